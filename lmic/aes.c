@@ -20,6 +20,10 @@ u4_t os_aes (u1_t mode, u1_t* buf, u2_t len) {
     return HAL_boottab->aes(mode, buf, len, AESKEY, AESAUX);
 }
 
+#elif defined(CFG_aes_hw)
+
+// os_aes() provided by HAL
+
 #else
 
 #define AES_MICSUB 0x30 // internal use only
@@ -48,6 +52,7 @@ static const u1_t AES_S[256] = {
   0x8C, 0xA1, 0x89, 0x0D, 0xBF, 0xE6, 0x42, 0x68, 0x41, 0x99, 0x2D, 0x0F, 0xB0, 0x54, 0xBB, 0x16,
 };
 
+#if !defined(CFG_aes_small)
 static const u4_t AES_E1[256] = {
   0xC66363A5, 0xF87C7C84, 0xEE777799, 0xF67B7B8D, 0xFFF2F20D, 0xD66B6BBD, 0xDE6F6FB1, 0x91C5C554, 
   0x60303050, 0x02010103, 0xCE6767A9, 0x562B2B7D, 0xE7FEFE19, 0xB5D7D762, 0x4DABABE6, 0xEC76769A, 
@@ -187,6 +192,7 @@ static const u4_t AES_E4[256] = {
   0x8C8C8F03, 0xA1A1F859, 0x89898009, 0x0D0D171A, 0xBFBFDA65, 0xE6E631D7, 0x4242C684, 0x6868B8D0, 
   0x4141C382, 0x9999B029, 0x2D2D775A, 0x0F0F111E, 0xB0B0CB7B, 0x5454FCA8, 0xBBBBD66D, 0x16163A2C, 
 };
+#endif
 
 #define msbf4_read(p)    ((p)[0]<<24 | (p)[1]<<16 | (p)[2]<<8 | (p)[3])
 #define msbf4_write(p,v) (p)[0]=(v)>>24,(p)[1]=(v)>>16,(p)[2]=(v)>>8,(p)[3]=(v)
@@ -194,6 +200,55 @@ static const u4_t AES_E4[256] = {
 
 #define u1(v)                       ((u1_t)(v))
 
+#if defined(CFG_aes_small)
+
+// Compact implementation using only the S-box, MixColumns is computed on the fly
+// (four bytes in parallel). Saves 4 KB of tables at the expense of speed.
+
+#define rotl(x,n)   (((x) << (n)) | ((x) >> (32-(n))))
+#define xtime4(x)   ((((x) & 0x7F7F7F7F) << 1) ^ ((((x) >> 7) & 0x01010101) * 0x1B))
+
+#define AES_subshift(r0,r1,r2,r3)   ((AES_S[   r0>>24 ]<<24) | \
+                                     (AES_S[u1(r1>>16)]<<16) | \
+                                     (AES_S[u1(r2>> 8)]<< 8) | \
+                                      AES_S[u1(r3)    ])
+
+static u4_t mixcolumn (u4_t x) {
+    u4_t y = rotl(x, 8);
+    return xtime4(x ^ y) ^ y ^ rotl(x, 16) ^ rotl(x, 24);
+}
+
+// encrypt block in s[0-3] (MSBF words) with roundkeys ki
+__hotcode static void aesencblock (u4_t* s, const u4_t* ki) {
+    u4_t a0 = s[0] ^ ki[0];
+    u4_t a1 = s[1] ^ ki[1];
+    u4_t a2 = s[2] ^ ki[2];
+    u4_t a3 = s[3] ^ ki[3];
+    for( int r = 1; r <= 10; r++ ) {
+        u4_t t0 = AES_subshift(a0,a1,a2,a3);
+        u4_t t1 = AES_subshift(a1,a2,a3,a0);
+        u4_t t2 = AES_subshift(a2,a3,a0,a1);
+        u4_t t3 = AES_subshift(a3,a0,a1,a2);
+        if( r < 10 ) {
+            t0 = mixcolumn(t0);
+            t1 = mixcolumn(t1);
+            t2 = mixcolumn(t2);
+            t3 = mixcolumn(t3);
+        }
+        ki += 4;
+        a0 = t0 ^ ki[0];
+        a1 = t1 ^ ki[1];
+        a2 = t2 ^ ki[2];
+        a3 = t3 ^ ki[3];
+    }
+    s[0] = a0;
+    s[1] = a1;
+    s[2] = a2;
+    s[3] = a3;
+}
+
+#else
+
 #define AES_key4(r1,r2,r3,r0,i)    r1 = ki[i+1]; \
                                    r2 = ki[i+2]; \
                                    r3 = ki[i+3]; \
@@ -210,17 +265,19 @@ static const u4_t AES_E4[256] = {
                                    a ^= (AES_S[u1(r2>> 8)]<< 8); \
                                    a ^=  AES_S[u1(r3)    ]
 
+#endif
+
 // generate 1+10 roundkeys for encryption with 128-bit key
-// read 128-bit key from AESKEY in MSBF, generate roundkey words in place
-static void aesroundkeys () {
+// read 128-bit key from rk in MSBF, generate roundkey words in place
+static void aesroundkeys (u4_t* rk) {
     int i;
     u4_t b;
 
     for( i=0; i<4; i++) {
-        AESKEY[i] = swapmsbf(AESKEY[i]);
+        rk[i] = swapmsbf(rk[i]);
     }
     
-    b = AESKEY[3];
+    b = rk[3];
     for( ; i<44; i++ ) {
         if( i%4==0 ) {
             // b = SubWord(RotWord(b)) xor Rcon[i/4]
@@ -230,15 +287,71 @@ static void aesroundkeys () {
                 (AES_S[   b >> 24 ]      ) ^
                  AES_RCON[(i-4)/4];
         }
-        AESKEY[i] = b ^= AESKEY[i-4];
+        rk[i] = b ^= rk[i-4];
+    }
+}
+
+#if defined(CFG_aes_keycache)
+
+#ifndef AES_KEYCACHE_SZ
+#if defined(CFG_aes_keycache_mc)
+#include "lce.h"
+// NwkSKey (up/down) + AppSKey, and NwkSKeyDn + AppSKey per multicast group
+#define AES_KEYCACHE_SZ (3 + 2*LCE_MCGRP_MAX)
+#else
+#define AES_KEYCACHE_SZ 3 // NwkSKey (up/down) + AppSKey
+#endif
+#endif
+
+static struct {
+    struct {
+        const u1_t* key;        // address of key (NULL if unused)
+        u4_t rk[44];            // expanded roundkeys
+    } slot[AES_KEYCACHE_SZ];
+    u4_t* rk;                   // roundkeys for next os_aes() call
+    unsigned int next;          // next slot to replace
+} keycache;
+
+void os_aesSetKey (const u1_t* key) {
+    int i;
+    for( i = 0; i < AES_KEYCACHE_SZ; i++ ) {
+        if( keycache.slot[i].key == key ) {
+            keycache.rk = keycache.slot[i].rk;
+            return;
+        }
     }
+    i = keycache.next;
+    keycache.next = (i + 1) % AES_KEYCACHE_SZ;
+    keycache.slot[i].key = key;
+    memcpy(keycache.slot[i].rk, key, 16);
+    aesroundkeys(keycache.slot[i].rk);
+    keycache.rk = keycache.slot[i].rk;
+}
+
+void os_aesFlushKeys (void) {
+    memset(&keycache, 0, sizeof(keycache));
 }
 
+#endif
+
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
-u4_t os_aes (u1_t mode, u1_t* buf, u2_t len) {
-        
-        aesroundkeys();
+#if defined(CFG_aes_small)
+#define __aes_hotcode // rounds are in aesencblock()
+#else
+#define __aes_hotcode __hotcode
+#endif
+__aes_hotcode u4_t os_aes (u1_t mode, u1_t* buf, u2_t len) {
+        u4_t* rk;
+
+#if defined(CFG_aes_keycache)
+        if( (rk = keycache.rk) != NULL ) { // key schedule from cache
+            keycache.rk = NULL;
+        } else
+#endif
+        {
+            aesroundkeys(rk = AESKEY);
+        }
 
         if( mode & AES_MICNOAUX ) {
             AESAUX[0] = AESAUX[1] = AESAUX[2] = AESAUX[3] = 0;
@@ -251,8 +364,11 @@ u4_t os_aes (u1_t mode, u1_t* buf, u2_t len) {
 
         while( (s2_t)len > 0 ) {
             u4_t a0, a1, a2, a3;
-            u4_t t0, t1, t2, t3;
+            u4_t t0, t1;
+#if !defined(CFG_aes_small)
+            u4_t t2, t3;
             u4_t *ki, *ke;
+#endif
 
             // load input block
             if( (mode & AES_CTR) || ((mode & AES_MIC) && (mode & AES_MICNOAUX)==0) ) { // load CTR block or first MIC block
@@ -284,7 +400,17 @@ u4_t os_aes (u1_t mode, u1_t* buf, u2_t len) {
             }
 
             // perform AES encryption on block in a0-a3
-            ki = AESKEY;
+#if defined(CFG_aes_small)
+            {
+                u4_t st[4] = { a0, a1, a2, a3 };
+                aesencblock(st, rk);
+                a0 = st[0];
+                a1 = st[1];
+                a2 = st[2];
+                a3 = st[3];
+            }
+#else
+            ki = rk;
             ke = ki + 8*4;
             a0 ^= ki[0];
             a1 ^= ki[1];
@@ -314,6 +440,7 @@ u4_t os_aes (u1_t mode, u1_t* buf, u2_t len) {
             AES_expr(a1,t1,t2,t3,t0,9);
             AES_expr(a2,t2,t3,t0,t1,10);
             AES_expr(a3,t3,t0,t1,t2,11);
+#endif
             // result of AES encryption in a0-a3
 
             if( mode & AES_MIC ) {
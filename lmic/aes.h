@@ -28,4 +28,15 @@ extern u1_t* AESaux;
 u4_t os_aes (u1_t mode, u1_t* buf, u2_t len);
 #endif
 
+// Key schedule cache: os_aesSetKey() loads the key for the next os_aes() call.
+// The key must reside in stable storage, since its address identifies the
+// cached key schedule; os_aesFlushKeys() must be called when keys change.
+#if defined(CFG_aes_keycache) && !defined(CFG_aes_hw) && !(defined(CFG_bootloader) && defined(CFG_bootloader_aes))
+void os_aesSetKey (const u1_t* key);
+void os_aesFlushKeys (void);
+#else
+#define os_aesSetKey(key) os_copyMem(AESkey, (key), 16)
+#define os_aesFlushKeys() do { } while( 0 )
+#endif
+
 #endif // _aes_h_
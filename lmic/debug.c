@@ -18,8 +18,31 @@ void debug_str (const char* str) {
     hal_debug_str(str);
 }
 
+static const char hexdigits[16] = "0123456789ABCDEF";
+
+// Divide by 10 without division or multiplication (Hacker's Delight, divu10),
+// Cortex-M0+ has no hardware divider.
+static inline unsigned int divu10 (unsigned int n) {
+    unsigned int q = (n >> 1) + (n >> 2);
+    q += q >> 4;
+    q += q >> 8;
+    q += q >> 16;
+    q >>= 3;
+    unsigned int r = n - ((q << 3) + (q << 1));
+    return q + ((r + 6) >> 4);
+}
+
+// write byte as two hex digits
+static inline char* hex2 (char* p, unsigned int b) {
+    p[0] = hexdigits[(b >> 4) & 0xF];
+    p[1] = hexdigits[b & 0xF];
+    return p + 2;
+}
+
+// base must be 2, 10 or 16
 static int itoa (char* buf, unsigned int val, int base, int mindigits, int exp, int prec, char sign) {
     char num[33], *p = num, *b = buf;
+    int shift = (base == 16) ? 4 : (base == 2) ? 1 : 0;
     if (sign) {
 	if ((int) val < 0) {
 	    val = -val;
@@ -32,10 +55,18 @@ static int itoa (char* buf, unsigned int val, int base, int mindigits, int exp,
 	mindigits = 32;
     }
     do {
-	int m = val % base;
-        *p++ = (m <= 9) ? m + '0' : m - 10 + 'A';
+	unsigned int m;
+	if (shift) {
+	    m = val & (base - 1);
+	    val >>= shift;
+	} else {
+	    unsigned int q = divu10(val);
+	    m = val - ((q << 3) + (q << 1));
+	    val = q;
+	}
+	*p++ = hexdigits[m];
 	if (p - num == exp) *p++ = '.';
-    } while ( (val /= base) || p - num < mindigits );
+    } while ( val || p - num < mindigits );
     do {
 	*b++ = *--p;
     } while (p > num + exp - prec);
@@ -178,7 +209,7 @@ static int debug_vsnprintf(char *str, int size, const char *format, va_list arg)
 		    char buf[23], *p = buf;
 		    unsigned char *eui = va_arg(arg, unsigned char *);
 		    for (int i = 7; i >= 0; i--) {
-			p += itoa(p, eui[i], 16, 2, 0, 0, 0);
+			p = hex2(p, eui[i]);
 			if (i) *p++ = '-';
 		    }
 		    dst += strpad(dst, end - dst, buf, 23, width, left, ' ');
@@ -187,9 +218,11 @@ static int debug_vsnprintf(char *str, int size, const char *format, va_list arg)
 		case 't':   // ostime_t  (hh:mm:ss.mmm)
 		case 'T': { // osxtime_t (ddd.hh:mm:ss)
 		    char buf[12], *p = buf;
-		    uint64_t t = ((c == 'T') ? va_arg(arg, uint64_t) : va_arg(arg, uint32_t)) * 1000 / OSTICKS_PER_SEC;
-		    int ms = t % 1000;
-		    t /= 1000;
+		    // (split off seconds first, the remainder is 32-bit arithmetic)
+		    uint64_t ticks = (c == 'T') ? va_arg(arg, uint64_t) : va_arg(arg, uint32_t);
+		    uint64_t secs = ticks / OSTICKS_PER_SEC;
+		    int ms = (uint32_t) (ticks - secs * OSTICKS_PER_SEC) * 1000 / OSTICKS_PER_SEC;
+		    uint32_t t = secs;
 		    int sec = t % 60;
 		    t /= 60;
 		    int min = t % 60;
@@ -219,7 +252,7 @@ static int debug_vsnprintf(char *str, int size, const char *format, va_list arg)
 		    char *top = (prec == 0 || dst + prec > end) ? end : dst + prec;
 		    while (len--) {
 			if ((len == 0 && top - dst >= 2) || top - dst >= 2 + space + 2) {
-			    dst += itoa(dst, *buf++, 16, 2, 0, 0, 0);
+			    dst = hex2(dst, *buf++);
 			    if(space && len && dst < top) *dst++ = ' ';
 			} else {
 			    while (dst < top) *dst++ = '.';
@@ -0,0 +1,77 @@
+// Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#ifdef CFG_evlog
+
+#include "lmic.h"
+
+// size of ring in words (must be a power of two)
+#ifndef EVLOG_SZ
+#define EVLOG_SZ	256
+#endif
+
+#if (EVLOG_SZ & (EVLOG_SZ - 1)) != 0
+#error "EVLOG_SZ must be a power of two"
+#endif
+
+#define EVLOG_HDR(tok,n)	(((u4_t) (n) << 24) | ((tok) & 0xffffff))
+#define EVLOG_LEN(hdr)		(2 + (((hdr) >> 24) & 0xff))
+#define EVLOG_IDX(i)		((i) & (EVLOG_SZ - 1))
+
+static struct {
+    u4_t buf[EVLOG_SZ];
+    u2_t rd, wr;
+    u4_t lost;		// records overwritten since last read
+} evlog;
+
+// reported on read when records were overwritten (first string in section)
+static const char evlog_lostfmt[] __attribute__((section(".evlog.0"), used)) = "[%u records lost]";
+
+static int used (void) {
+    return EVLOG_IDX(evlog.wr - evlog.rd);
+}
+
+void evlog_put (u4_t token, const u4_t* args, int nargs) {
+    ASSERT(nargs <= EVLOG_MAXARGS);
+    hal_disableIRQs();
+    // drop oldest records to make room
+    while( EVLOG_SZ - 1 - used() < 2 + nargs ) {
+	evlog.rd = EVLOG_IDX(evlog.rd + EVLOG_LEN(evlog.buf[evlog.rd]));
+	evlog.lost += 1;
+    }
+    int wr = evlog.wr;
+    evlog.buf[wr] = EVLOG_HDR(token, nargs);
+    evlog.buf[wr = EVLOG_IDX(wr + 1)] = os_getTime();
+    for( int i = 0; i < nargs; i++ ) {
+	evlog.buf[wr = EVLOG_IDX(wr + 1)] = args[i];
+    }
+    evlog.wr = EVLOG_IDX(wr + 1);
+    hal_enableIRQs();
+}
+
+int evlog_read (u4_t* buf, int maxwords) {
+    int n = 0;
+    hal_disableIRQs();
+    if( evlog.lost && maxwords >= 3 ) {
+	buf[n++] = EVLOG_HDR((uintptr_t) evlog_lostfmt, 1);
+	buf[n++] = os_getTime();
+	buf[n++] = evlog.lost;
+	evlog.lost = 0;
+    }
+    while( evlog.rd != evlog.wr ) {
+	int len = EVLOG_LEN(evlog.buf[evlog.rd]);
+	if( n + len > maxwords ) {
+	    break;
+	}
+	while( len-- > 0 ) {
+	    buf[n++] = evlog.buf[evlog.rd];
+	    evlog.rd = EVLOG_IDX(evlog.rd + 1);
+	}
+    }
+    hal_enableIRQs();
+    return n;
+}
+
+#endif
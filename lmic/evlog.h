@@ -0,0 +1,42 @@
+// Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#ifndef _evlog_h_
+#define _evlog_h_
+
+// Tokenized event log (flight recorder)
+//
+// EVLOG(fmt, ...) stores a record with the format string token, the current
+// time and up to EVLOG_MAXARGS 32-bit arguments in a RAM ring, overwriting
+// the oldest records when full. Format strings are placed in the non-loaded
+// section .evlog, i.e. they do not occupy flash; the token is the offset of
+// the string in that section. Recorded data is retrieved with evlog_read()
+// and decoded on the host using the firmware ELF file (tools/evlog).
+//
+// Record layout (words): hdr = nargs<<24 | token, time, args...
+
+#ifndef CFG_evlog
+
+#define EVLOG(fmt,...)			do { } while (0)
+
+#else
+
+#define EVLOG_MAXARGS	8
+
+#define EVLOG(fmt,...) do { \
+    static const char __evlog_fmt[] __attribute__((section(".evlog"), used)) = fmt; \
+    const u4_t __evlog_args[] = { 0, ## __VA_ARGS__ }; \
+    evlog_put((uintptr_t) __evlog_fmt, __evlog_args + 1, sizeof(__evlog_args) / sizeof(u4_t) - 1); \
+} while (0)
+
+// append record to log
+void evlog_put (u4_t token, const u4_t* args, int nargs);
+
+// copy and remove oldest complete records, returns number of words
+int evlog_read (u4_t* buf, int maxwords);
+
+#endif
+
+#endif
@@ -12,6 +12,15 @@
 #include HAL_IMPL_INC
 #endif
 
+// Timing-critical code can be run from RAM (if supported by the HAL and
+// enabled with CFG_fastcode) to avoid flash wait states. __fastcode (HAL)
+// always places code in RAM, __hotcode only if CFG_fastcode is set.
+#if defined(CFG_fastcode) && defined(__fastcode)
+#define __hotcode __fastcode
+#else
+#define __hotcode
+#endif
+
 /*
  * initialize hardware (IO, SPI, TIMER, IRQ).
  */
@@ -80,6 +89,20 @@ void hal_disableIRQs (void);
  */
 void hal_enableIRQs (void);
 
+#ifdef CFG_jobstats
+/*
+ * return longest section (in ticks) with interrupts disabled since last call and reset it.
+ */
+u4_t hal_irqoff_max (void);
+#endif
+
+#ifdef CFG_stackmon
+/*
+ * return lowest address the stack can grow down to (end of static data).
+ */
+void* hal_stack_limit (void);
+#endif
+
 /*
  * put system and CPU in low-power mode, sleep until target time / interrupt.
  */
@@ -87,6 +110,43 @@ void hal_enableIRQs (void);
 #define HAL_SLEEP_APPROX	1
 void hal_sleep (u1_t type, u4_t targettime);
 
+#ifdef CFG_runspeed
+/*
+ * set MCU clock speed for subsequent code (until changed or reset to full).
+ * reduced speeds are only a request, the HAL may stay at or return to full
+ * speed if clock-dependent peripherals are in use.
+ */
+enum {
+    HAL_RUNSPEED_FULL,          // full speed
+    HAL_RUNSPEED_REDUCED,       // reduced speed (e.g. no PLL)
+    HAL_RUNSPEED_LOW,           // low speed
+};
+void hal_setRunSpeed (u1_t speed);
+#endif
+
+#ifdef CFG_boottrace
+/*
+ * record boot stage completion (microseconds since start of hal_init).
+ * stages not covered by a HAL are left at zero. the last stage stops the trace.
+ */
+enum {
+    HAL_BOOT_CLOCK,             // system clock running
+    HAL_BOOT_IO,                // personalization data, pins, SPI
+    HAL_BOOT_TIMER,             // LSE and system timer running
+    HAL_BOOT_PERIPH,            // LEDs, debug, perso
+    HAL_BOOT_EEFS,              // file system and restore hooks
+    HAL_BOOT_RADIO,             // radio reset
+    HAL_BOOT_LMIC,              // MAC initialized
+    HAL_BOOT_APP,               // application start
+    HAL_BOOT_CNT
+};
+void hal_boottrace_mark (int stage);
+const u4_t* hal_boottrace (void);
+#define BOOTTRACE(stage) hal_boottrace_mark(stage)
+#else
+#define BOOTTRACE(stage) do { } while( 0 )
+#endif
+
 /*
  * return 32-bit system time in ticks.
  */
@@ -144,6 +204,8 @@ void hal_fwinfo (hal_fwi* fwi);
 
 void hal_pd_init (void);
 bool hal_pd_valid (void);
+bool hal_pd_reload (int off, int len);
+u4_t hal_pd_gen (void);
 u1_t* hal_joineui (void);
 u1_t* hal_deveui (void);
 u1_t* hal_nwkkey (void);
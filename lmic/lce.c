@@ -38,6 +38,7 @@ bool lce_processJoinAccept (u1_t* jacc, u1_t jacclen, u2_t devnonce) {
     if( mic1 != mic2 ) {
         return 0;
     }
+    os_aesFlushKeys(); // session keys are replaced
     u1_t* nwkskey = LMIC.lceCtx.nwkSKey;
     os_clearMem(nwkskey, 16);
     nwkskey[0] = 0x01;
@@ -105,7 +106,7 @@ bool lce_verifyMic (s1_t keyid, u4_t devaddr, u4_t seqno, u1_t* pdu, int len) {
         // Illegal key index
         return 0;
     }
-    os_copyMem(AESkey,key,16);
+    os_aesSetKey(key);
     return os_aes(AES_MIC, pdu, len) == os_rmsbf4(pdu+len);
 }
 
@@ -114,8 +115,7 @@ void lce_addMic (s1_t keyid, u4_t devaddr, u4_t seqno, u1_t* pdu, int len) {
         return; // Illegal key index
     }
     micB0(devaddr, seqno, 0, len);
-    const u1_t* key = LMIC.lceCtx.nwkSKey;
-    os_copyMem(AESkey,key,16);
+    os_aesSetKey(LMIC.lceCtx.nwkSKey);
     // MSB because of internal structure of AES
     os_wmsbf4(pdu+len, os_aes(AES_MIC, pdu, len));
 }
@@ -155,7 +155,7 @@ void lce_cipher (s1_t keyid, u4_t devaddr, u4_t seqno, int cat, u1_t* payload, i
     }
     micB0(devaddr, seqno, cat, 1);
     AESaux[0]  = 0x01;
-    os_copyMem(AESkey,key,16);
+    os_aesSetKey(key);
     os_aes(AES_CTR, payload, len);
 }
 
@@ -174,9 +174,57 @@ void lce_loadSessionKeys (const u1_t* nwkSKey, const u1_t* appSKey)
 #endif
     if( appSKey != (u1_t*)0 )
         os_copyMem(LMIC.lceCtx.appSKey, appSKey, 16);
+    os_aesFlushKeys();
+}
+
+void lce_loadMultiCastKeys (s1_t keyid, const u1_t* nwkSKeyDn, const u1_t* appSKey) {
+    ASSERT(keyid >= LCE_MCGRP_0 && keyid < LCE_MCGRP_0+LCE_MCGRP_MAX);
+    lce_ctx_mcgrp_t* grp = &LMIC.lceCtx.mcgroup[keyid - LCE_MCGRP_0];
+    if( nwkSKeyDn != (u1_t*)0 )
+        os_copyMem(grp->nwkSKeyDn, nwkSKeyDn, 16);
+    if( appSKey != (u1_t*)0 )
+        os_copyMem(grp->appSKey, appSKey, 16);
+    os_aesFlushKeys();
+}
+
+// Derive multicast session keys from encrypted McKey (LoRaWAN Remote
+// Multicast Setup v1.0.0): McRootKey is derived from GenAppKey (LoRaWAN1.0)
+// or AppKey (LoRaWAN1.1), McKEKey from McRootKey.
+void lce_deriveMultiCastKeys (u4_t mcaddr, const u1_t* mckeyenc, u1_t* nwkSKeyDn, u1_t* appSKey) {
+    u1_t key[16];
+    os_clearMem(key, 16);
+#if defined(CFG_lorawan11)
+    key[0] = 0x20;
+#endif
+    os_getAppKey(AESkey);
+    os_aes(AES_ENC, key, 16);            // McRootKey
+    os_copyMem(AESkey, key, 16);
+    os_clearMem(key, 16);
+    os_aes(AES_ENC, key, 16);            // McKEKey
+    os_copyMem(AESkey, key, 16);
+    os_copyMem(key, mckeyenc, 16);
+    os_aes(AES_ENC, key, 16);            // McKey
+    os_clearMem(nwkSKeyDn, 16);
+    nwkSKeyDn[0] = 0x02;
+    os_wlsbf4(nwkSKeyDn+1, mcaddr);
+    os_clearMem(appSKey, 16);
+    appSKey[0] = 0x01;
+    os_wlsbf4(appSKey+1, mcaddr);
+    os_copyMem(AESkey, key, 16);
+    os_aes(AES_ENC, nwkSKeyDn, 16);      // McNwkSKey
+    os_copyMem(AESkey, key, 16);
+    os_aes(AES_ENC, appSKey, 16);        // McAppSKey
+    os_clearMem(key, 16);
+}
+
+void lce_clearMultiCastKeys (s1_t keyid) {
+    ASSERT(keyid >= LCE_MCGRP_0 && keyid < LCE_MCGRP_0+LCE_MCGRP_MAX);
+    os_clearMem(&LMIC.lceCtx.mcgroup[keyid - LCE_MCGRP_0], sizeof(lce_ctx_mcgrp_t));
+    os_aesFlushKeys();
 }
 
 
 void lce_init (void) {
     os_clearMem(&LMIC.lceCtx, sizeof(LMIC.lceCtx));
+    os_aesFlushKeys();
 }
@@ -12,7 +12,14 @@
 #define LCE_APPSKEY   (-2)
 #define LCE_NWKSKEY   (-1)
 #define LCE_MCGRP_0   ( 0)
+#if defined(CFG_mcgrp_max)
+#define LCE_MCGRP_MAX (CFG_mcgrp_max)   // number of multicast groups (LMICCFG += mcgrp_max=N)
+#else
 #define LCE_MCGRP_MAX ( 2)
+#endif
+#if LCE_MCGRP_MAX < 1 || LCE_MCGRP_0+LCE_MCGRP_MAX > 127
+#error "LCE_MCGRP_MAX out of range"
+#endif
 
 // Stream cipher categories (lce_cipher(..,cat,..):
 // Distinct use of the AppSKey must use different key classes
@@ -37,6 +44,9 @@ void lce_loadSessionKeys (const u1_t* nwkSKey, const u1_t* nwkSKeyDn, const u1_t
 #else
 void lce_loadSessionKeys (const u1_t* nwkSKey, const u1_t* appSKey);
 #endif
+void lce_loadMultiCastKeys (s1_t keyid, const u1_t* nwkSKeyDn, const u1_t* appSKey);
+void lce_clearMultiCastKeys (s1_t keyid);
+void lce_deriveMultiCastKeys (u4_t mcaddr, const u1_t* mckeyenc, u1_t* nwkSKeyDn, u1_t* appSKey);
 void lce_init (void);
 
 
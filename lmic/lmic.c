@@ -12,6 +12,9 @@
 #endif // !defined(MINRX_SYMS)
 #define PAMBL_SYMS_BCN BCN_PREAMBLE_LEN
 #define PAMBL_SYMS     STD_PREAMBLE_LEN
+#if defined(CFG_rxwin_adapt) && !defined(RXWIN_MINSYMS)
+#define RXWIN_MINSYMS 5 // min RX symbols once clock skew is known
+#endif
 #define PAMBL_FSK  5
 #define PRERX_FSK  2
 #define RXLEN_FSK  (PRERX_FSK+5+3) // rx preamble and sync word
@@ -47,6 +50,17 @@ DECL_ON_LMIC_EVENT;
 static void engineUpdate(void);
 static void startScan (void);
 
+#if defined(CFG_engine_incr)
+// Changes relevant to engineUpdate which are not visible in opmode et al.
+enum {
+    ENG_CHMAP   = 0x01,   // channel map changed
+    ENG_JOB     = 0x02,   // LMIC.osjob cancelled
+};
+#define engineDirty(bits)   (LMIC.eng.dirty |= (bits))
+#else
+#define engineDirty(bits)   do { } while( 0 )
+#endif
+
 
 // ================================================================================
 // BEG OS - default implementations for certain OS suport functions
@@ -120,18 +134,17 @@ void os_wmsbf4 (u1_t* buf, u4_t v) {
 #endif
 
 #if !defined(os_crc16)
-// New CRC-16 CCITT(XMODEM) checksum for beacons:
+// New CRC-16 CCITT(XMODEM) checksum for beacons (polynomial 0x1021, nibble table)
+static const u2_t CRC16_TAB[16] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+    0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+};
+
 u2_t os_crc16 (u1_t* data, uint len) {
     u2_t remainder = 0;
-    u2_t polynomial = 0x1021;
     for( uint i = 0; i < len; i++ ) {
-        remainder ^= data[i] << 8;
-        for( u1_t bit = 8; bit > 0; bit--) {
-            if( (remainder & 0x8000) )
-                remainder = (remainder << 1) ^ polynomial;
-            else
-                remainder <<= 1;
-        }
+        remainder = (remainder << 4) ^ CRC16_TAB[(remainder >> 12) ^ (data[i] >> 4)];
+        remainder = (remainder << 4) ^ CRC16_TAB[(remainder >> 12) ^ (data[i] & 0xf)];
     }
     return remainder;
 }
@@ -249,6 +262,11 @@ static const region_t REGIONS[REGIONS_COUNT] = {
         .maxFreq        = 928000000,
         .defaultCh      = { 923200000, 923400000 },
         .chTxCap        = 10, // 10%
+#if defined(CFG_as923_lbt)
+        // ARIB STD-T108 (Japan): carrier sense 5ms, -80dBm
+        .ccaThreshold   = (-80 + RSSI_OFF),
+        .ccaTime        = us2osticks(5000),
+#endif
         .bands          = {
             { 0, 0, CAP_NONE,  16 }, // ==> no bands (XXX:bit of a hack)
         },
@@ -379,7 +397,12 @@ static const region_t REGIONS[REGIONS_COUNT] = {
 #endif
 };
 
+// Single-region builds resolve region parameters at compile time
+#if defined(REG_SINGLE)
+#define REGION          (REGIONS[0])
+#else
 #define REGION          (*LMIC.region)
+#endif
 #define isREGION(reg)   (&REGION == &REGIONS[REGION_##reg])
 
 #if defined(REG_FIX) && defined(REG_DYN)
@@ -390,7 +413,27 @@ static const region_t REGIONS[REGIONS_COUNT] = {
 #define REG_IS_FIX()    (0)
 #endif
 
+// Region functions are dispatched at runtime only if both channel plan
+// types are present, otherwise they are called directly (and can inline)
+#if defined(REG_FIX) && defined(REG_DYN)
 #define _call_rfunc(fn,...)     (REGION.rfuncs->fn(__VA_ARGS__))
+#else
+#if defined(REG_FIX)
+#define _rfunc(fn)              fn ## _fix
+#else
+#define _rfunc(fn)              fn ## _dyn
+#endif
+#define _call_rfunc(fn,...)     (_rfunc(fn)(__VA_ARGS__))
+static void     _rfunc(disableChannel) (u1_t chidx);
+static void     _rfunc(initDefaultChannels) (void);
+static void     _rfunc(prepareDn) ();
+static u1_t     _rfunc(applyChannelMap) (u1_t chpage, u2_t chmap, u2_t* dest);
+static u1_t     _rfunc(checkChannelMap) (u2_t* map);
+static void     _rfunc(syncDatarate) (void);
+static void     _rfunc(updateTx) (ostime_t txbeg);
+static ostime_t _rfunc(nextTx) (ostime_t now);
+static void     _rfunc(setBcnRxParams) (void);
+#endif
 #define disableChannel(...)     _call_rfunc( disableChannel, __VA_ARGS__)
 #define initDefaultChannels()   _call_rfunc( initDefaultChannels)
 #define prepareDn()             _call_rfunc( prepareDn)
@@ -486,82 +529,6 @@ static dr_t rps2dndr (rps_t rps) {
 // ================================================================================
 
 
-// ================================================================================
-// BEG LORA
-
-static const u1_t SENSITIVITY[7][3] = {
-    // ------------bw----------
-    // 125kHz    250kHz    500kHz
-    { 141-109,  141-109, 141-109 },  // FSK
-    { 141-127,  141-124, 141-121 },  // SF7
-    { 141-129,  141-126, 141-123 },  // SF8
-    { 141-132,  141-129, 141-126 },  // SF9
-    { 141-135,  141-132, 141-129 },  // SF10
-    { 141-138,  141-135, 141-132 },  // SF11
-    { 141-141,  141-138, 141-135 }   // SF12
-};
-
-int getSensitivity (rps_t rps) {
-    return -141 + SENSITIVITY[getSf(rps)][getBw(rps)];
-}
-
-ostime_t calcAirTime (rps_t rps, u1_t plen) {
-    u1_t bw = getBw(rps);  // 0,1,2 = 125,250,500kHz
-    u1_t sf = getSf(rps);  // 0=FSK, 1..6 = SF7..12
-    if( sf == FSK ) {
-        return (plen+/*preamble*/5+/*syncword*/3+/*len*/1+/*crc*/2) * /*bits/byte*/8
-            * (s4_t)OSTICKS_PER_SEC / /*kbit/s*/50000;
-    }
-    u1_t sfx = 4*(sf+(7-SF7));
-    u1_t q = sfx - 8*enDro(rps);
-    int tmp = 8*plen - sfx + 28 + (getNocrc(rps)?0:16) - (getIh(rps)?20:0);
-    if( tmp > 0 ) {
-        tmp = (tmp + q - 1) / q;
-        tmp *= getCr(rps)+5;
-        tmp += 8;
-    } else {
-        tmp = 8;
-    }
-    tmp = (tmp<<2) + /*preamble*/49 /* 4 * (8 + 4.25) */;
-    // bw = 125000 = 15625 * 2^3
-    //      250000 = 15625 * 2^4
-    //      500000 = 15625 * 2^5
-    // sf = 7..12
-    //
-    // osticks =  tmp * OSTICKS_PER_SEC * 1<<sf / bw
-    //
-    // 3 => counter reduced divisor 125000/8 => 15625
-    // 2 => counter 2 shift on tmp
-    sfx = sf+(7-SF7) - (3+2) - bw;
-    int div = 15625;
-    if( sfx > 4 ) {
-        // prevent 32bit signed int overflow in last step
-        div >>= sfx-4;
-        sfx = 4;
-    }
-    // Need 32bit arithmetic for this last step
-    return (((ostime_t)tmp << sfx) * OSTICKS_PER_SEC + div/2) / div;
-}
-
-extern inline sf_t  getSf    (rps_t params);
-extern inline rps_t setSf    (rps_t params, sf_t sf);
-extern inline bw_t  getBw    (rps_t params);
-extern inline rps_t setBw    (rps_t params, bw_t cr);
-extern inline cr_t  getCr    (rps_t params);
-extern inline rps_t setCr    (rps_t params, cr_t cr);
-extern inline int   getNocrc (rps_t params);
-extern inline rps_t setNocrc (rps_t params, int nocrc);
-extern inline int   getIh    (rps_t params);
-extern inline rps_t setIh    (rps_t params, int ih);
-extern inline rps_t makeRps  (sf_t sf, bw_t bw, cr_t cr, int ih, int nocrc);
-extern inline int   sameSfBw (rps_t r1, rps_t r2);
-extern inline int   enDro    (rps_t params);
-
-
-// END LORA
-// ================================================================================
-
-
 #if defined(CFG_lorawan11)
 static void incPollcnt (void) {
     u1_t c = LMIC.pollcnt;
@@ -593,9 +560,85 @@ static ostime_t dr2hsym (dr_t dr, s1_t num) {
     return us2osticks(us);
 }
 
+#if defined(CFG_bcn_predict)
+// Beacon drift predictor
+//
+// The drift measured at each received beacon is kept for the last BCN_HIST
+// beacons, normalized by the external compensation in effect (e.g. a
+// temperature model of the crystal, see LMIC_setDriftComp()). A linear
+// least-squares fit over these measurements predicts the drift of the
+// following beacon periods, so that beacon and ping slots stay aligned
+// through missed beacons. Windows are only widened by the residual of the
+// fit instead of the largest drift difference ever seen.
+
+// Evaluate fit 'ahead' beacon periods after last received beacon, optionally
+// return max. residual.
+static s2_t bdpFit (int ahead, s2_t* presid) {
+    int n = LMIC.bdp.n, i;
+    s8_t sx = 0, sy = 0, sxx = 0, sxy = 0;
+    for( i = 0; i < n; i++ ) {
+        s8_t x = -(s8_t)(u1_t)(LMIC.bdp.base - LMIC.bdp.per[i]);
+        sx += x;
+        sy += LMIC.bdp.drift[i];
+        sxx += x * x;
+        sxy += x * LMIC.bdp.drift[i];
+    }
+    s8_t d = n * sxx - sx * sx;
+    if( n < 2 || d == 0 ) {
+        if( presid )
+            *presid = 0;
+        return n ? LMIC.bdp.drift[0] : LMIC.drift;
+    }
+    // y(x) = (sy*d + b*(n*x - sx)) / (n*d) with b = n*sxy - sx*sy
+    s8_t b = n * sxy - sx * sy;
+    if( presid ) {
+        s2_t resid = 0;
+        for( i = 0; i < n; i++ ) {
+            s8_t x = -(s8_t)(u1_t)(LMIC.bdp.base - LMIC.bdp.per[i]);
+            s4_t r = LMIC.bdp.drift[i] - (s4_t)((sy * d + b * (n * x - sx)) / (n * d));
+            if( r < 0 ) r = -r;
+            if( r > resid ) resid = (r > 0x7fff) ? 0x7fff : r;
+        }
+        *presid = resid;
+    }
+    return (s2_t)((sy * d + b * (n * (s8_t)ahead - sx)) / (n * d));
+}
+
+// Predicted drift of beacon period 'ahead' periods after last received beacon
+static s2_t bdpPredict (int ahead) {
+    return bdpFit(ahead, NULL) + LMIC.bdp.comp;
+}
+
+// Add measured drift (average over 'span' periods ending with current beacon)
+static void bdpAdd (s2_t drift, int span) {
+    os_moveMem(&LMIC.bdp.drift[1], &LMIC.bdp.drift[0], (BCN_HIST-1) * sizeof(LMIC.bdp.drift[0]));
+    os_moveMem(&LMIC.bdp.per[1], &LMIC.bdp.per[0], (BCN_HIST-1) * sizeof(LMIC.bdp.per[0]));
+    LMIC.bdp.base = LMIC.bcninfo.time >> BCN_INTV_exp;
+    LMIC.bdp.drift[0] = drift - LMIC.bdp.comp;
+    LMIC.bdp.per[0] = LMIC.bdp.base - (span >> 1);  // middle of span
+    if( LMIC.bdp.n < BCN_HIST )
+        LMIC.bdp.n += 1;
+    bdpFit(0, &LMIC.bdp.resid);
+}
+
+void LMIC_setDriftComp (s2_t comp) {
+    LMIC.bdp.comp = comp;
+}
+#endif
+
+#if defined(CFG_rxwin_adapt)
+static s4_t evalRxdErr (u4_t* span); // fwd decl
+#endif
+
 static ostime_t calcRxWindow (u1_t secs, dr_t dr) {
     ostime_t rxoff, err;
 
+#if defined(CFG_bcn_predict)
+    // assume residual of drift fit (or max wobble) for missed bcn periods
+    if( LMIC.bdp.n > 2 ) {
+        err = (ostime_t)(LMIC.bdp.resid > LMIC.lastDriftDiff ? LMIC.bdp.resid : LMIC.lastDriftDiff) * LMIC.missedBcns;
+    } else
+#endif
     // assume max wobble for missed bcn periods
     err = (ostime_t)LMIC.maxDriftDiff * LMIC.missedBcns;
     if( secs==0 ) {
@@ -606,12 +649,24 @@ static ostime_t calcRxWindow (u1_t secs, dr_t dr) {
     } else {
         // scheduled RX window within secs into current beacon period
         rxoff  = dr2hsym(dr, PAMBL_SYMS);
-        rxoff += (LMIC.drift * (ostime_t)secs) >> BCN_INTV_exp;
-        err   += (LMIC.lastDriftDiff * (ostime_t)secs) >> BCN_INTV_exp;
+#if defined(CFG_rxwin_adapt)
+        if( (LMIC.bcninfo.flags & BCN_NODDIFF) && LMIC.rxdErrCnt >= RXDERR_NUM ) {
+            // no drift measured across beacons yet: use skew and span of class A windows
+            u4_t span;
+            s4_t skew = evalRxdErr(&span);
+            rxoff += (skew * (ostime_t)secs) >> RXDERR_SHIFT;
+            err   += (span * secs) >> RXDERR_SHIFT;
+        } else
+#endif
+        {
+            rxoff += (LMIC.drift * (ostime_t)secs) >> BCN_INTV_exp;
+            err   += (LMIC.lastDriftDiff * (ostime_t)secs) >> BCN_INTV_exp;
+        }
     }
     // std RX window, enlarged by drift wobble
     ostime_t hsym = dr2hsym(dr,1);   // 1 symbol in ticks
     u4_t rxsyms = MINRX_SYMS + (err+hsym-1) / hsym;  // ceil syms
+    LMIC.rxsyms = rxsyms > 255 ? 255 : rxsyms;
     // rxoff is the center of the beacon preamble adjusted by drift
     // rxsyms is the width of the rx window
     // limit for dr2hsym/rxsym: s1_t
@@ -626,11 +681,29 @@ static void calcBcnRxWindowFromMillis (u1_t ms, bit_t ini) {
         LMIC.maxDriftDiff = 0;
         LMIC.missedBcns = 0;
         LMIC.bcninfo.flags |= BCN_NODRIFT|BCN_NODDIFF;
+#if defined(CFG_bcn_predict)
+        LMIC.bdp.n = 0;
+        LMIC.bdp.sum = 0;
+#endif
     }
     ostime_t hsym = dr2hsym(REGION.beaconDr, 1);
     ostime_t cpre = dr2hsym(REGION.beaconDr,
             PAMBL_SYMS_BCN);                             // offset: center preamble
-    int wsyms = (ms2osticksCeil(ms) + hsym - 1) / hsym;  // len RX span (2*ms) in syms (ceil)
+    ostime_t tol = ms2osticksCeil(ms);
+#if defined(CFG_rxwin_adapt)
+    // pure clock drift tolerance: use measured skew and span instead
+    if( ms == BCN_100PPM_ms && LMIC.rxdErrCnt >= RXDERR_NUM ) {
+        u4_t span;
+        s4_t skew = evalRxdErr(&span);
+        ostime_t dtol = ((span * BCN_INTV_sec) >> RXDERR_SHIFT) + hsym;
+        if( dtol < tol ) {
+            tol = dtol;
+            LMIC.drift = (skew * BCN_INTV_sec) >> RXDERR_SHIFT;
+            cpre += LMIC.drift;
+        }
+    }
+#endif
+    int wsyms = (tol + hsym - 1) / hsym;  // len RX span (2*ms) in syms (ceil)
     if( wsyms < MINRX_SYMS ) wsyms = MINRX_SYMS;         // no smaller than min
     ostime_t whspan = dr2hsym(REGION.beaconDr, wsyms);  // half RX span in osticks
     LMIC.bcnRxsyms = wsyms;
@@ -645,6 +718,9 @@ static void iniRxdErr () {
     for( u1_t u=RXDERR_NUM&0; u<RXDERR_NUM; u++ )
         LMIC.rxdErrs[u] = (us2osticksCeil(RXDERR_INI) << (RXDERR_SHIFT-1)) * (u&1?-1:1);
     LMIC.rxdErrIdx = 0;
+#if defined(CFG_rxwin_adapt)
+    LMIC.rxdErrCnt = 0;
+#endif
 }
 
 static void addRxdErr (u1_t rxdelay) {
@@ -653,6 +729,10 @@ static void addRxdErr (u1_t rxdelay) {
         return;
     LMIC.rxdErrs[LMIC.rxdErrIdx] = err;
     LMIC.rxdErrIdx = (LMIC.rxdErrIdx + 1) % RXDERR_NUM;
+#if defined(CFG_rxwin_adapt)
+    if( LMIC.rxdErrCnt < RXDERR_NUM )
+        LMIC.rxdErrCnt += 1;
+#endif
 }
 
 static s4_t evalRxdErr (u4_t* span) {
@@ -674,8 +754,16 @@ static s4_t evalRxdErr (u4_t* span) {
 }
 
 static void adjustByRxdErr (u1_t rxdelay, u1_t dr) {
-#ifdef CFG_testpin
-    // XXX: for now only in HW regr tests - not yet ready for prime time
+#if defined(CFG_rxwin_adapt)
+    // only once all initial worst-case samples have been replaced
+    if( LMIC.rxdErrCnt < RXDERR_NUM )
+        return;
+    // skew is compensated, so fewer symbols suffice to catch the preamble
+    LMIC.rxtime += dr2hsym(dr, MINRX_SYMS-RXWIN_MINSYMS);
+    LMIC.rxsyms -= MINRX_SYMS-RXWIN_MINSYMS;
+#endif
+#if defined(CFG_testpin) || defined(CFG_rxwin_adapt)
+    // shift window by measured skew, widen it by observed span
     u4_t span;
     s4_t skew = evalRxdErr(&span);
     LMIC.rxtime += (skew * rxdelay + (1<<(RXDERR_SHIFT-1))) >> RXDERR_SHIFT;
@@ -683,7 +771,7 @@ static void adjustByRxdErr (u1_t rxdelay, u1_t dr) {
     span /= dr2hsym(dr,1); // additional half symbols
     LMIC.rxsyms += (span + 1) >> 1;
     LMIC.rxtime -= span*hsym;
-#endif // CFG_testpin
+#endif // CFG_testpin || CFG_rxwin_adapt
 }
 
 
@@ -726,6 +814,25 @@ static bit_t rxschedNext (rxsched_t* rxsched, ostime_t cando) {
     goto again;
 }
 
+#if defined(CFG_ping_coalesce)
+// Adjacent ping slots: if the next slot of this beacon period starts within
+// PING_COALESCE_osticks after the upcoming RX ends, the radio is kept in
+// standby in between instead of being put to sleep and woken up again
+// (TCXO start-up, modem setup). The sleep governor of the HAL already
+// avoids the deep sleep modes for such short gaps.
+static void pingCoalesce (void) {
+    LMIC.radioStandby = 0;
+    if( getSf(dndr2rps(LMIC.ping.dr)) == FSK )
+        return;
+    u1_t rxsyms = LMIC.rxsyms;  // rxschedNext() clobbers LMIC.rxsyms
+    rxsched_t next = LMIC.ping;
+    ostime_t rxend = LMIC.rxtime + 2 * dr2hsym(LMIC.ping.dr, 1) * rxsyms;
+    if( rxschedNext(&next, rxend) && next.rxtime - RX_RAMPUP - rxend < PING_COALESCE_osticks )
+        LMIC.radioStandby = 1;
+    LMIC.rxsyms = rxsyms;
+}
+#endif
+
 
 static ostime_t rndDelay (u1_t secSpan) {
     u2_t r = os_getRndU2();
@@ -785,7 +892,7 @@ u1_t LMIC_setPingable (u1_t intvExp) {
 }
 
 
-static freq_t rdFreq (u1_t* p) {
+static freq_t rdFreq (const u1_t* p) {
     freq_t freq = ((p[2] << 16) | (p[1] << 8) | p[0]) * 100;
     if( freq != 0 && (freq < REGION.minFreq || freq > REGION.maxFreq) )
         return -1;
@@ -812,6 +919,27 @@ static dr_t prepareDnDr (dr_t updr) {
 
 #ifdef REG_DYN
 
+#if defined(CFG_dyn_index)
+// invalidate cached channel availability
+static void invalAvail_dyn (void) {
+    LMIC.dyn.idxDr = 0xff;
+}
+
+// rebuild per-datarate channel maps (after any channel or channel map change)
+static void updateChIndex_dyn (void) {
+    for( u1_t dr=0; dr < 16; dr++ ) {
+        u2_t map = 0;
+        for( u1_t ci=0; ci < MAX_DYN_CHNLS; ci++ ) {
+            if( (LMIC.dyn.channelMap & (1 << ci)) && (LMIC.dyn.chDrMap[ci] & (1 << dr)) ) {
+                map |= (1 << ci);
+            }
+        }
+        LMIC.dyn.drChMap[dr] = map;
+    }
+    invalAvail_dyn();
+}
+#endif
+
 static void prepareDn_dyn () {
     LMIC.dndr = prepareDnDr(LMIC.dndr);
     // Check reconfigured DN link freq
@@ -826,12 +954,16 @@ static void disableChannel_dyn (u1_t chidx) {
     LMIC.dyn.chDnFreq[chidx] = 0;
     LMIC.dyn.chDrMap [chidx] = 0;
     LMIC.dyn.channelMap &= ~(1 << chidx);
+    engineDirty(ENG_CHMAP);
     if (LMIC.dyn.channelMap == 0) {
         LMIC.dyn.channelMap = (1 << MIN_DYN_CHNLS) - 1; // safety net
         // XXX - won't the default channels have 0 as their freqency
         //       if they have been disabled in the past?
         //       I suspect the safety net is not needed anymore...
     }
+#if defined(CFG_dyn_index)
+    updateChIndex_dyn();
+#endif
 }
 
 static drmap_t all125up () {
@@ -872,7 +1004,12 @@ static bit_t setupChannel_dyn (u1_t chidx, freq_t freq, drmap_t drmap) {
     LMIC.dyn.chDnFreq[chidx] = 0;               // reset DN freq if channel is setup/modified
     LMIC.dyn.chDrMap[chidx] = drmap ?: all125up();
     setAvail(&LMIC.dyn.chAvail[chidx], 0);      // available right away
+    LMIC.dyn.chBusy[chidx] = 0;
     LMIC.dyn.channelMap |= 1 << chidx;          // enabled right away
+    engineDirty(ENG_CHMAP);
+#if defined(CFG_dyn_index)
+    updateChIndex_dyn();
+#endif
     return 1;
 }
 
@@ -882,6 +1019,9 @@ static void initDefaultChannels_dyn (void) {
     for (u1_t ch = 0; ch < MIN_DYN_CHNLS && REGION.defaultCh[ch]; ch++) {
         setupChannel_dyn(ch, REGION.defaultCh[ch], defaultDrMap);
     }
+#if defined(CFG_dyn_index)
+    updateChIndex_dyn();
+#endif
 }
 
 static u1_t applyChannelMap_dyn (u1_t chpage, u2_t chmap, u2_t* dest) {
@@ -960,26 +1100,22 @@ static void updateTx_dyn (ostime_t txbeg) {
     if (LMIC.globalDutyRate != 0) {
         LMIC.globalDutyAvail = txbeg + (airtime << LMIC.globalDutyRate);
     }
+#if defined(CFG_dyn_index)
+    invalAvail_dyn();
+#endif
 }
 
 static u1_t selectRandomChnl (u2_t map, u1_t nbits) {
-    u1_t k;
- again:
-    // Note: we have a small negligible bias of 2^16 % nbits (nbits <= 16 => bias < 0.025%)
-    k = os_getRndU2() % nbits;
-    for( u1_t chnl=0; chnl<16; chnl++ ) {
-        if( (map & (1<<chnl)) == 0 )
-            continue;
-        if( k==0 ) {
-            if( LMIC.refChnl == chnl && nbits > 1 )
-                goto again; // don't use same channel twice
-            LMIC.refChnl = chnl;
-            return chnl;
-        }
-        k--;
+    ASSERT(nbits > 0 && nbits == __builtin_popcount(map));
+    // don't use same channel twice (remove it from candidates instead of retrying)
+    if( nbits > 1 && LMIC.refChnl < 16 && (map & (1 << LMIC.refChnl)) ) {
+        map &= ~(1 << LMIC.refChnl);
+        nbits -= 1;
     }
-    ASSERT(0);
-    return 0;
+    // Note: we have a small negligible bias of 2^16 % nbits (nbits <= 16 => bias < 0.025%)
+    u1_t chnl = selectChnl(map, os_getRndU2() % nbits);
+    LMIC.refChnl = chnl;
+    return chnl;
 }
 
 // select channel, perform LBT if required
@@ -993,13 +1129,29 @@ static ostime_t nextTx_dyn (ostime_t now) {
     u1_t cccnt = 0; // number of candidate channels
     u2_t ccmap = 0; // candidate channel mask
     u2_t pcmap = 0; // probe channel mask
+#if defined(CFG_dyn_index)
+    // nothing becomes available before cached time (unchanged since last scan)
+    if( LMIC.dyn.idxDr == LMIC.datarate && !LMIC.noDC && xnow < LMIC.dyn.nextAvail ) {
+        return (ostime_t) LMIC.dyn.nextAvail;
+    }
+    u2_t enmap; // enabled channels for current datarate
+#endif
 again:
+#if defined(CFG_dyn_index)
+    enmap = LMIC.dyn.drChMap[LMIC.datarate];
+#endif
     for (u1_t chnl = 0; chnl < MAX_DYN_CHNLS; chnl++) {
         u2_t chnlbit = 1 << chnl;
+#if defined(CFG_dyn_index)
+        if ((enmap & chnlbit) == 0) {                           // channel disabled or not enabled for current datarate
+            continue;
+        }
+#else
         if ((LMIC.dyn.channelMap & chnlbit) == 0 ||             // channel disabled
                 (LMIC.dyn.chDrMap[chnl] & drbit) == 0) {        // or not enabled for current datarate
             continue;
         }
+#endif
         // check channel DC availability
         osxtime_t avail = getAvail(LMIC.dyn.chAvail[chnl]);
         // check band DC availability
@@ -1045,14 +1197,21 @@ again:
             if (REGION.ccaThreshold
                     && (((REGION.flags & REG_PSA) == 0) || pcmap & (1 << chnl))) {
                 // perform CCA
-                LMIC.rps = updr2rps(LMIC.datarate);
-                LMIC.freq = LMIC.dyn.chUpFreq[chnl] & ~BAND_MASK;
-                LMIC.rxtime = REGION.ccaTime;
-                LMIC.rssi = REGION.ccaThreshold;
-                os_radio(RADIO_CCA);
-                if (LMIC.rssi >= REGION.ccaThreshold) { // channel is not available
+                if (!os_cca(updr2rps(LMIC.datarate), LMIC.dyn.chUpFreq[chnl] & ~BAND_MASK)) {
+                    // channel is not available - back off exponentially with repeated busy results
+                    if (LMIC.dyn.chBusy[chnl] < LBT_BUSY_MAX) {
+                        LMIC.dyn.chBusy[chnl] += 1;
+                    }
+                    osxtime_t busy = xnow + (sec2osticks(1) << (LMIC.dyn.chBusy[chnl] - 1));
+                    if (getAvail(LMIC.dyn.chAvail[chnl]) < busy) {
+                        setAvail(&LMIC.dyn.chAvail[chnl], busy);
+#if defined(CFG_dyn_index)
+                        invalAvail_dyn();
+#endif
+                    }
                     goto unavailable;
                 }
+                LMIC.dyn.chBusy[chnl] >>= 1;
             } else {
                 // channel decision is stable (i.e. won't change even if not used immediately)
                 LMIC.opmode &= ~OP_NEXTCHNL; // XXX - not sure if that's necessary, since we only consider channels that can be used NOW
@@ -1067,6 +1226,12 @@ again:
         // Avoid being bombarded...
         txavail = os_getXTime() + ms2osticks(100);
     }
+#if defined(CFG_dyn_index)
+    else {
+        LMIC.dyn.nextAvail = txavail;
+        LMIC.dyn.idxDr = LMIC.datarate;
+    }
+#endif
     // Earliest duty cycle expiry or earliest time a channel might be tested again
     return (ostime_t) txavail;
 }
@@ -1084,16 +1249,94 @@ static void setBcnRxParams_dyn (void) {
 
 
 
+#if defined(CFG_join_backoff)
+// Join back-off (LoRaWAN 1.0.4): the aggregated airtime of join requests
+// since the first attempt is limited to 36s in the first hour, 36s in the
+// following 10 hours, and 8.7s per 24 hours after that. Once the budget of
+// the current window is used up, the next request is delayed to the start
+// of the next window plus a random jitter, so that devices which lost the
+// network at the same time do not all rejoin at once.
+
+static osxtime_t jboWindowEnd (u1_t win) {
+    u4_t secs = (win == 0) ? 3600 : 11*3600 + (u4_t) (win - 1) * 24*3600;
+    return LMIC.jbo.start + (osxtime_t) secs * OSTICKS_PER_SEC;
+}
+
+static void jboUpdateWindow (osxtime_t t) {
+    while( LMIC.jbo.win < 255 && t - jboWindowEnd(LMIC.jbo.win) >= 0 ) {
+        LMIC.jbo.win += 1;
+        LMIC.jbo.airtime = 0;
+        LMIC.jbo.next = 0;
+    }
+}
+
+static void jboStart (void) {
+    if( !LMIC.jbo.active ) {
+        LMIC.jbo.active = 1;
+        LMIC.jbo.start = os_getXTime();
+        LMIC.jbo.win = 0;
+        LMIC.jbo.airtime = 0;
+        LMIC.jbo.next = 0;
+    }
+}
+
+// Earliest time at or after txbeg for the next join request
+static ostime_t jboCheck (ostime_t txbeg) {
+    osxtime_t now = os_getXTime();
+    osxtime_t t = os_time2XTime(txbeg, now);
+    jboUpdateWindow(t);
+    ostime_t budget = (LMIC.jbo.win < 2) ? sec2osticks(36) : ms2osticks(8700);
+    ostime_t air = calcAirTime(setCr(updr2rps(LMIC.datarate), (cr_t)LMIC.errcr), LEN_JR);
+    if( LMIC.jbo.airtime + air > budget ) {
+        if( LMIC.jbo.next == 0 ) {
+            LMIC.jbo.next = jboWindowEnd(LMIC.jbo.win) + rndDelay(255);
+        }
+        t = LMIC.jbo.next;
+        // keep within ostime_t range, the engine will check again
+        if( t - now > sec2osticks(3600) ) {
+            t = now + sec2osticks(3600);
+        }
+    }
+    return (ostime_t) t;
+}
+
+void LMIC_getJoinBackoff (lmic_joinbo_t* jbo) {
+    jbo->active = LMIC.jbo.active;
+    jbo->elapsed = LMIC.jbo.active ? (os_getXTime() - LMIC.jbo.start) / OSTICKS_PER_SEC : 0;
+    jbo->airtime = osticks2ms(LMIC.jbo.airtime);
+    jbo->chnl = LMIC.jbo.chnl;
+}
+
+void LMIC_setJoinBackoff (const lmic_joinbo_t* jbo) {
+    LMIC.jbo.active = jbo->active;
+    LMIC.jbo.chnl = jbo->chnl;
+    if( jbo->active ) {
+        osxtime_t now = os_getXTime();
+        LMIC.jbo.start = now - (osxtime_t) jbo->elapsed * OSTICKS_PER_SEC;
+        LMIC.jbo.win = 0;
+        jboUpdateWindow(now);
+        LMIC.jbo.airtime = ms2osticks(jbo->airtime);
+        LMIC.jbo.next = 0;
+    }
+}
+#endif
+
 static void initJoinLoop (void) {
     initDefaultChannels();
     if( REG_IS_FIX() ) {
 #ifdef REG_FIX
         LMIC.refChnl = 0;
+#if defined(CFG_join_backoff)
+        LMIC.refChnl = LMIC.jbo.chnl % REGION.numChBlocks; // block of last successful join
+#endif
         LMIC.txChnl = LMIC.fix.hoplist[LMIC.refChnl];
         setDrJoin(DRCHG_SET, REGION.joinDr);
 #endif
     } else {
         LMIC.txChnl = 0; // XXX - join should use nextTx!
+#if defined(CFG_join_backoff) && defined(REG_DYN)
+        LMIC.txChnl = LMIC.jbo.chnl % MIN_DYN_CHNLS; // channel of last successful join
+#endif
         setDrJoin(DRCHG_SET, fastest125());
     }
     LMIC.txPowAdj = 0;
@@ -1453,6 +1696,11 @@ static void opmodePoll (void) {
 
 static void reportEvent (ev_t ev) {
     TRACE_EV(ev);
+#if defined(CFG_engine_stats) && defined(CFG_DEBUG)
+    if( ev == EV_TXCOMPLETE ) {
+        debug_printf("lmic: engine calls=%u evals=%u\r\n", LMIC.eng.calls, LMIC.eng.evals);
+    }
+#endif
     ON_LMIC_EVENT(ev);
     engineUpdate();
 }
@@ -1494,6 +1742,382 @@ static void stateJustJoined (void) {
 }
 
 
+// ================================================================================
+// MAC commands (downlink)
+//
+// Commands are processed in two passes: the first pass determines how many
+// of the commands are complete and known (processing stops at the first
+// unknown or truncated command), the second pass applies them. Each handler
+// is given the remaining (validated) command bytes and returns the number of
+// bytes consumed; this lets LinkADRReq process a contiguous block of
+// requests atomically.
+
+typedef int (*mcmdfn_t) (const u1_t* opt, int olen);
+
+typedef struct {
+    u1_t len;           // length including command byte (minimum if variable)
+    mcmdfn_t fn;
+} mcmd_t;
+
+// queue answer for next uplink (dropped if buffer is full)
+static void mcmdAns (u1_t cmd, const u1_t* ans, int alen) {
+    u1_t i = LMIC.foptsUpLen;
+    if( i + 1 + alen <= sizeof(LMIC.foptsUp) ) {
+        LMIC.foptsUp[i] = cmd;
+        os_copyMem(&LMIC.foptsUp[i+1], ans, alen);
+        LMIC.foptsUpLen = i + 1 + alen;
+    }
+}
+
+static int mcmd_pad (const u1_t* opt, int olen) {
+    // FPort=0 if we had MAC commands in payload
+    return 1;
+}
+
+static int mcmd_lchk (const u1_t* opt, int olen) {
+    LMIC.gwmargin = opt[1];
+    LMIC.gwcnt = opt[2];
+    return 3;
+}
+
+static int mcmd_ladr (const u1_t* opt, int olen) {
+    u1_t p1, chpage, nbtrans, cnt = 0;
+    u2_t chmap;
+    int oidx = 0;
+#ifdef REG_FIX
+    u2_t dmap[CHMAP_SZ];
+#else
+    u2_t dmap[1];
+#endif
+    if (REG_IS_FIX()) {
+#ifdef REG_FIX
+        os_copyMem(dmap, LMIC.fix.channelMap, sizeof(LMIC.fix.channelMap));
+#endif
+    }
+    u1_t ans = MCMD_LADR_ANS_POWACK | MCMD_LADR_ANS_CHACK | MCMD_LADR_ANS_DRACK;
+    do {
+        p1      = opt[oidx+1];                         // txpow + DR
+        chmap   = os_rlsbf2(&opt[oidx+2]);             // list of enabled channels
+        chpage  = opt[oidx+4] & MCMD_LADR_CHPAGE_MASK; // channel page
+        nbtrans = opt[oidx+4] & MCMD_LADR_REPEAT_MASK; // up repeat count
+        oidx += 5;
+        cnt  += 1;
+        if( !applyChannelMap(chpage, chmap, dmap) ) {
+            ans &= ~MCMD_LADR_ANS_CHACK;
+        }
+    } while (oidx < olen && opt[oidx] == MCMD_LADR_REQ);
+
+    if( (ans & MCMD_LADR_ANS_CHACK) && !checkChannelMap(dmap) ) {
+        ans &= ~MCMD_LADR_ANS_CHACK;
+    }
+    if( nbtrans == 0 ) {
+        nbtrans = LMIC.nbTrans;  // keep unchanged
+    }
+    dr_t dr = (dr_t)(((p1 & MCMD_LADR_DR_MASK) >> MCMD_LADR_DR_SHIFT));
+    s1_t powadj = (s1_t)((p1 & MCMD_LADR_POW_MASK) >> MCMD_LADR_POW_SHIFT);
+#if 0
+    debug_printf("ADR: p1=%02x,dr=%d,powadj=%d,chmap=%04x,chpage=%d,nbtrans=%d\r\n",
+            p1, dr, powadj, chmap, chpage, nbtrans);
+#endif
+    if( dr == 15 ) {
+        dr = LMIC.datarate; // Do not change DR
+    }
+    if( !validDR(dr) || ( REG_IS_FIX()
+#ifdef REG_FIX
+                && !checkChannel_fix(dmap, dr)
+#endif
+                )) {
+        ans &= ~MCMD_LADR_ANS_DRACK;
+    }
+    if( ans == (MCMD_LADR_ANS_POWACK | MCMD_LADR_ANS_CHACK | MCMD_LADR_ANS_DRACK) ) {
+        // Nothing went wrong - use settings
+        engineDirty(ENG_CHMAP);
+        if (REG_IS_FIX()) {
+#ifdef REG_FIX
+            os_copyMem(LMIC.fix.channelMap, dmap, sizeof(LMIC.fix.channelMap));
+#endif
+        } else {
+#ifdef REG_DYN
+            LMIC.dyn.channelMap = *dmap;
+#if defined(CFG_dyn_index)
+            updateChIndex_dyn();
+#endif
+#endif
+        }
+        LMIC.nbTrans = nbtrans;
+        // XXX: so far all regions define a power reduction table in the form:
+        // XXX:   MaxEIRP - 2*powadj dB with 0 <= powadj <= REGMAX
+        // XXX: where REGMAX is a region specific maximum.
+        // XXX: We currently do not check if the max value is exceeded (a field in LMIC.region->maxPowAdjIdx?)
+        setDrTxpow(DRCHG_NWKCMD, dr, powadj==15 ? KEEP_TXPOWADJ : -2*powadj);
+        reportEvent(EV_DATARATE);
+    }
+    while( cnt-- > 0 ) {
+        mcmdAns(MCMD_LADR_ANS, &ans, 1);
+    }
+    syncDatarate();              // fix DR if no more channel allowing this datarate
+    LMIC.opmode |= OP_NEXTCHNL;  // DR might have changed, channel might no longer be available
+    return oidx;
+}
+
+static int mcmd_devs (const u1_t* opt, int olen) {
+    LMIC.margin = (LMIC.snr >> 2) & 0x3f;
+    LMIC.devsAns = 1;
+    opmodePoll();
+    return 1;
+}
+
+static int mcmd_dn2p (const u1_t* opt, int olen) {
+    u1_t dr = opt[1] & 0xF;
+    u1_t off = (opt[1] >> 4) & 7;
+    freq_t freq = rdFreq(&opt[2]);
+    u1_t ans = 0;
+    if( validDR(dr) )  //XXX:BUG validDNDR
+        ans |= MCMD_DN2P_ANS_DRACK;
+    if( freq > 0 )
+        ans |= MCMD_DN2P_ANS_CHACK;
+    if( REGION.rx1DrOff[off] != ILLEGAL_RX1DRoff )
+        ans |= MCMD_DN2P_ANS_OFFACK;
+    if( ans == (MCMD_DN2P_ANS_OFFACK|MCMD_DN2P_ANS_DRACK|MCMD_DN2P_ANS_CHACK) ) {
+        LMIC.dn1DrOffIdx = off;
+        LMIC.dn2Dr = dr;
+        LMIC.dn2Freq = freq;
+    }
+    mcmdAns(MCMD_DN2P_ANS, &ans, 1);
+    LMIC.dn2Ans = MCMD_DN2P_ANS_REPLY | ans;   // answer pending
+    opmodePoll();
+    return 5;
+}
+
+static int mcmd_dcap (const u1_t* opt, int olen) {
+    LMIC.globalDutyRate  = opt[1] & 0xF;
+    LMIC.globalDutyAvail = os_getTime();
+    LMIC.dutyCapAns = 1;
+    return 2;
+}
+
+static int mcmd_snch (const u1_t* opt, int olen) {
+    u1_t ans = MCMD_SNCH_ANS_PEND;
+#ifdef REG_DYN
+    if (!REG_IS_FIX()) { // only available in dynamic regions
+        u1_t chidx = opt[1];
+        freq_t freq  = rdFreq(&opt[2]);
+        if( chidx < MIN_DYN_CHNLS && REGION.defaultCh[chidx] ) {
+            // don't allow modification of default channels
+        } else if( freq == 0 && chidx < MAX_DYN_CHNLS ) {
+            disableChannel_dyn(chidx);
+            ans = MCMD_SNCH_ANS_PEND|MCMD_SNCH_ANS_DRACK|MCMD_SNCH_ANS_FQACK;
+        } else {
+            u1_t mindr = opt[5] & 0xF;
+            u1_t maxdr = opt[5] >> 4;
+
+            if( validDR(mindr) && validDR(maxdr) && mindr <= maxdr &&  //XXX:BUG use a validUPDR?
+                (chidx >= MIN_DYN_CHNLS || (mindr == 0 && maxdr >= fastest125())) ) // XXX: correct?
+                ans |= MCMD_SNCH_ANS_DRACK;
+            if( chidx <= MAX_DYN_CHNLS && freq >= 0 )
+                ans |= MCMD_SNCH_ANS_FQACK;
+            if( ans == (MCMD_SNCH_ANS_PEND|MCMD_SNCH_ANS_DRACK|MCMD_SNCH_ANS_FQACK) )
+                setupChannel_dyn(chidx, freq, DR_RANGE_MAP(mindr,maxdr));
+        }
+    }
+#endif
+    opmodePoll();
+    ans &= ~MCMD_SNCH_ANS_RFU;
+    mcmdAns(MCMD_SNCH_ANS, &ans, 1);
+    return 6;
+}
+
+static int mcmd_dnfq (const u1_t* opt, int olen) {
+#ifdef REG_DYN
+    if (!REG_IS_FIX()) { // only available in dynamic regions
+        u1_t ans = MCMD_DNFQ_ANS_PEND;
+        u1_t chidx = opt[1];
+        freq_t freq  = rdFreq(&opt[2]);
+        if( chidx <= MAX_DYN_CHNLS && LMIC.dyn.chUpFreq[chidx] != 0 )
+            ans |= MCMD_DNFQ_ANS_CHACK;
+        if( freq > 0 )
+            ans |= MCMD_DNFQ_ANS_FQACK;
+        if( ans == (MCMD_DNFQ_ANS_PEND|MCMD_DNFQ_ANS_CHACK|MCMD_DNFQ_ANS_FQACK) )
+            LMIC.dyn.chDnFreq[chidx] = freq;
+        if( LMIC.dnfqAns + LMIC.dnfqAnsPend < 16 )
+            LMIC.dnfqAcks |= ans << (2*(LMIC.dnfqAns + LMIC.dnfqAnsPend));
+        LMIC.dnfqAns += 1;
+        ans &= ~MCMD_DNFQ_ANS_RFU;
+        mcmdAns(MCMD_DNFQ_ANS, &ans, 1);
+    }
+#endif
+    opmodePoll();
+    return 5;
+}
+
+static int mcmd_rxtm (const u1_t* opt, int olen) {
+    LMIC.dn1Dly = opt[1] & 0xF;
+    if( LMIC.dn1Dly == 0 )
+        LMIC.dn1Dly = 1;
+    LMIC.dn1DlyAns = 0x80;
+    opmodePoll();
+    return 2;
+}
+
+static int mcmd_pitv (const u1_t* opt, int olen) {
+    if( (LMIC.ping.intvExp & 0x80) ) {
+        LMIC.ping.intvExp &= 0x7F;   // clear pending bit
+        LMIC.opmode |= OP_PINGABLE;
+    } // else: ignore if we weren't waiting for it
+    return 1;
+}
+
+static int mcmd_pngc (const u1_t* opt, int olen) {
+    freq_t freq = rdFreq(&opt[1]);
+    u1_t dr = opt[4] & 0xF;
+    u1_t ans = 0;
+    if( validDR(dr) )  //XXX:BUG: validDNDR
+        ans |= MCMD_PNGC_ANS_DRACK;
+    if( freq >= 0)
+        ans |= MCMD_PNGC_ANS_FQACK;
+    if( ans == (MCMD_PNGC_ANS_FQACK|MCMD_PNGC_ANS_DRACK) ) {
+        LMIC.ping.freq = freq ?: REGION.pingFreq;
+        LMIC.ping.dr = dr;
+    }
+    mcmdAns(MCMD_PNGC_ANS, &ans, 1);
+    return 5;
+}
+
+static int mcmd_time (const u1_t* opt, int olen) {
+    u4_t secs = os_rlsbf4(&opt[1]);
+    u1_t frac = opt[5];
+    osxtime_t ref = os_time2XTime(LMIC.txend, os_getXTime());
+    LMIC.gpsEpochOff = secs * OSTICKS_PER_SEC + (((frac * OSTICKS_PER_SEC) >> 8) + 128) - ref;
+    LMIC.askForTime = 0;   // stop asking for time
+    // Currently, we only ask for time when we want to track a beacon
+    // If there are other reasons for getting MCMD_TIME_ANS we have to discern them here
+    // Set up tracking of next beacon based on the obtained time:
+    // Accuracy error: 1/512 sec = ~2ms - spec promises +/-100ms
+    LMIC.bcninfo.txtime = LMIC.txend - (secs & 0x7F) * OSTICKS_PER_SEC - (((frac * OSTICKS_PER_SEC) + 128) >> 8);
+    LMIC.bcninfo.flags = 0;  // no previous beacon as reference (BCN_PARTIAL|BCN_FULL cleared)
+#if defined(CFG_bcn_predict)
+    if( (LMIC.opmode & OP_TRACK) && LMIC.bdp.n ) {
+        // resync of tracked beacon - keep drift model
+        LMIC.bcninfo.time = (secs & ~(BCN_INTV_sec-1));
+        LMIC.missedBcns = 0;
+        LMIC.bdp.sum = 0;
+        calcBcnRxWindowFromMillis(100,0);
+    } else
+#endif
+    calcBcnRxWindowFromMillis(100,1);
+    LMIC.bcnChnl = (1+(secs >> 7)) % numBcnChannels();
+    LMIC.opmode = (LMIC.opmode & ~OP_SCAN) | OP_TRACK;
+    return 6;
+}
+
+static int mcmd_bcni (const u1_t* opt, int olen) {
+    // Ignore if tracking already enabled
+    if( (LMIC.opmode & OP_TRACK) == 0 ) {
+        LMIC.bcnChnl = opt[3];
+        // Disable tracking
+        LMIC.opmode |= OP_TRACK;
+        // Cleared later in txComplete handling - triggers EV_BEACON_FOUND
+        ASSERT(LMIC.askForTime!=0);
+        // Setup RX parameters
+        LMIC.bcninfo.txtime = (LMIC.rxtime
+                               + ms2osticks(os_rlsbf2(&opt[1]) * MCMD_BCNI_TUNIT)
+                               + ms2osticksCeil(MCMD_BCNI_TUNIT/2)
+                               - BCN_INTV_osticks);
+        LMIC.bcninfo.flags = 0;  // txtime above cannot be used as reference (BCN_PARTIAL|BCN_FULL cleared)
+        calcBcnRxWindowFromMillis(MCMD_BCNI_TUNIT,1);  // error of +/-N ms
+    }
+    return 4;
+}
+
+static int mcmd_bcnf (const u1_t* opt, int olen) {
+    freq_t freq = rdFreq(&opt[1]);
+    u1_t ans = MCMD_BCNF_ANS_PEND;
+    if( freq >= 0 )
+        ans |= MCMD_BCNF_ANS_FQACK;
+    LMIC.bcnfAns = ans;
+    if( ans == (MCMD_BCNF_ANS_PEND | MCMD_BCNF_ANS_FQACK) )
+        LMIC.bcnFreq = freq;
+    return 4;
+}
+
+#if defined(CFG_lorawan11)
+static int mcmd_adrp (const u1_t* opt, int olen) {
+    LMIC_setLinkCheck(1 << (opt[1] >> 4), 1 << (opt[1] & 0xf));
+    mcmdAns(MCMD_ADRP_ANS, NULL, 0);
+    return 2;
+}
+
+static int mcmd_rkey (const u1_t* opt, int olen) {
+    // Ignore if we did not ask for options negotiation
+    if( LMIC.opts & OPT_OPTNEG ) {
+        LMIC.opts = OPT_LORAWAN11;
+    }
+    return 2 + (opt[1] >> 4);
+}
+
+static int mcmd_devmd (const u1_t* opt, int olen) {
+    if( (LMIC.clmode & PEND_CLASS_C) && opt[1] == ((LMIC.clmode & CLASS_C) ? 0 : 2) ) {
+        decPollcnt();
+        LMIC.clmode &= ~PEND_CLASS_C;
+        LMIC.clmode ^= CLASS_C;
+    } // else: unexpected confirm or unexpected class -- ignore
+    return 2;
+}
+#endif
+
+static const mcmd_t MCMDS[] = {
+    [0]                 = { 1, mcmd_pad },
+    [MCMD_LCHK_ANS]     = { 3, mcmd_lchk },
+    [MCMD_LADR_REQ]     = { 5, mcmd_ladr },
+    [MCMD_DCAP_REQ]     = { 2, mcmd_dcap },
+    [MCMD_DN2P_SET]     = { 5, mcmd_dn2p },
+    [MCMD_DEVS_REQ]     = { 1, mcmd_devs },
+    [MCMD_SNCH_REQ]     = { 6, mcmd_snch },
+    [MCMD_RXTM_REQ]     = { 2, mcmd_rxtm },
+    [MCMD_DNFQ_REQ]     = { 5, mcmd_dnfq },
+    [MCMD_TIME_ANS]     = { 6, mcmd_time },
+    [MCMD_PITV_ANS]     = { 1, mcmd_pitv },
+    [MCMD_PNGC_REQ]     = { 5, mcmd_pngc },
+    [MCMD_BCNI_ANS]     = { 4, mcmd_bcni },
+    [MCMD_BCNF_REQ]     = { 4, mcmd_bcnf },
+#if defined(CFG_lorawan11)
+    [MCMD_ADRP_REQ]     = { 2, mcmd_adrp },
+    [MCMD_RKEY_CNF]     = { 2, mcmd_rkey },
+    [MCMD_DEVMD_CONF]   = { 2, mcmd_devmd },
+#endif
+};
+
+// length of the leading complete and known commands
+static int validMcmds (const u1_t* opts, int olen) {
+    int oidx = 0;
+    while( oidx < olen ) {
+        u1_t cmd = opts[oidx];
+        int len;
+        if( cmd >= sizeof(MCMDS)/sizeof(MCMDS[0]) || (len = MCMDS[cmd].len) == 0 ) {
+            break;              // unknown command - stop processing
+        }
+#if defined(CFG_lorawan11)
+        if( cmd == MCMD_RKEY_CNF && oidx + 1 < olen ) {
+            len += opts[oidx+1] >> 4;
+        }
+#endif
+        if( oidx + len > olen ) {
+            break;              // truncated command
+        }
+        oidx += len;
+    }
+    return oidx;
+}
+
+static void processMcmds (const u1_t* opts, int olen) {
+    olen = validMcmds(opts, olen);
+    int oidx = 0;
+    while( oidx < olen ) {
+        oidx += MCMDS[opts[oidx]].fn(opts + oidx, olen - oidx);
+    }
+}
+
+
 // ================================================================================
 // Decoding frames
 
@@ -1537,6 +2161,9 @@ static bit_t decodeFrame (void) {
     u1_t hdr    = d[0];
     u1_t ftype  = hdr & HDR_FTYPE;
     int  dlen   = LMIC.dataLen;
+#if defined(CFG_tx_prestage)
+    LMIC.stageLen = 0;  // MAC state may change - rebuild next repetition
+#endif
     if( dlen < OFF_DAT_OPTS+4 ||
         dlen > maxDnLen(LMIC.rps) ||
         (hdr & HDR_MAJOR) != HDR_MAJOR_V1 ||
@@ -1611,7 +2238,6 @@ static bit_t decodeFrame (void) {
 
     // Process OPTS
     u1_t* opts = &d[OFF_DAT_OPTS];
-    int oidx = 0;
 
     if( !replayConf ) {
         // Handle payload only if not a replay
@@ -1640,303 +2266,7 @@ static bit_t decodeFrame (void) {
         LMIC.dn2Ans = LMIC.dn1DlyAns = LMIC.dnfqAns = LMIC.dnfqAnsPend = LMIC.dnfqAcks = 0;
     }
     LMIC.foptsUpLen = 0;
-    while( oidx < olen ) {
-        switch( opts[oidx] ) {
-        case 0:  // FPort=0 if we had MAC commands in payload
-            oidx += 1;
-            continue;
-
-        case MCMD_LCHK_ANS: {
-            LMIC.gwmargin = opts[oidx+1];
-            LMIC.gwcnt = opts[oidx+2];
-            oidx += 3;
-            continue;
-        }
-        case MCMD_LADR_REQ: {
-            u1_t p1, chpage, nbtrans, cnt = 0;
-            u2_t chmap;
-#ifdef REG_FIX
-            u2_t dmap[CHMAP_SZ];
-#else
-            u2_t dmap[1];
-#endif
-            if (REG_IS_FIX()) {
-#ifdef REG_FIX
-                os_copyMem(dmap, LMIC.fix.channelMap, sizeof(LMIC.fix.channelMap));
-#endif
-            }
-            u1_t ans = MCMD_LADR_ANS_POWACK | MCMD_LADR_ANS_CHACK | MCMD_LADR_ANS_DRACK;
-            do {
-                p1      = opts[oidx+1];                         // txpow + DR
-                chmap   = os_rlsbf2(&opts[oidx+2]);             // list of enabled channels
-                chpage  = opts[oidx+4] & MCMD_LADR_CHPAGE_MASK; // channel page
-                nbtrans = opts[oidx+4] & MCMD_LADR_REPEAT_MASK; // up repeat count
-                oidx += 5;
-                cnt  += 1;
-                if( !applyChannelMap(chpage, chmap, dmap) ) {
-                    ans &= ~MCMD_LADR_ANS_CHACK;
-                }
-            } while (oidx < olen && opts[oidx] == MCMD_LADR_REQ);
-
-            if( (ans & MCMD_LADR_ANS_CHACK) && !checkChannelMap(dmap) ) {
-                ans &= ~MCMD_LADR_ANS_CHACK;
-            }
-            if( nbtrans == 0 ) {
-                nbtrans = LMIC.nbTrans;  // keep unchanged
-            }
-            dr_t dr = (dr_t)(((p1 & MCMD_LADR_DR_MASK) >> MCMD_LADR_DR_SHIFT));
-            s1_t powadj = (s1_t)((p1 & MCMD_LADR_POW_MASK) >> MCMD_LADR_POW_SHIFT);
-#if 0
-            debug_printf("ADR: p1=%02x,dr=%d,powadj=%d,chmap=%04x,chpage=%d,nbtrans=%d\r\n",
-                    p1, dr, powadj, chmap, chpage, nbtrans);
-#endif
-            if( dr == 15 ) {
-                dr = LMIC.datarate; // Do not change DR
-            }
-            if( !validDR(dr) || ( REG_IS_FIX()
-#ifdef REG_FIX
-                        && !checkChannel_fix(dmap, dr)
-#endif
-                        )) {
-                ans &= ~MCMD_LADR_ANS_DRACK;
-            }
-            if( ans == (MCMD_LADR_ANS_POWACK | MCMD_LADR_ANS_CHACK | MCMD_LADR_ANS_DRACK) ) {
-                // Nothing went wrong - use settings
-                if (REG_IS_FIX()) {
-#ifdef REG_FIX
-                    os_copyMem(LMIC.fix.channelMap, dmap, sizeof(LMIC.fix.channelMap));
-#endif
-                } else {
-#ifdef REG_DYN
-                    LMIC.dyn.channelMap = *dmap;
-#endif
-                }
-                LMIC.nbTrans = nbtrans;
-                // XXX: so far all regions define a power reduction table in the form:
-                // XXX:   MaxEIRP - 2*powadj dB with 0 <= powadj <= REGMAX
-                // XXX: where REGMAX is a region specific maximum.
-                // XXX: We currently do not check if the max value is exceeded (a field in LMIC.region->maxPowAdjIdx?)
-                setDrTxpow(DRCHG_NWKCMD, dr, powadj==15 ? KEEP_TXPOWADJ : -2*powadj);
-                reportEvent(EV_DATARATE);
-            }
-            while( cnt-- > 0 ) {
-                LMIC.foptsUp[LMIC.foptsUpLen++] = MCMD_LADR_ANS;
-                LMIC.foptsUp[LMIC.foptsUpLen++] = ans;
-            }
-            syncDatarate();              // fix DR if no more channel allowing this datarate
-            LMIC.opmode |= OP_NEXTCHNL;  // DR might have changed, channel might no longer be available
-            continue;
-        }
-        case MCMD_DEVS_REQ: {
-            LMIC.margin = (LMIC.snr >> 2) & 0x3f;
-            LMIC.devsAns = 1;
-            oidx += 1;
-            opmodePoll();
-            continue;
-        }
-        case MCMD_DN2P_SET: {
-            u1_t dr = opts[oidx+1] & 0xF;
-            u1_t off = (opts[oidx+1] >> 4) & 7;
-            freq_t freq = rdFreq(&opts[oidx+2]);
-            oidx += 5;
-            u1_t ans = 0;
-            if( validDR(dr) )  //XXX:BUG validDNDR
-                ans |= MCMD_DN2P_ANS_DRACK;
-            if( freq > 0 )
-                ans |= MCMD_DN2P_ANS_CHACK;
-            if( REGION.rx1DrOff[off] != ILLEGAL_RX1DRoff )
-                ans |= MCMD_DN2P_ANS_OFFACK;
-            if( ans == (MCMD_DN2P_ANS_OFFACK|MCMD_DN2P_ANS_DRACK|MCMD_DN2P_ANS_CHACK) ) {
-                LMIC.dn1DrOffIdx = off;
-                LMIC.dn2Dr = dr;
-                LMIC.dn2Freq = freq;
-            }
-            u1_t i = LMIC.foptsUpLen;
-            LMIC.foptsUpLen = i+2;
-            LMIC.foptsUp[i+0] = MCMD_DN2P_ANS;
-            LMIC.foptsUp[i+1] = ans;
-            LMIC.dn2Ans = MCMD_DN2P_ANS_REPLY | ans;   // answer pending
-            opmodePoll();
-            continue;
-        }
-        case MCMD_DCAP_REQ: {
-            u1_t cap = opts[oidx+1];
-            oidx += 2;
-            LMIC.globalDutyRate  = cap & 0xF;
-            LMIC.globalDutyAvail = os_getTime();
-            LMIC.dutyCapAns = 1;
-            continue;
-        }
-        case MCMD_SNCH_REQ: {
-            u1_t ans = MCMD_SNCH_ANS_PEND;
-#ifdef REG_DYN
-            if (!REG_IS_FIX()) { // only available in dynamic regions
-                u1_t chidx = opts[oidx+1];
-                freq_t freq  = rdFreq(&opts[oidx+2]);
-                if( chidx < MIN_DYN_CHNLS && REGION.defaultCh[chidx] ) {
-                    // don't allow modification of default channels
-                } else if( freq == 0 && chidx < MAX_DYN_CHNLS ) {
-                    disableChannel_dyn(chidx);
-                    ans = MCMD_SNCH_ANS_PEND|MCMD_SNCH_ANS_DRACK|MCMD_SNCH_ANS_FQACK;
-                } else {
-                    u1_t mindr = opts[oidx+5] & 0xF;
-                    u1_t maxdr = opts[oidx+5] >> 4;
-
-                    if( validDR(mindr) && validDR(maxdr) && mindr <= maxdr &&  //XXX:BUG use a validUPDR?
-                        (chidx >= MIN_DYN_CHNLS || (mindr == 0 && maxdr >= fastest125())) ) // XXX: correct?
-                        ans |= MCMD_SNCH_ANS_DRACK;
-                    if( chidx <= MAX_DYN_CHNLS && freq >= 0 )
-                        ans |= MCMD_SNCH_ANS_FQACK;
-                    if( ans == (MCMD_SNCH_ANS_PEND|MCMD_SNCH_ANS_DRACK|MCMD_SNCH_ANS_FQACK) )
-                        setupChannel_dyn(chidx, freq, DR_RANGE_MAP(mindr,maxdr));
-                }
-            }
-#endif
-            oidx += 6;
-            opmodePoll();
-            u1_t i = LMIC.foptsUpLen;
-            LMIC.foptsUpLen = i+2;
-            LMIC.foptsUp[i+0] = MCMD_SNCH_ANS;
-            LMIC.foptsUp[i+1] = ans & ~MCMD_SNCH_ANS_RFU;
-            continue;
-        }
-        case MCMD_DNFQ_REQ: {
-#ifdef REG_DYN
-            if (!REG_IS_FIX()) { // only available in dynamic regions
-                u1_t ans = MCMD_DNFQ_ANS_PEND;
-                u1_t chidx = opts[oidx+1];
-                freq_t freq  = rdFreq(&opts[oidx+2]);
-                if( chidx <= MAX_DYN_CHNLS && LMIC.dyn.chUpFreq[chidx] != 0 )
-                    ans |= MCMD_DNFQ_ANS_CHACK;
-                if( freq > 0 )
-                    ans |= MCMD_DNFQ_ANS_FQACK;
-                if( ans == (MCMD_DNFQ_ANS_PEND|MCMD_DNFQ_ANS_CHACK|MCMD_DNFQ_ANS_FQACK) )
-                    LMIC.dyn.chDnFreq[chidx] = freq;
-                if( LMIC.dnfqAns + LMIC.dnfqAnsPend < 16 )
-                    LMIC.dnfqAcks |= ans << (2*(LMIC.dnfqAns + LMIC.dnfqAnsPend));
-                LMIC.dnfqAns += 1;
-                u1_t i = LMIC.foptsUpLen;
-                LMIC.foptsUpLen = i+2;
-                LMIC.foptsUp[i+0] = MCMD_DNFQ_ANS;
-                LMIC.foptsUp[i+1] = ans & ~MCMD_DNFQ_ANS_RFU;
-            }
-#endif
-            oidx += 5;
-            opmodePoll();
-            continue;
-        }
-        case MCMD_RXTM_REQ: {
-            LMIC.dn1Dly = opts[oidx+1] & 0xF;
-            if( LMIC.dn1Dly == 0 )
-                LMIC.dn1Dly = 1;
-            LMIC.dn1DlyAns = 0x80;
-            opmodePoll();
-            oidx += 2;
-            continue;
-        }
-        case MCMD_PITV_ANS: {
-            if( (LMIC.ping.intvExp & 0x80) ) {
-                LMIC.ping.intvExp &= 0x7F;   // clear pending bit
-                LMIC.opmode |= OP_PINGABLE;
-            } // else: ignore if we weren't waiting for it
-            oidx += 1;
-            continue;
-        }
-        case MCMD_PNGC_REQ: {
-            freq_t freq = rdFreq(&opts[oidx+1]);
-            u1_t dr = opts[oidx+4] & 0xF;
-            oidx += 5;
-            u1_t ans = 0;
-            if( validDR(dr) )  //XXX:BUG: validDNDR
-                ans |= MCMD_PNGC_ANS_DRACK;
-            if( freq >= 0)
-                ans |= MCMD_PNGC_ANS_FQACK;
-            if( ans == (MCMD_PNGC_ANS_FQACK|MCMD_PNGC_ANS_DRACK) ) {
-                LMIC.ping.freq = freq ?: REGION.pingFreq;
-                LMIC.ping.dr = dr;
-            }
-            u1_t i = LMIC.foptsUpLen;
-            LMIC.foptsUpLen = i+2;
-            LMIC.foptsUp[i+0] = MCMD_PNGC_ANS;
-            LMIC.foptsUp[i+1] = ans;
-            continue;
-        }
-        case MCMD_TIME_ANS: {
-            u4_t secs = os_rlsbf4(&opts[oidx+1]);
-            u1_t frac = opts[oidx+5];
-            osxtime_t ref = os_time2XTime(LMIC.txend, os_getXTime());
-            LMIC.gpsEpochOff = secs * OSTICKS_PER_SEC + (((frac * OSTICKS_PER_SEC) >> 8) + 128) - ref;
-            LMIC.askForTime = 0;   // stop asking for time
-            oidx += 6;
-            // Currently, we only ask for time when we want to track a beacon
-            // If there are other reasons for getting MCMD_TIME_ANS we have to discern them here
-            // Set up tracking of next beacon based on the obtained time:
-            // Accuracy error: 1/512 sec = ~2ms - spec promises +/-100ms
-            LMIC.bcninfo.txtime = LMIC.txend - (secs & 0x7F) * OSTICKS_PER_SEC - (((frac * OSTICKS_PER_SEC) + 128) >> 8);
-            LMIC.bcninfo.flags = 0;  // no previous beacon as reference (BCN_PARTIAL|BCN_FULL cleared)
-            calcBcnRxWindowFromMillis(100,1);
-            LMIC.bcnChnl = (1+(secs >> 7)) % numBcnChannels();
-            LMIC.opmode = (LMIC.opmode & ~OP_SCAN) | OP_TRACK;
-            continue;
-        }
-        case MCMD_BCNI_ANS: {
-            // Ignore if tracking already enabled
-            if( (LMIC.opmode & OP_TRACK) == 0 ) {
-                LMIC.bcnChnl = opts[oidx+3];
-                // Disable tracking
-                LMIC.opmode |= OP_TRACK;
-                // Cleared later in txComplete handling - triggers EV_BEACON_FOUND
-                ASSERT(LMIC.askForTime!=0);
-                // Setup RX parameters
-                LMIC.bcninfo.txtime = (LMIC.rxtime
-                                       + ms2osticks(os_rlsbf2(&opts[oidx+1]) * MCMD_BCNI_TUNIT)
-                                       + ms2osticksCeil(MCMD_BCNI_TUNIT/2)
-                                       - BCN_INTV_osticks);
-                LMIC.bcninfo.flags = 0;  // txtime above cannot be used as reference (BCN_PARTIAL|BCN_FULL cleared)
-                calcBcnRxWindowFromMillis(MCMD_BCNI_TUNIT,1);  // error of +/-N ms
-            }
-            oidx += 4;
-            continue;
-        }
-        case MCMD_BCNF_REQ: {
-            freq_t freq = rdFreq(&opts[oidx+1]);
-            u1_t ans = MCMD_BCNF_ANS_PEND;
-            if( freq >= 0 )
-                ans |= MCMD_BCNF_ANS_FQACK;
-            LMIC.bcnfAns = ans;
-            if( ans == (MCMD_BCNF_ANS_PEND | MCMD_BCNF_ANS_FQACK) )
-                LMIC.bcnFreq = freq;
-            oidx += 4;
-            continue;
-        }
-#if defined(CFG_lorawan11)
-        case MCMD_ADRP_REQ: {
-            LMIC_setLinkCheck(1 << (opts[oidx+1] >> 4), 1 << (opts[oidx+1] & 0xf));
-            LMIC.foptsUp[LMIC.foptsUpLen++] = MCMD_ADRP_ANS;
-            oidx += 2;
-            continue;
-        }
-        case MCMD_RKEY_CNF: {
-            // Ignore if we did not ask for options negotiation
-            if( LMIC.opts & OPT_OPTNEG ) {
-                LMIC.opts = OPT_LORAWAN11;
-            }
-            oidx += 2 + (opts[oidx+1] >> 4);
-            continue;
-        }
-        case MCMD_DEVMD_CONF: {
-            if( (LMIC.clmode & PEND_CLASS_C) && opts[oidx+1] == ((LMIC.clmode & CLASS_C) ? 0 : 2) ) {
-                decPollcnt();
-                LMIC.clmode &= ~PEND_CLASS_C;
-                LMIC.clmode ^= CLASS_C;
-            } // else: unexpected confirm or unexpected class -- ignore
-            oidx += 2;
-            continue;
-        }
-#endif
-        }
-        break;
-    }
+    processMcmds(opts, olen);
 
 #if defined(CFG_lorawan11)
     if( LMIC.opts & OPT_OPTNEG ) {
@@ -1971,6 +2301,25 @@ static bit_t decodeFrame (void) {
 }
 
 
+// Binary search for multicast session in LMIC.mcsorted. Returns the position
+// of the session with the given address, or the insertion point (as ~pos).
+static int findMultiCastSession (devaddr_t grpaddr) {
+    int lo = 0, hi = LMIC.mccount;
+    while( lo < hi ) {
+        int mid = (lo + hi) >> 1;
+        devaddr_t a = LMIC.sessions[LMIC.mcsorted[mid]].grpaddr;
+        if( a == grpaddr ) {
+            return mid;
+        }
+        if( a < grpaddr ) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return ~lo;
+}
+
 static bit_t decodeMultiCastFrame (void) {
     u1_t* d = LMIC.frame;
     u1_t hdr    = d[0];
@@ -1992,11 +2341,12 @@ static bit_t decodeMultiCastFrame (void) {
     int  pend  = dlen-4;  // MIC
 
     // check for multicast session with this address
-    session_t* s;
-    for(s = LMIC.sessions; s<LMIC.sessions+MAX_MULTICAST_SESSIONS && s->grpaddr!=addr; s++);
-    if( s == LMIC.sessions+MAX_MULTICAST_SESSIONS ) {
+    int pos = findMultiCastSession(addr);
+    if( pos < 0 ) {
         goto norx;
     }
+    int idx = LMIC.mcsorted[pos];
+    session_t* s = &LMIC.sessions[idx];
     // check for short frame
     if( poff > pend ) {
         goto norx;
@@ -2018,7 +2368,7 @@ static bit_t decodeMultiCastFrame (void) {
     seqno = s->seqnoADn + (u2_t)(seqno - s->seqnoADn);
 
     // verify MIC
-    if( !lce_verifyMic(LCE_MCGRP_0 + (s-LMIC.sessions), s->grpaddr, seqno, d, pend) ) {
+    if( !lce_verifyMic(LCE_MCGRP_0 + idx, s->grpaddr, seqno, d, pend) ) {
         goto norx;
     }
     // check down frame counter
@@ -2034,7 +2384,7 @@ static bit_t decodeMultiCastFrame (void) {
 
     // Decrypt payload - if any
     if( pend-poff > 0 ) {
-        lce_cipher(LCE_MCGRP_0 + (s-LMIC.sessions), s->grpaddr, seqno, /*dn*/1, d+poff, pend-poff);
+        lce_cipher(LCE_MCGRP_0 + idx, s->grpaddr, seqno, /*dn*/1, d+poff, pend-poff);
     }
 
     if( port < 0 ) {
@@ -2074,6 +2424,7 @@ static void schedRx2 (u1_t delay, osjobcb_t func) {
     {
         // Add 1.5 symbols we need 5 out of 8. Try to sync 1.5 symbols into the preamble.
         LMIC.rxtime = LMIC.txend + delay*sec2osticks(1) + dr2hsym(LMIC.dn2Dr, PAMBL_SYMS-MINRX_SYMS);
+        LMIC.rxsyms = MINRX_SYMS;
         adjustByRxdErr(delay, LMIC.dn2Dr);
     }
     os_setTimedCallback(&LMIC.osjob, LMIC.rxtime - RX_RAMPUP, func);
@@ -2206,6 +2557,12 @@ static bit_t processJoinAccept (void) {
         LMIC.datarate = lowerDR(LMIC.datarate, LMIC.rejoinCnt);
     }
     addRxdErr(DELAY_JACC1 + (LMIC.txrxFlags & TXRX_DNW2 ? DELAY_EXTDNW2 : 0));
+#if defined(CFG_join_backoff)
+    if( (LMIC.opmode & OP_REJOIN) == 0 ) {
+        LMIC.jbo.active = 0;
+        LMIC.jbo.chnl = REG_IS_FIX() ? LMIC.refChnl : LMIC.txChnl;
+    }
+#endif
     stateJustJoined();
     reportEvent(EV_JOINED);
     return 1;
@@ -2276,18 +2633,91 @@ static void processRx1DnData (osjob_t* osjob) {
     }
 }
 
+// engine has nothing to do but continuous class C RX
+#define CLASSC_IDLE() ((LMIC.opmode & (OP_JOINING|OP_REJOIN|OP_TXDATA|OP_POLL|OP_TRACK \
+                | OP_SCAN|OP_TXRXPEND|OP_SHUTDOWN|OP_NOENGINE)) == 0)
+
+#if defined(CFG_mcast_fast)
+static void setupRx2ClassC (void);
+#endif
+
 static void processRx2ClassC (osjob_t* osjob) {
     if( LMIC.dataLen != 0 ) {
         LMIC.txrxFlags = TXRX_DNW2;
-	if ((LMIC.devaddr == os_rlsbf4(&LMIC.frame[OFF_DAT_ADDR]) && decodeFrame()) || decodeMultiCastFrame() ) {
+        if( LMIC.devaddr == os_rlsbf4(&LMIC.frame[OFF_DAT_ADDR]) && decodeFrame() ) {
             reportEvent(EV_RXCOMPLETE);
             return;
         }
+#if defined(CFG_mcast_fast)
+        // decodeMultiCastFrame() has checked the frame counter and the MIC
+        // against the group session, advanced the session counter and
+        // decrypted the payload, so the handler gets authenticated,
+        // non-replayed data and must not repeat any of these checks.
+        if( decodeMultiCastFrame() ) {
+            if( LMIC.mcRxFunc && (LMIC.txrxFlags & TXRX_PORT)
+                    && LMIC.frame[LMIC.dataBeg-1] == LMIC.mcRxPort && CLASSC_IDLE() ) {
+                // fast path: process in place and re-arm RX right away
+                TRACE_EV(EV_RXCOMPLETE);
+                LMIC.mcRxFunc(LMIC.mcRxPort, LMIC.frame + LMIC.dataBeg, LMIC.dataLen);
+                if( CLASSC_IDLE() ) {
+                    setupRx2ClassC();
+                    return;
+                }
+            } else {
+                reportEvent(EV_RXCOMPLETE);
+                return;
+            }
+        }
+#else
+        if( decodeMultiCastFrame() ) {
+            reportEvent(EV_RXCOMPLETE);
+            return;
+        }
+#endif
     }
     engineUpdate();
 }
 
-static void setupRx2ClassC () {
+#if defined(CFG_classc_lp)
+// Low-power class C: instead of continuous RX2 the radio sleeps and does a
+// CAD every sniffIntv. Downlinks must be sent with a preamble covering the
+// interval (see LMIC_sniffPreamble()), on detection the radio receives the
+// frame. Returns the needed preamble length in symbols, 0 if sniffing is not
+// possible at the current RX2 datarate.
+static u1_t sniffSyms (void) {
+    if( LMIC.sniffIntv == 0 || getSf(dndr2rps(LMIC.dn2Dr)) == FSK )
+        return 0;
+    ostime_t sym = 2 * dr2hsym(LMIC.dn2Dr, 1);
+    u4_t syms = (LMIC.sniffIntv + sym - 1) / sym + SNIFF_CAD_SYMS + MINRX_SYMS;
+    return (syms > 255) ? 0 : syms;
+}
+
+static void startSniff (osjob_t* osjob) {
+    if( (LMIC.clmode & CLASS_C) == 0
+            || (LMIC.opmode & (OP_TXRXPEND|OP_TRACK|OP_SCAN|OP_SHUTDOWN|OP_NOENGINE)) != 0 ) {
+        return; // engine is using the radio (will call setupRx2ClassC() again)
+    }
+    LMIC.sniffTime = os_getTime();
+    LMIC.osjob.func = FUNC_ADDR(processRx2ClassC);
+    LMIC.txrxFlags = TXRX_DNW2;
+    LMIC.rps = dndr2rps(LMIC.dn2Dr);
+    LMIC.freq = LMIC.dn2Freq;
+    LMIC.rxsyms = sniffSyms(); // (rx timeout after preamble detection)
+    LMIC.dataLen = 0;
+    os_radio(RADIO_CAD);
+}
+#endif
+
+static void setupRx2ClassC (void) {
+#if defined(CFG_classc_lp)
+    // (RX2 of a pending transaction is always continuous)
+    if( (LMIC.opmode & (OP_TXRXPEND|OP_TRACK)) == 0 && sniffSyms() ) {
+        ostime_t now = os_getTime();
+        ostime_t t = LMIC.sniffTime + LMIC.sniffIntv;
+        os_setTimedCallback(&LMIC.sniffjob, (t - now < 0) ? now : t, FUNC_ADDR(startSniff));
+        return;
+    }
+#endif
     LMIC.osjob.func = FUNC_ADDR(processRx2ClassC);
     LMIC.txrxFlags = TXRX_DNW2;
     LMIC.rps = dndr2rps(LMIC.dn2Dr);
@@ -2339,9 +2769,17 @@ static void updataDone (osjob_t* osjob) {
 // ========================================
 
 
+// FCtrl of next uplink data frame (without FOptsLen)
+static u1_t frameCtrl (void) {
+    return (LMIC.dnConf | (LMIC.pendTxNoRx ? 0 : LMIC.adrEnabled
+                           | ((LMIC.adrAckReq >= 0 && ((LMIC.opmode & OP_LINKDEAD) == 0 || !LMIC.adrEnabled)) ? FCT_ADRARQ : 0))
+            | ((LMIC.opmode & (OP_TRACK|OP_PINGABLE)) == (OP_TRACK|OP_PINGABLE) ? FCT_CLASSB : 0));
+}
+
 static void buildDataFrame (void) {
     bit_t txdata = ((LMIC.opmode & (OP_TXDATA|OP_POLL)) != OP_POLL);
-    u1_t dlen = txdata ? LMIC.pendTxLen : 0;
+    txjit_t jit = txdata ? LMIC.pendTxJit : NULL;
+    int dlen = (txdata && !jit) ? LMIC.pendTxLen : 0;
 
     // Piggyback MAC options
     // Prioritize by importance
@@ -2437,6 +2875,7 @@ static void buildDataFrame (void) {
         // too big for FOpts, send as MAC frame with port=0 (cancels application payload)
         memcpy(LMIC.pendTxData, LMIC.frame+OFF_DAT_OPTS, foptslen);
         dlen = foptslen;
+        jit = NULL;
         LMIC.pendTxPort = 0;
         LMIC.pendTxConf = 0;
         if( txdata ) {
@@ -2448,6 +2887,16 @@ static void buildDataFrame (void) {
     }
 
     int flen, flen_max = LMIC_maxAppPayload() + 13;
+    if( jit && txdata && flen_max - (end + 5) >= 0 ) {
+        // let application write payload directly into frame after FOpts
+        if( (dlen = jit(LMIC.frame+end+1, flen_max - (end + 5))) < 0 ) {
+            dlen = 0;
+            txdata = 0;
+            LMIC.txrxFlags |= TXRX_NOTX;
+        }
+        ASSERT(end + 5 + dlen <= flen_max);
+        LMIC.pendTxLen = dlen;
+    }
 again:
     flen = end + (txdata ? 5+dlen : 4);
     if( flen > flen_max ) {
@@ -2473,10 +2922,7 @@ again:
         }
     }
     LMIC.frame[OFF_DAT_HDR] = HDR_FTYPE_DAUP | HDR_MAJOR_V1;
-    LMIC.frame[OFF_DAT_FCT] = (LMIC.dnConf | (LMIC.pendTxNoRx ? 0 : LMIC.adrEnabled
-                               | ((LMIC.adrAckReq >= 0 && ((LMIC.opmode & OP_LINKDEAD) == 0 || !LMIC.adrEnabled)) ? FCT_ADRARQ : 0))
-                               | ((LMIC.opmode & (OP_TRACK|OP_PINGABLE)) == (OP_TRACK|OP_PINGABLE) ? FCT_CLASSB : 0)
-                               | (end-OFF_DAT_OPTS));
+    LMIC.frame[OFF_DAT_FCT] = frameCtrl() | (end-OFF_DAT_OPTS);
     os_wlsbf4(LMIC.frame+OFF_DAT_ADDR,  LMIC.devaddr);
 
     if( LMIC.txCnt == 0 || (LMIC.opmode & (OP_TXDATA|OP_POLL)) == OP_POLL ) {
@@ -2494,7 +2940,9 @@ again:
             LMIC.frame[OFF_DAT_HDR] = HDR_FTYPE_DCUP | HDR_MAJOR_V1;
         }
         LMIC.frame[end] = LMIC.pendTxPort;
-        os_copyMem(LMIC.frame+end+1, LMIC.pendTxData, dlen);
+        if( !jit ) {
+            os_copyMem(LMIC.frame+end+1, LMIC.pendTxData, dlen);
+        }
         lce_cipher(LMIC.pendTxPort==0 ? LCE_NWKSKEY : LCE_APPSKEY,
                    LMIC.devaddr, LMIC.seqnoUp-1, /*up*/0, LMIC.frame+end+1, dlen);
     }
@@ -2502,6 +2950,35 @@ again:
     LMIC.dataLen = flen;
 }
 
+#if defined(CFG_tx_prestage)
+// Repetitions (nbTrans or missing ack) carry the same FCnt as the first
+// transmission. Keep the encrypted frame including MIC and replay it instead
+// of running the cipher and MIC again. The staged frame is dropped when a
+// downlink is received and not used if FCtrl would differ (ack pending, ADR,
+// class B) or it exceeds the payload limit of the current datarate.
+static void stageFrame (void) {
+    if( LMIC.dataLen <= sizeof(LMIC.stage) ) {
+        os_copyMem(LMIC.stage, LMIC.frame, LMIC.dataLen);
+        LMIC.stageLen = LMIC.dataLen;
+        LMIC.stageFlags = LMIC.txrxFlags & TXRX_NOTX;
+    } else {
+        LMIC.stageLen = 0;
+    }
+}
+
+static bit_t replayFrame (void) {
+    if( LMIC.stageLen == 0 || LMIC.txCnt == 0 || (LMIC.opmode & OP_TXDATA) == 0 ||
+        (LMIC.stage[OFF_DAT_FCT] & ~FCT_OPTLEN) != frameCtrl() ||
+        LMIC.stageLen > LMIC_maxAppPayload() + 13 ) {
+        return 0;
+    }
+    os_copyMem(LMIC.frame, LMIC.stage, LMIC.stageLen);
+    LMIC.dataLen = LMIC.stageLen;
+    LMIC.txrxFlags |= LMIC.stageFlags;
+    return 1;
+}
+#endif
+
 
 // Callback from HAL during scan mode or when job timer expires.
 static void onBcnScanRx (osjob_t* job) {
@@ -2689,6 +3166,9 @@ bit_t LMIC_startJoining (void) {
         // Setup state
         LMIC.rejoinCnt = LMIC.txCnt = LMIC.pendTxConf = 0;
         initJoinLoop();
+#if defined(CFG_join_backoff)
+        jboStart();
+#endif
         LMIC.opmode |= OP_JOINING;
         LMIC.clmode = 0;
         LMIC.pollcnt = 0;
@@ -2726,6 +3206,11 @@ static bit_t processDnData (void) {
       norx:
         // Nothing received - implies no port
         LMIC.txrxFlags = (LMIC.txrxFlags & TXRX_NOTX) | TXRX_NOPORT;
+#if defined(CFG_rxwin_adapt)
+        // expected answer (ack, ADR ack, time) missed - fall back to standard windows until retrained
+        if( LMIC.pendTxConf != 0 || LMIC.adrAckReq >= 0 || LMIC.askForTime > 0 )
+            LMIC.rxdErrCnt = 0;
+#endif
         if( (LMIC.opmode & OP_TXDATA) ) {
             LMIC.txCnt += 1;
             if( (int8_t)LMIC.txCnt < (int8_t)LMIC.nbTrans ) { // int8_t => implicit check for IGN_NBTRANS
@@ -2827,9 +3312,14 @@ static void processBeacon (osjob_t* osjob) {
         }
         // We have a previous BEACON to calculate some drift
         s2_t drift = (LMIC.bcninfo.txtime - lasttx) - BCN_INTV_osticks;
+#if defined(CFG_bcn_predict)
+        // lasttx is surrogate if beacons were missed: add drift predicted for missed periods
+        drift = (LMIC.bdp.sum + drift) / (LMIC.missedBcns+1);
+#else
         if( LMIC.missedBcns > 0 ) {
             drift = LMIC.drift + (drift - LMIC.drift) / (LMIC.missedBcns+1);
         }
+#endif
         if( (LMIC.bcninfo.flags & BCN_NODRIFT) == 0 ) {
             s2_t diff = LMIC.drift - drift;
             if( diff < 0 ) diff = -diff;
@@ -2838,15 +3328,35 @@ static void processBeacon (osjob_t* osjob) {
                 LMIC.maxDriftDiff = diff;
             LMIC.bcninfo.flags &= ~BCN_NODDIFF;
         }
+#if defined(CFG_bcn_predict)
+        bdpAdd(drift, LMIC.missedBcns+1);
+        LMIC.bdp.sum = 0;
+        drift = bdpPredict(1);  // expected drift of next period
+#endif
         LMIC.drift = drift;
         LMIC.missedBcns = LMIC.rejoinCnt = 0;
         LMIC.bcninfo.flags &= ~BCN_NODRIFT;
         ASSERT((LMIC.bcninfo.flags & (BCN_PARTIAL|BCN_FULL)) != 0);
     } else {
         ev = EV_BEACON_MISSED;
+#if defined(CFG_rxwin_adapt)
+        // fall back to standard windows until retrained
+        LMIC.rxdErrCnt = 0;
+#endif
         LMIC.bcninfo.txtime += BCN_INTV_osticks + LMIC.drift;
         LMIC.bcninfo.time   += BCN_INTV_sec;
         LMIC.missedBcns++;
+#if defined(CFG_bcn_predict)
+        LMIC.bdp.sum += LMIC.drift;
+        if( LMIC.bdp.n ) {
+            LMIC.drift = bdpPredict(LMIC.missedBcns+1);
+        }
+        // resync via DeviceTimeReq before windows grow wide - instead of a full scan
+        if( LMIC.missedBcns == BCN_RESYNC_MISSED && LMIC.askForTime <= 0 ) {
+            LMIC.askForTime = BCN_RESYNC_TRIES;
+            opmodePoll();
+        }
+#endif
         // Delay any possible TX after surmised beacon - it's there although we missed it
         txDelay(LMIC.bcninfo.txtime + BCN_RESERVE_osticks, 4);
         if( LMIC.missedBcns > MAX_MISSED_BCNS )
@@ -2879,6 +3389,52 @@ static void startRxPing (osjob_t* osjob) {
 }
 
 
+#if defined(CFG_engine_incr)
+// Check if the outcome of the last evaluation is still valid, i.e. none of
+// its inputs have changed and the job it scheduled is still pending. The job
+// is pending as long as it has not been re-armed (func/deadline), fired
+// (deadline reached) or cancelled (ENG_JOB), so the queue need not be walked.
+static bit_t engineUnchanged (ostime_t now) {
+    return LMIC.eng.wait
+        && LMIC.eng.dirty == 0
+        && LMIC.eng.opmode == LMIC.opmode
+        && LMIC.eng.clmode == LMIC.clmode
+        && LMIC.eng.pollcnt == LMIC.pollcnt
+        && LMIC.eng.datarate == LMIC.datarate
+        && LMIC.eng.globalDutyRate == LMIC.globalDutyRate
+        && LMIC.eng.txend == LMIC.txend
+        && LMIC.eng.globalDutyAvail == LMIC.globalDutyAvail
+        && LMIC.eng.bcnRxtime == LMIC.bcnRxtime
+        // poll timeout expiry is not tied to LMIC.osjob
+        && ((LMIC.opmode & OP_POLL) == 0 || now - LMIC.polltime < LMIC.polltimeout)
+        && LMIC.osjob.func == LMIC.eng.func
+        && LMIC.osjob.deadline == LMIC.eng.deadline
+        && LMIC.eng.deadline - now > 0;
+}
+
+// Remember inputs and outcome of evaluation which ended with a timed job
+static void engineSnapshot (void) {
+    LMIC.eng.dirty = 0;
+    LMIC.eng.wait = 1;
+    LMIC.eng.opmode = LMIC.opmode;
+    LMIC.eng.clmode = LMIC.clmode;
+    LMIC.eng.pollcnt = LMIC.pollcnt;
+    LMIC.eng.datarate = LMIC.datarate;
+    LMIC.eng.globalDutyRate = LMIC.globalDutyRate;
+    LMIC.eng.txend = LMIC.txend;
+    LMIC.eng.globalDutyAvail = LMIC.globalDutyAvail;
+    LMIC.eng.bcnRxtime = LMIC.bcnRxtime;
+    LMIC.eng.func = LMIC.osjob.func;
+    LMIC.eng.deadline = LMIC.osjob.deadline;
+}
+#define engineSetTimedCallback(job, time, cb) do { \
+    os_setTimedCallback(job, time, cb); \
+    engineSnapshot(); \
+} while( 0 )
+#else
+#define engineSetTimedCallback(job, time, cb) os_setTimedCallback(job, time, cb)
+#endif
+
 // Decide what to do next for the MAC layer of a device
 static void engineUpdate (void) {
     // Check for ongoing state: scan or TX/RX transaction
@@ -2894,6 +3450,21 @@ static void engineUpdate (void) {
 #endif // CFG_autojoin
 
     ostime_t now    = os_getTime();
+#if defined(CFG_engine_stats)
+    LMIC.eng.calls += 1;
+#endif
+#if defined(CFG_engine_incr)
+    if( engineUnchanged(now) ) {
+        return; // keep scheduled job
+    }
+    LMIC.eng.wait = 0;
+#endif
+#if defined(CFG_engine_stats)
+    LMIC.eng.evals += 1;
+#endif
+#if defined(CFG_ping_coalesce)
+    LMIC.radioStandby = 0;  // set again if next job is an adjacent ping slot
+#endif
     ostime_t rxtime = 0;
     ostime_t txbeg  = 0;
 
@@ -2940,6 +3511,11 @@ static void engineUpdate (void) {
         // Delayed TX or waiting for duty cycle?
         if( (LMIC.globalDutyRate != 0 || (LMIC.opmode & OP_RNDTX) != 0)  &&  (txbeg - LMIC.globalDutyAvail) < 0 )
             txbeg = LMIC.globalDutyAvail;
+#if defined(CFG_join_backoff)
+        // Join back-off
+        if( jacc && (LMIC.opmode & OP_REJOIN) == 0 && !LMIC.noDC )
+            txbeg = jboCheck(txbeg);
+#endif
         // If we're tracking a beacon...
         // then make sure TX-RX transaction is complete before beacon
         if( (LMIC.opmode & OP_TRACK) != 0 &&
@@ -2983,7 +3559,14 @@ static void engineUpdate (void) {
                     goto reset;
                 }
                 LMIC.txrxFlags = 0;
+#if defined(CFG_tx_prestage)
+                if( !replayFrame() ) {
+                    buildDataFrame();
+                    stageFrame();
+                }
+#else
                 buildDataFrame();
+#endif
                 if( LMIC.dataLen == 0 ) {
                     txError();
                     return;
@@ -2991,6 +3574,11 @@ static void engineUpdate (void) {
                 LMIC.osjob.func = FUNC_ADDR(updataDone);
             }
             LMIC.rps    = setCr(updr2rps(txdr), (cr_t)LMIC.errcr);
+#if defined(CFG_join_backoff)
+            if( jacc && (LMIC.opmode & OP_REJOIN) == 0 ) {
+                LMIC.jbo.airtime += calcAirTime(LMIC.rps, LMIC.dataLen);
+            }
+#endif
             LMIC.dndr   = txdr;  // carry TX datarate (can be != LMIC.datarate) over to txDone/setupRx1
             LMIC.opmode = (LMIC.opmode & ~(OP_POLL|OP_RNDTX)) | OP_TXRXPEND | OP_NEXTCHNL;
             updateTx(txbeg);
@@ -3027,7 +3615,10 @@ static void engineUpdate (void) {
             LMIC.rps     = dndr2rps(LMIC.ping.dr);
             LMIC.dataLen = 0;
             ASSERT(LMIC.rxtime - now+RX_RAMPUP >= 0 );
-            os_setTimedCallback(&LMIC.osjob, LMIC.rxtime - RX_RAMPUP, FUNC_ADDR(startRxPing));
+#if defined(CFG_ping_coalesce)
+            pingCoalesce();
+#endif
+            engineSetTimedCallback(&LMIC.osjob, LMIC.rxtime - RX_RAMPUP, FUNC_ADDR(startRxPing));
             return;
         }
         // no - just wait for the beacon
@@ -3044,14 +3635,14 @@ static void engineUpdate (void) {
         os_radio(RADIO_RX);
         return;
     }
-    os_setTimedCallback(&LMIC.osjob, rxtime, FUNC_ADDR(startRxBcn));
+    engineSetTimedCallback(&LMIC.osjob, rxtime, FUNC_ADDR(startRxBcn));
     return;
 
   txdelay:
     if( (LMIC.clmode & CLASS_C) ) {
         setupRx2ClassC();
     }
-    os_setTimedCallback(&LMIC.osjob, txbeg-TX_RAMPUP, FUNC_ADDR(runEngineUpdate));
+    engineSetTimedCallback(&LMIC.osjob, txbeg-TX_RAMPUP, FUNC_ADDR(runEngineUpdate));
 }
 
 
@@ -3069,6 +3660,10 @@ void LMIC_setDrTxpow (dr_t dr, s1_t txpowadj) {
 
 void LMIC_shutdown (void) {
     os_clearCallback(&LMIC.osjob);
+    engineDirty(ENG_JOB);
+#if defined(CFG_classc_lp)
+    os_clearCallback(&LMIC.sniffjob);
+#endif
     os_radio(RADIO_STOP);
     LMIC.opmode |= OP_SHUTDOWN;
 }
@@ -3094,13 +3689,41 @@ u1_t LMIC_regionCode (u1_t regionIdx) {
 void LMIC_reset_ex (u1_t regionCode) {
     os_radio(RADIO_STOP);
     os_clearCallback(&LMIC.osjob);
+#if defined(CFG_classc_lp)
+    os_clearCallback(&LMIC.sniffjob);
+    ostime_t sniffIntv = LMIC.sniffIntv;
+#endif
 
+#if defined(CFG_mcast_fast)
+    mcrx_t mcRxFunc = LMIC.mcRxFunc;
+    u1_t mcRxPort = LMIC.mcRxPort;
+#endif
+#if defined(CFG_join_backoff)
+    const region_t* region = LMIC.region;
+    typeof(LMIC.jbo) jbo = LMIC.jbo;
+#endif
     os_clearMem((u1_t*) &LMIC, sizeof(LMIC));
+#if defined(CFG_mcast_fast)
+    LMIC.mcRxFunc = mcRxFunc;
+    LMIC.mcRxPort = mcRxPort;
+#endif
+#if defined(CFG_join_backoff)
+    LMIC.jbo = jbo;
+#endif
+#if defined(CFG_classc_lp)
+    LMIC.sniffIntv = sniffIntv;
+#endif
+    lce_init();
 
     // set region
     int regionIdx = LMIC_regionIdx(regionCode);
     ASSERT(regionIdx >= 0);
     LMIC.region = &REGIONS[regionIdx];
+#if defined(CFG_join_backoff)
+    if( region != NULL && LMIC.region != region ) {
+        LMIC.jbo.chnl = 0; // channel preference is per region
+    }
+#endif
     // reset and calibrate radio
     LMIC.freq = (REGION.maxFreq - REGION.minFreq) / 2;
     os_radio(RADIO_INIT);
@@ -3135,9 +3758,11 @@ void LMIC_init (void) {
 void LMIC_clrTxData (void) {
     LMIC.opmode &= ~(OP_TXDATA|OP_TXRXPEND|OP_POLL);
     LMIC.pendTxLen = 0;
+    LMIC.pendTxJit = NULL;
     if( (LMIC.opmode & (OP_JOINING|OP_SCAN)) != 0 ) // do not interfere with JOINING/SCANNING
         return;
     os_clearCallback(&LMIC.osjob);
+    engineDirty(ENG_JOB);
     os_radio(RADIO_STOP);
     engineUpdate();
 }
@@ -3160,10 +3785,20 @@ int LMIC_setTxData2 (u1_t port, u1_t* data, u1_t dlen, u1_t confirmed) {
     LMIC.pendTxConf = confirmed;
     LMIC.pendTxPort = port;
     LMIC.pendTxLen  = dlen;
+    LMIC.pendTxJit  = NULL;
     LMIC_setTxData();
     return 0;
 }
 
+// Zero-copy variant - payload is written into LMIC.frame by jitfunc when frame is built
+void LMIC_setTxDataJit (u1_t port, txjit_t jitfunc, u1_t confirmed) {
+    LMIC.pendTxConf = confirmed;
+    LMIC.pendTxPort = port;
+    LMIC.pendTxLen  = 0;
+    LMIC.pendTxJit  = jitfunc;
+    LMIC_setTxData();
+}
+
 
 // Send a payload-less message to signal device is alive
 void LMIC_sendAlive (void) {
@@ -3205,6 +3840,27 @@ void LMIC_setClassC (u1_t enabled) {
     engineUpdate();
 }
 
+#if defined(CFG_classc_lp)
+// Set CAD interval for class C reception (0=continuous RX). The network
+// server must send class C downlinks with a preamble of at least
+// LMIC_sniffPreamble() symbols.
+void LMIC_setClassCSniff (ostime_t intv) {
+    LMIC.sniffIntv = intv;
+    LMIC.sniffTime = os_getTime() - intv;
+    os_clearCallback(&LMIC.sniffjob);
+    if( (LMIC.clmode & CLASS_C) && CLASSC_IDLE() ) {
+        os_radio(RADIO_STOP); // (stop continuous RX or ongoing CAD)
+        engineUpdate();
+    }
+}
+
+// Return downlink preamble length in symbols required at the current RX2
+// datarate, 0 if continuous RX is used.
+u1_t LMIC_sniffPreamble (void) {
+    return sniffSyms();
+}
+#endif
+
 //! \brief Setup given session keys
 //! and put the MAC in a state as if
 //! a join request/accept would have negotiated just these keys.
@@ -3245,24 +3901,51 @@ void LMIC_setSession (u4_t netid, devaddr_t devaddr, const u1_t* nwkKey,
     LMIC.dn1DrOffIdx = 0;
 }
 
+#if defined(CFG_mcast_fast)
+void LMIC_setMultiCastHandler (u1_t port, mcrx_t func) {
+    LMIC.mcRxPort = port;
+    LMIC.mcRxFunc = func;
+}
+#endif
+
 int LMIC_setMultiCastSession (devaddr_t grpaddr, const u1_t* nwkKeyDn, const u1_t* appKey, u4_t seqnoADn) {
     session_t* s;
-    for(s = LMIC.sessions; s<LMIC.sessions+MAX_MULTICAST_SESSIONS && s->grpaddr!=0 && s->grpaddr!=grpaddr; s++);
-    if (s >= LMIC.sessions+MAX_MULTICAST_SESSIONS)
-	return 0;
+    int pos = findMultiCastSession(grpaddr);
+    if( pos >= 0 ) {
+        s = &LMIC.sessions[LMIC.mcsorted[pos]];
+    } else {
+        if( LMIC.mccount >= MAX_MULTICAST_SESSIONS || grpaddr == 0 )
+            return 0;
+        for(s = LMIC.sessions; s->grpaddr!=0; s++);
+        pos = ~pos;
+        os_moveMem(&LMIC.mcsorted[pos+1], &LMIC.mcsorted[pos], LMIC.mccount-pos);
+        LMIC.mcsorted[pos] = s - LMIC.sessions;
+        LMIC.mccount += 1;
+    }
 
     s->grpaddr  = grpaddr;
     s->seqnoADn = seqnoADn;
 
     if( nwkKeyDn != (u1_t*)0 ) {
         os_copyMem(s->nwkKeyDn, nwkKeyDn, 16);
-	os_copyMem(&LMIC.lceCtx.mcgroup[LCE_MCGRP_0 + (s-LMIC.sessions)].nwkSKeyDn, nwkKeyDn, 16);
     }
 
     if( appKey != (u1_t*)0 ) {
         os_copyMem(s->appKey, appKey, 16);
-	os_copyMem(&LMIC.lceCtx.mcgroup[LCE_MCGRP_0 + (s-LMIC.sessions)].appSKey, appKey, 16);
     }
+    lce_loadMultiCastKeys(LCE_MCGRP_0 + (s-LMIC.sessions), nwkKeyDn, appKey);
+    return 1;
+}
+
+int LMIC_clrMultiCastSession (devaddr_t grpaddr) {
+    int pos = findMultiCastSession(grpaddr);
+    if( pos < 0 )
+        return 0;
+    int idx = LMIC.mcsorted[pos];
+    LMIC.mccount -= 1;
+    os_moveMem(&LMIC.mcsorted[pos], &LMIC.mcsorted[pos+1], LMIC.mccount-pos);
+    os_clearMem(&LMIC.sessions[idx], sizeof(session_t));
+    lce_clearMultiCastKeys(LCE_MCGRP_0 + idx);
     return 1;
 }
 
@@ -3342,6 +4025,89 @@ ostime_t LMIC_nextTx (ostime_t now) {
     return nextTx(now);
 }
 
+// Forecast how many frames with payload length plen (incl. 13 bytes MAC
+// overhead) at datarate dr can be started within the next horizon ticks,
+// given current band/channel/global duty-cycle state. This replays the
+// avail bookkeeping of updateTx without changing it, and assumes PSA
+// channels pass LBT.
+int LMIC_txBudget (dr_t dr, u1_t plen, ostime_t horizon) {
+    ostime_t airtime = calcAirTime(updr2rps(dr), plen);
+    if( LMIC.noDC ) {
+        return horizon / airtime + 1;
+    }
+    osxtime_t xnow = os_getXTime();
+    osxtime_t xend = xnow + horizon;
+    osxtime_t gavail = xnow; // earliest start of next frame (global constraints)
+    if( LMIC.globalDutyRate != 0 ) {
+        osxtime_t t = os_time2XTime(LMIC.globalDutyAvail, xnow);
+        if( t > gavail ) {
+            gavail = t;
+        }
+    }
+    ostime_t gstep = (LMIC.globalDutyRate != 0) ? (airtime << LMIC.globalDutyRate) : airtime;
+    int n = 0;
+#ifdef REG_DYN
+    if( !REG_IS_FIX() ) {
+        osxtime_t chav[MAX_DYN_CHNLS], bav[MAX_BANDS];
+        for( u1_t i = 0; i < MAX_BANDS && REGION.bands[i].lo; i++ ) {
+            bav[i] = getAvail(LMIC.dyn.bandAvail[i]);
+        }
+        u2_t map = 0;
+        for( u1_t chnl = 0; chnl < MAX_DYN_CHNLS; chnl++ ) {
+            if( (LMIC.dyn.channelMap & (1 << chnl)) && (LMIC.dyn.chDrMap[chnl] & (1 << dr)) ) {
+                chav[chnl] = getAvail(LMIC.dyn.chAvail[chnl]);
+                map |= (1 << chnl);
+            }
+        }
+        while( map ) {
+            // find channel which becomes available first
+            osxtime_t start = OSXTIME_MAX;
+            u1_t c = 0;
+            for( u1_t chnl = 0; chnl < MAX_DYN_CHNLS; chnl++ ) {
+                if( map & (1 << chnl) ) {
+                    osxtime_t avail = chav[chnl];
+                    osxtime_t bavail = bav[LMIC.dyn.chUpFreq[chnl] & BAND_MASK];
+                    if( (REGION.flags & REG_PSA) ? (bavail < avail) : (bavail > avail) ) {
+                        avail = bavail;
+                    }
+                    if( avail < start ) {
+                        start = avail;
+                        c = chnl;
+                    }
+                }
+            }
+            if( start < gavail ) {
+                start = gavail;
+            }
+            if( start >= xend ) {
+                break;
+            }
+            n += 1;
+            u1_t b = LMIC.dyn.chUpFreq[c] & BAND_MASK;
+            bav[b] = start + airtime * REGION.bands[b].txcap;
+            chav[c] = start + airtime * REGION.chTxCap;
+            gavail = start + gstep;
+        }
+        return n;
+    }
+#endif
+#ifdef REG_FIX
+    osxtime_t avail = getAvail(LMIC.globalAvail);
+    if( avail > gavail ) {
+        gavail = avail;
+    }
+#if CFG_us915
+    if( isREGION(US915) && dr != REGION.fixDr && gstep < ms2osticks(400) ) {
+        gstep = ms2osticks(400); // FHSS: max 1 transmission every 400 ms
+    }
+#endif
+    if( gavail < xend ) {
+        n = (xend - gavail - 1) / gstep + 1;
+    }
+#endif
+    return n;
+}
+
 #if defined(CFG_simul)
 #include "addr2func.h"
 #include "arr2len.h"
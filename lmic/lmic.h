@@ -142,6 +142,19 @@ typedef struct {
 enum { TXCONF_ATTEMPTS    =   8 };   //!< Transmit attempts for confirmed frames
 enum { MAX_MISSED_BCNS    =  20 };   // threshold for triggering rejoin requests
 enum { MAX_RXSYMS         = 100 };   // stop tracking beacon beyond this
+#if defined(CFG_bcn_predict)
+#ifndef BCN_HIST
+#define BCN_HIST 4                      // number of drift measurements used by predictor
+#endif
+enum { BCN_RESYNC_MISSED  =   4 };   // missed beacons before resync via DeviceTimeReq
+enum { BCN_RESYNC_TRIES   =   3 };   // number of uplinks carrying DeviceTimeReq
+#endif
+
+#if defined(CFG_tx_prestage)
+#ifndef TX_STAGE_LEN
+#define TX_STAGE_LEN 64                 // max. size of data frame staged for repetitions
+#endif
+#endif
 
 #define RXDERR_NUM 5
 #define RXDERR_SHIFT 4
@@ -159,6 +172,14 @@ enum { TXRX_GUARD_ms      =  6000 };  // msecs - don't start TX-RX transaction b
 enum { JOIN_GUARD_ms      =  9000 };  // msecs - don't start Join Req/Acc transaction before beacon
 enum { TXRX_BCNEXT_secs   =     2 };  // secs - earliest start after beacon time
 enum { RETRY_PERIOD_secs  =     3 };  // secs - random period for retrying a confirmed send
+enum { LBT_BUSY_MAX       =     5 };  // channel found busy by LBT is skipped for up to 2^(LBT_BUSY_MAX-1) secs
+#if defined(CFG_ping_coalesce) && !defined(PING_COALESCE_osticks)
+// max. gap between ping slots (end of RX to ramp-up of next RX) to keep radio in standby
+#define PING_COALESCE_osticks ms2osticks(10)
+#endif
+#if defined(CFG_classc_lp)
+enum { SNIFF_CAD_SYMS     =     2 };  // syms - duration of a CAD operation
+#endif
 
 // Keep in sync with evdefs.hpp::drChange
 enum { DRCHG_SET, DRCHG_NOJACC, DRCHG_NOACK, DRCHG_NOADRACK, DRCHG_NWKCMD };
@@ -186,14 +207,13 @@ enum { BCN_NONE    = 0x00,   //!< No beacon received
 //! Information about the last and previous beacons.
 typedef struct {
     ostime_t txtime;  //!< Time when the beacon was sent
+    u4_t     time;    //!< GPS time in seconds of last beacon (received or surrogate)
+    s4_t     lat;     //!< Lat field of last beacon (valid only if BCN_FULL set)
+    s4_t     lon;     //!< Lon field of last beacon (valid only if BCN_FULL set)
     s1_t     rssi;    //!< Adjusted RSSI value of last received beacon
     s1_t     snr;     //!< Scaled SNR value of last received beacon
     u1_t     flags;   //!< Last beacon reception and tracking states. See BCN_* values.
-    u4_t     time;    //!< GPS time in seconds of last beacon (received or surrogate)
-    //
     u1_t     info;    //!< Info field of last beacon (valid only if BCN_FULL set)
-    s4_t     lat;     //!< Lat field of last beacon (valid only if BCN_FULL set)
-    s4_t     lon;     //!< Lon field of last beacon (valid only if BCN_FULL set)
 } bcninfo_t;
 
 // purpose of receive window - lmic_t.rxState
@@ -238,6 +258,31 @@ enum _ev_t { EV_SCAN_TIMEOUT=1, EV_BEACON_FOUND,
              EV_TXDONE, EV_DATARATE, EV_START_SCAN, EV_ADR_BACKOFF, EV_SHUTDOWN };
 typedef enum _ev_t ev_t;
 
+// Just-in-time payload callback: write FRMPayload (max. maxlen bytes) directly
+// into the frame buffer at buf and return its length (<0 to cancel payload).
+// Invoked whenever the frame is built, i.e. also for nbTrans repetitions of
+// the same frame counter, which must yield an identical payload.
+typedef int (*txjit_t) (u1_t* buf, int maxlen);
+
+#if defined(CFG_mcast_fast)
+// Multicast fast path handler (CFG_mcast_fast): called for multicast downlinks
+// on the registered port received during continuous class C RX. The frame
+// counter and MIC have been verified against the group session, and the
+// payload is decrypted in place and valid only during the call; RX is re-armed
+// right after the handler returns without a full engine update (unless the
+// handler queued an uplink).
+typedef void (*mcrx_t) (u1_t port, u1_t* data, int dlen);
+#endif
+
+// Join back-off state (CFG_join_backoff), for saving across device resets
+// with LMIC_getJoinBackoff() and restoring with LMIC_setJoinBackoff().
+typedef struct {
+    u4_t        elapsed;      // seconds since first join attempt
+    u4_t        airtime;      // join airtime in current back-off window (ms)
+    u1_t        active;       // joining (back-off applies)
+    u1_t        chnl;         // channel (block) of last successful join
+} lmic_joinbo_t;
+
 
 // Internal use values in lmic_t.opts, uses the unused upper nibble
 // of option bitmap 1 (0xf0).
@@ -282,36 +327,73 @@ typedef u2_t avail_t;
 #define CHMAP_SZ (MAX_FIX_CHNLS+15)/16
 
 struct lmic_t {
+    // Members are grouped by use and ordered by alignment within each group
+    // (8/4-byte fields first, then 2-byte, then bytes and byte arrays) to
+    // avoid padding. Fields used on every TX/RX come first.
+
     // Radio settings TX/RX (also accessed by HAL)
     ostime_t    txend;
     ostime_t    rxtime;  // timestamp when frame was fully received
     ostime_t    rxtime0; // timestamp when preamble of frame was received (computed)
     u4_t        freq;
+    rps_t       rps;
     s1_t        rssi;
     s1_t        snr;
-    rps_t       rps;
     u1_t        rxsyms;
     u1_t        dndr;
     s1_t        txpow;     // dBm -- needs to be combined with brdTxPowOff
 
+    // Public part of MAC state
+    u1_t        txCnt;
+    u1_t        txrxFlags;  // transaction flags (TX-RX combo)
+    u1_t        dataBeg;    // 0 or start of data (dataBeg-1 is port)
+    u1_t        dataLen;    // 0 no data or zero length data, >0 byte count of data
+
     osjob_t     osjob;
 
+    // Per-frame MAC state
+    u4_t        netid;        // current network id (~0 - none)
+    devaddr_t   devaddr;
+    u4_t        seqnoDn;      // device level down stream seqno
+#if defined(CFG_lorawan11)
+    u4_t        seqnoADn;     // device level down stream seqno (AFCntDown)
+#endif
+    u4_t        seqnoUp;
+    u2_t        opmode;
+    u1_t        clmode;       // current/pending class A/B/C
+    u1_t        pollcnt;      // >0 waiting for an answer from network
+    u1_t        txChnl;       // channel for next TX
+    dr_t        datarate;     // current data rate
+    u1_t        nbTrans;      // ADR controlled frame repetition
+    u1_t        dnConf;       // dn frame confirm pending: LORA::FCT_ACK or 0
+
+    // Duty cycle and channel plan
     osxtime_t   baseAvail;                      // base time for availability
+    const region_t* region;
+    ostime_t    globalDutyAvail; // time device can send again  -- XXX:PROBLEM if no TX for ~18h we have a rollover here!! --> avail_t??
     avail_t     globalAvail;                    // next available DC (global)
     u1_t        noDC;                           // disable all duty cycle
-
-    const region_t* region;
+    u1_t        globalDutyRate;  // max rate: 1/2^k
+    u1_t        refChnl;         // channel randomizer - search relative to this indicator
     union {
 #ifdef REG_DYN
         // ETSI-like (dynamic channels)
         struct {
-            avail_t     bandAvail[MAX_BANDS];   // next available DC (per band)
-            avail_t     chAvail[MAX_DYN_CHNLS]; // next available DC (per channel)
+#if defined(CFG_dyn_index)
+            osxtime_t   nextAvail;              // earliest DC availability for idxDr
+#endif
             freq_t      chUpFreq[MAX_DYN_CHNLS];// uplink frequency
             freq_t      chDnFreq[MAX_DYN_CHNLS];// downlink frequency
+            avail_t     bandAvail[MAX_BANDS];   // next available DC (per band)
+            avail_t     chAvail[MAX_DYN_CHNLS]; // next available DC (per channel)
             drmap_t     chDrMap[MAX_DYN_CHNLS]; // enabled data rates
+            u1_t        chBusy[MAX_DYN_CHNLS];  // LBT busy score (per channel)
 
             u2_t        channelMap;             // active channels
+#if defined(CFG_dyn_index)
+            u2_t        drChMap[16];            // active channels per data rate
+            u1_t        idxDr;                  // data rate of nextAvail (0xff=invalid)
+#endif
         } dyn;
 #endif
 #ifdef REG_FIX
@@ -323,55 +405,99 @@ struct lmic_t {
 #endif
     };
 
-    u1_t        refChnl;         // channel randomizer - search relative to this indicator
-    u1_t        txChnl;          // channel for next TX
-    u1_t        globalDutyRate;  // max rate: 1/2^k
-    ostime_t    globalDutyAvail; // time device can send again  -- XXX:PROBLEM if no TX for ~18h we have a rollover here!! --> avail_t??
+#if defined(CFG_engine_incr) || defined(CFG_engine_stats)
+    struct {
+#if defined(CFG_engine_incr)
+        osjobcb_t   func;         // scheduled job at last evaluation
+        ostime_t    txend;
+        ostime_t    globalDutyAvail;
+        ostime_t    bcnRxtime;
+        ostime_t    deadline;
+#endif
+#if defined(CFG_engine_stats)
+        u4_t        calls;        // number of engineUpdate invocations
+        u4_t        evals;        // number of full evaluations
+#endif
+#if defined(CFG_engine_incr)
+        u2_t        opmode;
+        u1_t        dirty;        // explicitly flagged changes (ENG_*)
+        u1_t        wait;         // evaluation ended with timed job below
+        u1_t        clmode;       // snapshot of inputs at last evaluation
+        u1_t        pollcnt;
+        u1_t        datarate;
+        u1_t        globalDutyRate;
+#endif
+    } eng;
+#endif
 
-    u4_t        netid;        // current network id (~0 - none)
-    u2_t        opmode;
-    u1_t        clmode;       // current/pending class A/B/C
-    u1_t        pollcnt;      // >0 waiting for an answer from network
-    u1_t        nbTrans;      // ADR controlled frame repetition
+    // TX power, timing and ADR
+    osxtime_t   gpsEpochOff;  // gpstime = gpsEpochOff+getXTime(), 0=undefined
+#if defined(CFG_join_backoff)
+    struct {
+        osxtime_t   start;    // time of first join attempt
+        osxtime_t   next;     // earliest next join request if budget exhausted (0=none)
+        ostime_t    airtime;  // aggregated join airtime in current window
+        u1_t        active;   // joining
+        u1_t        win;      // current back-off window
+        u1_t        chnl;     // preferred join channel (block)
+    } jbo;                    // kept across LMIC_reset
+#endif
+    s4_t        rxdErrs[RXDERR_NUM];
+    s4_t        adrAckReq;    // counter until we reset data rate (0x80000000=off)
+    u4_t        adrAckLimit;  // ADR_ACK_LIMIT
+    u4_t        adrAckDelay;  // ADR_ACK_DELAY
+    s2_t        drift;        // last measured drift
+    s2_t        lastDriftDiff;
+    s2_t        maxDriftDiff;
+#if defined(CFG_bcn_predict)
+    struct {
+        s2_t    drift[BCN_HIST]; // measured drift per beacon period (compensated), newest first
+        u1_t    per[BCN_HIST];   // beacon period number (mod 256) of measurement
+        u1_t    n;               // number of measurements
+        u1_t    base;            // beacon period number of last received beacon
+        s2_t    resid;           // max. residual of linear fit
+        s2_t    comp;            // external drift compensation (ticks per beacon period)
+        s4_t    sum;             // predicted drift accumulated over missed beacons
+    } bdp;                    // beacon drift predictor
+#endif
     s1_t        txPowAdj;     // adjustment for txpow (ADR controlled)
     s1_t        brdTxPowOff;  // board-specific power adjustment offset
-    dr_t        datarate;     // current data rate
     u1_t        errcr;        // error coding rate (used for TX only)
     u1_t        rejoinCnt;    // adjustment for rejoin datarate
-    s2_t        drift;        // last measured drift
-    s2_t        lastDriftDiff;
-    s2_t        maxDriftDiff;
-    osxtime_t   gpsEpochOff;  // gpstime = gpsEpochOff+getXTime(), 0=undefined
-    s4_t        rxdErrs[RXDERR_NUM];
     u1_t        rxdErrIdx;
+#if defined(CFG_rxwin_adapt)
+    u1_t        rxdErrCnt;    // number of RX timing samples since last re-init/miss
+#endif
+    u1_t        adrEnabled;
 
+    // Pending uplink data
+    txjit_t     pendTxJit;    // if set, payload is built in place instead of from pendTxData
+#if defined(CFG_mcast_fast)
+    mcrx_t      mcRxFunc;     // multicast fast path handler (kept across LMIC_reset)
+    u1_t        mcRxPort;     // multicast fast path port
+#endif
     u1_t        pendTxPort;
     u1_t        pendTxConf;   // confirmed data
     u1_t        pendTxLen;    // +0x80 = confirmed
-    u1_t        pendTxData[MAX_LEN_PAYLOAD];
     u1_t        pendTxNoRx;   // don't listen for down data after tx
+    u1_t        pendTxData[MAX_LEN_PAYLOAD];
 
-    u2_t        devNonce;     // last generated nonce
-    lce_ctx_t   lceCtx;
-    devaddr_t   devaddr;
-    u4_t        seqnoDn;      // device level down stream seqno
-#if defined(CFG_lorawan11)
-    u4_t        seqnoADn;     // device level down stream seqno (AFCntDown)
+    // Frame buffer, shared by TX and RX
+    u1_t        frame[MAX_LEN_FRAME];
+#if defined(CFG_tx_prestage)
+    // encrypted copy of last data frame, replayed for repetitions of same FCnt
+    u1_t        stageLen;     // length of staged frame (0=none)
+    u1_t        stageFlags;   // txrxFlags (TXRX_NOTX) of staged frame
+    u1_t        stage[TX_STAGE_LEN];
 #endif
-    u4_t        seqnoUp;
-
-    u1_t        dnConf;       // dn frame confirm pending: LORA::FCT_ACK or 0
-    s4_t        adrAckReq;    // counter until we reset data rate (0x80000000=off)
-    u4_t        adrAckLimit;  // ADR_ACK_LIMIT
-    u4_t        adrAckDelay;  // ADR_ACK_DELAY
 
+    // MAC command answers
+    u4_t        dn2Freq;
+    u4_t        dnfqAcks;     // ack bit pending
     u1_t        margin;       // bits 7/6:RFU, 0-5: SNR of last DevStatusReq frame, reported by DevStatusAns to network
     u1_t        gwmargin;     // last reported by network via LinkCheckAns
     u1_t        gwcnt;        //  - ditto -
-    u1_t        foptsUpLen;
-    u1_t        foptsUp[64];  // pending FOpts in up direction - cleared after next send
     bit_t       devsAns;      // device status answer pending
-    u1_t        adrEnabled;
     u1_t        moreData;     // NWK has more data pending
     bit_t       dutyCapAns;   // have to ACK duty cycle settings
     //XXX:old: u1_t        snchAns;      // answer set new channel
@@ -379,19 +505,22 @@ struct lmic_t {
     s1_t        dn1DrOffIdx;  // index into DR offset table (can be negative in some regions!)
     // 2nd RX window (after up stream)
     u1_t        dn2Dr;
-    u4_t        dn2Freq;
     u1_t        dn2Ans;       // 0=no answer pend, 0x80+ACKs
     u1_t        dn1DlyAns;    // 0=no answer pend, 0x80 send MCMD_RXTM_ANS
     u1_t        dnfqAns;      // # of DNFQ in this down frame
     u1_t        dnfqAnsPend;  // pending ACK bits (2 each)
-    u4_t        dnfqAcks;     // ack bit pending
-
-    // multicast sessions
-    session_t  sessions[MAX_MULTICAST_SESSIONS];
-
 #if defined(CFG_lorawan11)
     u1_t        opts;         // negotiated protocol options
 #endif
+    u1_t        foptsUpLen;
+    u1_t        foptsUp[64];  // pending FOpts in up direction - cleared after next send
+
+    // Session keys and multicast sessions
+    lce_ctx_t   lceCtx;
+    session_t  sessions[MAX_MULTICAST_SESSIONS];
+    u1_t        mcsorted[MAX_MULTICAST_SESSIONS]; // indices of active sessions sorted by grpaddr
+    u1_t        mccount;      // number of active multicast sessions
+    u2_t        devNonce;     // last generated nonce
 
     // Class B state
     u1_t        missedBcns;   // unable to track last N beacons
@@ -399,19 +528,12 @@ struct lmic_t {
     //XXX:old: u1_t        pingSetAns;   // answer set cmd and ACK bits
     rxsched_t   ping;         // pingable setup
 
-    // Public part of MAC state
-    u1_t        txCnt;
-    u1_t        txrxFlags;  // transaction flags (TX-RX combo)
-    u1_t        dataBeg;    // 0 or start of data (dataBeg-1 is port)
-    u1_t        dataLen;    // 0 no data or zero length data, >0 byte count of data
-    u1_t        frame[MAX_LEN_FRAME];
-
-    u1_t        bcnfAns;      // mcmd beacon freq: bit7:pending, bit0:ACK/NACK
-    u1_t        bcnChnl;
     u4_t        bcnFreq;      // 0=default, !=0: specific BCN freq/no hopping
-    u1_t        bcnRxsyms;    //
     ostime_t    bcnRxtime;
     bcninfo_t   bcninfo;      // Last received beacon info
+    u1_t        bcnfAns;      // mcmd beacon freq: bit7:pending, bit0:ACK/NACK
+    u1_t        bcnChnl;
+    u1_t        bcnRxsyms;    //
 
     u1_t        noRXIQinversion;
 
@@ -422,6 +544,16 @@ struct lmic_t {
 
     // radio power consumption
     u4_t        radioPwr_ua;  // power consumption of current radio operation in uA
+    u1_t        radioPwr_rxon; // current radio operation is continuous RX
+#if defined(CFG_ping_coalesce)
+    u1_t        radioStandby; // keep radio in standby after current RX (next ping slot follows)
+#endif
+#if defined(CFG_classc_lp)
+    // low-power class C: periodic CAD instead of continuous RX2
+    osjob_t     sniffjob;     // job to start next CAD
+    ostime_t    sniffIntv;    // CAD interval (0=continuous RX)
+    ostime_t    sniffTime;    // start of last CAD
+#endif
 
 #ifdef CFG_testpin
     // Signal specific event via a GPIO pin.
@@ -454,12 +586,17 @@ u1_t  LMIC_regionCode   (u1_t regionIdx);
 void  LMIC_clrTxData    (void);
 void  LMIC_setTxData    (void);
 int   LMIC_setTxData2   (u1_t port, u1_t* data, u1_t dlen, u1_t confirmed);
+void  LMIC_setTxDataJit (u1_t port, txjit_t jitfunc, u1_t confirmed);
 void  LMIC_sendAlive    (void);
 
 u1_t  LMIC_enableTracking  (u1_t tryBcnInfo);
 void  LMIC_disableTracking (void);
 
 void  LMIC_setClassC     (u1_t enabled);
+#if defined(CFG_classc_lp)
+void  LMIC_setClassCSniff (ostime_t intv);
+u1_t  LMIC_sniffPreamble  (void);
+#endif
 void  LMIC_stopPingable  (void);
 u1_t  LMIC_setPingable   (u1_t intvExp);
 void  LMIC_tryRejoin     (void);
@@ -467,6 +604,17 @@ void  LMIC_tryRejoin     (void);
 int  LMIC_scan (ostime_t timeout);
 int  LMIC_track (ostime_t when);
 int LMIC_setMultiCastSession (devaddr_t grpaddr, const u1_t* nwkKeyDn, const u1_t* appKey, u4_t seqnoAdn);
+int LMIC_clrMultiCastSession (devaddr_t grpaddr);
+#if defined(CFG_mcast_fast)
+void LMIC_setMultiCastHandler (u1_t port, mcrx_t func);
+#endif
+#if defined(CFG_bcn_predict)
+void LMIC_setDriftComp (s2_t comp);
+#endif
+#if defined(CFG_join_backoff)
+void LMIC_getJoinBackoff (lmic_joinbo_t* jbo);
+void LMIC_setJoinBackoff (const lmic_joinbo_t* jbo);
+#endif
 
 void LMIC_setSession (u4_t netid, devaddr_t devaddr, const u1_t* nwkKey,
 #if defined(CFG_lorawan11)
@@ -484,6 +632,7 @@ rps_t    LMIC_dndr2rps (u1_t dr);
 ostime_t LMIC_calcAirTime (rps_t rps, u1_t plen);
 u1_t     LMIC_maxAppPayload();
 ostime_t LMIC_nextTx (ostime_t now);
+int      LMIC_txBudget (dr_t dr, u1_t plen, ostime_t horizon);
 
 // Simulation only APIs
 #if defined(CFG_simul)
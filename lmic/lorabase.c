@@ -0,0 +1,136 @@
+// Copyright (C) 2016-2019 Semtech (International) AG. All rights reserved.
+// Copyright (C) 2014-2016 IBM Corporation. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#include "lmic.h"
+
+// number of entries in airtime cache (power of two, 0 to disable)
+#ifndef AIRTIME_CACHE_SZ
+#define AIRTIME_CACHE_SZ 8
+#endif
+
+#if (AIRTIME_CACHE_SZ & (AIRTIME_CACHE_SZ - 1)) != 0
+#error "AIRTIME_CACHE_SZ must be a power of two"
+#endif
+
+static const u1_t SENSITIVITY[7][3] = {
+    // ------------bw----------
+    // 125kHz    250kHz    500kHz
+    { 141-109,  141-109, 141-109 },  // FSK
+    { 141-127,  141-124, 141-121 },  // SF7
+    { 141-129,  141-126, 141-123 },  // SF8
+    { 141-132,  141-129, 141-126 },  // SF9
+    { 141-135,  141-132, 141-129 },  // SF10
+    { 141-138,  141-135, 141-132 },  // SF11
+    { 141-141,  141-138, 141-135 }   // SF12
+};
+
+int getSensitivity (rps_t rps) {
+    return -141 + SENSITIVITY[getSf(rps)][getBw(rps)];
+}
+
+// compute airtime of frame with given radio parameters and payload length
+static ostime_t airtime (rps_t rps, u1_t plen) {
+    u1_t bw = getBw(rps);  // 0,1,2 = 125,250,500kHz
+    u1_t sf = getSf(rps);  // 0=FSK, 1..6 = SF7..12
+    if( sf == FSK ) {
+        return (plen+/*preamble*/5+/*syncword*/3+/*len*/1+/*crc*/2) * /*bits/byte*/8
+            * (s4_t)OSTICKS_PER_SEC / /*kbit/s*/50000;
+    }
+    u1_t sfx = 4*(sf+(7-SF7));
+    u1_t q = sfx - 8*enDro(rps);
+    int tmp = 8*plen - sfx + 28 + (getNocrc(rps)?0:16) - (getIh(rps)?20:0);
+    if( tmp > 0 ) {
+        tmp = (tmp + q - 1) / q;
+        tmp *= getCr(rps)+5;
+        tmp += 8;
+    } else {
+        tmp = 8;
+    }
+    tmp = (tmp<<2) + /*preamble*/49 /* 4 * (8 + 4.25) */;
+    // bw = 125000 = 15625 * 2^3
+    //      250000 = 15625 * 2^4
+    //      500000 = 15625 * 2^5
+    // sf = 7..12
+    //
+    // osticks =  tmp * OSTICKS_PER_SEC * 1<<sf / bw
+    //
+    // 3 => counter reduced divisor 125000/8 => 15625
+    // 2 => counter 2 shift on tmp
+    sfx = sf+(7-SF7) - (3+2) - bw;
+    int div = 15625;
+    if( sfx > 4 ) {
+        // prevent 32bit signed int overflow in last step
+        div >>= sfx-4;
+        sfx = 4;
+    }
+    // Need 32bit arithmetic for this last step
+    return (((ostime_t)tmp << sfx) * OSTICKS_PER_SEC + div/2) / div;
+}
+
+#if AIRTIME_CACHE_SZ > 0
+// Small direct-mapped cache of computed airtimes. The computation above needs
+// two divisions which are costly on cores without hardware divider, and most
+// calls use the same few radio parameter/length combinations. Entries with an
+// airtime of zero are unused (every real frame has a non-zero airtime).
+//
+// The cache has a single writer: it is only filled by calcAirTime() from job
+// context. The radio drivers use calcAirTimeIrq() in interrupt context, which
+// only reads. An entry is invalidated before it is rewritten, so an interrupt
+// arriving in between sees either a complete entry or a miss.
+static volatile struct {
+    ostime_t airtime;
+    rps_t rps;
+    u1_t plen;
+} airtimecache[AIRTIME_CACHE_SZ];
+
+static ostime_t lookup (unsigned int idx, rps_t rps, u1_t plen) {
+    ostime_t t = airtimecache[idx].airtime;
+    return (t != 0 && airtimecache[idx].rps == rps && airtimecache[idx].plen == plen) ? t : 0;
+}
+
+#define CACHEIDX(rps,plen) (((rps) ^ ((rps) >> 5) ^ (plen)) & (AIRTIME_CACHE_SZ - 1))
+
+ostime_t calcAirTime (rps_t rps, u1_t plen) {
+    unsigned int idx = CACHEIDX(rps, plen);
+    ostime_t t = lookup(idx, rps, plen);
+    if( t == 0 ) {
+        t = airtime(rps, plen);
+        airtimecache[idx].airtime = 0;
+        airtimecache[idx].rps = rps;
+        airtimecache[idx].plen = plen;
+        airtimecache[idx].airtime = t;
+    }
+    return t;
+}
+
+ostime_t calcAirTimeIrq (rps_t rps, u1_t plen) {
+    ostime_t t = lookup(CACHEIDX(rps, plen), rps, plen);
+    return (t != 0) ? t : airtime(rps, plen);
+}
+#else
+ostime_t calcAirTime (rps_t rps, u1_t plen) {
+    return airtime(rps, plen);
+}
+
+ostime_t calcAirTimeIrq (rps_t rps, u1_t plen) {
+    return airtime(rps, plen);
+}
+#endif
+
+extern inline sf_t  getSf    (rps_t params);
+extern inline rps_t setSf    (rps_t params, sf_t sf);
+extern inline bw_t  getBw    (rps_t params);
+extern inline rps_t setBw    (rps_t params, bw_t cr);
+extern inline cr_t  getCr    (rps_t params);
+extern inline rps_t setCr    (rps_t params, cr_t cr);
+extern inline int   getNocrc (rps_t params);
+extern inline rps_t setNocrc (rps_t params, int nocrc);
+extern inline int   getIh    (rps_t params);
+extern inline rps_t setIh    (rps_t params, int ih);
+extern inline rps_t makeRps  (sf_t sf, bw_t bw, cr_t cr, int ih, int nocrc);
+extern inline int   sameSfBw (rps_t r1, rps_t r2);
+extern inline int   enDro    (rps_t params);
+extern inline u1_t  selectChnl (u2_t map, u1_t k);
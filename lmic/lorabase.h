@@ -309,6 +309,16 @@ inline int sameSfBw(rps_t r1, rps_t r2) { return ((r1^r2)&0x1F) == 0; }
 // Must be enabled for: SF11/BW125, SF12/BW125, SF12/BW250
 inline int enDro (rps_t params) { return (int)getSf(params) - getBw(params) >= SF11; }
 
+// return index of k-th (0-based) set bit in channel map word (k must be less than popcount(map))
+inline u1_t selectChnl (u2_t map, u1_t k) {
+    u1_t i = 0, n;
+    if( k >= (n = __builtin_popcount(map & 0xff)) ) { k -= n; i += 8; map >>= 8; }
+    if( k >= (n = __builtin_popcount(map & 0x0f)) ) { k -= n; i += 4; map >>= 4; }
+    if( k >= (n = __builtin_popcount(map & 0x03)) ) { k -= n; i += 2; map >>= 2; }
+    if( k >= (map & 1) ) { i += 1; }
+    return i;
+}
+
 //
 // BEG: Keep in sync with lorabase.hpp
 // ================================================================================
@@ -316,8 +326,9 @@ inline int enDro (rps_t params) { return (int)getSf(params) - getBw(params) >= S
 
 // Convert between dBm values and power codes (MCMD_LADR_XdBm)
 s1_t pow2dBm (u1_t mcmd_ladr_p1);
-// Calculate airtime
+// Calculate airtime (job context; use calcAirTimeIrq in interrupt context)
 ostime_t calcAirTime (rps_t rps, u1_t plen);
+ostime_t calcAirTimeIrq (rps_t rps, u1_t plen);
 // Sensitivity at given SF/BW
 int getSensitivity (rps_t rps);
 
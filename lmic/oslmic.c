@@ -8,14 +8,36 @@
 #include "aes.h"
 #include "peripherals.h"
 
+// clock speed for jobs scheduled with OSJOB_FLAG_SLOWCLK
+#if defined(CFG_runspeed) && !defined(OS_RUNSPEED_SLOWCLK)
+#define OS_RUNSPEED_SLOWCLK HAL_RUNSPEED_REDUCED
+#endif
+
 // RUNTIME STATE
 static struct {
     osjob_t* scheduledjobs;
+    osxjob_t* farjobs;  // extended jobs beyond range of ostime_t (sorted by deadline)
     unsigned int exact;
+#if defined(CFG_jobheap)
+    unsigned int seqno;
+#endif
+#if defined(CFG_jobstats)
+    os_jobstats jobstats[OS_JOBSTATS_MAX];
+    u4_t jobstats_ovfl; // invocations not recorded because table was full
+#endif
+#if defined(CFG_stackmon)
+    u4_t* stackdirty;   // lowest overwritten stack word found by last scan (NULL if not painted)
+    u4_t* stacklow;     // lowest overwritten stack word seen so far
+#endif
     union {
         u4_t randwrds[4];
         u1_t randbuf[16];
     } /* anonymous */;
+    u1_t randidx;       // next unused byte in randbuf (0=uninitialized, 16=empty)
+#if !defined(PERIPH_TRNG)
+    u1_t randkey[16];   // private key of AES-CTR generator
+    u4_t randctr[4];    // counter block of AES-CTR generator
+#endif
 } OS;
 
 void os_init (void* bootarg) {
@@ -23,39 +45,86 @@ void os_init (void* bootarg) {
     hal_init(bootarg);
 #ifndef CFG_noradio
     radio_init(false);
+    BOOTTRACE(HAL_BOOT_RADIO);
 #endif
     LMIC_init();
+    BOOTTRACE(HAL_BOOT_LMIC);
 }
 
-// return next random byte derived from seed buffer
-// (buf[0] holds index of next byte to be returned 1-16)
+// Random numbers are taken from the TRNG if available, or are otherwise
+// generated by AES in counter mode with a private key derived from the
+// seed. The private key is loaded into AESkey directly (not through
+// os_aesSetKey()), so it never displaces cached session keys.
 
 void rng_init (void) {
+#ifndef PERIPH_TRNG
+    memcpy(OS.randkey, __TIME__, 8);
+    os_getDevEui(OS.randkey + 8);
+    // derive private key from seed
+    os_copyMem(AESkey, OS.randkey, 16);
+    os_aes(AES_ENC, OS.randkey, 16);
+#endif
+    OS.randidx = 16;
+}
+
+// refill random buffer
+static void rng_refill (void) {
 #ifdef PERIPH_TRNG
     trng_next(OS.randwrds, 4);
 #else
-    memcpy(OS.randbuf, __TIME__, 8);
-    os_getDevEui(OS.randbuf + 8);
+    OS.randwrds[0] = OS.randctr[0];
+    OS.randwrds[1] = OS.randctr[1];
+    OS.randwrds[2] = OS.randctr[2];
+    OS.randwrds[3] = OS.randctr[3]++;
+    os_copyMem(AESkey, OS.randkey, 16);
+    os_aes(AES_ENC, OS.randbuf, 16);
 #endif
 }
 
+void os_getRndBytes (u1_t* buf, int n) {
+    if( OS.randidx == 0 ) {
+        rng_init(); // lazy initialization
+    }
+    while( n > 0 ) {
+        if( OS.randidx == 16 ) {
+#ifdef PERIPH_TRNG
+            // fill whole words directly
+            if( n >= 4 && ((uintptr_t) buf & 3) == 0 ) {
+                trng_next((u4_t*) buf, n >> 2);
+                buf += n & ~3;
+                n &= 3;
+                continue;
+            }
+#endif
+            rng_refill();
+            OS.randidx = 0;
+        }
+        int m = 16 - OS.randidx;
+        if( m > n ) {
+            m = n;
+        }
+        memcpy(buf, OS.randbuf + OS.randidx, m);
+        OS.randidx += m;
+        buf += m;
+        n -= m;
+    }
+}
+
 u1_t os_getRndU1 (void) {
-    u1_t i = OS.randbuf[0];
-    switch( i ) {
-        case 0:
-            rng_init(); // lazy initialization
-            // fall-thru
-        case 16:
-            os_aes(AES_ENC, OS.randbuf, 16); // encrypt seed with any key
-            i = 0;
-    }
-    u1_t v = OS.randbuf[i++];
-    OS.randbuf[0] = i;
+    u1_t v;
+    os_getRndBytes(&v, 1);
     return v;
 }
 
-bit_t os_cca (u2_t rps, u4_t freq) { //XXX:this belongs into os_radio module
-    return 0;  // never grant access
+// listen before talk: sample RSSI on freq for the region's CCA time,
+// return 1 if channel is clear (max RSSI below the region's CCA threshold)
+bit_t os_cca (u2_t rps, u4_t freq) {
+    LMIC.rps = rps;
+    LMIC.freq = freq;
+    LMIC.rxtime = LMIC.region->ccaTime;
+    LMIC.rssi = LMIC.region->ccaThreshold;
+    os_radio(RADIO_CCA);
+    return LMIC.rssi < LMIC.region->ccaThreshold;
 }
 
 u1_t os_getBattLevel (void) {
@@ -74,9 +143,122 @@ osxtime_t os_time2XTime (ostime_t t, osxtime_t context) {
     return context + ((t - (ostime_t) context));
 }
 
+#if defined(CFG_jobheap)
+// The scheduled jobs are kept in an intrusive pairing heap ordered by deadline
+// and insertion sequence number. This yields the jobs in exactly the same
+// order as the sorted list (jobs with equal deadlines run first-come first-served),
+// but insertion is O(1) and removal is O(log n) amortized instead of O(n). Since
+// all queue manipulations run with interrupts disabled, this bounds the IRQ-off
+// latency when many jobs are pending; the price are three extra words per job.
+
+// return true if job a is due before job b
+static int jobbefore (osjob_t* a, osjob_t* b) {
+    ostime_t d = a->deadline - b->deadline; // (cmp diff, not abs!)
+    return (d != 0) ? (d < 0) : ((int) (a->seqno - b->seqno) < 0);
+}
+
+// meld two heap roots, return new root
+static osjob_t* meldjobs (osjob_t* a, osjob_t* b) {
+    if( jobbefore(b, a) ) {
+        osjob_t* t = a; a = b; b = t;
+    }
+    // make b leftmost child of a
+    if( (b->next = a->child) ) {
+        b->next->prev = b;
+    }
+    b->prev = a;
+    a->child = b;
+    return a;
+}
+
+// two-pass pairing of sibling list, return new root
+static osjob_t* pairjobs (osjob_t* j) {
+    osjob_t* acc = NULL;
+    // first pass: meld pairs from left to right, collect results in reverse order
+    while( j ) {
+        osjob_t* a = j;
+        osjob_t* b = a->next;
+        j = b ? b->next : NULL;
+        a->next = a->prev = NULL;
+        if( b ) {
+            b->next = b->prev = NULL;
+            a = meldjobs(a, b);
+        }
+        a->next = acc;
+        acc = a;
+    }
+    // second pass: meld results from right to left
+    while( acc ) {
+        osjob_t* a = acc;
+        acc = a->next;
+        a->next = NULL;
+        j = j ? meldjobs(j, a) : a;
+    }
+    return j;
+}
+
+// remove queued job from heap
+static void removejob (osjob_t* job) {
+    osjob_t* sub = pairjobs(job->child);
+    if( job == OS.scheduledjobs ) {
+        OS.scheduledjobs = sub;
+    } else {
+        osjob_t* p = job->prev;
+        if( p->child == job ) {
+            p->child = job->next;
+        } else {
+            p->next = job->next;
+        }
+        if( job->next ) {
+            job->next->prev = p;
+        }
+        if( sub ) {
+            OS.scheduledjobs = meldjobs(OS.scheduledjobs, sub);
+        }
+    }
+    job->child = job->next = job->prev = NULL;
+}
+
+// return 1 if job is queued (job must have been zero-initialized, see oslmic.h)
+static int queuedjob (osjob_t* job) {
+    ASSERT(job->prev == NULL || job->prev->child == job || job->prev->next == job);
+    return job == OS.scheduledjobs || job->prev != NULL;
+}
+
+// unlink job from queue, return 1 if removed
+static int unlinkjob (osjob_t* job) {
+    if( !queuedjob(job) ) {
+        return 0;
+    }
+    removejob(job);
+    if ((job->flags & OSJOB_FLAG_APPROX) == 0) {
+        OS.exact -= 1;
+    }
+    return 1;
+}
+
+// insert job into queue
+static void insertjob (osjob_t* job) {
+    job->seqno = OS.seqno++;
+    job->child = job->next = job->prev = NULL;
+    OS.scheduledjobs = OS.scheduledjobs ? meldjobs(OS.scheduledjobs, job) : job;
+}
+
+#else
+
+// return 1 if job is queued
+static int queuedjob (osjob_t* job) {
+    for(osjob_t* j = OS.scheduledjobs; j; j = j->next) {
+        if(j == job) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
 // unlink job from queue, return 1 if removed
-static int unlinkjob (osjob_t** pnext, osjob_t* job) {
-    for( ; *pnext; pnext = &((*pnext)->next)) {
+static int unlinkjob (osjob_t* job) {
+    for(osjob_t** pnext = &OS.scheduledjobs; *pnext; pnext = &((*pnext)->next)) {
         if(*pnext == job) { // unlink
             *pnext = job->next;
 	    if ((job->flags & OSJOB_FLAG_APPROX) == 0) {
@@ -88,48 +270,127 @@ static int unlinkjob (osjob_t** pnext, osjob_t* job) {
     return 0;
 }
 
+// insert job into queue
+static void insertjob (osjob_t* job) {
+    osjob_t** pnext;
+    job->next = NULL;
+    for(pnext=&OS.scheduledjobs; *pnext; pnext=&((*pnext)->next)) {
+        if((*pnext)->deadline - job->deadline > 0) { // (cmp diff, not abs!)
+            // enqueue before next element and stop
+            job->next = *pnext;
+            break;
+        }
+    }
+    *pnext = job;
+}
+
+#endif
+
+// Extended jobs with deadlines beyond the range of ostime_t are kept in a
+// separate list sorted by their 64-bit deadline. The list is only looked at
+// when the scheduler is about to sleep; once the first deadline is within
+// range, the job is moved to the job queue. Until then, the sleep time is
+// limited to that point, so a far-future job costs no wake-ups of its own.
+
 // NOTE: since the job queue might begin with jobs which already have a shortly expired deadline, we cannot use
 //       the maximum span of ostime to schedule the next job (otherwise it would be queued in first)!
 #define XJOBTIME_MAX_DIFF (OSTIME_MAX_DIFF / 2)
 
-// update schedule of extended job
-static void extendedjobcb (osxjob_t* xjob) {
-    hal_disableIRQs();
-    osxtime_t now = os_getXTime();
-    if (xjob->deadline - now > XJOBTIME_MAX_DIFF) {
-	// schedule intermediate callback
-	os_setTimedCallbackEx((osjob_t*) xjob, (ostime_t) (now + XJOBTIME_MAX_DIFF), (osjobcb_t) extendedjobcb, OSJOB_FLAG_APPROX);
+// unlink job from far-future list, return 1 if removed
+static int unlinkfarjob (osjob_t* job) {
+    for( osxjob_t** pnext = &OS.farjobs; *pnext; pnext = (osxjob_t**) &(*pnext)->job.next ) {
+        if( &(*pnext)->job == job ) {
+            *pnext = (osxjob_t*) job->next;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// insert extended job into queue or far-future list
+static void insertxjob (osxjob_t* xjob) {
+    if( xjob->deadline - os_getXTime() <= XJOBTIME_MAX_DIFF ) {
+        os_setTimedCallbackEx(&xjob->job, (ostime_t) xjob->deadline, xjob->func, OSJOB_FLAG_APPROX);
     } else {
-	// schedule final callback
-	os_setTimedCallbackEx((osjob_t*) xjob, (ostime_t) xjob->deadline, xjob->func, OSJOB_FLAG_APPROX);
+        osxjob_t** pnext;
+        xjob->job.next = NULL;
+        xjob->job.func = xjob->func;
+        xjob->job.flags = OSJOB_FLAG_APPROX;
+        for( pnext = &OS.farjobs; *pnext; pnext = (osxjob_t**) &(*pnext)->job.next ) {
+            if( (*pnext)->deadline > xjob->deadline ) {
+                xjob->job.next = &(*pnext)->job;
+                break;
+            }
+        }
+        *pnext = xjob;
     }
-    hal_enableIRQs();
+}
+
+// move first far-future job to queue if its deadline is within range and
+// return 1, or limit sleep deadline to when it will be and return 0
+static int farjobs_update (ostime_t now, ostime_t* pdeadline) {
+    osxjob_t* xjob = OS.farjobs;
+    osxtime_t xnow = os_time2XTime(now, os_getXTime());
+    if( xjob->deadline - xnow <= XJOBTIME_MAX_DIFF ) {
+        OS.farjobs = (osxjob_t*) xjob->job.next;
+        insertxjob(xjob);
+        return 1;
+    }
+    if( xjob->deadline - XJOBTIME_MAX_DIFF - xnow < *pdeadline - now ) {
+        *pdeadline = (ostime_t) (xjob->deadline - XJOBTIME_MAX_DIFF);
+    }
+    return 0;
 }
 
 // schedule job far in the future (deadline may exceed max delta of ostime_t 2^31-1 ticks = 65535.99s = 18.2h)
 void os_setExtendedTimedCallback (osxjob_t* xjob, osxtime_t xtime, osjobcb_t cb) {
     hal_disableIRQs();
-    unlinkjob(&OS.scheduledjobs, (osjob_t*) xjob);
+    if( !unlinkjob(&xjob->job) ) {
+        unlinkfarjob(&xjob->job);
+    }
     xjob->func = cb;
     xjob->deadline = xtime;
-    extendedjobcb(xjob);
+    insertxjob(xjob);
     hal_enableIRQs();
 }
 
 // clear scheduled job, return 1 if job was removed
 int os_clearCallback (osjob_t* job) {
     hal_disableIRQs();
-    int r = unlinkjob(&OS.scheduledjobs, job);
+    int r = unlinkjob(job) || unlinkfarjob(job);
     hal_enableIRQs();
     return r;
 }
 
+// return 1 if job is scheduled
+int os_jobPending (osjob_t* job) {
+    hal_disableIRQs();
+    int r = queuedjob(job);
+    for( osxjob_t* xj = OS.farjobs; xj && !r; xj = (osxjob_t*) xj->job.next ) {
+        r = (&xj->job == job);
+    }
+    hal_enableIRQs();
+    return r;
+}
+
+// return 1 and deadline of earliest job if any job is scheduled
+int os_getNextDeadline (ostime_t* pdeadline) {
+    hal_disableIRQs();
+    osjob_t* j = OS.scheduledjobs;
+    if( j ) {
+        *pdeadline = j->deadline;
+    }
+    hal_enableIRQs();
+    return j != NULL;
+}
+
 // schedule timed job
 void os_setTimedCallbackEx (osjob_t* job, ostime_t time, osjobcb_t cb, unsigned int flags) {
-    osjob_t** pnext;
     hal_disableIRQs();
     // remove if job was already queued
-    unlinkjob(&OS.scheduledjobs, job);
+    if( !unlinkjob(job) ) {
+        unlinkfarjob(job);
+    }
     // fill-in job
     ostime_t now = os_getTime();
     if( flags & OSJOB_FLAG_NOW ) {
@@ -139,23 +400,110 @@ void os_setTimedCallbackEx (osjob_t* job, ostime_t time, osjobcb_t cb, unsigned
     }
     job->deadline = time;
     job->func = cb;
-    job->next = NULL;
     job->flags = flags;
     if ((flags & OSJOB_FLAG_APPROX) == 0) {
 	OS.exact += 1;
     }
     // insert into schedule
-    for(pnext=&OS.scheduledjobs; *pnext; pnext=&((*pnext)->next)) {
-        if((*pnext)->deadline - time > 0) { // (cmp diff, not abs!)
-            // enqueue before next element and stop
-            job->next = *pnext;
+    insertjob(job);
+    hal_enableIRQs();
+}
+
+#if defined(CFG_jobstats)
+static os_jobstats* jobstats_update (osjobcb_t func, s4_t late, u4_t run, u4_t irqoff) {
+    os_jobstats* js = OS.jobstats;
+    for( ; js < OS.jobstats + OS_JOBSTATS_MAX; js++ ) {
+        if( js->func == func || js->func == NULL ) {
             break;
         }
     }
-    *pnext = job;
+    if( js == OS.jobstats + OS_JOBSTATS_MAX ) {
+        OS.jobstats_ovfl += 1;
+        return NULL;
+    }
+    js->func = func;
+    js->count += 1;
+    js->runtime += run;
+    js->maxrun = max(js->maxrun, run);
+    js->maxlate = max(js->maxlate, late);
+    js->maxirqoff = max(js->maxirqoff, irqoff);
+    return js;
+}
+
+// copy and reset job statistics, return number of entries
+int os_jobstats_collect (os_jobstats* stats, int max) {
+    int n = 0;
+    hal_disableIRQs();
+    for( ; n < max && n < OS_JOBSTATS_MAX && OS.jobstats[n].func; n++ ) {
+        stats[n] = OS.jobstats[n];
+    }
+    memset(OS.jobstats, 0, sizeof(OS.jobstats));
+    OS.jobstats_ovfl = 0;
     hal_enableIRQs();
+    return n;
+}
+
+void os_jobstats_dump (void) {
+#if defined(CFG_DEBUG)
+    os_jobstats stats[OS_JOBSTATS_MAX];
+    u4_t ovfl = OS.jobstats_ovfl;
+    int n = os_jobstats_collect(stats, OS_JOBSTATS_MAX);
+    for( int i = 0; i < n; i++ ) {
+        debug_printf("job %08x: n=%u avg=%u max=%u late=%d irqoff=%u"
+#if defined(CFG_stackmon)
+                " stack=%u"
+#endif
+                "\r\n",
+                (u4_t) (uintptr_t) stats[i].func, stats[i].count, stats[i].runtime / stats[i].count,
+                stats[i].maxrun, stats[i].maxlate, stats[i].maxirqoff
+#if defined(CFG_stackmon)
+                , stats[i].maxstack
+#endif
+                );
+    }
+    if( ovfl ) {
+        debug_printf("job stats: %u invocations not recorded\r\n", ovfl);
+    }
+#if defined(CFG_stackmon)
+    debug_printf("stack: %u bytes free\r\n", os_stackfree());
+#endif
+#endif
+}
+#endif
+
+#if defined(CFG_stackmon)
+// Stack high-water monitor: the unused stack below the scheduler frame is
+// painted before each job and scanned for the lowest overwritten word after
+// it. Interrupts serviced while the job runs are accounted to the job.
+#define STACK_PAINT     0xa55a5aa5
+#define STACK_GUARD     16      // words left unpainted below scheduler frame
+
+// paint stack up to top (only the part overwritten since the last scan)
+static void stack_paint (u4_t* top) {
+    u4_t* p = OS.stackdirty ? OS.stackdirty : hal_stack_limit();
+    while( p < top ) {
+        *p++ = STACK_PAINT;
+    }
+}
+
+// return number of bytes used below top since stack was painted
+static u4_t stack_scan (u4_t* top) {
+    u4_t* p = hal_stack_limit();
+    while( p < top && *p == STACK_PAINT ) {
+        p++;
+    }
+    OS.stackdirty = p;
+    if( OS.stacklow == NULL || p < OS.stacklow ) {
+        OS.stacklow = p;
+    }
+    return (top - p) << 2;
 }
 
+u4_t os_stackfree (void) {
+    return OS.stacklow ? (OS.stacklow - (u4_t*) hal_stack_limit()) << 2 : 0;
+}
+#endif
+
 void os_runstep (void) {
     // check for runnable jobs
     hal_disableIRQs();
@@ -165,18 +513,57 @@ void os_runstep (void) {
     if( j ) {
         deadline = j->deadline;
         if( (deadline - now) <= 0 ) {
-	    OS.scheduledjobs = j->next; // de-queue
+	    unlinkjob(j); // de-queue
             if( (j->flags & OSJOB_FLAG_IRQDISABLED) == 0 ) {
                 hal_enableIRQs();
             }
             hal_watchcount(30); // max 60 sec XXX
+#if defined(CFG_runspeed)
+            bool slowclk = (j->flags & OSJOB_FLAG_SLOWCLK) != 0;
+            if( slowclk ) {
+                hal_setRunSpeed(OS_RUNSPEED_SLOWCLK);
+            }
+#endif
+#if defined(CFG_stackmon)
+            u4_t* stacktop = (u4_t*) __builtin_frame_address(0) - STACK_GUARD;
+            stack_paint(stacktop);
+#endif
+#if defined(CFG_jobstats)
+            osjobcb_t func = j->func;
+            hal_irqoff_max(); // reset
+            ostime_t t0 = os_getTime();
+            func(j);
+            ostime_t t1 = os_getTime();
+#if defined(CFG_stackmon)
+            u4_t stack = stack_scan(stacktop);
+            os_jobstats* js = jobstats_update(func, t0 - deadline, t1 - t0, hal_irqoff_max());
+            if( js ) {
+                js->maxstack = max(js->maxstack, stack);
+            }
+#else
+            jobstats_update(func, t0 - deadline, t1 - t0, hal_irqoff_max());
+#endif
+#else
             j->func(j);
+#if defined(CFG_stackmon)
+            stack_scan(stacktop);
+#endif
+#endif
+#if defined(CFG_runspeed)
+            if( slowclk ) {
+                hal_setRunSpeed(HAL_RUNSPEED_FULL);
+            }
+#endif
             hal_watchcount(0);
             return;
         }
     } else {
         deadline = now + 0x7fffff00;
     }
+    if( OS.farjobs && farjobs_update(now, &deadline) ) {
+        hal_enableIRQs();
+        return;
+    }
     hal_sleep(OS.exact ? HAL_SLEEP_EXACT : HAL_SLEEP_APPROX, deadline);
     hal_enableIRQs();
 }
@@ -193,5 +580,6 @@ static u1_t evcatEn = 0xFF;
 void os_logEv (uint8_t evcat, uint8_t evid, uint32_t evparam) {
     if( evcat >= EVCAT_MAX && evcat < sizeof(evcatEn)*8 && (evcatEn & (1<<evcat)) == 0 )
         return;
+    EVLOG("ev %u:%u %08x", evcat, evid, evparam);
     hal_logEv(evcat, evid, evparam);
 }
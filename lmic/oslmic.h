@@ -35,6 +35,7 @@ typedef const char*	str_t;
 #include <string.h>
 #if !defined(CFG_simul)
 #include "debug.h"
+#include "evlog.h"
 #endif
 #if !defined(CFG_noassert)
 #if defined(CFG_simul) && defined(CFG_DEBUG)
@@ -141,6 +142,8 @@ extern u4_t AESKEY[];
 #if defined(CFG_simul)
 extern int log_lvl;
 void LOGIT(int lvl, char* fmt, ...);
+#elif defined(CFG_evlog)
+#define LOGIT(lvl, fmt, ...) EVLOG(fmt, ## __VA_ARGS__)
 #else
 #define LOGIT(lvl, fmt, ...) debug_printf(fmt, ## __VA_ARGS__)
 #endif
@@ -151,20 +154,27 @@ void os_init (void* bootarg);
 void os_runstep (void);
 void os_runloop (void);
 u1_t os_getRndU1 (void);
+void os_getRndBytes (u1_t* buf, int n);
 
 //================================================================================
 
 #ifndef RX_RAMPUP
 #ifndef CFG_rxrampup
 #if defined(BRD_sx1261_radio) || defined(BRD_sx1262_radio)
-#define RX_RAMPUP  (us2osticks(5000))
+#define RX_RAMPUP_INI  (us2osticks(5000))
 #elif defined(BRD_sx1272_radio) || defined(BRD_sx1276_radio)
-#define RX_RAMPUP  (us2osticksCeil(2800))
+#define RX_RAMPUP_INI  (us2osticksCeil(2800))
 #else
-#define RX_RAMPUP  (0)
+#define RX_RAMPUP_INI  (0)
 #endif
 #else
-#define RX_RAMPUP  (us2osticksCeil(CFG_rxrampup))
+#define RX_RAMPUP_INI  (us2osticksCeil(CFG_rxrampup))
+#endif
+#if defined(CFG_rxrampup_adapt)
+// measured at runtime, never exceeds initial value
+#define RX_RAMPUP  (radio_rxRampup())
+#else
+#define RX_RAMPUP  RX_RAMPUP_INI
 #endif
 #endif
 #ifndef TX_RAMPUP
@@ -208,6 +218,11 @@ typedef s8_t  osxtime_t;
 
 struct osjob_t; // fwd decl
 typedef void (*osjobcb_t) (struct osjob_t*);
+// Jobs must be zero-initialized before they are first passed to any os_*
+// function (static storage, or cleared with os_clearMem), and must not be
+// moved, copied or cleared while they are scheduled. With CFG_jobheap,
+// whether a job is queued is decided from its links alone, so a job with
+// stale contents (e.g. uninitialized on the stack) corrupts the heap.
 typedef struct osjob_t {
     struct osjob_t* next;
     ostime_t deadline;
@@ -217,6 +232,11 @@ typedef struct osjob_t {
     void* ctx;
     int pqidx;
 #endif
+#if defined(CFG_jobheap)
+    struct osjob_t* child;      // leftmost child in pairing heap (next is the right sibling)
+    struct osjob_t* prev;       // parent if leftmost child, left sibling otherwise, NULL if root
+    unsigned int seqno;         // insertion order, breaks ties between equal deadlines
+#endif
 } osjob_t;
 
 // extended os job wrapper for future events exceeding max range of ostime_t
@@ -227,6 +247,32 @@ struct osxjob_t {
     osjobcb_t func;
 };
 
+#if defined(CFG_jobstats)
+#ifndef OS_JOBSTATS_MAX
+#define OS_JOBSTATS_MAX 16
+#endif
+// per-callback job statistics (times in ticks)
+typedef struct {
+    osjobcb_t func;     // job callback
+    u4_t count;         // number of invocations
+    u4_t runtime;       // accumulated execution time
+    u4_t maxrun;        // longest execution time
+    s4_t maxlate;       // largest delay between deadline and start of execution
+    u4_t maxirqoff;     // longest IRQ-off section while job was running
+#if defined(CFG_stackmon)
+    u4_t maxstack;      // deepest stack use below scheduler (bytes)
+#endif
+} os_jobstats;
+
+int os_jobstats_collect (os_jobstats* stats, int max);
+void os_jobstats_dump (void);
+#endif
+
+#if defined(CFG_stackmon)
+// return smallest amount of free stack seen so far (bytes)
+u4_t os_stackfree (void);
+#endif
+
 #include "hal.h"
 
 #ifndef HAS_os_calls
@@ -251,6 +297,7 @@ enum {
     OSJOB_FLAG_APPROX      = (1 << 0), // actual time of job may be approximate
     OSJOB_FLAG_IRQDISABLED = (1 << 1), // IRQs will be disabled when job is run -- THE JOB MUST RE-ENABLE IRQs BY CALLING hal_enableIRQs() !!!
     OSJOB_FLAG_NOW         = (1 << 2), // job is immediately runnable (time parameter is ignored)
+    OSJOB_FLAG_SLOWCLK     = (1 << 3), // job is not timing-critical and may run at reduced clock speed (CFG_runspeed)
 };
 void os_setTimedCallbackEx (osjob_t* job, ostime_t time, osjobcb_t cb, unsigned int flags);
 void os_setExtendedTimedCallback (osxjob_t* xjob, osxtime_t xtime, osjobcb_t cb);
@@ -259,10 +306,17 @@ void os_setExtendedTimedCallback (osxjob_t* xjob, osxtime_t xtime, osjobcb_t cb)
 #define os_setTimedCallback(job, time, cb) os_setTimedCallbackEx(job, time, cb, 0)
 #define os_setApproxTimedCallback(job, time, cb) os_setTimedCallbackEx(job, time, cb, OSJOB_FLAG_APPROX)
 #define os_setProtectedTimedCallback(job, time, cb) os_setTimedCallbackEx(job, time, cb, OSJOB_FLAG_IRQDISABLED)
+#define os_setSlowCallback(job, cb) os_setTimedCallbackEx(job, 0, cb, OSJOB_FLAG_NOW | OSJOB_FLAG_SLOWCLK)
 #endif
 #ifndef os_clearCallback
 int os_clearCallback (osjob_t* job);
 #endif
+#ifndef os_jobPending
+int os_jobPending (osjob_t* job);
+#endif
+#ifndef os_getNextDeadline
+int os_getNextDeadline (ostime_t* pdeadline);
+#endif
 #ifndef os_getTime
 ostime_t os_getTime (void);
 #endif
@@ -278,6 +332,9 @@ uint os_getTimeSecs (void);
 #ifndef os_radio
 void os_radio (u1_t mode);
 #endif
+#ifndef os_cca
+bit_t os_cca (u2_t rps, u4_t freq);
+#endif
 #ifndef os_getBattLevel
 u1_t os_getBattLevel (void);
 #endif
@@ -321,7 +378,7 @@ void os_wlsbf3 (u1_t* buf, u4_t value);
 
 //! Get random number (default impl for u2_t).
 #ifndef os_getRndU2
-#define os_getRndU2() ((u2_t)((os_getRndU1()<<8)|os_getRndU1()))
+#define os_getRndU2() ({ u2_t _r; os_getRndBytes((u1_t*) &_r, sizeof(_r)); _r; })
 #endif
 #ifndef os_crc16
 u2_t os_crc16 (u1_t* d, uint len);
@@ -349,9 +406,18 @@ void radio_init (bool calibrate); // (used by os_init())
 void radio_writeBuf (u1_t addr, u1_t* buf, u1_t len); // (used by perso)
 void radio_readBuf (u1_t addr, u1_t* buf, u1_t len); // (used by perso)
 void radio_set_irq_timeout (ostime_t timeout);
+#if defined(CFG_rxrampup_adapt)
+ostime_t radio_rxRampup (void);
+void radio_rxRampupSample (ostime_t rxtime, ostime_t now); // (used by radio drivers)
+ostime_t radio_getRxRampupEst (void); // (used by rampup service)
+void radio_setRxRampupEst (ostime_t est); // (used by rampup service)
+#endif
 
 // radio-specific functions
 bool radio_irq_process (ostime_t irqtime, u1_t diomask);
+#if defined(CFG_fifo_irq)
+u1_t radio_irq_fifo (u1_t diomask, ostime_t irqtime); // (called in IRQ context)
+#endif
 void radio_starttx (bool txcontinuous);
 void radio_startrx (bool rxcontinuous);
 void radio_sleep (void);
@@ -0,0 +1,112 @@
+// Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#ifndef _osthread_h_
+#define _osthread_h_
+
+#include "lmic.h"
+
+// Stackless threads (protothreads) on top of os jobs. A thread is a job
+// callback whose body is enclosed in OS_THREAD_BEGIN/OS_THREAD_END. The
+// OS_AWAIT_* macros start an operation that schedules the thread's job when
+// it completes, and return; when the job runs again, execution continues
+// after the await. The stack is not preserved across awaits, so local
+// variables must not be used to carry state across them (keep it in a
+// static structure that embeds the osthread_t), and awaits must not be used
+// inside switch statements of the thread body. The USART and I2C awaits
+// require peripherals.h.
+//
+//  static void blink (osjob_t* job) {
+//      osthread_t* t = OS_THREAD(job);
+//      OS_THREAD_BEGIN(t);
+//      while( 1 ) {
+//          leds_set(LED, 1);
+//          OS_AWAIT_TIMEOUT(t, ms2osticks(100));
+//          leds_set(LED, 0);
+//          OS_AWAIT_TIMEOUT(t, sec2osticks(5));
+//      }
+//      OS_THREAD_END(t);
+//  }
+
+typedef struct {
+    osjob_t job;        // job running the thread (must be first)
+    osjobcb_t func;     // thread body
+    unsigned int lc;    // local continuation (0=start)
+    int status;         // result of last await (see macros)
+    ev_t ev;            // awaited LMIC event (0=none)
+} osthread_t;
+
+#define OS_THREAD(j)            ((osthread_t*) (j))
+
+// start (or restart) thread
+static inline void os_thread_start (osthread_t* t, osjobcb_t func) {
+    t->func = func;
+    t->lc = 0;
+    t->ev = 0;
+    os_setCallback(&t->job, func);
+}
+
+// stop thread
+static inline void os_thread_stop (osthread_t* t) {
+    os_clearCallback(&t->job);
+    t->lc = 0;
+    t->ev = 0;
+}
+
+// return true if thread has not run to its end
+static inline bool os_thread_running (osthread_t* t) {
+    return t->lc != 0 || os_jobPending(&t->job);
+}
+
+// deliver LMIC event to thread (call from event handler, e.g. lwm_event hook)
+static inline void os_thread_event (osthread_t* t, ev_t ev) {
+    if( t->ev != 0 && t->ev == ev ) {
+        t->ev = 0;
+        t->status = 1;
+        os_setCallback(&t->job, t->func);
+    }
+}
+
+#define OS_THREAD_BEGIN(t)      switch( (t)->lc ) { case 0:
+#define OS_THREAD_END(t)        } (t)->lc = 0; return
+
+// (internal) start operation, return, and resume here
+#define OS__AWAIT(t, start, resume) \
+    do { (t)->lc = __LINE__; start; return; case __LINE__: resume; } while( 0 )
+
+// let other jobs run
+#define OS_YIELD(t) \
+    OS__AWAIT(t, os_setCallback(&(t)->job, (t)->func), )
+
+// wait for duration (ticks) or until time
+#define OS_AWAIT_TIMEOUT(t, ticks) \
+    OS__AWAIT(t, os_setTimedCallback(&(t)->job, os_getTime() + (ticks), (t)->func), )
+#define OS_AWAIT_TIME(t, time) \
+    OS__AWAIT(t, os_setTimedCallback(&(t)->job, (time), (t)->func), )
+
+// wait for condition, polling every interval (ticks)
+#define OS_AWAIT_COND(t, cond, interval) \
+    while( !(cond) ) OS_AWAIT_TIMEOUT(t, interval)
+
+// wait for USART transmission
+#define OS_AWAIT_USART_SEND(t, port, src, n) \
+    OS__AWAIT(t, usart_send((port), (src), (n), &(t)->job, (t)->func), )
+
+// wait for USART reception (see usart_recv, *pn holds the result)
+#define OS_AWAIT_USART(t, port, dst, pn, timeout, idle_timeout) \
+    OS__AWAIT(t, usart_recv((port), (dst), (pn), (timeout), (idle_timeout), &(t)->job, (t)->func), )
+
+// wait for I2C transfer (status holds I2C_OK/I2C_NAK/I2C_ABORT)
+#define OS_AWAIT_I2C(t, addr, buf, wlen, rlen, timeout) \
+    OS__AWAIT(t, i2c_xfer_ex((addr), (buf), (wlen), (rlen), (timeout), &(t)->job, (t)->func, &(t)->status), )
+
+// wait for LMIC event delivered with os_thread_event() (status is 1 if the
+// event occurred, 0 on timeout)
+#define OS_AWAIT_LMIC_EVENT(t, e, timeout) \
+    OS__AWAIT(t, ((t)->ev = (e), (t)->status = 0, \
+                os_setTimedCallback(&(t)->job, os_getTime() + (timeout), (t)->func)), \
+            (t)->ev = 0)
+
+#endif
@@ -43,6 +43,17 @@ void usart_send (const void* port, void* src, int n, osjob_t* job, osjobcb_t cb)
 void usart_recv (const void* port, void* dst, int* n, ostime_t timeout, ostime_t idle_timeout, osjob_t* job, osjobcb_t cb);
 void usart_abort_recv (const void* port);
 void usart_str (const void* port, const char* str);
+void usart_send_wait (const void* port);
+
+// Continuous reception into circular buffer; the job is scheduled when the
+// line goes idle or the buffer is half/completely filled. Received data is
+// accessed in place with usart_ring_peek() (returns number of contiguous
+// bytes available) and released with usart_ring_consume(). The consumer must
+// keep up, a buffer overrun by more than its size goes undetected.
+void usart_recv_ring (const void* port, void* buf, int sz, osjob_t* job, osjobcb_t cb);
+int usart_ring_peek (const void* port, unsigned char** pdata);
+void usart_ring_consume (const void* port, int n);
+void usart_stop_ring (const void* port);
 
 #endif
 
@@ -128,6 +139,24 @@ void i2c_xfer_ex (unsigned int addr, unsigned char* buf, unsigned int wlen, unsi
         ostime_t timeout, osjob_t* job, osjobcb_t cb, int* pstatus);
 void i2c_abort (void);
 
+// Queued transaction: write wlen bytes from wbuf, then (repeated start) read
+// rlen bytes into rbuf. Transactions are executed in order using DMA; upon
+// completion, the status is set and the job scheduled (if job is NULL, the
+// callback is invoked directly from interrupt context).
+typedef struct _i2c_txn i2c_txn;
+struct _i2c_txn {
+    i2c_txn* next;              // (internal)
+    unsigned int addr;
+    unsigned char* wbuf;
+    unsigned int wlen;
+    unsigned char* rbuf;
+    unsigned int rlen;
+    int status;
+    osjob_t* job;
+    osjobcb_t cb;
+};
+void i2c_submit (i2c_txn* txn);
+
 #endif
 
 
@@ -137,6 +166,15 @@ void i2c_abort (void);
 
 unsigned int adc_read (unsigned int chnl, unsigned int rate);
 
+#ifdef PERIPH_ADC_SCAN
+// Convert all channels in chmask (ascending order) nscans times into buf
+// (nscans * popcount(chmask) samples) using DMA; each sample is the average
+// of 2^ovs conversions (hardware oversampling, ovs=0..8). The job is
+// scheduled when done; the CPU can sleep in S0 meanwhile.
+void adc_scan (unsigned int chmask, unsigned int rate, unsigned int ovs,
+        unsigned short* buf, int nscans, osjob_t* job, osjobcb_t cb);
+#endif
+
 #endif
 
 
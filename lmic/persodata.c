@@ -26,8 +26,10 @@ typedef struct {
 
 _Static_assert(sizeof(persodata_v1) <= 256, "persodata struct too large");
 
+// validated copy of persodata, all accessors read from here
 static struct {
     bool valid;
+    u4_t gen;                   // incremented with every (re-)load
     persodata_v1 data;
 } pd;
 
@@ -46,10 +48,13 @@ static persodata_v1* pd_check_v1 (void* ptr) {
 
 void hal_pd_init (void) {
     persodata_v1* ppd = pd_check_v1((void*) HAL_PERSODATA_BASE);
+    pd.gen += 1;
     if( ppd ) {
         pd.data = *ppd;
         pd.valid = true;
     } else {
+        memset(&pd.data, 0, sizeof(pd.data));
+        pd.valid = false;
         // fill defaults
         uint64_t eui;
 
@@ -66,6 +71,20 @@ bool hal_pd_valid (void) {
     return pd.valid;
 }
 
+// re-validate and reload after persodata has been rewritten (returns true
+// if range [off, off+len) relative to HAL_PERSODATA_BASE touched the block)
+bool hal_pd_reload (int off, int len) {
+    if( off < (int) sizeof(persodata_v1) && off + len > 0 ) {
+        hal_pd_init();
+        return true;
+    }
+    return false;
+}
+
+u4_t hal_pd_gen (void) {
+    return pd.gen;
+}
+
 u1_t* hal_joineui (void) {
     return pd.data.joineui;
 }
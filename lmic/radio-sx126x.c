@@ -160,6 +160,43 @@ static struct {
     unsigned int sleeping:1;
 } state;
 
+#if defined(CFG_sx126x_cache)
+// shadow copy of last applied configuration commands (retained in warm sleep)
+enum {
+    SH_REGMODE,
+    SH_DIO2,
+    SH_PTYPE,
+    SH_FREQ,
+    SH_MODPARAMS,
+    SH_SYNCWORD,
+
+    SH_CNT
+};
+static struct {
+    uint8_t valid;
+    uint8_t len[SH_CNT];
+    uint8_t data[SH_CNT][8];
+} shadow;
+
+// check if configuration is already applied, otherwise record it (caller must apply it)
+static int shadow_check (int slot, const uint8_t* data, uint8_t len) {
+    if ((shadow.valid & (1 << slot)) && shadow.len[slot] == len && memcmp(shadow.data[slot], data, len) == 0) {
+        return 1;
+    }
+    shadow.valid |= (1 << slot);
+    shadow.len[slot] = len;
+    memcpy(shadow.data[slot], data, len);
+    return 0;
+}
+
+static void shadow_invalidate (int mask) {
+    shadow.valid &= ~mask;
+}
+#define SHADOW_CHECK(slot,data,len) do { if (shadow_check((slot), (data), (len))) return; } while (0)
+#else
+#define SHADOW_CHECK(slot,data,len) do { } while (0)
+#endif
+
 // ----------------------------------------
 
 static void writecmd (uint8_t cmd, const uint8_t* data, uint8_t len) {
@@ -267,11 +304,13 @@ static void SetStandby (uint8_t cfg) {
 
 // set regulator mode REGMODE_LDO or REGMODE_DCDC
 static void SetRegulatorMode (uint8_t mode) {
+    SHADOW_CHECK(SH_REGMODE, &mode, 1);
     writecmd(CMD_SETREGULATORMODE, &mode, 1);
 }
 
 // use DIO2 to drive antenna rf switch
 static void SetDIO2AsRfSwitchCtrl (uint8_t enable) {
+    SHADOW_CHECK(SH_DIO2, &enable, 1);
     writecmd(CMD_SETDIO2ASRFSWITCHCTRL, &enable, 1);
 }
 
@@ -322,6 +361,11 @@ static void SetFs (void) {
 
 // set radio to PACKET_TYPE_LORA or PACKET_TYPE_FSK mode
 static void SetPacketType (uint8_t type) {
+    SHADOW_CHECK(SH_PTYPE, &type, 1);
+#if defined(CFG_sx126x_cache)
+    // modem-specific settings have to be reapplied
+    shadow_invalidate((1 << SH_MODPARAMS) | (1 << SH_SYNCWORD));
+#endif
     writecmd(CMD_SETPACKETTYPE, &type, 1);
 }
 
@@ -350,6 +394,7 @@ static void SetRfFrequency (uint32_t freq) {
     // set frequency
     uint8_t buf[4];
     os_wmsbf4(buf, (uint32_t) (((uint64_t) freq << 25) / 32000000));
+    SHADOW_CHECK(SH_FREQ, buf, 4);
     writecmd(CMD_SETRFFREQUENCY, buf, 4);
 }
 
@@ -360,6 +405,7 @@ static void SetModulationParamsLora (u2_t rps) {
     param[1] = getBw(rps) + 4; // BW (bw125=0)
     param[2] = getCr(rps) + 1; // CR (cr45=0)
     param[3] = enDro(rps);     // low-data-rate-opt (symbol time equal or above 16.38 ms)
+    SHADOW_CHECK(SH_MODPARAMS, param, 4);
     writecmd(CMD_SETMODULATIONPARAMS, param, 4);
 }
 
@@ -374,14 +420,15 @@ static void SetModulationParamsFsk (void) {
     param[5] = 0x00; // TX frequency deviation 25kHz (deviation * 2^25 / fxtal = 25000 * 2^25 / 32000000 = 0x006666)
     param[6] = 0x66;
     param[7] = 0x66;
+    SHADOW_CHECK(SH_MODPARAMS, param, 8);
     writecmd(CMD_SETMODULATIONPARAMS, param, 8);
 }
 
 // configure packet handling for LoRa
-static void SetPacketParamsLora (u2_t rps, int len, int inv) {
+static void SetPacketParamsLora (u2_t rps, int pre, int len, int inv) {
     uint8_t param[6];
-    param[0] = 0x00; // 8 symbols preamble
-    param[1] = 0x08;
+    param[0] = pre >> 8; // preamble length (symbols)
+    param[1] = pre;
     param[2] = getIh(rps); // implicit header
     param[3] = len;
     param[4] = !getNocrc(rps);
@@ -435,6 +482,13 @@ static void GetPacketStatusLora (s1_t *rssi, s1_t *snr) {
     *snr = buf[1] * SNR_SCALEUP / 4;
 }
 
+// get instantaneous rssi (in rx mode)
+static s1_t GetRssiInst (void) {
+    uint8_t buf[1];
+    readcmd(CMD_GETRSSIINST, buf, 1);
+    return -buf[0] / 2 + RSSI_OFF;
+}
+
 // get signal quality of received packet for FSK
 static s1_t GetPacketStatusFsk (void) {
     uint8_t buf[3];
@@ -442,6 +496,21 @@ static s1_t GetPacketStatusFsk (void) {
     return -buf[2] / 2 + RSSI_OFF; // RssiAvg
 }
 
+// configure CAD on 2 symbols, switch to rx for timeout [1/64ms] on detection
+static void SetCadParams (u2_t rps, uint32_t timeout64ms) {
+    // detection peak thresholds for 2 symbols (SF7..SF12)
+    static const uint8_t detpeak[] = { 22, 22, 24, 25, 26, 30 };
+    uint8_t param[7];
+    param[0] = 0x01; // CAD_ON_2_SYMB
+    param[1] = detpeak[getSf(rps) - SF7];
+    param[2] = 10;   // detection minimum
+    param[3] = 0x01; // CAD_RX
+    param[4] = timeout64ms >> 16;
+    param[5] = timeout64ms >> 8;
+    param[6] = timeout64ms;
+    writecmd(CMD_SETCADPARAMS, param, 7);
+}
+
 // set and enable irq mask for dio1
 static void SetDioIrqParams (uint16_t mask) {
     uint8_t param[] = { mask >> 8, mask & 0xFF, mask >> 8, mask & 0xFF, 0x00, 0x00, 0x00, 0x00 };
@@ -473,6 +542,7 @@ static void SetTxPower (int pw) {
 // set sync word for LoRa
 static void SetSyncWordLora (uint16_t syncword) {
     uint8_t buf[2] = { syncword >> 8, syncword & 0xFF };
+    SHADOW_CHECK(SH_SYNCWORD, buf, 2);
     WriteRegs(REG_LORASYNCWORDMSB, buf, 2);
 }
 
@@ -519,7 +589,12 @@ static uint32_t GetRandom (void) {
 void radio_sleep (void) {
     // cache sleep state to avoid unneccessary wakeup (waking up from cold sleep takes about 4ms)
     if (state.sleeping == 0) {
+#if defined(CFG_sx126x_cache)
+	// keep configuration, so it does not have to be reapplied on wakeup
+	SetSleep(SLEEP_WARM);
+#else
 	SetSleep(SLEEP_COLD);
+#endif
 	state.sleeping = 1;
     }
 }
@@ -531,7 +606,7 @@ static void txlora (void) {
     SetPacketType(PACKET_TYPE_LORA);
     SetRfFrequency(LMIC.freq);
     SetModulationParamsLora(LMIC.rps);
-    SetPacketParamsLora(LMIC.rps, LMIC.dataLen, 0);
+    SetPacketParamsLora(LMIC.rps, 8, LMIC.dataLen, 0);
     SetTxPower(LMIC.txpow + LMIC.brdTxPowOff);
     SetSyncWordLora(0x3444);
     WriteFifo(LMIC.frame, LMIC.dataLen);
@@ -643,6 +718,9 @@ static void rxfsk (bool rxcontinuous) {
 	BACKTRACE();
 	// busy wait until exact rx time
 	ostime_t now = os_getTime();
+#if defined(CFG_rxrampup_adapt)
+	radio_rxRampupSample(LMIC.rxtime, now);
+#endif
 	if (LMIC.rxtime - now < 0) {
 	    debug_printf("WARNING: rxtime is %d ticks in the past! (ramp-up time %d ms / %d ticks)\r\n",
 			 now - LMIC.rxtime, osticks2ms(now - t0), now - t0);
@@ -665,7 +743,7 @@ static void rxlora (bool rxcontinuous) {
     SetPacketType(PACKET_TYPE_LORA);
     SetRfFrequency(LMIC.freq);
     SetModulationParamsLora(LMIC.rps);
-    SetPacketParamsLora(LMIC.rps, 255, !LMIC.noRXIQinversion);
+    SetPacketParamsLora(LMIC.rps, 8, 255, !LMIC.noRXIQinversion);
     SetSyncWordLora(0x3444);
     StopTimerOnPreamble(0);
     SetLoRaSymbNumTimeout(LMIC.rxsyms);
@@ -691,6 +769,9 @@ static void rxlora (bool rxcontinuous) {
 	BACKTRACE();
 	// busy wait until exact rx time
 	ostime_t now = os_getTime();
+#if defined(CFG_rxrampup_adapt)
+	radio_rxRampupSample(LMIC.rxtime, now);
+#endif
 	if (LMIC.rxtime - now < 0) {
 	    debug_printf("WARNING: rxtime is %d ticks in the past! (ramp-up time %d ms / %d ticks)\r\n",
 			 now - LMIC.rxtime, osticks2ms(now - t0), now - t0);
@@ -704,13 +785,82 @@ static void rxlora (bool rxcontinuous) {
     hal_enableIRQs();
 }
 
-void radio_cca () {
-    LMIC.rssi = -127; //XXX:TBD
+// LMIC.rssi = max_rssi(threshold=LMIC.rssi, duration=LMIC.rxtime, freq=LMIC.freq, bw=LMIC.rps)
+void radio_cca (void) {
+    BACKTRACE();
+    SetRegulatorMode(REGMODE_DCDC);
+    SetDIO2AsRfSwitchCtrl(1);
+    SetStandby(STDBY_RC);
+    if (getSf(LMIC.rps) == FSK) {
+	SetPacketType(PACKET_TYPE_FSK);
+	SetRfFrequency(LMIC.freq);
+	SetModulationParamsFsk();
+    } else {
+	// (receiver bandwidth of channel)
+	SetPacketType(PACKET_TYPE_LORA);
+	SetRfFrequency(LMIC.freq);
+	SetModulationParamsLora(LMIC.rps);
+    }
+    SetDioIrqParams(0);
+    ClearIrqStatus(IRQ_ALL);
+
+    // enable antenna switch for RX (and account power consumption)
+    hal_ant_switch(HAL_ANTSW_RX);
+
+    // start receiver (continuous), don't receive frames
+    SetRx(0xFFFFFF);
+
+    // initialize threshold
+    int rssi;
+    int rssi_th = LMIC.rssi;
+    int rssi_max = -128 + RSSI_OFF;
+    ostime_t t0 = os_getTime();
+
+    // sample rssi values
+    do {
+	rssi = GetRssiInst();
+	if (rssi > rssi_max) {
+	    rssi_max = rssi;
+	}
+    } while (rssi < rssi_th && os_getTime() - t0 < LMIC.rxtime);
+
+    // return max observed rssi value
+    LMIC.rssi = rssi_max;
+
+    // shutdown receiver
+    SetStandby(STDBY_RC);
+    radio_sleep();
+
+    // disable antenna switch
+    hal_ant_switch(HAL_ANTSW_OFF);
 }
 
+// CAD, on detection rx for LMIC.rxsyms symbols (expected preamble length)
 void radio_cad (void) {
-    // not yet...
-    ASSERT(0);
+    ASSERT(getSf(LMIC.rps) != FSK);
+    SetRegulatorMode(REGMODE_DCDC);
+    SetDIO2AsRfSwitchCtrl(1);
+    SetStandby(STDBY_RC);
+    SetPacketType(PACKET_TYPE_LORA);
+    SetRfFrequency(LMIC.freq);
+    SetModulationParamsLora(LMIC.rps);
+    SetPacketParamsLora(LMIC.rps, (LMIC.rxsyms < 8) ? 8 : LMIC.rxsyms, 255, !LMIC.noRXIQinversion);
+    SetSyncWordLora(0x3444);
+    StopTimerOnPreamble(0);
+    // symbol time in 1/64ms: 2^sf / bw[kHz] * 64
+    SetCadParams(LMIC.rps, ((uint32_t) LMIC.rxsyms << (getSf(LMIC.rps) + 6)) * 64 / (125 << getBw(LMIC.rps)));
+    SetDioIrqParams(IRQ_CADDONE | IRQ_CADDETECTED | IRQ_RXDONE | IRQ_TIMEOUT);
+
+    ClearIrqStatus(IRQ_ALL);
+
+    // enable IRQs in HAL
+    hal_irqmask_set(HAL_IRQMASK_DIO1);
+
+    BACKTRACE();
+    // enable antenna switch for RX (and account power consumption)
+    hal_ant_switch(HAL_ANTSW_RX);
+    // start CAD...
+    writecmd(CMD_SETCAD, NULL, 0);
 }
 
 void radio_cw (void) {
@@ -744,6 +894,9 @@ static void radio_reset (void) {
 
     // initialize state
     state.sleeping = 0;
+#if defined(CFG_sx126x_cache)
+    shadow_invalidate(~0);
+#endif
 }
 
 void radio_init (bool calibrate) {
@@ -765,6 +918,13 @@ void radio_init (bool calibrate) {
     hal_enableIRQs();
 }
 
+#if defined(CFG_fifo_irq)
+// (complete frames fit into the data buffer, nothing to stream)
+u1_t radio_irq_fifo (u1_t diomask, ostime_t irqtime) {
+    return diomask;
+}
+#endif
+
 // (run by irqjob)
 bool radio_irq_process (ostime_t irqtime, u1_t diomask) {
     uint16_t irqflags = GetIrqStatus();
@@ -788,7 +948,7 @@ bool radio_irq_process (ostime_t irqtime, u1_t diomask) {
 
             // save exact rx timestamps
             LMIC.rxtime  = irqtime - FSK_RXDONE_FIXUP; // end of frame timestamp
-	    LMIC.rxtime0 = LMIC.rxtime - calcAirTime(LMIC.rps, LMIC.dataLen); // beginning of frame timestamp
+	    LMIC.rxtime0 = LMIC.rxtime - calcAirTimeIrq(LMIC.rps, LMIC.dataLen); // beginning of frame timestamp
 #ifdef DEBUG_RX
 	    debug_printf("RX[freq=%.1F,FSK,rssi=%d,len=%d]: %h\r\n",
 			 LMIC.freq, 6, LMIC.rssi - RSSI_OFF, LMIC.dataLen, LMIC.frame, LMIC.dataLen);
@@ -830,7 +990,7 @@ bool radio_irq_process (ostime_t irqtime, u1_t diomask) {
             else if (getBw(LMIC.rps) == BW500) {
                 LMIC.rxtime -= LORA_RXDONE_FIXUP_500[getSf(LMIC.rps)];
             }
-	    LMIC.rxtime0 = LMIC.rxtime - calcAirTime(LMIC.rps, LMIC.dataLen); // beginning of frame timestamp
+	    LMIC.rxtime0 = LMIC.rxtime - calcAirTimeIrq(LMIC.rps, LMIC.dataLen); // beginning of frame timestamp
 #ifdef DEBUG_RX
 	    debug_printf("RX[freq=%.1F,sf=%d,bw=%d,rssi=%d,snr=%.2F,len=%d]: %h\r\n",
 			 LMIC.freq, 6, getSf(LMIC.rps) + 6, 125 << getBw(LMIC.rps),
@@ -845,6 +1005,17 @@ bool radio_irq_process (ostime_t irqtime, u1_t diomask) {
 	    debug_printf("RX[freq=%.1F,sf=%d,bw=%d]: TIMEOUT\r\n",
 			 LMIC.freq, 6, getSf(LMIC.rps) + 6, 125 << getBw(LMIC.rps));
 #endif
+	} else if (irqflags & IRQ_CADDONE) { // CADDONE
+	    BACKTRACE();
+	    // check if preamble symbol was detected
+	    if (irqflags & IRQ_CADDETECTED) {
+		// radio has switched to rx (CAD_RX), continue waiting
+		ClearIrqStatus(IRQ_CADDONE | IRQ_CADDETECTED);
+		return false;
+	    } else {
+		// indicate timeout
+		LMIC.dataLen = 0;
+	    }
         } else {
 	    // unexpected irq
 	    debug_printf("UNEXPECTED RADIO IRQ %04x\r\n", irqflags);
@@ -765,14 +765,20 @@ static void txlora (bool txcontinuous) {
 }
 
 static void setuprxlora (void) {
-    // select LoRa modem (from sleep mode)
-    setopmode(OPMODE_LORA_SLEEP);
+#if defined(CFG_ping_coalesce)
+    // radio may have been kept in standby after previous RX (see LMIC.radioStandby)
+    if( readReg(RegOpMode) != OPMODE_LORA_STANDBY )
+#endif
+    {
+	// select LoRa modem (from sleep mode)
+	setopmode(OPMODE_LORA_SLEEP);
 
-    // power-up tcxo
-    power_tcxo();
+	// power-up tcxo
+	power_tcxo();
 
-    // enter standby mode
-    setopmode(OPMODE_LORA_STANDBY);
+	// enter standby mode
+	setopmode(OPMODE_LORA_STANDBY);
+    }
 
     // configure LoRa modem (cfg1, cfg2, cfg3)
     configLoraModem(false);
@@ -823,6 +829,10 @@ static ostime_t bugfix_rxtime (ostime_t rxtime) {
 
 static void rxlorasingle (void) {
     ostime_t t0 = os_getTime();
+#if defined(CFG_ping_coalesce) && defined(CFG_rxrampup_adapt)
+    // ramp-up from standby is not representative
+    bool warm = (readReg(RegOpMode) == OPMODE_LORA_STANDBY);
+#endif
 
     // select modem, setup TCXO, freq, modulation
     setuprxlora();
@@ -850,6 +860,12 @@ static void rxlorasingle (void) {
     rxtime = bugfix_rxtime(rxtime);
     // wait for it...
     ostime_t now = os_getTime();
+#if defined(CFG_rxrampup_adapt)
+#if defined(CFG_ping_coalesce)
+    if( !warm )
+#endif
+    radio_rxRampupSample(rxtime, now);
+#endif
     hal_waitUntil(rxtime);
     // enable antenna switch for RX (and account power consumption)
     hal_ant_switch(HAL_ANTSW_RX);
@@ -893,6 +909,11 @@ static void rxloracad (void) {
     // select modem, setup TCXO, freq, modulation
     setuprxlora();
 
+#if defined(CFG_classc_lp)
+    // expect long preamble (LMIC.rxsyms, see lmic.c: sniffSyms())
+    writeReg(LORARegPreambleLsb, LMIC.rxsyms);
+#endif
+
     // configure DIO mapping DIO0=RxDone DIO1=RxTout DIO2=NOP DIO3=CadDone DIO4=NOP DIO5=NOP
     writeReg(RegDioMapping1, MAP1_LORA_DIO0_RXDONE | MAP1_LORA_DIO1_RXTOUT | MAP1_LORA_DIO2_NOP | MAP1_LORA_DIO3_CDDONE);
     writeReg(RegDioMapping2, MAP2_LORA_DIO4_NOP | MAP2_LORA_DIO5_NOP);
@@ -991,6 +1012,9 @@ static void rxfsk (bool rxcontinuous) {
 	radio_set_irq_timeout(LMIC.rxtime + us2osticks((2*FIFOTHRESH)*8*1000/50));
 	// busy wait until exact rx time
 	ostime_t now = os_getTime();
+#if defined(CFG_rxrampup_adapt)
+	radio_rxRampupSample(LMIC.rxtime, now);
+#endif
 	if (LMIC.rxtime - now < 0) {
 	    debug_printf("WARNING: rxtime is %d ticks in the past! (ramp-up time %d ms / %d ticks)\r\n",
 			 now - LMIC.rxtime, osticks2ms(now - t0), now - t0);
@@ -1007,7 +1031,11 @@ static void rxfsk (bool rxcontinuous) {
 }
 
 void radio_startrx (bool rxcontinuous) {
+#if defined(CFG_ping_coalesce)
+    ASSERT( (readReg(RegOpMode) & OPMODE_MASK) == OPMODE_SLEEP || readReg(RegOpMode) == OPMODE_LORA_STANDBY );
+#else
     ASSERT( (readReg(RegOpMode) & OPMODE_MASK) == OPMODE_SLEEP );
+#endif
 
     // set power consumption for statistics
     LMIC.radioPwr_ua = 11500;
@@ -1150,6 +1178,34 @@ void radio_init (bool calibrate) {
     hal_enableIRQs();
 }
 
+#if defined(CFG_fifo_irq)
+// FSK FifoEmpty (TX) and FifoLevel (RX) interrupts on DIO1 are serviced
+// directly in IRQ context, so a busy job queue cannot cause FIFO under- or
+// overruns; returns DIOs left for processing by the irq job
+__hotcode u1_t radio_irq_fifo (u1_t diomask, ostime_t irqtime) {
+    if (diomask == HAL_IRQMASK_DIO1 && getSf(LMIC.rps) == FSK) {
+	u1_t irqflags1 = readReg(FSKRegIrqFlags1);
+	u1_t irqflags2 = readReg(FSKRegIrqFlags2);
+	// (same precedence as in radio_irq_process, completion is left to irq job)
+	if ((irqflags2 & (IRQ_FSK2_PACKETSENT_MASK | IRQ_FSK2_PAYLOADREADY_MASK)) == 0
+		&& (irqflags1 & IRQ_FSK1_TIMEOUT_MASK) == 0) {
+	    if (irqflags2 & IRQ_FSK2_FIFOEMPTY_MASK) { // FIFOEMPTY (TX)
+		LoadFifo();
+		diomask = 0;
+	    } else if (irqflags2 & IRQ_FSK2_FIFOLEVEL_MASK) { // FIFOLEVEL (RX)
+		UnloadFifo();
+		diomask = 0;
+	    }
+	    if (diomask == 0) {
+		// update tx/rx timeout
+		radio_set_irq_timeout(irqtime + us2osticks((FIFOTHRESH+10)*8*1000/50));
+	    }
+	}
+    }
+    return diomask;
+}
+#endif
+
 // (run by irqjob)
 bool radio_irq_process (ostime_t irqtime, u1_t diomask) {
     // dispatch modem
@@ -1176,7 +1232,7 @@ bool radio_irq_process (ostime_t irqtime, u1_t diomask) {
 
             // save exact rx timestamps
             LMIC.rxtime  = irqtime - FSK_RXDONE_FIXUP; // end of frame timestamp
-	    LMIC.rxtime0 = LMIC.rxtime - calcAirTime(LMIC.rps, LMIC.dataLen); // beginning of frame timestamp
+	    LMIC.rxtime0 = LMIC.rxtime - calcAirTimeIrq(LMIC.rps, LMIC.dataLen); // beginning of frame timestamp
 #ifdef DEBUG_RX
 	    debug_printf("RX[freq=%.1F,FSK,rssi=%d,len=%d]: %h\r\n",
 			 LMIC.freq, 6, LMIC.rssi - RSSI_OFF, LMIC.dataLen, LMIC.frame, LMIC.dataLen);
@@ -1254,7 +1310,7 @@ bool radio_irq_process (ostime_t irqtime, u1_t diomask) {
             else if (getBw(LMIC.rps) == BW500) {
                 LMIC.rxtime -= LORA_RXDONE_FIXUP_500[getSf(LMIC.rps)];
             }
-	    LMIC.rxtime0 = LMIC.rxtime - calcAirTime(LMIC.rps, LMIC.dataLen); // beginning of frame timestamp
+	    LMIC.rxtime0 = LMIC.rxtime - calcAirTimeIrq(LMIC.rps, LMIC.dataLen); // beginning of frame timestamp
 
 	    // set FIFO read address pointer (to address of last packet received)
 	    writeReg(LORARegFifoAddrPtr, readReg(LORARegFifoRxCurrentAddr));
@@ -1279,8 +1335,14 @@ bool radio_irq_process (ostime_t irqtime, u1_t diomask) {
 	    BACKTRACE();
 	    // check if preamble symbol was detected
 	    if (irqflags & IRQ_LORA_CDDETD_MASK) {
+#if defined(CFG_classc_lp)
+		// switch to receiving (single, times out after LMIC.rxsyms if no frame follows)
+		writeReg(LORARegIrqFlags, IRQ_LORA_CDDONE_MASK | IRQ_LORA_CDDETD_MASK);
+		writeReg(RegOpMode, OPMODE_LORA_RX_SINGLE);
+#else
 		// switch to receiving (continuous)
 		writeReg(RegOpMode, OPMODE_LORA_RX);
+#endif
 		// continue waiting
 		return false;
 	    } else {
@@ -17,8 +17,72 @@ static struct {
     osjob_t irqjob;
     u1_t diomask;
     u1_t txmode;
+#if defined(CFG_ping_coalesce)
+    u1_t standby;       // radio kept in standby after last RX
+#endif
 } state;
 
+#if defined(CFG_rxrampup_adapt)
+// ----------------------------------------
+// ADAPTIVE RX RAMP-UP
+
+// number of samples before measured ramp-up is used
+#ifndef RAMPUP_MINSAMPLES
+#define RAMPUP_MINSAMPLES       8
+#endif
+// safety margin added to measured ramp-up
+#ifndef RAMPUP_GUARD
+#define RAMPUP_GUARD            us2osticksCeil(300)
+#endif
+// decay of estimate towards smaller samples (1/2^n per sample)
+#define RAMPUP_DECAY            4
+
+// The estimate follows larger samples immediately and only slowly decays
+// towards smaller ones, thus tracking the upper envelope of the ramp-up
+// times (which include job dispatch latency and radio configuration).
+static struct {
+    ostime_t est;
+    u1_t samples;
+} rampup = {
+    .est = RX_RAMPUP_INI,
+};
+
+ostime_t radio_rxRampup (void) {
+    ostime_t r = rampup.est + RAMPUP_GUARD;
+    return (rampup.samples < RAMPUP_MINSAMPLES || r > RX_RAMPUP_INI) ? RX_RAMPUP_INI : r;
+}
+
+// called by radio driver when RX is ready to be started at rxtime
+void radio_rxRampupSample (ostime_t rxtime, ostime_t now) {
+    // actual ramp-up = ramp-up used for scheduling - remaining slack
+    ostime_t r = radio_rxRampup() - (rxtime - now);
+    if( r < 0 ) {
+        r = 0;
+    } else if( r > RX_RAMPUP_INI ) {
+        r = RX_RAMPUP_INI;
+    }
+    if( rampup.samples == 0 || r > rampup.est ) {
+        rampup.est = r;
+    } else {
+        rampup.est -= (rampup.est - r) >> RAMPUP_DECAY;
+    }
+    if( rampup.samples < RAMPUP_MINSAMPLES ) {
+        rampup.samples += 1;
+    }
+}
+
+ostime_t radio_getRxRampupEst (void) {
+    return (rampup.samples < RAMPUP_MINSAMPLES) ? -1 : rampup.est;
+}
+
+void radio_setRxRampupEst (ostime_t est) {
+    if( est >= 0 && est <= RX_RAMPUP_INI ) {
+        rampup.est = est;
+        rampup.samples = RAMPUP_MINSAMPLES;
+    }
+}
+#endif
+
 // stop radio, disarm interrupts, cancel jobs
 static void radio_stop (void) {
     hal_disableIRQs();
@@ -34,9 +98,32 @@ static void radio_stop (void) {
     os_clearCallback(&state.irqjob);
     // clear state
     state.diomask = 0;
+#if defined(CFG_ping_coalesce)
+    state.standby = 0;
+#endif
     hal_enableIRQs();
 }
 
+#if defined(CFG_ping_coalesce)
+// put radio to sleep if next RX has not been started in time
+static void radio_standby_timeout (osjob_t* j) {
+    radio_stop();
+}
+
+// like radio_stop(), but leave radio in standby with TCXO powered since
+// the next RX follows shortly (see LMIC.radioStandby)
+static void radio_standby (void) {
+    hal_disableIRQs();
+    hal_ant_switch(HAL_ANTSW_OFF);
+    hal_irqmask_set(0);
+    state.diomask = 0;
+    state.standby = 1;
+    os_setTimedCallback(&state.irqjob, os_getTime() + PING_COALESCE_osticks + RX_RAMPUP_INI,
+            radio_standby_timeout);
+    hal_enableIRQs();
+}
+#endif
+
 // guard timeout in case no completion interrupt is generated by radio
 // protected job - runs with irqs disabled!
 static void radio_irq_timeout (osjob_t* j) {
@@ -72,6 +159,12 @@ static void radio_irq_func (osjob_t* j) {
     // call radio-specific processing function
     if( radio_irq_process(state.irqtime, state.diomask) ) {
 	// current radio operation has completed
+#if defined(CFG_ping_coalesce)
+	if( !state.txmode && LMIC.radioStandby ) {
+	    LMIC.radioStandby = 0;
+	    radio_standby(); // (disable antenna switch and HAL irqs, keep radio in standby)
+	} else
+#endif
 	radio_stop(); // (disable antenna switch and HAL irqs, make radio sleep)
 
 	// run LMIC job (use preset func ptr)
@@ -83,10 +176,17 @@ static void radio_irq_func (osjob_t* j) {
 }
 
 // called by hal exti IRQ handler
-// (all radio operations are performed on radio job!)
-void radio_irq_handler (u1_t diomask, ostime_t ticks) {
+// (all radio operations are performed on radio job, except FIFO handling with CFG_fifo_irq!)
+__hotcode void radio_irq_handler (u1_t diomask, ostime_t ticks) {
     BACKTRACE();
 
+#if defined(CFG_fifo_irq)
+    // service FIFO refill/drain interrupts right away (without irq job)
+    if( (diomask = radio_irq_fifo(diomask, ticks)) == 0 ) {
+	return;
+    }
+#endif
+
     // make sure previous job has been run
     ASSERT( state.diomask == 0 );
 
@@ -122,9 +222,17 @@ void os_radio (u1_t mode) {
 	    break;
 
 	case RADIO_RX:
+#if defined(CFG_ping_coalesce)
+	    if( state.standby ) {
+		// cancel standby timeout, radio and TCXO are still up
+		os_clearCallback(&state.irqjob);
+		state.standby = 0;
+	    } else
+#endif
 	    radio_stop();
 	    // set timeout for rx operation (should not happen, might be updated by radio driver)
 	    state.txmode = 0;
+	    LMIC.radioPwr_rxon = 0;
 	    radio_set_irq_timeout(LMIC.rxtime + ms2osticks(5) + LMIC_calcAirTime(LMIC.rps, 255) * 110 / 100);
 	    // receive frame at rxtime/now (wait for completion interrupt)
 	    radio_startrx(false);
@@ -134,6 +242,7 @@ void os_radio (u1_t mode) {
 	    radio_stop();
 	    // start scanning for frame now (wait for completion interrupt)
 	    state.txmode = 0;
+	    LMIC.radioPwr_rxon = 1;
 	    radio_startrx(true);
 	    break;
 
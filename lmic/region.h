@@ -128,6 +128,12 @@ enum {
 #error "No regions defined"
 #endif
 
+// Exactly one region configured: no runtime region selection
+#if (defined(CFG_eu868) + defined(CFG_as923) + defined(CFG_us915) + \
+     defined(CFG_au915) + defined(CFG_cn470) + defined(CFG_in865)) == 1
+#define REG_SINGLE
+#endif
+
 
 // ------------------------------------------------
 // Derived values
@@ -0,0 +1,10 @@
+// Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+// HAL peripherals for host tests that build oslmic.c (see ../test_jobq.c);
+// none are available.
+
+// EVLOG() (not included by oslmic.h for CFG_simul)
+#include "evlog.h"
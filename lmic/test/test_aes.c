@@ -0,0 +1,131 @@
+// Copyright (C) 2020-2022 Michael Kuyper. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#include "lmic.h"
+#include "aes.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Known-answer tests for all os_aes() modes, build with and without
+// CFG_aes_small. Run with -b for a simple benchmark.
+
+static const u1_t KEY_FIPS197[16] = {
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f
+};
+static const u1_t PT_FIPS197[16] = {
+    0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff
+};
+static const u1_t CT_FIPS197[16] = {
+    0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30, 0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a
+};
+
+// RFC 4493, NIST SP 800-38A
+static const u1_t KEY_NIST[16] = {
+    0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c
+};
+static const u1_t MSG_NIST[64] = {
+    0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+    0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+    0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11, 0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+    0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17, 0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10
+};
+static const struct {
+    int len;
+    u4_t mic;   // first word of CMAC
+} CMAC_RFC4493[] = {
+    { 16, 0x070a16b4 },
+    { 40, 0xdfa66747 },
+    { 64, 0x51f0bebf },
+};
+static const u1_t CTR_NIST[16] = {
+    0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff
+};
+static const u1_t CT_CTR_NIST[64] = {
+    0x87, 0x4d, 0x61, 0x91, 0xb6, 0x20, 0xe3, 0x26, 0x1b, 0xef, 0x68, 0x64, 0x99, 0x0d, 0xb6, 0xce,
+    0x98, 0x06, 0xf6, 0x6b, 0x79, 0x70, 0xfd, 0xff, 0x86, 0x17, 0x18, 0x7b, 0xb9, 0xff, 0xfd, 0xff,
+    0x5a, 0xe4, 0xdf, 0x3e, 0xdb, 0xd5, 0xd3, 0x5e, 0x5b, 0x4f, 0x09, 0x02, 0x0d, 0xb0, 0x3e, 0xab,
+    0x1e, 0x03, 0x1d, 0xda, 0x2f, 0xbe, 0x03, 0xd1, 0x79, 0x21, 0x70, 0xa0, 0xf3, 0x00, 0x9c, 0xee
+};
+
+static int errors;
+
+static void check (int cond, const char* what) {
+    if( !cond ) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        errors += 1;
+    }
+}
+
+static void test_enc (void) {
+    u1_t buf[16];
+    memcpy(buf, PT_FIPS197, 16);
+    memcpy(AESkey, KEY_FIPS197, 16);
+    os_aes(AES_ENC, buf, 16);
+    check(memcmp(buf, CT_FIPS197, 16) == 0, "AES_ENC (FIPS-197 C.1)");
+}
+
+static void test_mic (void) {
+    for( int i = 0; i < sizeof(CMAC_RFC4493) / sizeof(CMAC_RFC4493[0]); i++ ) {
+        u1_t buf[64];
+        memcpy(buf, MSG_NIST, sizeof(buf));
+        memcpy(AESkey, KEY_NIST, 16);
+        u4_t mic = os_aes(AES_MIC|AES_MICNOAUX, buf, CMAC_RFC4493[i].len);
+        check(mic == CMAC_RFC4493[i].mic, "AES_MIC|AES_MICNOAUX (RFC 4493)");
+    }
+    // MIC with B0 in AESaux must equal MIC over B0 || message
+    for( int len = 1; len <= 48; len++ ) {
+        u1_t buf[64];
+        memcpy(buf, MSG_NIST, 16);
+        memcpy(buf + 16, MSG_NIST + 16, len);
+        memcpy(AESkey, KEY_NIST, 16);
+        u4_t mic1 = os_aes(AES_MIC|AES_MICNOAUX, buf, 16 + len);
+        memcpy(AESaux, MSG_NIST, 16);
+        memcpy(AESkey, KEY_NIST, 16);
+        u4_t mic2 = os_aes(AES_MIC, buf + 16, len);
+        check(mic1 == mic2, "AES_MIC with B0");
+    }
+}
+
+static void test_ctr (void) {
+    u1_t buf[64];
+    // complete blocks
+    memcpy(buf, MSG_NIST, sizeof(buf));
+    memcpy(AESkey, KEY_NIST, 16);
+    memcpy(AESaux, CTR_NIST, 16);
+    os_aes(AES_CTR, buf, sizeof(buf));
+    check(memcmp(buf, CT_CTR_NIST, sizeof(buf)) == 0, "AES_CTR (SP 800-38A F.5.1)");
+    // partial block
+    memcpy(buf, MSG_NIST, sizeof(buf));
+    memcpy(AESkey, KEY_NIST, 16);
+    memcpy(AESaux, CTR_NIST, 16);
+    os_aes(AES_CTR, buf, 37);
+    check(memcmp(buf, CT_CTR_NIST, 37) == 0 && memcmp(buf + 37, MSG_NIST + 37, 64 - 37) == 0, "AES_CTR (partial)");
+}
+
+static void bench (void) {
+    enum { N = 100000 };
+    u1_t buf[16] = { 0 };
+    clock_t t0 = clock();
+    for( int i = 0; i < N; i++ ) {
+        memcpy(AESkey, KEY_NIST, 16);
+        os_aes(AES_ENC, buf, 16);
+    }
+    clock_t t1 = clock();
+    printf("%.1f ns per block (including key expansion)\n",
+            (double) (t1 - t0) * 1e9 / CLOCKS_PER_SEC / N);
+}
+
+int main (int argc, char** argv) {
+    test_enc();
+    test_mic();
+    test_ctr();
+    printf("%s%s: %d errors\n", argv[0], (errors ? " FAILED" : ""), errors);
+    if( argc > 1 && strcmp(argv[1], "-b") == 0 ) {
+        bench();
+    }
+    return errors ? 1 : 0;
+}
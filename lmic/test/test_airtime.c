@@ -0,0 +1,92 @@
+// Copyright (C) 2020-2022 Michael Kuyper. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#include "lmic.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// ------------------------------------------------
+// HAL stubs
+
+void hal_failed (void) {
+    abort();
+}
+
+
+// ------------------------------------------------
+// Known airtimes (Semtech LoRa calculator / SX127x datasheet: CR 4/5,
+// 8 symbol preamble, explicit header, CRC on, low data rate optimization for
+// symbols of 16.384 ms or longer)
+
+static const struct {
+    sf_t sf;
+    bw_t bw;
+    u1_t plen;
+    u4_t us;
+} KNOWN[] = {
+    { SF7,  BW125,   0,   25856 },
+    { SF7,  BW125,  13,   46336 },
+    { SF7,  BW125,  64,  118016 },
+    { SF7,  BW125, 255,  399616 },
+    { SF8,  BW125,  23,  113152 },
+    { SF9,  BW125,  13,  164864 },
+    { SF10, BW125,  51,  616448 },
+    { SF11, BW125,  13,  577536 },
+    { SF12, BW125,  13, 1155072 },
+    { SF12, BW125,  64, 2793472 },
+    { SF12, BW125, 255, 9019392 },
+    { SF7,  BW250,  51,   51328 },
+    { SF8,  BW500,  13,   20608 },
+    { SF10, BW500,   0,   51712 },
+    { SF12, BW500,  64,  616448 },
+};
+
+
+// ------------------------------------------------
+// Test
+
+int main (int argc, char** argv) {
+    int errors = 0;
+    long count = 0;
+    for( int i = 0; i < sizeof(KNOWN) / sizeof(KNOWN[0]); i++ ) {
+        rps_t rps = makeRps(KNOWN[i].sf, KNOWN[i].bw, CR_4_5, 0, 0);
+        ostime_t t = calcAirTime(rps, KNOWN[i].plen);
+        ostime_t ref = ((s8_t) KNOWN[i].us * OSTICKS_PER_SEC + 500000) / 1000000;
+        // allow for rounding to ticks, and for the truncated divisor used by
+        // airtime() to stay within 32 bits at SF12/BW125 (< 0.01%)
+        ostime_t tol = 1 + ref / 10000;
+        if( t < ref - tol || t > ref + tol ) {
+            fprintf(stderr, "mismatch: SF%d/BW%d plen=%u: %d != %d ticks (%u us)\n",
+                    KNOWN[i].sf + 6, 125 << KNOWN[i].bw, KNOWN[i].plen, t, ref, KNOWN[i].us);
+            errors += 1;
+        }
+    }
+    // cached and uncached (interrupt context) paths must agree, repeat to
+    // exercise both cache misses and hits
+    for( int pass = 0; pass < 2; pass++ ) {
+        for( unsigned int r = 0; r <= 0xffff; r++ ) {
+            rps_t rps = r;
+            if( getSf(rps) > SF12 || getBw(rps) > BW500 ) {
+                continue;
+            }
+            for( unsigned int plen = 0; plen <= 255; plen++ ) {
+                ostime_t t0 = calcAirTimeIrq(rps, plen);
+                ostime_t t1 = calcAirTime(rps, plen);
+                ostime_t t2 = calcAirTime(rps, plen);
+                ostime_t t3 = calcAirTimeIrq(rps, plen);
+                if( t0 <= 0 || t1 != t0 || t2 != t0 || t3 != t0 ) {
+                    if( errors++ < 10 ) {
+                        fprintf(stderr, "mismatch: rps=0x%04x plen=%u: %d/%d/%d/%d\n", rps, plen, t0, t1, t2, t3);
+                    }
+                }
+                count += 1;
+            }
+        }
+    }
+    printf("%d known airtimes and %ld combinations checked, %d errors\n",
+            (int) (sizeof(KNOWN) / sizeof(KNOWN[0])), count, errors);
+    return errors ? 1 : 0;
+}
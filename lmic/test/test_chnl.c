@@ -0,0 +1,95 @@
+// Copyright (C) 2020-2022 Michael Kuyper. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#include "lmic.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// ------------------------------------------------
+// HAL stubs
+
+void hal_disableIRQs (void) {
+}
+
+void hal_enableIRQs (void) {
+}
+
+void hal_failed (void) {
+    abort();
+}
+
+
+// ------------------------------------------------
+// Reference implementation (bit by bit)
+
+static u1_t refSelectChnl (u2_t map, u1_t k) {
+    for( u1_t chnl = 0; chnl < 16; chnl++ ) {
+        if( (map & (1 << chnl)) && k-- == 0 ) {
+            return chnl;
+        }
+    }
+    return 0xff;
+}
+
+
+// ------------------------------------------------
+// Test
+
+#define DRAWS_PER_CHNL  20000
+
+int main (int argc, char** argv) {
+    int errors = 0;
+    long count = 0;
+
+    // exhaustive check against reference
+    for( unsigned int map = 1; map <= 0xffff; map++ ) {
+        u1_t n = __builtin_popcount(map);
+        for( u1_t k = 0; k < n; k++ ) {
+            u1_t c = selectChnl(map, k);
+            if( c != refSelectChnl(map, k) ) {
+                if( errors++ < 10 ) {
+                    fprintf(stderr, "mismatch: map=0x%04x k=%u: %u != %u\n", map, k, c, refSelectChnl(map, k));
+                }
+            }
+            count += 1;
+        }
+    }
+    printf("%ld selections checked, %d errors\n", count, errors);
+
+    // distribution check: uniform random index must yield uniform channel usage
+    static const u2_t maps[] = { 0x0007, 0x00ff, 0xa5a5, 0x8001, 0xfffe, 0xffff };
+    srand(1);
+    for( int m = 0; m < sizeof(maps) / sizeof(maps[0]); m++ ) {
+        u2_t map = maps[m];
+        u1_t n = __builtin_popcount(map);
+        long hist[16] = { 0 };
+        long draws = (long) n * DRAWS_PER_CHNL;
+        for( long i = 0; i < draws; i++ ) {
+            u2_t r = rand() & 0xffff;
+            hist[selectChnl(map, r % n)] += 1;
+        }
+        // chi-square statistic, critical value for df <= 15 at p=0.001 is < 38
+        double chi2 = 0;
+        for( int c = 0; c < 16; c++ ) {
+            if( (map & (1 << c)) == 0 ) {
+                if( hist[c] != 0 ) {
+                    fprintf(stderr, "map=0x%04x: disabled channel %d selected\n", map, c);
+                    errors += 1;
+                }
+                continue;
+            }
+            double d = hist[c] - DRAWS_PER_CHNL;
+            chi2 += d * d / DRAWS_PER_CHNL;
+        }
+        if( chi2 > 38 ) {
+            fprintf(stderr, "map=0x%04x: distribution not uniform (chi2=%.1f)\n", map, chi2);
+            errors += 1;
+        }
+        printf("map=0x%04x: chi2=%.1f (df=%d)\n", map, chi2, n - 1);
+    }
+
+    return errors ? 1 : 0;
+}
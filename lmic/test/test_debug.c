@@ -0,0 +1,110 @@
+// Copyright (C) 2020-2022 Michael Kuyper. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#include "lmic.h"
+#include "debug.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Compare debug_snprintf() integer formatting against the C library (hex
+// digits are always upper case) and check the custom conversions (%b, %F,
+// %E, %h, %t, %T). Run with -b for a benchmark of typical log lines.
+
+void hal_debug_str (const char* str) { }
+void hal_debug_led (int val) { }
+
+static int errors;
+
+static void compare (const char* fmt, int val) {
+    char exp[64], res[64];
+    snprintf(exp, sizeof(exp), fmt, val);
+    debug_snprintf(res, sizeof(res), fmt, val);
+    if( strcmp(exp, res) != 0 ) {
+        fprintf(stderr, "FAILED: '%s' %d: expected '%s', got '%s'\n", fmt, val, exp, res);
+        errors += 1;
+    }
+}
+
+static void expect (const char* exp, const char* res) {
+    if( strcmp(exp, res) != 0 ) {
+        fprintf(stderr, "FAILED: expected '%s', got '%s'\n", exp, res);
+        errors += 1;
+    }
+}
+
+static void test_int (void) {
+    static const char* const fmts[] = {
+        "%d", "%u", "%X", "%5d", "%-5d|", "%05d", "%+d", "% d", "%08X", "%-8X|", "%.3d",
+    };
+    static const int vals[] = {
+        0, 1, 9, 10, 99, 100, 12345, -1, -10, -12345, 0x7fffffff, (int) 0x80000000,
+        (int) 0xdeadbeef, 429496729, 429496730, 999999999, 1000000000, (int) 4294967290u,
+    };
+    for( int i = 0; i < sizeof(fmts) / sizeof(fmts[0]); i++ ) {
+        for( int j = 0; j < sizeof(vals) / sizeof(vals[0]); j++ ) {
+            compare(fmts[i], vals[j]);
+        }
+    }
+    // exhaustive-ish decimal sweep (divide-free conversion)
+    unsigned int v = 0;
+    do {
+        compare("%u", v);
+        v += 65521;
+    } while( v >= 65521 );
+}
+
+static void test_custom (void) {
+    char buf[128];
+    debug_snprintf(buf, sizeof(buf), "%b", 10);
+    expect("1010", buf);
+    debug_snprintf(buf, sizeof(buf), "%08b", 5);
+    expect("00000101", buf);
+    debug_snprintf(buf, sizeof(buf), "%.1F", 868100000, 6);
+    expect("868.1", buf);
+    debug_snprintf(buf, sizeof(buf), "%F", -1234, 3);
+    expect("-1.234", buf);
+    u1_t eui[8] = { 0x08, 0x07, 0x06, 0x05, 0x04, 0x03, 0x02, 0xf1 };
+    debug_snprintf(buf, sizeof(buf), "%E", eui);
+    expect("F1-02-03-04-05-06-07-08", buf);
+    debug_snprintf(buf, sizeof(buf), "%h", eui, 4);
+    expect("08070605", buf);
+    debug_snprintf(buf, sizeof(buf), "% h", eui, 3);
+    expect("08 07 06", buf);
+    debug_snprintf(buf, sizeof(buf), "%.9h", eui, 8);
+    expect("080706...", buf);
+    debug_snprintf(buf, sizeof(buf), "%t", (u4_t) (OSTICKS_PER_SEC * 3725 + OSTICKS_PER_SEC / 2));
+    expect("01:02:05.500", buf);
+    debug_snprintf(buf, sizeof(buf), "%T", (u8_t) OSTICKS_PER_SEC * (86400 * 3 + 3600 + 61));
+    expect("003.01:01:01", buf);
+}
+
+static void bench (void) {
+    enum { N = 200000 };
+    u1_t frame[32];
+    char buf[256];
+    for( int i = 0; i < sizeof(frame); i++ ) {
+        frame[i] = i * 37;
+    }
+    clock_t t0 = clock();
+    for( int i = 0; i < N; i++ ) {
+        // like DEBUG_TX/DEBUG_RX
+        debug_snprintf(buf, sizeof(buf), "TX[fcnt=%d,freq=%.1F,sf=%d,bw=%d,pow=%d,len=%d%s]: %.80h\r\n",
+                i, 868100000 + i, 6, 7 + (i & 3), 125, 14, 23, "", frame, sizeof(frame));
+    }
+    clock_t t1 = clock();
+    printf("%.1f ns per log line\n", (double) (t1 - t0) * 1e9 / CLOCKS_PER_SEC / N);
+}
+
+int main (int argc, char** argv) {
+    test_int();
+    test_custom();
+    printf("%s%s: %d errors\n", argv[0], (errors ? " FAILED" : ""), errors);
+    if( argc > 1 && strcmp(argv[1], "-b") == 0 ) {
+        bench();
+    }
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,253 @@
+// Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#include "lmic.h"
+#include "aes.h"
+
+#include <stdio.h>
+#include <time.h>
+
+// Job queue of oslmic.c, built with the sorted list (test_jobq) or the
+// pairing heap of CFG_jobheap (test_jobq_heap). A re-arm storm (many pending
+// jobs which are repeatedly re-armed, cancelled, and re-armed from their
+// callbacks) must run every job exactly once, in deadline order and
+// first-come first-served for equal deadlines, across the wrap of the tick
+// counter. Run with -b to compare the cost of re-arming and of running queued
+// jobs between the backends for various queue lengths.
+
+static int errors;
+
+#define CHECK(c) do { if( !(c) ) { \
+    fprintf(stderr, "FAILED: %s:%d: %s\n", __FILE__, __LINE__, #c); errors += 1; \
+} } while( 0 )
+
+#if defined(CFG_jobheap)
+#define BACKEND "heap"
+#else
+#define BACKEND "list"
+#endif
+
+#define MAXJOBS 512
+
+static osjob_t jobs[MAXJOBS];
+static struct {
+    u4_t deadline;      // as armed
+    u4_t seq;           // arming order
+    int armed;
+} ref[MAXJOBS];
+static int njobs;
+static u4_t armseq;
+static int checking;    // compare against reference while sleeping
+
+// ------------------------------------------------
+// HAL stubs (time only advances while sleeping)
+
+static u4_t now;
+static int irqlevel;
+static int sleeptype;
+
+u4_t hal_ticks (void) {
+    return now;
+}
+
+u8_t hal_xticks (void) {
+    return now;
+}
+
+void hal_disableIRQs (void) {
+    irqlevel += 1;
+}
+
+void hal_enableIRQs (void) {
+    irqlevel -= 1;
+}
+
+static int nexact (void) {
+    int n = 0;
+    for( int i = 0; i < njobs; i++ ) {
+        n += (ref[i].armed && (i & 1) == 0);
+    }
+    return n;
+}
+
+void hal_sleep (u1_t type, u4_t targettime) {
+    if( checking ) {
+        CHECK(type == (nexact() ? HAL_SLEEP_EXACT : HAL_SLEEP_APPROX));
+    }
+    sleeptype = type;
+    if( (s4_t) (targettime - now) > 0 ) {
+        now = targettime;
+    }
+}
+
+void hal_failed (void) {
+    fprintf(stderr, "FAILED: hal_failed()\n");
+    errors += 1;
+}
+
+void hal_init (void* bootarg) { }
+void hal_watchcount (int cnt) { }
+void hal_logEv (uint8_t evcat, uint8_t evid, uint32_t evparam) { }
+u1_t hal_getBattLevel (void) { return 0; }
+void radio_init (bool calibrate) { }
+void os_radio (u1_t mode) { }
+void os_getDevEui (u1_t* buf) { }
+u4_t os_aes (u1_t mode, u1_t* buf, u2_t len) { return 0; }
+void LMIC_init (void) { }
+
+u4_t AESKEY[4];
+struct lmic_t* plmic;
+
+// ------------------------------------------------
+// Reference model
+
+static u4_t rnd_state = 1;
+
+static u4_t rnd (void) { // xorshift32
+    u4_t x = rnd_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return (rnd_state = x);
+}
+
+static struct {
+    int ran;            // jobs run since last reset
+    int valid;
+    u4_t deadline;      // of last job run
+    u4_t seq;
+    int rearm;          // budget for re-arming from callbacks
+} last;
+
+static void jobfunc (osjob_t* job);
+
+// odd jobs are approximate, even ones exact
+static void arm (int i, u4_t delay) {
+    u4_t deadline = now + delay;
+    os_setTimedCallbackEx(&jobs[i], deadline, jobfunc, (i & 1) ? OSJOB_FLAG_APPROX : 0);
+    ref[i].deadline = deadline;
+    ref[i].seq = armseq++;
+    ref[i].armed = 1;
+}
+
+static void jobfunc (osjob_t* job) {
+    int i = job - jobs;
+    CHECK(irqlevel == 0);
+    CHECK(ref[i].armed);
+    CHECK((s4_t) (now - ref[i].deadline) >= 0);
+    if( last.valid ) {
+        s4_t d = ref[i].deadline - last.deadline;
+        CHECK(d > 0 || (d == 0 && (s4_t) (ref[i].seq - last.seq) > 0));
+    }
+    last.valid = 1;
+    last.deadline = ref[i].deadline;
+    last.seq = ref[i].seq;
+    last.ran += 1;
+    ref[i].armed = 0;
+    if( last.rearm > 0 && (rnd() & 3) == 0 ) {
+        last.rearm -= 1;
+        arm(i, 1 + rnd() % (4 * njobs));
+    }
+}
+
+static int narmed (void) {
+    int n = 0;
+    for( int i = 0; i < njobs; i++ ) {
+        n += ref[i].armed;
+    }
+    return n;
+}
+
+static void storm (int n, int rounds) {
+    njobs = n;
+    memset(&last, 0, sizeof(last));
+    last.rearm = n;
+    // dense deadlines, so many of them are equal
+    u4_t range = 4 * n;
+    for( int i = 0; i < n; i++ ) {
+        arm(i, rnd() % range);
+    }
+    int expected = n;
+    for( int r = 0; r < rounds; r++ ) {
+        int i = rnd() % n;
+        CHECK(os_jobPending(&jobs[i]) == ref[i].armed);
+        if( (rnd() & 7) == 0 ) {
+            CHECK(os_clearCallback(&jobs[i]) == ref[i].armed);
+            expected -= ref[i].armed;
+            ref[i].armed = 0;
+        } else {
+            expected += !ref[i].armed;
+            arm(i, rnd() % range);
+        }
+        now += rnd() % 3; // (some jobs become due while queued)
+    }
+    CHECK(narmed() == expected);
+    int budget = last.rearm;
+    checking = 1;
+    for( int steps = 0; narmed() && steps < 4 * n; steps++ ) {
+        os_runstep();
+    }
+    checking = 0;
+    CHECK(narmed() == 0);
+    CHECK(last.ran == expected + budget - last.rearm);
+    CHECK(irqlevel == 0);
+    // exact job counter must be back to zero
+    os_runstep();
+    CHECK(sleeptype == HAL_SLEEP_APPROX);
+}
+
+static void test_storm (void) {
+    static const int sizes[] = { 1, 2, 7, 64, MAXJOBS };
+    for( int k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++ ) {
+        // start right below the sign change of ostime_t
+        now = 0x7fffffff - 2 * sizes[k];
+        storm(sizes[k], 20 * sizes[k]);
+    }
+}
+
+static void benchfunc (osjob_t* job) {
+}
+
+static void bench (void) {
+    static const int sizes[] = { 8, 64, MAXJOBS };
+    enum { N = 200000 };
+    for( int k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++ ) {
+        int n = sizes[k];
+        for( int i = 0; i < n; i++ ) {
+            os_setTimedCallback(&jobs[i], now + 1 + rnd() % (4 * n), jobfunc);
+        }
+        clock_t t0 = clock();
+        for( int r = 0; r < N; r++ ) {
+            os_setTimedCallback(&jobs[rnd() % n], now + 1 + rnd() % (4 * n), jobfunc);
+        }
+        clock_t t1 = clock();
+        for( int i = 0; i < n; i++ ) {
+            os_clearCallback(&jobs[i]);
+        }
+        // fill and drain queue (de-queueing cost of the heap)
+        clock_t t2 = clock();
+        for( int r = 0; r < N / n; r++ ) {
+            for( int i = 0; i < n; i++ ) {
+                os_setTimedCallbackEx(&jobs[i], now + 1 + rnd() % (4 * n), benchfunc, OSJOB_FLAG_APPROX);
+            }
+            while( os_getNextDeadline(&(ostime_t) { 0 }) ) {
+                os_runstep();
+            }
+        }
+        clock_t t3 = clock();
+        printf("%s: %3d jobs: %.1f ns per re-arm, %.1f ns per queued job run\n", BACKEND, n,
+                (double) (t1 - t0) * 1e9 / CLOCKS_PER_SEC / N,
+                (double) (t3 - t2) * 1e9 / CLOCKS_PER_SEC / (N / n * n));
+    }
+}
+
+int main (int argc, char** argv) {
+    test_storm();
+    printf("%s%s: %d errors\n", argv[0], (errors ? " FAILED" : ""), errors);
+    if( argc > 1 && strcmp(argv[1], "-b") == 0 ) {
+        bench();
+    }
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,160 @@
+// Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#include "osthread.h"
+
+#include <stdio.h>
+
+// Run threads on a minimal scheduler (single pending job per thread, virtual
+// time advances to the earliest deadline) and check the order of execution,
+// timeouts and event delivery.
+
+static int errors;
+
+#define CHECK(c) do { if( !(c) ) { \
+    fprintf(stderr, "FAILED: %s:%d: %s\n", __FILE__, __LINE__, #c); errors += 1; \
+} } while( 0 )
+
+// ------------------------------------------------
+// Scheduler stubs
+
+#define MAXJOBS 4
+
+static ostime_t now;
+static osjob_t* jobs[MAXJOBS];
+
+ostime_t os_getTime (void) {
+    return now;
+}
+
+int os_clearCallback (osjob_t* job) {
+    for( int i = 0; i < MAXJOBS; i++ ) {
+        if( jobs[i] == job ) {
+            jobs[i] = NULL;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int os_jobPending (osjob_t* job) {
+    for( int i = 0; i < MAXJOBS; i++ ) {
+        if( jobs[i] == job ) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void os_setTimedCallbackEx (osjob_t* job, ostime_t time, osjobcb_t cb, unsigned int flags) {
+    os_clearCallback(job);
+    job->deadline = (flags & OSJOB_FLAG_NOW) ? now : time;
+    job->func = cb;
+    for( int i = 0; i < MAXJOBS; i++ ) {
+        if( jobs[i] == NULL ) {
+            jobs[i] = job;
+            return;
+        }
+    }
+    CHECK(0);
+}
+
+// run next job, return 0 if none is pending
+static int runstep (void) {
+    osjob_t* j = NULL;
+    int idx = 0;
+    for( int i = 0; i < MAXJOBS; i++ ) {
+        if( jobs[i] && (j == NULL || jobs[i]->deadline - j->deadline < 0) ) {
+            j = jobs[i];
+            idx = i;
+        }
+    }
+    if( j ) {
+        jobs[idx] = NULL;
+        if( j->deadline - now > 0 ) {
+            now = j->deadline;
+        }
+        j->func(j);
+    }
+    return j != NULL;
+}
+
+// ------------------------------------------------
+// Threads
+
+static char trace[64];
+static int tlen;
+
+static void mark (char c) {
+    if( tlen < sizeof(trace) - 1 ) {
+        trace[tlen++] = c;
+    }
+}
+
+static struct {
+    osthread_t t;
+    int i;
+} ta, tb;
+
+static void thread_a (osjob_t* job) {
+    OS_THREAD_BEGIN(&ta.t);
+    for( ta.i = 0; ta.i < 3; ta.i++ ) {
+        mark('a');
+        OS_AWAIT_TIMEOUT(&ta.t, 10);
+    }
+    mark('A');
+    OS_THREAD_END(&ta.t);
+}
+
+static void thread_b (osjob_t* job) {
+    osthread_t* t = OS_THREAD(job);
+    OS_THREAD_BEGIN(t);
+    mark('b');
+    OS_AWAIT_TIMEOUT(t, 15);
+    mark('b');
+    OS_YIELD(t);
+    mark('b');
+    OS_AWAIT_LMIC_EVENT(t, EV_TXCOMPLETE, 100);
+    mark(t->status ? 'e' : 't');
+    OS_AWAIT_LMIC_EVENT(t, EV_TXCOMPLETE, 100);
+    mark(t->status ? 'e' : 't');
+    mark('B');
+    OS_THREAD_END(t);
+}
+
+// deliver events while thread b waits (only the awaited one counts, once)
+static void events (osjob_t* job) {
+    os_thread_event(&tb.t, EV_RXCOMPLETE);
+    os_thread_event(&tb.t, EV_TXCOMPLETE);
+    os_thread_event(&tb.t, EV_TXCOMPLETE);
+}
+
+int main (int argc, char** argv) {
+    osjob_t evjob;
+    os_thread_start(&ta.t, thread_a);
+    os_thread_start(&tb.t, thread_b);
+    os_setTimedCallback(&evjob, 40, events);
+    while( runstep() );
+    trace[tlen] = 0;
+    // a: 0,10,20 (end at 30), b: 0,15,15 (after yield), event at 40, timeout at 140
+    if( strcmp(trace, "ababbaAetB") != 0 ) {
+        fprintf(stderr, "FAILED: trace '%s'\n", trace);
+        errors += 1;
+    }
+    CHECK(now == 140);
+    CHECK(!os_thread_running(&ta.t));
+    CHECK(!os_thread_running(&tb.t));
+
+    // restart and stop while waiting
+    os_thread_start(&ta.t, thread_a);
+    runstep();
+    CHECK(os_thread_running(&ta.t));
+    os_thread_stop(&ta.t);
+    CHECK(!os_thread_running(&ta.t));
+    CHECK(!runstep());
+
+    printf("%s%s: %d errors\n", argv[0], (errors ? " FAILED" : ""), errors);
+    return errors ? 1 : 0;
+}
@@ -30,11 +30,12 @@ frag_size = 128
 # initialize fragment generator
 fc = frag.FragCarousel.fromfile(updata, frag_size)
 
-# generate FUOTA downlinks
+# generate FUOTA downlinks (in batches, see FragCarousel.chunks)
 while True:
-    # randomly select non-zero fragment index
-    idx = random.randint(1, 65535)
-    # generate FUOTA payload (session header plus fragment data)
-    payload = struct.pack('<HHHH', src_crc, dst_crc, fc.cct, idx) + fc.chunk(idx)
-    # print payload (could be delivered as downlink on port 16 to ex-fuota application)
-    print(payload.hex())
+    # randomly select non-zero fragment indices
+    idxs = [random.randint(1, 65535) for _ in range(64)]
+    for idx, chunk in zip(idxs, fc.chunks(idxs)):
+        # generate FUOTA payload (session header plus fragment data)
+        payload = struct.pack('<HHHH', src_crc, dst_crc, fc.cct, idx) + chunk
+        # print payload (could be delivered as downlink on port 16 to ex-fuota application)
+        print(payload.hex())
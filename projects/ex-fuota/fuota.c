@@ -106,6 +106,10 @@ void process_fuota (unsigned char* buf, int len) {
 
     // check if session parameters match, otherwise initialize new session
     if( fuota_check_state(FUOTA_SESSION, sid, cct, cnw) == FUOTA_ERROR ) {
+        if( fuota_work_size(cct, cnw) > (FUOTA_WORK_NW << 2) ) {
+            debug_printf("FUOTA session too large for decoder (%d chunks)!\r\n", cct);
+            return;
+        }
         // need to create a new session
         int dnp = ((cct * cnw * 4)             + (FLASH_PAGE_SZ-1)) / FLASH_PAGE_SZ;
         int mnp = (fuota_matrix_size(cct, cnw) + (FLASH_PAGE_SZ-1)) / FLASH_PAGE_SZ;
@@ -0,0 +1,78 @@
+# Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+#
+# This file is subject to the terms and conditions defined in file 'LICENSE',
+# which is part of this source code package.
+
+# Benchmark of the MAC engine: for every uplink cycle (TX, receive windows,
+# EV_TXCOMPLETE), count the engineUpdate invocations and full evaluations
+# (reported by the firmware when built with CFG_engine_stats) and the
+# instructions executed inside engineUpdate (attributed by the profiler).
+# Emulated code executes in zero virtual time, so instructions are converted
+# to estimated CPU ticks using the CPI and clock of energy.CurrentTable.
+
+from typing import Any, List, Tuple
+
+import os
+import re
+import shlex
+
+from devtest import vtime, DeviceTest
+from energy import CurrentTable
+from eventhub import EventHub
+from profiler import Profiler
+
+from ward import fixture, test
+
+class EngineStats:
+    RE = re.compile(r'lmic: engine calls=(\d+) evals=(\d+)')
+
+    def __init__(self, dut:DeviceTest) -> None:
+        self.samples:List[Tuple[int,int]] = []
+        event = dut.log.event
+        def capture(type:int, **kwargs:Any) -> None:
+            if type == EventHub.LOG and (m := EngineStats.RE.search(str(kwargs['msg']))):
+                self.samples.append((int(m.group(1)), int(m.group(2))))
+            event(type, **kwargs)
+        dut.log.event = capture # type: ignore
+
+@fixture
+async def createtest(_=vtime):
+    dut = DeviceTest()
+    dut.start()
+    yield dut
+    await dut.stop()
+
+
+CYCLES = 5
+
+@test('Engine update cost per uplink cycle')
+async def _(dut=createtest):
+    stats = EngineStats(dut)
+    prof = Profiler(dut.sim, shlex.split(os.environ.get('TEST_HEXFILES', '')))
+    try:
+        await dut.join()
+        await dut.updf()
+        for i in range(CYCLES):
+            with prof.scenario(f'cycle{i}'):
+                await dut.updf()
+        insns = [prof.summary().get(f'cycle{i}', {}).get('engineUpdate', (0, 0))[1]
+                for i in range(CYCLES)]
+    finally:
+        prof.close()
+
+    # one sample per EV_TXCOMPLETE; the last CYCLES+1 bracket the cycles
+    assert len(stats.samples) >= CYCLES + 1
+    samples = stats.samples[-(CYCLES + 1):]
+    deltas = [(c1 - c0, e1 - e0) for ((c0, e0), (c1, e1)) in zip(samples, samples[1:])]
+    for (calls, evals) in deltas:
+        assert 0 < evals <= calls
+    assert all(insns), 'engineUpdate not found in profile (missing ELF file?)'
+
+    t = CurrentTable()
+    calls = sum(d[0] for d in deltas) / CYCLES
+    evals = sum(d[1] for d in deltas) / CYCLES
+    ticks = sum(insns) * t.cpi / CYCLES
+    print(f'engineUpdate per uplink cycle: {calls:.1f} calls, {evals:.1f} evaluations '
+            f'({100 * (calls - evals) / calls:.0f}% skipped), '
+            f'{sum(insns) / CYCLES:.0f} instructions, ~{ticks:.0f} CPU ticks '
+            f'({ticks / t.mcu_hz * 1e6:.1f} us at {t.mcu_hz / 1e6:.0f} MHz)')
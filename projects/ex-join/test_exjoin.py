@@ -44,3 +44,20 @@ async def _(dut=createtest):
     m = await dut.updf()
     dut.dndf(m, 15, b'hi there')
     await asyncio.sleep(5)
+
+
+@test('Resume from joined snapshot')
+async def _(dut=createtest):
+    await dut.join()
+    await dut.updf()
+    snap = await dut.snapshot()
+    await dut.stop()
+
+    dut2 = DeviceTest()
+    dut2.start(snap)
+    try:
+        for _ in range(2):
+            m = await dut2.updf()
+            assert m.rtm['FRMPayload'] == b'hello'
+    finally:
+        await dut2.stop()
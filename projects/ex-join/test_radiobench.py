@@ -0,0 +1 @@
+../../services/lwtest/test_radiobench.py
\ No newline at end of file
@@ -0,0 +1,61 @@
+# Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+#
+# This file is subject to the terms and conditions defined in file 'LICENSE',
+# which is part of this source code package.
+
+# Region discovery on a multi-region image without personalization data: the
+# device scans the RX2 channel of each region (EU868, then US915) with CAD for
+# REGSCAN_DWELL_MS before the first join, and joins in the region where it
+# heard downlink traffic.
+
+import asyncio
+
+from devtest import vtime, DeviceTest
+from medium import LoraMsg, Rps
+from runtime import JobGroup
+
+from ward import fixture, test
+
+@fixture
+async def createtest(_=vtime):
+    dut = DeviceTest()
+    dut.start()
+    yield dut
+    await dut.stop()
+
+
+DWELL = 4.0             # REGSCAN_DWELL_MS
+
+US915_RX2 = (923300000, Rps.makeRps(sf=12, bw=500000, crc=0, iqinv=True))
+
+# downlink frames of another device (MHDR, FHDR, FPort, MIC) from tbeg to tend
+def traffic(dut:DeviceTest, freq:int, rps:int, tbeg:float, tend:float, *, interval:float=0.5) -> JobGroup:
+    jobs = JobGroup(dut.runtime)
+    t = tbeg
+    while t < tend:
+        msg = LoraMsg(t, bytes([0x60]) + bytes(range(1, 16)), freq, rps, xpow=14, src=dut.gateway)
+        jobs.schedule(None, msg.xbeg, dut.medium.msg_preamble, msg=msg)
+        jobs.schedule(None, msg.xpld, dut.medium.msg_payload, msg=msg)
+        jobs.schedule(None, msg.xend, dut.medium.msg_complete, msg=msg)
+        t = msg.xend + interval
+    return jobs
+
+
+@test('Region scan: join in region with downlink traffic')
+async def _(dut=createtest):
+    await asyncio.sleep(0.1)
+    traffic(dut, *US915_RX2, 0.5, 2 * DWELL)
+    await dut.join()
+    assert dut.session is not None
+    assert dut.session['rx2freq'] == US915_RX2[0]
+    # both regions were scanned before the join
+    assert asyncio.get_running_loop().time() >= 2 * DWELL
+    await dut.updf()
+
+
+@test('Region scan: nothing heard')
+async def _(dut=createtest):
+    m = await dut.up()
+    assert asyncio.get_running_loop().time() >= 2 * DWELL
+    # join goes ahead in the first region
+    assert 863000000 <= m.msg.freq <= 870000000
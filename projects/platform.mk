@@ -99,6 +99,8 @@ ifeq ($(TOOLCHAIN),gcc)
     BIN		:= $(CROSS_COMPILE)objcopy -O binary
     GDB		:= $(CROSS_COMPILE)gdb
     AR		:= $(CROSS_COMPILE)ar
+    SIZE	:= $(CROSS_COMPILE)size
+    NM		:= $(CROSS_COMPILE)nm
     OPENOCD	?= openocd
 endif
 
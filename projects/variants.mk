@@ -33,3 +33,28 @@ endif
 ifneq (,$(TARGET.$(VARIANT)))
     TARGET = $(TARGET.$(VARIANT))
 endif
+
+# additional per-variant LMIC configuration
+
+LMICCFG += $(LMICCFG.$(VARIANT))
+
+# AES implementation: sw (default), small (no T-tables, saves 4 KB flash but
+# slower), or hw (MCUs with AES engine, e.g. STM32L082)
+
+ifneq (,$(AES.$(VARIANT)))
+    AES = $(AES.$(VARIANT))
+endif
+
+ifeq (hw,$(AES))
+    LMICCFG += aes_hw
+endif
+ifeq (small,$(AES))
+    LMICCFG += aes_small
+endif
+
+# Optimization profile: size (default, as set by the project), or lto
+# (link-time optimization; HOTSRCS are compiled with -O2 instead)
+
+ifneq (,$(OPT.$(VARIANT)))
+    OPT = $(OPT.$(VARIANT))
+endif
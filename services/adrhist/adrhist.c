@@ -0,0 +1,155 @@
+// Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#include <string.h>
+
+#include "lmic.h"
+#include "eefs/eefs.h"
+
+#include "adrhist.h"
+
+#include "svcdefs_eefs_init.h" // for type-checking hook functions
+#include "svcdefs_eefs_fn.h"
+#include "svcdefs_lwm_event.h"
+
+#ifndef ADRHIST_REGIONS
+#define ADRHIST_REGIONS         2       // number of regions remembered
+#endif
+
+#ifndef ADRHIST_SNR_DELTA
+#define ADRHIST_SNR_DELTA       (3*4)   // save if average SNR changes by 3 dB
+#endif
+
+#ifndef ADRHIST_MINDN
+#define ADRHIST_MINDN           2       // downlinks needed before history is used
+#endif
+
+// 1a1396271ad4aad0-ca069591
+static const uint8_t UFID_ADRHIST[12] = {
+    0xd0, 0xaa, 0xd4, 0x1a, 0x27, 0x96, 0x13, 0x1a, 0x91, 0x95, 0x06, 0xca
+};
+
+// Entries are kept in most-recently-used order; index 0 is the current
+// region once it has been used.
+static struct {
+    adrhist_entry e[ADRHIST_REGIONS];   // current
+    adrhist_entry saved;                // current region as saved
+} hist;
+
+static adrhist_entry* lookup (bool create) {
+    u1_t regcode = LMIC.region->regcode;
+    int i;
+    for( i = 0; i < ADRHIST_REGIONS - 1; i++ ) {
+        if( hist.e[i].regcode == regcode ) {
+            break;
+        }
+    }
+    if( hist.e[i].regcode != regcode ) {
+        if( !create ) {
+            return NULL;
+        }
+        memset(&hist.e[i], 0, sizeof(hist.e[i]));
+        hist.e[i].regcode = regcode;
+    }
+    if( i != 0 ) {
+        adrhist_entry e = hist.e[i];
+        memmove(&hist.e[1], &hist.e[0], i * sizeof(hist.e[0]));
+        hist.e[0] = e;
+        memset(&hist.saved, 0, sizeof(hist.saved)); // force save
+    }
+    return &hist.e[0];
+}
+
+static void commit (void) {
+    adrhist_entry* e = &hist.e[0];
+    adrhist_entry* s = &hist.saved;
+    if( e->ndn < ADRHIST_MINDN ) {
+        return;
+    }
+    if( e->regcode != s->regcode || e->dr != s->dr || e->txPowAdj != s->txPowAdj
+            || e->snr - s->snr > ADRHIST_SNR_DELTA || s->snr - e->snr > ADRHIST_SNR_DELTA ) {
+        if( eefs_log_save(UFID_ADRHIST, hist.e, sizeof(hist.e)) >= 0 ) {
+            *s = *e;
+        }
+    }
+}
+
+const adrhist_entry* adrhist_get (void) {
+    adrhist_entry* e = lookup(false);
+    return (e && e->ndn >= ADRHIST_MINDN) ? e : NULL;
+}
+
+void adrhist_reset (void) {
+    eefs_rm(UFID_ADRHIST);
+    memset(&hist, 0, sizeof(hist));
+}
+
+static void downlink (void) {
+    adrhist_entry* e = lookup(true);
+    if( e->ndn == 0 ) {
+        e->rssi = LMIC.rssi;
+        e->snr = LMIC.snr;
+    } else {
+        // exponential moving average (alpha = 1/4)
+        e->rssi += (LMIC.rssi - e->rssi) / 4;
+        e->snr += (LMIC.snr - e->snr) / 4;
+    }
+    if( e->ndn < 255 ) {
+        e->ndn += 1;
+    }
+    e->gwmargin = LMIC.gwmargin;
+    e->gwcnt = LMIC.gwcnt;
+    if( LMIC.adrEnabled ) {
+        e->dr = LMIC.datarate;
+        e->txPowAdj = LMIC.txPowAdj;
+    }
+    commit();
+}
+
+void _adrhist_event (ev_t ev) {
+    switch( ev ) {
+        case EV_JOINED: {
+            const adrhist_entry* e = adrhist_get();
+            if( e && LMIC.adrEnabled ) {
+                debug_printf("adrhist: restoring DR%d, txpowadj %d\r\n", e->dr, e->txPowAdj);
+                LMIC_setDrTxpow(e->dr, e->txPowAdj);
+            }
+            break;
+        }
+        case EV_TXCOMPLETE:
+        case EV_RXCOMPLETE:
+            if( LMIC.txrxFlags & (TXRX_DNW1 | TXRX_DNW2) ) {
+                downlink();
+            }
+            break;
+        case EV_LINK_DEAD: {
+            // history no longer reflects the link; don't restore it
+            adrhist_entry* e = lookup(false);
+            if( e && e->ndn ) {
+                e->ndn = 0;
+                eefs_log_save(UFID_ADRHIST, hist.e, sizeof(hist.e));
+                hist.saved = *e;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void _adrhist_init (void) {
+    if( eefs_log_read(UFID_ADRHIST, hist.e, sizeof(hist.e)) == sizeof(hist.e) ) {
+        hist.saved = hist.e[0];
+    } else {
+        memset(&hist, 0, sizeof(hist));
+    }
+}
+
+const char* _adrhist_eefs_fn (const uint8_t* ufid) {
+    if( memcmp(ufid, UFID_ADRHIST, sizeof(UFID_ADRHIST)) == 0 ) {
+        return "ch.mkdata.svc.adrhist";
+    }
+    return NULL;
+}
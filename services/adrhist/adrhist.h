@@ -0,0 +1,33 @@
+// Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#ifndef _adrhist_h_
+#define _adrhist_h_
+
+#include <stdint.h>
+
+// Persisted ADR link history (per region). The last network-managed data
+// rate and TX power adjustment are saved along with the link quality seen
+// on downlinks, and restored when the device (re)joins in the same region,
+// instead of starting over from the default data rate. If the link turns
+// out to be worse, the regular ADR back-off (ADR_ACK_REQ) recovers.
+typedef struct {
+    uint8_t regcode;    // region code (REGCODE_*), REGCODE_UNDEF if unused
+    uint8_t dr;         // last network-managed data rate
+    int8_t txPowAdj;    // last network-managed TX power adjustment
+    uint8_t gwmargin;   // last LinkCheckAns margin
+    uint8_t gwcnt;      // last LinkCheckAns gateway count
+    int8_t rssi;        // average downlink RSSI
+    int8_t snr;         // average downlink SNR (dB*4)
+    uint8_t ndn;        // number of downlinks averaged (saturating)
+} adrhist_entry;
+
+// Get history for current region, returns NULL if none available
+const adrhist_entry* adrhist_get (void);
+
+// Forget history (e.g. after the device has been moved)
+void adrhist_reset (void);
+
+#endif
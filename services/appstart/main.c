@@ -5,13 +5,16 @@
 
 #include "lmic.h"
 
-#include "svcdefs.h"
+#include "svcdefs_appstart.h"
 
 #ifdef SVC_backtrace
 #include "backtrace/backtrace.h"
 #endif
 
-static void initfunc (osjob_t* job) {
+// Print device and firmware information. With CFG_fastboot this is done in a
+// job of its own after the application start hook, so that blocking debug
+// output does not delay the application's first jobs.
+static void bootinfo (osjob_t* job) {
 #if defined(CFG_DEBUG) && CFG_DEBUG != 0
     unsigned char eui[8];
     hal_fwi fwi;
@@ -30,14 +33,34 @@ static void initfunc (osjob_t* job) {
 	    (BOOT_DEVINFO->bootmode == TABS_BOOT_FLIGHT) ? "flight" :
 #endif
 	    "normal");
+#if defined(CFG_boottrace)
+    const u4_t* bt = hal_boottrace();
+    debug_printf("boot: clock=%u io=%u timer=%u periph=%u eefs=%u radio=%u lmic=%u app=%u us\r\n",
+            bt[HAL_BOOT_CLOCK], bt[HAL_BOOT_IO], bt[HAL_BOOT_TIMER], bt[HAL_BOOT_PERIPH],
+            bt[HAL_BOOT_EEFS], bt[HAL_BOOT_RADIO], bt[HAL_BOOT_LMIC], bt[HAL_BOOT_APP]);
+#endif
 #endif
 
 #ifdef SVC_backtrace
     bt_print();
 #endif
+}
+
+static void initfunc (osjob_t* job) {
+    BOOTTRACE(HAL_BOOT_APP);
+#if defined(CFG_fastboot)
+    static osjob_t infojob;
 
     // Application start hook
     SVCHOOK_appstart(job);
+
+    os_setCallback(&infojob, bootinfo);
+#else
+    bootinfo(job);
+
+    // Application start hook
+    SVCHOOK_appstart(job);
+#endif
 }
 
 int main (void* bootarg) {
@@ -11,7 +11,8 @@
 
 #include "eckm.h"
 
-#include "svcdefs.h" // for type-checking hook functions
+#include "svcdefs_eefs_init.h" // for type-checking hook functions
+#include "svcdefs_eefs_fn.h"
 
 #define CURVE uECC_secp256r1
 
@@ -20,6 +21,11 @@ static const uint8_t UFID_ECKM_CONFIG[12] = {
     0x70, 0x67, 0xbb, 0xc8, 0x59, 0xb9, 0x0e, 0x17, 0xc0, 0xea, 0x85, 0x4c
 };
 
+// 1a139627130e0650-4e42e49c
+static const uint8_t UFID_ECKM_KEYS[12] = {
+    0x50, 0x06, 0x0e, 0x13, 0x27, 0x96, 0x13, 0x1a, 0x9c, 0xe4, 0x42, 0x4e
+};
+
 enum {
     F_INIT      = (1 << 0), // key generated
     F_PAIRED    = (1 << 1), // paired with join server
@@ -32,10 +38,21 @@ typedef struct {
     uint8_t joineui[8];  // join EUI
 } eckm_config;
 
+// derived keys (cached in eefs, so HKDF only runs after pairing)
+typedef struct {
+    uint32_t check;      // binds record to master key (see keys_check())
+    uint8_t nwkkey[16];
+    uint8_t appkey[16];
+} eckm_keys;
+
 static struct {
     uint8_t joineui[8];
     uint8_t nwkkey[16];
     uint8_t appkey[16];
+
+    bool pubvalid;       // pubkey and keyid are valid
+    uint32_t keyid;
+    uint8_t pubkey[64];
 } current;
 
 //  src: 32 bytes ->  8 words or NULL
@@ -100,13 +117,30 @@ static void load (eckm_config* config) {
     }
 }
 
+static uint32_t keys_check (eckm_config* config) {
+    return config->master[0] ^ config->master[1] ^ config->master[2] ^ config->master[3]
+        ^ os_rlsbf4(config->joineui) ^ 0x3a9dc7e1;
+}
+
 static void init (void) {
     eckm_config config;
     load(&config);
+    current.pubvalid = false;
     if( config.flags & F_PAIRED ) {
+        eckm_keys keys;
         memcpy(current.joineui, config.joineui, 8);
-        hkdf(current.nwkkey, config.master, "nwkkey", 6);
-        hkdf(current.appkey, config.master, "appkey", 6);
+        if( eefs_read(UFID_ECKM_KEYS, &keys, sizeof(keys)) == sizeof(keys)
+                && keys.check == keys_check(&config) ) {
+            memcpy(current.nwkkey, keys.nwkkey, 16);
+            memcpy(current.appkey, keys.appkey, 16);
+        } else {
+            hkdf(current.nwkkey, config.master, "nwkkey", 6);
+            hkdf(current.appkey, config.master, "appkey", 6);
+            keys.check = keys_check(&config);
+            memcpy(keys.nwkkey, current.nwkkey, 16);
+            memcpy(keys.appkey, current.appkey, 16);
+            eefs_save(UFID_ECKM_KEYS, &keys, sizeof(keys));
+        }
     } else {
         // use EEPROM settings
         memcpy(current.joineui, hal_joineui(), 8);
@@ -127,9 +161,7 @@ static void init (void) {
 }
 
 static int eckm_rand (uint8_t* dest, unsigned int size) {
-    while( size-- > 0 ) {
-        *dest++ = os_getRndU1();
-    }
+    os_getRndBytes(dest, size);
     return 1;
 }
 
@@ -156,20 +188,23 @@ bool eckm_initkey (void) {
 }
 
 bool eckm_pubkey (uint8_t* pubkey, uint32_t* keyid) {
-    eckm_config config;
-    load(&config);
-    uint8_t pub[64];
-    if( (config.flags & F_INIT)
-            && uECC_compute_public_key(config.prikey, pub, CURVE()) ) {
-        if( pubkey ) {
-            memcpy(pubkey, pub, 64);
-        }
-        if( keyid ) {
-            *keyid = get_keyid(&config);
+    if( !current.pubvalid ) {
+        eckm_config config;
+        load(&config);
+        if( (config.flags & F_INIT) == 0
+                || !uECC_compute_public_key(config.prikey, current.pubkey, CURVE()) ) {
+            return false;
         }
-        return true;
+        current.keyid = get_keyid(&config);
+        current.pubvalid = true;
     }
-    return false;
+    if( pubkey ) {
+        memcpy(pubkey, current.pubkey, 64);
+    }
+    if( keyid ) {
+        *keyid = current.keyid;
+    }
+    return true;
 }
 
 bool eckm_joineui (uint8_t* joineui) {
@@ -202,6 +237,7 @@ bool eckm_pair (const uint8_t* joineui, const uint8_t* pubkey) {
 }
 
 void eckm_clear (void) {
+    eefs_rm(UFID_ECKM_KEYS);
     eefs_rm(UFID_ECKM_CONFIG);
     init();
 }
@@ -214,6 +250,9 @@ const char* _eckm_eefs_fn (const uint8_t* ufid) {
     if( memcmp(ufid, UFID_ECKM_CONFIG, sizeof(UFID_ECKM_CONFIG)) == 0 ) {
         return "ch.mkdata.svc.eckm.config";
     }
+    if( memcmp(ufid, UFID_ECKM_KEYS, sizeof(UFID_ECKM_KEYS)) == 0 ) {
+        return "ch.mkdata.svc.eckm.keys";
+    }
     return NULL;
 }
 
@@ -3,18 +3,106 @@
 // This file is subject to the terms and conditions defined in file 'LICENSE',
 // which is part of this source code package.
 
+#include <string.h>
+
 #include "lmic.h"
 #include "peripherals.h"
 
 #include "picofs.h"
 #include "eefs.h"
 
-#include "svcdefs.h"
+#include "svcdefs_eefs_init.h"
+#include "svcdefs_eefs_gc.h"
+#include "svcdefs_eefs_fn.h"
+
+// Number of blocks at the end of the eefs area used for the record log
+// (0 = disabled, eefs_log_* map to eefs_*).
+#ifndef SVC_EEFS_LOG_BLKS
+#define SVC_EEFS_LOG_BLKS 0
+#endif
+
+// Maximum number of distinct records in the log
+#ifndef SVC_EEFS_LOG_MAXREC
+#define SVC_EEFS_LOG_MAXREC 4
+#endif
+
+// Maximum duration of a garbage collection slice
+#ifndef SVC_EEFS_GC_SLICE
+#define SVC_EEFS_GC_SLICE ms2osticks(20)
+#endif
+
+// Size of write-behind buffer for eefs_save_async() (0 = disabled, writes
+// are synchronous)
+#ifndef SVC_EEFS_ASYNC_BUFSZ
+#define SVC_EEFS_ASYNC_BUFSZ 0
+#endif
+
+// Estimated EEPROM programming time per word (with erase)
+#ifndef SVC_EEFS_ASYNC_WORD_US
+#define SVC_EEFS_ASYNC_WORD_US 3300
+#endif
+
+#if SVC_EEFS_ASYNC_BUFSZ > 0
+// pending write (followed by data, padded to word size)
+typedef struct {
+    uint8_t ufid[12];
+    uint16_t sz;
+    uint16_t res;
+} pend_hdr;
+
+#define PEND_SIZE(sz)   (sizeof(pend_hdr) + (((sz) + 3) & ~3))
+#endif
+
+#if SVC_EEFS_LOG_BLKS > 0
+
+#define LOG_SLOT_NW     16                              // slot size (words)
+#define LOG_DATA_MAX    ((LOG_SLOT_NW - 3) * 4)         // max record size (bytes)
+#define LOG_NSLOTS      ((SVC_EEFS_LOG_BLKS * PFS_BLOCKSZ) / (LOG_SLOT_NW * 4))
+
+_Static_assert(LOG_NSLOTS > SVC_EEFS_LOG_MAXREC, "log too small for number of records");
+_Static_assert(LOG_NSLOTS <= 255, "log too large");
+
+// log slot -- commit word is written last
+typedef struct {
+    uint32_t tag;                       // FNV32 of UFID
+    uint32_t crc;                       // FNV32 of tag, data, and commit word
+    uint32_t data[LOG_SLOT_NW - 3];     // record data
+    uint32_t commit;                    // length (bits 16-31), sequence number (bits 0-15)
+} log_slot;
+
+typedef struct {
+    uint32_t tag;
+    uint8_t slot;
+} log_rec;
+
+#endif
 
 static struct {
     bool initialized;
     pfs fs;
 
+    struct {
+        osjob_t job;
+        int cursor;                     // next file handle to check (-1 = idle)
+    } gc;
+
+#if SVC_EEFS_LOG_BLKS > 0
+    struct {
+        log_slot* slots;
+        int head;                       // next slot to consider for writing
+        uint16_t seq;                   // next sequence number
+        int nrec;
+        log_rec rec[SVC_EEFS_LOG_MAXREC]; // most recent slot per record
+    } log;
+#endif
+
+#if SVC_EEFS_ASYNC_BUFSZ > 0
+    struct {
+        osjob_t job;
+        int len;                        // bytes used in buffer
+        uint32_t buf[SVC_EEFS_ASYNC_BUFSZ / 4]; // pending writes, oldest first
+    } pend;
+#endif
 } state;
 
 #if defined(CFG_DEBUG) && CFG_DEBUG != 0
@@ -32,32 +120,436 @@ static void cb_debug_ls (int fh, const uint8_t* ufid, void* ctx) {
 }
 #endif
 
+#if SVC_EEFS_LOG_BLKS > 0
+// Record log: small, frequently updated records are appended to a ring of
+// fixed-size slots instead of rewriting a picofs chain and metablock. Slots
+// holding the most recent copy of a record are never overwritten; the writer
+// simply skips them. An interrupted write leaves a slot with an invalid CRC,
+// so the previous copy is still found at boot.
+
+static uint32_t log_tag (const uint8_t* ufid) {
+    uint32_t h;
+    pfs_crc32(&h, NULL, 0);
+    pfs_crc32(&h, (unsigned char*) ufid, 12);
+    return h;
+}
+
+static uint32_t log_crc (log_slot* ls, uint32_t commit) {
+    uint32_t h;
+    pfs_crc32(&h, NULL, 0);
+    pfs_crc32(&h, (unsigned char*) &ls->tag, 4);
+    pfs_crc32(&h, (unsigned char*) ls->data, commit >> 16);
+    pfs_crc32(&h, (unsigned char*) &commit, 4);
+    return h;
+}
+
+static bool log_valid (log_slot* ls) {
+    uint32_t commit = ls->commit;
+    return (commit >> 16) <= LOG_DATA_MAX && ls->crc == log_crc(ls, commit);
+}
+
+static int log_find (uint32_t tag) {
+    for( int i = 0; i < state.log.nrec; i++ ) {
+        if( state.log.rec[i].tag == tag ) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static bool log_live (int slot) {
+    for( int i = 0; i < state.log.nrec; i++ ) {
+        if( state.log.rec[i].slot == slot ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void log_init (void* begin) {
+    state.log.slots = begin;
+    state.log.nrec = 0;
+    int last = -1;
+    for( int i = 0; i < LOG_NSLOTS; i++ ) {
+        log_slot* ls = &state.log.slots[i];
+        if( log_valid(ls) ) {
+            uint16_t seq = ls->commit;
+            int r = log_find(ls->tag);
+            if( r < 0 ) {
+                if( state.log.nrec < SVC_EEFS_LOG_MAXREC ) {
+                    state.log.rec[state.log.nrec].tag = ls->tag;
+                    state.log.rec[state.log.nrec].slot = i;
+                    state.log.nrec += 1;
+                }
+            } else if( (int16_t) (seq - (uint16_t) state.log.slots[state.log.rec[r].slot].commit) > 0 ) {
+                state.log.rec[r].slot = i;
+            }
+            if( last < 0 || (int16_t) (seq - (uint16_t) state.log.slots[last].commit) > 0 ) {
+                last = i;
+            }
+        }
+    }
+    if( last < 0 ) {
+        state.log.head = pfs_rnd_block(LOG_NSLOTS);
+        state.log.seq = 0;
+    } else {
+        state.log.head = (last + 1) % LOG_NSLOTS;
+        state.log.seq = state.log.slots[last].commit + 1;
+    }
+}
+
+static int log_read (const uint8_t* ufid, void* data, int sz) {
+    int r = log_find(log_tag(ufid));
+    if( r < 0 ) {
+        return -1;
+    }
+    log_slot* ls = &state.log.slots[state.log.rec[r].slot];
+    int len = ls->commit >> 16;
+    if( data ) {
+        memcpy(data, ls->data, (sz < len) ? sz : len);
+    }
+    return len;
+}
+
+static int log_save (const uint8_t* ufid, void* data, int sz) {
+    uint32_t tag = log_tag(ufid);
+    int r = log_find(tag);
+    if( r < 0 ) {
+        if( state.log.nrec == SVC_EEFS_LOG_MAXREC ) {
+            return -1;
+        }
+    } else {
+        log_slot* ls = &state.log.slots[state.log.rec[r].slot];
+        if( (ls->commit >> 16) == sz && memcmp(ls->data, data, sz) == 0 ) {
+            return state.log.rec[r].slot; // no change
+        }
+    }
+
+    // find next slot not holding a current record (there always is one)
+    int n = state.log.head;
+    while( log_live(n) ) {
+        n = (n + 1) % LOG_NSLOTS;
+    }
+
+    log_slot b;
+    memset(&b, 0, sizeof(b));
+    uint32_t commit = (sz << 16) | state.log.seq;
+    b.tag = tag;
+    memcpy(b.data, data, sz);
+    b.crc = log_crc(&b, commit);
+    log_slot* ls = &state.log.slots[n];
+    eeprom_copy(ls, &b, 8 + ((sz + 3) & ~3));
+    eeprom_write(&ls->commit, commit);
+
+    state.log.head = (n + 1) % LOG_NSLOTS;
+    state.log.seq += 1;
+    if( r < 0 ) {
+        r = state.log.nrec++;
+        state.log.rec[r].tag = tag;
+        // drop copy in file system, if any
+        int fh = pfs_find(&state.fs, ufid);
+        if( fh >= 0 ) {
+            pfs_rm_fh(&state.fs, fh);
+        }
+    }
+    state.log.rec[r].slot = n;
+    return n;
+}
+
+static bool log_rm (const uint8_t* ufid) {
+    uint32_t tag = log_tag(ufid);
+    int r = log_find(tag);
+    if( r < 0 ) {
+        return false;
+    }
+    // invalidate all copies, not just the current one
+    for( int i = 0; i < LOG_NSLOTS; i++ ) {
+        log_slot* ls = &state.log.slots[i];
+        if( ls->tag == tag && log_valid(ls) ) {
+            eeprom_write(&ls->crc, ~ls->crc);
+        }
+    }
+    state.log.rec[r] = state.log.rec[--state.log.nrec];
+    return true;
+}
+#endif
+
+#if SVC_EEFS_ASYNC_BUFSZ > 0
+// Write-behind queue: eefs_save_async() copies the data to a RAM buffer, and
+// a job writes one file at a time when the next scheduled job is far enough
+// out for the estimated programming time. Reads are served from the buffer.
+
+static pend_hdr* pend_find (const uint8_t* ufid) {
+    for( int off = 0; off < state.pend.len; ) {
+        pend_hdr* ph = (pend_hdr*) ((unsigned char*) state.pend.buf + off);
+        if( memcmp(ph->ufid, ufid, 12) == 0 ) {
+            return ph;
+        }
+        off += PEND_SIZE(ph->sz);
+    }
+    return NULL;
+}
+
+static void pend_remove (pend_hdr* ph) {
+    int off = (unsigned char*) ph - (unsigned char*) state.pend.buf;
+    int n = PEND_SIZE(ph->sz);
+    memmove(ph, (unsigned char*) ph + n, state.pend.len - off - n);
+    state.pend.len -= n;
+}
+
+static void pend_drop (const uint8_t* ufid) {
+    pend_hdr* ph = pend_find(ufid);
+    if( ph ) {
+        pend_remove(ph);
+    }
+}
+
+static int pend_read (const uint8_t* ufid, void* data, int sz) {
+    pend_hdr* ph = pend_find(ufid);
+    if( ph == NULL ) {
+        return -1;
+    }
+    if( data ) {
+        memcpy(data, ph + 1, (sz < ph->sz) ? sz : ph->sz);
+    }
+    return ph->sz;
+}
+
+static int save (const uint8_t* ufid, void* data, int sz);
+
+// write oldest pending file (returns false if not enough idle time)
+static bool pend_write (bool force) {
+    pend_hdr* ph = (pend_hdr*) state.pend.buf;
+    if( !force ) {
+        // estimate: data and metablock (plus one block for chain switch)
+        int nw = (((ph->sz + 30) / 31) + 2) * (PFS_BLOCKSZ / 4);
+        ostime_t cost = us2osticksCeil(nw * SVC_EEFS_ASYNC_WORD_US);
+        ostime_t deadline;
+        if( os_getNextDeadline(&deadline) && deadline - os_getTime() < cost ) {
+            return false;
+        }
+    }
+    save(ph->ufid, ph + 1, ph->sz);
+    pend_remove(ph);
+    return true;
+}
+
+static void pend_job (osjob_t* job) {
+    if( state.pend.len ) {
+        if( pend_write(false) ) {
+            if( state.pend.len ) {
+                os_setSlowCallback(job, pend_job);
+            }
+        } else {
+            // retry after next job
+            ostime_t deadline;
+            os_getNextDeadline(&deadline);
+            os_setTimedCallbackEx(job, deadline, pend_job, OSJOB_FLAG_APPROX | OSJOB_FLAG_SLOWCLK);
+        }
+    }
+}
+#endif
+
+// Garbage collection: files are kept unless a service approves their removal
+// from the eefs_gc hook (fn is the name from the eefs_fn hook, or NULL if no
+// service knows the file), so data of services not linked into this build
+// survives. Collection runs in slices of at most SVC_EEFS_GC_SLICE from a
+// job, so other jobs can run in between, and only when started explicitly.
+
+static bool gc_keep (const uint8_t* ufid) {
+    int keep = 1;
+    SVCHOOK_eefs_gc(SVCHOOK_eefs_fn(ufid), &keep);
+    return keep;
+}
+
+// returns true when complete
+static bool gc_slice (void) {
+    ostime_t t0 = os_getTime();
+    const uint8_t* ufid;
+    int fh;
+    while( (fh = pfs_next(&state.fs, state.gc.cursor, &ufid)) >= 0 ) {
+        state.gc.cursor = fh + 1;
+        if( !gc_keep(ufid) ) {
+            debug_printf("eefs: gc removing file %02x\r\n", fh);
+            pfs_rm_fh(&state.fs, fh);
+        }
+        if( os_getTime() - t0 >= SVC_EEFS_GC_SLICE ) {
+            return false;
+        }
+    }
+    state.gc.cursor = -1;
+    return true;
+}
+
+static void gc_job (osjob_t* job) {
+    if( !gc_slice() ) {
+        os_setSlowCallback(job, gc_job);
+    }
+}
+
+void eefs_gc_start (void) {
+    ASSERT(state.initialized);
+    if( state.gc.cursor < 0 ) {
+        state.gc.cursor = 0;
+    }
+    os_setSlowCallback(&state.gc.job, gc_job);
+}
+
 void eefs_init (void* begin, unsigned int size) {
+#if SVC_EEFS_LOG_BLKS > 0
+    int nblks = size / PFS_BLOCKSZ - SVC_EEFS_LOG_BLKS;
+    ASSERT(nblks > 0);
+    pfs_init(&state.fs, begin, nblks);
+    log_init((unsigned char*) begin + nblks * PFS_BLOCKSZ);
+#else
     pfs_init(&state.fs, begin, size / PFS_BLOCKSZ);
+#endif
     state.initialized = true;
+    state.gc.cursor = -1;
 #if defined(CFG_DEBUG) && CFG_DEBUG != 0
     pfs_ls(&state.fs, cb_debug_ls, NULL);
+#if SVC_EEFS_LOG_BLKS > 0
+    debug_printf("eefs: log %d slots, %d records, head=%d, seq=%d\r\n",
+            LOG_NSLOTS, state.log.nrec, state.log.head, state.log.seq);
+#endif
 #endif
     SVCHOOK_eefs_init();
 }
 
 int eefs_read (const uint8_t* ufid, void* data, int sz) {
     ASSERT(state.initialized);
+#if SVC_EEFS_ASYNC_BUFSZ > 0
+    int len = pend_read(ufid, data, sz);
+    if( len >= 0 ) {
+        return len;
+    }
+#endif
     return pfs_read(&state.fs, ufid, data, sz);
 }
 
+#if SVC_EEFS_ASYNC_BUFSZ > 0
+static int save (const uint8_t* ufid, void* data, int sz) {
+#else
 int eefs_save (const uint8_t* ufid, void* data, int sz) {
     ASSERT(state.initialized);
-    int fh = pfs_save(&state.fs, ufid, data, sz);
-    if( fh < 0 ) {
-        // TODO: garbage collect
-        fh = pfs_save(&state.fs, ufid, data, sz);
+#endif
+#if SVC_EEFS_LOG_BLKS > 0
+    // invalidate log copies first, eefs_log_read() would return them
+    log_rm(ufid);
+#endif
+    return pfs_save(&state.fs, ufid, data, sz);
+}
+
+#if SVC_EEFS_ASYNC_BUFSZ > 0
+int eefs_save (const uint8_t* ufid, void* data, int sz) {
+    ASSERT(state.initialized);
+    pend_drop(ufid);
+    return save(ufid, data, sz);
+}
+
+int eefs_save_async (const uint8_t* ufid, void* data, int sz) {
+    ASSERT(state.initialized);
+    pend_drop(ufid);
+    if( state.pend.len + PEND_SIZE(sz) > sizeof(state.pend.buf) ) {
+        return save(ufid, data, sz);
+    }
+    pend_hdr* ph = (pend_hdr*) ((unsigned char*) state.pend.buf + state.pend.len);
+    memcpy(ph->ufid, ufid, 12);
+    ph->sz = sz;
+    memcpy(ph + 1, data, sz);
+    state.pend.len += PEND_SIZE(sz);
+    if( !os_jobPending(&state.pend.job) ) {
+        os_setSlowCallback(&state.pend.job, pend_job);
+    }
+    return 0;
+}
+
+void eefs_flush (void) {
+    ASSERT(state.initialized);
+    while( state.pend.len ) {
+        pend_write(true);
+    }
+    os_clearCallback(&state.pend.job);
+}
+#else
+int eefs_save_async (const uint8_t* ufid, void* data, int sz) {
+    return eefs_save(ufid, data, sz);
+}
+
+void eefs_flush (void) {
+}
+#endif
+
+int eefs_log_read (const uint8_t* ufid, void* data, int sz) {
+    ASSERT(state.initialized);
+#if SVC_EEFS_ASYNC_BUFSZ > 0
+    int plen = pend_read(ufid, data, sz);
+    if( plen >= 0 ) {
+        return plen;
     }
-    return fh;
+#endif
+#if SVC_EEFS_LOG_BLKS > 0
+    int len = log_read(ufid, data, sz);
+    if( len >= 0 ) {
+        return len;
+    }
+#endif
+    return pfs_read(&state.fs, ufid, data, sz);
+}
+
+int eefs_log_save (const uint8_t* ufid, void* data, int sz) {
+    ASSERT(state.initialized);
+#if SVC_EEFS_ASYNC_BUFSZ > 0
+    pend_drop(ufid);
+#endif
+#if SVC_EEFS_LOG_BLKS > 0
+    if( sz <= LOG_DATA_MAX ) {
+        int rv = log_save(ufid, data, sz);
+        if( rv >= 0 ) {
+            return rv;
+        }
+    }
+#endif
+    // (drops the log copy, if any)
+    return eefs_save(ufid, data, sz);
+}
+
+int eefs_update (const uint8_t* ufid, int off, void* data, int sz) {
+    ASSERT(state.initialized);
+#if SVC_EEFS_ASYNC_BUFSZ > 0
+    pend_hdr* ph = pend_find(ufid);
+    if( ph ) {
+        if( off < 0 || off + sz > ph->sz ) {
+            return -1;
+        }
+        memcpy((unsigned char*) (ph + 1) + off, data, sz);
+        return 0;
+    }
+#endif
+#if SVC_EEFS_LOG_BLKS > 0
+    uint32_t buf[LOG_DATA_MAX / 4];
+    int len = log_read(ufid, buf, sizeof(buf));
+    if( len >= 0 ) {
+        if( off < 0 || off + sz > len ) {
+            return -1;
+        }
+        memcpy((unsigned char*) buf + off, data, sz);
+        return log_save(ufid, buf, len);
+    }
+#endif
+    return pfs_update(&state.fs, ufid, off, data, sz);
 }
 
 bool eefs_rm (const uint8_t* ufid) {
     ASSERT(state.initialized);
+#if SVC_EEFS_ASYNC_BUFSZ > 0
+    pend_drop(ufid);
+#endif
+#if SVC_EEFS_LOG_BLKS > 0
+    if( log_rm(ufid) ) {
+        return true;
+    }
+#endif
     int fh = pfs_find(&state.fs, ufid);
     if( fh < 0 ) {
         return false;
@@ -86,7 +578,7 @@ void pfs_write_block (void* dst, void* src, int nwords) {
 }
 
 uint8_t pfs_rnd_block (uint8_t nblks) {
-    uint32_t rnd = (os_getRndU1() << 24) | (os_getRndU1() << 16)
-        | (os_getRndU1() << 8) | os_getRndU1();
+    uint32_t rnd;
+    os_getRndBytes((u1_t*) &rnd, sizeof(rnd));
     return rnd % nblks;
 }
@@ -11,7 +11,45 @@
 
 void eefs_init (void* begin, unsigned int size);
 int eefs_read (const uint8_t* ufid, void* data, int sz);
+// Returns a negative value if the file does not fit into the free blocks.
+// Space of files that could be removed is not reclaimed implicitly, so a
+// save can fail although eefs_gc_start() would make room for it.
 int eefs_save (const uint8_t* ufid, void* data, int sz);
+
+// Write-behind save (SVC_EEFS_ASYNC_BUFSZ > 0): the data is copied and
+// written by a background job when there is enough time before the next
+// scheduled job. Reads see pending data. eefs_flush() writes all pending
+// files synchronously (e.g. before a reboot).
+int eefs_save_async (const uint8_t* ufid, void* data, int sz);
+void eefs_flush (void);
 bool eefs_rm (const uint8_t* ufid);
 
+// Start background garbage collection: a file is removed only if a service
+// clears *pkeep from its eefs_gc hook (fn is the name from the eefs_fn hook,
+// or NULL for files unknown to all services); all other files are kept.
+void eefs_gc_start (void);
+
+// Update part of an existing file (offset and length must lie within the
+// file); only the blocks up to the last modified one are rewritten.
+// Returns a negative value if the file does not exist or is too short.
+int eefs_update (const uint8_t* ufid, int off, void* data, int sz);
+
+// Record log for small, frequently updated records (SVC_EEFS_LOG_BLKS > 0).
+// Each update is appended to a ring of 64-byte slots at the end of the eefs
+// area, writing 3 words plus the record data; records of up to 52 bytes are
+// supported, larger ones (or too many records) fall back to eefs_save(),
+// which invalidates the copies in the log. Use eefs_log_read() for records
+// written with eefs_log_save(); records previously saved with eefs_save() are
+// found and migrated on first update.
+//
+// Endurance: every update goes to the next free slot, so with S slots of
+// which R hold other current records, each word is programmed once per
+// (S - R) updates. With 100k cycles per word (STM32L0 data EEPROM at 85C)
+// over 10 years, that allows about 27 * (S - R) updates per day; e.g.
+// SVC_EEFS_LOG_BLKS=32 (16 slots, 1 other record) gives ~410 updates/day,
+// compared to ~27/day for a plain file whose metablock is rewritten on
+// every save. The host test (make check) measures both projections.
+int eefs_log_read (const uint8_t* ufid, void* data, int sz);
+int eefs_log_save (const uint8_t* ufid, void* data, int sz);
+
 #endif
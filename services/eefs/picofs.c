@@ -66,6 +66,59 @@ static inline void dealloc (pfs_alloc* a, int blk) {
     a->map[blk >> 5] &= ~(1 << (blk & 0x1f));
 }
 
+// Directory index: open addressing with linear probing over the random part
+// of the UFID. Entries are hints only; a hit is always verified against the
+// metablock, so stale entries are harmless.
+
+enum {
+    IDX_EMPTY = 0,
+    IDX_DELETED = 255,
+};
+
+_Static_assert((PFS_IDXSZ & (PFS_IDXSZ - 1)) == 0, "index size must be power of 2");
+
+static inline int idx_hash (const uint8_t* ufid) {
+    return (ufid[8] ^ ufid[9] ^ ufid[10] ^ ufid[11]) & (PFS_IDXSZ - 1);
+}
+
+static bool ismeta (pfs* s, int fh, const uint8_t* ufid) {
+    return isalloc(&s->alloc, fh) && s->bb[fh].meta.magic == MB_MAGIC
+        && memcmp(ufid, s->bb[fh].meta.ufid, 12) == 0;
+}
+
+static void idx_add (pfs* s, const uint8_t* ufid, int fh) {
+    int h = idx_hash(ufid);
+    for( int i = 0; i < PFS_IDXSZ; i++, h = (h + 1) & (PFS_IDXSZ - 1) ) {
+        if( s->idx[h] == IDX_EMPTY || s->idx[h] == IDX_DELETED ) {
+            s->idx[h] = fh + 1;
+            return;
+        }
+    }
+    PFS_LOG("index full\n");
+    s->idxfull = true;
+}
+
+static void idx_del (pfs* s, const uint8_t* ufid, int fh) {
+    int h = idx_hash(ufid);
+    for( int i = 0; i < PFS_IDXSZ && s->idx[h] != IDX_EMPTY; i++, h = (h + 1) & (PFS_IDXSZ - 1) ) {
+        if( s->idx[h] == fh + 1 ) {
+            s->idx[h] = IDX_DELETED;
+            return;
+        }
+    }
+}
+
+// returns fh, -1 if not found, or -2 if index cannot be relied upon
+static int idx_find (pfs* s, const uint8_t* ufid) {
+    int h = idx_hash(ufid);
+    for( int i = 0; i < PFS_IDXSZ && s->idx[h] != IDX_EMPTY; i++, h = (h + 1) & (PFS_IDXSZ - 1) ) {
+        if( s->idx[h] != IDX_DELETED && ismeta(s, s->idx[h] - 1, ufid) ) {
+            return s->idx[h] - 1;
+        }
+    }
+    return s->idxfull ? -2 : -1;
+}
+
 typedef int (*walk_cb) (pfs* s, int n, void* ctx);
 
 static int walk (pfs* s, int start, walk_cb cb, void* ctx) {
@@ -127,6 +180,8 @@ void pfs_init (pfs* s, void* p, int nblks) {
     s->nblks = nblks;
     s->next = pfs_rnd_block(nblks);
     memset(&s->alloc, 0, sizeof(s->alloc));
+    memset(s->idx, IDX_EMPTY, sizeof(s->idx));
+    s->idxfull = false;
     for( int i = 0; i < nblks; i++ ) {
         if( !isalloc(&s->alloc, i )
                 && s->bb[i].meta.magic == MB_MAGIC ) {
@@ -135,6 +190,7 @@ void pfs_init (pfs* s, void* p, int nblks) {
                 PFS_LOG(" chain %d: ", j);
                 if( v_chain(s, s->bb[i].meta.p[j].blk0, s->bb[i].meta.crc[j]) ) {
                     alloc(&s->alloc, i);
+                    idx_add(s, s->bb[i].meta.ufid, i);
                     if(~(s->bb[i].meta.p[j^1].w) != 0 ) {
                         // fix dangling entry
                         pfs_write_word(&s->bb[i].meta.p[j^1].w, ~0);
@@ -180,6 +236,17 @@ void pfs_ls (pfs* s, void (*cb) (int, const uint8_t*, void*), void* ctx) {
     pfs_dir(s, cb_ls, &li);
 }
 
+// return first file handle >= fh (or -1), and its UFID
+int pfs_next (pfs* s, int fh, const uint8_t** pufid) {
+    for( ; fh >= 0 && fh < s->nblks; fh++ ) {
+        if( isalloc(&s->alloc, fh) && s->bb[fh].meta.magic == MB_MAGIC ) {
+            *pufid = s->bb[fh].meta.ufid;
+            return fh;
+        }
+    }
+    return -1;
+}
+
 typedef struct {
     const uint8_t* ufid;
     int fh;
@@ -195,6 +262,10 @@ static int cb_find (pfs* s, int n, void* ctx) {
 }
 
 int pfs_find (pfs* s, const uint8_t* ufid) {
+    int fh = idx_find(s, ufid);
+    if( fh != -2 ) {
+        return fh;
+    }
     finfo fi = {
         .ufid = ufid
     };
@@ -204,16 +275,29 @@ int pfs_find (pfs* s, const uint8_t* ufid) {
     return -1;
 }
 
+typedef struct {
+    pfs_alloc* a;
+    int stop;
+} dinfo;
+
 static int cb_dealloc (pfs* s, int n, void* ctx) {
-    pfs_alloc* a = ctx;
+    dinfo* di = ctx;
+    if( n == di->stop ) {
+        return 1;
+    }
     PFS_LOG("%d, ", n);
-    dealloc(a, n);
+    dealloc(di->a, n);
     return 0;
 }
 
-static void chain_clear (pfs* s, pfs_alloc* a, int start) {
+// deallocate chain up to (not including) block stop
+static void chain_clear (pfs* s, pfs_alloc* a, int start, int stop) {
+    dinfo di = {
+        .a = a,
+        .stop = stop
+    };
     PFS_LOG("chain_clear: ");
-    walk(s, start, cb_dealloc, a);
+    walk(s, start, cb_dealloc, &di);
     PFS_LOG("complete\n");
 }
 
@@ -221,8 +305,9 @@ void pfs_rm_fh (pfs* s, int fh) {
     if( isalloc(&s->alloc, fh)
             && s->bb[fh].meta.magic == MB_MAGIC ) {
         int j = (~(s->bb[fh].meta.p[0].w) == 0);
+        idx_del(s, s->bb[fh].meta.ufid, fh);
         pfs_write_word(&s->bb[fh].meta.magic, 0);
-        chain_clear(s, &s->alloc, s->bb[fh].meta.p[j].blk0);
+        chain_clear(s, &s->alloc, s->bb[fh].meta.p[j].blk0, 255);
         dealloc(&s->alloc, fh);
     }
 }
@@ -260,12 +345,13 @@ static int meta_create (pfs* s, pfs_alloc* a, const uint8_t* ufid) {
     return fh;
 }
 
-static void meta_update (pfs* s, pfs_alloc* a, int fh, uint32_t w, uint32_t crc) {
+// switch to new chain, old chain is deallocated up to block stop (shared tail)
+static void meta_update (pfs* s, pfs_alloc* a, int fh, uint32_t w, uint32_t crc, int stop) {
     int j = (~(s->bb[fh].meta.p[0].w) != 0);
     pfs_write_word(&s->bb[fh].meta.crc[j], crc);
     pfs_write_word(&s->bb[fh].meta.p[j].w, w);
     if( ~(s->bb[fh].meta.p[j^1].w) != 0 ) {
-        chain_clear(s, a, s->bb[fh].meta.p[j^1].blk0);
+        chain_clear(s, a, s->bb[fh].meta.p[j^1].blk0, stop);
         pfs_write_word(&s->bb[fh].meta.p[j^1].w, ~0);
     }
     PFS_LOG("meta_update: %d, w0=%08x, w1=%08x\n", fh, s->bb[fh].meta.p[0].w, s->bb[fh].meta.p[1].w);
@@ -347,13 +433,17 @@ int pfs_save (pfs* s, const uint8_t* ufid, void* data, int sz) {
     uint32_t crc;
     pfs_alloc a = s->alloc;
     int fh, first, pad = 0; // initialize to appease compiler
+    bool new = false;
     if( ((fh = pfs_find(s, ufid)) >= 0) ) {
         if( chain_cmp(s, fh, data, sz) == 0 ) {
             PFS_LOG("no change\n");
             return fh;
         }
-    } else if( (fh = meta_create(s, &a, ufid)) < 0 ) {
-        return fh;
+    } else {
+        if( (fh = meta_create(s, &a, ufid)) < 0 ) {
+            return fh;
+        }
+        new = true;
     }
     pfs_crc32(&crc, NULL, 0);
     if( (first = chain_write(s, &a, data, sz, &pad, &crc)) < 0 ) {
@@ -363,8 +453,11 @@ int pfs_save (pfs* s, const uint8_t* ufid, void* data, int sz) {
         .blk0 = first,
         .pad = pad
     };
-    meta_update(s, &a, fh, p.w, crc);
+    meta_update(s, &a, fh, p.w, crc, 255);
     s->alloc = a;
+    if( new ) {
+        idx_add(s, ufid, fh);
+    }
     return fh;
 }
 
@@ -409,3 +502,89 @@ int pfs_read (pfs* s, const uint8_t* ufid, void* data, int sz) {
     }
     return pfs_read_fh(s, fh, data, sz);
 }
+
+// Partial update: only the blocks up to the last modified one are copied
+// (the chain is singly linked, so the predecessors of a modified block need
+// a new next pointer); the tail is shared with the old chain. The CRC is
+// continued over the unmodified tail by reading it, and the new chain is
+// committed atomically via the metablock as with pfs_save().
+int pfs_update (pfs* s, const uint8_t* ufid, int off, void* data, int sz) {
+    int fh;
+    if( (fh = pfs_find(s, ufid)) < 0 ) {
+        return fh;
+    }
+    int j = (~(s->bb[fh].meta.p[0].w) == 0);
+    fbp op = s->bb[fh].meta.p[j];
+    if( off < 0 || sz <= 0 || off + sz > pfs_read_fh(s, fh, NULL, 0) ) {
+        return -1;
+    }
+    PFS_LOG("pfs_update: ");
+
+    pfs_alloc a = s->alloc;
+    unsigned char* ptr = data;
+    int end = off + sz;
+    int last = (end - 1) / 31;
+    uint32_t crc;
+    pfs_crc32(&crc, NULL, 0);
+
+    // check for changes first
+    int o = op.blk0;
+    for( int k = 0; k <= last; k++, o = s->bb[o].data.next ) {
+        int b0 = k * 31;
+        int lo = (off > b0) ? off - b0 : 0;
+        int hi = (end < b0 + 31) ? end - b0 : 31;
+        if( lo < hi && memcmp(s->bb[o].data.data + lo, ptr + (b0 + lo - off), hi - lo) != 0 ) {
+            break;
+        }
+        if( k == last ) {
+            PFS_LOG("no change\n");
+            return fh;
+        }
+    }
+
+    o = op.blk0;
+    int first = block_alloc(s, &a);
+    if( first < 0 ) {
+        PFS_LOG("out of memory\n");
+        return first;
+    }
+    int i = first;
+    for( int k = 0; k <= last; k++ ) {
+        pfs_block b;
+        b = s->bb[o];
+        int b0 = k * 31;
+        int lo = (off > b0) ? off - b0 : 0;
+        int hi = (end < b0 + 31) ? end - b0 : 31;
+        if( lo < hi ) {
+            memcpy(b.data.data + lo, ptr + (b0 + lo - off), hi - lo);
+        }
+        pfs_crc32(&crc, b.data.data, sizeof(b.data.data));
+        o = s->bb[o].data.next;
+        int n;
+        if( k < last ) {
+            if( (n = block_alloc(s, &a)) < 0 ) {
+                PFS_LOG("out of memory\n");
+                return n;
+            }
+        } else {
+            n = o;      // shared tail
+        }
+        PFS_LOG("%d, ", i);
+        b.data.next = n;
+        pfs_write_block(s->bb[i].raw, b.raw, sizeof(b.raw) / 4);
+        i = n;
+    }
+    // continue CRC over tail
+    for( ; o != 255; o = s->bb[o].data.next ) {
+        pfs_crc32(&crc, s->bb[o].data.data, sizeof(s->bb[o].data.data));
+    }
+    PFS_LOG("complete\n");
+
+    fbp p = {
+        .blk0 = first,
+        .pad = op.pad
+    };
+    meta_update(s, &a, fh, p.w, crc, i);
+    s->alloc = a;
+    return fh;
+}
@@ -16,6 +16,11 @@ enum {
     PFS_BLOCKSZ = 32,
 };
 
+// number of directory index slots (power of 2)
+#ifndef PFS_IDXSZ
+#define PFS_IDXSZ 32
+#endif
+
 // block allocation map
 typedef struct {
     uint32_t map[8];            // 32 B - block allocation map
@@ -27,6 +32,8 @@ typedef struct {
     int nblks;                  // number of blocks
     int next;                   // next alloc search start
     pfs_alloc alloc;            // allocation bitmap
+    uint8_t idx[PFS_IDXSZ];     // directory index (UFID hash -> fh+1, 0=empty, 255=deleted)
+    bool idxfull;               // index overflowed, fall back to directory walk
 } pfs;
 
 // glue functions
@@ -39,7 +46,9 @@ void pfs_init (pfs* s, void* p, int nblks);
 int pfs_find (pfs* s, const uint8_t* ufid);
 int pfs_read (pfs* s, const uint8_t* ufid, void* data, int sz);
 int pfs_save (pfs* s, const uint8_t* ufid, void* data, int sz);
+int pfs_update (pfs* s, const uint8_t* ufid, int off, void* data, int sz);
 void pfs_ls (pfs* s, void (*cb) (int fh, const uint8_t* ufid, void* ctx), void* ctx);
+int pfs_next (pfs* s, int fh, const uint8_t** pufid);
 
 void pfs_rm_fh (pfs* s, int fh);
 int pfs_read_fh (pfs* s, int fh, void* data, int sz);
@@ -0,0 +1,11 @@
+// Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+// HAL peripherals for the host test (see ../test.c)
+
+#define PERIPH_EEPROM
+
+// debug_printf() (not included by oslmic.h for CFG_simul)
+#include "debug.h"
@@ -0,0 +1,9 @@
+// Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+// Service hooks for the host test (see ../test.c)
+
+void test_eefs_init (void);
+#define SVCHOOK_eefs_init() test_eefs_init()
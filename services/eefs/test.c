@@ -0,0 +1,308 @@
+// Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lmic.h"
+#include "peripherals.h"
+
+#include "picofs.h"
+#include "eefs.h"
+
+// Run eefs on a simulated EEPROM with stubbed scheduler and service hooks,
+// and check that garbage collection only removes files a service approved
+// through the eefs_gc hook, and never runs unless started. Records switching
+// between the log and a plain file must always read back the latest value,
+// also after a reboot. The write count per EEPROM word gives the endurance
+// projection for log records and plain files.
+
+static int errors;
+
+#define CHECK(c) do { if( !(c) ) { \
+    fprintf(stderr, "FAILED: %s:%d: %s\n", __FILE__, __LINE__, #c); errors += 1; \
+} } while( 0 )
+
+// ------------------------------------------------
+// EEPROM
+
+#define EE_NBLKS 64
+
+#define EE_NWORDS (EE_NBLKS * PFS_BLOCKSZ / 4)
+
+static uint32_t ee[EE_NWORDS];
+static uint32_t wcnt[EE_NWORDS];        // writes per word
+
+void eeprom_write (void* dest, unsigned int val) {
+    uint32_t* p = dest;
+    ASSERT(p >= ee && p < ee + EE_NWORDS);
+    *p = val;
+    wcnt[p - ee] += 1;
+}
+
+void eeprom_copy (void* dest, const void* src, int len) {
+    ASSERT((len & 3) == 0);
+    const uint32_t* s = src;
+    for( uint32_t* p = dest; len > 0; len -= 4 ) {
+        eeprom_write(p++, *s++);
+    }
+}
+
+// ------------------------------------------------
+// Scheduler, HAL
+
+#define MAXJOBS 4
+
+static ostime_t now;
+static osjob_t* jobs[MAXJOBS];
+
+ostime_t os_getTime (void) {
+    return now++;
+}
+
+int os_clearCallback (osjob_t* job) {
+    for( int i = 0; i < MAXJOBS; i++ ) {
+        if( jobs[i] == job ) {
+            jobs[i] = NULL;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int os_jobPending (osjob_t* job) {
+    for( int i = 0; i < MAXJOBS; i++ ) {
+        if( jobs[i] == job ) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void os_setTimedCallbackEx (osjob_t* job, ostime_t time, osjobcb_t cb, unsigned int flags) {
+    os_clearCallback(job);
+    job->deadline = (flags & OSJOB_FLAG_NOW) ? now : time;
+    job->func = cb;
+    for( int i = 0; i < MAXJOBS; i++ ) {
+        if( jobs[i] == NULL ) {
+            jobs[i] = job;
+            return;
+        }
+    }
+    ASSERT(0);
+}
+
+static bool idle (void) {
+    for( int i = 0; i < MAXJOBS; i++ ) {
+        if( jobs[i] ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// run jobs until none is pending
+static void run (void) {
+    for( int n = 0; !idle(); n++ ) {
+        ASSERT(n < 1000);
+        for( int i = 0; i < MAXJOBS; i++ ) {
+            osjob_t* job = jobs[i];
+            if( job ) {
+                jobs[i] = NULL;
+                job->func(job);
+            }
+        }
+    }
+}
+
+void os_getRndBytes (u1_t* buf, int n) {
+    while( n-- > 0 ) {
+        *buf++ = rand();
+    }
+}
+
+void hal_failed (void) {
+    abort();
+}
+
+// ------------------------------------------------
+// Service hooks
+
+// 1a13962807e5b1b0-c0f5db1d
+static const uint8_t UFID_KNOWN[12] = { 0xb0, 0xb1, 0xe5, 0x07, 0x28, 0x96, 0x13, 0x1a, 0x1d, 0xdb, 0xf5, 0xc0 };
+// 1a13962808890af0-977da6ca
+static const uint8_t UFID_OTHER[12] = { 0xf0, 0x0a, 0x89, 0x08, 0x28, 0x96, 0x13, 0x1a, 0xca, 0xa6, 0x7d, 0x97 };
+
+enum { GC_DEFAULT, GC_UNKNOWN };
+static int gc_policy;                   // files approved for removal
+static int gc_calls;
+
+void test_eefs_init (void) {
+}
+
+const char* test_eefs_fn (const uint8_t* ufid) {
+    return (memcmp(ufid, UFID_KNOWN, 12) == 0) ? "test.known" : NULL;
+}
+
+void test_eefs_gc (const char* fn, int* pkeep) {
+    gc_calls += 1;
+    if( gc_policy == GC_UNKNOWN && fn == NULL ) {
+        *pkeep = 0;
+    }
+}
+
+// ------------------------------------------------
+
+static uint8_t data[512];
+
+static void format (void) {
+    memset(ee, 0, sizeof(ee));
+    memset(wcnt, 0, sizeof(wcnt));
+    eefs_init(ee, sizeof(ee));
+}
+
+static void reboot (void) {
+    eefs_init(ee, sizeof(ee));
+}
+
+static uint32_t max_wcnt (void) {
+    uint32_t m = 0;
+    for( int i = 0; i < EE_NWORDS; i++ ) {
+        if( wcnt[i] > m ) {
+            m = wcnt[i];
+        }
+    }
+    return m;
+}
+
+static void fill (uint8_t* buf, int sz, int seed) {
+    for( int i = 0; i < sz; i++ ) {
+        buf[i] = seed * 31 + i;
+    }
+}
+
+static bool check (const uint8_t* ufid, int seed, int sz) {
+    uint8_t exp[sizeof(data)], buf[sizeof(data)];
+    fill(exp, sz, seed);
+    return eefs_log_read(ufid, buf, sizeof(buf)) == sz && memcmp(buf, exp, sz) == 0;
+}
+
+static void ufid_n (uint8_t* ufid, int n) {
+    memcpy(ufid, UFID_OTHER, 12);
+    ufid[9] = n;
+}
+
+static void test_gc (void) {
+    format();
+    CHECK(eefs_save(UFID_KNOWN, data, 40) >= 0);
+    CHECK(eefs_save(UFID_OTHER, data, 40) >= 0);
+
+    // files unknown to all services are kept unless a service approves
+    gc_policy = GC_DEFAULT;
+    gc_calls = 0;
+    eefs_gc_start();
+    run();
+    CHECK(gc_calls == 2);
+    CHECK(eefs_read(UFID_KNOWN, NULL, 0) == 40);
+    CHECK(eefs_read(UFID_OTHER, NULL, 0) == 40);
+
+    // a full file system does not trigger collection
+    uint8_t ufid[12];
+    int n = 0;
+    do {
+        ufid_n(ufid, ++n);
+    } while( eefs_save(ufid, data, 100) >= 0 && n < EE_NBLKS );
+    CHECK(n > 1 && n < EE_NBLKS);
+    CHECK(idle());
+    CHECK(eefs_read(UFID_OTHER, NULL, 0) == 40);
+
+    // ... until removal of unknown files is approved explicitly
+    gc_policy = GC_UNKNOWN;
+    eefs_gc_start();
+    run();
+    CHECK(eefs_read(UFID_KNOWN, NULL, 0) == 40);
+    CHECK(eefs_read(UFID_OTHER, NULL, 0) < 0);
+    ufid_n(ufid, 1);
+    CHECK(eefs_read(ufid, NULL, 0) < 0);
+    CHECK(eefs_save(ufid, data, 100) >= 0);
+    gc_policy = GC_DEFAULT;
+}
+
+static void test_log (void) {
+    format();
+    uint8_t buf[sizeof(data)];
+    // alternate between records that fit into a log slot and ones that don't
+    static const int sizes[] = { 20, 100, 100, 8, 52, 53, 12, 12, 200, 4 };
+    for( int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++ ) {
+        fill(buf, sizes[i], i);
+        CHECK(eefs_log_save(UFID_KNOWN, buf, sizes[i]) >= 0);
+        CHECK(check(UFID_KNOWN, i, sizes[i]));
+        reboot();
+        CHECK(check(UFID_KNOWN, i, sizes[i]));
+    }
+    // plain save of a record held in the log
+    fill(buf, 16, 99);
+    CHECK(eefs_log_save(UFID_OTHER, buf, 16) >= 0);
+    fill(buf, 24, 100);
+    CHECK(eefs_save(UFID_OTHER, buf, 24) >= 0);
+    CHECK(check(UFID_OTHER, 100, 24));
+    reboot();
+    CHECK(check(UFID_OTHER, 100, 24));
+    // removal
+    CHECK(eefs_rm(UFID_KNOWN));
+    CHECK(eefs_log_read(UFID_KNOWN, NULL, 0) < 0);
+    reboot();
+    CHECK(eefs_log_read(UFID_KNOWN, NULL, 0) < 0);
+}
+
+// updates per day over 10 years with 100k cycles per word
+static double per_day (int nupd, uint32_t maxw) {
+    return 100000.0 / (10 * 365) * nupd / maxw;
+}
+
+static void test_endurance (void) {
+    enum { NUPD = 2000, SZ = 36 };      // e.g. pwrman statistics
+    uint8_t buf[SZ];
+
+    // log record, with one other current record
+    format();
+    fill(buf, SZ, 0);
+    CHECK(eefs_log_save(UFID_OTHER, buf, SZ) >= 0);
+    memset(wcnt, 0, sizeof(wcnt));
+    for( int i = 1; i <= NUPD; i++ ) {
+        fill(buf, SZ, i);
+        CHECK(eefs_log_save(UFID_KNOWN, buf, SZ) >= 0);
+    }
+    CHECK(check(UFID_KNOWN, NUPD, SZ));
+    double log = per_day(NUPD, max_wcnt());
+
+    // plain file
+    format();
+    for( int i = 1; i <= NUPD; i++ ) {
+        fill(buf, SZ, i);
+        CHECK(eefs_save(UFID_KNOWN, buf, SZ) >= 0);
+    }
+    CHECK(check(UFID_KNOWN, NUPD, SZ));
+    double plain = per_day(NUPD, max_wcnt());
+
+    // log: every update goes to the next free slot (eefs.h)
+    int nslots = (SVC_EEFS_LOG_BLKS * PFS_BLOCKSZ) / 64;
+    CHECK(log >= 27 * (nslots - 1));
+    CHECK(log > plain);
+    printf("endurance (%d slots, %dB record): log %.0f, plain file %.0f updates/day\n",
+            nslots, SZ, log, plain);
+}
+
+int main (int argc, char** argv) {
+    for( int i = 0; i < sizeof(data); i++ ) {
+        data[i] = i * 7 + 1;
+    }
+    test_gc();
+    test_log();
+    test_endurance();
+    printf("%s%s: %d errors\n", argv[0], (errors ? " FAILED" : ""), errors);
+    return errors ? 1 : 0;
+}
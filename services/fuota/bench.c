@@ -0,0 +1,209 @@
+// Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#include "fuota.h"
+#include "fuota_hal.h"
+#include "flashsim.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+
+#include <time.h>
+#include <ucontext.h>
+
+
+// ------------------------------------------------
+// Benchmark parameters
+
+static const uint32_t IMAGE_SIZES[] = { 16 * 1024, 64 * 1024, 120 * 1024 };
+static const uint32_t CHUNK_NWS[] = { 12, 30, 60 };     // 48, 120, 240 bytes
+static const uint32_t LOSS_PCTS[] = { 0, 10, 30 };
+static const uint32_t REDUNDANCY_PCTS[] = { 10, 30, 60 };
+
+#define N(a) (sizeof(a) / sizeof(a[0]))
+
+
+// ------------------------------------------------
+// Stack usage measurement
+
+// The decoder is run on a separate, painted stack; after a run, the lowest
+// overwritten byte gives the peak stack depth.
+
+#define STACK_SZ        (256 * 1024)
+#define STACK_PAINT     0xa5
+
+static unsigned char stack[STACK_SZ] __attribute__((aligned(16)));
+static ucontext_t uc_main, uc_call;
+
+static struct {
+    enum { CALL_PROCESS, CALL_UNPACK } op;
+    fuota_session* s;
+    uint32_t id;
+    unsigned char* buf;
+    int rv;
+    void* ptr;
+} call;
+
+static void call_entry (void) {
+    while (1) {
+        switch (call.op) {
+            case CALL_PROCESS:
+                call.rv = fuota_process(call.s, call.id, call.buf);
+                break;
+            case CALL_UNPACK:
+                call.ptr = fuota_unpack(call.s);
+                break;
+        }
+        swapcontext(&uc_call, &uc_main);
+    }
+}
+
+static void stack_init (void) {
+    memset(stack, STACK_PAINT, sizeof(stack));
+    getcontext(&uc_call);
+    uc_call.uc_stack.ss_sp = stack;
+    uc_call.uc_stack.ss_size = sizeof(stack);
+    uc_call.uc_link = NULL;
+    makecontext(&uc_call, call_entry, 0);
+}
+
+static uint32_t stack_peak (void) {
+    uint32_t i;
+    for (i = 0; i < STACK_SZ && stack[i] == STACK_PAINT; i++);
+    return STACK_SZ - i;
+}
+
+static void stack_call (void) {
+    swapcontext(&uc_main, &uc_call);
+}
+
+static uint64_t cpu_ns (void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+// ------------------------------------------------
+// Benchmark
+
+static const char* variant;
+
+static void run (uint32_t image_sz, uint32_t chunk_nw, uint32_t loss, uint32_t red, unsigned int seed) {
+    uint32_t chunk_ct = (image_sz + (chunk_nw << 2) - 1) / (chunk_nw << 2);
+    uint32_t data_nw = chunk_ct * chunk_nw;
+
+    uint32_t dnp = ((data_nw << 2) + (FLASH_PAGE_SZ-1)) / FLASH_PAGE_SZ;
+    size_t ms = fuota_matrix_size(chunk_ct, chunk_nw);
+    uint32_t mnp = (ms + (FLASH_PAGE_SZ-1)) / FLASH_PAGE_SZ;
+    uint32_t snp = 1;
+    if ((mnp + dnp + snp) > FLASH_PAGE_CT) {
+        fprintf(stderr, "skipping %u/%u bytes: session does not fit in flash (%u pages)\n",
+                image_sz, chunk_nw << 2, mnp + dnp + snp);
+        return;
+    }
+
+    srand(seed);
+    uint32_t* image = malloc(data_nw << 2);
+    assert(image);
+    for (uint32_t i = 0; i < data_nw; i++) {
+        image[i] = rand();
+    }
+
+    flashsim_reset();
+    // Flash:  |........<matrix><data><session>|
+    uint32_t mw = (FLASH_PAGE_CT - (mnp + dnp + snp)) * (FLASH_PAGE_SZ >> 2);
+    uint32_t dw = (FLASH_PAGE_CT - (dnp + snp)) * (FLASH_PAGE_SZ >> 2);
+    uint32_t sw = (FLASH_PAGE_CT - snp) * (FLASH_PAGE_SZ >> 2);
+    flashsim_erase(mw, mnp);
+    flashsim_erase(dw, dnp);
+    flashsim_erase(sw, snp);
+
+    fuota_session* s = word2addr(sw);
+    fuota_init(s, word2addr(mw), word2addr(dw), 0x123, chunk_ct, chunk_nw);
+    flashsim_stats st0 = STATS;
+
+    stack_init();
+
+    uint32_t tx_ct = chunk_ct + (chunk_ct * red + 99) / 100;
+    uint32_t rx_ct = 0;
+    uint64_t cpu = 0;
+    int rv = FUOTA_MORE;
+    uint32_t chunk[chunk_nw];
+    for (uint32_t id = 0; id < tx_ct && rv == FUOTA_MORE; id++) {
+        if ((rand() % 100) < loss) {
+            continue;
+        }
+        fuota_gen_chunk(chunk, image, id, chunk_ct, chunk_nw);
+        call.op = CALL_PROCESS;
+        call.s = s;
+        call.id = id;
+        call.buf = (unsigned char*) chunk;
+        uint64_t t0 = cpu_ns();
+        stack_call();
+        cpu += cpu_ns() - t0;
+        rv = call.rv;
+        assert(rv != FUOTA_ERROR);
+        rx_ct += 1;
+    }
+
+    uint64_t cpu_unpack = 0;
+    if (rv == FUOTA_COMPLETE) {
+        call.op = CALL_UNPACK;
+        call.s = s;
+        uint64_t t0 = cpu_ns();
+        stack_call();
+        cpu_unpack = cpu_ns() - t0;
+        assert(call.ptr == word2addr(dw));
+        assert(memcmp(image, FLASH.W + dw, data_nw << 2) == 0);
+    }
+
+    printf("%s,%u,%u,%u,%u,%u,%u,%d,%.2f,%.2f,%llu,%llu,%llu,%llu,%u,%u\n",
+            variant, image_sz, chunk_nw << 2, loss, red, tx_ct, rx_ct,
+            rv == FUOTA_COMPLETE, rx_ct ? cpu / 1e3 / rx_ct : 0.0, cpu_unpack / 1e6,
+            (unsigned long long) (STATS.rd_words - st0.rd_words),
+            (unsigned long long) (STATS.wr_words - st0.wr_words),
+            (unsigned long long) (STATS.wr_calls - st0.wr_calls),
+            (unsigned long long) (STATS.erases - st0.erases),
+            (uint32_t) ms, stack_peak());
+    fflush(stdout);
+
+    free(image);
+}
+
+int main (int argc, char** argv) {
+    variant = strrchr(argv[0], '/');
+    variant = variant ? variant + 1 : argv[0];
+
+    int header = 1;
+    if (argc > 1 && strcmp(argv[1], "-n") == 0) {
+        header = 0;     // omit CSV header (for concatenating variants)
+        argc--;
+        argv++;
+    }
+    if (argc > 2) {
+        printf("usage: %s [-n] [SEED]\n", variant);
+        return 1;
+    }
+    unsigned int seed = (argc > 1) ? strtoul(argv[1], NULL, 0) : 1;
+
+    if (header) {
+        printf("variant,image_bytes,chunk_bytes,loss_pct,redundancy_pct,chunks_tx,chunks_rx,"
+                "complete,process_us_per_chunk,unpack_ms,flash_rd_words,flash_wr_words,"
+                "flash_wr_ops,flash_erases,matrix_bytes,stack_bytes\n");
+    }
+    for (int i = 0; i < N(IMAGE_SIZES); i++) {
+        for (int j = 0; j < N(CHUNK_NWS); j++) {
+            for (int k = 0; k < N(LOSS_PCTS); k++) {
+                for (int l = 0; l < N(REDUNDANCY_PCTS); l++) {
+                    run(IMAGE_SIZES[i], CHUNK_NWS[j], LOSS_PCTS[k], REDUNDANCY_PCTS[l], seed);
+                }
+            }
+        }
+    }
+    return 0;
+}
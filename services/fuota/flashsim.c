@@ -0,0 +1,80 @@
+// Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#include "fuota.h"
+#include "flashsim.h"
+
+#include <string.h>
+#include <assert.h>
+
+#ifndef __x86_64__
+#error "Simulation requires 64-bit platform"
+#endif
+
+flashsim_mem FLASH;
+flashsim_stats STATS;
+
+void flashsim_reset (void) {
+    memset(&FLASH, 0xa5, sizeof(FLASH));
+    memset(&STATS, 0, sizeof(STATS));
+}
+
+void flashsim_erase (uint32_t word, uint32_t npages) {
+    assert((word + npages * (FLASH_PAGE_SZ >> 2)) <= FLASH_WORD_CT);
+    memset(FLASH.W + word, (fuota_flash_bitdefault) ? 0xff : 0x00, npages * FLASH_PAGE_SZ);
+}
+
+// Fake flash addresses are non-canonical, i.e. they are not valid
+// in amd64 virtual address space.
+uint32_t addr2word (void* ptr) {
+    uintptr_t addr = (uintptr_t) ptr;
+    assert((addr >> 32) == 0xdeadbeef);
+    assert((addr & 3) == 0);
+    return (addr & 0xffffffff) >> 2;
+}
+
+void* word2addr (uint32_t word) {
+    assert(word <= FLASH_WORD_CT);
+    return (void*) ((0xdeadbeefULL << 32) | (word << 2));
+}
+
+void fuota_flash_write (void* _dst, void* _src, uint32_t nwords, bool erase) {
+    assert((((uintptr_t) _src) & 3) == 0);
+    uint32_t* src = _src;
+    uint32_t w = addr2word(_dst);
+    assert((w + nwords) <= FLASH_WORD_CT);
+    uint32_t* dst = FLASH.W + w;
+    STATS.wr_words += nwords;
+    STATS.wr_calls += 1;
+    int i;
+    for (i = 0; i < nwords; i++) {
+        if (((w++ << 2) & (FLASH_PAGE_SZ-1)) == 0 && erase) {
+            memset(dst + i, (fuota_flash_bitdefault) ? 0xff : 0x00, FLASH_PAGE_SZ);
+            STATS.erases += 1;
+        }
+        assert(dst[i] == ((fuota_flash_bitdefault) ? ~0 : 0));
+        dst[i] = src[i];
+    }
+}
+
+void fuota_flash_read (void* dst, void* src, uint32_t nwords) {
+    uint32_t w = addr2word(src);
+    assert((w + nwords) <= FLASH_WORD_CT);
+    STATS.rd_words += nwords;
+    memcpy(dst, FLASH.W + w, nwords << 2);
+}
+
+uint32_t fuota_flash_rd_u4 (void* addr) {
+    uint32_t w = addr2word(addr);
+    assert(w < FLASH_WORD_CT);
+    STATS.rd_words += 1;
+    return(FLASH.W[w]);
+}
+
+void* fuota_flash_rd_ptr (void* addr) {
+    uint32_t w = addr2word(addr);
+    assert(w < FLASH_WORD_CT);
+    return *((void**) (FLASH.W + w));
+}
@@ -0,0 +1,48 @@
+// Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#ifndef _flashsim_h_
+#define _flashsim_h_
+
+#include <stdint.h>
+
+#include "fuota_hal.h"
+
+// ------------------------------------------------
+// Flash simulation (host tests and benchmark)
+
+#define FLASH_SZ        (512 * 1024) // 512K
+#define FLASH_PAGE_SZ   fuota_flash_pagesz
+
+#define FLASH_WORD_CT   (FLASH_SZ >> 2)
+#define FLASH_PAGE_CT   (FLASH_SZ / FLASH_PAGE_SZ)
+#define FLASH_END       (FLASH.W + (FLASH_SZ / 4))
+
+typedef union {
+    uint32_t W[FLASH_SZ / 4];
+    uint32_t P[FLASH_PAGE_CT][FLASH_PAGE_SZ / 4];
+} flashsim_mem;
+
+// flash access statistics
+typedef struct {
+    uint64_t rd_words;  // words read
+    uint64_t wr_words;  // words written
+    uint64_t wr_calls;  // write operations
+    uint64_t erases;    // pages erased
+} flashsim_stats;
+
+extern flashsim_mem FLASH;
+extern flashsim_stats STATS;
+
+// fill flash with garbage and reset statistics
+void flashsim_reset (void);
+
+// erase pages (not counted) starting at word offset
+void flashsim_erase (uint32_t word, uint32_t npages);
+
+uint32_t addr2word (void* ptr);
+void* word2addr (uint32_t word);
+
+#endif
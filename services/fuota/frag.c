@@ -7,6 +7,7 @@
 // Transport Specification v1.0.0.
 
 #include <string.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include "fuota/fuota.h"
@@ -15,19 +16,33 @@
 #include "eefs/eefs.h"
 #include "frag.h"
 
-#include "svcdefs.h"
+#include "svcdefs_frag_complete.h"
+#include "svcdefs_frag_changed.h"
+#include "svcdefs_lwm_downlink.h"
+#include "svcdefs_eefs_init.h"
+#include "svcdefs_eefs_fn.h"
 
 #ifndef SVC_FRAG_PORT
 #define SVC_FRAG_PORT 201
 #endif
 
+// number of resolved rows between progress record updates
+#ifndef SVC_FRAG_PROGRESS_INTV
+#define SVC_FRAG_PROGRESS_INTV 16
+#endif
+
 // 16b75e2c8ff85440-7414ee53
 static const uint8_t UFID_FRAG_SESSION[12] = { 0x40, 0x54, 0xf8, 0x8f, 0x2c, 0x5e, 0xb7, 0x16, 0x53, 0xee, 0x14, 0x74 };
+// 1a13962575e38bb0-cedf8721
+static const uint8_t UFID_FRAG_PROGRESS[12] = { 0xb0, 0x8b, 0xe3, 0x75, 0x25, 0x96, 0x13, 0x1a, 0x21, 0x87, 0xdf, 0xce };
 
 const char* _frag_eefs_fn (const uint8_t* ufid) {
     if( memcmp(ufid, UFID_FRAG_SESSION, sizeof(UFID_FRAG_SESSION)) == 0 ) {
         return "com.semtech.svc.frag.session";
     }
+    if( memcmp(ufid, UFID_FRAG_PROGRESS, sizeof(UFID_FRAG_PROGRESS)) == 0 ) {
+        return "com.semtech.svc.frag.progress";
+    }
     return NULL;
 }
 
@@ -50,6 +65,8 @@ enum {
     FRAG_SESS_DEL_REQ   = 0x03,
     FRAG_SESS_DEL_ANS   = 0x03,
     DATA_FRAGMENT       = 0x08,
+    FRAG_MISSING_REQ    = 0x81, // proprietary
+    FRAG_MISSING_ANS    = 0x81, // proprietary
 #ifdef SVC_FRAG_TEST
     FRAG_HASH_REQ       = 0x80, // proprietary test command
     FRAG_HASH_ANS       = 0x80, // proprietary test command
@@ -72,6 +89,11 @@ enum {
     SDA_STAT_IDX        = (1 << 2), // session index not supported
 };
 
+enum {
+    FMA_RANGES_MAX      = 8,        // max. number of ranges per answer
+    FMA_MORE            = (1 << 5), // more missing ranges follow
+};
+
 typedef struct {
     struct {
         void* abeg;             // pointer to storage (NULL if unused)
@@ -86,6 +108,27 @@ typedef struct {
     } sessions[SESSION_MAX];
 } pstate;
 
+// Progress record
+//
+// The number of resolved rows is tracked in RAM and saved every
+// SVC_FRAG_PROGRESS_INTV rows, so it can be restored without scanning the
+// matrix. After a reset, the count may lag by up to SVC_FRAG_PROGRESS_INTV-1
+// rows; such sessions are marked as inexact and the matrix is scanned when
+// the count is first reported. Completion is taken from the matrix itself.
+// The matrix is also scanned if the record does not match the session.
+
+enum {
+    PIVOT_NONE = 0xffff,        // no row resolved since record was created
+};
+
+typedef struct {
+    struct {
+        uint32_t desc;          // descriptor (must match session)
+        uint16_t rank;          // number of resolved rows
+        uint16_t pivot;         // last resolved row
+    } sessions[SESSION_MAX];
+} pprogress;
+
 static struct {
     unsigned char resp[64];     // response buffer
     int rlen;                   // response length
@@ -93,11 +136,13 @@ static struct {
     lwm_job lwmjob;             // uplink job
 
     struct {
-        void* beg;              // beginning of storage area
-        void* end;              // end of storage area
-    } storage[SESSION_MAX];
+        void* beg;              // beginning of storage arena
+        void* end;              // end of storage arena
+    } arena;
 
     pstate ps;                  // persistent state (stored in EEFS)
+    pprogress pp;               // progress record (stored in EEFS)
+    uint8_t inexact;            // sessions with possibly lagging rank (bitmask)
 } state;
 
 // ensure that there is at least n bytes available in the
@@ -109,6 +154,10 @@ static void resp_makeroom (int n) {
         int cmd = state.resp[skip];
         int csz = ((cmd == PKG_VERSION_ANS) ? 3
                 :  (cmd == FRAG_STATUS_ANS) ? 5
+                :  (cmd == FRAG_MISSING_ANS) ? 2 + 4 * (state.resp[skip+1] & 0xf)
+#ifdef SVC_FRAG_TEST
+                :  (cmd == FRAG_HASH_ANS) ? 33
+#endif
                 :                             2);
         skip += csz;
         rlen -= csz;
@@ -138,50 +187,177 @@ static int calc_session_size (uint32_t cct, uint32_t cnw, int* pmsz, int* pdsz)
     return msz + dsz + fuota_flash_pagesz;
 }
 
+// Session storage arena
+//
+// All sessions share a single flash arena. Each session occupies a contiguous,
+// page-aligned block (matrix, data, session page) sized on setup. Sessions are
+// packed towards the end of the arena; when a session is deleted, the sessions
+// below it are moved up so the free space stays contiguous at the beginning.
+
+static bool arena_overlaps (int skip, uintptr_t beg, uintptr_t end) {
+    for( int i = 0; i < SESSION_MAX; i++ ) {
+        if( i != skip && state.ps.sessions[i].abeg
+                && beg < (uintptr_t) state.ps.sessions[i].aend
+                && end > (uintptr_t) state.ps.sessions[i].abeg ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// find highest free block of given size, return end or 0
+static uintptr_t arena_alloc (int size) {
+    uintptr_t best = 0;
+    for( int i = -1; i < SESSION_MAX; i++ ) {
+        uintptr_t end;
+        if( i < 0 ) {
+            end = (uintptr_t) state.arena.end;
+        } else if( state.ps.sessions[i].abeg ) {
+            end = (uintptr_t) state.ps.sessions[i].abeg;
+        } else {
+            continue;
+        }
+        if( end > best && end - (uintptr_t) state.arena.beg >= size
+                && !arena_overlaps(-1, end - size, end) ) {
+            best = end;
+        }
+    }
+    return best;
+}
+
+// save single session entry of persistent state (or all of it if not yet stored)
+static void save_session (int idx) {
+    if( eefs_update(UFID_FRAG_SESSION, offsetof(pstate, sessions[idx]),
+                &state.ps.sessions[idx], sizeof(state.ps.sessions[idx])) < 0 ) {
+        eefs_save(UFID_FRAG_SESSION, &state.ps, sizeof(pstate));
+    }
+}
+
+static void save_progress (int idx) {
+    if( eefs_update(UFID_FRAG_PROGRESS, offsetof(pprogress, sessions[idx]),
+                &state.pp.sessions[idx], sizeof(state.pp.sessions[idx])) < 0 ) {
+        eefs_save(UFID_FRAG_PROGRESS, &state.pp, sizeof(pprogress));
+    }
+}
+
+static void arena_compact (void) {
+    uintptr_t top = (uintptr_t) state.arena.end;
+    while( 1 ) {
+        // find highest session below top
+        int idx = -1;
+        for( int i = 0; i < SESSION_MAX; i++ ) {
+            if( state.ps.sessions[i].abeg
+                    && (uintptr_t) state.ps.sessions[i].aend <= top
+                    && (idx < 0 || state.ps.sessions[i].aend > state.ps.sessions[idx].aend) ) {
+                idx = i;
+            }
+        }
+        if( idx < 0 ) {
+            break;
+        }
+        uintptr_t size = (uintptr_t) state.ps.sessions[idx].aend
+            - (uintptr_t) state.ps.sessions[idx].abeg;
+        if( (uintptr_t) state.ps.sessions[idx].aend != top ) {
+            int msz, dsz;
+            calc_session_size(state.ps.sessions[idx].fcnt,
+                    state.ps.sessions[idx].fsz >> 2, &msz, &dsz);
+            debug_printf("frag: moving session %d (%d bytes)\r\n", idx, size);
+            fuota_session* fs = (fuota_session*) (top - fuota_flash_pagesz);
+            fuota_move(get_session(idx), fs,
+                    (void*) ((uintptr_t) fs - (dsz + msz)),
+                    (void*) ((uintptr_t) fs - (dsz      )));
+            state.ps.sessions[idx].abeg = (void*) (top - size);
+            state.ps.sessions[idx].aend = (void*) top;
+            save_session(idx);
+            SVCHOOK_frag_changed(idx);
+        }
+        top -= size;
+    }
+}
+
+static void progress_restore (void) {
+    if( eefs_read(UFID_FRAG_PROGRESS, &state.pp, sizeof(pprogress)) != sizeof(pprogress) ) {
+        memset(&state.pp, 0, sizeof(pprogress));
+    }
+    state.inexact = 0;
+    for( int i = 0; i < SESSION_MAX; i++ ) {
+        if( state.ps.sessions[i].abeg == NULL ) {
+            continue;
+        }
+        fuota_session* fs = get_session(i);
+        uint32_t fcnt = state.ps.sessions[i].fcnt;
+        uint32_t pivot = state.pp.sessions[i].pivot;
+        uint32_t bm;
+        if( fuota_state(fs, NULL, NULL, NULL, NULL) >= FUOTA_COMPLETE ) {
+            state.pp.sessions[i].rank = fcnt;
+        } else if( state.pp.sessions[i].desc == state.ps.sessions[i].desc
+                && state.pp.sessions[i].rank < fcnt
+                && ((pivot == PIVOT_NONE && state.pp.sessions[i].rank == 0)
+                    || (fuota_bitmap(fs, pivot, 1, &bm) == 1 && (bm & 1))) ) {
+            // record is plausible, but may lag
+            state.inexact |= (1 << i);
+        } else {
+            // verification failed -- fall back to full scan
+            uint32_t cc;
+            fuota_state(fs, NULL, NULL, NULL, &cc);
+            debug_printf("frag: rescanned session %d (%d rows)\r\n", i, cc);
+            state.pp.sessions[i].rank = cc;
+            state.pp.sessions[i].pivot = PIVOT_NONE;
+        }
+        state.pp.sessions[i].desc = state.ps.sessions[i].desc;
+    }
+    eefs_save(UFID_FRAG_PROGRESS, &state.pp, sizeof(pprogress));
+}
+
 void _frag_restore (void) {
     if( eefs_read(UFID_FRAG_SESSION, &state.ps, sizeof(pstate)) != sizeof(pstate) ) {
         memset(&state.ps, 0, sizeof(pstate));
     }
     for( int i = 0; i < SESSION_MAX; i++ ) {
-        if( state.storage[i].beg ) {
-            void* beg = state.ps.sessions[i].abeg;
-            void* end = state.ps.sessions[i].aend;
-            if( beg ) {
-                if( beg < end
-                        && beg >= state.storage[i].beg
-                        && end <= state.storage[i].end
-                        && (state.ps.sessions[i].fsz & 3) == 0
-                        && ((uintptr_t) end - (uintptr_t) beg) == calc_session_size(
-                            state.ps.sessions[i].fcnt, state.ps.sessions[i].fsz >> 2,
-                            NULL, NULL)
-                        && fuota_check_state(get_session(i),
-                            state.ps.sessions[i].desc, state.ps.sessions[i].fcnt,
-                            state.ps.sessions[i].fsz >> 2) != FUOTA_ERROR ) {
-                    // TODO - should check all saved parameters
-                    debug_printf("frag: recovered session 0x%08x\r\n",
-                            state.ps.sessions[i].desc);
-                } else {
-                    goto invalid;
-                }
+        void* beg = state.ps.sessions[i].abeg;
+        void* end = state.ps.sessions[i].aend;
+        if( beg ) {
+            if( beg < end
+                    && beg >= state.arena.beg
+                    && end <= state.arena.end
+                    && !arena_overlaps(i, (uintptr_t) beg, (uintptr_t) end)
+                    && (state.ps.sessions[i].fsz & 3) == 0
+                    && ((uintptr_t) end - (uintptr_t) beg) == calc_session_size(
+                        state.ps.sessions[i].fcnt, state.ps.sessions[i].fsz >> 2,
+                        NULL, NULL)
+                    && fuota_check_state(get_session(i),
+                        state.ps.sessions[i].desc, state.ps.sessions[i].fcnt,
+                        state.ps.sessions[i].fsz >> 2) != FUOTA_ERROR ) {
+                // TODO - should check all saved parameters
+                debug_printf("frag: recovered session 0x%08x\r\n",
+                        state.ps.sessions[i].desc);
+            } else {
+                state.ps.sessions[i].abeg = NULL;
+                state.ps.sessions[i].aend = NULL;
             }
-        } else {
-invalid:
-            state.ps.sessions[i].abeg = NULL;
-            state.ps.sessions[i].aend = NULL;
         }
     }
     eefs_save(UFID_FRAG_SESSION, &state.ps, sizeof(pstate));
+    progress_restore();
 }
 
-void _frag_init (int nsessions, void** sbeg, void** send) {
-    for( int i = 0; i < SESSION_MAX; i++ ) {
-        if( i < nsessions ) {
-            debug_printf("frag: init session storage %d (%d bytes)\r\n",
-                    i, ((uintptr_t) send[i] - (uintptr_t) sbeg[i]));
-            state.storage[i].beg = sbeg[i];
-            state.storage[i].end = send[i];
-        }
-    }
+#if defined(CFG_mcast_fast)
+void _frag_dl (int port, unsigned char* data, int dlen, unsigned int flags);
+
+// multicast fast path: data fragments are processed without a full engine update
+static void mcrx (u1_t port, u1_t* data, int dlen) {
+    _frag_dl(port, data, dlen, TXRX_DNW2 | TXRX_PORT);
+}
+#endif
+
+void _frag_init (void* beg, void* end) {
+    debug_printf("frag: init session storage (%d bytes)\r\n",
+            ((uintptr_t) end - (uintptr_t) beg));
+    state.arena.beg = beg;
+    state.arena.end = end;
+#if defined(CFG_mcast_fast)
+    LMIC_setMultiCastHandler(SVC_FRAG_PORT, mcrx);
+#endif
 }
 
 int frag_get (int idx, void** pdata) {
@@ -218,8 +394,15 @@ static void frag_status_ans (int idx) {
     uint32_t total, complete;
     if( idx >= SESSION_MAX || state.ps.sessions[idx].abeg == NULL
             || fuota_state(get_session(idx), NULL,
-                &total, NULL, &complete) == FUOTA_ERROR ) {
+                &total, NULL, NULL) == FUOTA_ERROR ) {
         total = complete = 0;
+    } else {
+        if( state.inexact & (1 << idx) ) {
+            fuota_state(get_session(idx), NULL, NULL, NULL, &complete);
+            state.pp.sessions[idx].rank = complete;
+            state.inexact &= ~(1 << idx);
+        }
+        complete = state.pp.sessions[idx].rank;
     }
     resp_makeroom(5);
     idx = (idx << 14) | complete; // Received&index
@@ -240,6 +423,75 @@ static int frag_status_req (unsigned char* data, int dlen) {
     return 2;
 }
 
+// missing fragments answer (proprietary):
+// ----+-----+-------------------+----------+----------+-----
+// off | 0   | 1                 | 2        | 4        | ...
+// ----+-----+-------------------+----------+----------+-----
+// len | 1   | 1                 | 2        | 2        | ...
+// ----+-----+-------------------+----------+----------+-----
+// val | cmd | idx:2|more:1|n:4  | first[0] | count[0] | ...
+// ----+-----+-------------------+----------+----------+-----
+// Ranges refer to unresolved rows of the matrix (0-based), i.e. the server
+// can choose its redundancy so that each fragment fills one of these rows.
+// The number of ranges is limited so the answer fits into the maximum
+// payload of the current data rate; 'more' is set if ranges were left out.
+static int frag_missing_req (unsigned char* data, int dlen) {
+    // 1:idx, 2-3:first row
+    if( dlen < 4 ) {
+        return -1;
+    }
+    int idx = data[1] & 3;
+    uint32_t row = os_rlsbf2(data + 2);
+    int nmax = (LMIC_maxAppPayload() - 2) / 4;
+    if( nmax > FMA_RANGES_MAX ) {
+        nmax = FMA_RANGES_MAX;
+    } else if( nmax < 0 ) {
+        nmax = 0;
+    }
+    int n = 0;
+    bool more = false;
+    uint32_t rbeg = 0, rlen = 0;
+    uint32_t rstart[FMA_RANGES_MAX], rcount[FMA_RANGES_MAX];
+    if( idx < SESSION_MAX && state.ps.sessions[idx].abeg != NULL ) {
+        fuota_session* fs = get_session(idx);
+        uint32_t bm[8], nbits;
+        while( !more && (nbits = fuota_bitmap(fs, row, 256, bm)) > 0 ) {
+            for( uint32_t i = 0; i < nbits; i++, row++ ) {
+                if( (bm[i >> 5] & (1u << (i & 31))) == 0 ) {
+                    if( rlen && rbeg + rlen == row ) {
+                        rlen += 1;
+                    } else if( n == nmax ) {
+                        more = true;
+                        break;
+                    } else {
+                        if( rlen ) {
+                            rstart[n] = rbeg;
+                            rcount[n++] = rlen;
+                        }
+                        rbeg = row;
+                        rlen = 1;
+                    }
+                }
+            }
+        }
+        if( rlen && n < nmax ) {
+            rstart[n] = rbeg;
+            rcount[n++] = rlen;
+        } else if( rlen ) {
+            more = true;
+        }
+    }
+    resp_makeroom(2 + 4 * n);
+    state.resp[state.rlen++] = FRAG_MISSING_ANS;
+    state.resp[state.rlen++] = (idx << 6) | (more ? FMA_MORE : 0) | n;
+    for( int i = 0; i < n; i++ ) {
+        os_wlsbf2(state.resp + state.rlen, rstart[i]);
+        os_wlsbf2(state.resp + state.rlen + 2, rcount[i]);
+        state.rlen += 4;
+    }
+    return 4;
+}
+
 #ifdef SVC_FRAG_TEST
 static int frag_hash_req (unsigned char* data, int dlen) {
     if( dlen < 2 ) {
@@ -266,7 +518,7 @@ static int frag_sess_setup_req (unsigned char* data, int dlen) {
     // 1:idx, 2-3:cct, 4:csz, 5:ctl, 6:pad, 7-10:dsc
     int idx = (data[1] >> 4) & 3;
     int status = idx << 6;
-    if( idx >= SESSION_MAX || state.storage[idx].beg == NULL ) {
+    if( idx >= SESSION_MAX || state.arena.beg == NULL ) {
         status |= SSA_STAT_IDX;
     } else if( state.ps.sessions[idx].abeg ) {
         // already allocated -- spec is ambiguous, we'll return an error here
@@ -280,13 +532,14 @@ static int frag_sess_setup_req (unsigned char* data, int dlen) {
 
         int msz, dsz;
         int size = calc_session_size(cct, cnw, &msz, &dsz);
+        uintptr_t end;
 
-        if( size > ((uintptr_t) state.storage[idx].end
-                - (uintptr_t) state.storage[idx].beg) ) {
+        if( fuota_work_size(cct, cnw) > (FUOTA_WORK_NW << 2)
+                || (end = arena_alloc(size)) == 0 ) {
             status |= SSA_STAT_MEM;
         } else {
-            state.ps.sessions[idx].abeg   = (void*) ((uintptr_t) state.storage[idx].end - size);
-            state.ps.sessions[idx].aend   = state.storage[idx].end;
+            state.ps.sessions[idx].abeg   = (void*) (end - size);
+            state.ps.sessions[idx].aend   = (void*) end;
             state.ps.sessions[idx].desc   = os_rlsbf4(data+7);
             state.ps.sessions[idx].fcnt   = cct;
             state.ps.sessions[idx].fsz    = cnw << 2;
@@ -302,8 +555,15 @@ static int frag_sess_setup_req (unsigned char* data, int dlen) {
             flash_write(mtrx, NULL, size >> 2, true);
             // initialize state
             fuota_init(fs, mtrx, cdat, state.ps.sessions[idx].desc, cct, cnw);
+            SVCHOOK_frag_changed(idx);
             // save state to eeprom
-            eefs_save(UFID_FRAG_SESSION, &state.ps, sizeof(pstate));
+            save_session(idx);
+            // reset progress record
+            state.pp.sessions[idx].desc  = state.ps.sessions[idx].desc;
+            state.pp.sessions[idx].rank  = 0;
+            state.pp.sessions[idx].pivot = PIVOT_NONE;
+            state.inexact &= ~(1 << idx);
+            save_progress(idx);
         }
     }
     resp_makeroom(2);
@@ -324,7 +584,10 @@ static int frag_sess_del_req (unsigned char* data, int dlen) {
         state.ps.sessions[idx].abeg = NULL;
         state.ps.sessions[idx].aend = NULL;
         // save state to eeprom
-        eefs_save(UFID_FRAG_SESSION, &state.ps, sizeof(pstate));
+        save_session(idx);
+        SVCHOOK_frag_changed(idx);
+        // close gap left by session
+        arena_compact();
     }
     resp_makeroom(2);
     state.resp[state.rlen++] = FRAG_SESS_DEL_ANS;
@@ -337,12 +600,28 @@ static int data_fragment (unsigned char* data, int dlen) {
         int idx_n = os_rlsbf2(data + 1);
         int idx = idx_n >> 14;
         int cid = idx_n & 0x3fff;
-        if( idx < SESSION_MAX && state.storage[idx].beg != NULL ) {
+        if( idx < SESSION_MAX && state.ps.sessions[idx].abeg != NULL ) {
             uint32_t cnw;
             fuota_session* fs = get_session(idx);
             if( fuota_state(fs, NULL, NULL, &cnw, NULL) != FUOTA_ERROR
                     && dlen >= (cnw << 2)) {
-                fuota_process(fs, cid, data + 3);
+                uint32_t row;
+                int complete = (fuota_process_ex(fs, cid, data + 3, &row) == FUOTA_COMPLETE);
+                if( row != UINT32_MAX ) {
+                    uint32_t rank = ++state.pp.sessions[idx].rank;
+                    state.pp.sessions[idx].pivot = row;
+                    if( complete ) {
+                        // resync (rank may have lagged since reset)
+                        rank = state.pp.sessions[idx].rank = state.ps.sessions[idx].fcnt;
+                        state.inexact &= ~(1 << idx);
+                    }
+                    if( (rank % SVC_FRAG_PROGRESS_INTV) == 0 || complete ) {
+                        save_progress(idx);
+                    }
+                    if( complete ) {
+                        SVCHOOK_frag_complete(idx);
+                    }
+                }
 
                 // TODO - only generate status uplink on unicast
                 frag_status_ans(idx);
@@ -379,6 +658,10 @@ void _frag_dl (int port, unsigned char* data, int dlen, unsigned int flags) {
                     n = data_fragment(data, dlen);
                     break;
 
+                case FRAG_MISSING_REQ:
+                    n = frag_missing_req(data, dlen);
+                    break;
+
 #ifdef SVC_FRAG_TEST
                 case FRAG_HASH_REQ:
                     n = frag_hash_req(data, dlen);
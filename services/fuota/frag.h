@@ -6,7 +6,8 @@
 #ifndef _frag_h_
 #define _frag_h_
 
-void _frag_init (int nsessions, void** sbeg, void** send);
+// set flash area shared by all sessions (page-aligned)
+void _frag_init (void* beg, void* end);
 
 int frag_get (int idx, void** pdata);
 
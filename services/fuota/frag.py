@@ -7,10 +7,23 @@
 
 from typing import BinaryIO,Callable,List,Optional,Union
 
+import ctypes
+import os
 import random
 import struct
 from bitarray import bitarray
 
+# optional C chunk generator (build with 'make libfuotagen.so')
+try:
+    _gen = ctypes.CDLL(os.path.join(os.path.dirname(os.path.realpath(__file__)),
+        'libfuotagen.so'))
+    _gen.fuota_gen_chunks.restype = None
+    _gen.fuota_gen_chunks.argtypes = [ctypes.c_char_p, ctypes.c_char_p,
+            ctypes.POINTER(ctypes.c_uint32), ctypes.c_uint32, ctypes.c_uint32,
+            ctypes.c_uint32]
+except OSError:
+    _gen = None
+
 def bitarrayfrombytes(buf:bytes) -> bitarray:
     b = bitarray(endian='little')
     b.frombytes(buf)
@@ -47,6 +60,20 @@ class FragCarousel:
         self.blocks = [bitarrayfrombytes(data[b*csz:(b+1)*csz]) for b in range(cct)]
 
     def chunk(self, cid:int) -> bytes:
+        return self.chunks([cid])[0]
+
+    def chunks(self, cids:List[int]) -> List[bytes]:
+        if _gen and isinstance(self.cbg, TrackNetGenerator) and (self.csz & 3) == 0:
+            # generate all chunks in a single pass over the data
+            n = len(cids)
+            buf = ctypes.create_string_buffer(n * self.csz)
+            _gen.fuota_gen_chunks(buf, self.data, (ctypes.c_uint32 * n)(*cids),
+                    n, self.cct, self.csz >> 2)
+            raw = buf.raw
+            return [raw[i*self.csz:(i+1)*self.csz] for i in range(n)]
+        return [self._chunk(cid) for cid in cids]
+
+    def _chunk(self, cid:int) -> bytes:
         cb = self.cbg.generate(self.cct, cid)
         chunk = bitarray(self.csz * 8, endian='little')
         chunk.setall(0)
@@ -7,6 +7,7 @@
 
 #include "fuota.h"
 #include "fuota_hal.h"
+#include "fuota_gen.h"
 
 
 // ------------------------------------------------
@@ -29,7 +30,11 @@ struct _fuota_session {
 _Static_assert(sizeof(fuota_session) <= fuota_flash_pagesz,
         "fuota_session must fit into single Flash page");
 
+#ifdef FUOTA_DEFERRED
+#define FUOTA_MAGIC     0x03291983      // session layout differs
+#else
 #define FUOTA_MAGIC     0x03291982
+#endif
 
 
 // ------------------------------------------------
@@ -73,6 +78,30 @@ static void buffered_write (bw_state* state, uint32_t* src, uint32_t nwords) {
     }
 }
 
+#ifdef FUOTA_DEFERRED
+// write words to flash in descending address order, end marks end of area
+static void buffered_write_desc (bw_state* state, uint32_t* dst, uint32_t* src,
+        uint32_t nwords, uint32_t* end) {
+    if (src == NULL) { // flush
+        if (state->base) {
+            fuota_flash_write(state->base, state->buf, state->off, true);
+        }
+    } else {
+        while (nwords-- > 0) {
+            uint32_t* addr = dst + nwords;
+            if (addr < state->base || state->base == NULL) {
+                if (state->base) {
+                    fuota_flash_write(state->base, state->buf, state->off, true);
+                }
+                state->base = (uint32_t*) ((uintptr_t) addr & ~(uintptr_t) (fuota_flash_pagesz - 1));
+                state->off = (end - state->base < PAGE_NW) ? end - state->base : PAGE_NW;
+            }
+            state->buf[(((uintptr_t) addr) >> 2) & (PAGE_NW - 1)] = src[nwords];
+        }
+    }
+}
+#endif
+
 static void word_taint(void* addr) {
     uint32_t value = ~FLASH_UNTAINTED;
     fuota_flash_write(addr, &value, 1, false);
@@ -83,9 +112,9 @@ static void word_taint(void* addr) {
 // XOR operations
 
 // buffered flash to ram
-static void xor_bf2r (uint32_t* dest, uint32_t* src, uint32_t nwords, bw_state* state) {
+__hotcode static void xor_bf2r (uint32_t* dest, uint32_t* src, uint32_t nwords, bw_state* state) {
     while (nwords-- > 0) {
-        if (state && src >= state->base) {
+        if (state && src >= state->base && src < state->base + PAGE_NW) {
             *dest++ ^= state->buf[(((uintptr_t) (src++)) >> 2) & (PAGE_NW - 1)];
         } else {
             *dest++ ^= fuota_flash_rd_u4(src++);
@@ -93,13 +122,15 @@ static void xor_bf2r (uint32_t* dest, uint32_t* src, uint32_t nwords, bw_state*
     }
 }
 
-static void xor_f2r (uint32_t* dest, uint32_t* src, uint32_t nwords) {
+#ifndef FUOTA_DEFERRED
+__hotcode static void xor_f2r (uint32_t* dest, uint32_t* src, uint32_t nwords) {
     while (nwords-- > 0) {
         *dest++ ^= fuota_flash_rd_u4(src++);
     }
 }
+#endif
 
-static void xor_mf2r (uint32_t* dest, uint32_t* src, uint32_t nwords) {
+__hotcode static void xor_mf2r (uint32_t* dest, uint32_t* src, uint32_t nwords) {
     while (nwords-- > 0) {
         *dest++ ^=
 #if (fuota_flash_bitdefault != 0)
@@ -109,6 +140,19 @@ static void xor_mf2r (uint32_t* dest, uint32_t* src, uint32_t nwords) {
     }
 }
 
+#ifdef FUOTA_ROWCACHE_NW
+// matrix row mirrored in ram (flash representation)
+__hotcode static void xor_mr2r (uint32_t* dest, uint32_t* src, uint32_t nwords) {
+    while (nwords-- > 0) {
+        *dest++ ^=
+#if (fuota_flash_bitdefault != 0)
+            ~
+#endif
+            *src++;
+    }
+}
+#endif
+
 
 // ------------------------------------------------
 // Triangular matrix
@@ -139,6 +183,7 @@ static uint32_t m_offset (uint32_t row) {
     return off;
 }
 
+#ifndef FUOTA_DEFERRED
 // return the row number based on the right-most "set" bit
 static uint32_t m_rmb (uint32_t* row, uint32_t nwords) {
     while (nwords-- > 0) {
@@ -149,6 +194,7 @@ static uint32_t m_rmb (uint32_t* row, uint32_t nwords) {
     }
     return UINT32_MAX;
 }
+#endif
 
 // update the word index and mask for the previous bit
 static inline void m_prev (uint32_t* idx, uint32_t* mask) {
@@ -180,32 +226,117 @@ static uint32_t m_count (uint32_t* matrix, uint32_t chunk_ct) {
 }
 
 
+#ifdef FUOTA_DEFERRED
 // ------------------------------------------------
-// Check bits generator
+// Combination rows
+//
+// In deferred mode, incoming chunks are only reduced against the matrix (and
+// only until their pivot is found); the data is stored as received. For each
+// row i, the rows j > i that were combined with the chunk are recorded as bit
+// (j - i - 1) of a combination row, stored after the matrix in a second
+// triangular area (row i at m_offset(chunk_ct - 1 - i)). Since combinations
+// only refer to higher rows, fuota_unpack can reduce the blocks in a single
+// descending pass before the usual back-substitution.
+//
+// While a chunk is reduced, combined rows are marked in its checkbit row: the
+// bit of an eliminated row is cleared by the elimination and never looked at
+// again, so it is set to record the combination. Above the pivot, the
+// checkbit row thus holds the combination row.
+
+#define C_ROW(matrix,chunk_ct,i) ((matrix) + m_offset(chunk_ct) + m_offset((chunk_ct) - 1 - (i)))
+
+// shift bit vector right by n bits (can be done in place)
+static void b_shr (uint32_t* dst, uint32_t* src, uint32_t n, uint32_t dst_nw, uint32_t src_nw) {
+    uint32_t w = n >> 5, b = n & 31;
+    for (uint32_t k = 0; k < dst_nw; k++, w++) {
+        uint32_t lo = (w < src_nw) ? src[w] : 0;
+        uint32_t hi = (w + 1 < src_nw) ? src[w + 1] : 0;
+        dst[k] = b ? ((lo >> b) | (hi << (32 - b))) : lo;
+    }
+}
+#endif
 
-// returns the number of checkbit words
-#define G_WORDS(n)      ((n + 31) >> 5)
 
-// 32bit pseudo hash
-static uint32_t g_avalanche (uint32_t x) {
-    x = ((x >> 16) ^ x) * 0x45d9f3b;
-    x = ((x >> 16) ^ x) * 0x45d9f3b;
-    x = (x >> 16) ^ x;
-    return x;
+// ------------------------------------------------
+// Row cache
+//
+// If FUOTA_ROWCACHE_NW is defined, a pool of that many words of RAM is used
+// to hold a bitmap of the rows present in the matrix of the current session,
+// followed by a mirror of the top-most (i.e. longest) matrix rows. Since rows
+// are stored consecutively, these form a single region at the end of the
+// matrix. The bitmap allows eliminating 32 candidate rows at a time without
+// probing flash, and rows in the mirror are XORed from RAM.
+
+#ifdef FUOTA_ROWCACHE_NW
+
+static struct {
+    fuota_session* session;     // cached session (NULL if invalid)
+    uint32_t r0;                // first row in mirror
+    uint32_t* rows;             // mirror of matrix from m_offset(r0) on
+    uint32_t pool[FUOTA_ROWCACHE_NW];
+} rc;
+
+// load row cache for session, return bitmap of present rows or NULL
+static uint32_t* rc_load (fuota_session* session, uint32_t* matrix, uint32_t chunk_ct) {
+    if (rc.session != session) {
+        uint32_t pw = G_WORDS(chunk_ct);
+        if (pw > FUOTA_ROWCACHE_NW) {
+            return NULL;
+        }
+        uint32_t avail = FUOTA_ROWCACHE_NW - pw;
+        uint32_t r0 = chunk_ct;
+        while (r0 > 0 && m_offset(chunk_ct) - m_offset(r0 - 1) <= avail) {
+            r0 -= 1;
+        }
+        memset(rc.pool, 0, pw << 2);
+        for (uint32_t i = 0; i < chunk_ct; i++) {
+            if (fuota_flash_rd_u4(matrix + m_offset(i + 1) - 1) != FLASH_UNTAINTED) {
+                rc.pool[M_BITIDX(i)] |= M_BITMSK(i);
+            }
+        }
+        rc.r0 = r0;
+        rc.rows = rc.pool + pw;
+        fuota_flash_read(rc.rows, matrix + m_offset(r0), m_offset(chunk_ct) - m_offset(r0));
+        rc.session = session;
+    }
+    return rc.pool;
 }
 
-// generate checkbits for chunk
-static void g_checkbits (uint32_t chunk_id, uint32_t* row, uint32_t chunk_ct) {
-    uint32_t i, n = G_WORDS(chunk_ct);
-    for (i = 0; i < n; i++) {
-        row[i] = g_avalanche((chunk_id * n) + i);
+// update row cache after row has been written to flash
+static void rc_update (uint32_t row, uint32_t* c, uint32_t nwords) {
+    rc.pool[M_BITIDX(row)] |= M_BITMSK(row);
+    if (row >= rc.r0) {
+        memcpy(rc.rows + m_offset(row) - m_offset(rc.r0), c, nwords << 2);
     }
-    uint32_t mask = M_BITMSK(chunk_ct) - 1;
-    if (mask) {
-        row[i - 1] &= mask;
+}
+
+// check if all rows are present
+static uint32_t rc_complete (uint32_t* present, uint32_t chunk_ct) {
+    uint32_t n = chunk_ct >> 5;
+    for (uint32_t i = 0; i < n; i++) {
+        if (present[i] != UINT32_MAX) {
+            return 0;
+        }
     }
+    return (chunk_ct & 31) == 0 || present[n] == M_BITMSK(chunk_ct) - 1;
 }
 
+#endif
+
+
+// ------------------------------------------------
+// Working buffer
+//
+// Chunks are processed in a statically allocated buffer of FUOTA_WORK_NW words
+// instead of on the stack (the job running the decoder might have little of
+// it): the chunk data, followed by its checkbit row, which needs one bit per
+// chunk. Session parameters are checked against FUOTA_WORK_NW before
+// processing, sessions too large for the buffer can't be decoded.
+
+static uint32_t work[FUOTA_WORK_NW];
+
+#define W_NWORDS(chunk_ct,chunk_nw) ((chunk_nw) + G_WORDS(chunk_ct))
+
 
 // ------------------------------------------------
 // API
@@ -220,9 +351,16 @@ static bool check_session (fuota_session* session) {
 
 size_t fuota_matrix_size (uint32_t chunk_ct, uint32_t chunk_nw) {
     uint32_t m_nw = m_offset(chunk_ct); // matrix size in words
+#ifdef FUOTA_DEFERRED
+    m_nw <<= 1; // followed by combination rows
+#endif
     return (m_nw << 2);
 }
 
+size_t fuota_work_size (uint32_t chunk_ct, uint32_t chunk_nw) {
+    return (W_NWORDS(chunk_ct, chunk_nw) << 2);
+}
+
 void fuota_init (void* session, void* matrix, void* data, uint32_t sid,
         uint32_t chunk_ct, uint32_t chunk_nw) {
     fuota_session s;
@@ -240,6 +378,45 @@ void fuota_init (void* session, void* matrix, void* data, uint32_t sid,
     s.blocks = data;
 
     fuota_flash_write(session, &s, sizeof(fuota_session) >> 2, false);
+#ifdef FUOTA_ROWCACHE_NW
+    if (rc.session == session) {
+        rc.session = NULL;
+    }
+#endif
+}
+
+// copy area of full pages to equal or higher address (top-down, areas may overlap)
+static void move_pages (uint32_t* dst, uint32_t* src, uint32_t nwords) {
+    uint32_t buf[PAGE_NW];
+    uint32_t off = (nwords + (PAGE_NW - 1)) & ~(PAGE_NW - 1);
+    while (off > 0) {
+        off -= PAGE_NW;
+        fuota_flash_read(buf, src + off, PAGE_NW);
+        fuota_flash_write(dst + off, buf, PAGE_NW, true);
+    }
+}
+
+void fuota_move (fuota_session* session, void* new_session, void* new_matrix, void* new_data) {
+    fuota_session s;
+    fuota_flash_read(&s, session, sizeof(fuota_session) >> 2);
+    // invalidate current session state first
+    uint32_t buf[PAGE_NW];
+    memset(buf, (fuota_flash_bitdefault) ? 0xff : 0x00, sizeof(buf));
+    fuota_flash_write(session, buf, PAGE_NW, true);
+#ifdef FUOTA_ROWCACHE_NW
+    rc.session = NULL;
+#endif
+    // chunk data is above matrix, so move it first
+    if (new_data != s.blocks) {
+        move_pages(new_data, s.blocks, s.chunk_ct * s.chunk_nw);
+    }
+    if (new_matrix != s.matrix) {
+        move_pages(new_matrix, s.matrix, fuota_matrix_size(s.chunk_ct, s.chunk_nw) >> 2);
+    }
+    // write session state (including progress) to new location
+    s.matrix = new_matrix;
+    s.blocks = new_data;
+    fuota_flash_write(new_session, &s, sizeof(fuota_session) >> 2, true);
 }
 
 void* fuota_unpack (fuota_session* session) {
@@ -250,12 +427,41 @@ void* fuota_unpack (fuota_session* session) {
         word_taint(&session->unpacking);
 
         bw_state buffer;
+#ifdef FUOTA_DEFERRED
+        {
+            // reduce blocks by their combination rows (descending)
+            uint32_t chunk_ct = s_u4(chunk_ct);
+            uint32_t chunk_nw = s_u4(chunk_nw);
+            uint32_t* blocks = s_u4ptr(blocks);
+            uint32_t* matrix = s_u4ptr(matrix);
+            buffer.base = NULL;
+            buffer.off = 0;
+            uint32_t i = chunk_ct;
+            while (i-- > 0) {
+                uint32_t* d = work;
+                fuota_flash_read(d, blocks + (chunk_nw * i), chunk_nw);
+                uint32_t r = chunk_ct - 1 - i;
+                uint32_t* cr = C_ROW(matrix, chunk_ct, i);
+                for (uint32_t k = 0; k < G_WORDS(r); k++) {
+                    uint32_t cw = fuota_flash_rd_u4(cr + k);
+                    while (cw) {
+                        uint32_t j = i + 1 + (k << 5) + __builtin_ctz(cw);
+                        cw &= cw - 1;
+                        xor_bf2r(d, blocks + (chunk_nw * j), chunk_nw, &buffer);
+                    }
+                }
+                buffered_write_desc(&buffer, blocks + (chunk_nw * i), d, chunk_nw,
+                        blocks + (chunk_nw * chunk_ct));
+            }
+            buffered_write_desc(&buffer, NULL, NULL, 0, NULL); // flush buffer to flash
+        }
+#endif
         buffer.base = s_u4ptr(blocks);
         buffer.off = 0;
         uint32_t i;
         uint32_t chunk_nw = s_u4(chunk_nw);
         for (i = 0; i < s_u4(chunk_ct); i++) {
-            uint32_t d[chunk_nw];
+            uint32_t* d = work;
             fuota_flash_read(d, s_u4ptr(blocks) + (chunk_nw * i), chunk_nw);
             uint32_t* c = s_u4ptr(matrix) + m_offset(i);
             uint32_t j = i, idx = M_BITIDX(j), mask = M_BITMSK(j);
@@ -284,6 +490,14 @@ static void matrix_write (void* dst, uint32_t* c, uint32_t nwords) {
 
 int fuota_process (fuota_session* session, uint32_t chunk_id,
         unsigned char* chunk_buf) {
+    return fuota_process_ex(session, chunk_id, chunk_buf, NULL);
+}
+
+int fuota_process_ex (fuota_session* session, uint32_t chunk_id,
+        unsigned char* chunk_buf, uint32_t* prow) {
+    if (prow) {
+        *prow = UINT32_MAX;
+    }
     // check if session is valid, or if we are already done
     int state = fuota_state(session, NULL, NULL, NULL, NULL);
     if( state != FUOTA_MORE ) {
@@ -292,32 +506,124 @@ int fuota_process (fuota_session* session, uint32_t chunk_id,
     // get session parameters
     uint32_t chunk_ct = s_u4(chunk_ct);
     uint32_t chunk_nw = s_u4(chunk_nw);
+    uint32_t nw = G_WORDS(chunk_ct);
+    if (W_NWORDS(chunk_ct, chunk_nw) > FUOTA_WORK_NW) {
+        return FUOTA_ERROR;
+    }
     // copy chunk data to word-aligned buffer
-    uint32_t d[chunk_nw];
+    uint32_t* d = work;
     memcpy(d, chunk_buf, chunk_nw << 2);
     // generate checkbits
-    uint32_t c[G_WORDS(chunk_ct)];
+    uint32_t* c = work + chunk_nw;
     g_checkbits(chunk_id, c, chunk_ct);
     // process against already received chunks
     uint32_t* matrix = s_u4ptr(matrix);
-    uint32_t i = chunk_ct, idx = M_BITIDX(i), mask = M_BITMSK(i);
-    while (i-- > 0) {
-        m_prev(&idx, &mask);
-        if ((c[idx] & mask)
-                && M_ISSET(fuota_flash_rd_u4(matrix + m_offset(i) + idx), mask)) {
-            // xor checkbits
-            xor_mf2r(c, matrix + m_offset(i), idx + 1);
-            // xor data block
-            xor_f2r(d, s_u4ptr(blocks) + (chunk_nw * i), chunk_nw);
+    uint32_t* blocks = s_u4ptr(blocks);
+    uint32_t i;
+#ifdef FUOTA_ROWCACHE_NW
+    uint32_t* present = rc_load(session, matrix, chunk_ct);
+    if (present) {
+        // word-parallel: eliminate highest present row until no candidates are left
+        uint32_t w = nw;
+        uint32_t lim = UINT32_MAX; // bits of c[w] not yet processed
+        while (w-- > 0) {
+            uint32_t cand;
+            lim = UINT32_MAX;
+            while ((cand = c[w] & present[w] & lim) != 0) {
+                uint32_t top = 31 - __builtin_clz(cand);
+#ifdef FUOTA_DEFERRED
+                if (((c[w] & lim) >> top) > 1) {
+                    break; // higher bit without row - found pivot
+                }
+#endif
+                i = (w << 5) + top;
+                if (i >= rc.r0) {
+                    xor_mr2r(c, rc.rows + m_offset(i) - m_offset(rc.r0), w + 1);
+                } else {
+                    xor_mf2r(c, matrix + m_offset(i), w + 1);
+                }
+#ifdef FUOTA_DEFERRED
+                // mark row as combined
+                c[w] |= M_BITMSK(i);
+                lim = (uint32_t) M_BITMSK(i) - 1;
+#else
+                xor_f2r(d, blocks + (chunk_nw * i), chunk_nw);
+#endif
+            }
+#ifdef FUOTA_DEFERRED
+            if (c[w] & lim) {
+                break;
+            }
+#endif
+        }
+#ifdef FUOTA_DEFERRED
+        i = (w < nw) ? (w << 5) + (31 - __builtin_clz(c[w] & lim)) : UINT32_MAX;
+#endif
+    } else
+#endif
+    {
+        i = chunk_ct;
+        uint32_t idx = M_BITIDX(i), mask = M_BITMSK(i);
+        while (i-- > 0) {
+            m_prev(&idx, &mask);
+            if (c[idx] & mask) {
+                if (M_ISSET(fuota_flash_rd_u4(matrix + m_offset(i) + idx), mask)) {
+                    // xor checkbits
+                    xor_mf2r(c, matrix + m_offset(i), idx + 1);
+#ifdef FUOTA_DEFERRED
+                    // mark row as combined
+                    c[idx] |= mask;
+#else
+                    // xor data block
+                    xor_f2r(d, blocks + (chunk_nw * i), chunk_nw);
+#endif
+                }
+#ifdef FUOTA_DEFERRED
+                else {
+                    break; // found pivot - lower bits are resolved in fuota_unpack
+                }
+#endif
+            }
         }
     }
-    if ((i = m_rmb(c, G_WORDS(chunk_ct))) < chunk_ct) {
+#ifdef FUOTA_DEFERRED
+    // i is the pivot (UINT32_MAX if none), bits above it mark combined rows
+#else
+    i = m_rmb(c, nw);
+#endif
+    if (i < chunk_ct) {
+        if (prow) {
+            *prow = i;
+        }
+#ifdef FUOTA_DEFERRED
+        // split off combination marks
+        uint32_t cw = c[M_BITIDX(i)];
+        c[M_BITIDX(i)] &= UINT32_MAX >> (31 - (i & 31));
+#endif
         // store matrix row
         matrix_write(matrix + m_offset(i), c, M_NWORDS(i));
+#ifdef FUOTA_ROWCACHE_NW
+        if (present) {
+            rc_update(i, c, M_NWORDS(i));
+        }
+#endif
+#ifdef FUOTA_DEFERRED
+        // store combined rows (all above pivot) relative to pivot
+        uint32_t r = chunk_ct - 1 - i;
+        if (r > 0) {
+            c[M_BITIDX(i)] = cw;
+            b_shr(c, c, i + 1, G_WORDS(r), nw);
+            fuota_flash_write(C_ROW(matrix, chunk_ct, i), c, G_WORDS(r), false);
+        }
+#endif
         // store block
-        fuota_flash_write(s_u4ptr(blocks) + (chunk_nw * i), d, chunk_nw, false);
+        fuota_flash_write(blocks + (chunk_nw * i), d, chunk_nw, false);
         // check if complete
-        if (m_complete(matrix, chunk_ct)) {
+        if (
+#ifdef FUOTA_ROWCACHE_NW
+                present ? rc_complete(present, chunk_ct) :
+#endif
+                m_complete(matrix, chunk_ct)) {
             word_taint(&session->complete);
             return FUOTA_COMPLETE;
         }
@@ -352,6 +658,29 @@ int fuota_state (fuota_session* session, uint32_t* sid,
     return FUOTA_MORE;
 }
 
+uint32_t fuota_bitmap (fuota_session* session, uint32_t first, uint32_t nbits,
+        uint32_t* bitmap) {
+    if (!check_session(session)) {
+        return 0;
+    }
+    uint32_t chunk_ct = s_u4(chunk_ct);
+    if (first >= chunk_ct) {
+        return 0;
+    }
+    if (nbits > chunk_ct - first) {
+        nbits = chunk_ct - first;
+    }
+    uint32_t* matrix = s_u4ptr(matrix);
+    memset(bitmap, 0, G_WORDS(nbits) << 2);
+    for (uint32_t i = 0; i < nbits; i++) {
+        // last word of row holds its diagonal bit
+        if (fuota_flash_rd_u4(matrix + m_offset(first + i + 1) - 1) != FLASH_UNTAINTED) {
+            bitmap[M_BITIDX(i)] |= M_BITMSK(i);
+        }
+    }
+    return nbits;
+}
+
 int fuota_check_state (fuota_session* session, uint32_t sid,
         uint32_t chunk_ct, uint32_t chunk_nw) {
     uint32_t c_sid, c_chunk_ct, c_chunk_nw;
@@ -362,32 +691,3 @@ int fuota_check_state (fuota_session* session, uint32_t sid,
     }
     return state;
 }
-
-
-// ------------------------------------------------
-// Chunk Generator
-
-#ifdef FUOTA_GENERATOR
-
-// XOR - ram to ram
-static void xor_r2r (uint32_t* dest, uint32_t* src, uint32_t nwords) {
-    while (nwords-- > 0) {
-        *dest++ ^= *src++;
-    }
-}
-
-void fuota_gen_chunk (uint32_t* dst, uint32_t* src, uint32_t chunk_id,
-        uint32_t chunk_ct, uint32_t chunk_nw) {
-    uint32_t c[G_WORDS(chunk_ct)];
-    g_checkbits(chunk_id, c, chunk_ct);
-    memset(dst, 0x00, chunk_nw * 4);
-    uint32_t i = chunk_ct, idx = M_BITIDX(i), mask = M_BITMSK(i);
-    while (i-- > 0) {
-        m_prev(&idx, &mask);
-        if (c[idx] & mask) {
-            xor_r2r(dst, src + (chunk_nw * i), chunk_nw);
-        }
-    }
-}
-
-#endif
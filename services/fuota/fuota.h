@@ -19,11 +19,24 @@ enum {
 struct _fuota_session;
 typedef struct _fuota_session fuota_session;
 
+// size of the decoder's working buffer (in 4-byte words), which holds a chunk
+// and its checkbit row while it is processed
+#ifndef FUOTA_WORK_NW
+#define FUOTA_WORK_NW   256
+#endif
+
 // return the required matrix size
 // - chunk_ct: chunk count
 // - chunk_nw: number of 4-byte words per chunk
 size_t fuota_matrix_size (uint32_t chunk_ct, uint32_t chunk_nw);
 
+// return the required working buffer size
+// - chunk_ct: chunk count
+// - chunk_nw: number of 4-byte words per chunk
+// NOTE: Sessions for which this exceeds FUOTA_WORK_NW*4 cannot be processed
+//       (fuota_process returns FUOTA_ERROR), check before setting them up.
+size_t fuota_work_size (uint32_t chunk_ct, uint32_t chunk_nw);
+
 // initialize a session
 // - session:   pointer to a single flash page that will hold the session state
 // - matrix:    page-aligned pointer to flash area large enough to
@@ -38,6 +51,16 @@ size_t fuota_matrix_size (uint32_t chunk_ct, uint32_t chunk_nw);
 void fuota_init (void* session, void* matrix, void* data, uint32_t sid,
         uint32_t chunk_ct, uint32_t chunk_nw);
 
+// move a session to new flash areas (e.g. to compact storage)
+// - session:     pointer to session
+// - new_session: page-aligned pointer to new session state page
+// - new_matrix:  page-aligned pointer to new matrix area
+// - new_data:    page-aligned pointer to new chunk data area
+// NOTE: The new areas must be at the same or higher addresses than the current
+//       ones and may overlap them. A reset while moving loses the session.
+void fuota_move (fuota_session* session, void* new_session, void* new_matrix,
+        void* new_data);
+
 // process a chunk
 // - session:   pointer to session
 // - chunk_id:  chunk identifier
@@ -45,6 +68,11 @@ void fuota_init (void* session, void* matrix, void* data, uint32_t sid,
 int fuota_process (fuota_session* session, uint32_t chunk_id,
         unsigned char* chunk_buf);
 
+// process a chunk, and report the matrix row it resolved
+// - prow:      set to resolved row, or UINT32_MAX if chunk was not useful
+int fuota_process_ex (fuota_session* session, uint32_t chunk_id,
+        unsigned char* chunk_buf, uint32_t* prow);
+
 // get current session state
 int fuota_state (fuota_session* session, uint32_t* sid,
         uint32_t* chunk_ct, uint32_t* chunk_nw, uint32_t* complete_ct);
@@ -53,13 +81,28 @@ int fuota_state (fuota_session* session, uint32_t* sid,
 int fuota_check_state (fuota_session* session, uint32_t sid,
         uint32_t chunk_ct, uint32_t chunk_nw);
 
+// get reception bitmap (bit i is set if row first+i of the matrix is resolved)
+// - session:   pointer to session
+// - first:     first row
+// - nbits:     max. number of rows (bitmap must hold (nbits+31)/32 words)
+// returns the number of rows reported (0 on error)
+uint32_t fuota_bitmap (fuota_session* session, uint32_t first, uint32_t nbits,
+        uint32_t* bitmap);
+
 // unpack the received chunks and recover the original file
 // - session:   pointer to session
 void* fuota_unpack (fuota_session* session);
 
 #ifdef FUOTA_GENERATOR
+// generate a chunk from the original file (host-side, see fuota_gen.c)
 void fuota_gen_chunk (uint32_t* dst, uint32_t* src, uint32_t chunk_id,
         uint32_t chunk_ct, uint32_t chunk_nw);
+
+// generate count chunks in a single pass over the original file
+// - dst:       buffer for count * chunk_nw words
+// - chunk_ids: chunk identifiers
+void fuota_gen_chunks (uint32_t* dst, const uint32_t* src, const uint32_t* chunk_ids,
+        uint32_t count, uint32_t chunk_ct, uint32_t chunk_nw);
 #endif
 
 #endif
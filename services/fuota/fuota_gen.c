@@ -0,0 +1,49 @@
+// Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+// Copyright (C) 2016-2019 Semtech (International) AG. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+// Chunk generator (encoder) for host-side tools. Besides the test program,
+// this file is built as shared library (libfuotagen.so) used by frag.py.
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef FUOTA_GENERATOR
+#define FUOTA_GENERATOR
+#endif
+#include "fuota.h"
+#include "fuota_gen.h"
+
+// XOR - ram to ram
+static void xor_r2r (uint32_t* dest, const uint32_t* src, uint32_t nwords) {
+    while (nwords-- > 0) {
+        *dest++ ^= *src++;
+    }
+}
+
+void fuota_gen_chunks (uint32_t* dst, const uint32_t* src, const uint32_t* chunk_ids,
+        uint32_t count, uint32_t chunk_ct, uint32_t chunk_nw) {
+    uint32_t nw = G_WORDS(chunk_ct);
+    uint32_t* c = malloc(count * nw * 4);
+    for (uint32_t k = 0; k < count; k++) {
+        g_checkbits(chunk_ids[k], c + (nw * k), chunk_ct);
+    }
+    memset(dst, 0x00, count * chunk_nw * 4);
+    // single pass over source, each block is combined into all chunks of the batch
+    for (uint32_t i = 0; i < chunk_ct; i++) {
+        uint32_t idx = i >> 5, mask = 1 << (i & 31);
+        for (uint32_t k = 0; k < count; k++) {
+            if (c[(nw * k) + idx] & mask) {
+                xor_r2r(dst + (chunk_nw * k), src + (chunk_nw * i), chunk_nw);
+            }
+        }
+    }
+    free(c);
+}
+
+void fuota_gen_chunk (uint32_t* dst, uint32_t* src, uint32_t chunk_id,
+        uint32_t chunk_ct, uint32_t chunk_nw) {
+    fuota_gen_chunks(dst, src, &chunk_id, 1, chunk_ct, chunk_nw);
+}
@@ -0,0 +1,38 @@
+// Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+// Copyright (C) 2016-2019 Semtech (International) AG. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#ifndef _fuota_gen_h_
+#define _fuota_gen_h_
+
+// Check bits generator, shared by the decoder (fuota.c) and the host-side
+// encoder (fuota_gen.c).
+
+#include <stdint.h>
+
+// returns the number of checkbit words
+#define G_WORDS(n)      ((n + 31) >> 5)
+
+// 32bit pseudo hash
+static inline uint32_t g_avalanche (uint32_t x) {
+    x = ((x >> 16) ^ x) * 0x45d9f3b;
+    x = ((x >> 16) ^ x) * 0x45d9f3b;
+    x = (x >> 16) ^ x;
+    return x;
+}
+
+// generate checkbits for chunk
+static inline void g_checkbits (uint32_t chunk_id, uint32_t* row, uint32_t chunk_ct) {
+    uint32_t i, n = G_WORDS(chunk_ct);
+    for (i = 0; i < n; i++) {
+        row[i] = g_avalanche((chunk_id * n) + i);
+    }
+    uint32_t mask = (1 << (chunk_ct & 31)) - 1;
+    if (mask) {
+        row[i - 1] &= mask;
+    }
+}
+
+#endif
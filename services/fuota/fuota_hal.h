@@ -19,6 +19,11 @@
 #include "lmic.h"
 #endif
 
+// Place code in RAM (see lmic/hal.h)
+#ifndef __hotcode
+#define __hotcode
+#endif
+
 
 // ------------------------------------------------
 // Flash access
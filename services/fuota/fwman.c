@@ -12,10 +12,15 @@
 #include "bootloader.h"
 
 #include "lwmux/lwmux.h"
+#include "eefs/eefs.h"
 #include "micro-ecc/uECC.h"
 
 #include "frag.h"
 
+#include "svcdefs_lwm_downlink.h" // for type-checking hook functions
+#include "svcdefs_frag_complete.h"
+#include "svcdefs_frag_changed.h"
+
 #ifndef SVC_FWMAN_PORT
 #define SVC_FWMAN_PORT 203
 #endif
@@ -77,7 +82,19 @@ static struct {
     int rlen;                   // response length
 
     lwm_job lwmjob;             // uplink job
-    osjob_t rebootjob;          // reboot job
+    osxjob_t rebootjob;         // reboot job (may be days ahead)
+    osjob_t checkjob;           // image check job (DevUpgradeImageReq)
+    osjob_t precheckjob;        // image check job (session complete)
+
+    struct {
+        bool valid;             // result of last image check still valid
+        int status;
+        uint32_t crc;
+        void* ptr;
+    } result;
+
+    bool sigok;                 // signature of image with hash below verified
+    uint32_t sighash[8];
 } state;
 
 // ensure that there is at least n bytes available in the
@@ -141,11 +158,18 @@ static bool check_sig (void* ptr, int len) {
     uint32_t hash[8];
     sha256(hash, ptr, up->size);
 
+    // hashing is cheap compared to ECDSA; skip verification if already done
+    if( state.sigok && memcmp(hash, state.sighash, sizeof(hash)) == 0 ) {
+        return true;
+    }
+
     sig += up->size;
     len -= up->size;
     while( len >= sigsize ) {
         if( uECC_verify(pubkey, (unsigned char*) hash, 32, sig, curve) == 1 ) {
             debug_str("fwman: signature verified\r\n");
+            memcpy(state.sighash, hash, sizeof(hash));
+            state.sigok = true;
             return true;
         } else {
             debug_str("fwman: signature invalid\r\n");
@@ -156,7 +180,7 @@ static bool check_sig (void* ptr, int len) {
     return false;
 }
 
-static int check_img (uint32_t* pcrc, void** pdata) {
+static int do_check_img (uint32_t* pcrc, void** pdata) {
     void* ptr;
     int len;
     if( (len = frag_get(SVC_FWMAN_UPDATE_FRAG_IDX, &ptr)) < 0 ) {
@@ -171,6 +195,17 @@ static int check_img (uint32_t* pcrc, void** pdata) {
                 || !check_sig(ptr, len) ) {
             return DUI_STAT_INVALID;
         } else {
+            // a delta update can only be applied to the firmware it references
+            // (the signature covers the header, so the CRC of the reconstructed
+            // image is authenticated as well and verified by the bootloader)
+            if( up->uptype == BOOT_UPTYPE_LZ4DELTA ) {
+                hal_fwi fwi;
+                hal_fwinfo(&fwi);
+                if( up->size < sizeof(boot_uphdr) + 4
+                        || *(uint32_t*) (up + 1) != fwi.crc ) {
+                    return DUI_STAT_MISMATCH;
+                }
+            }
             if( pcrc ) {
                 *pcrc = up->fwcrc;
             }
@@ -182,6 +217,44 @@ static int check_img (uint32_t* pcrc, void** pdata) {
     }
 }
 
+// image check, final results are cached until the update session changes
+// (no result is cached while the image is missing or incomplete)
+static int check_img (uint32_t* pcrc, void** pdata) {
+    if( !state.result.valid ) {
+        state.result.status = do_check_img(&state.result.crc, &state.result.ptr);
+        state.result.valid = (state.result.status != DUI_STAT_NONE);
+    }
+    if( state.result.status == DUI_STAT_VALID ) {
+        if( pcrc ) {
+            *pcrc = state.result.crc;
+        }
+        if( pdata ) {
+            *pdata = state.result.ptr;
+        }
+    }
+    return state.result.status;
+}
+
+static void precheck_job (osjob_t* job) {
+    debug_printf("fwman: update image check: %d\r\n", check_img(NULL, NULL));
+}
+
+// check image in the background as soon as it is complete, so that
+// DevUpgradeImageReq and reboot do not have to
+void _fwman_frag_complete (int idx) {
+    if( idx == SVC_FWMAN_UPDATE_FRAG_IDX ) {
+        state.result.valid = false;
+        os_setCallback(&state.precheckjob, precheck_job);
+    }
+}
+
+void _fwman_frag_changed (int idx) {
+    if( idx == SVC_FWMAN_UPDATE_FRAG_IDX ) {
+        state.result.valid = false;
+        os_clearCallback(&state.precheckjob);
+    }
+}
+
 static void reboot (osjob_t* j) {
     void* ptr;
     if( check_img(NULL, &ptr) == DUI_STAT_VALID ) {
@@ -192,6 +265,7 @@ static void reboot (osjob_t* j) {
         }
     }
     debug_str("fwman: rebooting...\r\n");
+    eefs_flush();
     hal_reboot();
 }
 
@@ -203,13 +277,18 @@ static int dev_reboot_time_req (unsigned char* data, int dlen) {
 
     if( t == 0 ) {
         // reboot now (don't send answer)
-        os_setCallback(&state.rebootjob, reboot);
+        os_setCallback(&state.rebootjob.job, reboot);
     } else {
         if ( t == 0xffffffff ) {
             // cancel any pending reboot
-            os_clearCallback(&state.rebootjob);
+            os_clearCallback(&state.rebootjob.job);
+        } else if( LMIC.gpsEpochOff ) {
+            // time is in seconds since GPS epoch, reboot right away if in the past
+            osxtime_t now = os_getXTime();
+            osxtime_t rt = sec2osxticks(t) - LMIC.gpsEpochOff;
+            os_setExtendedTimedCallback(&state.rebootjob, (rt > now) ? rt : now, reboot);
         } else {
-            // exact time reboot not supported for now
+            // exact time reboot not possible without network time
             t = 0;
         }
         resp_makeroom(ANS_LENS[DEV_REBOOT_TIME_ANS]);
@@ -224,6 +303,7 @@ static int dev_reboot_time_req (unsigned char* data, int dlen) {
 static int dev_upgrade_img_req (void) {
     uint32_t crc;
 
+    // (usually the cached result of the check run when the image completed)
     int status = check_img(&crc, NULL);
 
     resp_makeroom(ANS_LENS[DEV_UPGRADE_IMG_ANS] + ((status == DUI_STAT_VALID) ? 4 : 0));
@@ -5,6 +5,7 @@
 
 #include "fuota.h"
 #include "fuota_hal.h"
+#include "flashsim.h"
 
 #include <string.h>
 #include <stdlib.h>
@@ -13,73 +14,7 @@
 
 #include <time.h>
 
-#ifndef __x86_64__
-#error "Simulation requires 64-bit platform"
-#endif
-
-
-// ------------------------------------------------
-// Flash simulation
-
-#define FLASH_SZ        (128 * 1024) // 128K
-#define FLASH_PAGE_SZ   fuota_flash_pagesz
-
-#define FLASH_WORD_CT   (FLASH_SZ >> 2)
-#define FLASH_PAGE_CT   (FLASH_SZ / FLASH_PAGE_SZ)
-#define FLASH_END       (FLASH.W + (FLASH_SZ / 4))
-
-static union {
-    uint32_t W[FLASH_SZ / 4];
-    uint32_t P[FLASH_PAGE_CT][FLASH_PAGE_SZ / 4];
-} FLASH;
-
-// Fake flash addresses are non-canonical, i.e. they are not valid
-// in amd64 virtual address space.
-static uint32_t addr2word (void* ptr) {
-    uintptr_t addr = (uintptr_t) ptr;
-    assert((addr >> 32) == 0xdeadbeef);
-    assert((addr & 3) == 0);
-    return (addr & 0xffffffff) >> 2;
-}
-
-static void* word2addr (uint32_t word) {
-    assert(word <= FLASH_WORD_CT);
-    return (void*) ((0xdeadbeefULL << 32) | (word << 2));
-}
-
-void fuota_flash_write (void* _dst, void* _src, uint32_t nwords, bool erase) {
-    assert((((uintptr_t) _src) & 3) == 0);
-    uint32_t* src = _src;
-    uint32_t w = addr2word(_dst);
-    assert((w + nwords) <= FLASH_WORD_CT);
-    uint32_t* dst = FLASH.W + w;
-    int i;
-    for (i = 0; i < nwords; i++) {
-        if (((w++ << 2) & (FLASH_PAGE_SZ-1)) == 0 && erase) {
-            memset(dst + i, (fuota_flash_bitdefault) ? 0xff : 0x00, FLASH_PAGE_SZ);
-        }
-        assert(dst[i] == ((fuota_flash_bitdefault) ? ~0 : 0));
-        dst[i] = src[i];
-    }
-}
-
-void fuota_flash_read (void* dst, void* src, uint32_t nwords) {
-    uint32_t w = addr2word(src);
-    assert((w + nwords) <= FLASH_WORD_CT);
-    memcpy(dst, FLASH.W + w, nwords << 2);
-}
-
-uint32_t fuota_flash_rd_u4 (void* addr) {
-    uint32_t w = addr2word(addr);
-    assert(w < FLASH_WORD_CT);
-    return(FLASH.W[w]);
-}
-
-void* fuota_flash_rd_ptr (void* addr) {
-    uint32_t w = addr2word(addr);
-    assert(w < FLASH_WORD_CT);
-    return *((void**) (FLASH.W + w));
-}
+#define MOVE_PAGES      3            // distance for fuota_move() test
 
 
 // ------------------------------------------------
@@ -115,7 +50,7 @@ int main (int argc, char** argv) {
         return 1;
     }
 
-    memset(&FLASH, 0xa5, sizeof(FLASH));
+    flashsim_reset();
 
     uint32_t chunk_nw = 60; // 60 words = 240 bytes
 
@@ -139,16 +74,16 @@ int main (int argc, char** argv) {
     uint32_t snp = (ss + (FLASH_PAGE_SZ-1)) / FLASH_PAGE_SZ;
     printf("              %6d pages (%d bytes)\n", snp, snp * FLASH_PAGE_SZ);
 
-    assert((mnp + dnp + snp) < FLASH_PAGE_CT);
-    // Flash:  |........<matrix><data><session>|
-    uint32_t mw = (FLASH_PAGE_CT - (mnp + dnp + snp)) * (FLASH_PAGE_SZ >> 2);
-    uint32_t dw = (FLASH_PAGE_CT - (dnp + snp)) * (FLASH_PAGE_SZ >> 2);
-    uint32_t sw = (FLASH_PAGE_CT - (snp)) * (FLASH_PAGE_SZ >> 2);
+    assert((mnp + dnp + snp + MOVE_PAGES) < FLASH_PAGE_CT);
+    // Flash:  |........<matrix><data><session>....| (session is moved up half-way)
+    uint32_t mw = (FLASH_PAGE_CT - (mnp + dnp + snp + MOVE_PAGES)) * (FLASH_PAGE_SZ >> 2);
+    uint32_t dw = (FLASH_PAGE_CT - (dnp + snp + MOVE_PAGES)) * (FLASH_PAGE_SZ >> 2);
+    uint32_t sw = (FLASH_PAGE_CT - (snp + MOVE_PAGES)) * (FLASH_PAGE_SZ >> 2);
 
     // erase session pages
-    memset(FLASH.W + mw, (fuota_flash_bitdefault) ? 0xff : 0x00, mnp * FLASH_PAGE_SZ);
-    memset(FLASH.W + dw, (fuota_flash_bitdefault) ? 0xff : 0x00, dnp * FLASH_PAGE_SZ);
-    memset(FLASH.W + sw, (fuota_flash_bitdefault) ? 0xff : 0x00, snp * FLASH_PAGE_SZ);
+    flashsim_erase(mw, mnp);
+    flashsim_erase(dw, dnp);
+    flashsim_erase(sw, snp);
 
     void* matrix = word2addr(mw);
     void* data = word2addr(dw);
@@ -165,6 +100,7 @@ int main (int argc, char** argv) {
     uint32_t chunk_id = rand();
     uint32_t total = 0;
     uint32_t cc = 0;
+    clock_t cpu = 0;
     while (1) {
         uint32_t chunk[chunk_nw];
         // skip random number of chunks (simulate packet loss)
@@ -172,7 +108,9 @@ int main (int argc, char** argv) {
         // generate a new chunk
         fuota_gen_chunk(chunk, (uint32_t*) inbuf, chunk_id, chunk_ct, chunk_nw);
         // process chunk
+        clock_t t0 = clock();
         int rv = fuota_process(s, chunk_id, (unsigned char*) chunk);
+        cpu += clock() - t0;
         assert(rv != FUOTA_ERROR);
         total += 1;
         // get complete count
@@ -189,12 +127,39 @@ int main (int argc, char** argv) {
         }
         assert(rv == FUOTA_MORE);
         assert(cc != chunk_ct);
+        if (cc >= chunk_ct / 2 && s == session) {
+            // check reception bitmap
+            uint32_t bm[(chunk_ct + 31) / 32], n = 0;
+            assert(fuota_bitmap(s, 0, chunk_ct, bm) == chunk_ct);
+            for (uint32_t i = 0; i < (chunk_ct + 31) / 32; i++) {
+                n += __builtin_popcount(bm[i]);
+            }
+            assert(n == cc);
+            // relocate session (overlapping)
+            uint32_t mv = MOVE_PAGES * (FLASH_PAGE_SZ >> 2);
+            data = word2addr(dw + mv);
+            s = word2addr(sw + mv);
+            fuota_move(session, s, word2addr(mw + mv), data);
+            printf("moved session to %p\n", (void*) s);
+            assert(fuota_check_state(s, 0x123, chunk_ct, chunk_nw) != FUOTA_ERROR);
+            assert(fuota_state(session, NULL, NULL, NULL, NULL) == FUOTA_ERROR);
+        }
     }
 
+    uint64_t rd_process = STATS.rd_words;
+    clock_t t0 = clock();
     void* outbuf = fuota_unpack(s);
+    clock_t cpu_unpack = clock() - t0;
     assert(outbuf);
     assert(outbuf == data);
 
+    printf("process:      %6.1f ms (%.1f us/chunk), %llu flash words read (%llu/chunk)\n",
+            cpu * 1e3 / CLOCKS_PER_SEC, cpu * 1e6 / CLOCKS_PER_SEC / total,
+            (unsigned long long) rd_process, (unsigned long long) rd_process / total);
+    printf("unpack:       %6.1f ms, %llu flash words read\n",
+            cpu_unpack * 1e3 / CLOCKS_PER_SEC,
+            (unsigned long long) (STATS.rd_words - rd_process));
+
     int diff = memcmp(inbuf, FLASH.W + addr2word(outbuf), chunk_ct * chunk_nw * 4);
     assert(!diff);
 
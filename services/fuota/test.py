@@ -5,7 +5,7 @@
 # This file is subject to the terms and conditions defined in file 'LICENSE',
 # which is part of this source code package.
 
-from typing import BinaryIO,Optional,Tuple,Union
+from typing import BinaryIO,List,Optional,Tuple,Union
 
 import argparse
 import asyncio
@@ -21,7 +21,7 @@ from devtest import DeviceTest, LoRaWANTest
 from vtimeloop import VirtualTimeLoop
 from zfwtool import Update, ZFWArchive
 
-from frag import FragCarousel
+from frag import DefragSession, FragCarousel, TrackNetGenerator
 
 import loramsg as lm
 
@@ -38,6 +38,8 @@ class FragPackage:
     FRAG_SESS_DEL_REQ   = 0x03
     FRAG_SESS_DEL_ANS   = 0x03
     DATA_FRAGMENT       = 0x08
+    FRAG_MISSING_REQ    = 0x81     # proprietary
+    FRAG_MISSING_ANS    = 0x81     # proprietary
     FRAG_HASH_REQ       = 0x80     # proprietary
     FRAG_HASH_ANS       = 0x80     # proprietary
 
@@ -171,6 +173,20 @@ class FuotaTest(LoRaWANTest):
         self.assert_eq(pl[1:], check_hash, explain=explain)
         return m
 
+    async def do_frag_missing(self, m:lm.Msg, first:int=0, fridx:int=0,
+            explain:Optional[str]=None) -> Tuple[lm.Msg,List[Tuple[int,int]],bool]:
+        assert 0 <= fridx < 4
+        self.lw_dnlink(m,
+                payload=struct.pack('<BBH', FragPackage.FRAG_MISSING_REQ, fridx, first),
+                port=FragPackage.PORT)
+        m = await self.frag_uplink()
+        pl = m['FRMPayload']
+        self.assert_eq(pl[0], FragPackage.FRAG_MISSING_ANS, explain=explain)
+        self.assert_eq(pl[1] >> 6, fridx, explain=explain)
+        n = pl[1] & 0xf
+        ranges = [struct.unpack_from('<HH', pl, 2 + 4 * i) for i in range(n)]
+        return m, ranges, bool(pl[1] & 0x20)
+
     async def do_frag_data_fragment(self, m:lm.Msg, cid:int, fragment:bytes,
             fridx:int=0, **kwargs) -> lm.Msg:
         assert 0 <= fridx < 4
@@ -292,6 +308,41 @@ class FuotaTest(LoRaWANTest):
         return m
 
 
+    @DeviceTest.test()
+    async def frag_missing_req(self) -> bool:
+        m = await self.do_init()
+
+        fc = FragCarousel.fromfile(np.random.bytes(4 * 1024))
+        ds = DefragSession(fc.cct, fc.csz, TrackNetGenerator())
+        m = await self.do_frag_sess_setup_req(m, fc.cct, fc.csz, pad=fc.pad)
+
+        # Send about half of the fragments
+        for cid in range(1, fc.cct // 2 + 1):
+            ds.process(cid, fc.chunk(cid))
+            m = await self.do_frag_data_fragment(m, cid, fc.chunk(cid),
+                    check_total=fc.cct, check_complete=ds.dct)
+
+        # Collect missing ranges and compare with local session
+        missing:List[int] = []
+        first = 0
+        while True:
+            m, ranges, more = await self.do_frag_missing(m, first=first)
+            for beg, cnt in ranges:
+                missing.extend(range(beg, beg + cnt))
+            if not more:
+                break
+            first = ranges[-1][0] + ranges[-1][1]
+        self.assert_eq(missing, [c for c in range(fc.cct) if ds.rows[c] is None],
+                explain='missing rows')
+
+        # Non-existent session
+        m, ranges, more = await self.do_frag_missing(m, fridx=1)
+        self.assert_eq(len(ranges), 0, explain='non-existent session')
+
+        m = await self.do_frag_sess_del_req(m, explain='clean up')
+
+        return True
+
     @DeviceTest.test()
     async def frag_data_fragment(self) -> bool:
         m = await self.do_init()
@@ -399,6 +450,25 @@ class FuotaTest(LoRaWANTest):
                 explain='update, test key signature')
         m = await self.do_frag_sess_del_req(m, explain='update, test key signature')
 
+        zfw = ZFWArchive.fromfile(os.environ['ZFWFILE'])
+
+        # delta update referencing current firmware
+        dup = Update.createDelta(up.unpack(), zfw.fw, 4096)
+        dup.sign(signkey)
+        m = await self.do_frag_upload(m, dup.tobytes())
+        m = await self.do_fwman_upgrade_img_req(m, check_status=FwManPackage.DUI_STAT_VALID,
+                check_crc=up.fwcrc,
+                explain='delta update, current firmware')
+        m = await self.do_frag_sess_del_req(m, explain='delta update, current firmware')
+
+        # delta update referencing other firmware
+        dup = Update.createDelta(zfw.fw, up.unpack(), 4096)
+        dup.sign(signkey)
+        m = await self.do_frag_upload(m, dup.tobytes())
+        m = await self.do_fwman_upgrade_img_req(m, check_status=FwManPackage.DUI_STAT_MISMATCH,
+                explain='delta update, other firmware')
+        m = await self.do_frag_sess_del_req(m, explain='delta update, other firmware')
+
         return True
 
     @DeviceTest.test()
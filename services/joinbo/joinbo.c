@@ -0,0 +1,59 @@
+// Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+// Persist LMIC join back-off state (elapsed time and airtime since the first
+// join attempt, preferred join channel), so that a device which is reset
+// while the network is unavailable continues to back off instead of starting
+// over with the aggressive first-hour schedule. The DevNonce itself is kept
+// by the HAL (hal_dnonce_next).
+
+#include <string.h>
+
+#include "lmic.h"
+#include "eefs/eefs.h"
+
+#include "svcdefs_eefs_init.h" // for type-checking hook functions
+#include "svcdefs_eefs_fn.h"
+#include "svcdefs_lwm_event.h"
+
+#if !defined(CFG_join_backoff)
+#error "joinbo service requires CFG_join_backoff"
+#endif
+
+// 1a13962721c889c0-cc55e5c2
+static const uint8_t UFID_JOINBO[12] = {
+    0xc0, 0x89, 0xc8, 0x21, 0x27, 0x96, 0x13, 0x1a, 0xc2, 0xe5, 0x55, 0xcc
+};
+
+static void save (void) {
+    lmic_joinbo_t jbo;
+    LMIC_getJoinBackoff(&jbo);
+    eefs_log_save(UFID_JOINBO, &jbo, sizeof(jbo));
+}
+
+void _joinbo_event (ev_t ev) {
+    switch( ev ) {
+        case EV_JOINED:
+        case EV_JOIN_FAILED:
+            save();
+            break;
+        default:
+            break;
+    }
+}
+
+void _joinbo_init (void) {
+    lmic_joinbo_t jbo;
+    if( eefs_log_read(UFID_JOINBO, &jbo, sizeof(jbo)) == sizeof(jbo) ) {
+        LMIC_setJoinBackoff(&jbo);
+    }
+}
+
+const char* _joinbo_eefs_fn (const uint8_t* ufid) {
+    if( memcmp(ufid, UFID_JOINBO, sizeof(UFID_JOINBO)) == 0 ) {
+        return "ch.mkdata.svc.joinbo";
+    }
+    return NULL;
+}
@@ -4,7 +4,15 @@
 // which is part of this source code package.
 
 #include "lwmux.h"
-#include "svcdefs.h"
+#include "svcdefs_lwm_event.h"
+#include "svcdefs_lwm_downlink.h"
+#include "svcdefs_lwm_join_defer.h"
+#include "svcdefs_lwm_join_region.h"
+#include "svcdefs_lwm_join_restore.h"
+
+#if defined(LWM_ENERGY) && defined(SVC_pwrman)
+#include "pwrman/pwrman.h"
+#endif
 
 DECL_ON_LMIC_EVENT;
 
@@ -23,7 +31,35 @@ static struct {
     lwm_job* queue;		// job queue head
     unsigned int runprio;       // minimum priority level for runnning jobs
     lwm_complete completefunc;	// current job completion function
+#ifdef LWM_AGGREGATE
+    struct {
+        int port;                               // aggregation port (0=disabled)
+        int n;                                  // number of additional completion functions
+        lwm_complete completefunc[LWM_AGG_MAX-1]; // completion functions of aggregated jobs
+        lwm_aggstats stats;
+    } agg;
+#endif
+#ifdef LWM_ENERGY
+    struct {
+        uint32_t budget;                        // daily budget (uAh, 0=disabled)
+        unsigned int minprio;                   // min. priority of jobs sent in deficit
+        int32_t balance;                        // bucket level (uAs)
+        osxtime_t t;                            // time of last refill
+        bool hold;                              // in deficit, hold back low-priority jobs
+        bool held;                              // job held back at this tx opportunity
+        ostime_t wake;                          // time to re-evaluate deficit
+        bool changed;                           // DR/power changed for current uplink
+        dr_t dr;                                // configured data rate
+        s1_t txPowAdj;                          // configured TX power adjustment
+#if defined(SVC_pwrman)
+        uint32_t uah;                           // pwrman accumulator at last update
+#endif
+        lwm_energystats stats;
+    } energy;
+#endif
     osjob_t job;		// tx opportunity job
+    ostime_t lasttx;		// time of last tx opportunity used
+    ostime_t txgap;		// average time between used tx opportunities
 
     unsigned int jcnt;		// join attempt counter
 
@@ -62,6 +98,8 @@ static struct {
 
 static bool mode_switch (void);
 static void tx_opportunity (osjob_t* j);
+static void tx_next (osjob_t* j);
+static void queue_insert (lwm_job* job);
 
 
 #ifdef LWM_SLOTTED
@@ -184,23 +222,314 @@ static void update_adr (void) {
     }
 }
 
+#ifdef LWM_ENERGY
+// ------------------------------------------------
+// Energy budget
+
+#define DAY_XTICKS sec2osxticks(60 * 60 * 24)
+
+#ifndef LWM_ENERGY_TX_UA
+// TX supply current (uA) at given output power (dBm), SX1276 PA_BOOST
+static uint32_t tx_ua (int dbm) {
+    static const uint16_t TX_MA10[10] = { // 2, 4, ... 20 dBm
+        351, 388, 420, 465, 518, 589, 678, 812, 957, 1114
+    };
+    int i = (dbm < 2) ? 0 : (dbm - 1) / 2;
+    return TX_MA10[(i > 9) ? 9 : i] * 100;
+}
+#define LWM_ENERGY_TX_UA(dbm) tx_ua(dbm)
+#endif
+
+// Estimated TX charge of frame (uAs)
+static uint32_t tx_charge (rps_t rps, int plen, int dbm) {
+    return (uint64_t) calcAirTime(rps, 13 + plen) * LWM_ENERGY_TX_UA(dbm) / OSTICKS_PER_SEC;
+}
+
+// Refill bucket, debit measured charge and decide whether to hold back jobs
+static void energy_update (ostime_t now) {
+    int32_t cap = state.energy.budget * 3600;
+    uint32_t rate = cap; // refill per day (uAs)
+    u1_t batt = os_getBattLevel();
+    if (batt != MCMD_DEVS_EXT_POWER && batt != MCMD_DEVS_BATT_NOINFO && batt < LWM_ENERGY_BATT_KNEE) {
+        rate = (uint64_t) rate * batt / LWM_ENERGY_BATT_KNEE;
+    }
+    osxtime_t xnow = os_getXTime();
+    if (xnow - state.energy.t >= DAY_XTICKS) {
+        state.energy.balance = cap; // (refilled in any case)
+    }
+    int64_t add = (rate == 0) ? 0 : (xnow - state.energy.t) * rate / DAY_XTICKS;
+    if (add > 0 && state.energy.balance < cap) {
+        // (only advance by the time that was accounted for)
+        state.energy.t += add * DAY_XTICKS / rate;
+        add += state.energy.balance;
+        state.energy.balance = (add > cap) ? cap : add;
+    }
+    if (state.energy.balance == cap) {
+        state.energy.t = xnow;
+    }
+#if defined(SVC_pwrman)
+    uint32_t uah = pwrman_accu_uah();
+    if (uah > state.energy.uah) { // (accumulator might have been reset)
+        int64_t bal = state.energy.balance - (int64_t) (uah - state.energy.uah) * 3600;
+        state.energy.balance = (bal < -cap) ? -cap : bal;
+    }
+    state.energy.uah = uah;
+#endif
+    state.energy.hold = state.energy.balance < 0 && batt != MCMD_DEVS_EXT_POWER;
+    if (state.energy.hold) {
+        // estimated end of deficit, but re-evaluate at least every hour
+        int64_t t = (rate == 0) ? DAY_XTICKS
+            : (-(int64_t) state.energy.balance * DAY_XTICKS + rate - 1) / rate;
+        state.energy.wake = now + ((t > sec2osticks(3600)) ? sec2osticks(3600) : t);
+    }
+}
+
+// Pick data rate and TX power with the least TX charge for (at least) the
+// same link budget as the configured ones: each step to the next faster
+// spreading factor loses 2.5 dB of sensitivity, which is made up with TX
+// power as far as the max. EIRP of the region allows.
+static void energy_txparams (int plen) {
+    dr_t dr0 = LMIC.datarate;
+    rps_t rps0 = LMIC_updr2rps(dr0);
+    int pow0 = LMIC.region->maxEirp + LMIC.txPowAdj;
+    uint32_t charge0 = tx_charge(rps0, plen, pow0);
+    dr_t best = dr0;
+    int bpow = pow0;
+    uint32_t bcharge = charge0;
+    for (int k = 1; dr0 + k < 16; k++) {
+        rps_t rps = LMIC_updr2rps(dr0 + k);
+        if (rps == ILLEGAL_RPS || getBw(rps) != getBw(rps0) || getSf(rps) == FSK
+                || getSf(rps) != getSf(rps0) - k) {
+            break;
+        }
+        int pow = pow0 + (5 * k + 1) / 2;
+        if (pow > LMIC.region->maxEirp) {
+            break;
+        }
+        uint32_t charge = tx_charge(rps, plen, pow);
+        if (charge < bcharge && LMIC.region->dr2maxAppPload[dr0 + k] >= plen) {
+            best = dr0 + k;
+            bpow = pow;
+            bcharge = charge;
+        }
+    }
+    if (best != dr0) {
+        state.energy.dr = dr0;
+        state.energy.txPowAdj = LMIC.txPowAdj;
+        state.energy.changed = true;
+        LMIC_setDrTxpow(best, bpow - LMIC.region->maxEirp);
+        state.energy.stats.optimized += 1;
+        state.energy.stats.saved += charge0 - bcharge;
+        debug_printf("lwm: energy dr %d->%d, %d->%d dBm\r\n", dr0, best, pow0, bpow);
+    }
+}
+
+// Go back to configured data rate and TX power after uplink
+static void energy_restore (void) {
+    if (state.energy.changed) {
+        LMIC_setDrTxpow(state.energy.dr, state.energy.txPowAdj);
+        state.energy.changed = false;
+    }
+}
+#endif
+
+// ------------------------------------------------
+// Job selection
+
+static unsigned int effective_prio (lwm_job* job, ostime_t now) {
+    unsigned int prio = job->prio;
+    if (job->aging > 0) {
+        unsigned int inc = (now - job->queued) / job->aging;
+        prio = (prio + inc < prio) ? LWM_PRIO_MAX : prio + inc;
+    }
+    return prio;
+}
+
+// Select next job - jobs whose deadline would expire before the next tx
+// opportunity (estimated from the observed duty-cycle limited gap between
+// uplinks) are served earliest-deadline-first, all others by their
+// (aged) priority. Returns link to selected job, or NULL. If a job is
+// held back by its rate limit, *pwake is set to the time it becomes
+// eligible.
+static lwm_job** queue_select (ostime_t now, ostime_t* pwake) {
+    lwm_job** best = NULL;
+    unsigned int bprio = 0;
+    bool burgent = false;
+    for (lwm_job** pnext = &state.queue; *pnext; pnext = &((*pnext)->next)) {
+        lwm_job* job = *pnext;
+        unsigned int prio = effective_prio(job, now);
+        if (prio < state.runprio) {
+            continue;
+        }
+        if (job->mininterval > 0 && job->stats.sent
+                && (now - (job->lastsent + job->mininterval)) < 0) {
+            if (pwake && (*pwake == 0 || (job->lastsent + job->mininterval) - *pwake < 0)) {
+                *pwake = job->lastsent + job->mininterval;
+            }
+            continue;
+        }
+#ifdef LWM_ENERGY
+        if (state.energy.hold && prio < state.energy.minprio) {
+            if (pwake && (*pwake == 0 || state.energy.wake - *pwake < 0)) {
+                *pwake = state.energy.wake;
+            }
+            state.energy.held = true;
+            continue;
+        }
+#endif
+        bool urgent = job->maxwait > 0
+            && (job->queued + job->maxwait) - now <= state.txgap;
+        if (best == NULL
+                || (urgent && !burgent)
+                || (urgent && burgent && (job->queued + job->maxwait)
+                    - ((*best)->queued + (*best)->maxwait) < 0)
+                || (!urgent && !burgent && prio > bprio)) {
+            best = pnext;
+            bprio = prio;
+            burgent = urgent;
+        }
+    }
+    return best;
+}
+
+// Unlink job from queue
+static lwm_job* queue_take (lwm_job** pjob) {
+    lwm_job* job = *pjob;
+    *pjob = job->next;
+    return job;
+}
+
+static void job_sent (lwm_job* job, ostime_t now) {
+    ostime_t wait = now - job->queued;
+    if (job->maxwait > 0 && wait > job->maxwait) {
+        job->stats.missed += 1;
+    }
+    if (wait > job->stats.wait_max) {
+        job->stats.wait_max = wait;
+    }
+    job->stats.wait_total += wait;
+    job->stats.sent += 1;
+    job->lastsent = now;
+}
+
+#ifdef LWM_AGGREGATE
+// Try to append more job payloads to the one already in LMIC.pendTxData
+static void aggregate (lwm_txinfo* txinfo) {
+    int max = LMIC_maxAppPayload();
+    int dlen = txinfo->dlen;
+    ostime_t now = os_getTime();
+    if (txinfo->jit_cb || state.agg.port == 0 || dlen + 2 + 3 > max
+            || queue_select(now, NULL) == NULL) {
+        return;
+    }
+    u1_t* buf = LMIC.pendTxData;
+    rps_t rps = LMIC_updr2rps(LMIC.datarate);
+    ostime_t airtime = calcAirTime(rps, 13 + dlen);
+    os_moveMem(buf + 2, buf, dlen);
+    buf[0] = txinfo->port;
+    buf[1] = dlen;
+    int off = 2 + dlen;
+    int n = 1;
+
+    lwm_job** pjob;
+    while (n < LWM_AGG_MAX && max - off >= 3 && (pjob = queue_select(now, NULL))) {
+        lwm_job* job = queue_take(pjob);
+        lwm_txinfo ti;
+        memset(&ti, 0, sizeof(ti));
+        ti.data = buf + off + 2;
+        ti.dlen = max - off - 2;
+        if (!job->txfunc(&ti)) {
+            // might not fit -- give it another chance with a full frame
+            queue_insert(job);
+            break;
+        }
+        if (ti.jit_cb) {
+            if ((ti.dlen = ti.jit_cb(buf + off + 2, max - off - 2)) < 0) {
+                ti.dlen = 0;
+            }
+        } else if (ti.data != buf + off + 2) {
+            os_copyMem(buf + off + 2, ti.data, ti.dlen);
+        }
+        ASSERT(ti.dlen >= 0 && ti.dlen <= max - off - 2);
+        job_sent(job, now);
+        buf[off] = ti.port;
+        buf[off+1] = ti.dlen;
+        off += 2 + ti.dlen;
+        state.agg.completefunc[n-1] = ti.txcomplete;
+        txinfo->confirmed |= ti.confirmed;
+        airtime += calcAirTime(rps, 13 + ti.dlen);
+        n += 1;
+    }
+    if (n == 1) {
+        // nothing to aggregate, restore original payload
+        os_moveMem(buf, buf + 2, dlen);
+        return;
+    }
+    state.agg.n = n - 1;
+    state.agg.stats.frames += 1;
+    state.agg.stats.jobs += n;
+    state.agg.stats.saved += airtime - calcAirTime(rps, 13 + off);
+    debug_printf("lwm: aggregated %d jobs (%d bytes), saved %t\r\n",
+            n, off, airtime - calcAirTime(rps, 13 + off));
+    txinfo->port = state.agg.port;
+    txinfo->dlen = off;
+}
+#endif
+
 static void tx_opportunity (osjob_t* j) {
     ASSERT(!(state.flags & (FLAG_BUSY | FLAG_JOINING)));
-    lwm_job* job;
-    while ((job = state.queue) != NULL && job->prio >= state.runprio) {
-        state.queue = job->next;
+    ostime_t now = os_getTime();
+    ostime_t wake = 0;
+    lwm_job** pjob;
+#ifdef LWM_ENERGY
+    state.energy.held = false;
+    if (state.energy.budget) {
+        energy_update(now);
+    }
+#endif
+    while ((pjob = queue_select(now, &wake)) != NULL) {
+        lwm_job* job = queue_take(pjob);
         lwm_txinfo txinfo;
         memset(&txinfo, 0, sizeof(txinfo));
         txinfo.data = LMIC.pendTxData;
         txinfo.dlen = LMIC_maxAppPayload();
         if (job->txfunc(&txinfo)) {
-            ASSERT((unsigned int) txinfo.dlen < MAX_LEN_PAYLOAD);
-            if (txinfo.data != LMIC.pendTxData) {
-                os_copyMem(LMIC.pendTxData, txinfo.data, txinfo.dlen);
+            job_sent(job, now);
+            if (state.lasttx) {
+                ostime_t gap = now - state.lasttx;
+                state.txgap = state.txgap ? (3 * state.txgap + gap) / 4 : gap;
+            }
+            state.lasttx = now;
+            if (txinfo.jit_cb) {
+                // payload will be written directly into frame by callback
+                txinfo.dlen = 0;
+            } else {
+                ASSERT((unsigned int) txinfo.dlen < MAX_LEN_PAYLOAD);
+                if (txinfo.data != LMIC.pendTxData) {
+                    os_copyMem(LMIC.pendTxData, txinfo.data, txinfo.dlen);
+                }
+#ifdef LWM_AGGREGATE
+                aggregate(&txinfo);
+#endif
             }
+#ifdef LWM_ENERGY
+            if (state.energy.budget) {
+                // (size of just-in-time payload is not known yet, assume max.)
+                int plen = txinfo.jit_cb ? LMIC_maxAppPayload() : txinfo.dlen;
+                if (!LMIC.adrEnabled) {
+                    energy_txparams(plen);
+                }
+#if !defined(SVC_pwrman)
+                // not measured, debit estimated TX charge
+                state.energy.balance -= tx_charge(LMIC_updr2rps(LMIC.datarate), plen,
+                        LMIC.region->maxEirp + LMIC.txPowAdj);
+#endif
+            }
+#endif
             LMIC.pendTxConf = txinfo.confirmed;
             LMIC.pendTxPort = txinfo.port;
             LMIC.pendTxLen = txinfo.dlen;
+            LMIC.pendTxJit = txinfo.jit_cb;
             state.flags |= FLAG_BUSY;
             state.completefunc = txinfo.txcomplete;
             LMIC_setTxData();
@@ -208,6 +537,15 @@ static void tx_opportunity (osjob_t* j) {
         }
     }
     // nobody is sending
+#ifdef LWM_ENERGY
+    if (state.energy.held) {
+        state.energy.stats.deferred += 1;
+    }
+#endif
+    if (wake && state.mode == LWM_MODE_NORMAL) {
+        // retry when rate limit or energy deficit of held back job expires
+        os_setApproxTimedCallback(&state.job, wake, tx_next);
+    }
 #ifdef LWM_SLOTTED
     if (state.mode == LWM_MODE_SLOTTED) {
         bcn_continue();
@@ -224,6 +562,9 @@ static void tx_next (osjob_t* j) {
 // TX complete handler
 static void tx_complete (void) {
     state.flags &= ~FLAG_BUSY;
+#ifdef LWM_ENERGY
+    energy_restore();
+#endif
     update_adr();
     if (mode_switch()) {
         return;
@@ -244,7 +585,22 @@ static void tx_complete (void) {
 
 static void join (osjob_t* job) {
     ASSERT((state.flags & (FLAG_BUSY | FLAG_JOINING)) == FLAG_JOINING);
-    LMIC_reset();
+    if (SVCHOOK_lwm_join_defer()) {
+        return; // service will call lwm_join_resume()
+    }
+    int region = SVCHOOK_lwm_join_region();
+    if (region) {
+        LMIC_reset_ex(region);
+    } else {
+        LMIC_reset();
+    }
+    if (SVCHOOK_lwm_join_restore()) {
+        debug_printf("lwm: session restored\r\n");
+        state.flags &= ~FLAG_JOINING;
+        SVCHOOK_lwm_event(EV_JOINED); // let services set up session state
+        tx_complete();
+        return;
+    }
     LMIC_startJoining();
     state.flags |= FLAG_BUSY;
 }
@@ -270,6 +626,9 @@ static void reschedule_join (void) {
 static void do_shutdown (void) {
     LMIC_shutdown();
     os_clearCallback(&state.job); // cancel any pending backed-off join or tx opportunity
+#ifdef LWM_ENERGY
+    energy_restore();
+#endif
     state.flags &= ~(FLAG_SHUTDOWN | FLAG_JOINING | FLAG_BUSY);
     state.mode = LWM_MODE_SHUTDOWN;
 }
@@ -321,6 +680,18 @@ static bool mode_switch (void) {
 // ------------------------------------------------
 // Public API
 
+static void queue_insert (lwm_job* job) {
+    lwm_job** pnext = &state.queue;
+    while (*pnext) {
+        if ((*pnext)->prio < job->prio) {
+            break;
+        }
+        pnext = &((*pnext)->next);
+    }
+    job->next = *pnext;
+    *pnext = job;
+}
+
 bool lwm_clear_send (lwm_job* job) {
     lwm_job** pnext = &state.queue;
     while (*pnext) {
@@ -334,20 +705,14 @@ bool lwm_clear_send (lwm_job* job) {
 }
 
 void lwm_request_send (lwm_job* job, unsigned int priority, lwm_tx txfunc) {
-    lwm_clear_send(job);
+    if (!lwm_clear_send(job)) {
+        // not yet queued - start waiting (re-requests keep their age)
+        job->queued = os_getTime();
+    }
 
     job->prio = priority;
     job->txfunc = txfunc;
-
-    lwm_job** pnext = &state.queue;
-    while (*pnext) {
-        if ((*pnext)->prio < priority) {
-            break;
-        }
-        pnext = &((*pnext)->next);
-    }
-    job->next = *pnext;
-    *pnext = job;
+    queue_insert(job);
 
     if (state.mode != LWM_MODE_SHUTDOWN
             && !(state.flags & (FLAG_BUSY | FLAG_JOINING))) {
@@ -355,6 +720,12 @@ void lwm_request_send (lwm_job* job, unsigned int priority, lwm_tx txfunc) {
     }
 }
 
+void lwm_join_resume (void) {
+    if ((state.flags & (FLAG_BUSY | FLAG_JOINING)) == FLAG_JOINING) {
+        os_setCallback(&state.job, join);
+    }
+}
+
 int lwm_getmode () {
     return state.mode;
 }
@@ -414,6 +785,43 @@ void lwm_setadrprofile (int txPowAdj, const unsigned char* drlist, int n) {
     }
 }
 
+#ifdef LWM_AGGREGATE
+void lwm_setaggregation (int port) {
+    ASSERT(port >= 0 && port < 224);
+    state.agg.port = port;
+}
+
+void lwm_get_aggstats (lwm_aggstats* stats) {
+    *stats = state.agg.stats;
+}
+#endif
+
+#ifdef LWM_ENERGY
+void lwm_setenergy (uint32_t uah_per_day, unsigned int minprio) {
+    ASSERT(uah_per_day <= INT32_MAX / 3600);
+    state.energy.budget = uah_per_day;
+    state.energy.minprio = minprio;
+    state.energy.balance = uah_per_day * 3600; // start with full bucket
+    state.energy.t = os_getXTime();
+    state.energy.hold = false;
+#if defined(SVC_pwrman)
+    state.energy.uah = pwrman_accu_uah();
+#endif
+    if (state.mode != LWM_MODE_SHUTDOWN
+            && !(state.flags & (FLAG_BUSY | FLAG_JOINING))) {
+        tx_next(&state.job);
+    }
+}
+
+void lwm_get_energystats (lwm_energystats* stats) {
+    if (state.energy.budget) {
+        energy_update(os_getTime());
+    }
+    *stats = state.energy.stats;
+    stats->balance = state.energy.balance;
+}
+#endif
+
 
 // ------------------------------------------------
 // LMiC event callback
@@ -426,6 +834,14 @@ DECL_ON_LMIC_EVENT {
             state.completefunc();
             state.completefunc = NULL;
         }
+#ifdef LWM_AGGREGATE
+        while (state.agg.n > 0) {
+            lwm_complete cf = state.agg.completefunc[--state.agg.n];
+            if (cf) {
+                cf();
+            }
+        }
+#endif
     }
 
     SVCHOOK_lwm_event(e);
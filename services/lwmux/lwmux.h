@@ -9,7 +9,8 @@
 #include "lmic.h"
 
 typedef void (*lwm_complete) (void);
-typedef int (*lwm_jit_cb) (unsigned char* data, int dlen);
+// Zero-copy payload callback, see txjit_t - if set, data/dlen are ignored
+typedef txjit_t lwm_jit_cb;
 
 typedef struct {
     unsigned char* data;
@@ -22,11 +23,27 @@ typedef struct {
 
 typedef bool (*lwm_tx) (lwm_txinfo*);
 
+typedef struct {
+    unsigned int sent;          // number of uplinks sent
+    unsigned int missed;        // number of deadlines missed
+    ostime_t wait_max;          // max. time between request and uplink
+    ostime_t wait_total;        // accumulated waiting time (average = wait_total / sent)
+} lwm_jobstats;
+
 typedef struct _lwm_job {
     unsigned int prio;
     lwm_tx txfunc;
     lwm_complete completefunc;
     struct _lwm_job* next;
+
+    // optional scheduling parameters, set before lwm_request_send() (0=unused)
+    ostime_t maxwait;           // deadline relative to request
+    ostime_t aging;             // waiting time per priority level increase
+    ostime_t mininterval;       // min. interval between uplinks of this job
+
+    ostime_t queued;            // time of request (internal)
+    ostime_t lastsent;          // time of last uplink (internal)
+    lwm_jobstats stats;
 } lwm_job;
 
 
@@ -50,6 +67,55 @@ bool lwm_clear_send (lwm_job* job);
 
 void lwm_setadrprofile (int txPowAdj, const unsigned char* drlist, int n);
 
+// Continue join postponed by a lwm_join_defer hook
+void lwm_join_resume (void);
+
+#ifdef LWM_AGGREGATE
+// Aggregation of several small job payloads into one uplink on a shared port.
+// Each payload is wrapped in a TLV record: <port:1> <length:1> <data:length>
+#ifndef LWM_AGG_MAX
+#define LWM_AGG_MAX 8   // max. number of jobs per aggregated uplink
+#endif
+
+typedef struct {
+    unsigned int frames;        // number of aggregated uplinks sent
+    unsigned int jobs;          // number of jobs carried in aggregated uplinks
+    ostime_t saved;             // airtime saved compared to individual uplinks
+} lwm_aggstats;
+
+void lwm_setaggregation (int port);     // port=0 disables aggregation
+void lwm_get_aggstats (lwm_aggstats* stats);
+#endif
+
+#ifdef LWM_ENERGY
+// Daily charge budget for the device. The charge used (measured by pwrman
+// if present, otherwise the estimated TX charge of the uplinks) is drawn
+// from a bucket holding one day of budget, which is refilled continuously.
+// Below LWM_ENERGY_BATT_KNEE the refill is scaled down with the battery
+// level. While the bucket is in deficit, jobs with an (aged) priority below
+// minprio are held back. If ADR is not network-managed, each uplink uses the
+// data rate / TX power combination with the least TX charge for the same
+// link budget.
+#ifndef LWM_ENERGY_BATT_KNEE
+#define LWM_ENERGY_BATT_KNEE 127        // battery level below which budget is reduced
+#endif
+
+typedef struct {
+    unsigned int deferred;      // tx opportunities with jobs held back
+    unsigned int optimized;     // uplinks sent at other data rate / TX power
+    uint32_t saved;             // estimated TX charge saved (uAs)
+    int32_t balance;            // bucket level (uAs, negative=deficit)
+} lwm_energystats;
+
+void lwm_setenergy (uint32_t uah_per_day, unsigned int minprio);   // uah_per_day=0 disables
+void lwm_get_energystats (lwm_energystats* stats);
+
+// Set budget from battery capacity and target lifetime
+static inline void lwm_setlifetime (uint32_t capacity_mah, uint32_t days, unsigned int minprio) {
+    lwm_setenergy((uint64_t) capacity_mah * 1000 / days, minprio);
+}
+#endif
+
 #ifdef LWM_SLOTTED
 void lwm_slotparams (u4_t freq, dr_t dr, ostime_t interval, int slotsz, int missed_max, int timeouts_max);
 
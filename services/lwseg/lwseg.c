@@ -0,0 +1,211 @@
+// Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#include <string.h>
+#include <stdint.h>
+
+#include "lmic.h"
+#include "lwmux/lwmux.h"
+
+#include "lwseg.h"
+
+#include "svcdefs_lwm_downlink.h" // for type-checking hook functions
+
+#ifndef SVC_LWSEG_PORT
+#define SVC_LWSEG_PORT 204
+#endif
+
+#define NBLKS_MAX ((LWSEG_MAXLEN + LWSEG_BLKSZ - 1) / LWSEG_BLKSZ)
+#if NBLKS_MAX > 4096
+#error "LWSEG_MAXLEN too large for 12-bit block index"
+#endif
+
+enum {
+    HDR_FIN     = (1 << 5),     // segment contains last block
+    HDR_AR      = (1 << 4),     // ack request
+};
+
+static struct {
+    const unsigned char* data;  // record in progress (NULL if idle)
+    int len;                    // record length
+    int nblks;                  // number of blocks
+    unsigned int prio;          // uplink priority
+    lwseg_complete cb;          // completion callback
+
+    unsigned int seq;           // record sequence number (mod 4)
+    int next;                   // next block to consider in current pass
+    int passes;                 // number of passes started
+    int probes;                 // consecutive probes without ack
+    bool await;                 // ack requested, waiting for answer
+    bool probe;                 // send header-only probe next
+
+    uint32_t acked[(NBLKS_MAX + 31) / 32]; // blocks acknowledged
+
+    lwm_job lwmjob;             // uplink job
+    osjob_t job;                // continuation after uplink
+    lwseg_stats stats;
+} state;
+
+static bool blk_acked (int b) {
+    return (state.acked[b >> 5] >> (b & 31)) & 1;
+}
+
+static void blk_setacked (int b) {
+    state.acked[b >> 5] |= ((uint32_t) 1 << (b & 31));
+}
+
+static int blk_len (int b) {
+    return (b == state.nblks - 1) ? state.len - b * LWSEG_BLKSZ : LWSEG_BLKSZ;
+}
+
+// find first block at or after b that has not been acknowledged
+static int blk_open (int b) {
+    while( b < state.nblks && blk_acked(b) ) {
+        b += 1;
+    }
+    return b;
+}
+
+static void finish (int status) {
+    lwseg_complete cb = state.cb;
+    lwm_clear_send(&state.lwmjob);
+    os_clearCallback(&state.job);
+    state.data = NULL;
+    if( status == LWSEG_OK ) {
+        state.stats.records += 1;
+    }
+    debug_printf("lwseg: record %d done, status=%d (%d bytes, %d passes)\r\n",
+            state.seq, status, state.len, state.passes);
+    if( cb ) {
+        cb(status);
+    }
+}
+
+static void next (osjob_t* job);
+
+static void txcomplete (void) {
+    // decide after the event has been processed (ack is delivered after completion)
+    os_setCallback(&state.job, next);
+}
+
+static bool txfunc (lwm_txinfo* txi) {
+    unsigned char* buf = txi->data;
+    int max = txi->dlen;
+    int b = state.probe ? state.nblks : blk_open(state.next);
+    int e = b;
+    int off = 2;
+
+    if( max < off ) {
+        return false;
+    }
+    // add consecutive open blocks as long as they fit
+    while( e < state.nblks && !blk_acked(e) ) {
+        int blen = blk_len(e);
+        if( off + blen > max ) {
+            break;
+        }
+        memcpy(buf + off, state.data + e * LWSEG_BLKSZ, blen);
+        off += blen;
+        e += 1;
+    }
+    if( e == b && b < state.nblks ) {
+        return false; // not even one block fits, wait for a bigger frame
+    }
+    state.next = e;
+    state.probe = false;
+    state.await = (blk_open(e) == state.nblks);
+
+    buf[0] = (state.seq << 6) | ((e == state.nblks && e > b) ? HDR_FIN : 0)
+        | (state.await ? HDR_AR : 0) | (b >> 8);
+    buf[1] = b;
+
+    txi->port = SVC_LWSEG_PORT;
+    txi->dlen = off;
+    txi->txcomplete = txcomplete;
+
+    state.stats.frames += 1;
+    state.stats.bytes += off - 2;
+    return true;
+}
+
+static void next (osjob_t* job) {
+    if( state.data == NULL ) {
+        return;
+    }
+    if( state.await ) {
+        // ack request went unanswered
+        if( ++state.probes > LWSEG_RETRIES ) {
+            finish(LWSEG_FAILED);
+            return;
+        }
+        state.probe = true;
+    } else if( state.passes > LWSEG_PASSES ) {
+        finish(LWSEG_FAILED);
+        return;
+    }
+    lwm_request_send(&state.lwmjob, state.prio, txfunc);
+}
+
+void _lwseg_dl (int port, unsigned char* data, int dlen, unsigned int flags) {
+    if( port != SVC_LWSEG_PORT || state.data == NULL || dlen < 2
+            || (data[0] >> 6) != state.seq ) {
+        return;
+    }
+    int base = ((data[0] & 0xf) << 8) | data[1];
+    for( int b = 0; b < base && b < state.nblks; b++ ) {
+        blk_setacked(b);
+    }
+    for( int i = 0; i < (dlen - 2) * 8 && base + i < state.nblks; i++ ) {
+        if( data[2 + (i >> 3)] & (1 << (i & 7)) ) {
+            blk_setacked(base + i);
+        }
+    }
+    if( blk_open(0) == state.nblks ) {
+        finish(LWSEG_OK);
+    } else if( state.await ) {
+        // start next pass with the blocks still missing
+        state.await = false;
+        state.probe = false;
+        state.probes = 0;
+        state.next = 0;
+        state.passes += 1;
+        state.stats.passes += 1;
+    }
+}
+
+bool lwseg_send (const unsigned char* data, int len, unsigned int priority, lwseg_complete cb) {
+    if( state.data || len <= 0 || len > LWSEG_MAXLEN ) {
+        return false;
+    }
+    state.data = data;
+    state.len = len;
+    state.nblks = (len + LWSEG_BLKSZ - 1) / LWSEG_BLKSZ;
+    state.prio = priority;
+    state.cb = cb;
+    state.seq = (state.seq + 1) & 3;
+    state.next = 0;
+    state.passes = 1;
+    state.probes = 0;
+    state.await = false;
+    state.probe = false;
+    memset(state.acked, 0, sizeof(state.acked));
+    state.stats.passes += 1;
+    lwm_request_send(&state.lwmjob, priority, txfunc);
+    return true;
+}
+
+void lwseg_abort (void) {
+    if( state.data ) {
+        finish(LWSEG_ABORTED);
+    }
+}
+
+bool lwseg_busy (void) {
+    return state.data != NULL;
+}
+
+void lwseg_get_stats (lwseg_stats* stats) {
+    *stats = state.stats;
+}
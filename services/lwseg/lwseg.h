@@ -0,0 +1,77 @@
+// Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#ifndef _lwseg_h_
+#define _lwseg_h_
+
+#include "lwmux/lwmux.h"
+
+// Transport of application records larger than a single uplink.
+//
+// The record is split into blocks of LWSEG_BLKSZ bytes (the last one may be
+// shorter). Each uplink carries a run of consecutive blocks, as many as fit
+// into the payload available at the current data rate, behind a two-byte
+// header:
+//
+//   <seq:2 fin:1 ar:1 blk:12> <data>
+//
+//   seq  record sequence number (mod 4)
+//   fin  segment contains the last block of the record
+//   ar   ack request: last segment of a pass (or header-only probe)
+//   blk  index of first block in segment
+//
+// The network answers an ack request with a selective acknowledgment:
+//
+//   <seq:2 rfu:2 base:12> <bitmap>
+//
+//   base    all blocks below this index have been received
+//   bitmap  blocks base, base+1, ... received (LSB first, may be empty)
+//
+// The next pass resends only the blocks not acknowledged. If no ack arrives
+// after an ack request, a header-only probe is sent (up to LWSEG_RETRIES
+// times). With lwmux aggregation enabled, segments also fill the room left
+// in other jobs' uplinks, and small jobs ride along with the last segment.
+
+#ifndef LWSEG_BLKSZ
+#define LWSEG_BLKSZ     4       // block size (bytes)
+#endif
+#ifndef LWSEG_MAXLEN
+#define LWSEG_MAXLEN    2048    // max. record length (bytes)
+#endif
+#ifndef LWSEG_RETRIES
+#define LWSEG_RETRIES   3       // max. consecutive probes without ack
+#endif
+#ifndef LWSEG_PASSES
+#define LWSEG_PASSES    8       // max. number of passes per record
+#endif
+
+enum {
+    LWSEG_OK,                   // all blocks acknowledged
+    LWSEG_FAILED,               // retries or passes exhausted
+    LWSEG_ABORTED,              // aborted by lwseg_abort()
+};
+
+typedef void (*lwseg_complete) (int status);
+
+typedef struct {
+    unsigned int records;       // number of records completed successfully
+    unsigned int frames;        // number of segments sent (incl. probes)
+    unsigned int bytes;         // number of record bytes sent (incl. resends)
+    unsigned int passes;        // number of passes
+} lwseg_stats;
+
+// Start sending record (data must remain valid until completion),
+// returns false if a record is in progress or len exceeds LWSEG_MAXLEN
+bool lwseg_send (const unsigned char* data, int len, unsigned int priority, lwseg_complete cb);
+
+// Abort record in progress (callback is invoked with LWSEG_ABORTED)
+void lwseg_abort (void);
+
+// Check if a record is in progress
+bool lwseg_busy (void);
+
+void lwseg_get_stats (lwseg_stats* stats);
+
+#endif
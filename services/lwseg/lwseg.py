@@ -0,0 +1,66 @@
+# Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+#
+# This file is subject to the terms and conditions defined in file 'LICENSE',
+# which is part of this source code package.
+
+# Network side of the lwseg record transport (see lwseg.h): reassembles the
+# segments of a record and generates the selective acknowledgments.
+
+from typing import Dict,Optional,Tuple
+
+BLKSZ = 4
+
+class Reassembler:
+    def __init__(self, blksz:int=BLKSZ) -> None:
+        self.blksz = blksz
+        self.seq:Optional[int] = None
+        self.blocks:Dict[int,bytes] = {}
+        self.nblks:Optional[int] = None
+
+    def _reset(self, seq:int) -> None:
+        self.seq = seq
+        self.blocks = {}
+        self.nblks = None
+
+    def complete(self) -> bool:
+        return self.nblks is not None and len(self.blocks) == self.nblks
+
+    def record(self) -> bytes:
+        assert self.nblks is not None
+        return b''.join(self.blocks[b] for b in range(self.nblks))
+
+    def ack(self, maxlen:int=2+8) -> bytes:
+        assert self.seq is not None
+        base = 0
+        while base in self.blocks:
+            base += 1
+        bm = 0
+        nbits = (maxlen - 2) * 8
+        if not self.complete():
+            for i in range(nbits):
+                if (base + i) in self.blocks:
+                    bm |= 1 << i
+        n = (bm.bit_length() + 7) // 8
+        return bytes([(self.seq << 6) | (base >> 8), base & 0xff]) + bm.to_bytes(n, 'little')
+
+    # Process uplink payload, returns (acknowledgment to send, completed record)
+    def process(self, payload:bytes, maxack:int=2+8) -> Tuple[Optional[bytes],Optional[bytes]]:
+        if len(payload) < 2:
+            return (None, None)
+        seq = payload[0] >> 6
+        fin = bool(payload[0] & 0x20)
+        ar = bool(payload[0] & 0x10)
+        blk = ((payload[0] & 0xf) << 8) | payload[1]
+        if seq != self.seq:
+            self._reset(seq)
+        data = payload[2:]
+        done = self.complete()
+        while data:
+            self.blocks[blk] = data[:self.blksz]
+            data = data[self.blksz:]
+            blk += 1
+        if fin:
+            self.nblks = blk
+        ack = self.ack(maxack) if ar else None
+        rec = self.record() if self.complete() and not done else None
+        return (ack, rec)
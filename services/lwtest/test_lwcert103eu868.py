@@ -16,6 +16,7 @@ import loraopts as lo
 
 from lorawan import LNS, LoraWanMsg
 from lwtest import LWTest, PowerStats
+from timing import GW_TOLERANCE
 from vtimeloop import VirtualTimeLoop
 
 from ward import fixture, test, Scope
@@ -614,3 +615,33 @@ async def _(dut=createtest):
 
     dut.dndf(m) # empty downlink to avoid timeout (?)
     m = await dut.check_freqs(m, frozenset(ch.freq for ch in dut.session['region'].upchannels))
+
+
+# Timing conformance (vendor command 0x80): receive windows must cover a
+# downlink at the nominal time, and uplinks must start promptly after being
+# scheduled. Run with SIM_TIMING=1 to check the windows in all other tests.
+TX_START_MAX = 50e-3
+JOB_LATE_MAX = 10e-3
+
+@test('2.16 MAC Timing Benchmark')
+async def _(dut=createtest):
+    timing = dut.enable_timing()
+    m = await dut.start_testmode()
+
+    for rx2, toff in itertools.product([False, True], [GW_TOLERANCE, -GW_TOLERANCE]):
+        m = await dut.echo(m, b'\1\2\3', rx2=rx2, toff=toff)
+    m = await dut.upstats(m, 16)
+
+    dut.request_timing(m)
+    m = await dut.test_updf()
+    txlate, joblate = dut.unpack_timing(m)
+
+    for name, st in timing.report().items():
+        print(f'{name}: {st}')
+    print(f'TX start delay: {txlate*1e3:.3f} ms, job lateness: '
+            + (f'{joblate*1e3:.3f} ms' if joblate is not None else 'n/a'))
+
+    assert timing.windows['rx1'].count > 0 and timing.windows['rx2'].count > 0
+    assert not timing.failures, '; '.join(timing.failures)
+    assert txlate <= TX_START_MAX, f'TX start delay {txlate*1e3:.3f} ms'
+    assert joblate is None or joblate <= JOB_LATE_MAX, f'job lateness {joblate*1e3:.3f} ms'
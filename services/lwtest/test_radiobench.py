@@ -0,0 +1,97 @@
+# Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+#
+# This file is subject to the terms and conditions defined in file 'LICENSE',
+# which is part of this source code package.
+
+# Receive benchmark for the radio driver (see radiobench.py). The device is
+# switched to class C (vendor command 0x81), so it listens continuously on
+# RX2 between the test mode uplinks. Each traffic pattern is injected on the
+# RX2 channel after the receive windows of an uplink have closed and ahead of
+# the next uplink. Run with SIM_RXBENCH=<file> to append the results of each
+# phase as JSON lines, e.g. to compare against a baseline.
+
+from typing import Any, Callable, Dict, Optional, Union
+
+import os
+
+import loramsg as lm
+
+from devtest import vtime
+from lorawan import LNS, LoraWanMsg
+from lwtest import LWTest
+from medium import LoraMsg
+from radiobench import RxBench, RxTraffic
+
+from ward import fixture, test
+
+
+@fixture
+async def createtest(_=vtime):
+    dut = LWTest()
+    dut.start()
+    yield dut
+    await dut.stop()
+
+
+BURST = 8           # frames per back-to-back burst
+NOISE = 4           # preamble-only noise events
+PAIRS = 4           # near-simultaneous frame pairs
+
+BURST_DELAY = 2.5   # start of traffic after end of uplink (s)
+
+async def classc(dut:LWTest, rx2dr:int) -> LoraWanMsg:
+    m = await dut.start_testmode(dlset=lm.DLSettings.pack(rx1droff=0, rx2dr=rx2dr, optneg=False))
+    dut.request_classc(m)
+    return await dut.test_updf()
+
+async def bench(dut:LWTest, name:str, rx2dr:int, pdu:Optional[Callable[[], bytes]]=None) -> None:
+    rb = dut.enable_rxbench()
+    traffic = RxTraffic(dut.runtime, dut.medium, rb, src=dut.gateway)
+    m = await classc(dut, rx2dr)
+    assert dut.session is not None
+    freq, rps = LNS.dn_rx2(dut.session)
+
+    phases:Dict[str,Callable[[float], Any]] = {
+            'burst': lambda t: traffic.back_to_back(t, BURST, freq, rps, pdu),
+            'noise': lambda t: traffic.preamble_noise(t, NOISE, freq, rps, pdu),
+            'nearsim': lambda t: traffic.near_simultaneous(t, PAIRS, freq, rps, pdu,
+                dt=LoraMsg.symtime(rps, nsym=RxBench.SYMDETECT)),
+            }
+    results:Dict[str,Dict[str,Union[int,float]]] = {}
+    for phase, pattern in phases.items():
+        rb.clear()
+        pattern(m.msg.xend + BURST_DELAY)
+        m = await dut.test_updf()
+        results[phase] = st = rb.report()
+        print(f'{name}/{phase}: ' + ' '.join(f'{k}={v:.1f}' if isinstance(v, float)
+            else f'{k}={v}' for k, v in st.items()))
+        if (fn := os.environ.get('SIM_RXBENCH')):
+            rb.save(fn, f'{name}/{phase}')
+
+    # receiver must be re-armed in time for the next frame of a burst
+    st = results['burst']
+    assert st['miss_off'] == 0, f'{st["miss_off"]} burst frames missed (receiver not armed)'
+    assert st['rearm'] > 0
+    # receiver must recover from a preamble that is not followed by a payload
+    st = results['noise']
+    assert st['miss_off'] + st['miss_busy'] == 0, f'{st["missed"]} frames missed after noise'
+    # one frame of each near-simultaneous pair must get through
+    st = results['nearsim']
+    assert st['received'] >= PAIRS - st['miss_tx']
+
+
+def downlink(dut:LWTest) -> Callable[[], bytes]:
+    return lambda: LNS.dl(dut.session, port=15, payload=b'bench')
+
+
+@test('Radio RX Benchmark: Class C, foreign frames')
+async def _(dut=createtest):
+    await bench(dut, 'foreign', 5)
+
+@test('Radio RX Benchmark: Class C, downlinks')
+async def _(dut=createtest):
+    await bench(dut, 'classc', 5, downlink(dut))
+
+@test('Radio RX Benchmark: Class C, FSK')
+async def _(dut=createtest):
+    await bench(dut, 'fsk', 7, downlink(dut))
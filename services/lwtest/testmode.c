@@ -24,6 +24,8 @@
 #define TESTCMD_CW           0x07
 #define TESTCMD_RFU          0x08 // 0x08-0x7F
 #define TESTCMD_VENDOR       0x80 // 0x80-0xFF
+#define TESTCMD_TIMING       0x80 // (vendor) report and reset timing statistics
+#define TESTCMD_CLASSC       0x81 // (vendor) enable/disable class C
 
 static struct {
     uint8_t active;    // test mode active
@@ -34,6 +36,10 @@ static struct {
     uint32_t uptotal;  // total number of up messages since start of test mode
     uint32_t lastdf;   // last down fcnt
     ostime_t dntime;   // time of last downlink (max 30 minutes)
+    ostime_t upsched;  // scheduled time of pending uplink
+    ostime_t txlate;   // largest delay from uplink schedule to TX start
+    uint8_t uppend;    // uplink scheduled, waiting for TX start
+    uint8_t timing;    // timing report requested
     osjob_t timer;     // cw timeout or uplink timer
     lwm_job lwmjob;    // uplink job
 } testmode;
@@ -45,6 +51,9 @@ static void starttestmode (void) {
     testmode.dncnt = 0;
     testmode.retrans = 0;
     testmode.lastdf = 0;
+    testmode.txlate = 0;
+    testmode.uppend = 0;
+    testmode.timing = 0;
     // disable duty cycle
     LMIC_enableFastJoin();
     LMIC_disableDC();
@@ -72,6 +81,31 @@ static void stoptestmode (void) {
     lwm_setpriority(LWM_PRIO_MIN);
 }
 
+static void put_us (u1_t* buf, s4_t ticks) {
+    os_wmsbf4(buf, (ticks < 0) ? 0 : osticks2us(ticks));
+}
+
+// Timing report: largest delay from uplink schedule to TX start and largest
+// job lateness seen by the scheduler (0xffffffff without CFG_jobstats), in
+// microseconds (4 bytes each, big endian). Both are reset.
+static int timingreport (u1_t* buf) {
+    buf[0] = TESTCMD_TIMING;
+    put_us(buf + 1, testmode.txlate);
+    testmode.txlate = 0;
+#if defined(CFG_jobstats)
+    os_jobstats stats[OS_JOBSTATS_MAX];
+    int n = os_jobstats_collect(stats, OS_JOBSTATS_MAX);
+    s4_t late = 0;
+    for( int i = 0; i < n; i++ ) {
+        late = max(late, stats[i].maxlate);
+    }
+    put_us(buf + 5, late);
+#else
+    os_wmsbf4(buf + 5, 0xffffffff);
+#endif
+    return 9;
+}
+
 static bool txfunc (lwm_txinfo* txi) {
     if (testmode.confirmed && (LMIC.txrxFlags & TXRX_NACK) && testmode.retrans < 8) {
 	// no ACK received - retransmit last uplink data in LMIC.pendTxData with same seqnoUp
@@ -85,6 +119,10 @@ static bool txfunc (lwm_txinfo* txi) {
         }
 	txi->dlen = LMIC.dataLen;
 	testmode.retrans = 0;
+    } else if (testmode.timing) {
+	txi->dlen = timingreport(txi->data);
+	testmode.timing = 0;
+	testmode.retrans = 0;
     } else {
 	txi->data[0] = testmode.dncnt >> 8; // fill in downlink_counter
 	txi->data[1] = testmode.dncnt;      // (2 bytes, big endian)
@@ -100,6 +138,8 @@ static bool txfunc (lwm_txinfo* txi) {
 }
 
 static void uplink (osjob_t* job) {
+    testmode.upsched = job->deadline;
+    testmode.uppend = 1;
     lwm_request_send(&testmode.lwmjob, LWM_PRIO_MAX - 2, txfunc);
 }
 
@@ -113,6 +153,13 @@ static void stopcw (osjob_t* job) {
 // referenced by tabs / rm_event()
 void testmode_handleEvent (ev_t ev) {
     switch (ev) {
+	case EV_TXSTART:
+	    if (testmode.uppend) {
+		testmode.txlate = max(testmode.txlate, os_getTime() - testmode.upsched);
+		testmode.uppend = 0;
+	    }
+	    break;
+
 	case EV_TXCOMPLETE: {
 	    // check for downlink
 	    if (LMIC.txrxFlags & (TXRX_DNW1|TXRX_DNW2)) {
@@ -186,6 +233,16 @@ void testmode_handleEvent (ev_t ev) {
 				// start continuous wave
 				os_radio(RADIO_TXCW);
 				return; // no uplink now
+
+			    case TESTCMD_TIMING: // report timing statistics
+				testmode.timing = 1;
+				break;
+
+			    case TESTCMD_CLASSC: // switch device class (device provisioned as class C)
+				if (LMIC.dataLen >= 2) {
+				    LMIC_setClassC(buf[1] ? UNILATERAL_CLASS_C : DISABLE_CLASS_C);
+				}
+				break;
 			}
 		    }
 		} else { // test mode not active
@@ -0,0 +1,392 @@
+// Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+// This service is an implementation of the LoRaWAN™ Remote Multicast Setup
+// Specification v1.0.0. Class B sessions are not supported.
+
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lmic.h"
+#include "lce.h"
+#include "lwmux/lwmux.h"
+#include "eefs/eefs.h"
+
+#include "mcsetup.h"
+
+#include "svcdefs_lwm_downlink.h" // for type-checking hook functions
+#include "svcdefs_lwm_event.h"
+#include "svcdefs_eefs_init.h"
+#include "svcdefs_eefs_fn.h"
+
+#ifndef SVC_MCSETUP_PORT
+#define SVC_MCSETUP_PORT 200
+#endif
+
+// number of groups (McGroupID is 2 bits)
+#ifndef MCSETUP_GROUPS
+#define MCSETUP_GROUPS (LCE_MCGRP_MAX < 4 ? LCE_MCGRP_MAX : 4)
+#endif
+
+// 1a13962728405880-37df699d
+static const uint8_t UFID_MCSETUP_GROUPS[12] = {
+    0x80, 0x58, 0x40, 0x28, 0x27, 0x96, 0x13, 0x1a, 0x9d, 0x69, 0xdf, 0x37
+};
+
+const char* _mcsetup_eefs_fn (const uint8_t* ufid) {
+    if( memcmp(ufid, UFID_MCSETUP_GROUPS, sizeof(UFID_MCSETUP_GROUPS)) == 0 ) {
+        return "ch.mkdata.svc.mcsetup.groups";
+    }
+    return NULL;
+}
+
+enum {
+    PKG_ID      = 2,
+    PKG_VERSION = 1,
+};
+
+enum {
+    PKG_VERSION_REQ     = 0x00,
+    PKG_VERSION_ANS     = 0x00,
+    MC_STATUS_REQ       = 0x01,
+    MC_STATUS_ANS       = 0x01,
+    MC_SETUP_REQ        = 0x02,
+    MC_SETUP_ANS        = 0x02,
+    MC_DELETE_REQ       = 0x03,
+    MC_DELETE_ANS       = 0x03,
+    MC_CLASSC_REQ       = 0x04,
+    MC_CLASSC_ANS       = 0x04,
+    MC_CLASSB_REQ       = 0x05,
+    MC_CLASSB_ANS       = 0x05,
+};
+
+enum {
+    SETUP_STAT_IDERR    = (1 << 2), // group id not supported
+    DELETE_STAT_UNDEF   = (1 << 2), // group not defined
+    SESS_STAT_DRERR     = (1 << 2), // data rate not supported
+    SESS_STAT_FREQERR   = (1 << 3), // frequency not supported
+    SESS_STAT_UNDEF     = (1 << 4), // group not defined
+};
+
+// Group definitions (stored in EEFS)
+//
+// The encrypted McKey is kept rather than the session keys; the keys are
+// derived again when the groups are installed after a join. The frame
+// counter starts over at minFCnt after a reset; maxFCnt is recorded but not
+// enforced.
+typedef struct {
+    struct {
+        uint32_t addr;          // McAddr (0 if undefined)
+        uint8_t mckey[16];      // McKey_encrypted
+        uint32_t minfcnt;       // minMcFCount
+        uint32_t maxfcnt;       // maxMcFCount
+    } groups[MCSETUP_GROUPS];
+} pstate;
+
+static struct {
+    unsigned char resp[24];     // response buffer
+    int rlen;                   // response length
+
+    lwm_job lwmjob;             // uplink job
+
+    pstate ps;                  // persistent state (stored in EEFS)
+
+    // class C session (one at a time)
+    struct {
+        osxjob_t xjob;          // start/end of session
+        int id;                 // group (-1 if none)
+        bool running;           // session has started
+        bool classc;            // class C enabled by session
+        uint8_t timeout;        // session length (2^timeout seconds)
+        uint8_t dr;             // session data rate
+        uint32_t freq;          // session frequency
+        uint8_t dn2Dr;          // saved RX2 parameters
+        uint32_t dn2Freq;
+    } cs;
+} state;
+
+static void session_stop (void);
+
+static void install (int id) {
+    u1_t nwkskey[16], appskey[16];
+    lce_deriveMultiCastKeys(state.ps.groups[id].addr, state.ps.groups[id].mckey, nwkskey, appskey);
+    LMIC_setMultiCastSession(state.ps.groups[id].addr, nwkskey, appskey, state.ps.groups[id].minfcnt);
+    memset(nwkskey, 0, sizeof(nwkskey));
+    memset(appskey, 0, sizeof(appskey));
+}
+
+static void uninstall (int id) {
+    if( state.cs.id == id ) {
+        session_stop();
+    }
+    LMIC_clrMultiCastSession(state.ps.groups[id].addr);
+    memset(&state.ps.groups[id], 0, sizeof(state.ps.groups[id]));
+}
+
+int mcsetup_groups (void) {
+    int mask = 0;
+    for( int id = 0; id < MCSETUP_GROUPS; id++ ) {
+        if( state.ps.groups[id].addr ) {
+            mask |= (1 << id);
+        }
+    }
+    return mask;
+}
+
+bool mcsetup_addr (int id, uint32_t* addr) {
+    if( id < 0 || id >= MCSETUP_GROUPS || state.ps.groups[id].addr == 0 ) {
+        return false;
+    }
+    *addr = state.ps.groups[id].addr;
+    return true;
+}
+
+bool mcsetup_session (int id) {
+    return state.cs.id == id && state.cs.running;
+}
+
+void _mcsetup_init (void) {
+    state.cs.id = -1;
+    if( eefs_read(UFID_MCSETUP_GROUPS, &state.ps, sizeof(pstate)) != sizeof(pstate) ) {
+        memset(&state.ps, 0, sizeof(pstate));
+    }
+}
+
+void _mcsetup_event (ev_t ev) {
+    if( ev == EV_JOINED ) {
+        // LMIC multicast sessions are cleared by LMIC_reset()
+        for( int id = 0; id < MCSETUP_GROUPS; id++ ) {
+            if( state.ps.groups[id].addr ) {
+                install(id);
+            }
+        }
+    }
+}
+
+// ------------------------------------------------
+// Class C session
+//
+// While the session is running, the RX2 parameters are replaced by the
+// session frequency and data rate, and the device is switched to class C
+// unless it already is.
+
+static void session_end (osjob_t* job) {
+    session_stop();
+}
+
+static void session_start (osjob_t* job) {
+    state.cs.running = true;
+    state.cs.dn2Freq = LMIC.dn2Freq;
+    state.cs.dn2Dr = LMIC.dn2Dr;
+    LMIC.dn2Freq = state.cs.freq;
+    LMIC.dn2Dr = state.cs.dr;
+    state.cs.classc = !(LMIC.clmode & CLASS_C);
+    if( state.cs.classc ) {
+        LMIC_setClassC(UNILATERAL_CLASS_C);
+    }
+    os_setExtendedTimedCallback(&state.cs.xjob,
+            os_getXTime() + sec2osxticks(1 << state.cs.timeout), session_end);
+}
+
+static void session_stop (void) {
+    os_clearCallback(&state.cs.xjob.job);
+    if( state.cs.running ) {
+        LMIC.dn2Freq = state.cs.dn2Freq;
+        LMIC.dn2Dr = state.cs.dn2Dr;
+        if( state.cs.classc ) {
+            LMIC_setClassC(DISABLE_CLASS_C);
+        }
+    }
+    state.cs.running = false;
+    state.cs.id = -1;
+}
+
+// ------------------------------------------------
+// Commands
+
+static void resp_makeroom (int len) {
+    if( state.rlen + len > sizeof(state.resp) ) {
+        state.rlen = 0; // drop previous answers
+    }
+}
+
+static int pkg_version_req (void) {
+    resp_makeroom(3);
+    state.resp[state.rlen++] = PKG_VERSION_ANS;
+    state.resp[state.rlen++] = PKG_ID;
+    state.resp[state.rlen++] = PKG_VERSION;
+    return 1;
+}
+
+static int mc_status_req (unsigned char* data, int dlen) {
+    if( dlen < 2 ) {
+        return -1;
+    }
+    int defined = mcsetup_groups();
+    int mask = data[1] & defined;
+    int n = 0;
+    for( ; defined; defined >>= 1 ) {
+        n += defined & 1;
+    }
+    resp_makeroom(2 + 5 * MCSETUP_GROUPS);
+    state.resp[state.rlen++] = MC_STATUS_ANS;
+    state.resp[state.rlen++] = (n << 4) | mask;
+    for( int id = 0; id < MCSETUP_GROUPS; id++ ) {
+        if( mask & (1 << id) ) {
+            state.resp[state.rlen++] = id;
+            os_wlsbf4(state.resp + state.rlen, state.ps.groups[id].addr);
+            state.rlen += 4;
+        }
+    }
+    return 2;
+}
+
+static int mc_setup_req (unsigned char* data, int dlen) {
+    // 1:id, 2-5:addr, 6-21:key, 22-25:minfcnt, 26-29:maxfcnt
+    if( dlen < 30 ) {
+        return -1;
+    }
+    int id = data[1] & 3;
+    uint32_t addr = os_rlsbf4(data + 2);
+    int status = id;
+    if( id >= MCSETUP_GROUPS || addr == 0 ) {
+        status |= SETUP_STAT_IDERR;
+    } else {
+        if( state.ps.groups[id].addr ) {
+            uninstall(id);
+        }
+        state.ps.groups[id].addr = addr;
+        memcpy(state.ps.groups[id].mckey, data + 6, 16);
+        state.ps.groups[id].minfcnt = os_rlsbf4(data + 22);
+        state.ps.groups[id].maxfcnt = os_rlsbf4(data + 26);
+        install(id);
+        eefs_save(UFID_MCSETUP_GROUPS, &state.ps, sizeof(pstate));
+    }
+    resp_makeroom(2);
+    state.resp[state.rlen++] = MC_SETUP_ANS;
+    state.resp[state.rlen++] = status;
+    return 30;
+}
+
+static int mc_delete_req (unsigned char* data, int dlen) {
+    if( dlen < 2 ) {
+        return -1;
+    }
+    int id = data[1] & 3;
+    int status = id;
+    if( id >= MCSETUP_GROUPS || state.ps.groups[id].addr == 0 ) {
+        status |= DELETE_STAT_UNDEF;
+    } else {
+        uninstall(id);
+        eefs_save(UFID_MCSETUP_GROUPS, &state.ps, sizeof(pstate));
+    }
+    resp_makeroom(2);
+    state.resp[state.rlen++] = MC_DELETE_ANS;
+    state.resp[state.rlen++] = status;
+    return 2;
+}
+
+static int mc_session_req (unsigned char* data, int dlen, bool classb) {
+    // 1:id, 2-5:time, 6:timeout, 7-9:freq, 10:dr
+    if( dlen < 11 ) {
+        return -1;
+    }
+    int id = data[1] & 3;
+    uint32_t freq = (data[7] | (data[8] << 8) | (data[9] << 16)) * 100;
+    uint8_t dr = data[10];
+    int status = id;
+    if( id >= MCSETUP_GROUPS || state.ps.groups[id].addr == 0 ) {
+        status |= SESS_STAT_UNDEF;
+    }
+    if( classb || freq < LMIC.region->minFreq || freq > LMIC.region->maxFreq ) {
+        status |= SESS_STAT_FREQERR;
+    }
+    if( classb || dr >= 16 || LMIC_updr2rps(dr) == ILLEGAL_RPS ) {
+        status |= SESS_STAT_DRERR;
+    }
+    resp_makeroom(5);
+    state.resp[state.rlen++] = classb ? MC_CLASSB_ANS : MC_CLASSC_ANS;
+    state.resp[state.rlen++] = status;
+    if( status == id ) {
+        session_stop();
+        state.cs.id = id;
+        state.cs.freq = freq;
+        state.cs.dr = dr;
+        state.cs.timeout = data[6] & 0xf;
+        // SessionTime is in seconds since GPS epoch; start now if time is unknown or in the past
+        osxtime_t now = os_getXTime();
+        osxtime_t start = now;
+        if( LMIC.gpsEpochOff ) {
+            osxtime_t t = sec2osxticks(os_rlsbf4(data + 2)) - LMIC.gpsEpochOff;
+            if( t > now ) {
+                start = t;
+            }
+        }
+        uint32_t tts = (start - now) / OSTICKS_PER_SEC;
+        if( tts > 0xffffff ) {
+            tts = 0xffffff;
+        }
+        state.resp[state.rlen++] = tts;
+        state.resp[state.rlen++] = tts >> 8;
+        state.resp[state.rlen++] = tts >> 16;
+        os_setExtendedTimedCallback(&state.cs.xjob, start, session_start);
+    }
+    return 11;
+}
+
+static bool txfunc (lwm_txinfo* txi) {
+    txi->port = SVC_MCSETUP_PORT;
+    txi->data = state.resp;
+    txi->dlen = state.rlen;
+    state.rlen = 0;
+    return true;
+}
+
+void _mcsetup_dl (int port, unsigned char* data, int dlen, unsigned int flags) {
+    if( port == SVC_MCSETUP_PORT ) {
+        while( dlen ) {
+            int n;
+            switch( *data ) {
+                case PKG_VERSION_REQ:
+                    n = pkg_version_req();
+                    break;
+
+                case MC_STATUS_REQ:
+                    n = mc_status_req(data, dlen);
+                    break;
+
+                case MC_SETUP_REQ:
+                    n = mc_setup_req(data, dlen);
+                    break;
+
+                case MC_DELETE_REQ:
+                    n = mc_delete_req(data, dlen);
+                    break;
+
+                case MC_CLASSC_REQ:
+                    n = mc_session_req(data, dlen, false);
+                    break;
+
+                case MC_CLASSB_REQ:
+                    n = mc_session_req(data, dlen, true);
+                    break;
+
+                default:
+                    // unknown command -- abort processing
+                    goto done;
+            }
+            if( n < 0 ) {
+                goto done;
+            }
+            data += n;
+            dlen -= n;
+        }
+done:
+        if( state.rlen ) {
+            lwm_request_send(&state.lwmjob, 0, txfunc);
+        }
+    }
+}
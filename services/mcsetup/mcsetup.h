@@ -0,0 +1,25 @@
+// Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#ifndef _mcsetup_h_
+#define _mcsetup_h_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Multicast groups managed by the network via the LoRaWAN Remote Multicast
+// Setup package. Group definitions are persisted and the LMIC multicast
+// sessions are installed again after each join.
+
+// Get bit mask of defined groups (McGroupBitMask)
+int mcsetup_groups (void);
+
+// Get address of group, returns false if group is not defined
+bool mcsetup_addr (int id, uint32_t* addr);
+
+// Check if class C session of group is running
+bool mcsetup_session (int id);
+
+#endif
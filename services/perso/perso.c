@@ -5,7 +5,7 @@
 
 #include "lmic.h"
 #include "peripherals.h"
-#include "svcdefs.h" // for type-checking hook functions
+#include "svcdefs_appstart.h" // for type-checking hook functions
 
 // Check prerequisistes and generate nice warnings
 #ifndef GPIO_PERSO_DET
@@ -19,13 +19,26 @@
 #define BRD_PERSO_UART_BAUDRATE 115200
 #endif
 
+// highest bit rate accepted by set baudrate command
+#ifndef BRD_PERSO_UART_MAXBAUD
+#define BRD_PERSO_UART_MAXBAUD 921600
+#endif
+
+// size of UART receive ring buffer (limits number of commands the host can
+// have in flight: one being processed plus as many frames as fit the ring)
+#ifndef SVC_PERSO_RINGSZ
+#define SVC_PERSO_RINGSZ 512
+#endif
+
 enum {
     CMD_NOP      = 0x00,
     CMD_RUN      = 0x01,
     CMD_RESET    = 0x02,
+    CMD_BAUD     = 0x03,
 
     CMD_EE_READ  = 0x90,
     CMD_EE_WRITE = 0x91,
+    CMD_EE_CRC   = 0x92,
 };
 
 enum {
@@ -42,6 +55,10 @@ enum {
     OFF_PAYLOAD  = 4,
 };
 
+enum {
+    MAX_PAYLOAD  = 236,
+};
+
 typedef union {
     unsigned char bytes[256];
     uint32_t words[256];
@@ -49,8 +66,12 @@ typedef union {
 
 static struct {
     commbuf buf;
-    int rxn;
+    int rxn;                    // bytes of current frame in buf (-1: discarding)
+    bool busy;                  // command being processed or response being sent
     osjobcb_t cb;
+    osjob_t rxjob;
+    unsigned int baud;          // bit rate to switch to after response
+    unsigned char ring[SVC_PERSO_RINGSZ];
 } perso;
 
 // forward declarations
@@ -63,6 +84,16 @@ static void cb_reboot (osjob_t* job) {
     hal_reboot();
 }
 
+// switch bit rate after response has been sent (frames received in the
+// meantime are discarded, host must wait for the response)
+static void cb_baud (osjob_t* job) {
+    usart_stop_ring(BRD_PERSO_UART);
+    usart_start(BRD_PERSO_UART, perso.baud);
+    perso.rxn = 0;
+    usart_recv_ring(BRD_PERSO_UART, perso.ring, sizeof(perso.ring), &perso.rxjob, rx_done);
+    rx_start(job);
+}
+
 static void perso_process (osjob_t* job) {
     unsigned char* buf = perso.buf.bytes;
     perso.cb = rx_start; // by default, start receiving next command upon completion
@@ -77,11 +108,23 @@ static void perso_process (osjob_t* job) {
             perso.cb = cb_reboot;
             goto nopl;
 
+        case CMD_BAUD:
+            if( buf[OFF_LEN] == 4 ) {
+                unsigned int br = os_rlsbf4(buf + OFF_PAYLOAD);
+                if( br >= 9600 && br <= BRD_PERSO_UART_MAXBAUD ) {
+                    perso.baud = br;
+                    perso.cb = cb_baud;
+                    buf[OFF_CMD] = RES_OK;
+                    goto nopl;
+                }
+            }
+            goto eparam;
+
 #if defined(PERIPH_EEPROM) && defined(EEPROM_BASE) && defined(EEPROM_SZ)
         case CMD_EE_READ:
             if( buf[OFF_LEN] == 3 ) {
                 int off = os_rlsbf2(buf + OFF_PAYLOAD), len = buf[OFF_PAYLOAD + 2];
-                if( len < 128 && off + len <= EEPROM_SZ ) {
+                if( len <= MAX_PAYLOAD && off + len <= EEPROM_SZ ) {
                     memcpy(buf + OFF_PAYLOAD, (unsigned char*) EEPROM_BASE + off, len);
                     buf[OFF_CMD] = RES_OK;
                     buf[OFF_LEN] = len;
@@ -93,14 +136,30 @@ static void perso_process (osjob_t* job) {
         case CMD_EE_WRITE:
             if( buf[OFF_LEN] >= 2 ) {
                 int off = os_rlsbf2(buf + OFF_PAYLOAD), len = buf[OFF_LEN] - 4;
-                if( len < 128 && (len & 3) == 0 && off + len <= EEPROM_SZ ) {
+                if( len <= MAX_PAYLOAD - 4 && (len & 3) == 0 && off + len <= EEPROM_SZ ) {
                     eeprom_copy((unsigned char*) EEPROM_BASE + off, buf + OFF_PAYLOAD + 4, len);
+#ifdef HAL_PERSODATA_BASE
+                    // keep validated copy in RAM coherent
+                    hal_pd_reload(off - (int) (HAL_PERSODATA_BASE - EEPROM_BASE), len);
+#endif
                     buf[OFF_CMD] = RES_OK;
                     buf[OFF_LEN] = 0;
                     break;
                 }
             }
             goto eparam;
+
+        case CMD_EE_CRC:
+            if( buf[OFF_LEN] == 4 ) {
+                int off = os_rlsbf2(buf + OFF_PAYLOAD), len = os_rlsbf2(buf + OFF_PAYLOAD + 2);
+                if( ((off | len) & 3) == 0 && off + len <= EEPROM_SZ ) {
+                    os_wlsbf4(buf + OFF_PAYLOAD, crc32((unsigned char*) EEPROM_BASE + off, len >> 2));
+                    buf[OFF_CMD] = RES_OK;
+                    buf[OFF_LEN] = 4;
+                    break;
+                }
+            }
+            goto eparam;
 #endif
 
         default:
@@ -157,29 +216,49 @@ static void cobs_encode (unsigned char* buf, int len) {
     *buf = 0x00;
 }
 
+// continue with frames already received
 static void rx_start (osjob_t* job) {
-    perso.rxn = sizeof(perso.buf);
-    usart_recv(BRD_PERSO_UART, perso.buf.bytes, &perso.rxn, sec2osticks(3600), ms2osticks(100), job, rx_done);
+    perso.busy = false;
+    rx_done(&perso.rxjob);
 }
 
+// assemble frames from received data (in place in the ring buffer, up to and
+// including the 0x00 delimiter) and process the first valid one
 static void rx_done (osjob_t* job) {
-    int len = perso.rxn;
-    while( len > 0 ) {
-        int used;
-        int n = cobs_decode(perso.buf.bytes, len, &used);
-        if( n >= 8 && (n & 3) == 0 && 8 + ((perso.buf.bytes[OFF_LEN] + 3) & ~3) == n
-                && crc32(perso.buf.words, (n>>2)-1) == perso.buf.words[(n>>2)-1] ) {
-            perso_process(job);
-            return;
+    unsigned char* p;
+    int n;
+    while( !perso.busy && (n = usart_ring_peek(BRD_PERSO_UART, &p)) > 0 ) {
+        int i;
+        for( i = 0; i < n && p[i]; i++ );
+        bool eof = (i < n);
+        if( eof ) {
+            i += 1;
+        }
+        if( perso.rxn >= 0 && perso.rxn + i <= (int) sizeof(perso.buf.bytes) ) {
+            memcpy(perso.buf.bytes + perso.rxn, p, i);
+            perso.rxn += i;
+        } else {
+            perso.rxn = -1; // frame too long
+        }
+        usart_ring_consume(BRD_PERSO_UART, i);
+        if( eof ) {
+            int used, len = perso.rxn;
+            perso.rxn = 0;
+            if( len > 0 ) {
+                int n = cobs_decode(perso.buf.bytes, len, &used);
+                if( n >= 8 && (n & 3) == 0 && 8 + ((perso.buf.bytes[OFF_LEN] + 3) & ~3) == n
+                        && crc32(perso.buf.words, (n>>2)-1) == perso.buf.words[(n>>2)-1] ) {
+                    perso.busy = true;
+                    perso_process(job);
+                }
+            }
         }
-        memmove(perso.buf.bytes, perso.buf.bytes + used, (len -= used));
     }
-    rx_start(job);
 }
 
 static void tx_start (osjob_t* job) {
     int n = perso.buf.bytes[OFF_LEN] + 4;
-    ASSERT(n <= 236);
+    ASSERT(n <= OFF_PAYLOAD + MAX_PAYLOAD);
     while( (n & 3) != 0 ) {
         perso.buf.bytes[n++] = 0xff;
     }
@@ -209,7 +288,7 @@ bool _perso_main (osjob_t* job) {
         }
 #endif
         usart_start(BRD_PERSO_UART, BRD_PERSO_UART_BAUDRATE);
-        rx_start(job);
+        usart_recv_ring(BRD_PERSO_UART, perso.ring, sizeof(perso.ring), &perso.rxjob, rx_done);
     }
 
     return enter_perso;
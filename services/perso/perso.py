@@ -3,11 +3,13 @@
 # This file is subject to the terms and conditions defined in file 'LICENSE',
 # which is part of this source code package.
 
-from typing import Optional, Tuple, Union
+from typing import Iterable, Iterator, List, Optional, Tuple, Union
 
 import asyncio
+import collections
 import hashlib
 import random
+import secrets
 import struct
 
 from binascii import crc32
@@ -22,15 +24,22 @@ class PTESerialPort:
     async def recv(self) -> bytes:
         raise NotImplementedError
 
+    def set_baudrate(self, baudrate:int) -> None:
+        pass
+
 class PTE:
-    def __init__(self, port:PTESerialPort, *, timeout:Optional[float]=5.0) -> None:
+    MAX_PAYLOAD = 236
+
+    def __init__(self, port:PTESerialPort, *, timeout:Optional[float]=5.0, window:int=2) -> None:
         self.port = port
         self.tag = random.randint(0x0000, 0xffff)
         self.sync = False
         self.timeout = timeout
+        self.window = window
+        self.rxbuf = b''
 
     def pack(self, cmd:int, payload:bytes) -> bytes:
-        assert len(payload) <= 236
+        assert len(payload) <= PTE.MAX_PAYLOAD
         self.tag = (self.tag + 1) & 0xffff
         l = len(payload)
         p = struct.pack('<BHB', cmd, self.tag, l) + payload
@@ -39,7 +48,7 @@ class PTE:
         p += struct.pack('<I', crc32(p))
         return p
 
-    def unpack(self, frame:bytes) -> Optional[Tuple[int,bytes]]:
+    def unpack(self, frame:bytes) -> Optional[Tuple[int,int,bytes]]:
         n = len(frame)
         if n < 8:
             return None
@@ -47,47 +56,77 @@ class PTE:
         crc, = struct.unpack('<I', frame[-4:])
         if 8 + ((l + 3) & ~3) != n or crc != crc32(frame[:-4]):
             return None
-        return res, frame[4:4+l]
+        return res, tag, frame[4:4+l]
 
     @staticmethod
     def frame(frame:bytes) -> bytes:
         return frame + b'\0'
 
-    @staticmethod
-    def unframe(buf:bytes) -> Tuple[bytes,bytes]:
-        n = len(buf)
-        i = buf.find(b'\0')
-        if i < 0:
-            return b'', b''
-        else:
-            return buf[:i], buf[i+1:]
-
-    async def _xchg(self, cmd:int, payload:bytes=b'') -> Tuple[int,bytes]:
+    # encode command, returns tag and frame
+    def encode(self, cmd:int, payload:bytes=b'') -> Tuple[int,bytes]:
         p = PTE.frame(cobs.encode(self.pack(cmd, payload)))
         if not self.sync:
             self.sync = True
             p = b'\x55\0\0\0' + p
-        self.port.send(p)
+        return self.tag, p
+
+    # next valid response (res, tag, payload), incomplete frames are kept
+    async def recv(self) -> Tuple[int,int,bytes]:
         while True:
-            b = await self.port.recv()
-            while b:
-                f, b = PTE.unframe(b)
+            while (i := self.rxbuf.find(b'\0')) >= 0:
+                f, self.rxbuf = self.rxbuf[:i], self.rxbuf[i+1:]
                 try:
                     f = cobs.decode(f)
                 except cobs.DecodeError:
                     continue
                 if (t := self.unpack(f)):
                     return t
+            self.rxbuf += await self.port.recv()
+
+    async def _xchg(self, cmd:int, payload:bytes=b'') -> Tuple[int,bytes]:
+        tag, p = self.encode(cmd, payload)
+        self.port.send(p)
+        while True:
+            res, t, pl = await self.recv()
+            if t == tag:
+                return res, pl
 
     async def xchg(self, cmd:int, payload:bytes=b'') -> Tuple[int,bytes]:
         return await asyncio.wait_for(self._xchg(cmd, payload), timeout=self.timeout)
 
+    # Pipelined exchange: keep up to window commands in flight, the device
+    # processes them in order; responses are matched by tag. A dropped frame
+    # results in a time-out.
+    async def xchg_many(self, cmds:Iterable[Tuple[int,bytes]]) -> List[Tuple[int,bytes]]:
+        it = iter(cmds)
+        pending:collections.deque = collections.deque()
+        results:List[Tuple[int,bytes]] = []
+        def fill() -> None:
+            data = b''
+            while len(pending) < self.window and (c := next(it, None)) is not None:
+                tag, p = self.encode(*c)
+                pending.append(tag)
+                data += p
+            if data:
+                self.port.send(data)
+        fill()
+        while pending:
+            res, t, pl = await asyncio.wait_for(self.recv(), timeout=self.timeout)
+            if t != pending[0]:
+                continue
+            pending.popleft()
+            results.append((res, pl))
+            fill()
+        return results
+
     CMD_NOP      = 0x00
     CMD_RUN      = 0x01
     CMD_RESET    = 0x02
+    CMD_BAUD     = 0x03
 
     CMD_EE_READ  = 0x90
     CMD_EE_WRITE = 0x91
+    CMD_EE_CRC   = 0x92
 
     RES_OK       = 0x00
     RES_EPARAM   = 0x80
@@ -129,6 +168,44 @@ class PTE:
         res, pl = await self.xchg(PTE.CMD_EE_WRITE, struct.pack('<HH', offset, 0) + data)
         PTE.check_res(res, expected=PTE.RES_OK)
 
+    async def ee_crc(self, offset:int, length:int) -> int:
+        res, pl = await self.xchg(PTE.CMD_EE_CRC, struct.pack('<HH', offset, length))
+        PTE.check_res(res, expected=PTE.RES_OK)
+        if pl is None or len(pl) != 4:
+            raise ValueError(f'Unexpected response payload length {len(pl) if pl else 0}')
+        return struct.unpack('<I', pl)[0]
+
+    # switch device and host to given bit rate
+    async def set_baudrate(self, baudrate:int) -> None:
+        res, pl = await self.xchg(PTE.CMD_BAUD, struct.pack('<I', baudrate))
+        PTE.check_res(res, expected=PTE.RES_OK)
+        self.port.set_baudrate(baudrate)
+        self.rxbuf = b''
+
+    async def ee_read_bulk(self, offset:int, length:int) -> bytes:
+        n = PTE.MAX_PAYLOAD
+        cmds = [(PTE.CMD_EE_READ, struct.pack('<HB', o, min(n, offset + length - o)))
+                for o in range(offset, offset + length, n)]
+        data = b''
+        for (res, pl), (_, c) in zip(await self.xchg_many(cmds), cmds):
+            PTE.check_res(res, expected=PTE.RES_OK)
+            if len(pl) != c[2]:
+                raise ValueError(f'Unexpected response payload length {len(pl)}')
+            data += pl
+        return data
+
+    # pipelined write of a whole image, verified by CRC-32 read back from device
+    async def ee_write_bulk(self, offset:int, data:bytes) -> None:
+        if (offset | len(data)) & 3:
+            raise ValueError('Offset and length must be multiples of 4')
+        n = PTE.MAX_PAYLOAD - 4
+        cmds = [(PTE.CMD_EE_WRITE, struct.pack('<HH', offset + o, 0) + data[o:o+n])
+                for o in range(0, len(data), n)]
+        for res, pl in await self.xchg_many(cmds):
+            PTE.check_res(res, expected=PTE.RES_OK)
+        if (crc := await self.ee_crc(offset, len(data))) != crc32(data):
+            raise ValueError(f'CRC mismatch after write (device: 0x{crc:08x}, expected: 0x{crc32(data):08x})')
+
 class PersoData:
     V1_MAGIC = 0xb2dc4db2
     V1_FORMAT_NH = '<IIII16s8s8s16s16s'
@@ -179,3 +256,39 @@ class PersoDataV1:
                 self.appkey)
         h = hashlib.sha256(pd).digest()
         return pd + h
+
+
+# Batch generator for a production lot: sequential DevEUIs, random keys,
+# serial numbers derived from lot name and index. The packed images are
+# ready to be flashed at the persodata offset (0x60) of the EEPROM.
+@dataclass
+class PersoLot:
+    lot:str
+    deveui:Eui                  # first DevEUI of lot
+    joineui:Eui
+    hwid:int = 0
+    region:int = 0
+    appkey:bool = True          # separate random AppKey (otherwise AppKey=NwkKey)
+
+    def generate(self, count:int) -> Iterator[PersoDataV1]:
+        base = self.deveui.as_int()
+        for idx in range(count):
+            nwkkey = secrets.token_bytes(16)
+            appkey = secrets.token_bytes(16) if self.appkey else nwkkey
+            serial = f'{self.lot}{idx:05d}'
+            if len(serial) > 16:
+                raise ValueError(f'Serial number too long: {serial}')
+            h = f'{base + idx:016X}'
+            yield PersoDataV1(self.hwid, self.region, serial, Eui('-'.join(h[i:i+2] for i in range(0, 16, 2))),
+                    self.joineui, nwkkey, appkey)
+
+    # Intel HEX image of personalization data at given address
+    @staticmethod
+    def hexfile(pd:PersoDataV1, addr:int) -> str:
+        import intelhex
+        import io
+        ih = intelhex.IntelHex()
+        ih.frombytes(pd.pack(), offset=addr)
+        f = io.StringIO()
+        ih.write_hex_file(f)
+        return f.getvalue()
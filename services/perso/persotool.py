@@ -10,9 +10,11 @@ from typing import Optional
 import aioserial
 import asyncio
 import click
+import csv
 import functools
+import os
 
-from perso import PTE, PTESerialPort, PersoData, PersoDataV1
+from perso import PTE, PTESerialPort, PersoData, PersoDataV1, PersoLot
 from rtlib import Eui
 
 class PhysicalPTESerialPort(PTESerialPort):
@@ -25,6 +27,9 @@ class PhysicalPTESerialPort(PTESerialPort):
     async def recv(self) -> bytes:
         return await self.serial.read_until_async(b'\0')
 
+    def set_baudrate(self, baudrate:int) -> None:
+        self.serial.baudrate = baudrate
+
 
 class BasedIntParamType(click.ParamType):
     name = "integer"
@@ -74,9 +79,20 @@ def coro(f):
         help='serial port')
 @click.option('-b', '--baud', type=int, default=115200,
         help='baud rate')
+@click.option('-f', '--fast', type=int, default=None,
+        help='switch to this baud rate before running command')
+@click.option('-w', '--window', type=int, default=2,
+        help='number of commands in flight for bulk transfers')
 @click.pass_context
-def cli(ctx:click.Context, port:str, baud:int) -> None:
-    ctx.obj['pte'] = PTE(PhysicalPTESerialPort(port, baud))
+def cli(ctx:click.Context, port:str, baud:int, fast:Optional[int], window:int) -> None:
+    ctx.obj['pte'] = PTE(PhysicalPTESerialPort(port, baud), window=window)
+    ctx.obj['fast'] = fast
+
+async def connect(ctx:click.Context) -> PTE:
+    pte = ctx.obj['pte']
+    if ctx.obj['fast']:
+        await pte.set_baudrate(ctx.obj['fast'])
+    return pte
 
 
 @cli.command(help='Read personalization data from EEPROM')
@@ -87,7 +103,7 @@ def cli(ctx:click.Context, port:str, baud:int) -> None:
 @click.pass_context
 @coro
 async def pdread(ctx:click.Context, offset:int, show_keys:bool):
-    pte = ctx.obj['pte']
+    pte = await connect(ctx)
     pd = PersoData.unpack(await pte.ee_read(offset, PersoData.V1_SIZE))
     print(f'Hardware ID: 0x{pd.hwid:08x}')
     print(f'Region ID:   0x{pd.region:08x} ({pd.region})')
@@ -105,7 +121,7 @@ async def pdread(ctx:click.Context, offset:int, show_keys:bool):
 @click.pass_context
 @coro
 async def pdclear(ctx:click.Context, offset:int):
-    pte = ctx.obj['pte']
+    pte = await connect(ctx)
     pd = PersoData.unpack(await pte.ee_read(offset, PersoData.V1_SIZE))
     await pte.ee_write(offset, bytes(PersoData.V1_SIZE))
 
@@ -125,10 +141,69 @@ async def pdclear(ctx:click.Context, offset:int):
 @click.pass_context
 @coro
 async def pdwrite(ctx:click.Context, offset:int, hwid:int, region:int, serialno:str, deveui:Eui, joineui:Eui, nwkkey:bytes, appkey:Optional[bytes]):
-    pte = ctx.obj['pte']
+    pte = await connect(ctx)
     if appkey is None:
         appkey = nwkkey
-    await pte.ee_write(offset, PersoDataV1(hwid, region, serialno, deveui, joineui, nwkkey, appkey).pack())
+    await pte.ee_write_bulk(offset, PersoDataV1(hwid, region, serialno, deveui, joineui, nwkkey, appkey).pack())
+
+
+@cli.command(help='Generate personalization images for a production lot')
+@click.option('--hwid', type=BASED_INT, default=0,
+        help='Hardware ID')
+@click.option('--region', type=BASED_INT, default=0,
+        help='Region ID')
+@click.option('-n', '--count', type=int, required=True,
+        help='Number of devices')
+@click.option('-a', '--address', type=BASED_INT, default=0x08080060,
+        help='Flash address of personalization data for HEX files')
+@click.option('-d', '--outdir', type=click.Path(file_okay=False), default='.',
+        help='Output directory')
+@click.option('--binary', is_flag=True,
+        help='Write raw binary images instead of HEX files')
+@click.option('--same-keys', is_flag=True,
+        help='Use the network key as application key')
+@click.argument('lot', type=str)
+@click.argument('deveui', type=EUI)
+@click.argument('joineui', type=EUI)
+@click.pass_context
+def pdgen(ctx:click.Context, hwid:int, region:int, count:int, address:int, outdir:str,
+        binary:bool, same_keys:bool, lot:str, deveui:Eui, joineui:Eui):
+    os.makedirs(outdir, exist_ok=True)
+    pl = PersoLot(lot, deveui, joineui, hwid=hwid, region=region, appkey=not same_keys)
+    with open(os.path.join(outdir, f'{lot}.csv'), 'w', newline='') as f:
+        w = csv.writer(f)
+        w.writerow(('serial', 'deveui', 'joineui', 'nwkkey', 'appkey'))
+        for pd in pl.generate(count):
+            if binary:
+                with open(os.path.join(outdir, f'{pd.serial}.bin'), 'wb') as b:
+                    b.write(pd.pack())
+            else:
+                with open(os.path.join(outdir, f'{pd.serial}.hex'), 'w') as h:
+                    h.write(PersoLot.hexfile(pd, address))
+            w.writerow((pd.serial, pd.deveui, pd.joineui, pd.nwkkey.hex(), pd.appkey.hex()))
+
+
+@cli.command(help='Write image file to EEPROM (pipelined, CRC verified)')
+@click.option('-o', '--offset', type=BASED_INT, default=0x0000,
+        help='Offset in EEPROM')
+@click.argument('image', type=click.File('rb'))
+@click.pass_context
+@coro
+async def eewrite(ctx:click.Context, offset:int, image):
+    pte = await connect(ctx)
+    await pte.ee_write_bulk(offset, image.read())
+
+
+@cli.command(help='Read EEPROM contents to image file')
+@click.option('-o', '--offset', type=BASED_INT, default=0x0000,
+        help='Offset in EEPROM')
+@click.argument('length', type=BASED_INT)
+@click.argument('image', type=click.File('wb'))
+@click.pass_context
+@coro
+async def eeread(ctx:click.Context, offset:int, length:int, image):
+    pte = await connect(ctx)
+    image.write(await pte.ee_read_bulk(offset, length))
 
 
 if __name__ == '__main__':
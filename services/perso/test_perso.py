@@ -7,7 +7,7 @@ import asyncio
 
 from devtest import vtime, DeviceTest
 from peripherals import FastUART, GPIO
-from perso import PTE, PTESerialPort, PersoData, PersoDataV1
+from perso import PTE, PTESerialPort, PersoData, PersoDataV1, PersoLot
 from rtlib import Eui
 
 from ward import fixture, test
@@ -93,3 +93,37 @@ async def _(pte=createtest):
     await pte.reset()
     await pte.dut.join(deveui=deveui, nwkkey=nwkkey)
     await pte.dut.updf()
+
+
+@test('Bulk Read/Write EEPROM Commands')
+async def _(pte=createtest):
+    pte.activate(True)
+    await asyncio.sleep(1)
+
+    # Pipelined write of an image spanning several frames, verified by CRC
+    pte.window = 3
+    image = bytes((i * 7) & 0xff for i in range(1024))
+    await pte.ee_write_bulk(0x0400, image)
+    assert await pte.ee_read_bulk(0x0400, len(image)) == image
+
+    # Bit rate change (no effect in simulation) keeps session going
+    await pte.set_baudrate(921600)
+    await pte.nop()
+
+
+@test('Production Lot Image')
+async def _(pte=createtest):
+    pte.activate(True)
+    await asyncio.sleep(1)
+
+    # Flash one generated image of a lot
+    lot = PersoLot('LOT-', Eui('01-02-03-04-05-06-00-00'), Eui('F1-F2-F3-F4-F5-F6-F7-F8'))
+    pd = list(lot.generate(4))[3]
+    assert pd.serial == 'LOT-00003'
+    await pte.ee_write_bulk(0x0060, pd.pack())
+    assert PersoData.unpack(await pte.ee_read(0x0060, PersoData.V1_SIZE)) == pd
+
+    # Reset and verify device joins with lot settings
+    await pte.reset()
+    await pte.dut.join(deveui=pd.deveui, nwkkey=pd.nwkkey)
+    await pte.dut.updf()
@@ -10,10 +10,20 @@
 #include "eefs/eefs.h"
 #include "pwrman.h"
 
-#include "svcdefs.h" // for type-checking hook functions
+#include "svcdefs_eefs_init.h" // for type-checking hook functions
+#include "svcdefs_eefs_fn.h"
 
 // our basic unit is the micro-ampere hour -- 2^32 uAh = 4295 Ah
 
+// number of job callbacks to attribute run time to (CFG_jobstats)
+#ifndef SVC_PWRMAN_JOBS
+#define SVC_PWRMAN_JOBS 8
+#endif
+
+#if defined(CFG_jobstats) && defined(BRD_PWR_RUN_UA)
+#define PWRMAN_JOBSTATS
+#endif
+
 // 16bc26f9da64e290-05b08ee7
 static const uint8_t UFID_PWRMAN_STATS[12] = { 0x90, 0xe2, 0x64, 0xda, 0xf9, 0x26, 0xbc, 0x16, 0xe7, 0x8e, 0xb0, 0x05 };
 
@@ -24,15 +34,27 @@ const char* _pwrman_eefs_fn (const uint8_t* ufid) {
     return NULL;
 }
 
+// Charge is accumulated as uA*ticks in a 64-bit residue; adding is cheap and
+// the (slow on Cortex-M0+) 64-bit division to micro-ampere hours is only done
+// when the residue overflows 32 bits, or before the totals are read.
 typedef struct {
     uint32_t hr;
-    uint32_t ticks;
+    uint64_t uaticks;
 } ptime;
 
+#define UAH_TICKS       ((uint32_t) OSTICKS_PER_SEC * 60 * 60)
+_Static_assert((uint64_t) OSTICKS_PER_SEC * 60 * 60 <= UINT32_MAX, "ticks per hour exceed 32 bits");
+
 // Volatile state
 static struct {
     ptime accu;                // accumulator
     ptime stats[PWRMAN_C_MAX]; // consumption statistics
+#if defined(PWRMAN_JOBSTATS)
+    struct {
+        osjobcb_t func;        // job callback (NULL: other, last entry only)
+        uint64_t uaticks;      // attributed charge
+    } jobs[SVC_PWRMAN_JOBS];
+#endif
 } state;
 
 // Persistent state (eefs)
@@ -43,28 +65,33 @@ typedef struct {
 
 static void update_rtstats (void); // fwd decl
 
-static void add (ptime* ppt, uint64_t uaticks) {
-    uaticks += ppt->ticks;
-    uint32_t uah = uaticks / (OSTICKS_PER_SEC * 60  * 60);
-    if( uah != 0 ) {
+static void normalize (ptime* ppt) {
+    if( ppt->uaticks >= UAH_TICKS ) {
+        uint32_t uah = ppt->uaticks / UAH_TICKS;
         ppt->hr += uah;
-	uaticks -= ((int64_t) uah * (OSTICKS_PER_SEC * 60 * 60));
+        ppt->uaticks -= (uint64_t) uah * UAH_TICKS;
+    }
+}
+
+static void add (ptime* ppt, uint64_t uaticks) {
+    ppt->uaticks += uaticks;
+    if( (ppt->uaticks >> 32) != 0 ) {
+        normalize(ppt);
     }
-    ppt->ticks = uaticks;
 }
 
 void pwrman_consume (int ctype, uint32_t ticks, uint32_t ua) {
     ASSERT(ctype < PWRMAN_C_MAX);
     uint64_t uaticks = (uint64_t) ticks * ua;
 #ifdef CFG_DEBUG_pwrman
-    debug_printf("pwrman: adding %u ticks to accu (%d/%d",
+    debug_printf("pwrman: adding %u ticks to accu (%d/%u",
             (uint32_t) uaticks,
-            state.accu.hr, state.accu.ticks);
+            state.accu.hr, (uint32_t) state.accu.uaticks);
 #endif
     add(&state.accu, uaticks);
 #ifdef CFG_DEBUG_pwrman
-    debug_printf(" --> %d/%d)\r\n",
-            state.accu.hr, state.accu.ticks);
+    debug_printf(" --> %d/%u)\r\n",
+            state.accu.hr, (uint32_t) state.accu.uaticks);
 #endif
     add(&state.stats[ctype], uaticks);
 }
@@ -81,19 +108,69 @@ void pwrman_commit (void) {
     for( int i = 0; i < PWRMAN_C_MAX; i++ ) {
         ps.uah_stats[i] = state.stats[i].hr;
     }
-    eefs_save(UFID_PWRMAN_STATS, &ps, sizeof(ps));
+    eefs_log_save(UFID_PWRMAN_STATS, &ps, sizeof(ps));
+}
+
+static uint8_t* put_varint (uint8_t* p, uint8_t* end, uint32_t v) {
+    do {
+        if( p == end ) {
+            return NULL;
+        }
+        *p++ = (v & 0x7f) | ((v > 0x7f) ? 0x80 : 0);
+        v >>= 7;
+    } while( v );
+    return p;
+}
+
+int pwrman_report (uint8_t* buf, int max) {
+    update_rtstats();
+    uint8_t* end = buf + max;
+    uint8_t* p = buf;
+    uint8_t* q;
+    if( max < 1 || (q = put_varint(buf + 1, end, state.accu.hr)) == NULL ) {
+        return 0;
+    }
+    *p = 0x01; // version
+    p = q;
+    for( int i = 0; i < PWRMAN_C_MAX; i++ ) {
+        if( state.stats[i].hr && p < end && (q = put_varint(p + 1, end, state.stats[i].hr)) ) {
+            *p = i;
+            p = q;
+        }
+    }
+#if defined(PWRMAN_JOBSTATS)
+    for( int i = 0; i < SVC_PWRMAN_JOBS; i++ ) {
+        if( state.jobs[i].uaticks == 0 || end - p < 5 ) {
+            continue;
+        }
+        uint64_t uas = state.jobs[i].uaticks / OSTICKS_PER_SEC;
+        uint32_t func = (uint32_t) (uintptr_t) state.jobs[i].func;
+        if( (q = put_varint(p + 5, end, (uas > UINT32_MAX) ? UINT32_MAX : uas)) ) {
+            p[0] = 0x80 | i;
+            p[1] = func;
+            p[2] = func >> 8;
+            p[3] = func >> 16;
+            p[4] = func >> 24;
+            p = q;
+        }
+    }
+#endif
+    return p - buf;
 }
 
 void pwrman_reset (void) {
     memset(&state, 0x00, sizeof(state));
     pwrman_pstate ps;
     memset(&ps, 0x00, sizeof(ps));
-    eefs_save(UFID_PWRMAN_STATS, &ps, sizeof(ps));
+    eefs_log_save(UFID_PWRMAN_STATS, &ps, sizeof(ps));
 }
 
 void _pwrman_init (void) {
     pwrman_pstate ps;
-    if( eefs_read(UFID_PWRMAN_STATS, &ps, sizeof(ps)) == sizeof(ps) ) {
+    memset(&ps, 0x00, sizeof(ps));
+    // categories are only ever appended, so shorter records are still valid
+    int len = eefs_log_read(UFID_PWRMAN_STATS, &ps, sizeof(ps));
+    if( len >= (int) sizeof(uint32_t) && len <= (int) sizeof(ps) && (len & 3) == 0 ) {
         state.accu.hr = ps.uah_accu;
         for( int i = 0; i < PWRMAN_C_MAX; i++ ) {
             state.stats[i].hr = ps.uah_stats[i];
@@ -101,7 +178,30 @@ void _pwrman_init (void) {
     }
 }
 
+#if defined(PWRMAN_JOBSTATS)
+// attribute MCU run time of jobs to their callbacks (consumes the job statistics)
+static void update_jobstats (void) {
+    os_jobstats stats[OS_JOBSTATS_MAX];
+    int n = os_jobstats_collect(stats, OS_JOBSTATS_MAX);
+    for( int i = 0; i < n; i++ ) {
+        int j;
+        for( j = 0; j < SVC_PWRMAN_JOBS - 1; j++ ) {
+            if( state.jobs[j].func == stats[i].func || state.jobs[j].func == NULL ) {
+                break;
+            }
+        }
+        if( j < SVC_PWRMAN_JOBS - 1 ) {
+            state.jobs[j].func = stats[i].func;
+        }
+        state.jobs[j].uaticks += (uint64_t) stats[i].runtime * BRD_PWR_RUN_UA;
+    }
+}
+#endif
+
 static void update_rtstats (void) {
+#if defined(PWRMAN_JOBSTATS)
+    update_jobstats();
+#endif
 #if defined(STM32L0) && defined(CFG_rtstats)
     hal_rtstats stats;
     hal_rtstats_collect(&stats);
@@ -109,5 +209,16 @@ static void update_rtstats (void) {
     pwrman_consume(PWRMAN_C_SLEEP, stats.sleep_ticks[HAL_SLEEP_S0], BRD_PWR_S0_UA);
     pwrman_consume(PWRMAN_C_SLEEP, stats.sleep_ticks[HAL_SLEEP_S1], BRD_PWR_S1_UA);
     pwrman_consume(PWRMAN_C_SLEEP, stats.sleep_ticks[HAL_SLEEP_S2], BRD_PWR_S2_UA);
+#if defined(CFG_spi_dma) && defined(CFG_DEBUG_pwrman)
+    // radio FIFO transfers are already accounted as S0 above, report savings vs. busy-wait
+    if( stats.spidma_ticks ) {
+        debug_printf("pwrman: spi dma %u ticks in S0, saved %u uA*ticks\r\n",
+                stats.spidma_ticks, stats.spidma_ticks * (BRD_PWR_RUN_UA - BRD_PWR_S0_UA));
+    }
+#endif
 #endif
+    normalize(&state.accu);
+    for( int i = 0; i < PWRMAN_C_MAX; i++ ) {
+        normalize(&state.stats[i]);
+    }
 }
@@ -9,20 +9,47 @@
 enum {
     PWRMAN_C_RUN,       // MCU run
     PWRMAN_C_SLEEP,     // MCU sleep
-    PWRMAN_C_RX,        // radio RX
-    PWRMAN_C_TX,        // radio TX
+    PWRMAN_C_RX,        // radio RX (receive windows)
+    PWRMAN_C_TX,        // radio TX (up to PWRMAN_TX_LO dBm)
     PWRMAN_C_APP1,      // application-specific 1
     PWRMAN_C_APP2,      // application-specific 2
     PWRMAN_C_APP3,      // application-specific 3
     PWRMAN_C_APP4,      // application-specific 4
+    PWRMAN_C_RXC,       // radio RX (continuous, class C)
+    PWRMAN_C_TX_MID,    // radio TX (up to PWRMAN_TX_MID dBm)
+    PWRMAN_C_TX_HI,     // radio TX (above PWRMAN_TX_MID dBm)
+    PWRMAN_C_NVM,       // flash/EEPROM programming (in addition to MCU)
 
     PWRMAN_C_MAX
 };
 
+// TX power level classes (dBm)
+#define PWRMAN_TX_LO    10
+#define PWRMAN_TX_MID   16
+
+static inline int pwrman_txclass (int dbm) {
+    return (dbm <= PWRMAN_TX_LO) ? PWRMAN_C_TX
+        : (dbm <= PWRMAN_TX_MID) ? PWRMAN_C_TX_MID : PWRMAN_C_TX_HI;
+}
+
 void pwrman_consume (int ctype, uint32_t ticks, uint32_t ua);
 void pwrman_commit (void);
 void pwrman_reset (void);
 
 uint32_t pwrman_accu_uah (void);
 
+// Build compact consumption report (e.g. for an uplink), returns length.
+//
+//   version (1 byte, 0x01)
+//   total uAh (varint)
+//   per non-zero category:  ctype (1 byte), uAh (varint)
+//   per job callback:       0x80|index (1 byte), func (4 bytes LE), uAs (varint)
+//
+// Varints are LEB128 (7 bits per byte, LSB first, MSB set if more follow).
+// Category totals are persistent; job charges (available with CFG_jobstats)
+// are MCU run time attributed to job callbacks since boot or the last
+// pwrman_reset() and are a breakdown of PWRMAN_C_RUN, not in addition to it.
+// Entries that do not fit into the buffer are omitted.
+int pwrman_report (uint8_t* buf, int max);
+
 #endif
@@ -0,0 +1,58 @@
+// Copyright (C) 2020-2022 Michael Kuyper. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#include <string.h>
+
+#include "lmic.h"
+#include "eefs/eefs.h"
+
+#include "rampup.h"
+
+#include "svcdefs_eefs_init.h" // for type-checking hook functions
+#include "svcdefs_eefs_fn.h"
+
+#if !defined(CFG_rxrampup_adapt)
+#error "rampup service requires CFG_rxrampup_adapt"
+#endif
+
+#ifndef RAMPUP_SAVE_DELTA
+#define RAMPUP_SAVE_DELTA       us2osticksCeil(100)
+#endif
+
+// 1a138c17870e2170-88b6324d
+static const uint8_t UFID_RAMPUP_EST[12] = {
+    0x70, 0x21, 0x0e, 0x87, 0x17, 0x8c, 0x13, 0x1a, 0x4d, 0x32, 0xb6, 0x88
+};
+
+static int32_t saved = -1;
+
+void rampup_commit (void) {
+    int32_t est = radio_getRxRampupEst();
+    if( est >= 0 && (saved < 0 || est - saved > RAMPUP_SAVE_DELTA || saved - est > RAMPUP_SAVE_DELTA) ) {
+        if( eefs_save(UFID_RAMPUP_EST, &est, sizeof(est)) >= 0 ) {
+            saved = est;
+        }
+    }
+}
+
+void rampup_reset (void) {
+    eefs_rm(UFID_RAMPUP_EST);
+    saved = -1;
+}
+
+void _rampup_init (void) {
+    int32_t est;
+    if( eefs_read(UFID_RAMPUP_EST, &est, sizeof(est)) == sizeof(est) ) {
+        radio_setRxRampupEst(est);
+        saved = est;
+    }
+}
+
+const char* _rampup_eefs_fn (const uint8_t* ufid) {
+    if( memcmp(ufid, UFID_RAMPUP_EST, sizeof(UFID_RAMPUP_EST)) == 0 ) {
+        return "ch.mkdata.svc.rampup.est";
+    }
+    return NULL;
+}
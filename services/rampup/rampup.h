@@ -0,0 +1,14 @@
+// Copyright (C) 2020-2022 Michael Kuyper. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#ifndef _rampup_h_
+#define _rampup_h_
+
+// Persist measured RX ramp-up time (requires CFG_rxrampup_adapt). The stored
+// value is only updated if it differs by more than RAMPUP_SAVE_DELTA ticks.
+void rampup_commit (void);
+void rampup_reset (void);
+
+#endif
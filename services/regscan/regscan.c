@@ -0,0 +1,212 @@
+// Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+// Region discovery before the first join.
+//
+// For each region, the radio does back-to-back CADs on the RX2 frequency,
+// cycling through REGSCAN_NDR data rates starting at the RX2 data rate, for
+// REGSCAN_DWELL_MS. Whenever a preamble is detected the frame is received;
+// valid downlink frames (data or join accept from any gateway) count for the
+// region. The region with the most frames (stronger RSSI on a tie) wins and
+// is persisted. If nothing is heard, the join goes ahead in the next region
+// in turn and the scan is repeated before the following join attempt.
+//
+// Regions that share an RX2 channel (e.g. US915 and AU915) cannot be told
+// apart; the first one compiled in wins.
+
+#include <string.h>
+
+#include "lmic.h"
+#include "lwmux/lwmux.h"
+#include "eefs/eefs.h"
+
+#include "regscan.h"
+
+#include "svcdefs_eefs_init.h" // for type-checking hook functions
+#include "svcdefs_eefs_fn.h"
+#include "svcdefs_lwm_event.h"
+#include "svcdefs_lwm_join_defer.h"
+#include "svcdefs_lwm_join_region.h"
+
+#ifndef REGSCAN_DWELL_MS
+#define REGSCAN_DWELL_MS        4000    // listening time per region
+#endif
+#ifndef REGSCAN_NDR
+#define REGSCAN_NDR             4       // number of data rates probed
+#endif
+#ifndef REGSCAN_JOINFAIL
+#define REGSCAN_JOINFAIL        3       // failed join cycles before region is dropped
+#endif
+
+#define REGSCAN_RXSYMS          12      // symbol timeout after preamble detection
+
+// 1a1396272d7071c0-7f432323
+static const uint8_t UFID_REGSCAN[12] = {
+    0xc0, 0x71, 0x70, 0x2d, 0x27, 0x96, 0x13, 0x1a, 0x23, 0x23, 0x43, 0x7f
+};
+
+const char* _regscan_eefs_fn (const uint8_t* ufid) {
+    if( memcmp(ufid, UFID_REGSCAN, sizeof(UFID_REGSCAN)) == 0 ) {
+        return "ch.mkdata.svc.regscan";
+    }
+    return NULL;
+}
+
+// persistent state (stored in EEFS)
+typedef struct {
+    uint8_t regcode;            // discovered region (0 if unknown)
+    uint8_t confirmed;          // joined successfully in region
+    uint8_t fails;              // failed join cycles while not confirmed
+} pstate;
+
+static struct {
+    pstate ps;                  // persistent state
+    bool done;                  // scan complete, let next join attempt proceed
+    int fallback;               // region index to join in if nothing was heard
+
+    // scan in progress
+    int ridx;                   // region index
+    int probe;                  // probe counter (selects data rate)
+    ostime_t tend;              // end of dwell time in region
+    struct {
+        unsigned int frames;    // downlink frames heard
+        int rssi;               // strongest RSSI
+    } score[REGIONS_COUNT];
+} state;
+
+static void save (void) {
+    eefs_log_save(UFID_REGSCAN, &state.ps, sizeof(state.ps));
+}
+
+static bool is_downlink (void) {
+    switch( LMIC.frame[0] & HDR_FTYPE ) {
+        case HDR_FTYPE_JACC:
+        case HDR_FTYPE_DADN:
+        case HDR_FTYPE_DCDN:
+            return LMIC.dataLen >= 12; // MHDR, FHDR, MIC (join accept: 17)
+        default:
+            return false;
+    }
+}
+
+static void cad_done (osjob_t* job);
+
+static void cad_start (void) {
+    dr_t dr;
+    rps_t rps;
+    do {
+        dr = LMIC.region->rx2Dr + (state.probe++ % REGSCAN_NDR);
+    } while( (rps = LMIC_dndr2rps(dr)) == ILLEGAL_RPS );
+    LMIC.freq = LMIC.region->rx2Freq;
+    LMIC.rps = rps;
+    LMIC.rxsyms = REGSCAN_RXSYMS;
+    LMIC.dataLen = 0;
+    LMIC.osjob.func = cad_done;
+    os_radio(RADIO_CAD);
+}
+
+static void region_start (void) {
+    LMIC_reset_ex(LMIC_regionCode(state.ridx));
+    state.probe = 0;
+    state.tend = os_getTime() + ms2osticks(REGSCAN_DWELL_MS);
+    debug_printf("regscan: listening in region %d\r\n", LMIC_regionCode(state.ridx));
+    cad_start();
+}
+
+static void scan_done (void) {
+    int best = -1;
+    for( int i = 0; i < REGIONS_COUNT; i++ ) {
+        if( state.score[i].frames && (best < 0 || state.score[i].frames > state.score[best].frames
+                    || (state.score[i].frames == state.score[best].frames
+                        && state.score[i].rssi > state.score[best].rssi)) ) {
+            best = i;
+        }
+    }
+    if( best >= 0 ) {
+        state.ps.regcode = LMIC_regionCode(best);
+        state.ps.confirmed = 0;
+        state.ps.fails = 0;
+        save();
+        debug_printf("regscan: region %d (%d frames, rssi %d)\r\n",
+                state.ps.regcode, state.score[best].frames, state.score[best].rssi - RSSI_OFF);
+    } else {
+        debug_printf("regscan: nothing heard\r\n");
+    }
+    state.done = true;
+    lwm_join_resume();
+}
+
+static void cad_done (osjob_t* job) {
+    if( LMIC.dataLen && is_downlink() ) {
+        if( state.score[state.ridx].frames++ == 0 || LMIC.rssi > state.score[state.ridx].rssi ) {
+            state.score[state.ridx].rssi = LMIC.rssi;
+        }
+    }
+    if( os_getTime() - state.tend < 0 ) {
+        cad_start();
+    } else if( ++state.ridx < REGIONS_COUNT ) {
+        region_start();
+    } else {
+        os_radio(RADIO_STOP);
+        scan_done();
+    }
+}
+
+bool _regscan_defer (void) {
+    if( os_getRegion() != REGCODE_UNDEF || state.ps.regcode ) {
+        return false;
+    }
+    if( state.done ) {
+        state.done = false;
+        return false;
+    }
+    // (restarts scan if a previous one was cut short by shutdown)
+    memset(state.score, 0, sizeof(state.score));
+    state.ridx = 0;
+    region_start();
+    return true;
+}
+
+int _regscan_region (void) {
+    if( os_getRegion() != REGCODE_UNDEF ) {
+        return 0;
+    }
+    if( state.ps.regcode ) {
+        return state.ps.regcode;
+    }
+    // nothing heard, try regions in turn
+    return LMIC_regionCode(state.fallback++ % REGIONS_COUNT);
+}
+
+void _regscan_event (ev_t ev) {
+    if( state.ps.regcode == 0 || state.ps.confirmed ) {
+        return;
+    }
+    if( ev == EV_JOINED ) {
+        state.ps.confirmed = 1;
+        save();
+    } else if( ev == EV_JOIN_FAILED ) {
+        if( ++state.ps.fails >= REGSCAN_JOINFAIL ) {
+            debug_printf("regscan: dropping region %d\r\n", state.ps.regcode);
+            state.ps.regcode = 0;
+        }
+        save();
+    }
+}
+
+void _regscan_init (void) {
+    if( eefs_log_read(UFID_REGSCAN, &state.ps, sizeof(state.ps)) != sizeof(state.ps) ) {
+        memset(&state.ps, 0, sizeof(state.ps));
+    }
+}
+
+int regscan_region (void) {
+    return (os_getRegion() != REGCODE_UNDEF) ? os_getRegion() : state.ps.regcode;
+}
+
+void regscan_reset (void) {
+    memset(&state.ps, 0, sizeof(state.ps));
+    save();
+}
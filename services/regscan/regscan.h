@@ -0,0 +1,24 @@
+// Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#ifndef _regscan_h_
+#define _regscan_h_
+
+#include <stdbool.h>
+
+// Region discovery for multi-region images. If the personalization data
+// does not define a region, the first join is postponed while the device
+// listens for LoRaWAN downlink traffic in each compiled-in region (see
+// regscan.c). The region found is persisted and used for all subsequent
+// joins. It is dropped again if REGSCAN_JOINFAIL join cycles in a row fail
+// before the first successful join.
+
+// Get region code used for joining (0 if not known yet)
+int regscan_region (void);
+
+// Forget persisted region, scan again before next join
+void regscan_reset (void);
+
+#endif
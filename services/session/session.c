@@ -0,0 +1,218 @@
+// Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+// Session persistence with a write-coalescing frame counter journal.
+//
+// The session itself is written once per join (plain EEFS file). The frame
+// counters go to a small record in the EEFS record log:
+//
+//  - Uplink: the record holds a reserved limit; all counters below it may
+//    have been used. When the next counter reaches the limit, a new range of
+//    SESSION_UP_RESERVE counters is reserved. After a reset, counting resumes
+//    at the limit (skipping at most SESSION_UP_RESERVE values), and a new
+//    range is reserved right away.
+//  - Downlink: by default, the counter is journaled after every downlink, so
+//    it is restored exactly. A larger SESSION_DN_LAG journals it lazily, i.e.
+//    when it is at least SESSION_DN_LAG ahead of the saved value or whenever
+//    the record is written anyway; after a reset, up to SESSION_DN_LAG-1 old
+//    downlinks could then be replayed to the device.
+//
+// So there is one record write per SESSION_UP_RESERVE uplinks (plus one per
+// SESSION_DN_LAG downlinks), and restoring at boot reads two records. The
+// saved session is dropped on EV_LINK_DEAD, so the next start joins again.
+// Channels added by the network and the ADR state are not saved.
+
+#include <string.h>
+
+#include "lmic.h"
+#include "lwmux/lwmux.h"
+#include "eefs/eefs.h"
+
+#include "session.h"
+
+#include "svcdefs_eefs_init.h" // for type-checking hook functions
+#include "svcdefs_eefs_fn.h"
+#include "svcdefs_lwm_event.h"
+#include "svcdefs_lwm_join_restore.h"
+
+#ifndef SESSION_UP_RESERVE
+#define SESSION_UP_RESERVE      256     // uplink counters reserved per write
+#endif
+#ifndef SESSION_DN_LAG
+#define SESSION_DN_LAG          1       // journal every downlink (no replay window)
+#endif
+
+// 1a13962733cec410-55bc678c
+static const uint8_t UFID_SESSION[12] = {
+    0x10, 0xc4, 0xce, 0x33, 0x27, 0x96, 0x13, 0x1a, 0x8c, 0x67, 0xbc, 0x55
+};
+
+// 1a13962739598ef0-45971839
+static const uint8_t UFID_SESSION_FCNT[12] = {
+    0xf0, 0x8e, 0x59, 0x39, 0x27, 0x96, 0x13, 0x1a, 0x39, 0x18, 0x97, 0x45
+};
+
+const char* _session_eefs_fn (const uint8_t* ufid) {
+    if( memcmp(ufid, UFID_SESSION, sizeof(UFID_SESSION)) == 0 ) {
+        return "ch.mkdata.svc.session";
+    }
+    if( memcmp(ufid, UFID_SESSION_FCNT, sizeof(UFID_SESSION_FCNT)) == 0 ) {
+        return "ch.mkdata.svc.session.fcnt";
+    }
+    return NULL;
+}
+
+// session (written once per join)
+typedef struct {
+    uint32_t netid;
+    uint32_t devaddr;           // device address (0 if no session)
+    uint8_t nwkskey[16];
+#if defined(CFG_lorawan11)
+    uint8_t nwkskeydn[16];
+#endif
+    uint8_t appskey[16];
+    uint32_t dn2freq;
+    uint8_t regcode;
+    uint8_t dn1dly;
+    int8_t dn1droff;
+    uint8_t dn2dr;
+#if defined(CFG_lorawan11)
+    uint8_t opts;
+#endif
+} psession;
+
+// frame counters (record log)
+typedef struct {
+    uint32_t devaddr;           // session the counters belong to
+    uint32_t up;                // uplink counters below this may have been used
+    uint32_t dn;                // journaled downlink counter
+#if defined(CFG_lorawan11)
+    uint32_t adn;               // journaled application downlink counter
+#endif
+} pfcnt;
+
+static struct {
+    psession s;
+    pfcnt fc;
+    bool restoring;             // EV_JOINED is from restored session
+} state;
+
+static void fcnt_save (void) {
+    state.fc.devaddr = LMIC.devaddr;
+    state.fc.dn = LMIC.seqnoDn;
+#if defined(CFG_lorawan11)
+    state.fc.adn = LMIC.seqnoADn;
+#endif
+    eefs_log_save(UFID_SESSION_FCNT, &state.fc, sizeof(state.fc));
+}
+
+static void fcnt_reserve (void) {
+    state.fc.up = LMIC.seqnoUp + SESSION_UP_RESERVE;
+    fcnt_save();
+}
+
+// keep reservation ahead of next uplink counter, journal downlink counter lazily
+static void fcnt_update (void) {
+    if( LMIC.seqnoUp >= state.fc.up ) {
+        fcnt_reserve();
+    } else if( LMIC.seqnoDn - state.fc.dn >= SESSION_DN_LAG
+#if defined(CFG_lorawan11)
+            || LMIC.seqnoADn - state.fc.adn >= SESSION_DN_LAG
+#endif
+            ) {
+        fcnt_save();
+    }
+}
+
+static void session_save (void) {
+    state.s.netid = LMIC.netid;
+    state.s.devaddr = LMIC.devaddr;
+    memcpy(state.s.nwkskey, LMIC.lceCtx.nwkSKey, 16);
+#if defined(CFG_lorawan11)
+    memcpy(state.s.nwkskeydn, LMIC.lceCtx.nwkSKeyDn, 16);
+    state.s.opts = LMIC.opts;
+#endif
+    memcpy(state.s.appskey, LMIC.lceCtx.appSKey, 16);
+    state.s.dn2freq = LMIC.dn2Freq;
+    state.s.regcode = LMIC.region->regcode;
+    state.s.dn1dly = LMIC.dn1Dly;
+    state.s.dn1droff = LMIC.dn1DrOffIdx;
+    state.s.dn2dr = LMIC.dn2Dr;
+    eefs_save(UFID_SESSION, &state.s, sizeof(state.s));
+    fcnt_reserve();
+}
+
+bool session_valid (void) {
+    return state.s.devaddr != 0 && state.fc.devaddr == state.s.devaddr;
+}
+
+void session_clear (void) {
+    memset(&state.s, 0, sizeof(state.s));
+    eefs_rm(UFID_SESSION);
+}
+
+bool _session_restore (void) {
+    if( !session_valid() ) {
+        return false;
+    }
+    if( LMIC.region->regcode != state.s.regcode ) {
+        LMIC_reset_ex(state.s.regcode);
+    }
+    LMIC_setSession(state.s.netid, state.s.devaddr, state.s.nwkskey,
+#if defined(CFG_lorawan11)
+            state.s.nwkskeydn,
+#endif
+            state.s.appskey);
+#if defined(CFG_lorawan11)
+    LMIC.opts = state.s.opts;
+#endif
+    LMIC.dn2Freq = state.s.dn2freq;
+    LMIC.dn1Dly = state.s.dn1dly;
+    LMIC.dn1DrOffIdx = state.s.dn1droff;
+    LMIC.dn2Dr = state.s.dn2dr;
+    LMIC.seqnoUp = state.fc.up;
+    LMIC.seqnoDn = state.fc.dn;
+#if defined(CFG_lorawan11)
+    LMIC.seqnoADn = state.fc.adn;
+#endif
+    // counters below the limit may have been used, reserve a new range now
+    fcnt_reserve();
+    state.restoring = true;
+    debug_printf("session: restored %08x, fcnt up=%u dn=%u\r\n",
+            state.s.devaddr, LMIC.seqnoUp, LMIC.seqnoDn);
+    return true;
+}
+
+void _session_event (ev_t ev) {
+    switch( ev ) {
+        case EV_JOINED:
+            if( state.restoring ) {
+                state.restoring = false;
+            } else {
+                session_save();
+            }
+            break;
+        case EV_TXCOMPLETE:
+        case EV_RXCOMPLETE:
+            if( session_valid() ) {
+                fcnt_update();
+            }
+            break;
+        case EV_LINK_DEAD:
+            session_clear();
+            break;
+        default:
+            break;
+    }
+}
+
+void _session_init (void) {
+    if( eefs_read(UFID_SESSION, &state.s, sizeof(state.s)) != sizeof(state.s) ) {
+        memset(&state.s, 0, sizeof(state.s));
+    }
+    if( eefs_log_read(UFID_SESSION_FCNT, &state.fc, sizeof(state.fc)) != sizeof(state.fc) ) {
+        memset(&state.fc, 0, sizeof(state.fc));
+    }
+}
@@ -0,0 +1,22 @@
+// Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#ifndef _session_h_
+#define _session_h_
+
+#include <stdbool.h>
+
+// Persistence of the LoRaWAN session across resets. After a join the
+// session (address, keys, RX parameters) is saved once; at boot lwmux
+// restores it instead of joining again (see session.c for the frame
+// counter journal).
+
+// Check if a saved session is available
+bool session_valid (void);
+
+// Discard saved session, next join goes over the air
+void session_clear (void);
+
+#endif
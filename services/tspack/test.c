@@ -0,0 +1,132 @@
+// Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tspack.h"
+
+// Round-trip synthetic telemetry through encoder and decoder, in byte and
+// dictionary mode and for frame sizes from 11 to 242 bytes, and check that
+// a row that does not fit leaves the payload untouched. With -v, payloads
+// are printed for the Python decoder check (test.py).
+
+static int errors;
+
+#define CHECK(c) do { if( !(c) ) { \
+    fprintf(stderr, "FAILED: %s:%d: %s\n", __FILE__, __LINE__, #c); errors += 1; \
+} } while( 0 )
+
+static const int32_t dvals[] = { 0, 1, -1, 2, -2, 3, -3, 4, -4, 5, -5, 8, -8, 16, -16 };
+static const tspack_dict dict = { dvals, sizeof(dvals) / sizeof(dvals[0]) };
+
+#define NROWS 300
+static int32_t series[NROWS][TSPACK_MAXCH];
+
+static void gen (int nch, unsigned int seed) {
+    srand(seed);
+    int32_t v[TSPACK_MAXCH] = { 2150, -40, 101325, 0x7ffffff0 };
+    for( int r = 0; r < NROWS; r++ ) {
+        for( int ch = 0; ch < nch; ch++ ) {
+            int x = rand() % 100;
+            // mostly small steps, occasional jumps (and int32 wrap-around)
+            v[ch] += (x < 40) ? 0 : (x < 90) ? (rand() % 7) - 3 : (rand() % 2001) - 1000;
+            series[r][ch] = v[ch];
+        }
+    }
+}
+
+static void print_hex (const unsigned char* buf, int len) {
+    for( int i = 0; i < len; i++ ) {
+        printf("%02x", buf[i]);
+    }
+}
+
+static void roundtrip (int nch, int max, const tspack_dict* d, bool verbose) {
+    unsigned char buf[256], copy[256];
+    int32_t out[NROWS * TSPACK_MAXCH];
+    int r = 0;
+    while( r < NROWS ) {
+        tspack_enc enc;
+        memset(buf, 0xaa, sizeof(buf));
+        tspack_init(&enc, buf, max, nch, d);
+        int r0 = r;
+        while( r < NROWS ) {
+            memcpy(copy, buf, sizeof(buf));
+            int pos = enc.pos;
+            if( !tspack_add(&enc, series[r]) ) {
+                CHECK(pos == enc.pos);
+                CHECK(memcmp(copy, buf, sizeof(buf)) == 0);
+                break;
+            }
+            r += 1;
+        }
+        if( r == r0 ) {
+            CHECK(max < 2 + 5 * nch); // only a first row of large values may not fit
+            break;
+        }
+        int len = tspack_finish(&enc);
+        CHECK(len <= max);
+        CHECK(buf[max] == 0xaa);
+        int n = tspack_decode(buf, len, out, NROWS * TSPACK_MAXCH, d);
+        CHECK(n == (r - r0) * nch);
+        for( int i = 0; i < n; i++ ) {
+            if( out[i] != series[r0 + i / nch][i % nch] ) {
+                fprintf(stderr, "FAILED: nch=%d max=%d row=%d ch=%d: %d != %d\n", nch, max,
+                        r0 + i / nch, i % nch, out[i], series[r0 + i / nch][i % nch]);
+                errors += 1;
+                break;
+            }
+        }
+        if( verbose ) {
+            printf("%c ", d ? 'd' : 'b');
+            print_hex(buf, len);
+            for( int i = 0; i < n; i++ ) {
+                printf(" %d", out[i]);
+            }
+            printf("\n");
+        }
+    }
+}
+
+static int stats (int nch, int max, const tspack_dict* d) {
+    unsigned char buf[256];
+    tspack_enc enc;
+    tspack_init(&enc, buf, max, nch, d);
+    int r = 0;
+    while( r < NROWS && tspack_add(&enc, series[r]) ) {
+        r += 1;
+    }
+    return r;
+}
+
+int main (int argc, char** argv) {
+    bool verbose = (argc > 1 && strcmp(argv[1], "-v") == 0);
+    for( int nch = 1; nch <= TSPACK_MAXCH; nch++ ) {
+        gen(nch, nch);
+        for( int max = 11; max <= 242; max += 21 ) {
+            roundtrip(nch, max, NULL, verbose && max == 53);
+            roundtrip(nch, max, &dict, verbose && max == 53);
+        }
+        if( !verbose ) {
+            // readings per 11-byte frame (raw: 4 bytes per value)
+            printf("nch=%d: %d rows (byte), %d rows (dict) per 11 bytes, raw %d\n", nch,
+                    stats(nch, 11, NULL), stats(nch, 11, &dict), 11 / (4 * nch));
+        }
+    }
+    // errors
+    unsigned char bad[4] = { 0x20, 1, 0, 0 };
+    int32_t out[4];
+    CHECK(tspack_decode(bad, sizeof(bad), out, 4, NULL) == -1);    // version
+    bad[0] = 0x10;
+    CHECK(tspack_decode(bad, sizeof(bad), out, 4, NULL) == -1);    // no dictionary
+    bad[0] = 0x00; bad[2] = 0x80;
+    CHECK(tspack_decode(bad, 3, out, 4, NULL) == -1);              // truncated
+    if( !verbose ) {
+        printf("%s%s: %d errors\n", argv[0], (errors ? " FAILED" : ""), errors);
+    }
+    return errors ? 1 : 0;
+}
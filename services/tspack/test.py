@@ -0,0 +1,35 @@
+#!/usr/bin/env python3
+
+# Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+#
+# This file is subject to the terms and conditions defined in file 'LICENSE',
+# which is part of this source code package.
+
+# Decode the payloads printed by 'test -v' with tspack.py and re-encode them.
+
+import subprocess
+import sys
+
+import tspack
+
+DICT = [ 0, 1, -1, 2, -2, 3, -3, 4, -4, 5, -5, 8, -8, 16, -16 ]
+
+def main() -> int:
+    out = subprocess.run(['./test', '-v'], check=True, capture_output=True, text=True).stdout
+    errors = 0
+    n = 0
+    for line in out.splitlines():
+        mode, payload, *vals = line.split()
+        d = DICT if mode == 'd' else None
+        buf = bytes.fromhex(payload)
+        rows = tspack.decode(buf, d)
+        flat = [v for row in rows for v in row]
+        if flat != [int(v) for v in vals] or tspack.encode(rows, d) != buf:
+            print(f'FAILED: {line}', file=sys.stderr)
+            errors += 1
+        n += 1
+    print(f'{sys.argv[0]}{" FAILED" if errors else ""}: {n} payloads, {errors} errors')
+    return 1 if errors else 0
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,176 @@
+// Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#include <string.h>
+
+#include "tspack.h"
+
+enum {
+    HDR_DICT    = (1 << 4),     // dictionary mode
+    HDR_VERMSK  = (7 << 5),     // version (0)
+    ESCAPE      = 15,           // dictionary mode: literal value follows
+};
+
+static uint32_t zigzag (int32_t v) {
+    return ((uint32_t) v << 1) ^ -((uint32_t) v >> 31);
+}
+
+static int32_t unzigzag (uint32_t u) {
+    return (int32_t) ((u >> 1) ^ -(u & 1));
+}
+
+// number of groups of b bits needed for u (at least one)
+static int groups (uint32_t u, int b) {
+    int n = 1;
+    while( (u >>= b) != 0 ) {
+        n += 1;
+    }
+    return n;
+}
+
+static void put_nibble (unsigned char* buf, int pos, int v) {
+    if( pos & 1 ) {
+        buf[pos >> 1] |= v;
+    } else {
+        buf[pos >> 1] = v << 4;
+    }
+}
+
+static int get_nibble (const unsigned char* buf, int pos) {
+    return (pos & 1) ? (buf[pos >> 1] & 0xf) : (buf[pos >> 1] >> 4);
+}
+
+static int dict_lookup (const tspack_dict* dict, int32_t v) {
+    for( int i = 0; i < dict->n; i++ ) {
+        if( dict->vals[i] == v ) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void tspack_init (tspack_enc* enc, unsigned char* buf, int max, int nch, const tspack_dict* dict) {
+    enc->buf = buf;
+    enc->max = max;
+    enc->pos = 2 * TSPACK_HDRLEN;
+    enc->nch = nch;
+    enc->rows = 0;
+    enc->dict = dict;
+}
+
+bool tspack_add (tspack_enc* enc, const int32_t* row) {
+    int32_t d[TSPACK_MAXCH];
+    signed char code[TSPACK_MAXCH];
+    int need = 0;
+
+    if( enc->rows == 255 ) {
+        return false;
+    }
+    // determine size first, so a row that does not fit leaves no trace
+    for( int ch = 0; ch < enc->nch; ch++ ) {
+        d[ch] = enc->rows ? (int32_t) ((uint32_t) row[ch] - (uint32_t) enc->prev[ch]) : row[ch];
+        if( enc->dict ) {
+            code[ch] = enc->rows ? dict_lookup(enc->dict, d[ch]) : -1;
+            need += (code[ch] < 0) ? 1 + groups(zigzag(d[ch]), 3) : 1;
+        } else {
+            need += 2 * groups(zigzag(d[ch]), 7);
+        }
+    }
+    if( enc->pos + need > 2 * enc->max ) {
+        return false;
+    }
+    for( int ch = 0; ch < enc->nch; ch++ ) {
+        uint32_t u = zigzag(d[ch]);
+        if( enc->dict ) {
+            if( code[ch] >= 0 ) {
+                put_nibble(enc->buf, enc->pos++, code[ch]);
+                continue;
+            }
+            put_nibble(enc->buf, enc->pos++, ESCAPE);
+            while( u >= 8 ) {
+                put_nibble(enc->buf, enc->pos++, 8 | (u & 7));
+                u >>= 3;
+            }
+            put_nibble(enc->buf, enc->pos++, u);
+        } else {
+            unsigned char* p = enc->buf + (enc->pos >> 1);
+            while( u >= 0x80 ) {
+                *p++ = 0x80 | (u & 0x7f);
+                u >>= 7;
+            }
+            *p++ = u;
+            enc->pos = 2 * (p - enc->buf);
+        }
+    }
+    memcpy(enc->prev, row, enc->nch * sizeof(int32_t));
+    enc->rows += 1;
+    return true;
+}
+
+int tspack_finish (tspack_enc* enc) {
+    if( enc->rows == 0 ) {
+        return 0;
+    }
+    enc->buf[0] = (enc->dict ? HDR_DICT : 0) | (enc->nch - 1);
+    enc->buf[1] = enc->rows;
+    return (enc->pos + 1) >> 1;
+}
+
+int tspack_decode (const unsigned char* buf, int len, int32_t* out, int max, const tspack_dict* dict) {
+    if( len < TSPACK_HDRLEN || (buf[0] & HDR_VERMSK) != 0 ) {
+        return -1;
+    }
+    int nch = (buf[0] & 0xf) + 1;
+    bool dm = (buf[0] & HDR_DICT) != 0;
+    int n = buf[1] * nch;
+    int pos = 2 * TSPACK_HDRLEN;
+    int end = 2 * len;
+    if( n > max || (dm && dict == NULL) ) {
+        return -1;
+    }
+    for( int i = 0; i < n; i++ ) {
+        uint32_t u = 0;
+        int32_t v;
+        if( dm ) {
+            if( pos >= end ) {
+                return -1;
+            }
+            int c = get_nibble(buf, pos++);
+            if( c != ESCAPE ) {
+                if( i < nch || c >= dict->n ) {
+                    return -1;
+                }
+                v = dict->vals[c];
+                goto delta;
+            }
+            for( int s = 0, g; ; s += 3 ) {
+                if( pos >= end || s > 30 ) {
+                    return -1;
+                }
+                g = get_nibble(buf, pos++);
+                u |= (uint32_t) (g & 7) << s;
+                if( (g & 8) == 0 ) {
+                    break;
+                }
+            }
+        } else {
+            for( int s = 0, g; ; s += 7 ) {
+                if( pos >= end || s > 28 ) {
+                    return -1;
+                }
+                g = buf[pos >> 1];
+                pos += 2;
+                u |= (uint32_t) (g & 0x7f) << s;
+                if( (g & 0x80) == 0 ) {
+                    break;
+                }
+            }
+        }
+        v = unzigzag(u);
+    delta:
+        out[i] = (i < nch) ? v : (int32_t) ((uint32_t) out[i - nch] + (uint32_t) v);
+    }
+    return n;
+}
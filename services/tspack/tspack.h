@@ -0,0 +1,75 @@
+// Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#ifndef _tspack_h_
+#define _tspack_h_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Compact coding of telemetry time series (rows of nch integer values).
+//
+// The first row is coded as is, every subsequent value as the difference
+// to the previous value of the same channel. Values are zig-zag mapped
+// (0,-1,1,-2,... -> 0,1,2,3,...) and written as varints:
+//
+//   byte mode:        7 bits per byte, MSB set if more bytes follow
+//   dictionary mode:  4-bit codes; code i < 15 stands for dictionary value
+//                     i, code 15 is followed by a nibble varint (3 bits per
+//                     nibble, MSB set if more nibbles follow), high nibble
+//                     first within a byte
+//
+// In dictionary mode the first row is always escaped. A two-byte header
+// gives the number of channels, the mode and the number of rows:
+//
+//   <ver:3 dict:1 nch-1:4> <rows:8> <data>
+//
+// The encoder is allocation-free and can be filled row by row until the
+// frame is full, e.g. from an lwmux txfunc:
+//
+//   tspack_init(&enc, txi->data, txi->dlen, 3, NULL);
+//   while( have_reading() && tspack_add(&enc, next_reading()) ) {
+//       consume_reading();
+//   }
+//   txi->dlen = tspack_finish(&enc);
+//
+// tspack.py has the matching decoder.
+
+#ifndef TSPACK_MAXCH
+#define TSPACK_MAXCH    4       // max. number of channels (up to 16)
+#endif
+
+#define TSPACK_DICT_MAX 15      // max. number of dictionary entries
+#define TSPACK_HDRLEN   2       // header length
+
+// Static dictionary of frequent differences (shared with decoder)
+typedef struct {
+    const int32_t* vals;
+    int n;
+} tspack_dict;
+
+typedef struct {
+    unsigned char* buf;         // output buffer
+    int max;                    // buffer size (bytes)
+    int pos;                    // write position (nibbles)
+    int nch;                    // number of channels
+    int rows;                   // number of rows added
+    const tspack_dict* dict;    // dictionary (NULL for byte mode)
+    int32_t prev[TSPACK_MAXCH]; // previous row
+} tspack_enc;
+
+// Start encoding into buf (max bytes), dict may be NULL
+void tspack_init (tspack_enc* enc, unsigned char* buf, int max, int nch, const tspack_dict* dict);
+
+// Add row of nch values, returns false (and leaves output unchanged) if it does not fit
+bool tspack_add (tspack_enc* enc, const int32_t* row);
+
+// Finish encoding, returns payload length (0 if no rows were added)
+int tspack_finish (tspack_enc* enc);
+
+// Decode payload into out (row-major, max values), returns number of values or -1 on error
+int tspack_decode (const unsigned char* buf, int len, int32_t* out, int max, const tspack_dict* dict);
+
+#endif
@@ -0,0 +1,103 @@
+# Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+#
+# This file is subject to the terms and conditions defined in file 'LICENSE',
+# which is part of this source code package.
+
+# Decoder (and reference encoder) for tspack telemetry payloads, see tspack.h.
+
+from typing import List,Optional,Sequence
+
+ESCAPE = 15
+
+def _s32(v:int) -> int:
+    v &= 0xffffffff
+    return v - (1 << 32) if v & 0x80000000 else v
+
+def _zigzag(v:int) -> int:
+    return ((v << 1) ^ (v >> 31)) & 0xffffffff
+
+def _unzigzag(u:int) -> int:
+    return _s32((u >> 1) ^ -(u & 1))
+
+class _Nibbles:
+    def __init__(self, buf:bytes, pos:int) -> None:
+        self.buf = buf
+        self.pos = pos
+        self.end = 2 * len(buf)
+
+    def get(self) -> int:
+        if self.pos >= self.end:
+            raise ValueError('truncated payload')
+        b = self.buf[self.pos >> 1]
+        n = (b & 0xf) if self.pos & 1 else (b >> 4)
+        self.pos += 1
+        return n
+
+def decode(payload:bytes, dictionary:Optional[Sequence[int]]=None) -> List[List[int]]:
+    if len(payload) < 2 or payload[0] & 0xe0:
+        raise ValueError('invalid header')
+    nch = (payload[0] & 0xf) + 1
+    dm = bool(payload[0] & 0x10)
+    rows = payload[1]
+    if dm and dictionary is None:
+        raise ValueError('dictionary required')
+    nib = _Nibbles(payload, 4)
+    vals:List[int] = []
+    for i in range(rows * nch):
+        if dm:
+            c = nib.get()
+            if c != ESCAPE:
+                if i < nch or c >= len(dictionary):
+                    raise ValueError('invalid code')
+                v = dictionary[c]
+            else:
+                u = s = 0
+                while True:
+                    g = nib.get()
+                    u |= (g & 7) << s
+                    s += 3
+                    if not g & 8:
+                        break
+                v = _unzigzag(u)
+        else:
+            u = s = 0
+            while True:
+                g = nib.get() << 4
+                g |= nib.get()
+                u |= (g & 0x7f) << s
+                s += 7
+                if not g & 0x80:
+                    break
+            v = _unzigzag(u)
+        vals.append(v if i < nch else _s32(vals[i - nch] + v))
+    return [vals[r * nch:(r + 1) * nch] for r in range(rows)]
+
+def encode(rows:Sequence[Sequence[int]], dictionary:Optional[Sequence[int]]=None) -> bytes:
+    nch = len(rows[0])
+    nibs:List[int] = []
+    prev:Optional[Sequence[int]] = None
+    for row in rows:
+        for ch, v in enumerate(row):
+            d = v if prev is None else _s32(v - prev[ch])
+            u = _zigzag(d)
+            if dictionary is not None:
+                if prev is not None and d in dictionary:
+                    nibs.append(list(dictionary).index(d))
+                    continue
+                nibs.append(ESCAPE)
+                while u >= 8:
+                    nibs.append(8 | (u & 7))
+                    u >>= 3
+                nibs.append(u)
+            else:
+                while True:
+                    b = (u & 0x7f) | (0x80 if u >= 0x80 else 0)
+                    nibs.extend((b >> 4, b & 0xf))
+                    u >>= 7
+                    if not b & 0x80:
+                        break
+        prev = row
+    if len(nibs) & 1:
+        nibs.append(0)
+    hdr = bytes([(0x10 if dictionary is not None else 0) | (nch - 1), len(rows)])
+    return hdr + bytes((nibs[i] << 4) | nibs[i + 1] for i in range(0, len(nibs), 2))
@@ -5,15 +5,71 @@
 
 #include "lmic.h"
 
-#include "svcdefs.h"
+#include "svcdefs_uexti_irq.h"
 #include "uexti.h"
 
 #include "peripherals.h"
 
+#ifdef SVC_UEXTI_COUNTER
+// ------------------------------------------------
+// Edge counters
+
+static struct {
+    uexti_counter* counters;    // active counters
+} state;
+
+static void batchjob (osjob_t* job) {
+    uexti_counter* c = (uexti_counter*) job;
+    c->pending = 0;
+    unsigned int count = c->count;
+    unsigned int edges = count - c->reported;
+    c->reported = count;
+    c->cb(c, edges);
+}
+
+// count and timestamp edges, clear handled interrupts from mask
+static void counter_irq (unsigned int* mask) {
+    ostime_t now = os_getTime();
+    for( uexti_counter* c = state.counters; c; c = c->next ) {
+        if( (*mask & c->mask) == 0 ) {
+            continue;
+        }
+        *mask &= ~c->mask;
+        if( c->count != 0 && now - c->last < c->debounce ) {
+            continue; // bounce
+        }
+        c->last = now;
+        c->count += 1;
+        unsigned int used = 0;
+        if( c->ring ) {
+            used = c->head - c->tail;
+            if( used <= c->rmask ) {
+                c->ring[c->head & c->rmask] = now;
+                c->head += 1;
+                used += 1;
+            } else {
+                c->dropped += 1;
+            }
+        }
+        if( c->pending == 0 ) {
+            c->pending = 1;
+            os_setTimedCallbackEx(&c->job, now + c->interval, batchjob, OSJOB_FLAG_APPROX);
+        } else if( c->pending == 1 && used > (c->rmask >> 1) ) {
+            // ring half full, deliver early
+            c->pending = 2;
+            os_setCallback(&c->job, batchjob);
+        }
+    }
+}
+#endif
+
 // ------------------------------------------------
 // Unified External Interrupt Handler
 
 static void hook_uexti_irq (unsigned int* mask) {
+#ifdef SVC_UEXTI_COUNTER
+    counter_irq(mask);
+#endif
     SVCHOOK_uexti_irq(mask);
 }
 
@@ -62,3 +118,50 @@ void uexti_enable (unsigned int gpio, bool enable) {
 #else
 #error "Platform not supported by UEXTI service module"
 #endif
+
+#ifdef SVC_UEXTI_COUNTER
+void uexti_counter_start (uexti_counter* c, unsigned int gpio, bool rising, bool falling,
+        ostime_t debounce, ostime_t interval, ostime_t* ring, unsigned int ringsz,
+        uexti_batchcb cb) {
+    ASSERT((ringsz & (ringsz - 1)) == 0);
+    c->mask = 1 << BRD_PIN(gpio);
+    c->debounce = debounce;
+    c->interval = interval;
+    c->cb = cb;
+    c->ring = ringsz ? ring : NULL;
+    c->rmask = ringsz - 1;
+    c->head = c->tail = 0;
+    c->count = c->dropped = c->reported = 0;
+    c->pending = 0;
+    uexti_config(gpio, rising, falling);
+    hal_disableIRQs();
+    c->next = state.counters;
+    state.counters = c;
+    hal_enableIRQs();
+    uexti_enable(gpio, true);
+}
+
+void uexti_counter_stop (uexti_counter* c, unsigned int gpio) {
+    uexti_enable(gpio, false);
+    hal_disableIRQs();
+    for( uexti_counter** pc = &state.counters; *pc; pc = &(*pc)->next ) {
+        if( *pc == c ) {
+            *pc = c->next;
+            break;
+        }
+    }
+    os_clearCallback(&c->job);
+    c->pending = 0;
+    hal_enableIRQs();
+}
+
+bool uexti_counter_pop (uexti_counter* c, ostime_t* t) {
+    unsigned int tail = c->tail;
+    if( c->ring == NULL || tail == c->head ) {
+        return false;
+    }
+    *t = c->ring[tail & c->rmask];
+    c->tail = tail + 1;
+    return true;
+}
+#endif
@@ -8,7 +8,50 @@
 
 #include <stdbool.h>
 
+#include "lmic.h"
+
 void uexti_config (unsigned int gpio, bool rising, bool falling);
 void uexti_enable (unsigned int gpio, bool enable);
 
+#ifdef SVC_UEXTI_COUNTER
+// Edge counter: edges on a pin are counted and timestamped in the interrupt
+// handler (into a ring written only by the handler and read only by the job),
+// and delivered in batches to a job, at most once per interval.
+
+typedef struct _uexti_counter uexti_counter;
+
+// batch callback, edges is the number of edges since the previous batch
+// (timestamps are fetched with uexti_counter_pop)
+typedef void (*uexti_batchcb) (uexti_counter* c, unsigned int edges);
+
+struct _uexti_counter {
+    osjob_t job;                // (internal) batch job
+    uexti_counter* next;        // (internal) list of active counters
+    unsigned int mask;          // (internal) interrupt mask bit
+    ostime_t debounce;          // min. time between counted edges (ticks)
+    ostime_t interval;          // batch interval (ticks)
+    uexti_batchcb cb;           // batch callback
+    ostime_t* ring;             // timestamp ring
+    unsigned int rmask;         // ring size - 1 (size must be a power of 2)
+    volatile unsigned int head; // written by handler
+    volatile unsigned int tail; // written by job
+    volatile unsigned int count;   // total number of counted edges
+    volatile unsigned int dropped; // edges counted but not timestamped (ring full)
+    volatile unsigned char pending; // (internal) batch job scheduled (1=timed, 2=now)
+    ostime_t last;              // timestamp of last counted edge
+    unsigned int reported;      // count at last batch
+};
+
+// configure pin and start counting edges
+// - ring:      timestamp buffer (ringsz must be a power of 2, may be 0 if
+//              only counts are needed)
+void uexti_counter_start (uexti_counter* c, unsigned int gpio, bool rising, bool falling,
+        ostime_t debounce, ostime_t interval, ostime_t* ring, unsigned int ringsz,
+        uexti_batchcb cb);
+void uexti_counter_stop (uexti_counter* c, unsigned int gpio);
+
+// fetch oldest timestamp from ring, return false if empty
+bool uexti_counter_pop (uexti_counter* c, ostime_t* t);
+#endif
+
 #endif
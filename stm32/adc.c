@@ -32,23 +32,32 @@ static void adc_off (void) {
 #endif
 }
 
+static void adc_intch (unsigned int chmask, bool on) {
+#if defined(STM32L0)
+    unsigned int ccr = 0;
+    if( chmask & (1 << VREFINT_ADC_CH) ) {
+        ccr |= ADC_CCR_VREFEN;                  // internal voltage reference on channel 17
+    }
+    if( chmask & (1 << TEMPINT_ADC_CH) ) {
+        ccr |= ADC_CCR_TSEN;                    // internal temperature on channel 18
+    }
+    if( on ) {
+        ADC->CCR |= ccr;
+    } else {
+        ADC->CCR &= ~ccr;
+    }
+#endif
+}
+
 unsigned int adc_read (unsigned int chnl, unsigned int rate) {
     adc_on();
 #if defined(STM32L0)
-    if( chnl == VREFINT_ADC_CH ) {
-        ADC->CCR |= ADC_CCR_VREFEN;             // internal voltage reference on channel 17
-    } else if( chnl == TEMPINT_ADC_CH ) {
-        ADC->CCR |= ADC_CCR_TSEN;               // internal temperature on channel 18
-    }
+    adc_intch(1 << chnl, true);
     ADC1->CHSELR = (1 << chnl);                 // select channel
     ADC1->SMPR = rate & 0x7;                    // sample rate
     ADC1->CR |= ADC_CR_ADSTART;                 // start conversion
     while( (ADC1->ISR & ADC_ISR_EOC) == 0 );    // wait for it
-    if( chnl == VREFINT_ADC_CH ) {
-        ADC->CCR &= ~ADC_CCR_VREFEN;
-    } else if( chnl == TEMPINT_ADC_CH ) {
-        ADC->CCR &= ~ADC_CCR_TSEN;
-    }
+    adc_intch(1 << chnl, false);
 #elif defined(STM32L1)
     ADC1->SQR5 = chnl;                          // select the channel for the 1st conversion
     ADC1->CR2 |= ADC_CR2_SWSTART;               // start the conversion
@@ -58,3 +67,51 @@ unsigned int adc_read (unsigned int chnl, unsigned int rate) {
     adc_off();
     return v;
 }
+
+#ifdef PERIPH_ADC_SCAN
+
+static struct {
+    unsigned int chmask;
+    osjob_t* job;
+    osjobcb_t cb;
+} scan;
+
+static void scan_done (int status, void* arg) {
+    ADC1->CR |= ADC_CR_ADSTP;                   // stop conversions
+    while( (ADC1->CR & ADC_CR_ADSTP) != 0 );
+    dma_deconfig(BRD_DMA_CHAN_A(BRD_ADC_DMA));
+    ADC1->CFGR1 = 0;
+    ADC1->CFGR2 = 0;
+    adc_intch(scan.chmask, false);
+    adc_off();
+    hal_clearMaxSleep(HAL_SLEEP_S0);
+    os_setCallback(scan.job, scan.cb);
+}
+
+void adc_scan (unsigned int chmask, unsigned int rate, unsigned int ovs,
+        unsigned short* buf, int nscans, osjob_t* job, osjobcb_t cb) {
+    ASSERT(chmask != 0 && ovs <= 8);
+    int ch = BRD_DMA_CHAN_A(BRD_ADC_DMA);
+    scan.chmask = chmask;
+    scan.job = job;
+    scan.cb = cb;
+
+    // keep clock running during conversion
+    hal_setMaxSleep(HAL_SLEEP_S0);
+    adc_on();
+    adc_intch(chmask, true);
+    ADC1->CHSELR = chmask;                      // select channels
+    ADC1->SMPR = rate & 0x7;                    // sample rate
+    if( ovs ) {
+        // oversampling ratio 2^ovs, right shift by ovs (average)
+        ADC1->CFGR2 = ((ovs - 1) * ADC_CFGR2_OVSR_0) | (ovs * ADC_CFGR2_OVSS_0) | ADC_CFGR2_OVSE;
+    }
+    // continuous scan with DMA (one-shot), data register overwritten on overrun
+    ADC1->CFGR1 = ADC_CFGR1_DMAEN | ADC_CFGR1_OVRMOD | ((nscans > 1) ? ADC_CFGR1_CONT : 0);
+
+    dma_config(ch, DMA_ADC, DMA_CCR_MINC | DMA_CCR_PSIZE_0 | DMA_CCR_MSIZE_0, DMA_CB_COMPLETE, scan_done, NULL);
+    dma_transfer(ch, &ADC1->DR, buf, nscans * __builtin_popcount(chmask));
+    ADC1->CR |= ADC_CR_ADSTART;                 // start conversions
+}
+
+#endif
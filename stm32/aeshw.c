@@ -0,0 +1,182 @@
+// Copyright (C) 2020-2022 Michael Kuyper. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#include "peripherals.h"
+#include "aes.h"
+
+#if defined(CFG_aes_hw)
+
+// Implementation of os_aes() using the AES engine of STM32L0x2 parts. The
+// interface is identical to the software implementation in lmic/aes.c: the
+// key is passed in AESKEY, the IV/counter block in AESAUX (both MSBF), and
+// AESAUX holds the MIC/counter state in native word order upon return.
+
+#if defined(CFG_bootloader) && defined(CFG_bootloader_aes)
+#error "CFG_aes_hw and CFG_bootloader_aes are mutually exclusive"
+#endif
+
+// minimum number of blocks for DMA transfers in CTR mode
+#ifndef AES_DMA_MINBLKS
+#define AES_DMA_MINBLKS 4
+#endif
+
+#define msbf4_read(p)    ((p)[0]<<24 | (p)[1]<<16 | (p)[2]<<8 | (p)[3])
+#define msbf4_write(p,v) (p)[0]=(v)>>24,(p)[1]=(v)>>16,(p)[2]=(v)>>8,(p)[3]=(v)
+
+// load data block in MSBF word order (partial blocks are padded with 0x80 0x00..)
+static void loadblock (u4_t* a, const u1_t* buf, int len) {
+    u1_t b[16];
+    for( int i = 0; i < 16; i++ ) {
+        b[i] = (i < len) ? buf[i] : (i == len) ? 0x80 : 0x00;
+    }
+    for( int i = 0; i < 4; i++ ) {
+        a[i] = msbf4_read(b + 4*i);
+    }
+}
+
+// encrypt single block in place (ECB, engine must be enabled)
+static void encblock (u4_t* a) {
+    AES->DINR = a[0];
+    AES->DINR = a[1];
+    AES->DINR = a[2];
+    AES->DINR = a[3];
+    while( (AES->SR & AES_SR_CCF) == 0 );
+    AES->CR |= AES_CR_CCFC;
+    a[0] = AES->DOUTR;
+    a[1] = AES->DOUTR;
+    a[2] = AES->DOUTR;
+    a[3] = AES->DOUTR;
+}
+
+// compute CMAC over buffer, chaining value in AESAUX
+static void mic (u1_t mode, u1_t* buf, u2_t len) {
+    u4_t a[4];
+
+    if( (mode & AES_MICNOAUX) == 0 && (s2_t) len > 0 ) {
+        // first block is B0 passed in AESAUX
+        encblock(AESAUX);
+    }
+    while( (s2_t) len > 0 ) {
+        if( len <= 16 ) {
+            // last block: compute CMAC subkey K1 (complete) or K2 (padded)
+            a[0] = a[1] = a[2] = a[3] = 0;
+            encblock(a);
+            int n = (len == 16) ? 1 : 2;
+            do {
+                u4_t msb = a[0] >> 31;
+                a[0] = (a[0] << 1) | (a[1] >> 31);
+                a[1] = (a[1] << 1) | (a[2] >> 31);
+                a[2] = (a[2] << 1) | (a[3] >> 31);
+                a[3] = (a[3] << 1);
+                if( msb ) a[3] ^= 0x87;
+            } while( --n );
+            for( int i = 0; i < 4; i++ ) {
+                AESAUX[i] ^= a[i];
+            }
+        }
+        loadblock(a, buf, len);
+        for( int i = 0; i < 4; i++ ) {
+            AESAUX[i] ^= a[i];
+        }
+        encblock(AESAUX);
+        buf += 16;
+        len = (len > 16) ? len - 16 : 0;
+    }
+}
+
+// run full blocks through engine in CTR mode using DMA (buffer must be word-aligned)
+static void ctr_dma (u1_t* buf, int nblks) {
+    int ch_in = BRD_DMA_CHAN_A(BRD_AES_DMA);
+    int ch_out = BRD_DMA_CHAN_B(BRD_AES_DMA);
+
+    AES->CR = 0;
+    AES->IVR3 = AESAUX[0];
+    AES->IVR2 = AESAUX[1];
+    AES->IVR1 = AESAUX[2];
+    AES->IVR0 = AESAUX[3];
+    // byte swapping preserves memory byte order of data words
+    AES->CR = AES_CR_CHMOD_1 | AES_CR_DATATYPE_1 | AES_CR_DMAINEN | AES_CR_DMAOUTEN;
+
+    dma_config(ch_in, DMA_AES, DMA_CCR_MINC | DMA_CCR_DIR | DMA_CCR_PSIZE_1 | DMA_CCR_MSIZE_1, 0, NULL, NULL);
+    dma_config(ch_out, DMA_AES, DMA_CCR_MINC | DMA_CCR_PSIZE_1 | DMA_CCR_MSIZE_1, 0, NULL, NULL);
+    // output of block n is written before input of block n+1 is read, so in-place is safe
+    dma_transfer(ch_out, &AES->DOUTR, buf, nblks * 4);
+    dma_transfer(ch_in, &AES->DINR, buf, nblks * 4);
+    AES->CR |= AES_CR_EN;
+    while( dma_remaining(ch_out) != 0 );
+    dma_deconfig(ch_in);
+    dma_deconfig(ch_out);
+
+    AESAUX[3] += nblks;
+    // back to ECB for remaining block
+    AES->CR = AES_CR_CCFC;
+    AES->CR = AES_CR_EN;
+}
+
+// encrypt/decrypt buffer in CTR mode, counter in AESAUX
+static void ctr (u1_t* buf, u2_t len) {
+    int nblks = len >> 4;
+    if( nblks >= AES_DMA_MINBLKS && ((uintptr_t) buf & 3) == 0 ) {
+        ctr_dma(buf, nblks);
+        buf += nblks << 4;
+        len -= nblks << 4;
+    }
+    while( (s2_t) len > 0 ) {
+        u4_t a[4] = { AESAUX[0], AESAUX[1], AESAUX[2], AESAUX[3] };
+        encblock(a);
+        int n = (len > 16) ? 16 : len;
+        for( int i = 0; i < n; i++ ) {
+            buf[i] ^= a[i >> 2] >> (24 - 8 * (i & 3));
+        }
+        AESAUX[3]++;
+        buf += 16;
+        len -= n;
+    }
+}
+
+u4_t os_aes (u1_t mode, u1_t* buf, u2_t len) {
+    RCC->AHBENR |= RCC_AHBENR_CRYPEN;
+
+    // ECB, encryption, no data swapping
+    AES->CR = 0;
+    AES->KEYR3 = __REV(AESKEY[0]);
+    AES->KEYR2 = __REV(AESKEY[1]);
+    AES->KEYR1 = __REV(AESKEY[2]);
+    AES->KEYR0 = __REV(AESKEY[3]);
+    AES->CR = AES_CR_EN;
+
+    if( mode & AES_MICNOAUX ) {
+        AESAUX[0] = AESAUX[1] = AESAUX[2] = AESAUX[3] = 0;
+    } else {
+        AESAUX[0] = __REV(AESAUX[0]);
+        AESAUX[1] = __REV(AESAUX[1]);
+        AESAUX[2] = __REV(AESAUX[2]);
+        AESAUX[3] = __REV(AESAUX[3]);
+    }
+
+    if( mode & AES_MIC ) {
+        mic(mode, buf, len);
+    } else if( mode & AES_CTR ) {
+        ctr(buf, len);
+    } else { // ECB
+        while( (s2_t) len > 0 ) {
+            u4_t a[4];
+            loadblock(a, buf, len);
+            encblock(a);
+            for( int i = 0; i < 4; i++ ) {
+                msbf4_write(buf + 4*i, a[i]);
+            }
+            buf += 16;
+            len -= 16;
+        }
+    }
+
+    AES->CR = 0;
+    RCC->AHBENR &= ~RCC_AHBENR_CRYPEN;
+
+    return AESAUX[0];
+}
+
+#endif
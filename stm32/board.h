@@ -29,6 +29,9 @@
 #define BRD_GPIO_EXT_PULLDN             (1 << 17)
 #define BRD_GPIO_ACTIVE_LOW             (1 << 18)
 
+// Boards can define BRD_IO_INIT as a list of GPIO_PINCFG*() table entries
+// (see hw.h) which are applied together with the HAL's own pins at startup.
+
 // GPIO ports
 #define PORT_A  0
 #define PORT_B  1
@@ -39,6 +42,8 @@
 #define BRD_DMA_CHANS(a,b)              (((b) << 4) | (a))
 #define BRD_DMA_CHAN_A(x)               (((x) & 0xf) - 1)
 #define BRD_DMA_CHAN_B(x)               ((((x) >> 4) & 0xf) - 1)
+// bitmask of (0-based) channels used, for compile-time checks
+#define BRD_DMA_MASK(x)                 (((1 << ((x) & 0xf)) | (1 << (((x) >> 4) & 0xf))) >> 1)
 
 // UART instances
 #define BRD_USART1                      (1 << 0)
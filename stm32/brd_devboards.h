@@ -57,8 +57,12 @@
 // Enabled USART peripherals
 #define BRD_USART       (BRD_LPUART1 | BRD_USART2)
 
-// LPUART1
+// LPUART1 (channels 2,3 are taken by SPI1 with CFG_spi_dma)
+#if defined(CFG_spi_dma)
+#define BRD_LPUART1_DMA  BRD_DMA_CHANS(7,6)
+#else
 #define BRD_LPUART1_DMA  BRD_DMA_CHANS(2,3)
+#endif
 #define GPIO_LPUART1_TX  BRD_GPIO_AF(PORT_C, 4, 2)
 #define GPIO_LPUART1_RX  BRD_GPIO_AF(PORT_C, 5, 2)
 
@@ -96,6 +100,11 @@
 #define BRD_PWR_S2_UA  5
 #endif
 
+// additional current while programming flash/EEPROM
+#ifndef BRD_PWR_NVM_UA
+#define BRD_PWR_NVM_UA 3000
+#endif
+
 
 // -------------------------------------------
 #elif defined(CFG_b_l072Z_lrwan1_board)
@@ -135,13 +144,21 @@
 // Enabled USART peripherals
 #define BRD_USART       (BRD_USART1 | BRD_USART2)
 
-// USART1
+// USART1 (channels 2,3 are taken by SPI1 with CFG_spi_dma)
+#if defined(CFG_spi_dma)
+#define BRD_USART1_DMA  BRD_DMA_CHANS(4,5)
+#else
 #define BRD_USART1_DMA  BRD_DMA_CHANS(2,3)
+#endif
 #define GPIO_USART1_TX  BRD_GPIO_AF(PORT_A,  9, 4)
 #define GPIO_USART1_RX  BRD_GPIO_AF(PORT_A, 10, 4)
 
-// USART2
+// USART2 (with CFG_spi_dma, this leaves no channels for BRD_I2C)
+#if defined(CFG_spi_dma)
+#define BRD_USART2_DMA  BRD_DMA_CHANS(7,6)
+#else
 #define BRD_USART2_DMA  BRD_DMA_CHANS(4,5)
+#endif
 #define GPIO_USART2_TX  BRD_GPIO_AF(PORT_A, 2, 4)
 #define GPIO_USART2_RX  BRD_GPIO_AF(PORT_A, 3, 4)
 
@@ -171,6 +188,11 @@
 #define BRD_PWR_S2_UA  5
 #endif
 
+// additional current while programming flash/EEPROM
+#ifndef BRD_PWR_NVM_UA
+#define BRD_PWR_NVM_UA 3000
+#endif
+
 // brown-out
 #define BRD_borlevel   9 // RM0376, pg 116: BOR level 2, around 2.0 V
 
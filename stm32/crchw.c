@@ -0,0 +1,81 @@
+// Copyright (C) 2020-2022 Michael Kuyper. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#include "peripherals.h"
+
+#if defined(CFG_crc_hw)
+
+// Implementation of crc32() and the beacon CRC (os_crc16) using the CRC
+// engine. crc32() is bit-compatible with the bootloader implementation
+// (CRC-32, reflected, over little-endian words), large regions (e.g.
+// firmware images) are fed to the engine by memory-to-memory DMA.
+
+// minimum number of words for DMA transfers
+#ifndef CRC_DMA_MINWORDS
+#define CRC_DMA_MINWORDS 64
+#endif
+
+// max. number of words per DMA transfer (CNDTR is 16 bits)
+#define CRC_DMA_MAXWORDS 0xffff
+
+static void crc_on (uint32_t cr, uint32_t pol, uint32_t init) {
+    RCC->AHBENR |= RCC_AHBENR_CRCEN;
+    CRC->POL = pol;
+    CRC->INIT = init;
+    CRC->CR = cr | CRC_CR_RESET;
+}
+
+static void crc_off (void) {
+    RCC->AHBENR &= ~RCC_AHBENR_CRCEN;
+}
+
+// memory-to-memory transfer to CRC->DR on a channel not assigned to a
+// peripheral (see hw.h), return false if none is available
+static bool crc_dma (uint32_t* buf, int nwords) {
+    int ch = dma_claim(DMA_MASK_FREE);
+    if( ch < 0 ) {
+        return false;
+    }
+    // (request selection is ignored in memory-to-memory mode)
+    dma_config(ch, 0, DMA_CCR_MEM2MEM | DMA_CCR_MINC | DMA_CCR_DIR | DMA_CCR_PSIZE_1 | DMA_CCR_MSIZE_1, 0, NULL, NULL);
+    dma_transfer(ch, &CRC->DR, buf, nwords);
+    while( dma_remaining(ch) != 0 );
+    dma_deconfig(ch);
+    return true;
+}
+
+unsigned int crc32 (void* ptr, int nwords) {
+    uint32_t* buf = ptr;
+    // bit-reversed input (per word) and output, equivalent to reflected CRC-32
+    crc_on(CRC_CR_REV_IN_0 | CRC_CR_REV_IN_1 | CRC_CR_REV_OUT, 0x04C11DB7, 0xffffffff);
+    while( nwords >= CRC_DMA_MINWORDS ) {
+        int n = (nwords > CRC_DMA_MAXWORDS) ? CRC_DMA_MAXWORDS : nwords;
+        if( !crc_dma(buf, n) ) {
+            break;
+        }
+        buf += n;
+        nwords -= n;
+    }
+    while( nwords-- > 0 ) {
+        CRC->DR = *buf++;
+    }
+    uint32_t crc = ~CRC->DR;
+    crc_off();
+    return crc;
+}
+
+// CRC-16 CCITT (XMODEM)
+unsigned int crc16 (void* ptr, int nbytes) {
+    uint8_t* buf = ptr;
+    crc_on(CRC_CR_POLYSIZE_0, 0x1021, 0);
+    while( nbytes-- > 0 ) {
+        *((volatile uint8_t*) &CRC->DR) = *buf++;
+    }
+    uint32_t crc = CRC->DR & 0xffff;
+    crc_off();
+    return crc;
+}
+
+#endif
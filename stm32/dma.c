@@ -76,6 +76,20 @@ static void dma_off (unsigned int ch) {
     hal_enableIRQs();
 }
 
+// claim an inactive channel from mask (channels not assigned to a peripheral,
+// e.g. DMA_MASK_FREE), release with dma_deconfig(); return channel or -1
+int dma_claim (unsigned int mask) {
+    int ch = -1;
+    hal_disableIRQs();
+    mask &= ~dma.active;
+    if( mask ) {
+        ch = __builtin_ctz(mask);
+        dma_on(ch);
+    }
+    hal_enableIRQs();
+    return ch;
+}
+
 #define DMACHAN(ch) ((DMA_Channel_TypeDef*)(DMA1_Channel1_BASE + (ch) * (DMA1_Channel2_BASE-DMA1_Channel1_BASE)))
 
 void dma_config (unsigned int ch, unsigned int peripheral, unsigned int ccr, unsigned int flags, dma_cb callback, void* arg) {
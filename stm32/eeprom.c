@@ -6,33 +6,71 @@
 
 #include "peripherals.h"
 
-// write 32-bit word to EEPROM memory
-void eeprom_write (void* dest, unsigned int val) {
-    u4_t* addr = dest;
-    // check previous value
-    if( *addr != val ) {
-        // unlock data eeprom memory and registers
-        FLASH->PEKEYR = 0x89ABCDEF; // FLASH_PEKEY1
-        FLASH->PEKEYR = 0x02030405; // FLASH_PEKEY2
+#if defined(SVC_pwrman)
+#include "pwrman/pwrman.h"
+#endif
+
+// Notes:
+// - Data EEPROM can only be programmed word by word (~3.2ms per word with
+//   erase, see datasheet). Unchanged words are skipped, and the memory is
+//   unlocked only once per copy.
+// - While programming, the CPU sleeps in S0. The end-of-programming interrupt
+//   is used as wake-up event only (SEVONPEND), it is never taken.
 
-        // only auto-erase if neccessary (when content is non-zero)
+static void eeprom_unlock (void) {
+    // unlock data eeprom memory and registers
+    FLASH->PEKEYR = 0x89ABCDEF; // FLASH_PEKEY1
+    FLASH->PEKEYR = 0x02030405; // FLASH_PEKEY2
+
+    // only auto-erase if neccessary (when content is non-zero)
 #if defined(STM32L0)
-        FLASH->PECR &= ~FLASH_PECR_FIX; // clear FIX
+    FLASH->PECR &= ~FLASH_PECR_FIX; // clear FIX
 #elif defined(STM32L1)
-        FLASH->PECR &= ~FLASH_PECR_FTDW; // clear FTDW
+    FLASH->PECR &= ~FLASH_PECR_FTDW; // clear FTDW
 #endif
 
-        // write value
-        *addr = val;
+    // wake-up on end of programming
+    FLASH->PECR |= FLASH_PECR_EOPIE;
+    SCB->SCR |= SCB_SCR_SEVONPEND_Msk;
+}
+
+static void eeprom_lock (void) {
+    SCB->SCR &= ~SCB_SCR_SEVONPEND_Msk;
+    FLASH->PECR &= ~FLASH_PECR_EOPIE;
 
-        // check for end of programming
-        while( FLASH->SR & FLASH_SR_BSY ); // loop while busy
+    // lock data eeprom memory and registers
+    FLASH->PECR |= FLASH_PECR_PELOCK;
+}
 
-        // lock data eeprom memory and registers
-        FLASH->PECR |= FLASH_PECR_PELOCK;
+static void eeprom_program (u4_t* addr, u4_t val) {
+    // write value
+    *addr = val;
 
-        // verify value
-	ASSERT( *((volatile u4_t*) addr) == val );
+    // zzzz.... (any event wakes us, so check for end of programming)
+    while( FLASH->SR & FLASH_SR_BSY ) {
+        __WFE();
+    }
+    FLASH->SR = FLASH_SR_EOP;
+    NVIC_ClearPendingIRQ(FLASH_IRQn);
+
+    // verify value
+    ASSERT( *((volatile u4_t*) addr) == val );
+}
+
+// write 32-bit word to EEPROM memory
+void eeprom_write (void* dest, unsigned int val) {
+    u4_t* addr = dest;
+    // check previous value
+    if( *addr != val ) {
+#ifdef SVC_pwrman
+        ostime_t t0 = hal_ticks();
+#endif
+        eeprom_unlock();
+        eeprom_program(addr, val);
+        eeprom_lock();
+#ifdef SVC_pwrman
+        pwrman_consume(PWRMAN_C_NVM, hal_ticks() - t0, BRD_PWR_NVM_UA);
+#endif
     }
 }
 
@@ -42,7 +80,25 @@ void eeprom_copy (void* dest, const void* src, int len) {
     u4_t* s = (u4_t*) src;
     len >>= 2;
 
+    bool unlocked = false;
+#ifdef SVC_pwrman
+    ostime_t t0 = hal_ticks();
+#endif
     while( len-- ) {
-        eeprom_write(d++, *s++);
+        if( *d != *s ) {
+            if( !unlocked ) {
+                eeprom_unlock();
+                unlocked = true;
+            }
+            eeprom_program(d, *s);
+        }
+        d++;
+        s++;
+    }
+    if( unlocked ) {
+        eeprom_lock();
+#ifdef SVC_pwrman
+        pwrman_consume(PWRMAN_C_NVM, hal_ticks() - t0, BRD_PWR_NVM_UA);
+#endif
     }
 }
@@ -30,6 +30,57 @@ void gpio_cfg_pin (int port, int pin, int gpiocfg) {
     gpio_end(port);
 }
 
+void gpio_cfg_pins (const gpio_pincfg* pins, int n) {
+    unsigned int done = 0;
+    for( int i = 0; i < n; i++ ) {
+        int port = BRD_PORT(pins[i].gpio);
+        if( done & (1 << port) ) {
+            continue;
+        }
+        done |= (1 << port);
+        // collect all pins of this port
+        u4_t m1 = 0, m2 = 0, moder = 0, ospeedr = 0, otyper = 0, pupdr = 0, bsrr = 0;
+        u4_t afm[2] = { 0, 0 }, af[2] = { 0, 0 };
+        for( int j = i; j < n; j++ ) {
+            if( BRD_PORT(pins[j].gpio) != port ) {
+                continue;
+            }
+            int pin = BRD_PIN(pins[j].gpio);
+            unsigned int cfg = pins[j].cfg;
+            m1 |= 1 << pin;
+            m2 |= 3 << (2*pin);
+            moder |= ((cfg >> GPIOCFG_MODE_SHIFT) & 3) << (2*pin);
+            ospeedr |= ((cfg >> GPIOCFG_OSPEED_SHIFT) & 3) << (2*pin);
+            otyper |= ((cfg >> GPIOCFG_OTYPE_SHIFT) & 1) << pin;
+            pupdr |= ((cfg >> GPIOCFG_PUPD_SHIFT) & 3) << (2*pin);
+            if( (cfg & GPIOCFG_MODE_MASK) == GPIOCFG_MODE_ALT ) {
+                afm[GPIO_AFRLR(pin)] |= GPIO_AF_PINi(pin, GPIO_AF_MASK);
+                af[GPIO_AFRLR(pin)] |= GPIO_AF_PINi(pin, cfg & GPIOCFG_AF_MASK);
+            }
+            if( pins[j].val >= 0 ) {
+                bsrr |= 1 << (pin + (pins[j].val ? 0 : 16));
+            }
+        }
+        // update registers (mode last, so pins switch with final settings)
+        GPIO_TypeDef* p = GPIOx(port);
+        gpio_begin(port);
+        if( bsrr ) {
+            p->BSRR = bsrr;
+        }
+        if( afm[0] ) {
+            p->AFR[0] = (p->AFR[0] & ~afm[0]) | af[0];
+        }
+        if( afm[1] ) {
+            p->AFR[1] = (p->AFR[1] & ~afm[1]) | af[1];
+        }
+        p->OSPEEDR = (p->OSPEEDR & ~m2) | ospeedr;
+        p->OTYPER = (p->OTYPER & ~m1) | otyper;
+        p->PUPDR = (p->PUPDR & ~m2) | pupdr;
+        p->MODER = (p->MODER & ~m2) | moder;
+        gpio_end(port);
+    }
+}
+
 void gpio_set_pin (int port, int pin, int state) {
     gpio_begin(port);
     HW_SET_PIN(GPIOx(port), pin, state);
@@ -31,14 +31,49 @@ static struct {
     u4_t reset;
 #ifdef CFG_DEBUG
     u4_t debug_suspend;
+#ifdef CFG_debug_async
+    struct {
+        u2_t rd, wr;    // read/write positions in ring
+        u2_t txn;       // bytes in current transfer
+        u4_t ovfl;      // strings dropped (not yet reported)
+        osjob_t job;
+    } dbg;
+#endif
 #endif
 #ifdef CFG_rtstats
     struct {
         uint32_t run;                   // ticks running
         uint32_t sleep[HAL_SLEEP_CNT];  // ticks sleeping
+#ifdef CFG_spi_dma
+        uint32_t spidma;                // ticks sleeping during SPI DMA (not yet accounted)
+        uint32_t spidma_total;          // ticks sleeping during SPI DMA (since last collect)
+#endif
     } rtstats;
+#endif
+#ifdef CFG_jobstats
+    u4_t irqoff_t0;     // begin of current IRQ-off section
+    u4_t irqoff_max;    // longest IRQ-off section
 #endif
     u1_t maxsleep[HAL_SLEEP_CNT-1]; // deep sleep restrictions
+#ifdef CFG_boottrace
+    struct {
+        u4_t last;                      // SysTick value at last mark
+        u4_t khz;                       // HCLK frequency
+        u8_t us;                        // microseconds since start of trace
+        u4_t t[HAL_BOOT_CNT];           // stage completion times
+    } boot;
+#endif
+#ifdef CFG_runspeed
+    u1_t runspeed;      // requested run speed
+    u1_t runclk;        // current run speed
+#endif
+#ifdef CFG_sleepgov
+    struct {
+        u2_t lat[HAL_SLEEP_CNT];        // estimated wake-up latency (1/16 ticks)
+        u4_t count[HAL_SLEEP_CNT];      // number of sleeps per mode
+        u4_t late;                      // number of wake-ups after target time
+    } sleepgov;
+#endif
     u1_t battlevel;
     boot_boottab* boottab;
 } HAL;
@@ -85,11 +120,20 @@ static void call911 (uint32_t reason, uint32_t addr) {
 }
 #endif
 
+#if defined(CFG_DEBUG) && defined(CFG_debug_async)
+static void debug_flush (void); // fwd decl
+#endif
+
 __attribute__((noreturn))
 static void panic (uint32_t reason, uint32_t addr) {
     // disable interrupts
     __disable_irq();
 
+#if defined(CFG_DEBUG) && defined(CFG_debug_async)
+    // output buffered debug messages
+    debug_flush();
+#endif
+
 #ifdef CFG_panic911
     // yelp for help
     call911(reason, addr);
@@ -157,34 +201,39 @@ static void hal_spi_init () {
     hal_spi_select(0);
 }
 
+static const gpio_pincfg spi_pins_on[] = {
+    // configure pins for alternate function SPIx (SCK, MISO, MOSI)
+    GPIO_PINCFG_AF(GPIO_SCK, GPIOCFG_OSPEED_40MHz | GPIOCFG_OTYPE_PUPD | GPIOCFG_PUPD_PDN),
+    GPIO_PINCFG_AF(GPIO_MISO, GPIOCFG_OSPEED_40MHz | GPIOCFG_OTYPE_PUPD | GPIOCFG_PUPD_PDN),
+    GPIO_PINCFG_AF(GPIO_MOSI, GPIOCFG_OSPEED_40MHz | GPIOCFG_OTYPE_PUPD | GPIOCFG_PUPD_PDN),
+    // drive chip select low
+    GPIO_PINCFG_VAL(GPIO_NSS, GPIOCFG_MODE_OUT | GPIOCFG_OSPEED_40MHz | GPIOCFG_OTYPE_PUPD | GPIOCFG_PUPD_NONE, 0),
+};
+
+static const gpio_pincfg spi_pins_off[] = {
+    // stop driving chip select, activate pull-up
+    GPIO_PINCFG(GPIO_NSS, GPIOCFG_MODE_INP | GPIOCFG_PUPD_PUP),
+    // put SCK, MISO, MOSI back to analog input (HiZ) mode
+#if defined(BRD_sck_mosi_pulldown)
+    GPIO_PINCFG(GPIO_SCK, GPIOCFG_MODE_INP | GPIOCFG_PUPD_PDN),
+    GPIO_PINCFG(GPIO_MOSI, GPIOCFG_MODE_INP | GPIOCFG_PUPD_PDN),
+#elif defined(BRD_sck_mosi_drivelow)
+    GPIO_PINCFG_VAL(GPIO_SCK, GPIOCFG_MODE_OUT | GPIOCFG_OSPEED_40MHz | GPIOCFG_OTYPE_PUPD | GPIOCFG_PUPD_NONE, 0),
+    GPIO_PINCFG_VAL(GPIO_MOSI, GPIOCFG_MODE_OUT | GPIOCFG_OSPEED_40MHz | GPIOCFG_OTYPE_PUPD | GPIOCFG_PUPD_NONE, 0),
+#else
+    GPIO_PINCFG_DEFAULT(GPIO_SCK),
+    GPIO_PINCFG_DEFAULT(GPIO_MOSI),
+#endif
+    GPIO_PINCFG_DEFAULT(GPIO_MISO),
+};
+
 void hal_spi_select (int on) {
     if (on) {
         // enable clock for SPI interface 1
         SPIx_enable();
-        // configure pins for alternate function SPIx (SCK, MISO, MOSI)
-        CFG_PIN_AF(GPIO_SCK, GPIOCFG_OSPEED_40MHz | GPIOCFG_OTYPE_PUPD | GPIOCFG_PUPD_PDN);
-        CFG_PIN_AF(GPIO_MISO, GPIOCFG_OSPEED_40MHz | GPIOCFG_OTYPE_PUPD | GPIOCFG_PUPD_PDN);
-        CFG_PIN_AF(GPIO_MOSI, GPIOCFG_OSPEED_40MHz | GPIOCFG_OTYPE_PUPD | GPIOCFG_PUPD_PDN);
-        // drive chip select low
-        SET_PIN(GPIO_NSS, 0);
-        CFG_PIN(GPIO_NSS, GPIOCFG_MODE_OUT | GPIOCFG_OSPEED_40MHz | GPIOCFG_OTYPE_PUPD | GPIOCFG_PUPD_NONE);
+        CFG_PINS(spi_pins_on);
     } else {
-        // stop driving chip select, activate pull-up
-        CFG_PIN(GPIO_NSS, GPIOCFG_MODE_INP | GPIOCFG_PUPD_PUP);
-        // put SCK, MISO, MOSI back to analog input (HiZ) mode
-#if defined(BRD_sck_mosi_pulldown)
-        CFG_PIN(GPIO_SCK, GPIOCFG_MODE_INP | GPIOCFG_PUPD_PDN);
-        CFG_PIN(GPIO_MOSI, GPIOCFG_MODE_INP | GPIOCFG_PUPD_PDN);
-#elif defined(BRD_sck_mosi_drivelow)
-        SET_PIN(GPIO_SCK, 0);
-        CFG_PIN(GPIO_SCK, GPIOCFG_MODE_OUT | GPIOCFG_OSPEED_40MHz | GPIOCFG_OTYPE_PUPD | GPIOCFG_PUPD_NONE);
-        SET_PIN(GPIO_MOSI, 0);
-        CFG_PIN(GPIO_MOSI, GPIOCFG_MODE_OUT | GPIOCFG_OSPEED_40MHz | GPIOCFG_OTYPE_PUPD | GPIOCFG_PUPD_NONE);
-#else
-        CFG_PIN_DEFAULT(GPIO_SCK);
-        CFG_PIN_DEFAULT(GPIO_MOSI);
-#endif
-        CFG_PIN_DEFAULT(GPIO_MISO);
+        CFG_PINS(spi_pins_off);
         // disable clock for SPI interface
         SPIx_disable();
     }
@@ -197,10 +246,76 @@ static u1_t spi_byte (u1_t out) {
     return SPIx->DR; // in
 }
 
-void hal_spi_transact (const u1_t* txbuf, u1_t txlen, u1_t* rxbuf, u1_t rxlen) {
+#if defined(CFG_spi_dma)
+// DMA channels used for SPI RX and TX: BRD_RADIO_SPI_DMA (see hw.h)
+#if BRD_RADIO_SPI == 1
+#define DMA_SPIx                DMA_SPI1
+#else
+#define DMA_SPIx                DMA_SPI2
+#endif
+
+// minimum number of bytes for DMA transfers
+#ifndef SPI_DMA_MINLEN
+#define SPI_DMA_MINLEN          16
+#endif
+
+static void spi_dma_cb (int status, void* arg) {
+    // nothing to do, interrupt only serves to wake us up
+}
+
+// transfer buffer using DMA while sleeping in S0 (exactly one of txbuf/rxbuf is non-NULL)
+static void spi_dma (const u1_t* txbuf, u1_t* rxbuf, int len) {
+    int ch_rx = BRD_DMA_CHAN_A(BRD_RADIO_SPI_DMA);
+    int ch_tx = BRD_DMA_CHAN_B(BRD_RADIO_SPI_DMA);
+    static u1_t dummy;
+
+    // RX must always be drained; unused direction uses dummy byte without increment
+    dma_config(ch_rx, DMA_SPIx, rxbuf ? DMA_CCR_MINC : 0, DMA_CB_COMPLETE, spi_dma_cb, NULL);
+    dma_config(ch_tx, DMA_SPIx, DMA_CCR_DIR | (txbuf ? DMA_CCR_MINC : 0), 0, NULL, NULL);
+    dummy = 0;
+    dma_transfer(ch_rx, &SPIx->DR, rxbuf ? rxbuf : &dummy, len);
+    dma_transfer(ch_tx, &SPIx->DR, txbuf ? (void*) txbuf : &dummy, len);
+    SPIx->CR2 = SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN;
+
+#ifdef CFG_rtstats
+    u4_t t0 = hal_ticks();
+#endif
+    // zzzz.... (wake-up by pending DMA IRQ also works with interrupts disabled,
+    // but not in handler mode where the DMA IRQ cannot preempt - poll instead)
+    while( dma_remaining(ch_rx) != 0 ) {
+        if( __get_IPSR() == 0 ) {
+            __WFI();
+        }
+    }
+#ifdef CFG_rtstats
+    u4_t dt = hal_ticks() - t0;
+    hal_disableIRQs();
+    HAL.rtstats.spidma += dt;
+    hal_enableIRQs();
+#endif
+
+    SPIx->CR2 = 0;
+    dma_deconfig(ch_tx);
+    dma_deconfig(ch_rx);
+}
+#endif
+
+__hotcode void hal_spi_transact (const u1_t* txbuf, u1_t txlen, u1_t* rxbuf, u1_t rxlen) {
+#if defined(CFG_spi_dma)
+    if( txlen >= SPI_DMA_MINLEN ) {
+        spi_dma(txbuf, NULL, txlen);
+        txlen = 0;
+    }
+#endif
     for( int i = 0; i < txlen; i++) {
         spi_byte(txbuf[i]);
     }
+#if defined(CFG_spi_dma)
+    if( rxlen >= SPI_DMA_MINLEN ) {
+        spi_dma(NULL, rxbuf, rxlen);
+        rxlen = 0;
+    }
+#endif
     for( int i = 0; i < rxlen; i++) {
         rxbuf[i] = spi_byte(0);
     }
@@ -214,11 +329,16 @@ void hal_spi_transact (const u1_t* txbuf, u1_t txlen, u1_t* rxbuf, u1_t rxlen) {
 // - 32.768kHz LSE must be available
 // - LPTIM1 using LSE as clock source to keep time (always on)
 // - LPTIM1 is 16bit, so it will roll-over every 2 seconds, causing a wake-up
+// - CFG_longsleep: for long S2 sleeps, the RTC wake-up timer (1Hz) is used
+//   for the coarse part of the sleep with the LPTIM1 interrupt masked; the
+//   missed roll-overs are recovered from the RTC calendar on wake-up
 //
 // - TIM22 also uses the LSE as clock source
 // - TIM22 can be correlated to LPTIM1
 // - TIM22 is used as the on-time wake-up source for S0/S1
 // - TIM22 can be used to timestamp external events, e.g. DIO0 from the radio
+//   (CFG_dio_capture: DIO pins routed to TIM22_CH1, BRD_GPIO_CHAN(1), are
+//   captured in hardware; CH2 is reserved for the S0/S1 wake-up)
 //
 //
 //    R0 ──────┬────────┐
@@ -266,8 +386,19 @@ void hal_spi_transact (const u1_t* txbuf, u1_t txlen, u1_t* rxbuf, u1_t rxlen) {
 // - When switching clocks or clock frequencies, the TIM22 peripheral misses
 //   some clock edges.
 //
-// Things to consider:
-// - Option to set Run speed (16Mhz could be enough and save power)
+// Run speed (CFG_runspeed):
+// - hal_setRunSpeed() selects R0 (32MHz PLL, Vrange 1), 16MHz HSI (Vrange 2,
+//   ~3.3 mA) or R1 (4MHz MSI, Vrange 3, ~0.7 mA) while running.
+// - Peripherals clocked from PCLK (USART, I2C, timers, LEDs) hold S0 while
+//   active; as long as S0 is held, the HAL stays at or returns to R0, so
+//   baud rates and timings remain valid.
+// - Wake-up from S1/S2 is always to R0, the requested speed is re-applied
+//   before returning from hal_sleep().
+// - Example (class A sensor, 1 uplink/15 min): eefs writes, pwrman commits and
+//   GC are ~250 ms of R0 per uplink, mostly waiting for EEPROM programming in
+//   S0 (unaffected). Of the remaining ~60 ms CPU time, running at 16MHz costs
+//   2x the time at 0.46x the current, saving ~5 uAh/day; at 4MHz (4x time,
+//   0.1x current) ~42 uAh/day (~30 uAh/day with R1 -> S0 at 4MHz).
 
 
 #define PWR_CR_VOS_VRANGE1      (               PWR_CR_VOS_0)   // 1.8 V
@@ -284,8 +415,10 @@ void hal_spi_transact (const u1_t* txbuf, u1_t txlen, u1_t* rxbuf, u1_t rxlen) {
     } \
 } while (0)
 
-// initialize the LSE and the LPTIM1 peripheral
-static void time_init (void) {
+// start the LSE (unless still running after a warm reset); start-up takes
+// several hundred milliseconds, so this is done first thing in hal_init and
+// time_init() only waits for it to become ready.
+static void lse_start (void) {
     // check if LSE is still on
     if( (RCC->CSR & RCC_CSR_LSEON) == 0) {
         // enable power manager peripheral
@@ -310,7 +443,31 @@ static void time_init (void) {
         // disable power manager peripheral
         RCC->APB1ENR &= ~RCC_APB1ENR_PWREN;
     }
+}
+
+#if defined(CFG_longsleep)
+// run the RTC calendar from the LSE (1Hz with default prescalers), and
+// route the wake-up timer to EXTI line 20
+static void rtc_init (void) {
+    RCC->APB1ENR |= RCC_APB1ENR_PWREN;
+    PWR->CR |= PWR_CR_DBP;
+    if( (RCC->CSR & RCC_CSR_RTCEN) == 0 ) {
+        RCC->CSR |= RCC_CSR_RTCSEL_LSE | RCC_CSR_RTCEN;
+    }
+    RTC->WPR = 0xca;
+    RTC->WPR = 0x53;
+    RTC->CR = (RTC->CR & ~(RTC_CR_WUTE | RTC_CR_WUTIE)) | RTC_CR_BYPSHAD;
+    RTC->WPR = 0xff;
+    PWR->CR &= ~PWR_CR_DBP;
+    RCC->APB1ENR &= ~RCC_APB1ENR_PWREN;
+
+    EXTI->IMR |= EXTI_IMR_IM20;
+    EXTI->RTSR |= EXTI_RTSR_TR20;
+}
+#endif
 
+// initialize the LPTIM1 peripheral
+static void time_init (void) {
     // wait until LSE is ready
     SAFE_while(PANIC_LSE_NOSTART, (RCC->CSR & RCC_CSR_LSERDY) == 0);
 
@@ -339,6 +496,10 @@ static void time_init (void) {
     // start counting in continuous mode
     LPTIM1->CR |= LPTIM_CR_CNTSTRT;
 
+#if defined(CFG_longsleep)
+    rtc_init();
+#endif
+
     // enable clock to TIM22 peripheral
     RCC->APB2ENR |= RCC_APB2ENR_TIM22EN;
 
@@ -522,6 +683,69 @@ static void clock_run (void) {
     RCC->CR &= ~RCC_CR_MSION;
 }
 
+#ifdef CFG_runspeed
+static void clock_slow (int speed) {
+    if( speed == HAL_RUNSPEED_REDUCED ) {
+        // switch clock source to HSI (already running)
+        RCC->CFGR = (RCC->CFGR & ~RCC_CFGR_SW) | RCC_CFGR_SW_HSI;
+        while( (RCC->CFGR & RCC_CFGR_SWS) != RCC_CFGR_SWS_HSI );
+
+        // disable PLL
+        RCC->CR &= ~RCC_CR_PLLON;
+
+        // select Vrange 2 (keep 1 flash wait state, required for 16MHz)
+        RCC->APB1ENR |= RCC_APB1ENR_PWREN;
+        PWR->CR = PWR_CR_VOS_VRANGE2;
+        while( (PWR->CSR & PWR_CSR_VOSF) != 0 );
+        RCC->APB1ENR &= ~RCC_APB1ENR_PWREN;
+    } else {
+        // startup MSI @4MHz
+        RCC->ICSCR = (RCC->ICSCR & ~RCC_ICSCR_MSIRANGE) | RCC_ICSCR_MSIRANGE_6;
+        RCC->CR |= RCC_CR_MSION;
+        while( (RCC->CR & RCC_CR_MSIRDY) == 0 );
+
+        // switch clock source to MSI
+        RCC->CFGR = (RCC->CFGR & ~RCC_CFGR_SW) | RCC_CFGR_SW_MSI;
+        while( (RCC->CFGR & RCC_CFGR_SWS) != RCC_CFGR_SWS_MSI );
+
+        // disable flash wait states
+        FLASH->ACR &= ~FLASH_ACR_LATENCY;
+        while( (FLASH->ACR & FLASH_ACR_LATENCY) != 0 );
+
+        // disable PLL and HSI
+        RCC->CR &= ~(RCC_CR_PLLON | RCC_CR_HSION);
+
+        // select Vrange 3
+        RCC->APB1ENR |= RCC_APB1ENR_PWREN;
+        PWR->CR = PWR_CR_VOS_VRANGE3;
+        while( (PWR->CSR & PWR_CSR_VOSF) != 0 );
+        RCC->APB1ENR &= ~RCC_APB1ENR_PWREN;
+    }
+}
+
+// switch to requested run speed, unless full speed is required (IRQs must be disabled)
+static void runspeed_apply (void) {
+    int speed = HAL.maxsleep[HAL_SLEEP_S0] ? HAL_RUNSPEED_FULL : HAL.runspeed;
+    if( speed != HAL.runclk ) {
+        if( HAL.runclk != HAL_RUNSPEED_FULL ) {
+            clock_run();
+        }
+        if( speed != HAL_RUNSPEED_FULL ) {
+            clock_slow(speed);
+        }
+        HAL.runclk = speed;
+    }
+}
+
+void hal_setRunSpeed (u1_t speed) {
+    ASSERT(speed <= HAL_RUNSPEED_LOW);
+    hal_disableIRQs();
+    HAL.runspeed = speed;
+    runspeed_apply();
+    hal_enableIRQs();
+}
+#endif
+
 static void clock_sleep (int stype) {
     // startup MSI
     if( stype == HAL_SLEEP_S1 ) {
@@ -635,11 +859,173 @@ u4_t hal_ticks () {
     return hal_xticks();
 }
 
+#ifdef CFG_sleepgov
+// Adaptive sleep governor: the wake-up latency of each mode is measured on
+// every timer wake-up (from the programmed compare point to being back in
+// hal_sleep with the run clock up) and tracked per mode. Increases are taken
+// over immediately, decreases are smoothed (1/16 per sample), so the estimate
+// follows the worst recent case. The deepest mode whose latency (plus margin)
+// fits before the target is selected, and the wake-up is advanced by it.
+
+#define SLEEPGOV_MARGIN 2       // ticks added to estimate
+
+// initial estimates and upper bounds (ticks)
+static const u2_t SLEEPGOV_LAT0[HAL_SLEEP_CNT] = { 0, 4, 177 };
+static const u2_t SLEEPGOV_LATMAX[HAL_SLEEP_CNT] = { 8, 32, 400 };
+
+static void sleepgov_init (void) {
+    for( int i = 0; i < HAL_SLEEP_CNT; i++ ) {
+        HAL.sleepgov.lat[i] = SLEEPGOV_LAT0[i] << 4;
+    }
+}
+
+// wake-up advance for sleep mode (ticks)
+static u4_t sleepgov_th (int stype) {
+    return (stype == HAL_SLEEP_S0) ? 0 : ((HAL.sleepgov.lat[stype] + 15) >> 4) + SLEEPGOV_MARGIN;
+}
+
+static void sleepgov_update (int stype, u4_t wake, u4_t now, u4_t target) {
+    HAL.sleepgov.count[stype] += 1;
+    if( (s4_t) (now - target) > 0 ) {
+        HAL.sleepgov.late += 1;
+    }
+    s4_t sample = now - wake;
+    if( sample < 0 || sample > SLEEPGOV_LATMAX[stype] ) {
+        return; // woken up early by other interrupt, or outlier
+    }
+    u2_t* lat = &HAL.sleepgov.lat[stype];
+    if( (sample << 4) > *lat ) {
+        *lat = sample << 4;
+    } else {
+        *lat -= (*lat - (sample << 4) + 15) >> 4;
+    }
+}
+
+void hal_sleepgov_collect (hal_sleepgov* stats) {
+    hal_disableIRQs();
+    for( int i = 0; i < HAL_SLEEP_CNT; i++ ) {
+        stats->lat_ticks[i] = (HAL.sleepgov.lat[i] + 15) >> 4;
+        stats->count[i] = HAL.sleepgov.count[i];
+        HAL.sleepgov.count[i] = 0;
+    }
+    stats->late = HAL.sleepgov.late;
+    HAL.sleepgov.late = 0;
+    hal_enableIRQs();
+}
+
+#define S_TH(stype)     sleepgov_th(stype)
+#else
+static const u8_t S_TH_FIXED[] = {
+    0, 6, 190
+};
+#define S_TH(stype)     S_TH_FIXED[stype]
+#endif
+
+#if defined(CFG_longsleep)
+// Long S2 sleeps: the coarse part is slept in whole seconds on the RTC
+// wake-up timer, ending at least 2s before the final LPTIM1 roll-over; the
+// remainder is a regular S2 sleep. LPTIM1 keeps counting, but its
+// interrupt is masked so that roll-overs do not wake up the MCU. On wake-up,
+// HAL.ticks is recovered from the elapsed RTC time (1/256s resolution),
+// which resolves the exact 16-bit count unambiguously.
+
+#define LONGSLEEP_MIN   4       // (sec) shortest coarse sleep
+
+// current RTC time in 1/256 seconds (since midnight)
+static u4_t rtc_now (void) {
+    u4_t ss, tr;
+    do {
+        ss = RTC->SSR;
+        tr = RTC->TR;
+    } while( ss != RTC->SSR );
+    u4_t h = ((tr >> 20) & 0x3) * 10 + ((tr >> 16) & 0xf);
+    u4_t m = ((tr >> 12) & 0x7) * 10 + ((tr >> 8) & 0xf);
+    u4_t sec = ((tr >> 4) & 0x7) * 10 + (tr & 0xf);
+    return ((h * 60 + m) * 60 + sec) * 256 + (255 - (ss & RTC_SSR_SS));
+}
+
+// program (secs > 0) or disable (secs == 0) the RTC wake-up timer
+static void rtc_wakeup (u4_t secs) {
+    RCC->APB1ENR |= RCC_APB1ENR_PWREN;
+    PWR->CR |= PWR_CR_DBP;
+    RTC->WPR = 0xca;
+    RTC->WPR = 0x53;
+    RTC->CR &= ~(RTC_CR_WUTE | RTC_CR_WUTIE);
+    RTC->ISR = ~(RTC_ISR_WUTF | RTC_ISR_INIT) | (RTC->ISR & RTC_ISR_INIT);
+    if( secs ) {
+        while( (RTC->ISR & RTC_ISR_WUTWF) == 0 );
+        RTC->WUTR = secs - 1;
+        RTC->CR = (RTC->CR & ~RTC_CR_WUCKSEL) | RTC_CR_WUCKSEL_2 | RTC_CR_WUTIE | RTC_CR_WUTE;
+    }
+    RTC->WPR = 0xff;
+    PWR->CR &= ~PWR_CR_DBP;
+    RCC->APB1ENR &= ~RCC_APB1ENR_PWREN;
+    EXTI->PR = EXTI_PR_PR20;
+    NVIC->ICPR[0] = (1 << RTC_IRQn);
+}
+
+__fastcode static void sleep2_wfi (void) {
+    clock_sleep(HAL_SLEEP_S2);
+    flash_off();
+    __WFI();
+    flash_on();
+    clock_run();
+}
+
+// sleep until shortly before the final roll-over preceding xtt; returns true
+// if woken up by another interrupt (NOTE: interrupts must be disabled)
+static bool longsleep (u8_t xtt) {
+    u8_t xnow = hal_xticks_unsafe();
+    s8_t dt = (s8_t) (xtt & ~0xffffULL) - (s8_t) xnow;
+    s4_t secs = (dt >> 15) - 2;
+    if( secs < LONGSLEEP_MIN ) {
+        return false;
+    }
+#if CFG_watchdog
+    if( secs > 4 ) {
+        secs = 4; // (refreshed below)
+    }
+#endif
+    u4_t rtc0 = rtc_now();
+
+    NVIC_DisableIRQ(LPTIM1_IRQn);
+    rtc_wakeup(secs);
+    NVIC_EnableIRQ(RTC_IRQn);
+
+    // zzzz....
+    sleep2_wfi();
+
+    bool timeout = (RTC->ISR & RTC_ISR_WUTF) != 0;
+    NVIC_DisableIRQ(RTC_IRQn);
+    rtc_wakeup(0);
+
+    // elapsed time (mod 24h) in ticks
+    u4_t el = rtc_now() + 86400 * 256 - rtc0;
+    if( el >= 86400 * 256 ) {
+        el -= 86400 * 256;
+    }
+    u8_t est = xnow + (u8_t) el * (OSTICKS_PER_SEC / 256);
+
+    // recover high ticks from exact count (without pending roll-over)
+    u4_t cnt;
+    do {
+        LPTIM1->ICR = LPTIM_ICR_ARRMCF;
+        while( (LPTIM1->ISR & LPTIM_ISR_ARRM) != 0 );
+        cnt = time_cnt_unsafe();
+    } while( (LPTIM1->ISR & LPTIM_ISR_ARRM) != 0 );
+    HAL.ticks = (est - cnt + 0x8000) >> 16;
+
+    NVIC->ICPR[0] = (1 << LPTIM1_IRQn);
+    NVIC_EnableIRQ(LPTIM1_IRQn);
+#if CFG_watchdog
+    IWDG->KR = 0xaaaa; // refresh
+#endif
+    return !timeout;
+}
+#endif
+
 // NOTE: interrupts are already be disabled when this HAL function is called!
 void hal_sleep (u1_t type, u4_t targettime) {
-    static const u8_t S_TH[] = {
-        0, 6, 190
-    };
 
     u8_t xnow = hal_xticks_unsafe();
     s4_t dt = (s4_t) targettime - (s4_t) xnow;
@@ -650,14 +1036,14 @@ void hal_sleep (u1_t type, u4_t targettime) {
     // select sleep type
     int stype;
     for( stype = 0; stype < (HAL_SLEEP_CNT-1); stype++ ) {
-        if( dt < S_TH[stype + 1] || HAL.maxsleep[stype] ) {
+        if( dt < S_TH(stype + 1) || HAL.maxsleep[stype] ) {
             break;
         }
     }
 
     // only use S2 if htt would be strictly larger
     if( stype == HAL_SLEEP_S2 ) {
-        u8_t xtt = xnow + dt - S_TH[HAL_SLEEP_S2];
+        u8_t xtt = xnow + dt - S_TH(HAL_SLEEP_S2);
         if( (xtt >> 16) <= (xnow >> 16) ) {
             stype -= 1;
         }
@@ -667,18 +1053,50 @@ void hal_sleep (u1_t type, u4_t targettime) {
     static ostime_t wakeup;
     ostime_t t1 = xnow;
     ASSERT((t1 - wakeup) >= 0);
+#ifdef CFG_spi_dma
+    // move S0 sleep during SPI DMA out of run time
+    wakeup += HAL.rtstats.spidma;
+    HAL.rtstats.sleep[HAL_SLEEP_S0] += HAL.rtstats.spidma;
+    HAL.rtstats.spidma_total += HAL.rtstats.spidma;
+    HAL.rtstats.spidma = 0;
+#endif
     HAL.rtstats.run += (t1 - wakeup);
 #endif
 
-    xnow += (dt - S_TH[stype]);
+    xnow += (dt - S_TH(stype));
+#if defined(CFG_longsleep)
+    if( stype != HAL_SLEEP_S2 || !longsleep(xnow) )
+#endif
     sleep(stype, xnow >> 16, xnow & 0xffff);
 
+#ifdef CFG_runspeed
+    if( stype != HAL_SLEEP_S0 ) {
+        // woken up to R0
+        HAL.runclk = HAL_RUNSPEED_FULL;
+    }
+#endif
+
+#ifdef CFG_sleepgov
+    // S2 wakes up on the high tick boundary only
+    sleepgov_update(stype, (stype == HAL_SLEEP_S2) ? (u4_t) (xnow & ~0xffffULL) : (u4_t) xnow,
+            hal_ticks_unsafe(), targettime);
+#endif
+
+#ifdef CFG_jobstats
+    // don't account sleep time as IRQ-off time
+    HAL.irqoff_t0 = hal_ticks_unsafe();
+#endif
+
 #ifdef CFG_rtstats
     ostime_t t2 = hal_ticks_unsafe();
     ASSERT((t2 - t1) >= 0);
     HAL.rtstats.sleep[stype] += (t2 - t1);
     wakeup = t2;
 #endif
+
+#ifdef CFG_runspeed
+    runspeed_apply();
+#endif
 }
 
 // short-term busy wait
@@ -696,6 +1114,9 @@ void hal_setMaxSleep (unsigned int level) {
     hal_disableIRQs();
     ASSERT(level < HAL_SLEEP_CNT-1);
     HAL.maxsleep[level] += 1;
+#ifdef CFG_runspeed
+    runspeed_apply();
+#endif
     hal_enableIRQs();
 }
 
@@ -704,6 +1125,9 @@ void hal_clearMaxSleep (unsigned int level) {
     ASSERT(level < HAL_SLEEP_CNT-1);
     ASSERT(HAL.maxsleep[level]);
     HAL.maxsleep[level] -= 1;
+#ifdef CFG_runspeed
+    runspeed_apply();
+#endif
     hal_enableIRQs();
 }
 
@@ -711,24 +1135,39 @@ void hal_clearMaxSleep (unsigned int level) {
 // -----------------------------------------------------------------------------
 // I/O
 
-static void hal_io_init () {
+// initial pin configuration (boards can add entries via BRD_IO_INIT)
+static const gpio_pincfg io_init_pins[] = {
+#if 1
+    // disable single-wire debug (SWD) when running
+    GPIO_PINCFG_DEFAULT(BRD_GPIO(PORT_A, 13)),
+    GPIO_PINCFG_DEFAULT(BRD_GPIO(PORT_A, 14)),
+#endif
+#if defined(CFG_wailmer_board) || defined(CFG_wailord_board) || defined(CFG_coxproto_board) || defined(CFG_itrack_board)
+    // ensure GNSS is turned off (there is no external pull-down on load switch control line)
+    GPIO_PINCFG_VAL(GPIO_GNSS_EN, GPIOCFG_MODE_OUT | GPIOCFG_OSPEED_400kHz | GPIOCFG_OTYPE_PUPD | GPIOCFG_PUPD_NONE, 0),
+#endif
 #ifndef CFG_noradio
 #if defined(GPIO_RX)
-    SET_PIN_ONOFF(GPIO_RX, 0);
-    CFG_PIN(GPIO_RX, GPIOCFG_MODE_OUT | GPIOCFG_OSPEED_40MHz | GPIOCFG_OTYPE_PUPD | GPIOCFG_PUPD_NONE);
+    GPIO_PINCFG_OFF(GPIO_RX, GPIOCFG_MODE_OUT | GPIOCFG_OSPEED_40MHz | GPIOCFG_OTYPE_PUPD | GPIOCFG_PUPD_NONE),
 #endif
 #if defined(GPIO_TX)
-    SET_PIN_ONOFF(GPIO_TX, 0);
-    CFG_PIN(GPIO_TX, GPIOCFG_MODE_OUT | GPIOCFG_OSPEED_40MHz | GPIOCFG_OTYPE_PUPD | GPIOCFG_PUPD_NONE);
+    GPIO_PINCFG_OFF(GPIO_TX, GPIOCFG_MODE_OUT | GPIOCFG_OSPEED_40MHz | GPIOCFG_OTYPE_PUPD | GPIOCFG_PUPD_NONE),
 #endif
 #if defined(GPIO_TX2)
-    SET_PIN_ONOFF(GPIO_TX2, 0);
-    CFG_PIN(GPIO_TX2, GPIOCFG_MODE_OUT | GPIOCFG_OSPEED_40MHz | GPIOCFG_OTYPE_PUPD | GPIOCFG_PUPD_NONE);
+    GPIO_PINCFG_OFF(GPIO_TX2, GPIOCFG_MODE_OUT | GPIOCFG_OSPEED_40MHz | GPIOCFG_OTYPE_PUPD | GPIOCFG_PUPD_NONE),
 #endif
 #ifdef GPIO_TXRX_EN
-    SET_PIN_ONOFF(GPIO_TXRX_EN, 0);
-    CFG_PIN(GPIO_TXRX_EN, GPIOCFG_MODE_OUT | GPIOCFG_OSPEED_40MHz | GPIOCFG_OTYPE_PUPD | GPIOCFG_PUPD_NONE);
+    GPIO_PINCFG_OFF(GPIO_TXRX_EN, GPIOCFG_MODE_OUT | GPIOCFG_OSPEED_40MHz | GPIOCFG_OTYPE_PUPD | GPIOCFG_PUPD_NONE),
+#endif
 #endif
+#ifdef BRD_IO_INIT
+    BRD_IO_INIT
+#endif
+};
+
+static void hal_io_init () {
+    CFG_PINS(io_init_pins);
+#ifndef CFG_noradio
 #ifdef GPIO_DIO0
     IRQ_PIN(GPIO_DIO0, GPIO_IRQ_RISING);
 #endif
@@ -777,7 +1216,11 @@ void hal_ant_switch (u1_t val) {
     } else {
 #ifdef SVC_pwrman
         t1 = now;
-        ctype = (val == HAL_ANTSW_RX) ? PWRMAN_C_RX : PWRMAN_C_TX;
+        if( val == HAL_ANTSW_RX ) {
+            ctype = LMIC.radioPwr_rxon ? PWRMAN_C_RXC : PWRMAN_C_RX;
+        } else {
+            ctype = pwrman_txclass(LMIC.txpow);
+        }
         radio_ua = LMIC.radioPwr_ua;
 #endif
 #ifdef GPIO_TXRX_EN
@@ -809,27 +1252,61 @@ void hal_pin_busy_wait (void) {
 #ifdef GPIO_BUSY
     CFG_PIN(GPIO_BUSY, GPIOCFG_MODE_INP | GPIOCFG_OSPEED_40MHz);
 
+#if defined(CFG_busy_sleep)
+    if (GET_PIN(GPIO_BUSY) != 0) {
+        u4_t mask = 1 << BRD_PIN(GPIO_BUSY);
+        // generate event (not interrupt) on falling edge of BUSY
+        gpio_cfg_extirq_ex(BRD_PORT(GPIO_BUSY), BRD_PIN(GPIO_BUSY), false, true);
+        EXTI->EMR |= mask;
+        // zzzz.... (event is armed before pin is re-checked, so no edge can be missed)
+        while (GET_PIN(GPIO_BUSY) != 0) {
+            __WFE();
+        }
+        EXTI->EMR &= ~mask;
+        EXTI->FTSR &= ~mask;
+        EXTI->PR = mask;
+    }
+#else
     while (GET_PIN(GPIO_BUSY) != 0);
+#endif
 
     CFG_PIN_DEFAULT(GPIO_BUSY);
 #endif
 }
 
+#if defined(CFG_dio_capture)
+// Replace software timestamp with TIM22 input capture of the edge. TIM22 and
+// LPTIM1 both count LSE ticks, so the capture is converted by subtracting the
+// ticks elapsed since the edge, read from TIM22 right after the timestamp.
+static void dio_captime (int gpio, u4_t* time) {
+    unsigned int ch = BRD_GPIO_GET_CHAN(gpio) - 1;
+    ASSERT(ch == 0);
+    if( TIM22->SR & TIM_SR_CC1IF ) {
+        u2_t ct = TIM22->CCR1; // (clears CC1IF)
+        u2_t tx = TIM22->CNT;
+        TIM22->SR = ~TIM_SR_CC1OF;
+        *time -= (u2_t) (tx - ct);
+    }
+}
+#define DIO_CAPTIME(gpio,time) do { \
+    if( BRD_GPIO_GET_CHAN(gpio) ) { \
+        dio_captime(gpio, time); \
+    } \
+} while( 0 )
+#else
+#define DIO_CAPTIME(gpio,time) do { } while( 0 )
+#endif
+
 #define DIO_UPDATE(dio,mask,time) do { \
     if( (EXTI->PR & (1 << BRD_PIN(GPIO_DIO ## dio))) ) { \
         EXTI->PR = (1 << BRD_PIN(GPIO_DIO ## dio)); \
         *(mask) |= (1 << dio); \
-        /* if( BRD_GPIO_GET_CHAN(GPIO_DIO ## dio) ) { \
-            unsigned int ch = BRD_GPIO_GET_CHAN(GPIO_DIO ## dio) - 1; \
-            ASSERT(TIMx->SR & (TIM_SR_CC1IF << ch)); \
-            s2_t ct = (&(TIMx->CCR1))[ch]; \
-            *(time) += (ct - (s2_t) *(time)); \
-        } */ \
+        DIO_CAPTIME(GPIO_DIO ## dio, time); \
     } \
 } while( 0 )
 
 // generic EXTI IRQ handler for all channels
-static void EXTI_IRQHandler () {
+__hotcode static void EXTI_IRQHandler () {
     u4_t now = hal_ticks_unsafe();
     u1_t diomask = 0;
 #ifdef GPIO_DIO0
@@ -865,12 +1342,14 @@ static void EXTI_IRQHandler () {
 
 static void dio_config (int mask, int pin, int gpio) {
     if( mask & pin ) {
-#if 0
+#if defined(CFG_dio_capture)
         if( BRD_GPIO_GET_CHAN(gpio) ) {
-            unsigned int ch = BRD_GPIO_GET_CHAN(gpio) - 1;
-            TIMx->CCMR1 |= (1 << (ch << 3));
-            TIMx->SR = ~(TIM_SR_CC1IF << ch);
-            TIMx->CCER |= (TIM_CCER_CC1E << (ch << 2));
+            // TIM22_CH1 input capture on rising edge (EXTI still sees the pin)
+            TIM22->CCER &= ~(TIM_CCER_CC1E | TIM_CCER_CC1P | TIM_CCER_CC1NP);
+            TIM22->CCMR1 = (TIM22->CCMR1 & ~(TIM_CCMR1_CC1S | TIM_CCMR1_IC1F | TIM_CCMR1_IC1PSC))
+                | TIM_CCMR1_CC1S_0;
+            TIM22->SR = ~(TIM_SR_CC1IF | TIM_SR_CC1OF);
+            TIM22->CCER |= TIM_CCER_CC1E;
             CFG_PIN_AF(gpio, 0);
         } else
 #endif
@@ -879,10 +1358,9 @@ static void dio_config (int mask, int pin, int gpio) {
         }
         IRQ_PIN_SET(gpio, 1);
     } else {
-#if 0
+#if defined(CFG_dio_capture)
         if( BRD_GPIO_GET_CHAN(gpio) ) {
-            unsigned int ch = BRD_GPIO_GET_CHAN(gpio) - 1;
-            TIMx->CCER &= ~(TIM_CCER_CC1E << (ch << 2));
+            TIM22->CCER &= ~TIM_CCER_CC1E;
         }
 #endif
         IRQ_PIN_SET(gpio, 0);
@@ -926,15 +1404,43 @@ void hal_irqmask_set (int mask) {
 
 void hal_disableIRQs () {
     __disable_irq();
+#ifdef CFG_jobstats
+    if( HAL.irqlevel == 0 ) {
+        HAL.irqoff_t0 = hal_ticks_unsafe();
+    }
+#endif
     HAL.irqlevel++;
 }
 
 void hal_enableIRQs () {
     if(--HAL.irqlevel == 0) {
+#ifdef CFG_jobstats
+        u4_t dt = hal_ticks_unsafe() - HAL.irqoff_t0;
+        if( dt > HAL.irqoff_max ) {
+            HAL.irqoff_max = dt;
+        }
+#endif
         __enable_irq();
     }
 }
 
+#ifdef CFG_jobstats
+u4_t hal_irqoff_max (void) {
+    hal_disableIRQs();
+    u4_t max = HAL.irqoff_max;
+    HAL.irqoff_max = 0;
+    hal_enableIRQs();
+    return max;
+}
+#endif
+
+#ifdef CFG_stackmon
+void* hal_stack_limit (void) {
+    extern uint32_t _ebss; // provided by linker script
+    return &_ebss;
+}
+#endif
+
 #ifdef CFG_rtstats
 void hal_rtstats_collect (hal_rtstats* stats) {
     stats->run_ticks = HAL.rtstats.run;
@@ -943,6 +1449,10 @@ void hal_rtstats_collect (hal_rtstats* stats) {
         stats->sleep_ticks[i] = HAL.rtstats.sleep[i];
         HAL.rtstats.sleep[i] = 0;
     }
+#ifdef CFG_spi_dma
+    stats->spidma_ticks = HAL.rtstats.spidma_total;
+    HAL.rtstats.spidma_total = 0;
+#endif
 }
 #endif
 
@@ -992,6 +1502,37 @@ static void setbrownout (int level) {
 static void debug_init (void); // fwd decl
 #endif
 
+#ifdef CFG_boottrace
+// Boot stages are timed with SysTick (HCLK/8, 24-bit down-counter, not used
+// otherwise), since LPTIM1 only runs once the LSE is ready. The count since
+// the last mark is converted at the current HCLK frequency, so marks must be
+// less than 2^24 SysTick periods apart (>4s at 32MHz).
+
+static void boottrace_init (void) {
+    SysTick->LOAD = SysTick_LOAD_RELOAD_Msk;
+    SysTick->VAL = 0;
+    SysTick->CTRL = SysTick_CTRL_ENABLE_Msk; // external reference (HCLK/8)
+    HAL.boot.last = SysTick->VAL;
+    HAL.boot.khz = 2097; // MSI @2.1MHz at startup
+}
+
+void hal_boottrace_mark (int stage) {
+    if( SysTick->CTRL & SysTick_CTRL_ENABLE_Msk ) {
+        u4_t now = SysTick->VAL;
+        HAL.boot.us += ((u8_t) ((HAL.boot.last - now) & SysTick_LOAD_RELOAD_Msk) * 8000) / HAL.boot.khz;
+        HAL.boot.last = now;
+        HAL.boot.t[stage] = HAL.boot.us;
+        if( stage == HAL_BOOT_CNT - 1 ) {
+            SysTick->CTRL = 0;
+        }
+    }
+}
+
+const u4_t* hal_boottrace (void) {
+    return HAL.boot.t;
+}
+#endif
+
 void hal_init (void* bootarg) {
     memset(&HAL, 0x00, sizeof(HAL));
     HAL.boottab = bootarg;
@@ -1002,6 +1543,13 @@ void hal_init (void* bootarg) {
 
     ASSERT(HAL.boottab->version >= 0x105); // require bootloader v261
 
+#ifdef CFG_boottrace
+    boottrace_init();
+#endif
+
+    // let the LSE start up while the rest is initialized
+    lse_start();
+
 #ifdef BRD_borlevel
     setbrownout(BRD_borlevel);
 #endif
@@ -1009,27 +1557,24 @@ void hal_init (void* bootarg) {
     hal_disableIRQs();
 
     clock_init();
-
-    hal_pd_init();
-
-#if 1
-    // disable single-wire debug (SWD) when running
-    CFG_PIN_DEFAULT(BRD_GPIO(PORT_A, 13));
-    CFG_PIN_DEFAULT(BRD_GPIO(PORT_A, 14));
+    BOOTTRACE(HAL_BOOT_CLOCK);
+#ifdef CFG_boottrace
+    HAL.boot.khz = 32000;
 #endif
-
-#if defined(CFG_wailmer_board) || defined(CFG_wailord_board) || defined(CFG_coxproto_board) || defined(CFG_itrack_board)
-    // ensure GNSS is turned off (there is no external pull-down on load switch control line)
-    CFG_PIN(GPIO_GNSS_EN, GPIOCFG_MODE_OUT | GPIOCFG_OSPEED_400kHz | GPIOCFG_OTYPE_PUPD | GPIOCFG_PUPD_NONE);
-    SET_PIN(GPIO_GNSS_EN, 0);
+#ifdef CFG_sleepgov
+    sleepgov_init();
 #endif
 
-    // configure radio I/O and interrupt handler
+    hal_pd_init();
+
+    // configure initial pin states, radio I/O and interrupt handler
     hal_io_init();
     // configure radio SPI
     hal_spi_init();
+    BOOTTRACE(HAL_BOOT_IO);
     // configure timer and interrupt handler
     time_init();
+    BOOTTRACE(HAL_BOOT_TIMER);
 
     hal_enableIRQs();
 
@@ -1045,9 +1590,11 @@ void hal_init (void* bootarg) {
 #ifdef CFG_DEBUG
     debug_init();
 #endif
+    BOOTTRACE(HAL_BOOT_PERIPH);
 
 #if defined(SVC_eefs)
     eefs_init((void*) APPDATA_BASE, APPDATA_SZ);
+    BOOTTRACE(HAL_BOOT_EEFS);
 #endif
 }
 
@@ -1085,6 +1632,10 @@ const irqdef HAL_irqdefs[] = {
 #endif
 #endif
 
+#if defined(BRD_LED_TIM) && BRD_LED_TIM == 2
+    { TIM2_IRQn, leds_pwm_irq },
+#endif
+
 #if defined(HW_DMA)
     { DMA1_Channel1_IRQn, dma_irq },
     { DMA1_Channel2_3_IRQn, dma_irq },
@@ -1094,9 +1645,11 @@ const irqdef HAL_irqdefs[] = {
     { ~0, NULL } // end of list
 };
 
+#if !defined(CFG_crc_hw)
 unsigned int crc32 (void* ptr, int nwords) {
     return HAL.boottab->crc32(ptr, nwords);
 }
+#endif
 
 u1_t hal_getBattLevel (void) {
     return HAL.battlevel;
@@ -1121,9 +1674,103 @@ static void debug_init (void) {
 #endif
 }
 
+#ifdef CFG_debug_async
+// Debug output is buffered in a ring and sent by DMA in the background, so
+// that debug_printf() does not block for the duration of the transmission
+// (~5us per character at 2Mbaud). Strings that do not fit are dropped and
+// reported in the output stream; on panic, the ring is sent synchronously.
+
+#ifndef DEBUG_RINGSZ
+#define DEBUG_RINGSZ 1024
+#endif
+
+static char dbgring[DEBUG_RINGSZ];
+
+static void debug_put (const char* str, int n) {
+    int wr = HAL.dbg.wr;
+    while( n-- > 0 ) {
+        dbgring[wr++] = *str++;
+        if( wr == DEBUG_RINGSZ ) {
+            wr = 0;
+        }
+    }
+    HAL.dbg.wr = wr;
+}
+
+static void debug_kick (void); // fwd decl
+
+static void debug_txdone (osjob_t* job) {
+    hal_disableIRQs();
+    int rd = HAL.dbg.rd + HAL.dbg.txn;
+    HAL.dbg.rd = (rd == DEBUG_RINGSZ) ? 0 : rd;
+    HAL.dbg.txn = 0;
+    debug_kick();
+    hal_enableIRQs();
+}
+
+// start transfer of next contiguous chunk (IRQs must be disabled)
+static void debug_kick (void) {
+    int rd = HAL.dbg.rd, wr = HAL.dbg.wr;
+    if( HAL.dbg.txn == 0 && rd != wr && HAL.debug_suspend == 0 ) {
+        HAL.dbg.txn = (wr > rd) ? wr - rd : DEBUG_RINGSZ - rd;
+        usart_send(BRD_DBG_UART, dbgring + rd, HAL.dbg.txn, &HAL.dbg.job, debug_txdone);
+    }
+}
+
+void hal_debug_str (const char* str) {
+    int n = strlen(str);
+    hal_disableIRQs();
+    int avail = (HAL.dbg.rd - HAL.dbg.wr - 1 + DEBUG_RINGSZ) % DEBUG_RINGSZ;
+    if( HAL.dbg.ovfl ) {
+        char buf[32];
+        int m = debug_snprintf(buf, sizeof(buf), "\r\n[%u dropped]\r\n", HAL.dbg.ovfl);
+        if( m + n <= avail ) {
+            debug_put(buf, m);
+            avail -= m;
+            HAL.dbg.ovfl = 0;
+        }
+    }
+    if( n <= avail && HAL.dbg.ovfl == 0 ) {
+        debug_put(str, n);
+        debug_kick();
+    } else {
+        HAL.dbg.ovfl += 1;
+    }
+    hal_enableIRQs();
+}
+
+// complete current transfer synchronously (IRQs must be disabled)
+static void debug_sync (void) {
+    if( HAL.dbg.txn ) {
+        usart_send_wait(BRD_DBG_UART);
+        os_clearCallback(&HAL.dbg.job);
+        int rd = HAL.dbg.rd + HAL.dbg.txn;
+        HAL.dbg.rd = (rd == DEBUG_RINGSZ) ? 0 : rd;
+        HAL.dbg.txn = 0;
+    }
+}
+
+// send buffered output synchronously (IRQs must be disabled)
+static void debug_flush (void) {
+    debug_sync();
+    while( HAL.dbg.rd != HAL.dbg.wr ) {
+        char buf[33];
+        int n = 0;
+        while( n < sizeof(buf) - 1 && HAL.dbg.rd != HAL.dbg.wr ) {
+            buf[n++] = dbgring[HAL.dbg.rd++];
+            if( HAL.dbg.rd == DEBUG_RINGSZ ) {
+                HAL.dbg.rd = 0;
+            }
+        }
+        buf[n] = 0;
+        usart_str(BRD_DBG_UART, buf);
+    }
+}
+#else
 void hal_debug_str (const char* str) {
     usart_str(BRD_DBG_UART, str);
 }
+#endif
 
 void hal_debug_led (int val) {
 #if defined(GPIO_DBG_LED)
@@ -1133,6 +1780,11 @@ void hal_debug_led (int val) {
 
 void hal_debug_suspend (void) {
     if( HAL.debug_suspend == 0 ) {
+#ifdef CFG_debug_async
+        hal_disableIRQs();
+        debug_sync();
+        hal_enableIRQs();
+#endif
         usart_stop(BRD_DBG_UART);
     }
     HAL.debug_suspend += 1;
@@ -1143,6 +1795,11 @@ void hal_debug_resume (void) {
     HAL.debug_suspend -= 1;
     if( HAL.debug_suspend == 0 ) {
         debug_uartconfig();
+#ifdef CFG_debug_async
+        hal_disableIRQs();
+        debug_kick();
+        hal_enableIRQs();
+#endif
     }
 }
 
@@ -1211,9 +1868,15 @@ bool hal_set_update (void* ptr) {
 }
 
 void flash_write (void* dst, const void* src, unsigned int nwords, bool erase) {
+#ifdef SVC_pwrman
+    ostime_t t0 = hal_ticks();
+#endif
     hal_disableIRQs();
     HAL.boottab->wr_flash(dst, src, nwords, erase);
     hal_enableIRQs();
+#ifdef SVC_pwrman
+    pwrman_consume(PWRMAN_C_NVM, hal_ticks() - t0, BRD_PWR_NVM_UA);
+#endif
 }
 
 void hal_logEv (uint8_t evcat, uint8_t evid, uint32_t evparam) {
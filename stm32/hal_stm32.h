@@ -36,11 +36,24 @@ void hal_clearMaxSleep (unsigned int level);
 typedef struct {
     uint32_t run_ticks;
     uint32_t sleep_ticks[HAL_SLEEP_CNT];
+#ifdef CFG_spi_dma
+    uint32_t spidma_ticks;      // part of S0 sleep spent waiting for SPI DMA
+#endif
 } hal_rtstats;
 
 void hal_rtstats_collect (hal_rtstats* stats);
 #endif
 
+#ifdef CFG_sleepgov
+typedef struct {
+    uint32_t lat_ticks[HAL_SLEEP_CNT];  // current wake-up latency estimates
+    uint32_t count[HAL_SLEEP_CNT];      // sleeps per mode (since last collect)
+    uint32_t late;                      // wake-ups after target time (since last collect)
+} hal_sleepgov;
+
+void hal_sleepgov_collect (hal_sleepgov* stats);
+#endif
+
 
 // NVIC interrupt definition
 typedef struct {
@@ -62,6 +75,12 @@ typedef struct {
 
 void i2c_irq (void);
 
+#if defined(CFG_crc_hw)
+// Beacon CRC via CRC engine (stm32/crchw.c)
+unsigned int crc16 (void* ptr, int nbytes);
+#define os_crc16(d,len) ((uint16_t) crc16(d, len))
+#endif
+
 #if defined(SVC_fuota)
 // Glue for FUOTA (fountain code) service
 
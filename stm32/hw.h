@@ -76,6 +76,23 @@ void gpio_cfg_extirq_ex (int port, int pin, bool rising, bool falling);
 // clear/enable, or disable interrupt for given line (configure first!)
 void gpio_set_extirq (int pin, int on);
 
+// pin configuration table entry (see gpio_cfg_pins)
+typedef struct {
+    unsigned int gpio;          // BRD_GPIO*(...)
+    unsigned short cfg;         // GPIOCFG_*
+    signed char val;            // output state to set, or -1
+} gpio_pincfg;
+
+// configure multiple pins, writing each port's registers only once
+void gpio_cfg_pins (const gpio_pincfg* pins, int n);
+
+#define GPIO_PINCFG(gpio, opts)         { (gpio), (opts), -1 }
+#define GPIO_PINCFG_VAL(gpio, o, s)     { (gpio), (o), (s) }
+#define GPIO_PINCFG_AF(gpio, opts)      { (gpio), GPIOCFG_MODE_ALT | BRD_AF(gpio) | (opts), -1 }
+#define GPIO_PINCFG_DEFAULT(gpio)       { (gpio), GPIO_DEFAULT_CFG, -1 }
+#define GPIO_PINCFG_OFF(gpio, opts)     { (gpio), (opts), ((gpio) & BRD_GPIO_ACTIVE_LOW) ? 1 : 0 }
+#define CFG_PINS(tab)                   gpio_cfg_pins((tab), sizeof(tab) / sizeof((tab)[0]))
+
 enum { GPIO_LOHI = 0, GPIO_HILO = 1 };
 // generate a transition, then switch to HiZ
 int gpio_transition (int port, int pin, int type, int duration, unsigned int config);
@@ -200,6 +217,15 @@ typedef struct {
 
 #define PERIPH_ADC
 
+#if defined(CFG_adc_dma) && defined(STM32L0)
+#define PERIPH_ADC_SCAN
+// DMA channel used for ADC (1 or 2)
+#ifndef BRD_ADC_DMA
+#define BRD_ADC_DMA     BRD_DMA_CHAN(1)
+#endif
+#define HW_DMA
+#endif
+
 
 //////////////////////////////////////////////////////////////////////
 // CRC engine (32bit aligned words only!)
@@ -207,6 +233,10 @@ typedef struct {
 
 #define PERIPH_CRC
 
+#if defined(CFG_crc_hw)
+#define HW_DMA
+#endif
+
 //////////////////////////////////////////////////////////////////////
 // SHA engine (software, via bootloader)
 //////////////////////////////////////////////////////////////////////
@@ -220,6 +250,14 @@ typedef struct {
 
 #define PERIPH_I2C
 
+#if defined(BRD_I2C)
+// DMA channels used for TX and RX (I2C1: TX on 2 or 6, RX on 3 or 7)
+#ifndef BRD_I2C_DMA
+#define BRD_I2C_DMA     BRD_DMA_CHANS(6,7)
+#endif
+#define HW_DMA
+#endif
+
 
 //////////////////////////////////////////////////////////////////////
 // USART
@@ -318,6 +356,10 @@ void leds_pwm (unsigned int gpio, int dc);
 void leds_pwm_irq (void);
 void leds_pulse (unsigned int gpio, unsigned int min, unsigned int max, int step, unsigned int delay);
 
+#if defined(BRD_LED_TIM) && defined(BRD_LED_DMA)
+#define HW_DMA
+#endif
+
 
 //////////////////////////////////////////////////////////////////////
 // Vibe
@@ -384,12 +426,121 @@ void ir_tim_irq (void);
 #endif
 
 
+//////////////////////////////////////////////////////////////////////
+// AES engine (if available, replaces software AES)
+//////////////////////////////////////////////////////////////////////
+
+#if defined(CFG_aes_hw)
+#if !defined(AES)
+#error "CFG_aes_hw requires MCU with AES engine (e.g. STM32L082)"
+#endif
+// DMA channels used for AES_IN (1 or 5) and AES_OUT (2 or 3), RM0377 11.3.2
+#ifndef BRD_AES_DMA
+#define BRD_AES_DMA     BRD_DMA_CHANS(5,3)
+#endif
+#define HW_DMA
+#endif
+
+
+//////////////////////////////////////////////////////////////////////
+// Radio SPI (DMA for large transfers)
+//////////////////////////////////////////////////////////////////////
+
+#if defined(CFG_spi_dma)
+// DMA channels used for SPI RX and TX (RM0377 11.3.2)
+#ifndef BRD_RADIO_SPI_DMA
+#if BRD_RADIO_SPI == 1
+#define BRD_RADIO_SPI_DMA       BRD_DMA_CHANS(2,3)
+#else
+#define BRD_RADIO_SPI_DMA       BRD_DMA_CHANS(4,5)
+#endif
+#endif
+#define HW_DMA
+#endif
+
+
 //////////////////////////////////////////////////////////////////////
 // DMA
 //////////////////////////////////////////////////////////////////////
 
 #ifdef HW_DMA
 
+// Channels of enabled DMA users (BRD_*_DMA) must not overlap: USART and I2C
+// transfers are started from interrupt context, and SPI DMA can be used by
+// the radio driver from its interrupt handler, so a shared channel cannot
+// be arbitrated at run time. Memory-to-memory transfers (CRC) do not have a
+// fixed channel, they claim one of the remaining channels (DMA_MASK_FREE)
+// with dma_claim() and fall back to the CPU if none is available.
+#if defined(CFG_spi_dma)
+#define DMA_MASK_SPI            BRD_DMA_MASK(BRD_RADIO_SPI_DMA)
+#else
+#define DMA_MASK_SPI            0
+#endif
+#if defined(BRD_USART) && BRD_USART_EN(BRD_USART1) && defined(BRD_USART1_DMA)
+#define DMA_MASK_USART1         BRD_DMA_MASK(BRD_USART1_DMA)
+#else
+#define DMA_MASK_USART1         0
+#endif
+#if defined(BRD_USART) && BRD_USART_EN(BRD_USART2) && defined(BRD_USART2_DMA)
+#define DMA_MASK_USART2         BRD_DMA_MASK(BRD_USART2_DMA)
+#else
+#define DMA_MASK_USART2         0
+#endif
+#if defined(BRD_USART) && BRD_USART_EN(BRD_LPUART1) && defined(BRD_LPUART1_DMA)
+#define DMA_MASK_LPUART1        BRD_DMA_MASK(BRD_LPUART1_DMA)
+#else
+#define DMA_MASK_LPUART1        0
+#endif
+#if defined(BRD_LED_TIM) && defined(BRD_LED_DMA)
+#define DMA_MASK_LED            BRD_DMA_MASK(BRD_LED_DMA)
+#else
+#define DMA_MASK_LED            0
+#endif
+#if defined(BRD_I2C)
+#define DMA_MASK_I2C            BRD_DMA_MASK(BRD_I2C_DMA)
+#else
+#define DMA_MASK_I2C            0
+#endif
+#if defined(PERIPH_ADC_SCAN)
+#define DMA_MASK_ADC            BRD_DMA_MASK(BRD_ADC_DMA)
+#else
+#define DMA_MASK_ADC            0
+#endif
+#if defined(CFG_aes_hw)
+#define DMA_MASK_AES            BRD_DMA_MASK(BRD_AES_DMA)
+#else
+#define DMA_MASK_AES            0
+#endif
+
+#define DMA_MASK_STATIC         (DMA_MASK_SPI | DMA_MASK_USART1 | DMA_MASK_USART2 | \
+                                 DMA_MASK_LPUART1 | DMA_MASK_LED | DMA_MASK_I2C | \
+                                 DMA_MASK_ADC | DMA_MASK_AES)
+#define DMA_MASK_FREE           (0x7f & ~DMA_MASK_STATIC)
+
+#if (DMA_MASK_USART1 & DMA_MASK_SPI)
+#error "BRD_USART1_DMA overlaps with BRD_RADIO_SPI_DMA"
+#endif
+#if (DMA_MASK_USART2 & (DMA_MASK_SPI | DMA_MASK_USART1))
+#error "BRD_USART2_DMA overlaps with another DMA channel assignment"
+#endif
+#if (DMA_MASK_LPUART1 & (DMA_MASK_SPI | DMA_MASK_USART1 | DMA_MASK_USART2))
+#error "BRD_LPUART1_DMA overlaps with another DMA channel assignment"
+#endif
+#if (DMA_MASK_LED & (DMA_MASK_SPI | DMA_MASK_USART1 | DMA_MASK_USART2 | DMA_MASK_LPUART1))
+#error "BRD_LED_DMA overlaps with another DMA channel assignment"
+#endif
+#if (DMA_MASK_I2C & (DMA_MASK_SPI | DMA_MASK_USART1 | DMA_MASK_USART2 | DMA_MASK_LPUART1 | DMA_MASK_LED))
+#error "BRD_I2C_DMA overlaps with another DMA channel assignment"
+#endif
+#if (DMA_MASK_ADC & (DMA_MASK_SPI | DMA_MASK_USART1 | DMA_MASK_USART2 | DMA_MASK_LPUART1 | DMA_MASK_LED | \
+            DMA_MASK_I2C))
+#error "BRD_ADC_DMA overlaps with another DMA channel assignment"
+#endif
+#if (DMA_MASK_AES & (DMA_MASK_SPI | DMA_MASK_USART1 | DMA_MASK_USART2 | DMA_MASK_LPUART1 | DMA_MASK_LED | \
+            DMA_MASK_I2C | DMA_MASK_ADC))
+#error "BRD_AES_DMA overlaps with another DMA channel assignment"
+#endif
+
 enum {
     DMA_ADC     = 0,
     DMA_SPI1    = 1,
@@ -415,6 +566,7 @@ enum {
     DMA_CB_COMPLETE = (1 << 1),
 };
 typedef void (*dma_cb) (int status, void* arg);
+int dma_claim (unsigned int mask);
 void dma_config (unsigned int ch, unsigned int peripheral, unsigned int ccr, unsigned int flags, dma_cb callback, void* arg);
 int dma_deconfig (unsigned int ch);
 void dma_transfer (unsigned int ch, volatile void* paddr, void* maddr, int n);
@@ -12,15 +12,28 @@
 #define I2Cx_enable()	do { RCC->APB1ENR |= RCC_APB1ENR_I2C1EN; } while (0)
 #define I2Cx_disable()	do { RCC->APB1ENR &= ~RCC_APB1ENR_I2C1EN; } while (0)
 #define I2Cx_IRQn	I2C1_IRQn
+#define I2Cx_DMA	DMA_I2C1
 #else
 #error "Unsupported I2C peripheral"
 #endif
 
+// Notes:
+// - Transactions are queued and executed back-to-back; the bus is only
+//   released (STOP) when the queue is empty. Data is moved by DMA, so there
+//   is one interrupt per phase (plus one per 255 bytes for long transfers),
+//   and the CPU can sleep in S0 meanwhile.
+// - A NACK completes the current transaction with I2C_NAK (the peripheral
+//   automatically generates a STOP) and the queue continues.
+
+static struct {
+    i2c_txn* head;		// current transaction
+    i2c_txn** tail;
+    unsigned int rem;		// bytes remaining in phase after current chunk
+    int ch;			// active DMA channel (-1: none)
+} i2c;
+
 static struct {
-    unsigned int wlen;
-    unsigned char* wptr;
-    unsigned int rlen;
-    unsigned char* rptr;
+    i2c_txn txn;
     osjob_t* job;
     osjobcb_t cb;
     int* pstatus;
@@ -32,7 +45,23 @@ static struct {
     i2c_cb cb;
 } xfr2;
 
-static void i2c_stop (int status) {
+static void bus_on (void) {
+    // enable peripheral clock
+    I2Cx_enable();
+    // set timing
+    I2Cx->TIMINGR = 0x40101A22; // from CubeMX tool; t_rise=t_fall=50ns, 100kHz
+    // start I2C
+    I2Cx->CR1 = I2C_CR1_PE;
+    // setup GPIOs
+    CFG_PIN_AF(GPIO_I2C_SCL, GPIOCFG_OSPEED_40MHz | GPIOCFG_OTYPE_OPEN | GPIOCFG_PUPD_NONE);
+    CFG_PIN_AF(GPIO_I2C_SDA, GPIOCFG_OSPEED_40MHz | GPIOCFG_OTYPE_OPEN | GPIOCFG_PUPD_NONE);
+    // disable sleep (keep clock at full speed during transfer)
+    hal_setMaxSleep(HAL_SLEEP_S0);
+    // enable interrupts in NVIC
+    NVIC_EnableIRQ(I2Cx_IRQn);
+}
+
+static void bus_off (void) {
     // generate stop condition
     I2Cx->CR2 |= I2C_CR2_STOP;
     // disable interrupts in NVIC
@@ -44,91 +73,171 @@ static void i2c_stop (int status) {
     CFG_PIN_DEFAULT(GPIO_I2C_SDA);
     // disable peripheral clock
     I2Cx_disable();
-    // schedule callback
-    *(xfr.pstatus) = status;
-    if (xfr.job != NULL) {
-	os_setCallback(xfr.job, xfr.cb);
-    } else {
-	xfr.cb(NULL);
-    }
     // re-enable sleep
     hal_clearMaxSleep(HAL_SLEEP_S0);
 }
 
-static void i2c_start (int addr) {
-    // enable peripheral clock
-    I2Cx_enable();
-    // set timing
-    I2Cx->TIMINGR = 0x40101A22; // from CubeMX tool; t_rise=t_fall=50ns, 100kHz
-    // start I2C
-    I2Cx->CR1 |= I2C_CR1_PE;
-    // setup slave address
-    I2Cx->CR2 = (I2Cx->CR2 & ~I2C_CR2_SADD) | (addr & I2C_CR2_SADD);
-    // setup GPIOs
-    CFG_PIN_AF(GPIO_I2C_SCL, GPIOCFG_OSPEED_40MHz | GPIOCFG_OTYPE_OPEN | GPIOCFG_PUPD_NONE);
-    CFG_PIN_AF(GPIO_I2C_SDA, GPIOCFG_OSPEED_40MHz | GPIOCFG_OTYPE_OPEN | GPIOCFG_PUPD_NONE);
-    // disable sleep (keep clock at full speed during transfer
-    hal_setMaxSleep(HAL_SLEEP_S0);
-    // enable interrupts in NVIC
-    NVIC_EnableIRQ(I2Cx_IRQn);
+static void dma_stop (void) {
+    if( i2c.ch >= 0 ) {
+	dma_deconfig(i2c.ch);
+	i2c.ch = -1;
+    }
 }
 
-static void i2c_cont (void) {
-    if (xfr.wlen) {
-	// calculate length; TODO: handle >255
-	int n = xfr.wlen & 0xff;
-	xfr.wlen -= n;
-	// set direction & number of bytes
-	I2Cx->CR2 = (I2Cx->CR2 & ~(I2C_CR2_RD_WRN | I2C_CR2_NBYTES)) | (n << 16);
-	// enable interrupts
-	I2Cx->CR1 = (I2Cx->CR1 & ~0xfe) | I2C_CR1_TXIE | I2C_CR1_TCIE | I2C_CR1_NACKIE | I2C_CR1_ERRIE;
-	// start TX
-	I2Cx->CR2 |= I2C_CR2_START;
-    } else if (xfr.rlen) {
-	// calculate length; TODO: handle >255
-	int n = xfr.rlen & 0xff;
-	xfr.rlen -= n;
-	// set direction & number of bytes
-	I2Cx->CR2 = (I2Cx->CR2 & ~(I2C_CR2_RD_WRN | I2C_CR2_NBYTES)) | I2C_CR2_RD_WRN | (n << 16);
-	// enable interrupts
-	I2Cx->CR1 = (I2Cx->CR1 & ~0xfe) | I2C_CR1_RXIE | I2C_CR1_TCIE | I2C_CR1_NACKIE | I2C_CR1_ERRIE;
-	// start RX
-	I2Cx->CR2 |= I2C_CR2_START;
+// set byte count for next chunk of current phase
+static unsigned int nbytes (void) {
+    unsigned int n = (i2c.rem > 255) ? 255 : i2c.rem;
+    i2c.rem -= n;
+    return (n << 16) | ((i2c.rem) ? I2C_CR2_RELOAD : 0);
+}
+
+static void start_write (i2c_txn* t) {
+    i2c.ch = BRD_DMA_CHAN_A(BRD_I2C_DMA);
+    dma_config(i2c.ch, I2Cx_DMA, DMA_CCR_MINC | DMA_CCR_DIR, 0, NULL, NULL);
+    dma_transfer(i2c.ch, &I2Cx->TXDR, t->wbuf, t->wlen);
+    I2Cx->CR1 = I2C_CR1_PE | I2C_CR1_TXDMAEN | I2C_CR1_TCIE | I2C_CR1_NACKIE | I2C_CR1_ERRIE;
+    i2c.rem = t->wlen;
+    I2Cx->CR2 = (t->addr & I2C_CR2_SADD) | nbytes() | I2C_CR2_START;
+}
+
+static void start_read (i2c_txn* t) {
+    i2c.ch = BRD_DMA_CHAN_B(BRD_I2C_DMA);
+    dma_config(i2c.ch, I2Cx_DMA, DMA_CCR_MINC, 0, NULL, NULL);
+    dma_transfer(i2c.ch, &I2Cx->RXDR, t->rbuf, t->rlen);
+    I2Cx->CR1 = I2C_CR1_PE | I2C_CR1_RXDMAEN | I2C_CR1_TCIE | I2C_CR1_NACKIE | I2C_CR1_ERRIE;
+    i2c.rem = t->rlen;
+    I2Cx->CR2 = (t->addr & I2C_CR2_SADD) | I2C_CR2_RD_WRN | nbytes() | I2C_CR2_START;
+}
+
+// start next transaction in queue, or release bus
+static void next (void) {
+    i2c_txn* t;
+    while( (t = i2c.head) != NULL ) {
+	if( t->wlen ) {
+	    start_write(t);
+	    return;
+	} else if( t->rlen ) {
+	    start_read(t);
+	    return;
+	}
+	// nothing to transfer
+	i2c.head = t->next;
+	t->status = I2C_OK;
+	if( t->job != NULL ) {
+	    os_setCallback(t->job, t->cb);
+	} else {
+	    t->cb(NULL);
+	}
+    }
+    i2c.tail = &i2c.head;
+    bus_off();
+}
+
+// complete current transaction and move on
+static void complete (int status) {
+    i2c_txn* t = i2c.head;
+    dma_stop();
+    i2c.head = t->next;
+    t->status = status;
+    if( t->job != NULL ) {
+	os_setCallback(t->job, t->cb);
     } else {
-	// done
-	i2c_stop(I2C_OK);
+	t->cb(NULL);
     }
+    next();
 }
 
 void i2c_irq (void) {
     unsigned int isr = I2Cx->ISR;
-    if (isr & I2C_ISR_NACKF) {
-	// NACK detected, transfer failed!
-	i2c_stop(I2C_NAK);
-    } else if (isr & I2C_ISR_TC) {
-	// transfer complete, move on
-	i2c_cont();
-    } else if (isr & I2C_ISR_TXIS) {
-	// write next byte
-	I2Cx->TXDR = *xfr.wptr++;
-    } else if (isr & I2C_ISR_RXNE) {
-	// next byte received
-	*xfr.rptr++ = I2Cx->RXDR;
+    if( isr & I2C_ISR_NACKF ) {
+	// NACK detected, transaction failed (STOP is generated automatically)
+	I2Cx->ICR = I2C_ICR_NACKCF | I2C_ICR_STOPCF;
+	complete(I2C_NAK);
+    } else if( isr & (I2C_ISR_BERR | I2C_ISR_ARLO | I2C_ISR_OVR) ) {
+	// bus error
+	I2Cx->ICR = I2C_ICR_BERRCF | I2C_ICR_ARLOCF | I2C_ICR_OVRCF;
+	complete(I2C_ABORT);
+    } else if( isr & I2C_ISR_TCR ) {
+	// reload byte count for next chunk
+	I2Cx->CR2 = (I2Cx->CR2 & ~(I2C_CR2_NBYTES | I2C_CR2_RELOAD)) | nbytes();
+    } else if( isr & I2C_ISR_TC ) {
+	// phase complete, move on
+	i2c_txn* t = i2c.head;
+	int wr = (i2c.ch == BRD_DMA_CHAN_A(BRD_I2C_DMA));
+	dma_stop();
+	if( wr && t->rlen ) {
+	    start_read(t);
+	} else {
+	    complete(I2C_OK);
+	}
     } else {
 	hal_failed(); // XXX
     }
 }
 
+void i2c_submit (i2c_txn* txn) {
+    txn->next = NULL;
+    txn->status = I2C_BUSY;
+    hal_disableIRQs();
+    if( i2c.tail == NULL ) {
+	i2c.tail = &i2c.head; // first use
+    }
+    bool idle = (i2c.head == NULL);
+    *i2c.tail = txn;
+    i2c.tail = &txn->next;
+    if( idle ) {
+	i2c.ch = -1;
+	bus_on();
+	next();
+    }
+    hal_enableIRQs();
+}
+
+void i2c_abort (void) {
+    hal_disableIRQs();
+    i2c_txn* t = i2c.head;
+    if( t != NULL ) {
+	dma_stop();
+	i2c.head = NULL;
+	i2c.tail = &i2c.head;
+	bus_off();
+	// complete all pending transactions
+	do {
+	    i2c_txn* n = t->next;
+	    t->status = I2C_ABORT;
+	    if( t->job != NULL ) {
+		os_setCallback(t->job, t->cb);
+	    } else {
+		t->cb(NULL);
+	    }
+	    t = n;
+	} while( t != NULL );
+    }
+    hal_enableIRQs();
+}
+
 static void i2c_timeout (osjob_t* job) {
     i2c_abort();
 }
 
+static void xfrdone (osjob_t* j) {
+    *xfr.pstatus = xfr.txn.status;
+    if( xfr.job != NULL ) {
+	os_setCallback(xfr.job, xfr.cb);
+    } else {
+	xfr.cb(NULL);
+    }
+}
+
 void i2c_xfer_ex (unsigned int addr, unsigned char* buf, unsigned int wlen, unsigned int rlen, ostime_t timeout,
 	osjob_t* job, osjobcb_t cb, int* pstatus) {
-    // setup xfr structure
-    xfr.wlen = wlen;
-    xfr.rlen = rlen;
-    xfr.wptr = xfr.rptr = buf;
+    // setup transaction (completion callback from interrupt context)
+    xfr.txn.addr = addr;
+    xfr.txn.wbuf = xfr.txn.rbuf = buf;
+    xfr.txn.wlen = wlen;
+    xfr.txn.rlen = rlen;
+    xfr.txn.job = NULL;
+    xfr.txn.cb = xfrdone;
     xfr.job = job;
     xfr.cb = cb;
     xfr.pstatus = pstatus;
@@ -137,10 +246,7 @@ void i2c_xfer_ex (unsigned int addr, unsigned char* buf, unsigned int wlen, unsi
     if (timeout) {
 	os_setTimedCallback(job, os_getTime() + timeout, i2c_timeout);
     }
-    // prepare peripheral
-    i2c_start(addr);
-    // start actual transfer
-    i2c_cont();
+    i2c_submit(&xfr.txn);
 }
 
 static void i2cfunc (osjob_t* j) {
@@ -152,10 +258,4 @@ void i2c_xfer (unsigned int addr, unsigned char* buf, unsigned int wlen, unsigne
     i2c_xfer_ex(addr, buf, wlen, rlen, timeout, &xfr2.job, i2cfunc, &xfr2.status);
 }
 
-void i2c_abort (void) {
-    hal_disableIRQs();
-    i2c_stop(I2C_ABORT);
-    hal_enableIRQs();
-}
-
 #endif
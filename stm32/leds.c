@@ -16,6 +16,17 @@
 #error "Unsupported timer"
 #endif
 
+// With BRD_LED_DMA (DMA channel for the TIMx_UP request), one pulsing
+// channel at a time is driven by DMA: the complete waveform (one value per
+// update event) is generated into a table that is copied to the CCR register
+// in circular mode, so no interrupt is taken per step. Pulses too long for
+// the table fall back to the update interrupt.
+#if defined(BRD_LED_DMA)
+#ifndef LEDS_WAVE_MAX
+#define LEDS_WAVE_MAX	128
+#endif
+#endif
+
 static struct {
     unsigned int state;
     struct {
@@ -25,6 +36,10 @@ static struct {
 	unsigned int min;
 	unsigned int max;
     } pulse[4];
+#if defined(BRD_LED_DMA)
+    int dmach;				// channel driven by DMA (-1 if none)
+    uint16_t wave[LEDS_WAVE_MAX];
+#endif
 } pwm;
 
 #endif
@@ -41,10 +56,46 @@ void leds_init (void) {
 	TIM_CCMR2_OC3M_2 | TIM_CCMR2_OC3M_1 | TIM_CCMR2_OC3PE |
 	TIM_CCMR2_OC4M_2 | TIM_CCMR2_OC4M_1 | TIM_CCMR2_OC4PE;
     TIMx_disable();
+#if defined(BRD_LED_DMA)
+    pwm.dmach = -1;
+#endif
 #endif
 }
 
 #if defined(BRD_LED_TIM)
+#if defined(BRD_LED_DMA)
+static void wave_stop (void) {
+    TIMx->DIER &= ~TIM_DIER_UDE;
+    dma_deconfig(BRD_DMA_CHAN_A(BRD_LED_DMA));
+    pwm.dmach = -1;
+}
+
+// generate waveform of pulse (same sequence as leds_pwm_irq), return length or 0 if too long
+static unsigned int wave_gen (unsigned int ch) {
+    int ccr = (pwm.pulse[ch].step < 0) ? pwm.pulse[ch].max : pwm.pulse[ch].min;
+    int step = pwm.pulse[ch].step;
+    int ccr0 = ccr, step0 = step;
+    unsigned int n = 0;
+    do {
+	if (n + pwm.pulse[ch].delay + 1 > LEDS_WAVE_MAX) {
+	    return 0;
+	}
+	for (unsigned int i = 0; i <= pwm.pulse[ch].delay; i++) {
+	    pwm.wave[n++] = ccr;
+	}
+	ccr += step;
+	if (ccr <= pwm.pulse[ch].min) {
+	    ccr = pwm.pulse[ch].min;
+	    step = -step;
+	} else if (ccr >= pwm.pulse[ch].max) {
+	    ccr = pwm.pulse[ch].max;
+	    step = -step;
+	}
+    } while (ccr != ccr0 || step != step0);
+    return n;
+}
+#endif
+
 static void pwm_set_gpio (unsigned int gpio, bool enable, bool pulse, unsigned int ccr) {
     unsigned int ch = BRD_GPIO_GET_CHAN(gpio) - 1;
     ASSERT(ch < 4);
@@ -61,6 +112,12 @@ static void pwm_set_gpio (unsigned int gpio, bool enable, bool pulse, unsigned i
 	state1 &= ~(0x11 << ch);
     }
 
+#if defined(BRD_LED_DMA)
+    if (pwm.dmach == ch) {
+	wave_stop();
+    }
+#endif
+
     if (state0 == state1) {
 	return;
     }
@@ -87,7 +144,7 @@ static void pwm_set_gpio (unsigned int gpio, bool enable, bool pulse, unsigned i
 	}
     } else if (state0) {
 	TIMx->CR1 &= ~TIM_CR1_CEN;		// disable timer
-	TIMx->DIER &= ~TIM_DIER_UIE;		// disable update interrupt
+	TIMx->DIER &= ~(TIM_DIER_UIE | TIM_DIER_UDE); // disable update interrupt and DMA
 	TIMx_disable();				// disable peripheral clock
         hal_clearMaxSleep(HAL_SLEEP_S0);        // re-enable sleep
 	NVIC_DisableIRQ(TIMx_IRQn);		// disable interrupt in NVIC
@@ -125,6 +182,20 @@ void leds_pulse (unsigned int gpio, unsigned int min, unsigned int max, int step
     pwm.pulse[ch].max = max;
     pwm.pulse[ch].step = step;
     pwm.pulse[ch].delay = delay;
+#if defined(BRD_LED_DMA)
+    unsigned int n;
+    if (step && (pwm.dmach < 0 || pwm.dmach == ch) && (n = wave_gen(ch)) != 0) {
+	pwm_set_gpio(gpio, true, false, pwm.wave[0]);
+	pwm.pulse[ch].step = 0;		// not handled by update interrupt
+	unsigned int dch = BRD_DMA_CHAN_A(BRD_LED_DMA);
+	dma_config(dch, DMA_TIM2, DMA_CCR_MINC | DMA_CCR_CIRC | DMA_CCR_DIR
+		| DMA_CCR_PSIZE_0 | DMA_CCR_MSIZE_0, 0, NULL, NULL);
+	dma_transfer(dch, (&(TIMx->CCR1)) + ch, pwm.wave, n);
+	TIMx->DIER |= TIM_DIER_UDE;		// enable update DMA request
+	pwm.dmach = ch;
+	return;
+    }
+#endif
     pwm_set_gpio(gpio, true, true, (step < 0) ? max : min);
 #endif
 }
@@ -22,6 +22,9 @@ typedef struct {
         int* pn;
         ostime_t dl;            // deadline
         ostime_t it;            // idle timeout
+        unsigned char* ring;    // circular buffer (ring mode)
+        int sz;                 // size of circular buffer
+        int rd;                 // read position
     } rx;
 } usart_state;
 
@@ -65,7 +68,7 @@ static const usart_port port_u1 = {
     .enb     = RCC_APB2ENR_USART1EN,
     .irqn    = USART1_IRQn,
     .brr     = br2brr,
-#ifdef BRD_USART2_DMA
+#ifdef BRD_USART1_DMA
     .dma.tx  = BRD_DMA_CHAN_A(BRD_USART1_DMA),
     .dma.rx  = BRD_DMA_CHAN_B(BRD_USART1_DMA),
     .dma.pid = DMA_USART1,
@@ -172,6 +175,7 @@ static void usart_off (const usart_port* usart, unsigned int flag) {
 }
 
 static void rx_dma_cb (int status, void* port); // fwd decl
+static void ring_dma_cb (int status, void* port); // fwd decl
 
 static void rx_on (const usart_port* usart, bool idle) {
     // turn on usart
@@ -180,7 +184,14 @@ static void rx_on (const usart_port* usart, bool idle) {
     usart->port->RQR |= USART_RQR_RXFRQ;
     // configure DMA
     ASSERT(usart->dma.pid != DMA_NONE);
-    dma_config(usart->dma.rx, usart->dma.pid, DMA_CCR_MINC | DMA_CCR_PSIZE_1, DMA_CB_COMPLETE, rx_dma_cb, (void*) usart);
+    if( usart->state->rx.ring ) {
+        dma_config(usart->dma.rx, usart->dma.pid, DMA_CCR_MINC | DMA_CCR_CIRC | DMA_CCR_PSIZE_1,
+                DMA_CB_HALF | DMA_CB_COMPLETE, ring_dma_cb, (void*) usart);
+        // keep receiving if DMA falls behind (byte is lost)
+        usart->port->CR3 |= USART_CR3_OVRDIS;
+    } else {
+        dma_config(usart->dma.rx, usart->dma.pid, DMA_CCR_MINC | DMA_CCR_PSIZE_1, DMA_CB_COMPLETE, rx_dma_cb, (void*) usart);
+    }
     // enable DMA
     usart->port->CR3 |= USART_CR3_DMAR;
     if( idle ) {
@@ -197,7 +208,7 @@ static int rx_off (const usart_port* usart) {
     // deconfigure I/O line
     CFG_PIN_DEFAULT(usart->gpio.rx);
     // disable DMA
-    usart->port->CR3 &= ~USART_CR3_DMAR;
+    usart->port->CR3 &= ~(USART_CR3_DMAR | USART_CR3_OVRDIS);
     // disable receiver and interrupts
     usart->port->CR1 &= ~(USART_CR1_RE | USART_CR1_IDLEIE);
     // deconfigure DMA
@@ -264,6 +275,17 @@ void usart_send (const void* port, void* src, int n, osjob_t* job, osjobcb_t cb)
     dma_transfer(usart->dma.tx, &usart->port->TDR, src, n);
 }
 
+// complete pending transmission synchronously (e.g. before panic)
+void usart_send_wait (const void* port) {
+    const usart_port* usart = port;
+    hal_disableIRQs();
+    if( usart->state->on & TX_ON ) {
+        while( (usart->port->ISR & USART_ISR_TC) == 0 );
+        tx_off(usart, true);
+    }
+    hal_enableIRQs();
+}
+
 void usart_str (const void* port, const char* str) {
     const usart_port* usart = port;
 
@@ -339,6 +361,58 @@ void usart_recv (const void* port, void* dst, int* n, ostime_t timeout, ostime_t
     dma_transfer(usart->dma.rx, &usart->port->RDR, dst, *n);
 }
 
+// notify consumer of ring buffer data (unless already pending)
+static void ring_notify (const usart_port* usart) {
+    if( !os_jobPending(usart->state->rx.job) ) {
+        os_setCallback(usart->state->rx.job, usart->state->rx.cb);
+    }
+}
+
+static void ring_dma_cb (int status, void* arg) {
+    ring_notify(arg);
+}
+
+void usart_recv_ring (const void* port, void* buf, int sz, osjob_t* job, osjobcb_t cb) {
+    const usart_port* usart = port;
+
+    usart->state->rx.job = job;
+    usart->state->rx.cb = cb;
+    usart->state->rx.ring = buf;
+    usart->state->rx.sz = sz;
+    usart->state->rx.rd = 0;
+
+    rx_on(usart, true);
+    dma_transfer(usart->dma.rx, &usart->port->RDR, buf, sz);
+}
+
+int usart_ring_peek (const void* port, unsigned char** pdata) {
+    const usart_port* usart = port;
+    int sz = usart->state->rx.sz;
+    int rd = usart->state->rx.rd;
+    int wr = sz - dma_remaining(usart->dma.rx);
+    if( wr == sz ) {
+        wr = 0; // (counter reload pending)
+    }
+    *pdata = usart->state->rx.ring + rd;
+    return (wr >= rd) ? wr - rd : sz - rd;
+}
+
+void usart_ring_consume (const void* port, int n) {
+    const usart_port* usart = port;
+    int rd = usart->state->rx.rd + n;
+    ASSERT(rd <= usart->state->rx.sz);
+    usart->state->rx.rd = (rd == usart->state->rx.sz) ? 0 : rd;
+}
+
+void usart_stop_ring (const void* port) {
+    const usart_port* usart = port;
+    hal_disableIRQs();
+    rx_off(usart);
+    usart->state->rx.ring = NULL;
+    os_clearCallback(usart->state->rx.job);
+    hal_enableIRQs();
+}
+
 static void usart_irq (const usart_port* usart) {
     unsigned int isr = usart->port->ISR;
     unsigned int cr1 = usart->port->CR1;
@@ -349,7 +423,9 @@ static void usart_irq (const usart_port* usart) {
     if( (cr1 & USART_CR1_IDLEIE) && (isr & USART_ISR_IDLE) ) {
         // clear IDLE interrupt
         usart->port->ICR = USART_ICR_IDLECF;
-        if( dma_remaining(usart->dma.rx) != *usart->state->rx.pn ) {
+        if( usart->state->rx.ring ) {
+            ring_notify(usart);
+        } else if( dma_remaining(usart->dma.rx) != *usart->state->rx.pn ) {
             rewind_timeout(usart, true);
         }
     }
@@ -0,0 +1,136 @@
+#!/usr/bin/env python3
+
+# Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+#
+# This file is subject to the terms and conditions defined in file 'LICENSE',
+# which is part of this source code package.
+
+# Host-side decoder for the tokenized event log (lmic/evlog.h). Format
+# strings are read from the .evlog section of the firmware ELF file, or from a
+# dictionary previously extracted with the 'dict' command.
+
+import argparse
+import json
+import re
+import struct
+import sys
+
+from typing import Dict, Iterator, List, Tuple
+
+Dictionary = Dict[int,str]
+
+def elf_section(fn:str, name:str) -> bytes:
+    with open(fn, 'rb') as f:
+        elf = f.read()
+    if elf[:4] != b'\x7fELF' or elf[4] != 1 or elf[5] != 1:
+        raise ValueError(f'{fn}: not a little-endian ELF32 file')
+    shoff, = struct.unpack_from('<I', elf, 0x20)
+    shentsize, shnum, shstrndx = struct.unpack_from('<HHH', elf, 0x2e)
+    def shdr(i:int) -> Tuple[int,int,int]:
+        sh = struct.unpack_from('<10I', elf, shoff + i * shentsize)
+        return sh[0], sh[4], sh[5] # name, offset, size
+    _, stroff, _ = shdr(shstrndx)
+    for i in range(shnum):
+        nm, off, sz = shdr(i)
+        if elf[stroff+nm:elf.index(b'\0', stroff+nm)].decode() == name:
+            return elf[off:off+sz]
+    raise ValueError(f'{fn}: no section {name}')
+
+def load_dict(fn:str) -> Dictionary:
+    if fn.endswith('.json'):
+        with open(fn) as f:
+            return { int(k): v for k, v in json.load(f).items() }
+    sec = elf_section(fn, '.evlog')
+    d = {}
+    off = 0
+    while off < len(sec):
+        end = sec.index(b'\0', off)
+        if end > off:
+            d[off] = sec[off:end].decode(errors='replace')
+        off = end + 1
+        while off < len(sec) and sec[off] == 0:
+            off += 1 # alignment padding
+    return d
+
+def records(data:bytes) -> Iterator[Tuple[int,int,List[int]]]:
+    words = list(struct.unpack(f'<{len(data) // 4}I', data[:len(data) & ~3]))
+    while len(words) >= 2:
+        hdr, time = words[0], words[1]
+        n = (hdr >> 24) & 0xff
+        yield hdr & 0xffffff, time, words[2:2+n]
+        words = words[2+n:]
+
+SPEC = re.compile(r'%([-+ 0]*)(\d*)(?:\.(\d+))?([a-zA-Z%])')
+
+def fmt(f:str, args:List[int], tps:int) -> str:
+    args = list(args)
+    def arg() -> int:
+        return args.pop(0) if args else 0
+    def sub(m:re.Match) -> str:
+        flags, width, prec, conv = m.groups()
+        if conv == '%':
+            return '%'
+        v = arg()
+        s = v - (1 << 32) if v & 0x80000000 else v
+        if conv == 'c':
+            return chr(v & 0xff)
+        if conv in 'di':
+            return f'%{flags}{width}d' % s
+        if conv in 'uxX':
+            return f'%{flags}{width}{conv if conv != "u" else "d"}' % v
+        if conv == 'b':
+            return format(v, f'0{width}b' if '0' in flags else 'b')
+        if conv == 'F':
+            e = min(arg(), 9)
+            return f'{s / 10**e:.{e}f}'
+        if conv == 't':
+            ms = v * 1000 // tps
+            return f'{ms // 3600000 % 24:02}:{ms // 60000 % 60:02}:{ms // 1000 % 60:02}.{ms % 1000:03}'
+        if conv == 'T': # 64-bit, two words
+            sec = (v | (arg() << 32)) // tps
+            return f'{sec // 86400:03}.{sec // 3600 % 24:02}:{sec // 60 % 60:02}:{sec % 60:02}'
+        return f'<{conv}:0x{v:08x}>' # pointers (%s, %E, ...) cannot be resolved
+    return SPEC.sub(sub, f)
+
+def decode(d:Dictionary, data:bytes, tps:int) -> Iterator[str]:
+    for tok, time, args in records(data):
+        f = d.get(tok)
+        if f is None:
+            yield f'{time / tps:12.6f}  <unknown token 0x{tok:06x}> {args}'
+        else:
+            yield f'{time / tps:12.6f}  {fmt(f, args, tps)}'
+
+def main() -> None:
+    p = argparse.ArgumentParser(description='Event log decoder')
+    sp = p.add_subparsers(dest='cmd', required=True)
+    pd = sp.add_parser('dict', help='extract format string dictionary')
+    pd.add_argument('elf', help='firmware ELF file')
+    pd.add_argument('-o', '--output', help='output file (JSON)')
+    px = sp.add_parser('decode', help='decode event log data')
+    px.add_argument('dict', help='firmware ELF file or JSON dictionary')
+    px.add_argument('data', nargs='?', help='binary event log data (default: stdin)')
+    px.add_argument('--hex', action='store_true', help='data is hex-encoded')
+    px.add_argument('--tps', type=int, default=32768, help='ticks per second')
+    args = p.parse_args()
+
+    if args.cmd == 'dict':
+        out = json.dumps(load_dict(args.elf), indent=2)
+        if args.output:
+            with open(args.output, 'w') as f:
+                f.write(out + '\n')
+        else:
+            print(out)
+    else:
+        d = load_dict(args.dict)
+        if args.data:
+            with open(args.data, 'rb') as f:
+                data = f.read()
+        else:
+            data = sys.stdin.buffer.read()
+        if args.hex:
+            data = bytes.fromhex(data.decode())
+        for line in decode(d, data, args.tps):
+            print(line)
+
+if __name__ == '__main__':
+    main()
@@ -6,11 +6,13 @@
 # This file is subject to the terms and conditions defined in file 'LICENSE',
 # which is part of this source code package.
 
+import hashlib
+import io
+import json
 import os
 import shlex
 import sys
 import re
-import yaml
 
 from collections import deque, OrderedDict
 
@@ -20,7 +22,8 @@ from argparse import Namespace as NS # type alias
 
 from cc import CommandCollection
 
-HookDef = Tuple[int,str]
+HookDef = Tuple[int,str,str] # priority, function, key (or empty)
+KeyDef = Tuple[str,str,str]  # hook, key, default value
 
 class Service:
     class Hook:
@@ -34,21 +37,36 @@ class Service:
                 'first_nz' : STYLE_FIRST_NZ,
                 }
 
+        # A hook can be keyed by one of its (integer) arguments by appending
+        # "@arg" to the declaration. Implementations then specify the key
+        # value they handle ("func@KEY"), and the dispatch becomes a switch
+        # statement instead of calling every implementation in turn.
+        # Implementations without key are called for all values.
         def __init__(self, hd:str, fn:str) -> None:
-            m = re.match(r'^\s*(?:<(\w+):(\w+)>)?\s*(.+)\s+(\w+)\s*(\([^\)]+\))\s*$', hd)
+            m = re.match(r'^\s*(?:<(\w+):(\w+)>)?\s*(.+)\s+(\w+)\s*(\([^\)]+\))\s*(?:@(\w+))?\s*$', hd)
             if m:
                 self.name = m.group(4)
                 self.returntype = m.group(3)
                 self.returndefault = m.group(2)
                 self.style = self.STYLE_LOOKUP[m.group(1)]
                 self.template = f'{m.group(3)} %s {m.group(5)}'
+                self.key = m.group(6)
+                self.args = [re.sub(r'.*?(\w+)\s*$', r'\1', a) for a in m.group(5)[1:-1].split(',')]
+                if self.key is not None and (self.key not in self.args or self.style == self.STYLE_LAST):
+                    raise ValueError('%s: invalid key "%s" for hook "%s"' % (fn, self.key, self.name))
             else:
                 raise ValueError('%s: invalid function declaration "%s"' % (fn, hd))
 
         def emit(self, fh:TextIO, hookdefs:List[HookDef]) -> None:
-            hooks = [h for p, h in sorted(hookdefs)]
-            for h in hooks:
+            hookdefs = sorted(hookdefs)
+            for h in OrderedDict.fromkeys(h for p, h, k in hookdefs):
                 fh.write(f'extern {self.template % h};\n')
+            if any(k for p, h, k in hookdefs):
+                if self.key is None:
+                    raise ValueError('hook "%s" is not keyed' % self.name)
+                self._emit_keyed(fh, hookdefs)
+                return
+            hooks = [h for p, h, k in hookdefs]
             if self.style == self.STYLE_ALL:
                 self._emit_all(fh, hooks)
             elif self.style == self.STYLE_LAST:
@@ -72,6 +90,40 @@ class Service:
                     % (self.returntype, h)) for h in hooks])))
 
 
+        def _emit_keyed(self, fh:TextIO, hookdefs:List[HookDef]) -> None:
+            args = ', '.join(self.args)
+            cases:Dict[str,List[str]] = OrderedDict()
+            for p, h, k in hookdefs:
+                if k:
+                    cases.setdefault(k, []).append(h)
+            other = [h for p, h, k in hookdefs if not k]
+            fh.write(f'static inline {self.template % ("__svchook_" + self.name)} {{\n')
+            if self.style == self.STYLE_ALL:
+                fh.write(f'    switch( {self.key} ) {{\n')
+                for k, hooks in cases.items():
+                    fh.write(f'        case {k}:\n')
+                    for h in hooks:
+                        fh.write(f'            {h}({args});\n')
+                    fh.write(f'            break;\n')
+                fh.write(f'    }}\n')
+                for h in other:
+                    fh.write(f'    {h}({args});\n')
+            else:
+                fh.write(f'    {self.returntype} __SVCHOOK_retval;\n')
+                fh.write(f'    switch( {self.key} ) {{\n')
+                for k, hooks in cases.items():
+                    fh.write(f'        case {k}:\n')
+                    for h in hooks:
+                        fh.write(f'            if( (__SVCHOOK_retval = {h}({args})) ) return __SVCHOOK_retval;\n')
+                    fh.write(f'            break;\n')
+                fh.write(f'    }}\n')
+                for h in other:
+                    fh.write(f'    if( (__SVCHOOK_retval = {h}({args})) ) return __SVCHOOK_retval;\n')
+                fh.write(f'    return {self.returndefault};\n')
+            fh.write(f'}}\n')
+            fh.write(f'#define SVCHOOK_{self.name}(...) __svchook_{self.name}(__VA_ARGS__)\n')
+
+
     def __init__(self, svcid:str, fn:str) -> None:
         self.id = svcid
         self.srcs     : List[str]                      = []
@@ -79,7 +131,9 @@ class Service:
         self.hookdefs : Dict[str,List[HookDef]]        = OrderedDict()
         self.require  : List[str]                      = []
         self.defines  : List[Tuple[str,Optional[str]]] = []
+        self.keydefs  : List[KeyDef]                   = []
         self.fn = fn
+        import yaml # (only needed if not cached)
         with open(fn, 'r') as fh:
             d = yaml.safe_load(fh)
         k:str
@@ -103,11 +157,16 @@ class Service:
                     v = [ v ]
                 self.defines.extend([Service.parse_define(d, fn) for d in v])
             elif k.startswith('hook.'):
+                # function[@KEY[=default]][:priority]
                 def priohook(s:str) -> HookDef:
                     h, _, n = s.partition(':')
                     p = int(n) if n else 0
-                    return p, h
-                h = k[5:]
+                    h, _, k = h.strip().partition('@')
+                    k, _, kd = k.partition('=')
+                    if kd:
+                        self.keydefs.append((hook, k, kd))
+                    return p, h, k
+                h = hook = k[5:]
                 if h not in self.hookdefs:
                     self.hookdefs[h] = []
                 if not isinstance(v, list):
@@ -126,7 +185,8 @@ class Service:
 
 class ServiceCollection:
     def __init__(self) -> None:
-        self.svcs : Dict[str,Service] = OrderedDict()
+        self.svcs   : Dict[str,Service]       = OrderedDict()
+        self.probed : Dict[str,Optional[str]] = OrderedDict() # path -> digest (None if absent)
 
     def add(self, svc:Service) -> None:
         self.svcs[svc.id] = svc
@@ -145,6 +205,9 @@ class ServiceCollection:
                 '%s%s' % (k, '' if v is None else '=%s' % shlex.quote(v))
                 for svc in self.svcs.values() for k,v in svc.defines]
 
+    def keydefs(self, hook:str) -> List[Tuple[str,str]]:
+        return [(k, kd) for svc in self.svcs.values() for h, k, kd in svc.keydefs if h == hook]
+
     def hookdefs(self) -> Dict[Service.Hook,List[HookDef]]:
         return { h: [hd for hds in (sv2.hookdefs.get(h.name)
             for sv2 in self.svcs.values()) if hds is not None for hd in hds]
@@ -167,17 +230,76 @@ class ServiceToolUtil:
             return CommandCollection.arg('-p', '--path', type=str,
                     action='append',
                     help='paths to search for service definitions')
+        if name == '--cache':
+            return CommandCollection.arg('--cache', type=str,
+                    help='cache file for the service configuration')
         raise ValueError()
 
+    @staticmethod
+    def digest(fn:str) -> Optional[str]:
+        try:
+            with open(fn, 'rb') as fh:
+                return hashlib.sha1(fh.read()).hexdigest()
+        except FileNotFoundError:
+            return None
+
+    # Write file only if its contents changed, so that make does not
+    # consider anything depending on it out of date. Returns True if written.
+    @staticmethod
+    def update(fn:str, text:str) -> bool:
+        try:
+            with open(fn, 'r') as fh:
+                if fh.read() == text:
+                    return False
+        except FileNotFoundError:
+            pass
+        with open(fn, 'w') as fh:
+            fh.write(text)
+        return True
+
+# The results of the queries make runs on every invocation (check, sources,
+# defines) are cached, keyed by the command line. An entry is valid as long
+# as all files probed while collecting the services (including this tool)
+# are unchanged, and no previously absent candidate has appeared.
+class ServiceCache:
+    VERSION = 1
+
+    def __init__(self, fn:str, args:NS) -> None:
+        self.fn = fn
+        self.key = [ args.path or ['.'], args.svc ]
+        self.results : Optional[Dict[str,str]] = None
+        try:
+            with open(fn, 'r') as fh:
+                d = json.load(fh)
+            if (d['version'] == ServiceCache.VERSION and d['key'] == self.key
+                    and all(ServiceToolUtil.digest(p) == h for p, h in d['files'].items())):
+                self.results = d['results']
+        except (OSError, ValueError, KeyError, AttributeError):
+            pass
+
+    def store(self, sc:ServiceCollection, results:Dict[str,str]) -> None:
+        files = OrderedDict(sc.probed)
+        files[os.path.abspath(__file__)] = ServiceToolUtil.digest(__file__)
+        d = dict(version=ServiceCache.VERSION, key=self.key, files=files, results=results)
+        dn = os.path.dirname(self.fn)
+        if dn:
+            os.makedirs(dn, exist_ok=True)
+        tmp = self.fn + '.tmp'
+        with open(tmp, 'w') as fh:
+            json.dump(d, fh, indent=1)
+        os.replace(tmp, self.fn)
+        self.results = results
+
 class ServiceTool:
     def run(self) -> None:
         CommandCollection.run(self)
 
     @staticmethod
-    def load(svcid:str, paths:List[str]) -> Optional[Service]:
+    def load(svcid:str, paths:List[str], probed:Dict[str,Optional[str]]) -> Optional[Service]:
         for p in paths:
             fn = os.path.join(p, svcid + '.svc')
-            if os.path.isfile(fn):
+            probed[fn] = ServiceToolUtil.digest(fn)
+            if probed[fn] is not None:
                 return Service(svcid, fn)
         return None
 
@@ -190,7 +312,7 @@ class ServiceTool:
             s = sd.popleft()
             if not sc.contains(s):
                 i += 1
-                svc = ServiceTool.load(s, args.path or ['.'])
+                svc = ServiceTool.load(s, args.path or ['.'], sc.probed)
                 if svc is None:
                     raise ValueError('Cannot find service description for "%s"' % s)
                 sc.add(svc)
@@ -198,51 +320,101 @@ class ServiceTool:
         sc.validate()
         return sc
 
+    # Answer query from cache if possible, otherwise collect the services
+    # and update the cache.
+    @staticmethod
+    def query(args:NS, what:str) -> str:
+        cache = ServiceCache(args.cache, args) if args.cache else None
+        if cache is None or cache.results is None:
+            sc = ServiceTool.collect(args)
+            results = { 'sources': ' '.join(sc.sources()), 'defines': ' '.join(sc.defines()) }
+            if cache is None:
+                return results[what]
+            cache.store(sc, results)
+        return cast(Dict[str,str], cache.results)[what]
+
     @ServiceToolUtil.arg('svc')
     @ServiceToolUtil.arg('--path')
+    @ServiceToolUtil.arg('--cache')
     @CommandCollection.cmd(help='validate the service configuration')
     def check(self, args:NS) -> None:
         try:
-            ServiceTool.collect(args)
+            ServiceTool.query(args, 'sources')
         except:
             print(str(sys.exc_info()))
 
     @ServiceToolUtil.arg('svc')
     @ServiceToolUtil.arg('--path')
+    @ServiceToolUtil.arg('--cache')
     @CommandCollection.cmd(help='output a list of source files')
     def sources(self, args:NS) -> None:
-        sc = ServiceTool.collect(args)
-        print(' '.join(sc.sources()))
+        print(ServiceTool.query(args, 'sources'))
 
     @ServiceToolUtil.arg('svc')
     @ServiceToolUtil.arg('--path')
+    @ServiceToolUtil.arg('--cache')
     @CommandCollection.cmd(help='output a list defines for the compiler')
     def defines(self, args:NS) -> None:
-        sc = ServiceTool.collect(args)
-        print(' '.join(sc.defines()))
-
+        print(ServiceTool.query(args, 'defines'))
+
+    # Besides the svcdefs header, one header per hook is created next to it
+    # (e.g. svcdefs_lwm_event.h), which svcdefs.h includes. Translation units
+    # that only need some hooks can include those, so changing the
+    # implementations of one hook only recompiles what uses it. Files are
+    # only written when their contents change; with a stamp file the
+    # dependency file refers to the stamp instead of the header, so make
+    # does not re-run the tool over and over when nothing changed.
     @ServiceToolUtil.arg('svc')
     @CommandCollection.arg('-d', action='store_true', help='create a dependency file for make')
+    @CommandCollection.arg('-s', '--stamp', type=str, help='stamp file to touch (target of dependency file)')
     @CommandCollection.arg('-o', '--output', type=str, help='output file', required=True)
     @ServiceToolUtil.arg('--path')
+    @ServiceToolUtil.arg('--cache')
     @CommandCollection.cmd(help='create the svcdef header file')
     def svcdefs(self, args:NS) -> None:
         sc = ServiceTool.collect(args)
-        guard = os.path.basename(args.output).replace('.', '_')
-        with open(args.output, 'w') as fh:
-            fh.write('// Automatically generated by %s\n\n' % ' '.join(sys.argv))
+        base, ext = os.path.splitext(args.output)
+        hdr = '// Automatically generated by %s\n\n' % ' '.join(sys.argv)
+        hfns = []
+        for h, defs in sorted(sc.hookdefs().items(), key=lambda hd: hd[0].name):
+            hfn = '%s_%s%s' % (base, h.name, ext)
+            guard = os.path.basename(hfn).replace('.', '_')
+            fh = io.StringIO()
+            fh.write(hdr)
             fh.write('#ifndef _%s_\n' % guard)
             fh.write('#define _%s_\n' % guard)
-            for h, defs in sorted(sc.hookdefs().items(), key=lambda hd: hd[0].name):
-                h.emit(fh, defs)
-
+            for k, v in sc.keydefs(h.name):
+                fh.write('#ifndef %s\n#define %s %s\n#endif\n' % (k, k, v))
+            h.emit(fh, defs)
             fh.write('#endif\n')
+            ServiceToolUtil.update(hfn, fh.getvalue())
+            hfns.append(hfn)
+
+        # remove headers of hooks no longer present
+        d = os.path.dirname(args.output) or '.'
+        pfx = os.path.basename(base) + '_'
+        keep = [os.path.basename(hfn) for hfn in hfns]
+        for fn in os.listdir(d):
+            if fn.startswith(pfx) and fn.endswith(ext) and fn not in keep:
+                os.remove(os.path.join(d, fn))
+
+        guard = os.path.basename(args.output).replace('.', '_')
+        fh = io.StringIO()
+        fh.write(hdr)
+        fh.write('#ifndef _%s_\n' % guard)
+        fh.write('#define _%s_\n' % guard)
+        for hfn in hfns:
+            fh.write('#include "%s"\n' % os.path.basename(hfn))
+        fh.write('#endif\n')
+        ServiceToolUtil.update(args.output, fh.getvalue())
+
         if args.d:
-            with open(os.path.splitext(args.output)[0] + '.d', 'w') as fh:
-                deps = sc.files()
-                fh.write('%s: %s\n\n' % (args.output, ' '.join(deps)))
-                for d in deps:
-                    fh.write('%s:\n\n' % d)
+            deps = sc.files()
+            ServiceToolUtil.update(base + '.d', '%s: %s\n\n' % (args.stamp or args.output, ' '.join(deps))
+                    + ''.join('%s:\n\n' % d for d in deps))
+        if args.stamp:
+            with open(args.stamp, 'a'):
+                os.utime(args.stamp, None)
 
 if __name__ == '__main__':
     ServiceTool().run()
@@ -19,6 +19,14 @@
 static struct {
     boot_boottab* boottab;
     unsigned int irqlevel;
+#ifdef CFG_jobstats
+    u4_t irqoff_t0;     // begin of current IRQ-off section
+    u4_t irqoff_max;    // longest IRQ-off section
+#endif
+#ifdef CFG_boottrace
+    u4_t boot0;         // start of boot trace (ticks)
+    u4_t boot[HAL_BOOT_CNT];
+#endif
 } sim;
 
 void* HAL_svc;
@@ -45,6 +53,10 @@ void hal_init (void* bootarg) {
     nvic_init();
     dbg_init();
     timer_init();
+#ifdef CFG_boottrace
+    sim.boot0 = timer_ticks();
+#endif
+    BOOTTRACE(HAL_BOOT_TIMER);
     gpio_init();
     fuart_init();
     radio_halinit();
@@ -56,18 +68,29 @@ void hal_init (void* bootarg) {
 #if defined(SVC_frag)
     {
         extern volatile boot_fwhdr fwhdr;
-        void* beg[1] = { (void*) (((uintptr_t) &fwhdr + fwhdr.size
-                    + (FLASH_PAGE_SZ - 1)) & ~(FLASH_PAGE_SZ - 1)) };
-        void* end[1] = { (void*) FLASH_END };
-        _frag_init(1, beg, end);
+        _frag_init((void*) (((uintptr_t) &fwhdr + fwhdr.size
+                        + (FLASH_PAGE_SZ - 1)) & ~(FLASH_PAGE_SZ - 1)),
+                (void*) FLASH_END);
     }
 #endif
 
 #if defined(SVC_eefs)
     eefs_init((void*) APPDATA_BASE, APPDATA_SZ);
+    BOOTTRACE(HAL_BOOT_EEFS);
 #endif
 }
 
+#ifdef CFG_boottrace
+// (simulated time; stages before the timer is up are not covered)
+void hal_boottrace_mark (int stage) {
+    sim.boot[stage] = osticks2us(timer_ticks() - sim.boot0);
+}
+
+const u4_t* hal_boottrace (void) {
+    return sim.boot;
+}
+#endif
+
 void hal_watchcount (int cnt) {
     // not implemented
 }
@@ -75,20 +98,50 @@ void hal_watchcount (int cnt) {
 void hal_disableIRQs (void) {
     if( sim.irqlevel++ == 0 ) {
         asm volatile ("cpsid i" : : : "memory");
+#ifdef CFG_jobstats
+        sim.irqoff_t0 = timer_ticks();
+#endif
     }
 }
 
 void hal_enableIRQs (void) {
     ASSERT(sim.irqlevel);
     if( --sim.irqlevel == 0 ) {
+#ifdef CFG_jobstats
+        u4_t dt = (u4_t) timer_ticks() - sim.irqoff_t0;
+        if( dt > sim.irqoff_max ) {
+            sim.irqoff_max = dt;
+        }
+#endif
         asm volatile ("cpsie i" : : : "memory");
         irq();
     }
 }
 
+#ifdef CFG_jobstats
+u4_t hal_irqoff_max (void) {
+    hal_disableIRQs();
+    u4_t max = sim.irqoff_max;
+    sim.irqoff_max = 0;
+    hal_enableIRQs();
+    return max;
+}
+#endif
+
+#ifdef CFG_stackmon
+void* hal_stack_limit (void) {
+    extern uint32_t _ebss; // provided by linker script
+    return &_ebss;
+}
+#endif
+
 void hal_sleep (u1_t type, u4_t targettime) {
     timer_set(timer_extend(targettime));
     wfi();
+#ifdef CFG_jobstats
+    // don't account sleep time as IRQ-off time
+    sim.irqoff_t0 = timer_ticks();
+#endif
 }
 
 u4_t hal_ticks (void) {
@@ -12,6 +12,9 @@
 
 extern void* HAL_svc;
 
+// Macro to place code in RAM
+#define __fastcode __attribute__((noinline,section(".fastcode")))
+
 // peripherals
 enum {
     HAL_PID_NVIC,
@@ -273,9 +273,10 @@ enum {
 
 static void fuart_irq (void) {
     fuart_reg* reg = PERIPH_REG(HAL_PID_FUART);
-    fuart_rx_cb(reg->rxbuf, reg->rxlen);
+    // (receiver may re-enable reception from callback)
     reg->ctrl &= ~FUART_C_RXEN;
     psvc(HAL_PID_FUART, FUART_PSVC_CLEARIRQ);
+    fuart_rx_cb(reg->rxbuf, reg->rxlen);
 }
 
 void fuart_init (void) {
@@ -328,6 +329,9 @@ enum {
     RADIO_PSVC_TX,
     RADIO_PSVC_RX,
     RADIO_PSVC_CLEARIRQ,
+    RADIO_PSVC_RXON,
+    RADIO_PSVC_SLEEP,
+    RADIO_PSVC_CAD,
 };
 
 enum {
@@ -336,6 +340,7 @@ enum {
     RADIO_S_TXDONE,
     RADIO_S_RXDONE,
     RADIO_S_RXTOUT,
+    RADIO_S_CADDONE,
 };
 
 // RPS extensions
@@ -372,7 +377,7 @@ bool radio_irq_process (ostime_t irqtime, u1_t diomask) {
             LMIC.snr = reg->snr;
             LMIC.dataLen = reg->plen;
             LMIC.rxtime = irqtime;
-	    LMIC.rxtime0 = LMIC.rxtime - calcAirTime(LMIC.rps, LMIC.dataLen); // beginning of frame timestamp
+	    LMIC.rxtime0 = LMIC.rxtime - calcAirTimeIrq(LMIC.rps, LMIC.dataLen); // beginning of frame timestamp
             memcpy(LMIC.frame, reg->buf, LMIC.dataLen);
 #ifdef DEBUG_RX
             // XXX would be nice if this could be shared with other radio drivers... (radio.c)
@@ -391,6 +396,10 @@ bool radio_irq_process (ostime_t irqtime, u1_t diomask) {
                     LMIC.freq, 6, getSf(LMIC.rps) + 6, 125 << getBw(LMIC.rps));
 #endif
             break;
+        case RADIO_S_CADDONE:
+            // no preamble detected
+            LMIC.dataLen = 0;
+            break;
     }
     return true;
 }
@@ -412,24 +421,49 @@ void radio_starttx (bool txcontinuous) {
     psvc(HAL_PID_RADIO, RADIO_PSVC_TX);
 }
 
-void radio_startrx (bool rxcontinuous) {
-    ASSERT(rxcontinuous == 0);
-
+static radio_reg* rxsetup (void) {
     radio_reg* reg = PERIPH_REG(HAL_PID_RADIO);
 
-    reg->xtime = timer_extend(LMIC.rxtime);
     reg->freq = LMIC.freq;
     reg->rps = LMIC.rps;
-    reg->npreamble = LMIC.rxsyms;
 
     if( LMIC.noRXIQinversion == 0 ) {
         reg->rps |= RADIO_ERPS_IQINV;
     }
+    return reg;
+}
+
+void radio_startrx (bool rxcontinuous) {
+    radio_reg* reg = rxsetup();
+
+    if( rxcontinuous ) {
+        // receive until stopped, no symbol timeout
+        reg->xtime = timer_extend(os_getTime());
+        reg->npreamble = 0;
+        psvc(HAL_PID_RADIO, RADIO_PSVC_RXON);
+    } else {
+        reg->xtime = timer_extend(LMIC.rxtime);
+        reg->npreamble = LMIC.rxsyms;
+        psvc(HAL_PID_RADIO, RADIO_PSVC_RX);
+    }
+}
 
-    psvc(HAL_PID_RADIO, RADIO_PSVC_RX);
+// channel activity detection now; if a preamble is found, the frame is
+// received (single, times out after LMIC.rxsyms if no frame follows)
+void radio_cad (void) {
+    radio_reg* reg = rxsetup();
+    reg->xtime = timer_extend(os_getTime());
+    reg->npreamble = LMIC.rxsyms;
+    psvc(HAL_PID_RADIO, RADIO_PSVC_CAD);
+}
+
+void radio_sleep (void) {
+    // stop receiver (also after a frame has been received)
+    psvc(HAL_PID_RADIO, RADIO_PSVC_SLEEP);
 }
 
-void radio_sleep (void) {}
 void radio_cca (void) {}
-void radio_cad (void) {}
 void radio_cw (void) {}
+#if defined(CFG_fifo_irq)
+u1_t radio_irq_fifo (u1_t diomask, ostime_t irqtime) { return diomask; }
+#endif
@@ -0,0 +1,78 @@
+# Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+#
+# This file is subject to the terms and conditions defined in file 'LICENSE',
+# which is part of this source code package.
+
+# Micro-benchmark for runtime.Runtime/JobGroup on the VirtualTimeLoop:
+# radio-like job churn (schedule, reschedule, cancel) across many groups.
+#
+# Usage: python3 bench_runtime.py [-n JOBS] [-g GROUPS]
+
+import argparse
+import asyncio
+import random
+import time
+
+from runtime import Clock, JobGroup, Runtime
+from vtimeloop import VirtualTimeLoop
+
+
+class BenchClock(Clock):
+    def time(self, *, update:bool=False) -> float:
+        return asyncio.get_running_loop().time()
+
+    def ticks(self, *, update:bool=False) -> int:
+        return self.time2ticks(self.time())
+
+    def ticks2time(self, ticks:int) -> float:
+        return ticks / 1000000
+
+    def time2ticks(self, time:float) -> int:
+        return round(time * 1000000)
+
+    def sec2ticks(self, sec:float) -> int:
+        return round(sec * 1000000)
+
+
+async def bench(njobs:int, ngroups:int) -> int:
+    rt = Runtime()
+    rt.setclock(BenchClock())
+    rnd = random.Random(0)
+    groups = [JobGroup(rt) for _ in range(ngroups)]
+    done = asyncio.Event()
+    count = 0
+
+    def cb(g:JobGroup) -> None:
+        nonlocal count
+        count += 1
+        if count >= njobs:
+            done.set()
+            return
+        now = asyncio.get_running_loop().time()
+        # like a receiver: (re)arm a timeout and schedule a completion
+        g.cancel('timeout')
+        g.schedule('timeout', now + rnd.uniform(0.001, 0.1), cb, g=g)
+        g.schedule(None, now + rnd.uniform(0.001, 0.1), cb, g=g)
+
+    for g in groups:
+        g.schedule(None, rnd.uniform(0, 0.1), cb, g=g)
+    await done.wait()
+    for g in groups:
+        g.cancel_all()
+    return count
+
+def main() -> None:
+    p = argparse.ArgumentParser(description='Runtime job queue benchmark')
+    p.add_argument('-n', '--jobs', type=int, default=200000, help='number of jobs to run')
+    p.add_argument('-g', '--groups', type=int, default=100, help='number of job groups')
+    args = p.parse_args()
+
+    loop = VirtualTimeLoop()
+    asyncio.set_event_loop(loop)
+    t0 = time.perf_counter()
+    n = loop.run_until_complete(bench(args.jobs, args.groups))
+    dt = time.perf_counter() - t0
+    print(f'{n} jobs in {dt:.3f}s: {n / dt:.0f} jobs/s, {len(loop._tasks)} loop handles left')
+
+if __name__ == '__main__':
+    main()
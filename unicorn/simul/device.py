@@ -7,12 +7,14 @@
 from typing import cast, Any, Callable, Dict, List, Optional, Tuple, Type, TypeVar
 
 import asyncio
+import copy
 import ctypes
 import struct
 
 import unicorn as uc
 import unicorn.arm_const as uca
 
+from dataclasses import dataclass
 from intelhex import IntelHex
 from uuid import UUID
 
@@ -26,6 +28,9 @@ from runtime import Clock, Runtime
 class Peripheral:
     uuid:Optional[UUID] = None
 
+    # Python-side state to include in snapshots (in addition to 'reg')
+    snapattrs:Tuple[str,...] = ()
+
     def __init__(self, sim:'Simulation', pid:int):
         self.sim = sim
         self.pid = pid
@@ -34,6 +39,22 @@ class Peripheral:
     def init(self) -> None:
         pass
 
+    # no activity in flight that a snapshot could not capture
+    def idle(self) -> bool:
+        return True
+
+    def snapshot(self) -> Dict[str,Any]:
+        state = { a: copy.deepcopy(getattr(self, a)) for a in self.snapattrs }
+        if (reg := getattr(self, 'reg', None)) is not None:
+            state['reg'] = bytes(reg)
+        return state
+
+    def restore(self, state:Dict[str,Any]) -> None:
+        for a in self.snapattrs:
+            setattr(self, a, copy.deepcopy(state[a]))
+        if (reg := state.get('reg')) is not None:
+            ctypes.memmove(ctypes.addressof(self.reg), reg, len(reg))
+
     def svc(self, fid:int) -> None:
         raise NotImplementedError
 
@@ -83,7 +104,16 @@ class IrqHandler:
 # -----------------------------------------------------------------------------
 # Device Simulation
 
+@dataclass
+class Snapshot:
+    regs:Dict[int,int]
+    mem:List[Tuple[int,bytes]]
+    pc:int
+    running:bool
+    periphs:List[Tuple[int,UUID,Dict[str,Any]]]
+
 PreRunHook = Callable[[], None]
+WfiHook = Callable[[], bool]
 Context = Dict[str, Any]
 
 class Simulation():
@@ -116,6 +146,13 @@ class Simulation():
 
         #self.emu.hook_add(uc.UC_HOOK_CODE,
         #        lambda uc, addr, size, sim: sim.trace(addr), self)
+
+        # approximate instruction count (most Thumb instructions are 2 bytes)
+        self.icount = 0
+        if context.get('sim.icount', False):
+            self.emu.hook_add(uc.UC_HOOK_BLOCK,
+                    lambda uc, address, size, sim: sim.count(size), self,
+                    begin=Simulation.FLASH_BASE, end=Simulation.PERIPH_BASE-1)
         self.emu.hook_add(uc.UC_HOOK_INTR,
                 lambda uc, intno, sim: sim.intr(intno), self)
 
@@ -125,14 +162,22 @@ class Simulation():
                 sim.irq_return(address), self,
                 begin=0xfffff000, end=0xffffffff)
 
-        self.emu.mem_map(Simulation.RAM_BASE, context.get('sim.ramsz', 16*1024))
-        self.emu.mem_map(Simulation.FLASH_BASE, context.get('sim.flashsz', 128*1024))
+        self.memregions = [(Simulation.RAM_BASE, context.get('sim.ramsz', 16*1024)),
+                (Simulation.FLASH_BASE, context.get('sim.flashsz', 128*1024))]
         if (eesz := context.get('sim.eesz', 8*1024)):
-            self.emu.mem_map(Simulation.EE_BASE, eesz)
+            self.memregions.append((Simulation.EE_BASE, eesz))
+        for base, size in self.memregions:
+            self.emu.mem_map(base, size)
 
         self.evhub:Optional[EventHub] = context.get('evhub')
         self.peripherals:Dict[int,Peripheral] = { }
+        self.psvc:Dict[int,Callable[[int],None]] = { }
         self.prerunhooks:List[PreRunHook] = []
+        self.fastforward = context.get('sim.fastforward', True)
+        self.wfihook:Optional[WfiHook] = None
+        self.energy:Optional[Any] = None     # EnergyMeter (energy.py)
+        self.timing:Optional[Any] = None     # TimingMonitor (timing.py)
+        self.rxbench:Optional[Any] = None    # RxBench (radiobench.py)
 
         self.running = asyncio.Event()
         self.ex:Optional[BaseException] = None
@@ -154,6 +199,9 @@ class Simulation():
         if self.evhub:
             self.evhub.log(self, msg)
 
+    def count(self, size:int) -> None:
+        self.icount += size // 2
+
     def trace(self, addr:int) -> None:
         print('PC=%08x' % addr)
 
@@ -205,7 +253,9 @@ class Simulation():
         for pid in self.peripherals:
             self.unmap_peripheral(pid)
         self.peripherals.clear()
+        self.psvc.clear()
         self.prerunhooks.clear()
+        self.wfihook = None
 
         self.pc = ep
         self.emu.reg_write(uca.UC_ARM_REG_SP, sp)
@@ -214,6 +264,49 @@ class Simulation():
 
         self.running.set()
 
+    SNAPREGS = [uca.UC_ARM_REG_R0 + i for i in range(13)] + [
+            uca.UC_ARM_REG_SP, uca.UC_ARM_REG_LR, uca.UC_ARM_REG_CPSR]
+
+    # Capture complete device state. Only valid while the firmware is
+    # suspended in the run loop (i.e. from outside the simulation task) and
+    # all peripherals are idle.
+    def snapshot(self) -> Snapshot:
+        for p in self.peripherals.values():
+            if not p.idle():
+                raise RuntimeError(f'Peripheral {p.uuid} busy, cannot take snapshot')
+        return Snapshot(
+                regs={ r: self.emu.reg_read(r) for r in Simulation.SNAPREGS },
+                mem=[(base, bytes(self.emu.mem_read(base, size))) for base, size in self.memregions],
+                pc=self.pc,
+                running=self.running.is_set(),
+                periphs=[(pid, cast(UUID, p.uuid), p.snapshot()) for pid, p in sorted(self.peripherals.items())])
+
+    def restore(self, snap:Snapshot) -> None:
+        self.irqhandler = Simulation.dummyirqhandler
+        self.runtime.reset()
+
+        for pid in self.peripherals:
+            self.unmap_peripheral(pid)
+        self.peripherals.clear()
+        self.psvc.clear()
+        self.prerunhooks.clear()
+        self.wfihook = None
+
+        for base, data in snap.mem:
+            self.emu.mem_write(base, data)
+        for pid, uuid, state in snap.periphs:
+            p = Peripherals.create(uuid, self, pid)
+            self.peripherals[pid] = p
+            self.psvc[pid] = p.svc
+            p.restore(state)
+        for r, v in snap.regs.items():
+            self.emu.reg_write(r, v)
+        self.pc = snap.pc
+        if snap.running:
+            self.running.set()
+        else:
+            self.running.clear()
+
     SRC_CONTINUE = 0    # continue run loop
     SRC_RETURN   = 1    # return to caller
     SRC_RESET    = 2    # reset simulation
@@ -231,17 +324,26 @@ class Simulation():
     def svc_register(self) -> int:
         pid  = self.emu.reg_read(uca.UC_ARM_REG_R1)
         uuid = self.emu.reg_read(uca.UC_ARM_REG_R2)
-        self.peripherals[pid] = Peripherals.create(
-                UUID(bytes=bytes(self.emu.mem_read(uuid, 16))), self, pid)
+        p = Peripherals.create(UUID(bytes=bytes(self.emu.mem_read(uuid, 16))), self, pid)
+        self.peripherals[pid] = p
+        self.psvc[pid] = p.svc
         return Simulation.SRC_RETURN
 
+    # If the only thing that can end the sleep is the timer, the wfihook
+    # fast-forwards virtual time and the firmware continues without leaving
+    # the emulator.
     def svc_wfi(self) -> int:
         if not self.irqhandler.requested():
+            if self.fastforward and self.wfihook is not None and self.wfihook():
+                return Simulation.SRC_RETURN
             self.running.clear()
         return Simulation.SRC_CONTINUE
 
+    # only stop emulation if there is an interrupt to dispatch
     def svc_irq(self) -> int:
-        return Simulation.SRC_CONTINUE
+        if self.irqhandler.requested():
+            return Simulation.SRC_CONTINUE
+        return Simulation.SRC_RETURN
 
     def svc_reset(self) -> int:
         return Simulation.SRC_RESET
@@ -274,11 +376,10 @@ class Simulation():
                     raise RuntimeError(f'Invalid svc return code {c}')
 
             else:
-                pid = (svcid >> 16) & 0xff
-                p = self.peripherals.get(pid)
-                if p is None:
+                psvc = self.psvc.get((svcid >> 16) & 0xff)
+                if psvc is None:
                     raise RuntimeError(f'Unknown peripheral ID {svcid-Simulation.SVC_PERIPH_BASE}, lr=0x{lr:08x}')
-                p.svc(svcid & 0xffff)
+                psvc(svcid & 0xffff)
                 self.emu.reg_write(uca.UC_ARM_REG_PC, lr)
         else:
             raise RuntimeError('Unexpected interrupt {intno}, lr=0x{lr:08x}')
@@ -290,9 +391,13 @@ class Simulation():
             self.ex = ex
             self.emu.emu_stop()
 
-    async def run(self) -> None:
+    async def run(self, snapshot:Optional[Snapshot]=None) -> None:
         while True:
-            self.reset()
+            if snapshot is not None:
+                self.restore(snapshot)
+                snapshot = None
+            else:
+                self.reset()
 
             while True:
                 await self.running.wait()
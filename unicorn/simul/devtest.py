@@ -3,13 +3,16 @@
 # This file is subject to the terms and conditions defined in file 'LICENSE',
 # which is part of this source code package.
 
-from typing import Any, Callable, List, Generator, Optional, TextIO
+from typing import Any, Callable, Dict, List, Generator, Optional, TextIO
 
 import asyncio
+import contextlib
+import copy
 import os
 import shlex
 import sys
 
+from dataclasses import dataclass
 from ward import expect, fixture, Scope
 from colorama import Fore, Style
 
@@ -18,12 +21,16 @@ import loradefs as ld
 import loramsg as lm
 import loraopts as lo
 
-from device import Simulation
+from device import Simulation, Snapshot
+from energy import EnergyMeter
 from eventhub import EventHub
 from lorawan import LNS, LoraWanFormatter, LoraWanMsg, Gateway, Session, SessionManager, UniversalGateway
 from medium import LoraMsg, Rps, SimpleMedium
 from peripherals import Radio
+from profiler import Profiler
+from radiobench import RxBench
 from runtime import Runtime
+from timing import TimingMonitor
 from vtimeloop import VirtualTimeLoop
 
 def explain(s:Optional[str]='', *, explain:Optional[str]=None, **kwargs:Any) -> Optional[str]:
@@ -80,8 +87,13 @@ class LoggingEventHub(EventHub):
                 s += f' -- {info}'
             self.writer.write(f'{s}\n', style=Fore.GREEN)
 
+@dataclass
+class DeviceSnapshot:
+    sim:Snapshot
+    session:Optional[Session]
+
 class DeviceTest:
-    def __init__(self, *, hexfiles:Optional[List[str]]=None) -> None:
+    def __init__(self, *, hexfiles:Optional[List[str]]=None, context:Dict[str,Any]={}) -> None:
         self.runtime = Runtime()
         self.sm = SessionManager()
         self.log = LoggingEventHub(ColoramaStream(sys.stdout), sm=self.sm)
@@ -89,7 +101,7 @@ class DeviceTest:
         self.gateway = UniversalGateway(self.runtime, self.medium)
         self.session:Optional[Session] = None
 
-        self.sim = Simulation(self.runtime, context={ 'evhub': self.log, 'medium': self.medium})
+        self.sim = Simulation(self.runtime, context={ 'evhub': self.log, 'medium': self.medium, **context })
 
         if hexfiles is None:
             hexfiles = shlex.split(os.environ.get('TEST_HEXFILES', ''))
@@ -97,8 +109,61 @@ class DeviceTest:
         for hf in hexfiles:
             self.sim.load_hexfile(hf)
 
-    def start(self) -> None:
-        self.simtask = asyncio.create_task(self.sim.run())
+        # set SIM_PROFILE=<file> to append a profile report (and folded
+        # stacks to <file>.folded) for each test
+        self.profile = os.environ.get('SIM_PROFILE')
+        self.prof = Profiler(self.sim, hexfiles) if self.profile else None
+
+        # set SIM_ENERGY=1 to report charge per scenario for each test
+        self.meter:Optional[EnergyMeter] = None
+        self.energy = bool(os.environ.get('SIM_ENERGY'))
+
+        # set SIM_TIMING=1 to check receive window timing for each test
+        self.timing:Optional[TimingMonitor] = None
+        if os.environ.get('SIM_TIMING'):
+            self.enable_timing()
+
+        self.rxbench:Optional[RxBench] = None
+
+    def enable_timing(self) -> TimingMonitor:
+        if self.timing is None:
+            self.timing = TimingMonitor(self.sim)
+        return self.timing
+
+    def enable_rxbench(self) -> RxBench:
+        if self.rxbench is None:
+            self.rxbench = RxBench(self.sim)
+        return self.rxbench
+
+    def scenario(self, name:str) -> Any:
+        cm = contextlib.ExitStack()
+        if self.prof:
+            cm.enter_context(self.prof.scenario(name))
+        if self.meter:
+            cm.enter_context(self.meter.scenario(name))
+        return cm
+
+    # Start simulation, optionally resuming from a snapshot taken from a
+    # DeviceTest with the same firmware (e.g. a joined device).
+    def start(self, snapshot:Optional[DeviceSnapshot]=None) -> None:
+        if self.energy and self.meter is None:
+            self.meter = EnergyMeter(self.sim)
+        if snapshot is not None and snapshot.session is not None:
+            self.session = copy.deepcopy(snapshot.session)
+            self.sm.add(self.session)
+        self.simtask = asyncio.create_task(self.sim.run(snapshot and snapshot.sim))
+
+    # Capture device and session state once the radio is idle (e.g. after
+    # the receive windows following an uplink have closed).
+    async def snapshot(self, *, timeout:float=60) -> DeviceSnapshot:
+        deadline = asyncio.get_running_loop().time() + timeout
+        while True:
+            try:
+                return DeviceSnapshot(self.sim.snapshot(), copy.deepcopy(self.session))
+            except RuntimeError:
+                if asyncio.get_running_loop().time() > deadline:
+                    raise
+                await asyncio.sleep(0.1)
 
     async def stop(self) -> None:
         self.simtask.cancel()
@@ -106,6 +171,31 @@ class DeviceTest:
             await self.simtask
         except asyncio.CancelledError:
             pass
+        if self.prof and self.profile:
+            with open(self.profile, 'a') as f:
+                self.prof.report(f)
+            with open(self.profile + '.folded', 'a') as f:
+                self.prof.folded(f)
+            self.prof.close()
+            self.prof = None
+        if self.meter:
+            for scn, q in self.meter.report().items():
+                self.log.writer.write(f'energy {scn:8s} ' + ' '.join(f'{k}={v:.3f}' for k, v in q.items()) + ' uAh\n')
+            self.meter.close()
+            self.meter = None
+        if self.rxbench:
+            self.log.writer.write('rxbench ' + ' '.join(f'{k}={v:.1f}' if isinstance(v, float)
+                else f'{k}={v}' for k, v in self.rxbench.report().items()) + '\n')
+            self.rxbench.close()
+            self.rxbench = None
+        if self.timing:
+            timing = self.timing
+            for name, st in timing.report().items():
+                self.log.writer.write(f'timing {name:8s} ' + ' '.join(f'{k}={v:.1f}' if isinstance(v, float)
+                    else f'{k}={v}' for k, v in st.items()) + '\n')
+            timing.close()
+            self.timing = None
+            assert not timing.failures, 'Receive window timing violation: ' + '; '.join(timing.failures)
 
     async def up(self, *, timeout:Optional[float]=None, **kwargs:Any) -> LoraWanMsg:
         return await asyncio.wait_for(self.gateway.next_up(), timeout)
@@ -127,19 +217,20 @@ class DeviceTest:
         self.gateway.sched_dn(LoraMsg(uplwm.msg.xend + rxdelay + toff, pdu, freq, rps, xpow=xpow))
 
     async def join(self, *, timeout:Optional[float]=None, region:Optional[ld.Region]=None, **kwargs:Any) -> None:
-        jreq = await self.up(timeout=timeout, **kwargs)
-        if region:
-            if not isinstance(region, type(jreq.reg)):
-                raise ValueError(explain(f'Incompatible regions {region} and {jreq.reg}', **kwargs))
-        else:
-            region = jreq.reg
+        with self.scenario('join'):
+            jreq = await self.up(timeout=timeout, **kwargs)
+            if region:
+                if not isinstance(region, type(jreq.reg)):
+                    raise ValueError(explain(f'Incompatible regions {region} and {jreq.reg}', **kwargs))
+            else:
+                region = jreq.reg
 
-        if self.session:
-            self.sm.remove(self.session)
-        jacc, self.session = LNS.join(jreq.msg.pdu, region, **kwargs)
-        self.sm.add(self.session)
-        kwargs.setdefault('rx1delay', ld.JaccRxDelay)
-        self.dn(jreq, jacc, join=True, **kwargs)
+            if self.session:
+                self.sm.remove(self.session)
+            jacc, self.session = LNS.join(jreq.msg.pdu, region, **kwargs)
+            self.sm.add(self.session)
+            kwargs.setdefault('rx1delay', ld.JaccRxDelay)
+            self.dn(jreq, jacc, join=True, **kwargs)
 
     def verify(self, lwm:LoraWanMsg, *, expectport:Optional[int]=None, **kwargs:Any) -> rt.types.Msg:
         assert self.session is not None
@@ -158,7 +249,8 @@ class DeviceTest:
         deadline = timeout and loop.time() + timeout
         for _ in range(limit):
             timeout = deadline and max(0, deadline - loop.time())
-            upmsg = await self.up(timeout=timeout)
+            with self.scenario('uplink'):
+                upmsg = await self.up(timeout=timeout)
             upmsg.rtm = self.verify(upmsg, **kwargs)
             if filter(upmsg):
                 return upmsg
@@ -0,0 +1,123 @@
+# Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+#
+# This file is subject to the terms and conditions defined in file 'LICENSE',
+# which is part of this source code package.
+
+# Energy model for the simulated device.
+#
+# Emulated code executes in zero virtual time, so MCU run time is estimated
+# from the instruction count; the remainder of the elapsed virtual time is
+# spent in WFI sleep. Radio TX (per power level) and RX time is reported by
+# the Radio peripheral. Charge is accounted in µAs and reported in µAh, in
+# total and per scenario.
+
+from typing import Dict, Iterator, Optional
+
+import asyncio
+import bisect
+import contextlib
+
+from dataclasses import dataclass, field
+
+import unicorn as uc
+
+from device import Simulation
+
+
+# Default currents follow the BRD_PWR_* values in stm32/brd_devboards.h
+# and SX1276 datasheet figures (PA_BOOST).
+@dataclass
+class CurrentTable:
+    mcu_hz:float = 32e6
+    cpi:float = 1.5                 # average cycles per instruction
+    run_ua:float = 6000             # BRD_PWR_RUN_UA
+    sleep_ua:float = 5              # BRD_PWR_S2_UA
+    rx_ua:float = 11500
+    tx_ua:Dict[int,float] = field(default_factory=lambda: {
+        2: 24000, 7: 32000, 13: 40000, 14: 44000, 17: 87000, 20: 120000 })
+
+    def tx(self, xpow:int) -> float:
+        levels = sorted(self.tx_ua)
+        i = min(bisect.bisect_left(levels, xpow), len(levels) - 1)
+        return self.tx_ua[levels[i]]
+
+
+@dataclass
+class Charge:
+    run:float = 0.0                 # µAs
+    sleep:float = 0.0
+    tx:float = 0.0
+    rx:float = 0.0
+
+    def total(self) -> float:
+        return self.run + self.sleep + self.tx + self.rx
+
+    def __add__(self, o:'Charge') -> 'Charge':
+        return Charge(self.run + o.run, self.sleep + o.sleep, self.tx + o.tx, self.rx + o.rx)
+
+    def __sub__(self, o:'Charge') -> 'Charge':
+        return Charge(self.run - o.run, self.sleep - o.sleep, self.tx - o.tx, self.rx - o.rx)
+
+    def uah(self) -> Dict[str,float]:
+        return { 'run': self.run / 3600, 'sleep': self.sleep / 3600,
+                'tx': self.tx / 3600, 'rx': self.rx / 3600, 'total': self.total() / 3600 }
+
+
+class EnergyMeter:
+    def __init__(self, sim:Simulation, table:Optional[CurrentTable]=None) -> None:
+        self.sim = sim
+        self.table = table or CurrentTable()
+        self.t0 = asyncio.get_running_loop().time()
+        self.icount = 0
+        self.txs = 0.0              # TX time (s)
+        self.rxs = 0.0              # RX time (s)
+        self.txq = 0.0              # TX charge (µAs)
+        self.scn = 'init'
+        self.mark = Charge()
+        self.scenarios:Dict[str,Charge] = {}
+        self.hook = sim.emu.hook_add(uc.UC_HOOK_BLOCK,
+                lambda emu, addr, size, em: em.count(size), self,
+                begin=Simulation.FLASH_BASE, end=Simulation.PERIPH_BASE-1)
+        sim.energy = self
+
+    def close(self) -> None:
+        self.sim.emu.hook_del(self.hook)
+        self.sim.energy = None
+
+    def count(self, size:int) -> None:
+        self.icount += size // 2
+
+    def radio_tx(self, xpow:int, duration:float) -> None:
+        self.txs += duration
+        self.txq += self.table.tx(xpow) * duration
+
+    def radio_rx(self, duration:float) -> None:
+        self.rxs += duration
+
+    def charge(self) -> Charge:
+        t = self.table
+        run = self.icount * t.cpi / t.mcu_hz
+        elapsed = asyncio.get_running_loop().time() - self.t0
+        return Charge(run=run * t.run_ua, sleep=max(0, elapsed - run) * t.sleep_ua,
+                tx=self.txq, rx=self.rxs * t.rx_ua)
+
+    def switch(self, scn:str) -> None:
+        now = self.charge()
+        self.scenarios[self.scn] = self.scenarios.get(self.scn, Charge()) + (now - self.mark)
+        self.mark = now
+        self.scn = scn
+
+    @contextlib.contextmanager
+    def scenario(self, name:str) -> Iterator[None]:
+        prev = self.scn
+        self.switch(name)
+        try:
+            yield
+        finally:
+            self.switch(prev)
+
+    def report(self) -> Dict[str,Dict[str,float]]:
+        self.switch(self.scn)
+        res = { s: c.uah() for s, c in self.scenarios.items() }
+        res['total'] = self.charge().uah()
+        return res
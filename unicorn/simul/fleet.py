@@ -0,0 +1,277 @@
+# Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+#
+# This file is subject to the terms and conditions defined in file 'LICENSE',
+# which is part of this source code package.
+
+# Fleet simulation: many firmware instances (each with its own emulator and
+# runtime) on one virtual time loop, sharing a single medium and gateway.
+#
+# Usage: python3 fleet.py [-n COUNT] [-t SECONDS] [--stagger SECONDS] [--collisions [--radius M]] HEXFILE...
+
+from typing import Any, Dict, List, Optional, Tuple
+
+import argparse
+import asyncio
+import hashlib
+import math
+import os
+import random
+import shlex
+import struct
+
+from dataclasses import dataclass, field
+
+import loradefs as ld
+import loramsg as lm
+import rtlib as rt
+
+from device import Simulation
+from lorawan import LNS, LoraWanMsg, SessionManager, UniversalGateway
+from medium import CollisionMedium, LoraMsg, LoraMsgProcessor, LoraMsgTransmitter, Medium, SimpleMedium
+from peripherals import Radio
+from runtime import Clock, Runtime
+from vtimeloop import VirtualTimeLoop
+
+
+class LoopClock(Clock):
+    TICKS_PER_SEC = 1000000
+
+    def time(self, *, update:bool=False) -> float:
+        return asyncio.get_running_loop().time()
+
+    def ticks(self, *, update:bool=False) -> int:
+        return self.time2ticks(self.time())
+
+    def ticks2time(self, ticks:int) -> float:
+        return ticks / LoopClock.TICKS_PER_SEC
+
+    def time2ticks(self, time:float) -> int:
+        return round(time * LoopClock.TICKS_PER_SEC)
+
+    def sec2ticks(self, sec:float) -> int:
+        return round(sec * LoopClock.TICKS_PER_SEC)
+
+
+@dataclass
+class DeviceStats:
+    jreq:int = 0                # join requests sent
+    joined:Optional[float] = None
+    up:int = 0                  # data frames sent
+    up_rx:int = 0               # data frames received by network (unique)
+    airtime:float = 0.0
+    fcnts:set = field(default_factory=set)
+
+
+class FleetDevice:
+    PERSODATA_OFF = 0x60
+    PERSODATA_MAGIC_V1 = 0xb2dc4db2
+
+    def __init__(self, idx:int, hexfiles:List[str], medium:Medium, context:Dict[str,Any]) -> None:
+        self.idx = idx
+        self.deveui = 0xffffffaa00000000 | (idx + 1)
+        self.runtime = Runtime()
+        self.sim = Simulation(self.runtime, context={ 'medium': medium, **context })
+        for hf in hexfiles:
+            self.sim.load_hexfile(hf)
+        self.sim.emu.mem_write(Simulation.EE_BASE + FleetDevice.PERSODATA_OFF, self.persodata())
+        self.stats = DeviceStats()
+        self.pos = (0.0, 0.0)
+        self.task:Optional[asyncio.Task] = None
+
+    # personalization data (lmic/persodata.c) with unique DevEUI
+    def persodata(self) -> bytes:
+        pd = struct.pack('<IIII16sQQ16s16s', FleetDevice.PERSODATA_MAGIC_V1, 0, 0, 0,
+                b'fleet-%d' % self.idx, self.deveui, 0xffffffbb00000000,
+                b'@ABCDEFGHIJKLMNO', b'`abcdefghijklmno')
+        return pd + hashlib.sha256(pd).digest()
+
+    async def run(self, delay:float) -> None:
+        await asyncio.sleep(delay)
+        await self.sim.run()
+
+
+class FleetGateway(UniversalGateway):
+    def __init__(self, runtime:Runtime, medium:Medium) -> None:
+        super().__init__(runtime, medium)
+        self.dnsched:List[Tuple[float,float]] = []
+        self.dn_tx = 0
+        self.dn_dropped = 0
+
+    # gateway can only transmit one frame at a time; drop overlapping downlinks
+    def sched_dn(self, msg:LoraMsg) -> None:
+        now = asyncio.get_running_loop().time()
+        self.dnsched = [(b, e) for (b, e) in self.dnsched if e > now]
+        if any(b < msg.xend and msg.xbeg < e for (b, e) in self.dnsched):
+            self.dn_dropped += 1
+            return
+        self.dnsched.append((msg.xbeg, msg.xend))
+        self.dn_tx += 1
+        msg.src = self
+        LoraMsgTransmitter(self.runtime, self.medium).transmit(msg)
+
+
+class FleetMonitor(LoraMsgProcessor):
+    def __init__(self, fleet:'Fleet') -> None:
+        self.fleet = fleet
+
+    # count at start of transmission, frame might get corrupted on the medium
+    def msg_preamble(self, msg:LoraMsg, t:Optional[float]=None) -> None:
+        if isinstance(msg.src, Radio):
+            dev = self.fleet.sim2dev[id(msg.src.sim)]
+            dev.stats.airtime += msg.airtime()
+            if (msg.pdu[0] & lm.MHdr.FTYPE) == lm.FrmType.JREQ:
+                dev.stats.jreq += 1
+                self.fleet.jreqtimes.append(msg.xend)
+            else:
+                dev.stats.up += 1
+
+
+class Fleet:
+    def __init__(self, count:int, hexfiles:List[str], *, context:Dict[str,Any]={},
+            medium:Optional[Medium]=None, stagger:float=10.0, seed:int=0, radius:float=0) -> None:
+        self.rnd = random.Random(seed)
+        self.medium = medium or SimpleMedium()
+        if isinstance(self.medium, CollisionMedium) and radius and self.medium.pathloss is None:
+            self.medium.pathloss = self.pathloss
+        self.runtime = Runtime()
+        self.runtime.setclock(LoopClock())
+        self.gateway = FleetGateway(self.runtime, self.medium)
+        self.sm = SessionManager()
+        self.lns = LNS()
+        self.lns.sm = self.sm
+        self.stagger = stagger
+        self.devs = [FleetDevice(i, hexfiles, self.medium, context) for i in range(count)]
+        for d in self.devs:
+            # uniform in a disc around the gateway at the origin
+            r = radius * math.sqrt(self.rnd.random())
+            a = self.rnd.uniform(0, 2 * math.pi)
+            d.pos = (r * math.cos(a), r * math.sin(a))
+        self.sim2dev = { id(d.sim): d for d in self.devs }
+        self.eui2dev = { d.deveui: d for d in self.devs }
+        self.jreqtimes:List[float] = []
+        self.errors = 0
+        self.medium.add_listener(FleetMonitor(self))
+
+    def nodepos(self, node:Any) -> Tuple[float,float]:
+        if isinstance(node, Radio):
+            return self.sim2dev[id(node.sim)].pos
+        return (0.0, 0.0)
+
+    # log-distance path loss (Bor et al., 2016: PL(40m)=127.41dB, n=2.08)
+    def pathloss(self, src:Any, dst:Any) -> float:
+        (x0, y0), (x1, y1) = self.nodepos(src), self.nodepos(dst)
+        d = max(math.hypot(x1 - x0, y1 - y0), 1.0)
+        return 127.41 + 10 * 2.08 * math.log10(d / 40)
+
+    def handle_jreq(self, m:LoraWanMsg) -> None:
+        deveui = rt.Eui(lm.unpack_jreq(m.msg.pdu)['DevEUI'])
+        dev = self.eui2dev.get(deveui.as_int())
+        pdevnonce = -1
+        for s in self.sm.get_by_eui(deveui):
+            pdevnonce = s['devnonce']
+            self.sm.remove(s)
+        jacc, session = LNS.join(m.msg.pdu, m.reg, pdevnonce=pdevnonce)
+        self.sm.add(session)
+        if dev is not None:
+            dev.stats.joined = None
+        (f, rps) = LNS.dn_rx1(session, m.msg.freq, m.msg.rps, join=True)
+        self.gateway.sched_dn(LoraMsg(m.msg.xend + ld.JaccRxDelay, jacc, f, rps, xpow=m.reg.max_eirp))
+
+    def handle_updf(self, m:LoraWanMsg) -> None:
+        devaddr, = struct.unpack_from('<i', m.msg.pdu, 1)
+        session, updf = self.lns.try_unpack(m.msg.pdu, devaddr)
+        session['fcntup'] = updf['FCnt']
+        dev = self.eui2dev.get(session['deveui'].as_int())
+        if dev is not None:
+            if dev.stats.joined is None:
+                dev.stats.joined = m.msg.xend
+            if updf['FCnt'] not in dev.stats.fcnts:
+                dev.stats.fcnts.add(updf['FCnt'])
+                dev.stats.up_rx += 1
+
+    async def network(self) -> None:
+        while True:
+            for m in await self.gateway.next_ups():
+                try:
+                    if (m.msg.pdu[0] & lm.MHdr.FTYPE) == lm.FrmType.JREQ:
+                        self.handle_jreq(m)
+                    else:
+                        self.handle_updf(m)
+                except (ValueError, lm.VerifyError, struct.error):
+                    self.errors += 1
+
+    async def run(self, duration:float) -> None:
+        tasks = [asyncio.create_task(self.network())]
+        for d in self.devs:
+            d.task = asyncio.create_task(d.run(self.rnd.uniform(0, self.stagger)))
+            tasks.append(d.task)
+        await asyncio.sleep(duration)
+        for t in tasks:
+            t.cancel()
+        await asyncio.gather(*tasks, return_exceptions=True)
+
+    # maximum number of join requests within any window of given length
+    def jreq_peak(self, window:float) -> int:
+        ts = sorted(self.jreqtimes)
+        peak = 0
+        j = 0
+        for i, t in enumerate(ts):
+            while ts[j] < t - window:
+                j += 1
+            peak = max(peak, i - j + 1)
+        return peak
+
+    def report(self, duration:float) -> Dict[str,Any]:
+        st = [d.stats for d in self.devs]
+        up = sum(s.up for s in st)
+        up_rx = sum(s.up_rx for s in st)
+        airtime = sum(s.airtime for s in st)
+        joined = [s.joined for s in st if s.joined is not None]
+        m = self.medium
+        return {
+                'devices'       : len(st),
+                'duration'      : duration,
+                'joined'        : len(joined),
+                'jreq'          : sum(s.jreq for s in st),
+                'jreq_peak_10s' : self.jreq_peak(10),
+                'join_time_max' : max(joined) if joined else None,
+                'up'            : up,
+                'up_rx'         : up_rx,
+                'pdr'           : (up_rx / up) if up else None,
+                'airtime'       : airtime,
+                'duty_avg'      : airtime / (len(st) * duration) if st else 0,
+                'dn_tx'         : self.gateway.dn_tx,
+                'dn_dropped'    : self.gateway.dn_dropped,
+                'errors'        : self.errors,
+                'corrupted'     : m.corrupted if isinstance(m, CollisionMedium) else None,
+                }
+
+
+def main() -> None:
+    p = argparse.ArgumentParser(description='Fleet simulation')
+    p.add_argument('-n', '--count', type=int, default=100, help='number of devices')
+    p.add_argument('-t', '--time', type=float, default=3600, help='simulated time (seconds)')
+    p.add_argument('--stagger', type=float, default=10, help='spread of device start times (seconds)')
+    p.add_argument('--seed', type=int, default=0, help='random seed')
+    p.add_argument('--collisions', action='store_true', help='use interference model')
+    p.add_argument('--radius', type=float, default=0,
+            help='place devices within radius around gateway (meters, requires --collisions)')
+    p.add_argument('hexfiles', nargs='*', help='firmware hex files (default: $TEST_HEXFILES)')
+    args = p.parse_args()
+
+    hexfiles = args.hexfiles or shlex.split(os.environ.get('TEST_HEXFILES', ''))
+
+    async def run() -> Dict[str,Any]:
+        medium = CollisionMedium() if args.collisions else None
+        fleet = Fleet(args.count, hexfiles, medium=medium, stagger=args.stagger, seed=args.seed,
+                radius=args.radius)
+        await fleet.run(args.time)
+        return fleet.report(args.time)
+
+    loop = VirtualTimeLoop()
+    asyncio.set_event_loop(loop)
+    for k, v in loop.run_until_complete(run()).items():
+        print(f'{k:14s} {v:.6g}' if isinstance(v, float) else f'{k:14s} {v}')
+
+if __name__ == '__main__':
+    main()
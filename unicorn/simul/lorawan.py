@@ -72,13 +72,23 @@ class UniversalGateway(LoraMsgProcessor, Gateway):
         self.upframes:asyncio.Queue[LoraMsg] = asyncio.Queue()
         self.xmtr = LoraMsgTransmitter(runtime, medium)
 
+        # per region: frequency -> [(channel index, channel)], and rps -> DR
+        self.chidx:List[Dict[int,List[Tuple[int,Any]]]] = []
+        for r in regions:
+            d:Dict[int,List[Tuple[int,Any]]] = {}
+            for (idx, ch) in enumerate(r.upchannels):
+                d.setdefault(ch.freq, []).append((idx, ch))
+            self.chidx.append(d)
+        self.drcache:List[Dict[int,int]] = [{} for _ in regions]
+
         medium.add_listener(self)
 
     def msg_complete(self, msg:LoraMsg) -> None:
         if msg.src is not self and not Rps.isIqInv(msg.rps):
             assert msg.xpow is not None
-            msg.rssi = msg.xpow - 50
-            msg.snr = 10
+            if msg.rssi is None:
+                msg.rssi = msg.xpow - 50
+                msg.snr = 10
             self.upframes.put_nowait(msg)
 
     async def next_up(self) -> LoraWanMsg:
@@ -86,15 +96,23 @@ class UniversalGateway(LoraMsgProcessor, Gateway):
         reg, ch, dr = self.getupparams(msg)
         return LoraWanMsg(msg, reg, ch, dr)
 
+    # wait for at least one uplink, then return all queued uplinks
+    async def next_ups(self) -> List[LoraWanMsg]:
+        msgs = [await self.upframes.get()]
+        while not self.upframes.empty():
+            msgs.append(self.upframes.get_nowait())
+        return [LoraWanMsg(m, *self.getupparams(m)) for m in msgs]
+
     def sched_dn(self, msg:LoraMsg) -> None:
         msg.src = self
         self.xmtr.transmit(msg)
 
     def getupparams(self, msg:LoraMsg) -> Tuple[ld.Region,int,int]:
-        for r in self.regions:
-            dr = r.to_dr(*Rps.getSfBw(msg.rps)).dr
-            for (idx, ch) in enumerate(r.upchannels):
-                if msg.freq == ch.freq and dr >= ch.minDR and dr <= ch.maxDR:
+        for (r, chidx, drcache) in zip(self.regions, self.chidx, self.drcache):
+            if (dr := drcache.get(msg.rps)) is None:
+                dr = drcache[msg.rps] = r.to_dr(*Rps.getSfBw(msg.rps)).dr
+            for (idx, ch) in chidx.get(msg.freq, ()):
+                if dr >= ch.minDR and dr <= ch.maxDR:
                     return (r, idx, dr)
         raise ValueError(f'Channel not defined in regions {", ".join(r.name for r in self.regions)}: '
                 f'{msg.freq/1e6:.6f}MHz/{Rps.sfbwstr(msg.rps)}')
@@ -208,7 +226,12 @@ class LNS:
                 }
 
     def try_unpack(self, pdu:bytes, devaddr:int) -> Tuple[Session,rt.types.Msg]:
-        for s in self.sm.get_by_addr(devaddr):
+        sessions = self.sm.get_by_addr(devaddr)
+        if len(sessions) > 1:
+            # try sessions with the closest frame counter first
+            fcnt, = struct.unpack_from('<H', pdu, 6)
+            sessions.sort(key=lambda s: (fcnt - s['fcntup']) & 0xffff)
+        for s in sessions:
             try:
                 return s, lm.unpack_dataframe(pdu, s['fcntup'], s['nwkskey'], s['appskey'])
             except lm.VerifyError:
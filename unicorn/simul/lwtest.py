@@ -45,6 +45,14 @@ class LWTest(DeviceTest):
     def request_rejoin(self, uplwm:LoraWanMsg, **kwargs:Any) -> None:
         self.dndf(uplwm, port=224, payload=b'\x06', **kwargs)
 
+    # vendor command: report and reset timing statistics
+    def request_timing(self, uplwm:LoraWanMsg, **kwargs:Any) -> None:
+        self.dndf(uplwm, port=224, payload=b'\x80', **kwargs)
+
+    # vendor command: switch to class C (unilaterally) or back to class A
+    def request_classc(self, uplwm:LoraWanMsg, enabled:bool=True, **kwargs:Any) -> None:
+        self.dndf(uplwm, port=224, payload=bytes([0x81, int(enabled)]), **kwargs)
+
     @staticmethod
     def unpack_dnctr(lwm:LoraWanMsg, *, expected:Optional[int]=None, **kwargs:Any) -> int:
         assert lwm.rtm is not None
@@ -68,6 +76,17 @@ class LWTest(DeviceTest):
             expect.assert_equal(expected, echo, explain('Unexpected echo response', **kwargs))
         return echo
 
+    # return TX start delay from uplink schedule and job lateness (seconds,
+    # lateness is None if the firmware does not keep job statistics)
+    @staticmethod
+    def unpack_timing(lwm:LoraWanMsg, **kwargs:Any) -> Tuple[float,Optional[float]]:
+        assert lwm.rtm is not None
+        payload:bytes = lwm.rtm['FRMPayload'];
+        if len(payload) != 9 or payload[0] != 0x80:
+            raise ValueError(explain(f'invalid timing report: {payload.hex()}', **kwargs))
+        txlate, joblate = cast(Tuple[int,int], struct.unpack('>II', payload[1:]))
+        return (txlate * 1e-6, None if joblate == 0xffffffff else joblate * 1e-6)
+
     async def test_updf(self, **kwargs:Any) -> LoraWanMsg:
         kwargs.setdefault('timeout', 60)
         return await self.updf(port=224, **kwargs)
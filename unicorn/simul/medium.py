@@ -4,7 +4,7 @@
 # This file is subject to the terms and conditions defined in file 'LICENSE',
 # which is part of this source code package.
 
-from typing import Any, Callable, Optional, Set, Tuple
+from typing import Any, Callable, Dict, List, Optional, Set, Tuple
 
 import asyncio
 import math
@@ -194,26 +194,131 @@ class SimpleMedium(Medium):
         if self.evhub:
             self.evhub.event(EventHub.LORA, src=self, msg=msg)
         self.pmsg.add(msg)
-        for l in self.listeners:
+        for l in list(self.listeners):
             l.msg_preamble(msg)
 
     def msg_payload(self, msg:LoraMsg) -> None:
         self.pmsg.discard(msg)
-        for l in self.listeners:
+        for l in list(self.listeners):
             l.msg_payload(msg)
 
     def msg_complete(self, msg:LoraMsg) -> None:
-        for l in self.listeners:
+        for l in list(self.listeners):
             l.msg_complete(msg)
 
     def msg_abort(self, msg:LoraMsg) -> None:
         self.pmsg.discard(msg)
-        for l in self.listeners:
+        for l in list(self.listeners):
             l.msg_abort(msg)
 
 
+# Link budget for a message at a listener; nodes are the message source and
+# the listener (or its 'src' attribute, e.g. the Radio owning a receiver).
+PathLossFn = Callable[[Any, Any], float]
+
+class CollisionMedium(SimpleMedium):
+    """Medium with interference model.
+
+    Transmissions are kept in a per-frequency index while they can still
+    overlap with others. When a frame completes, each listener's received
+    power of the frame and of every overlapping transmission on the same
+    channel is computed from the path loss. The frame is corrupted for that
+    listener if:
+
+    - it is below the demodulator sensitivity, or
+    - any same-SF interferer is not at least CAPTURE_DB weaker, or
+    - any different-SF interferer is more than SFREJ_DB stronger
+      (quasi-orthogonality).
+
+    Corrupted frames are reported to the listener via msg_abort() instead of
+    msg_complete().
+    """
+    CAPTURE_DB = 6.0
+    SFREJ_DB = 16.0
+    NOISEFIG_DB = 6.0
+    SENSITIVITY = { 0: -117.0, 7: -123.0, 8: -126.0, 9: -129.0, 10: -132.0, 11: -134.5, 12: -137.0 }
+
+    def __init__(self, evhub:Optional[EventHub]=None, *, pathloss:Optional[PathLossFn]=None) -> None:
+        super().__init__(evhub)
+        self.pathloss = pathloss
+        self.active:Dict[int,List[LoraMsg]] = {}
+        self.inflight:Set[LoraMsg] = set()
+        self.delivered = 0
+        self.corrupted = 0
+
+    @staticmethod
+    def node(obj:Any) -> Any:
+        return getattr(obj, 'src', None) or obj
+
+    def rxpow(self, msg:LoraMsg, listener:Any) -> float:
+        xpow = msg.xpow if msg.xpow is not None else 14
+        if self.pathloss is None:
+            return xpow
+        return xpow - self.pathloss(msg.src, self.node(listener))
+
+    def sensitivity(self, msg:LoraMsg) -> float:
+        sf, bw = Rps.getSfBw(msg.rps)
+        return CollisionMedium.SENSITIVITY[sf] + 10 * math.log10(max(bw, 125000) / 125000)
+
+    def noisefloor(self, msg:LoraMsg) -> float:
+        bw = Rps.getBw(msg.rps) if not Rps.isFSK(msg.rps) else 125000
+        return -174 + 10 * math.log10(bw) + CollisionMedium.NOISEFIG_DB
+
+    def survives(self, msg:LoraMsg, listener:Any) -> Tuple[bool,float]:
+        p = self.rxpow(msg, listener)
+        if self.pathloss is not None and p < self.sensitivity(msg):
+            return False, p
+        sf = Rps.getSf(msg.rps)
+        for other in self.active.get(msg.freq, []):
+            if other is msg or other.src is self.node(listener):
+                continue
+            if other.xbeg >= msg.xend or other.xend <= msg.xbeg:
+                continue
+            q = self.rxpow(other, listener)
+            if Rps.getSf(other.rps) == sf:
+                if p - q < CollisionMedium.CAPTURE_DB:
+                    return False, p
+            elif q - p > CollisionMedium.SFREJ_DB:
+                return False, p
+        return True, p
+
+    def prune(self) -> None:
+        tmin = min((m.xbeg for m in self.inflight), default=math.inf)
+        for f in list(self.active):
+            l = [m for m in self.active[f] if m in self.inflight or m.xend > tmin]
+            if l:
+                self.active[f] = l
+            else:
+                del self.active[f]
+
+    def msg_preamble(self, msg:LoraMsg, t:Optional[float]=None) -> None:
+        self.active.setdefault(msg.freq, []).append(msg)
+        self.inflight.add(msg)
+        super().msg_preamble(msg, t)
+
+    def msg_complete(self, msg:LoraMsg) -> None:
+        for l in list(self.listeners):
+            ok, p = self.survives(msg, l)
+            if ok:
+                msg.rssi = p
+                msg.snr = p - self.noisefloor(msg)
+                self.delivered += 1
+                l.msg_complete(msg)
+            else:
+                self.corrupted += 1
+                l.msg_abort(msg)
+        self.inflight.discard(msg)
+        self.prune()
+
+    def msg_abort(self, msg:LoraMsg) -> None:
+        self.inflight.discard(msg)
+        super().msg_abort(msg)
+        self.prune()
+
+
 TxDoneCb = Callable[['LoraMsg'], None]
 RxDoneCb = Callable[[Optional['LoraMsg']], None]
+CadDoneCb = Callable[[], None]
 
 class LoraMsgTransmitter():
     def __init__(self, runtime:Runtime, medium:Medium, *, cb:Optional[TxDoneCb]=None) -> None:
@@ -245,15 +350,25 @@ class LoraMsgTransmitter():
         self.msg = None
 
 class LoraMsgReceiver(LoraMsgProcessor):
-    def __init__(self, runtime:Runtime, medium:Medium, *, cb:Optional[RxDoneCb]=None, symdetect:int=5) -> None:
+    def __init__(self, runtime:Runtime, medium:Medium, *, cb:Optional[RxDoneCb]=None, symdetect:int=5,
+            src:Optional[Any]=None, cadcb:Optional[CadDoneCb]=None) -> None:
         self.jobs = JobGroup(runtime)
         self.medium = medium
         self.cb = cb
+        self.cadcb = cadcb
+        self.src = src
         self.symdetect = symdetect
         self.msg:Optional[LoraMsg] = None
         self.locked = False
-
-    def receive(self, rxtime:float, freq:int, rps:int, *, minsyms:int=5) -> None:
+        self.listening = False
+
+    # Open receive window at rxtime; with continuous=True the receiver has no
+    # symbol timeout and listens until a frame is received or stop() is called.
+    # With cad>0 the window starts with a channel activity detection of cad
+    # symbols: if no preamble is on the air by then, cadcb is invoked (or cb
+    # with None), otherwise the receiver continues for minsyms symbols.
+    def receive(self, rxtime:float, freq:int, rps:int, *, minsyms:int=5, continuous:bool=False,
+            cad:int=0) -> None:
         if Rps.isFSK(rps):
             rps = 0
 
@@ -261,6 +376,8 @@ class LoraMsgReceiver(LoraMsgProcessor):
         self.rps = rps
         self.minsyms = minsyms
         self.rxtime = rxtime
+        self.continuous = continuous
+        self.cad = cad
 
         self.msg = None
         self.locked = False
@@ -269,11 +386,40 @@ class LoraMsgReceiver(LoraMsgProcessor):
 
     def rxstart(self) -> None:
         self.medium.add_listener(self, self.rxtime)
-        self.jobs.schedule('timeout', self.rxtime + LoraMsg.symtime(self.rps, nsym=self.minsyms), self.timeout)
+        self.listening = True
+        if self.cad:
+            self.jobs.schedule('timeout', self.rxtime + LoraMsg.symtime(self.rps, nsym=self.cad), self.caddone)
+        elif not self.continuous:
+            self.jobs.schedule('timeout', self.rxtime + LoraMsg.symtime(self.rps, nsym=self.minsyms), self.timeout)
+
+    def caddone(self) -> None:
+        if self.msg is None:
+            self.done()
+            if self.cadcb:
+                self.cadcb()
+            elif self.cb:
+                self.cb(None)
+        else:
+            # preamble detected (not locked yet, see msg_lock)
+            self.jobs.schedule('timeout', self.rxtime + LoraMsg.symtime(self.rps, nsym=self.cad + self.minsyms),
+                    self.timeout)
+
+    def done(self) -> None:
+        if self.listening:
+            self.medium.remove_listener(self)
+            self.listening = False
+        self.jobs.cancel_all()
+
+    # Abort reception without callback, returns True if the receiver was active
+    def stop(self) -> bool:
+        active = self.listening or bool(self.jobs.job2name)
+        self.done()
+        self.msg = None
+        self.locked = False
+        return active
 
     def timeout(self) -> None:
-        self.medium.remove_listener(self)
-        self.jobs.cancel_all()
+        self.done()
         if self.cb:
             self.cb(None)
 
@@ -295,5 +441,17 @@ class LoraMsgReceiver(LoraMsgProcessor):
 
     def msg_complete(self, msg:LoraMsg) -> None:
         if msg == self.msg and self.locked:
+            self.done()
             if self.cb:
                 self.cb(self.msg)
+
+    def msg_abort(self, msg:LoraMsg) -> None:
+        if msg == self.msg:
+            if self.locked:
+                # corrupted frame, report as failed reception
+                self.done()
+                if self.cb:
+                    self.cb(None)
+            else:
+                self.jobs.cancel('lock')
+                self.msg = None
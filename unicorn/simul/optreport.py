@@ -0,0 +1,97 @@
+# Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+#
+# This file is subject to the terms and conditions defined in file 'LICENSE',
+# which is part of this source code package.
+
+# Size/speed comparison of firmware builds (e.g. -Os vs. LTO with -O2 hot
+# files). Flash and RAM usage is taken from the ELF section headers; the
+# instruction count per scenario is taken from the profiler report
+# (SIM_PROFILE) written to profile.txt next to each ELF file.
+#
+# Usage: python3 optreport.py [--top N] ELFFILE ELFFILE...
+
+from typing import Dict, List, Tuple
+
+import argparse
+import os
+import re
+import struct
+
+
+SHF_WRITE = 0x1
+SHF_ALLOC = 0x2
+SHT_NOBITS = 8
+
+def elf_sizes(fn:str) -> Dict[str,int]:
+    with open(fn, 'rb') as f:
+        elf = f.read()
+    if elf[:4] != b'\x7fELF' or elf[4] != 1:
+        raise ValueError(f'{fn}: not an ELF32 file')
+    shoff, = struct.unpack_from('<I', elf, 0x20)
+    shentsize, shnum = struct.unpack_from('<HH', elf, 0x2e)
+    res = { 'text': 0, 'data': 0, 'bss': 0 }
+    for i in range(shnum):
+        _, shtype, flags, _, _, size = struct.unpack_from('<6I', elf, shoff + i * shentsize)
+        if not (flags & SHF_ALLOC):
+            continue
+        if shtype == SHT_NOBITS:
+            res['bss'] += size
+        elif flags & SHF_WRITE:
+            res['data'] += size
+        else:
+            res['text'] += size
+    res['flash'] = res['text'] + res['data']
+    res['ram'] = res['data'] + res['bss']
+    return res
+
+# profiler report (possibly appended by several tests):
+# scenario -> (total, function -> self)
+def read_profile(fn:str) -> Dict[str,Tuple[int,Dict[str,int]]]:
+    res:Dict[str,Tuple[int,Dict[str,int]]] = {}
+    scn = None
+    with open(fn) as f:
+        for line in f:
+            if (m := re.match(r'scenario (\S+): (\d+) instructions', line)):
+                scn = m.group(1)
+                total, funcs = res.get(scn, (0, {}))
+                res[scn] = (total + int(m.group(2)), funcs)
+            elif scn and (m := re.match(r'\s+(\d+)\s+(\d+)\s+(\S+)$', line)):
+                funcs = res[scn][1]
+                funcs[m.group(3)] = funcs.get(m.group(3), 0) + int(m.group(1))
+    return res
+
+def delta(a:int, b:int) -> str:
+    return f'{(b - a) * 100 / a:+6.1f}%' if a else '     -'
+
+def main() -> None:
+    p = argparse.ArgumentParser(description='Firmware size/speed comparison')
+    p.add_argument('--top', type=int, default=10, help='number of functions to list per scenario')
+    p.add_argument('elffiles', nargs='+', help='firmware ELF files (first is the baseline)')
+    args = p.parse_args()
+
+    names = [os.path.basename(os.path.dirname(os.path.abspath(fn))) or fn for fn in args.elffiles]
+    sizes = [elf_sizes(fn) for fn in args.elffiles]
+    profiles = []
+    for fn in args.elffiles:
+        pf = os.path.join(os.path.dirname(fn), 'profile.txt')
+        profiles.append(read_profile(pf) if os.path.exists(pf) else {})
+
+    w = max(12, *(len(n) for n in names))
+    print(f'{"":16s}' + ''.join(f' {n:>{w}s}' for n in names))
+    for k in ('text', 'data', 'bss', 'flash', 'ram'):
+        print(f'{k:16s}' + ''.join(f' {s[k]:{w}d}' for s in sizes)
+                + ''.join(f' {delta(sizes[0][k], s[k])}' for s in sizes[1:]))
+
+    base = profiles[0]
+    for scn in base:
+        print(f'{scn:16s}' + ''.join(f' {pr.get(scn, (0, {}))[0]:{w}d}' for pr in profiles)
+                + ''.join(f' {delta(base[scn][0], pr.get(scn, (0, {}))[0])}' for pr in profiles[1:]))
+
+    for scn, (_, funcs) in base.items():
+        print(f'\nscenario {scn}: instructions (self)')
+        for fn, n in sorted(funcs.items(), key=lambda x: x[1], reverse=True)[:args.top]:
+            others = [pr.get(scn, (0, {}))[1].get(fn, 0) for pr in profiles[1:]]
+            print(f'  {fn:30.30s} {n:10d}' + ''.join(f' {o:10d} {delta(n, o)}' for o in others))
+
+if __name__ == '__main__':
+    main()
@@ -3,7 +3,7 @@
 # This file is subject to the terms and conditions defined in file 'LICENSE',
 # which is part of this source code package.
 
-from typing import Any, List, Optional, Set
+from typing import Any, Dict, List, Optional, Set
 
 import asyncio
 import ctypes
@@ -14,6 +14,7 @@ from uuid import UUID
 from device import IrqHandler, Peripheral, Peripherals, Simulation
 from medium import LoraMsg, LoraMsgReceiver, LoraMsgTransmitter, Medium
 from runtime import Clock, Job, Runtime
+from vtimeloop import VirtualTimeLoop
 
 
 # -----------------------------------------------------------------------------
@@ -27,6 +28,8 @@ class NVIC(Peripheral, IrqHandler):
     class NVICRegister(ctypes.LittleEndianStructure):
         _fields_ = [('vtor', ctypes.c_uint32 * 128), ('prio', ctypes.c_ubyte * 128)]
 
+    snapattrs = ('reqs', 'cprio')
+
     def init(self) -> None:
         self.reg = NVIC.NVICRegister()
         self.sim.map_peripheral(self.pid, self.reg)
@@ -40,7 +43,7 @@ class NVIC(Peripheral, IrqHandler):
 
     def handler(self) -> Optional[int]:
         assert bool(self.reqs)
-        pid = sorted(self.reqs, key=lambda x: self.reg.prio[x], reverse=True)[0]
+        pid = max(self.reqs, key=lambda x: self.reg.prio[x])
         prio = self.reg.prio[pid]
         if prio <= self.cprio[-1]:
             return None
@@ -78,7 +81,7 @@ class DebugUnit(Peripheral):
 
     def svc(self, fid:int) -> None:
         assert fid == 0
-        self.sim.log(bytes(self.reg.s[:self.reg.n]).decode('utf-8'))
+        self.sim.log(ctypes.string_at(self.reg.s, self.reg.n).decode('utf-8'))
 
 
 # -----------------------------------------------------------------------------
@@ -99,6 +102,7 @@ class Timer(Peripheral, Clock):
         self.reg = Timer.TimerRegister()
         self.sim.map_peripheral(self.pid, self.reg)
         self.sim.prerunhooks.append(self.update)
+        self.sim.wfihook = self.fastforward
         self.sim.runtime.setclock(self)
         self.th:Optional[asyncio.TimerHandle] = None
         self.update()
@@ -106,6 +110,18 @@ class Timer(Peripheral, Clock):
     def update(self) -> None:
         self.reg.ticks = self.time2ticks(asyncio.get_running_loop().time())
 
+    def snapshot(self) -> Dict[str,Any]:
+        state = super().snapshot()
+        state['armed'] = self.th is not None and not self.th.cancelled()
+        return state
+
+    # continue tick count from snapshot at current time, re-arm alarm
+    def restore(self, state:Dict[str,Any]) -> None:
+        super().restore(state)
+        self.epoch = asyncio.get_running_loop().time() - (self.reg.ticks / Timer.TICKS_PER_SEC)
+        if state['armed']:
+            self.svc(0)
+
     def time(self, update:bool=False) -> float:
         return self.ticks2time(self.ticks(update))
 
@@ -131,6 +147,15 @@ class Timer(Peripheral, Clock):
     def alarm(self) -> None:
         self.sim.running.set()
 
+    # skip to the alarm if no other event is due before it
+    def fastforward(self) -> bool:
+        loop = asyncio.get_running_loop()
+        if self.th is None or not isinstance(loop, VirtualTimeLoop) or not loop.advance(self.th):
+            return False
+        self.th = None
+        self.update()
+        return True
+
     def svc(self, fid:int) -> None:
         assert fid == 0
         self.cancel()
@@ -149,6 +174,8 @@ class GPIO(Peripheral):
     class GPIORegister(ctypes.LittleEndianStructure):
         _fields_ = [(r, ctypes.c_uint32) for r in ('value', 'outm', 'outv', 'pdn', 'pup', 'rise', 'fall', 'irq')]
 
+    snapattrs = ('inpm', 'inpv', 'epup', 'epdn')
+
     def init(self) -> None:
         self.reg = GPIO.GPIORegister()
         self.sim.map_peripheral(self.pid, self.reg)
@@ -239,28 +266,39 @@ class FastUART(Peripheral):
     def init(self) -> None:
         self.reg = FastUART.FastUARTRegister()
         self.sim.map_peripheral(self.pid, self.reg)
+        self.svctab = { fid: f.__get__(self) for fid, f in FastUART.svc_lookup.items() }
         self.event = asyncio.Event()
+        self.txdata = bytearray()
+        self.rxpend = False
 
-    # receive from device
+    # receive from device (all data sent since last call)
     async def recv(self, *, timeout:Optional[float]=None) -> Optional[bytes]:
-        self.event.clear()
-        try:
-            await asyncio.wait_for(self.event.wait(), timeout=timeout)
-        except asyncio.TimeoutError:
-            return None
-        return bytes(self.reg.txbuf[:self.reg.txlen])
-
-    # send to device
+        if not self.txdata:
+            self.event.clear()
+            try:
+                await asyncio.wait_for(self.event.wait(), timeout=timeout)
+            except asyncio.TimeoutError:
+                return None
+        data = bytes(self.txdata)
+        self.txdata.clear()
+        return data
+
+    # send to device (appended if previous data has not been picked up yet)
     def send(self, data:bytes) -> None:
         if self.reg.ctrl & FastUART.C_RXEN:
-            self.reg.rxbuf[:len(data)] = data
-            self.reg.rxlen = len(data)
+            off = self.reg.rxlen if self.rxpend else 0
+            data = data[:len(self.reg.rxbuf) - off]
+            ctypes.memmove(ctypes.addressof(self.reg.rxbuf) + off, data, len(data))
+            self.reg.rxlen = off + len(data)
+            self.rxpend = True
             self.sim.irqhandler.set(self.pid)
 
     def svc_send(self) -> None:
+        self.txdata += ctypes.string_at(self.reg.txbuf, self.reg.txlen)
         self.event.set()
 
     def svc_clearirq(self) -> None:
+        self.rxpend = False
         self.sim.irqhandler.clear(self.pid)
 
     svc_lookup = {
@@ -269,7 +307,7 @@ class FastUART(Peripheral):
             }
 
     def svc(self, fid:int) -> None:
-        FastUART.svc_lookup[fid](self)
+        self.svctab[fid]()
 
 
 # -----------------------------------------------------------------------------
@@ -284,6 +322,9 @@ class Radio(Peripheral):
     S_TXDONE = 2
     S_RXDONE = 3
     S_RXTOUT = 4
+    S_CADDONE = 5
+
+    CAD_SYMS = 2        # duration of channel activity detection
 
     @Peripherals.register
     class RadioRegister(ctypes.LittleEndianStructure):
@@ -293,8 +334,14 @@ class Radio(Peripheral):
         self.reg = Radio.RadioRegister()
         self.sim.map_peripheral(self.pid, self.reg)
         self.medium:Medium = self.sim.context.get('medium', Medium())
-        self.rcvr = LoraMsgReceiver(self.sim.runtime, self.medium, cb=self.rxdone)
+        self.rcvr = LoraMsgReceiver(self.sim.runtime, self.medium, cb=self.rxdone, src=self, cadcb=self.caddone)
         self.xmtr = LoraMsgTransmitter(self.sim.runtime, self.medium, cb=self.txdone)
+        self.svctab = { fid: f.__get__(self) for fid, f in Radio.svc_lookup.items() }
+        self.rxbeg = 0.0
+
+    def idle(self) -> bool:
+        return (self.xmtr.msg is None and not self.rcvr.jobs.job2name
+                and self.rcvr not in getattr(self.medium, 'listeners', ()))
 
     def txdone(self, msg:LoraMsg) -> None:
         self.reg.status = Radio.S_TXDONE
@@ -302,17 +349,27 @@ class Radio(Peripheral):
         self.sim.irqhandler.set(self.pid)
 
     def rxdone(self, msg:Optional[LoraMsg]) -> None:
+        if self.sim.energy:
+            self.sim.energy.radio_rx(max(0, asyncio.get_running_loop().time() - self.rxbeg))
+        if self.sim.rxbench:
+            self.sim.rxbench.rx_done(msg)
         if msg:
             self.reg.status = Radio.S_RXDONE
             self.reg.xtime = self.sim.runtime.clock.time2ticks(msg.xend)
-            self.reg.buf[:len(msg.pdu)] = msg.pdu
+            ctypes.memmove(self.reg.buf, msg.pdu, len(msg.pdu))
             self.reg.plen = len(msg.pdu)
-            pass
         else:
             self.reg.status = Radio.S_RXTOUT
             self.reg.xtime = self.sim.runtime.clock.ticks(update=True)
         self.sim.irqhandler.set(self.pid)
 
+    def caddone(self) -> None:
+        if self.sim.energy:
+            self.sim.energy.radio_rx(max(0, asyncio.get_running_loop().time() - self.rxbeg))
+        self.reg.status = Radio.S_CADDONE
+        self.reg.xtime = self.sim.runtime.clock.ticks(update=True)
+        self.sim.irqhandler.set(self.pid)
+
     def svc_reset(self) -> None:
         pass
 
@@ -321,12 +378,44 @@ class Radio(Peripheral):
 
     def svc_rx(self) -> None:
         t = self.sim.runtime.clock.ticks2time(self.reg.xtime)
+        self.rxbeg = max(t, asyncio.get_running_loop().time())
+        if self.sim.timing:
+            self.sim.timing.rx_open(self.rxbeg, self.reg.freq, self.reg.rps, self.reg.npreamble)
+        if self.sim.rxbench:
+            self.sim.rxbench.rx_open(self.rxbeg, self.reg.freq, self.reg.rps, False)
         self.rcvr.receive(t, self.reg.freq, self.reg.rps, minsyms=self.reg.npreamble)
 
+    # continuous reception (no symbol timeout, until frame or sleep)
+    def svc_rxon(self) -> None:
+        self.rxbeg = asyncio.get_running_loop().time()
+        if self.sim.rxbench:
+            self.sim.rxbench.rx_open(self.rxbeg, self.reg.freq, self.reg.rps, True)
+        self.rcvr.receive(self.rxbeg, self.reg.freq, self.reg.rps, continuous=True)
+
+    # channel activity detection now, followed by reception (symbol timeout
+    # npreamble) if a preamble is on the air
+    def svc_cad(self) -> None:
+        self.rxbeg = asyncio.get_running_loop().time()
+        self.rcvr.receive(self.rxbeg, self.reg.freq, self.reg.rps, minsyms=self.reg.npreamble,
+                cad=Radio.CAD_SYMS)
+
+    def svc_sleep(self) -> None:
+        if self.rcvr.stop():
+            if self.sim.energy:
+                self.sim.energy.radio_rx(max(0, asyncio.get_running_loop().time() - self.rxbeg))
+            if self.sim.rxbench:
+                self.sim.rxbench.rx_stop()
+
     def svc_tx(self) -> None:
         now = self.sim.runtime.clock.time()
-        msg = LoraMsg(now, bytes(self.reg.buf[:self.reg.plen]), self.reg.freq, self.reg.rps,
+        msg = LoraMsg(now, ctypes.string_at(self.reg.buf, self.reg.plen), self.reg.freq, self.reg.rps,
                 xpow=self.reg.xpow, npreamble=self.reg.npreamble, src=self)
+        if self.sim.energy:
+            self.sim.energy.radio_tx(self.reg.xpow, msg.airtime())
+        if self.sim.timing:
+            self.sim.timing.tx_start(msg)
+        if self.sim.rxbench:
+            self.sim.rxbench.tx_start(msg)
         self.xmtr.transmit(msg)
 
     svc_lookup = {
@@ -334,7 +423,10 @@ class Radio(Peripheral):
             1: svc_tx,
             2: svc_rx,
             3: svc_clearirq,
+            4: svc_rxon,
+            5: svc_sleep,
+            6: svc_cad,
             }
 
     def svc(self, fid:int) -> None:
-        Radio.svc_lookup[fid](self)
+        self.svctab[fid]()
@@ -0,0 +1,126 @@
+# Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+#
+# This file is subject to the terms and conditions defined in file 'LICENSE',
+# which is part of this source code package.
+
+# Cycle-accounting profiler for firmware running in the simulator.
+#
+# A block hook attributes the (estimated) instruction count of every
+# executed basic block to the current call stack. The stack is tracked by
+# watching for blocks starting at function symbols (taken from the ELF
+# file next to each hex file) and unwinding when SP rises back to a frame's
+# entry value outside of that function. Counts are grouped by scenario,
+# e.g. 'join' or 'uplink', set by the test.
+#
+# Output: per-function self/total counts, and folded stacks for
+# flamegraph.pl ("scenario;outer;inner count").
+
+from typing import Dict, Iterator, List, Optional, TextIO, Tuple
+
+import bisect
+import contextlib
+import os
+import struct
+
+import unicorn as uc
+import unicorn.arm_const as uca
+
+from device import Simulation
+
+
+def elf_functions(fn:str) -> List[Tuple[int,int,str]]:
+    with open(fn, 'rb') as f:
+        elf = f.read()
+    if elf[:4] != b'\x7fELF' or elf[4] != 1:
+        raise ValueError(f'{fn}: not an ELF32 file')
+    shoff, = struct.unpack_from('<I', elf, 0x20)
+    shentsize, shnum = struct.unpack_from('<HH', elf, 0x2e)
+    shdrs = [struct.unpack_from('<10I', elf, shoff + i * shentsize) for i in range(shnum)]
+    funcs = []
+    for sh in shdrs:
+        if sh[1] != 2: # SHT_SYMTAB
+            continue
+        strtab = shdrs[sh[6]]
+        for off in range(sh[4], sh[4] + sh[5], 16):
+            name, value, size, info = struct.unpack_from('<IIIB', elf, off)
+            if (info & 0xf) == 2 and value: # STT_FUNC
+                end = elf.index(b'\0', strtab[4] + name)
+                funcs.append((value & ~1, size, elf[strtab[4] + name:end].decode()))
+    return sorted(set(funcs))
+
+
+class Profiler:
+    def __init__(self, sim:Simulation, hexfiles:List[str]) -> None:
+        self.sim = sim
+        funcs:List[Tuple[int,int,str]] = []
+        for hf in hexfiles:
+            elf = os.path.splitext(hf)[0] + '.out'
+            if os.path.exists(elf):
+                funcs.extend(elf_functions(elf))
+        funcs.sort()
+        self.starts = [f[0] for f in funcs]
+        self.funcs = funcs
+        self.entry = { f[0]: i for i, f in enumerate(funcs) }
+
+        self.scn = 'init'
+        self.stack:List[Tuple[int,int]] = [] # (function index, SP at entry)
+        self.counts:Dict[Tuple[str,Tuple[int,...]],int] = {}
+        self.hook = sim.emu.hook_add(uc.UC_HOOK_BLOCK,
+                lambda emu, addr, size, prof: prof.block(addr, size), self,
+                begin=Simulation.FLASH_BASE, end=Simulation.PERIPH_BASE-1)
+
+    def close(self) -> None:
+        self.sim.emu.hook_del(self.hook)
+
+    def inside(self, fidx:int, addr:int) -> bool:
+        beg, size, _ = self.funcs[fidx]
+        return beg <= addr < beg + max(size, 2)
+
+    def block(self, addr:int, size:int) -> None:
+        sp = self.sim.emu.reg_read(uca.UC_ARM_REG_SP)
+        st = self.stack
+        while st and st[-1][1] <= sp and not self.inside(st[-1][0], addr):
+            st.pop()
+        if (fidx := self.entry.get(addr)) is not None:
+            st.append((fidx, sp))
+        elif not st:
+            # entered mid-function (reset vector, return to unknown caller)
+            i = bisect.bisect_right(self.starts, addr) - 1
+            if i >= 0 and self.inside(i, addr):
+                st.append((i, sp))
+        key = (self.scn, tuple(f for f, _ in st))
+        self.counts[key] = self.counts.get(key, 0) + size // 2
+
+    @contextlib.contextmanager
+    def scenario(self, name:str) -> Iterator[None]:
+        prev, self.scn = self.scn, name
+        try:
+            yield
+        finally:
+            self.scn = prev
+
+    def fname(self, fidx:int) -> str:
+        return self.funcs[fidx][2]
+
+    # per scenario: function -> (self, total)
+    def summary(self) -> Dict[str,Dict[str,Tuple[int,int]]]:
+        res:Dict[str,Dict[str,List[int]]] = {}
+        for (scn, stack), n in self.counts.items():
+            d = res.setdefault(scn, {})
+            names = [self.fname(i) for i in stack] or ['?']
+            d.setdefault(names[-1], [0, 0])[0] += n
+            for fn in set(names):
+                d.setdefault(fn, [0, 0])[1] += n
+        return { s: { f: (v[0], v[1]) for f, v in d.items() } for s, d in res.items() }
+
+    def report(self, out:TextIO, *, top:int=20) -> None:
+        for scn, d in self.summary().items():
+            total = sum(v[0] for v in d.values())
+            out.write(f'scenario {scn}: {total} instructions\n')
+            out.write(f'  {"self":>10s} {"total":>10s}  function\n')
+            for fn, (s, t) in sorted(d.items(), key=lambda x: x[1][0], reverse=True)[:top]:
+                out.write(f'  {s:10d} {t:10d}  {fn}\n')
+
+    def folded(self, out:TextIO) -> None:
+        for (scn, stack), n in sorted(self.counts.items()):
+            out.write(';'.join([scn] + [self.fname(i) for i in stack]) + f' {n}\n')
@@ -0,0 +1,230 @@
+# Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+#
+# This file is subject to the terms and conditions defined in file 'LICENSE',
+# which is part of this source code package.
+
+# Receive benchmark for the radio driver and the MAC receive path.
+#
+# RxTraffic injects gateway-style traffic into the medium: bursts of
+# back-to-back frames, preamble-only noise (a preamble that is never followed
+# by a payload, e.g. a collision or a frame at the edge of the range) and
+# pairs of near-simultaneous frames. Patterns are deterministic for a given
+# seed, so runs can be compared against a saved baseline.
+#
+# RxBench is notified by the Radio peripheral whenever the receiver is armed,
+# completes or is stopped, and checks for every injected frame whether it was
+# received. For each completion of a continuous reception the driver
+# turnaround (RxDone to receiver armed again) is measured in virtual time and
+# in instructions. Emulated code executes in zero virtual time, so the
+# instruction count is also converted to an estimated MCU time (using the
+# clock and CPI of energy.CurrentTable).
+#
+# Missed frames are classified by the receiver state at the latest time the
+# frame could have been detected (`symdetect` symbols before the end of the
+# preamble, see medium.LoraMsgReceiver):
+#
+#   tx   - the device was transmitting
+#   off  - the receiver was not armed on the frame's channel (turnaround)
+#   busy - the receiver was armed, but held by another frame
+
+from typing import Any, Callable, Dict, List, Optional, Tuple, Union
+
+import asyncio
+import json
+import random
+
+from dataclasses import dataclass
+
+import unicorn as uc
+
+from device import Simulation
+from energy import CurrentTable
+from medium import LoraMsg, Medium, Rps
+from runtime import JobGroup, Runtime
+
+
+@dataclass
+class BenchFrame:
+    msg:LoraMsg
+    noise:bool = False
+    received:bool = False
+
+
+class RxBench:
+    SYMDETECT = 5       # medium.LoraMsgReceiver default
+
+    def __init__(self, sim:Simulation, table:Optional[CurrentTable]=None) -> None:
+        self.sim = sim
+        self.table = table or CurrentTable()
+        self.icount = 0
+        self.hook = sim.emu.hook_add(uc.UC_HOOK_BLOCK,
+                lambda emu, addr, size, rb: rb.count(size), self,
+                begin=Simulation.FLASH_BASE, end=Simulation.PERIPH_BASE-1)
+        self.armed:Optional[Tuple[float,int,int,bool]] = None
+        self.rxdone:Optional[Tuple[float,int]] = None       # (time, icount) of last RxDone
+        self.clear()
+        sim.rxbench = self
+
+    # start new measurement (e.g. for the next traffic pattern)
+    def clear(self) -> None:
+        self.frames:Dict[int,BenchFrame] = {}
+        self.windows:List[Tuple[float,float,int,int]] = []   # (beg, end, freq, rps)
+        self.txs:List[Tuple[float,float]] = []
+        self.turnaround:List[float] = []                    # virtual time (s)
+        self.instrs:List[int] = []
+        self.nrx = 0
+        self.nerr = 0
+
+    def close(self) -> None:
+        self.sim.emu.hook_del(self.hook)
+        self.sim.rxbench = None
+
+    def count(self, size:int) -> None:
+        self.icount += size // 2
+
+    @staticmethod
+    def now() -> float:
+        return asyncio.get_running_loop().time()
+
+    def expect(self, msg:LoraMsg, noise:bool=False) -> None:
+        self.frames[id(msg)] = BenchFrame(msg, noise)
+
+    def window_end(self, t:float) -> Optional[bool]:
+        if self.armed is None:
+            return None
+        beg, freq, rps, continuous = self.armed
+        self.windows.append((beg, max(beg, t), freq, rps))
+        self.armed = None
+        return continuous
+
+    # -- Radio peripheral notifications
+
+    def rx_open(self, t:float, freq:int, rps:int, continuous:bool) -> None:
+        self.window_end(t)
+        self.armed = (t, freq, 0 if Rps.isFSK(rps) else rps, continuous)
+        if self.rxdone is not None:
+            t0, i0 = self.rxdone
+            self.turnaround.append(self.now() - t0)
+            self.instrs.append(self.icount - i0)
+            self.rxdone = None
+
+    def rx_done(self, msg:Optional[LoraMsg]) -> None:
+        now = self.now()
+        continuous = self.window_end(now)
+        if msg is None:
+            self.nerr += 1
+        else:
+            self.nrx += 1
+            if (f := self.frames.get(id(msg))) is not None:
+                f.received = True
+        # only re-arming after continuous reception is a driver turnaround
+        # (single windows are followed by the next uplink or window)
+        self.rxdone = (now, self.icount) if continuous else None
+
+    def rx_stop(self) -> None:
+        self.window_end(self.now())
+        self.rxdone = None
+
+    def tx_start(self, msg:LoraMsg) -> None:
+        self.txs.append((msg.xbeg, msg.xend))
+        self.rxdone = None
+
+    # -- evaluation
+
+    def classify(self, msg:LoraMsg) -> str:
+        if any(beg < msg.xend and end > msg.xbeg for beg, end in self.txs):
+            return 'tx'
+        td = msg.xpld - LoraMsg.symtime(msg.rps, nsym=RxBench.SYMDETECT)
+        windows = list(self.windows)
+        if self.armed is not None:
+            beg, freq, rps, _ = self.armed
+            windows.append((beg, self.now(), freq, rps))
+        for beg, end, freq, rps in windows:
+            if beg <= td < end and msg.match(freq, rps):
+                return 'busy'
+        return 'off'
+
+    def report(self) -> Dict[str,Union[int,float]]:
+        frames = [f for f in self.frames.values() if not f.noise]
+        missed = [self.classify(f.msg) for f in frames if not f.received]
+        est = [n * self.table.cpi / self.table.mcu_hz for n in self.instrs]
+        st:Dict[str,Union[int,float]] = {
+                'frames': len(frames),
+                'received': len(frames) - len(missed),
+                'missed': len(missed),
+                **{ f'miss_{c}': missed.count(c) for c in ('tx', 'off', 'busy') },
+                'noise': len(self.frames) - len(frames),
+                'rxdone': self.nrx,
+                'rxerr': self.nerr,
+                'rearm': len(self.instrs) }
+        if self.instrs:
+            st.update({
+                'instr_avg': sum(self.instrs) / len(self.instrs),
+                'instr_max': max(self.instrs),
+                'vt_max_us': max(self.turnaround) * 1e6,
+                'est_avg_us': sum(est) / len(est) * 1e6,
+                'est_max_us': max(est) * 1e6 })
+        return st
+
+    # append report as JSON line (baseline for comparison between runs)
+    def save(self, fn:str, name:str, **kwargs:Any) -> None:
+        with open(fn, 'a') as f:
+            f.write(json.dumps({ 'name': name, **kwargs, **self.report() }) + '\n')
+
+
+PduSource = Union[bytes, Callable[[], bytes]]
+
+class RxTraffic:
+    def __init__(self, runtime:Runtime, medium:Medium, bench:RxBench, *,
+            seed:int=0, src:Optional[Any]=None, xpow:float=14) -> None:
+        self.jobs = JobGroup(runtime)
+        self.medium = medium
+        self.bench = bench
+        self.rnd = random.Random(seed)
+        self.src = src          # sender (e.g. gateway, so frames are not taken for uplinks)
+        self.xpow = xpow
+
+    def pdu(self, pdu:Optional[PduSource]) -> bytes:
+        if pdu is None:
+            return bytes(self.rnd.getrandbits(8) for _ in range(self.rnd.randint(12, 32)))
+        return pdu() if callable(pdu) else pdu
+
+    # schedule single frame, preamble only if noise is set
+    def frame(self, t:float, freq:int, rps:int, pdu:Optional[PduSource]=None, *,
+            noise:bool=False) -> LoraMsg:
+        msg = LoraMsg(t, self.pdu(pdu), freq, rps, xpow=self.xpow, src=self.src)
+        self.bench.expect(msg, noise)
+        self.jobs.schedule(None, msg.xbeg, self.medium.msg_preamble, msg=msg)
+        if noise:
+            self.jobs.schedule(None, msg.xpld, self.medium.msg_abort, msg=msg)
+        else:
+            self.jobs.schedule(None, msg.xpld, self.medium.msg_payload, msg=msg)
+            self.jobs.schedule(None, msg.xend, self.medium.msg_complete, msg=msg)
+        return msg
+
+    # n frames, each starting gap seconds after the end of the previous one;
+    # returns end time of last frame
+    def back_to_back(self, t:float, n:int, freq:int, rps:int, pdu:Optional[PduSource]=None, *,
+            gap:float=0) -> float:
+        for _ in range(n):
+            t = self.frame(t, freq, rps, pdu).xend + gap
+        return t - gap
+
+    # n preambles without payload, each followed by a frame (if pdu is given)
+    # gap seconds after the aborted preamble
+    def preamble_noise(self, t:float, n:int, freq:int, rps:int, pdu:Optional[PduSource]=None, *,
+            gap:float=0, frames:bool=True) -> float:
+        for _ in range(n):
+            t = self.frame(t, freq, rps, noise=True).xpld + gap
+            if frames:
+                t = self.frame(t, freq, rps, pdu).xend + gap
+        return t - gap
+
+    # n pairs of frames whose start is at most dt apart (random offset)
+    def near_simultaneous(self, t:float, n:int, freq:int, rps:int, pdu:Optional[PduSource]=None, *,
+            dt:float, gap:float=0) -> float:
+        for _ in range(n):
+            m1 = self.frame(t, freq, rps, pdu)
+            m2 = self.frame(t + self.rnd.uniform(0, dt), freq, rps, pdu)
+            t = max(m1.xend, m2.xend) + gap
+        return t - gap
@@ -31,9 +31,12 @@ class Clock:
         return 0
 
 class Job:
-    def _prepare(self, ticks:int) -> None:
+    _runtime:Optional['Runtime'] = None
+
+    def _prepare(self, ticks:int, runtime:'Runtime') -> None:
         self._ticks = ticks
         self._cancelled = False
+        self._runtime = runtime
 
     def __lt__(self, other:Any) -> bool:
         if isinstance(other, Job):
@@ -41,7 +44,10 @@ class Job:
         return NotImplemented
 
     def cancel(self) -> None:
-        self._cancelled = True
+        if not self._cancelled:
+            self._cancelled = True
+            if self._runtime is not None:
+                self._runtime.ncancelled += 1
 
     def run(self) -> None:
         pass
@@ -57,17 +63,29 @@ class CallbacksJob(Job):
         for callback, kwargs in self.callbacks:
             callback(**kwargs)
 
+# Jobs are kept in a heap of (ticks, seq, job) entries, so ordering uses
+# native tuple comparison and is FIFO for equal times. Cancelled jobs stay
+# in the heap (lazy deletion) and are counted; the heap is compacted when
+# they make up more than half of it. A single loop handle is kept for the
+# earliest job and only moved when the head changes.
+
 class Runtime():
     dummyclock = Clock()
     def __init__(self) -> None:
         self.clock = Runtime.dummyclock
-        self.jobs:List[Job] = list()
+        self.jobs:List[Tuple[int,int,Job]] = list()
+        self.seq = 0
+        self.ncancelled = 0
         self.handle:Optional[asyncio.Handle] = None
+        self.hticks = 0
         self.stepping = False
 
     def reset(self) -> None:
         self.clock = Runtime.dummyclock
+        for _, _, j in self.jobs:
+            j._runtime = None
         self.jobs.clear()
+        self.ncancelled = 0
         if self.handle:
             self.handle.cancel()
             self.handle = None
@@ -80,20 +98,32 @@ class Runtime():
     def schedule(self, t:Union[int,float], job:Job) -> None:
         if isinstance(t, float):
             t = self.clock.time2ticks(t)
-        job._prepare(t)
-        heapq.heappush(self.jobs, job)
-        self.rewind()
+        job._prepare(t, self)
+        self.seq += 1
+        heapq.heappush(self.jobs, (t, self.seq, job))
+        if not self.stepping and (self.handle is None or t < self.hticks):
+            self.rewind()
 
     def prune(self) -> None:
-        while self.jobs and self.jobs[0]._cancelled:
-            heapq.heappop(self.jobs)
+        jobs = self.jobs
+        if self.ncancelled > 32 and 2 * self.ncancelled > len(jobs):
+            jobs[:] = [e for e in jobs if not e[2]._cancelled]
+            heapq.heapify(jobs)
+            self.ncancelled = 0
+        while jobs and jobs[0][2]._cancelled:
+            heapq.heappop(jobs)
+            self.ncancelled -= 1
 
     def step(self) -> None:
         now = self.clock.ticks(update=True)
+        jobs = self.jobs
         self.stepping = True
-        while self.jobs and (j := self.jobs[0])._ticks <= now:
-            heapq.heappop(self.jobs)
-            if not j._cancelled:
+        while jobs and jobs[0][0] <= now:
+            _, _, j = heapq.heappop(jobs)
+            if j._cancelled:
+                self.ncancelled -= 1
+            else:
+                j._runtime = None
                 j.run()
         self.stepping = False
         self.handle = None
@@ -102,13 +132,18 @@ class Runtime():
     def rewind(self) -> None:
         if self.stepping:
             return
-        if self.handle:
-            self.handle.cancel()
-            self.handle = None
         self.prune()
         if self.jobs:
-            t = self.clock.ticks2time(self.jobs[0]._ticks)
-            self.handle = asyncio.get_running_loop().call_at(t, self.step)
+            t = self.jobs[0][0]
+            if self.handle is not None and t == self.hticks:
+                return
+            if self.handle is not None:
+                self.handle.cancel()
+            self.hticks = t
+            self.handle = asyncio.get_running_loop().call_at(self.clock.ticks2time(t), self.step)
+        elif self.handle is not None:
+            self.handle.cancel()
+            self.handle = None
 
 class JobGroup:
     def __init__(self, runtime:Runtime) -> None:
@@ -0,0 +1,88 @@
+# Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+#
+# This file is subject to the terms and conditions defined in file 'LICENSE',
+# which is part of this source code package.
+
+# Sharded test runner: runs each test module in a separate ward process
+# (with its own VirtualTimeLoop and emulator instance), up to one per CPU
+# core, and merges the captured logs in module order.
+#
+# Usage: python3 shard.py [-j JOBS] [--logdir DIR] [TESTFILE...] [-- WARDOPTS...]
+
+from typing import List, Optional, Tuple
+
+import argparse
+import asyncio
+import glob
+import os
+import sys
+import time
+
+
+class Shard:
+    def __init__(self, path:str, wardopts:List[str]) -> None:
+        self.path = path
+        self.wardopts = wardopts
+        self.output = b''
+        self.rc:Optional[int] = None
+        self.duration = 0.0
+
+    async def run(self, sem:asyncio.Semaphore) -> None:
+        async with sem:
+            t0 = time.monotonic()
+            proc = await asyncio.create_subprocess_exec(
+                    sys.executable, '-m', 'ward', '--path', self.path, *self.wardopts,
+                    stdout=asyncio.subprocess.PIPE, stderr=asyncio.subprocess.STDOUT)
+            self.output, _ = await proc.communicate()
+            self.rc = proc.returncode
+            self.duration = time.monotonic() - t0
+
+
+def split_args(argv:List[str]) -> Tuple[List[str],List[str]]:
+    if '--' in argv:
+        i = argv.index('--')
+        return argv[:i], argv[i+1:]
+    return argv, []
+
+def main() -> int:
+    argv, wardopts = split_args(sys.argv[1:])
+    p = argparse.ArgumentParser(description='Sharded ward test runner')
+    p.add_argument('-j', '--jobs', type=int, default=os.cpu_count() or 1, help='number of parallel processes')
+    p.add_argument('--logdir', help='also write per-module logs to this directory')
+    p.add_argument('tests', nargs='*', help='test modules (default: test_*.py)')
+    args = p.parse_args(argv)
+
+    tests = args.tests or sorted(glob.glob('test_*.py'))
+    shards = [Shard(t, wardopts) for t in tests]
+
+    async def run() -> None:
+        sem = asyncio.Semaphore(max(1, args.jobs))
+        # start largest modules first to shorten the critical path
+        order = sorted(shards, key=lambda s: os.path.getsize(s.path), reverse=True)
+        await asyncio.gather(*(s.run(sem) for s in order))
+
+    t0 = time.monotonic()
+    asyncio.run(run())
+    elapsed = time.monotonic() - t0
+
+    if args.logdir:
+        os.makedirs(args.logdir, exist_ok=True)
+    out = sys.stdout.buffer
+    for s in shards:
+        out.write(f'==== {s.path} (rc={s.rc}, {s.duration:.1f}s)\n'.encode())
+        out.write(s.output)
+        if args.logdir:
+            name = os.path.splitext(os.path.basename(s.path))[0] + '.log'
+            with open(os.path.join(args.logdir, name), 'wb') as f:
+                f.write(s.output)
+    failed = [s.path for s in shards if s.rc != 0]
+    cpu = sum(s.duration for s in shards)
+    out.write(f'==== {len(shards)} modules, {len(failed)} failed, {elapsed:.1f}s elapsed'
+            f' ({cpu:.1f}s serial)\n'.encode())
+    for f in failed:
+        out.write(f'FAILED: {f}\n'.encode())
+    out.flush()
+    return 1 if failed else 0
+
+if __name__ == '__main__':
+    sys.exit(main())
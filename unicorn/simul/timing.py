@@ -0,0 +1,91 @@
+# Copyright (C) 2020-2020 Michael Kuyper. All rights reserved.
+#
+# This file is subject to the terms and conditions defined in file 'LICENSE',
+# which is part of this source code package.
+
+# MAC timing monitor for the simulated device.
+#
+# The Radio peripheral reports uplink transmissions and receive window
+# openings. The first two windows after an uplink are taken as RX1 and RX2;
+# their nominal start is the end of the uplink plus the whole number of
+# seconds closest to the measured delay. The MAC opens the receiver early to
+# absorb clock error, so a window conforms if a downlink whose preamble starts
+# at the nominal time (within the gateway tolerance of +/-20us) can still be
+# detected by the receiver model (medium.LoraMsgReceiver): detection takes
+# `symdetect` preamble symbols, which must be seen before the end of the
+# preamble and before the window times out after `minsyms` symbols.
+#
+# Device side figures (TX start delay from uplink schedule and job lateness)
+# are reported over the air by the lwtest timing command (TESTCMD_TIMING).
+
+from typing import Dict, List, Optional
+
+from dataclasses import dataclass, field
+
+from device import Simulation
+from medium import LoraMsg, Rps
+
+
+GW_TOLERANCE = 20e-6
+
+
+@dataclass
+class WindowStats:
+    count:int = 0
+    offsets:List[float] = field(default_factory=list)   # open - nominal (s)
+    margins:List[float] = field(default_factory=list)   # smaller of early/late margin (s)
+    violations:int = 0
+
+    def summary(self) -> Dict[str,float]:
+        if not self.count:
+            return { 'n': 0 }
+        return { 'n': self.count,
+                'off_min_us': min(self.offsets) * 1e6,
+                'off_max_us': max(self.offsets) * 1e6,
+                'margin_min_us': min(self.margins) * 1e6,
+                'violations': self.violations }
+
+
+class TimingMonitor:
+    SYMDETECT = 5       # medium.LoraMsgReceiver default
+
+    def __init__(self, sim:Simulation) -> None:
+        self.sim = sim
+        self.txend:Optional[float] = None
+        self.nrx = 0
+        self.windows = { 'rx1': WindowStats(), 'rx2': WindowStats() }
+        self.failures:List[str] = []
+        sim.timing = self
+
+    def close(self) -> None:
+        self.sim.timing = None
+
+    def tx_start(self, msg:LoraMsg) -> None:
+        self.txend = msg.xend
+        self.nrx = 0
+
+    def rx_open(self, t:float, freq:int, rps:int, minsyms:int) -> None:
+        if self.txend is None or self.nrx >= 2 or Rps.isFSK(rps):
+            return
+        name = ('rx1', 'rx2')[self.nrx]
+        self.nrx += 1
+        nominal = self.txend + round(t - self.txend)
+        ts = LoraMsg.symtime(rps)
+        npreamble = 8   # downlink preamble (+4.25 symbols sync)
+        # preamble must start early enough to be detected before window timeout
+        early = t + (minsyms - TimingMonitor.SYMDETECT) * ts - (nominal + GW_TOLERANCE)
+        # window must open early enough to see enough preamble symbols
+        late = (nominal - GW_TOLERANCE) + (npreamble + 4.25 - TimingMonitor.SYMDETECT) * ts - t
+        ws = self.windows[name]
+        ws.count += 1
+        ws.offsets.append(t - nominal)
+        ws.margins.append(min(early, late))
+        if early < 0 or late < 0:
+            ws.violations += 1
+            self.failures.append(f'{name} at {t:.6f}: offset={(t - nominal) * 1e6:.1f}us, '
+                    f'early margin={early * 1e6:.1f}us, late margin={late * 1e6:.1f}us '
+                    f'(freq={freq}, sf={Rps.getSf(rps)}, minsyms={minsyms})')
+
+    def report(self) -> Dict[str,Dict[str,float]]:
+        return { name: ws.summary() for name, ws in self.windows.items() }
+
@@ -19,6 +19,7 @@ class VirtualTimeLoop(asyncio.AbstractEventLoop):
         self._time:float = 0
         self._tasks:List[asyncio.TimerHandle] = list()
         self._ex:Optional[BaseException] = None
+        self.fastforwards = 0
 
     def get_debug(self) -> bool:
         return False
@@ -43,6 +44,22 @@ class VirtualTimeLoop(asyncio.AbstractEventLoop):
             self._ex = None
             asyncio.events._set_running_loop(None)
 
+    # Consume handle th and advance time to it, if it is the next (unique)
+    # event. This allows a callback to skip ahead without returning to the
+    # loop; returns False if anything else is due first.
+    def advance(self, th:asyncio.TimerHandle) -> bool:
+        while len(self._tasks) and self._tasks[0].cancelled():
+            heapq.heappop(self._tasks)
+        if not len(self._tasks) or self._tasks[0] is not th:
+            return False
+        heapq.heappop(self._tasks)
+        if len(self._tasks) and self._tasks[0].when() <= th.when():
+            heapq.heappush(self._tasks, th)
+            return False
+        self._time = max(self._time, th.when())
+        self.fastforwards += 1
+        return True
+
     def run_until_complete(self, future:Union[Generator[Any,None,T],Awaitable[T]]) -> T:
         f = asyncio.ensure_future(future, loop=self)
         self._run(f)
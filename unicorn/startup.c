@@ -30,7 +30,7 @@ void _start (boot_boottab* boottab) {
 }
 
 // Firmware header
-__attribute__((section(".fwhdr")))
+__attribute__((section(".fwhdr"), used))
 const volatile hal_fwhdr fwhdr = {
     // CRC and size will be patched by external tool
     .boot.crc           = 0,
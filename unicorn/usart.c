@@ -18,9 +18,29 @@ static struct {
         osjob_t* job;
         osjobcb_t cb;
     } rx;
+    struct {
+        unsigned char* buf;
+        int sz, rd, wr;
+        osjob_t* job;
+        osjobcb_t cb;
+    } ring;
 } fuart;
 
 void fuart_rx_cb (unsigned char* buf, int n) {
+    if( fuart.ring.buf ) {
+        // copy to ring buffer (overrun goes undetected, as with circular DMA)
+        while( n-- > 0 ) {
+            fuart.ring.buf[fuart.ring.wr] = *buf++;
+            if( ++fuart.ring.wr == fuart.ring.sz ) {
+                fuart.ring.wr = 0;
+            }
+        }
+        fuart_rx_start();
+        if( !os_jobPending(fuart.ring.job) ) {
+            os_setCallback(fuart.ring.job, fuart.ring.cb);
+        }
+        return;
+    }
     if( n > *fuart.rx.pn ) {
         n = *fuart.rx.pn;
     } else {
@@ -85,3 +105,31 @@ void usart_abort_recv (const void* port) {
 void usart_str (const void* port, const char* str) {
     ASSERT(0);
 }
+
+void usart_recv_ring (const void* port, void* buf, int sz, osjob_t* job, osjobcb_t cb) {
+    ASSERT(port == USART_FUART1);
+    fuart.ring.buf = buf;
+    fuart.ring.sz = sz;
+    fuart.ring.rd = fuart.ring.wr = 0;
+    fuart.ring.job = job;
+    fuart.ring.cb = cb;
+    fuart_rx_start();
+}
+
+int usart_ring_peek (const void* port, unsigned char** pdata) {
+    int rd = fuart.ring.rd, wr = fuart.ring.wr;
+    *pdata = fuart.ring.buf + rd;
+    return (wr >= rd) ? wr - rd : fuart.ring.sz - rd;
+}
+
+void usart_ring_consume (const void* port, int n) {
+    int rd = fuart.ring.rd + n;
+    ASSERT(rd <= fuart.ring.sz);
+    fuart.ring.rd = (rd == fuart.ring.sz) ? 0 : rd;
+}
+
+void usart_stop_ring (const void* port) {
+    fuart_rx_stop();
+    fuart.ring.buf = NULL;
+    os_clearCallback(fuart.ring.job);
+}